@@ -4,6 +4,8 @@
 #ifndef _MLUA_CORE_MAIN_H
 #define _MLUA_CORE_MAIN_H
 
+#include <stddef.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 
@@ -11,9 +13,21 @@
 extern "C" {
 #endif
 
-// Create a new Lua interpreter.
+// The default size of the private heap of interpreters, in bytes. When zero,
+// interpreters allocate from the shared heap.
+#ifndef MLUA_HEAP_SIZE
+#define MLUA_HEAP_SIZE 0
+#endif
+
+// Create a new Lua interpreter, with a private heap of MLUA_HEAP_SIZE bytes.
 lua_State* mlua_new_interpreter(void);
 
+// Create a new Lua interpreter, with a private heap of the given size. The heap
+// is allocated as a single block from the shared heap, and all allocations of
+// the interpreter are served from it, without locking. When heap_size is zero,
+// the interpreter allocates from the shared heap.
+lua_State* mlua_new_interpreter_heap(size_t heap_size);
+
 // Free a Lua interpreter.
 void mlua_close_interpreter(lua_State* ls);
 
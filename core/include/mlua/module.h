@@ -27,34 +27,278 @@ extern "C" {
 #define MLUA_SYMBOL_HASH_DEBUG 0
 #endif
 
+// Enable caching of hashed symbol lookups. When enabled, symbols resolved
+// through the perfect hash are stored into the module or class table, so that
+// further lookups are plain table accesses.
+#ifndef MLUA_SYMBOL_CACHE
+#define MLUA_SYMBOL_CACHE 0
+#endif
+
+// The maximum number of symbols cached per interpreter. Each cached symbol uses
+// a table slot in RAM.
+#ifndef MLUA_SYMBOL_CACHE_MAX
+#define MLUA_SYMBOL_CACHE_MAX 256
+#endif
+
+// Enable lazy population of unhashed symbol tables. When enabled, the symbols
+// of unhashed modules and classes are looked up by name in flash on first
+// access, and only the symbols that are actually used are stored in RAM.
+#ifndef MLUA_LAZY_SYMBOL_TABLES
+#define MLUA_LAZY_SYMBOL_TABLES 0
+#endif
+
+// Enable unchecked argument conversions in the MLUA_FUNC_* wrappers. Integer
+// and boolean arguments are converted without type checks, which saves a few
+// cycles per call, but arguments of the wrong type are silently converted to 0
+// instead of raising an error.
+#ifndef MLUA_FAST_BINDINGS
+#define MLUA_FAST_BINDINGS 0
+#endif
+
 // Enable memory allocation statistics.
 #ifndef MLUA_ALLOC_STATS
 #define MLUA_ALLOC_STATS 0
 #endif
 
+// Enable the size-class pool allocator for small Lua objects. Small blocks are
+// carved from per-interpreter pages, one free list per size class, and larger
+// blocks are allocated with realloc().
+#ifndef MLUA_ALLOC_POOL
+#define MLUA_ALLOC_POOL 0
+#endif
+
+// The number of size classes of the pool allocator. Class i holds blocks of
+// 8 * (i + 1) bytes.
+#define MLUA_ALLOC_POOL_CLASSES 16
+
+// Enable allocation profiling.
+#ifndef MLUA_ALLOC_PROFILE
+#define MLUA_ALLOC_PROFILE 0
+#endif
+
+// The number of buckets in the allocation size histogram of the allocation
+// profiler. Bucket i counts allocations of size [2^i, 2^(i+1)), and the last
+// bucket counts all larger allocations.
+#define MLUA_ALLOC_PROFILE_BUCKETS 16
+
+// The number of object types tracked by the allocation profiler: the basic Lua
+// types, upvalues and function prototypes. Type 0 counts allocations that
+// aren't objects.
+#define MLUA_ALLOC_PROFILE_TYPES (LUA_NUMTYPES + 2)
+
+// The maximum number of source locations tracked by the allocation profiler.
+#ifndef MLUA_ALLOC_PROFILE_SITES
+#define MLUA_ALLOC_PROFILE_SITES 32
+#endif
+
+// Enable tracking of the running Lua thread for the sampling profiler, and
+// thread switch notifications for the call profiler. This is set by the
+// mlua.profile module.
+#ifndef MLUA_PROFILE
+#define MLUA_PROFILE 0
+#endif
+
+// Enable profiling of module opening. When enabled, the time and memory
+// allocated by the open function of each compiled-in module are recorded, and
+// can be retrieved with module_profile().
+#ifndef MLUA_MODULE_PROFILE
+#define MLUA_MODULE_PROFILE 0
+#endif
+
+// The default garbage collection profile of interpreters. The parameters have
+// the same meaning as those of collectgarbage("incremental") and
+// collectgarbage("generational").
+#ifndef MLUA_GC_GENERATIONAL
+#define MLUA_GC_GENERATIONAL 0
+#endif
+#ifndef MLUA_GC_PAUSE
+#define MLUA_GC_PAUSE MLUA_GC_PAUSE_DEFAULT
+#endif
+#ifndef MLUA_GC_STEPMUL
+#define MLUA_GC_STEPMUL 100
+#endif
+#ifndef MLUA_GC_STEPSIZE
+#define MLUA_GC_STEPSIZE MLUA_GC_STEPSIZE_DEFAULT
+#endif
+#ifndef MLUA_GC_MINORMUL
+#define MLUA_GC_MINORMUL 20
+#endif
+#ifndef MLUA_GC_MAJORMUL
+#define MLUA_GC_MAJORMUL 100
+#endif
+
+// The target duration of garbage collection steps for the GC auto-tuner, in
+// microseconds. When zero, auto-tuning is disabled. Auto-tuning requires
+// MLUA_ALLOC_STATS.
+#ifndef MLUA_GC_TARGET_PAUSE
+#define MLUA_GC_TARGET_PAUSE 0
+#endif
+
+// The interval between adjustments of the GC auto-tuner, in microseconds.
+#ifndef MLUA_GC_TUNE_PERIOD
+#define MLUA_GC_TUNE_PERIOD 100000
+#endif
+
+// The minimum amount of memory allocated during a tuning period for the GC
+// auto-tuner to measure a step, in bytes. Periods with less activity are
+// skipped, as forcing steps would only add work.
+#ifndef MLUA_GC_TUNE_MIN_ALLOC
+#define MLUA_GC_TUNE_MIN_ALLOC 1024
+#endif
+
 // Enable thread statistics.
 #ifndef MLUA_THREAD_STATS
 #define MLUA_THREAD_STATS 0
 #endif
 
+// Enable preemption of threads that run longer than their time slice.
+#ifndef MLUA_THREAD_PREEMPT
+#define MLUA_THREAD_PREEMPT 0
+#endif
+
+// The number of buckets in the histogram of event dispatch batch sizes. Bucket
+// i counts batches of size [2^i, 2^(i+1)), and the last bucket counts all
+// larger batches.
+#define MLUA_THREAD_BATCH_BUCKETS 6
+
+// The number of buckets in the histogram of event dispatch latencies. Bucket i
+// counts latencies of [2^i, 2^(i+1)) microseconds (bucket 0 also counts 0), and
+// the last bucket counts all larger latencies.
+#define MLUA_THREAD_LATENCY_BUCKETS 20
+
+#if MLUA_ALLOC_PROFILE
+
+// A source location sampled by the allocation profiler.
+typedef struct MLuaAllocSite {
+    char source[LUA_IDSIZE];    // The short source of the function
+    int line;                   // The current line
+    uint32_t count;             // Number of samples at this location
+} MLuaAllocSite;
+
+// The state of the allocation profiler.
+typedef struct MLuaAllocProfile {
+    uint32_t sizes[MLUA_ALLOC_PROFILE_BUCKETS];     // Histogram of sizes
+    uint32_t type_count[MLUA_ALLOC_PROFILE_TYPES];  // Objects per type
+    size_t type_size[MLUA_ALLOC_PROFILE_TYPES];     // Object size per type
+    uint32_t countdown;         // Allocations until the next sample
+    uint32_t unattributed;      // Samples without a recorded location
+    MLuaAllocSite sites[MLUA_ALLOC_PROFILE_SITES];  // Sampled locations
+} MLuaAllocProfile;
+
+#endif  // MLUA_ALLOC_PROFILE
+
+// The states of the soft memory usage limit.
+enum {
+    MLUA_ALLOC_SOFT_BELOW = 0,  // The usage is below the soft limit
+    MLUA_ALLOC_SOFT_CROSSED,    // The usage has crossed the soft limit
+    MLUA_ALLOC_SOFT_ABOVE,      // The crossing has been handled
+};
+
+// The garbage collection profile of an interpreter.
+typedef struct MLuaGCProfile {
+    bool generational;      // Use the generational mode
+    uint16_t pause;         // Incremental: pause, in percent
+    uint16_t stepmul;       // Incremental: step multiplier, in percent
+    uint8_t stepsize;       // Incremental: log2 of the step size, in bytes
+    uint8_t minormul;       // Generational: minor multiplier, in percent
+    uint16_t majormul;      // Generational: major multiplier, in percent
+    uint32_t target_pause;  // Auto-tuning target step duration, or 0
+} MLuaGCProfile;
+
+// The default garbage collection profile, set from the MLUA_GC_* definitions.
+extern MLuaGCProfile const mlua_gc_default_profile;
+
 // Per-interpreter global state.
 typedef struct MLuaGlobal {
+    MLuaGCProfile gc;       // The current garbage collection profile
 #if MLUA_ALLOC_STATS
     size_t alloc_count;     // Number of memory allocation
     size_t alloc_size;      // Sum of all memory allocations
     size_t alloc_used;      // Memory currently used
     size_t alloc_peak;      // Peak memory usage
+    size_t alloc_soft_limit;    // Soft memory usage limit, or 0
+    size_t alloc_hard_limit;    // Hard memory usage limit, or 0
+    uint8_t alloc_soft_state;   // State of the soft limit (MLUA_ALLOC_SOFT_*)
+#endif
+    void* alloc_heap;       // Private heap region, or NULL
+    void* alloc_heap_free;  // Free block list of the private heap
+#if MLUA_ALLOC_POOL
+    void* alloc_pool_free[MLUA_ALLOC_POOL_CLASSES];  // Free block lists
+    void* alloc_pool_pages;                         // List of pool pages
+    size_t alloc_pool_raw;      // Raw blocks with pool sizes (failed shrinks)
+#endif
+#if MLUA_ALLOC_PROFILE
+    lua_State* alloc_running;           // The currently running Lua thread
+    MLuaAllocProfile alloc_profile;     // Allocation profiler state
+#endif
+#if MLUA_PROFILE
+    lua_State* volatile profile_running;    // The resumed Lua thread, or NULL
+    void (*profile_switch)(lua_State*, bool);   // Thread switch notification
+#endif
+#if MLUA_ALLOC_STATS && MLUA_ALLOC_POOL
+    size_t alloc_pool_size;     // Memory held in pool pages
+    size_t alloc_pool_idle;     // Memory in free pool blocks
+#endif
+#if MLUA_MODULE_PROFILE
+    int module_depth;       // Nesting depth of module opening
+#endif
+#if MLUA_SYMBOL_CACHE
+    int symbol_cache_count; // Number of cached symbol lookups
+#endif
+#if MLUA_ALLOC_STATS
+    uint64_t gc_tune_next;  // The time of the next auto-tuning adjustment
+    size_t gc_tune_size;    // The value of alloc_size at the last adjustment
+    size_t gc_tune_peak;    // The value of alloc_peak at the last adjustment
+#endif
+#if LIB_MLUA_MOD_MLUA_THREAD
+    uint32_t thread_timer_seq;          // Sequence number of the next timer
+#endif
+#if LIB_MLUA_MOD_MLUA_THREAD && MLUA_THREAD_PREEMPT
+    lua_State* thread_running;          // The thread resumed by main()
+    uint64_t thread_slice_end;          // The end of the running time slice
+    uint32_t thread_slice;              // The time slice, or zero if disabled
 #endif
 #if LIB_MLUA_MOD_MLUA_THREAD && MLUA_THREAD_STATS
     lua_Unsigned thread_dispatches;     // Number of event dispatch cycles
     lua_Unsigned thread_waits;          // Number of event waits
     lua_Unsigned thread_resumes;        // Number of thread resumes
+    lua_Unsigned thread_pool_hits;      // Number of threads reused from the pool
+    lua_Unsigned thread_pool_misses;    // Number of newly-created threads
+    lua_Unsigned thread_dispatch_batches[MLUA_THREAD_BATCH_BUCKETS];
+                                        // Histogram of event batch sizes
+    lua_Unsigned thread_latency[MLUA_THREAD_LATENCY_BUCKETS];
+                                        // Histogram of dispatch latencies
+    uint32_t thread_latency_max;        // Largest dispatch latency
+    lua_Unsigned thread_preemptions;    // Number of forced yields
+    lua_Unsigned thread_gc_steps;       // Number of idle GC steps
 #endif
 } MLuaGlobal;
 
 // Return a pointer to the per-interpreter global state.
 MLuaGlobal* mlua_global(lua_State* ls);
 
+#if MLUA_ALLOC_STATS
+// If the memory usage has crossed the soft limit, run a full garbage collection
+// and emit a warning if the usage is still above the limit. The allocator
+// cannot collect garbage itself, so this function is called by the thread
+// scheduler.
+void mlua_check_soft_limit(lua_State* ls);
+#endif
+
+// Set the garbage collection profile of an interpreter, and apply it.
+void mlua_set_gc_profile(lua_State* ls, MLuaGCProfile const* profile);
+
+// Update a garbage collection profile from the table at the given index. Fields
+// that are absent or nil keep their value. Raises an error if the table
+// contains invalid values.
+void mlua_check_gc_profile(lua_State* ls, int arg, MLuaGCProfile* profile);
+
+#if MLUA_ALLOC_STATS
+// Adjust the garbage collection parameters if auto-tuning is enabled and the
+// tuning period has elapsed. This function is called by the thread scheduler.
+void mlua_tune_gc(lua_State* ls);
+#endif
+
 // Raise an error about argument 2 specifying an undefined symbol. Can be used
 // as an __index function for strict tables.
 int mlua_index_undefined(lua_State* ls);
@@ -80,6 +324,24 @@ int mlua_log_error(lua_State* ls);
 // The name of a metatable for weak keys.
 extern char const mlua_WeakK_name[];
 
+// Argument conversions for the MLUA_FUNC_* wrappers. With MLUA_FAST_BINDINGS,
+// they skip type checks, and booleans are converted without the function call
+// of mlua_to_cbool(). Numbers without an exact integer representation convert
+// to 0 as integers, and to true as booleans.
+#if MLUA_FAST_BINDINGS
+static inline lua_Integer mlua_arg_integer(lua_State* ls, int arg) {
+    return lua_tointeger(ls, arg);
+}
+
+static inline bool mlua_arg_cbool(lua_State* ls, int arg) {
+    return lua_isinteger(ls, arg) ? lua_tointeger(ls, arg) != 0
+                                  : lua_toboolean(ls, arg);
+}
+#else
+#define mlua_arg_integer luaL_checkinteger
+#define mlua_arg_cbool mlua_to_cbool
+#endif
+
 #define MLUA_FUNC_V(wp, p, n, ...)  \
 static int wp ## n(lua_State* ls) { p ## n(__VA_ARGS__); return 0; }
 #define MLUA_FUNC_R(wp, p, n, ret, ...)  \
@@ -290,6 +552,22 @@ void mlua_new_class_hash_(lua_State* ls, char const* name, int cnt,
 // instances.
 void mlua_set_metaclass(lua_State* ls);
 
+// A constant table, with its values in flash. Dictionaries have a hash, and
+// their keys are verified on lookup. Lists have no hash, and their values are
+// indexed by position.
+typedef struct MLuaConstTable {
+    MLuaSym const* syms;
+    MLuaSymHash const* hash;
+    uint32_t cnt;
+} MLuaConstTable;
+
+// Push a read-only proxy for a constant table. The proxy is created on first
+// use and cached in the registry.
+void mlua_push_const_table(lua_State* ls, MLuaConstTable const* t);
+
+// Push the constant table referenced by a symbol value.
+void mlua_sym_push_const_table(lua_State* ls, MLuaSymVal const* value);
+
 // A module registry entry.
 typedef struct MLuaModule {
     char const* name;
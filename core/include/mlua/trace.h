@@ -0,0 +1,83 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#ifndef _MLUA_CORE_TRACE_H
+#define _MLUA_CORE_TRACE_H
+
+#include <stdint.h>
+
+#include "mlua/platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Enable the trace ring. This is set by the mlua.trace module.
+#ifndef MLUA_TRACE
+#define MLUA_TRACE 0
+#endif
+
+// The number of records in the trace ring of each core. Must be a power of 2.
+#ifndef MLUA_TRACE_SIZE
+#define MLUA_TRACE_SIZE 256
+#endif
+
+// The kinds of trace records.
+typedef enum MLuaTraceKind {
+    MLUA_TRACE_IRQ = 1,     // An IRQ handler set an event (id: exception)
+    MLUA_TRACE_EVENT,       // An event was set pending (id: event)
+    MLUA_TRACE_DISPATCH,    // Pending events were dispatched (id: count)
+    MLUA_TRACE_WAIT,        // The scheduler started waiting for events
+    MLUA_TRACE_WAKE,        // The scheduler stopped waiting for events
+    MLUA_TRACE_RESUME,      // A thread was resumed (id: thread)
+    MLUA_TRACE_SUSPEND,     // A thread yielded or terminated (id: thread)
+    MLUA_TRACE_MARK,        // A mark was recorded from Lua (id: value)
+} MLuaTraceKind;
+
+// A trace record.
+typedef struct MLuaTraceRecord {
+    uint32_t time;          // The low-order bits of mlua_ticks64()
+    uint32_t id;            // A kind-specific identifier
+    uint16_t kind;          // The record kind (MLUA_TRACE_*)
+    uint16_t core;          // The core on which the record was written
+} MLuaTraceRecord;
+
+// The trace ring of a core. The head is the total number of records written,
+// and only increases.
+typedef struct MLuaTraceRing {
+    uint32_t head;
+    MLuaTraceRecord records[MLUA_TRACE_SIZE];
+} MLuaTraceRing;
+
+#if MLUA_TRACE
+
+// The trace rings, indexed by core.
+extern MLuaTraceRing mlua_trace_rings[MLUA_PLATFORM_CORES];
+
+// Write a trace record. This can be called from any context. Each core writes
+// to its own ring, so concurrent writers are only interrupt handlers on the
+// same core, which are excluded by disabling interrupts for a few cycles.
+__attribute__((__always_inline__))
+static inline void mlua_trace(MLuaTraceKind kind, uint32_t id) {
+    uint32_t core = mlua_platform_core_num();
+    MLuaTraceRing* ring = &mlua_trace_rings[core];
+    uint32_t save = mlua_platform_irq_save();
+    MLuaTraceRecord* rec = &ring->records[ring->head++ & (MLUA_TRACE_SIZE - 1)];
+    rec->time = (uint32_t)mlua_ticks();
+    rec->id = id;
+    rec->kind = kind;
+    rec->core = core;
+    mlua_platform_irq_restore(save);
+}
+
+#else
+
+#define mlua_trace(kind, id) do {} while (0)
+
+#endif  // MLUA_TRACE
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
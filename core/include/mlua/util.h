@@ -96,6 +96,10 @@ bool mlua_get_buffer(lua_State* ls, int arg, MLuaBuffer* buf);
 // pointer and size. Also accepts a string.
 bool mlua_get_ro_buffer(lua_State* ls, int arg, MLuaBuffer* buf);
 
+// Return the element size of the buffer at the given index: the element size
+// of an mlua.Array, or "def" for other buffers.
+lua_Integer mlua_buffer_elt_size(lua_State* ls, int arg, lua_Integer def);
+
 // Read from a buffer.
 static inline void mlua_buffer_read(MLuaBuffer const* buf, lua_Unsigned off,
                                     lua_Unsigned len, void* dest) {
@@ -138,6 +142,13 @@ static inline lua_Unsigned mlua_buffer_find(
     }
 }
 
+// Check the (buffer, [off], [len]) arguments of a function reading into a
+// buffer, starting at index arg. "off" defaults to 0, and "len" defaults to the
+// remaining size of the buffer, which is required if the buffer doesn't have a
+// size. Returns the buffer, and the offset and length of the range.
+void mlua_check_buffer_range(lua_State* ls, int arg, MLuaBuffer* buf,
+                             size_t* off, size_t* len);
+
 // Push a failure and an error message, and return the number of pushed values.
 int mlua_push_fail(lua_State* ls, char const* err);
 
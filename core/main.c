@@ -3,7 +3,9 @@
 
 #include "mlua/main.h"
 
+#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -79,24 +81,384 @@ static int pmain(lua_State* ls) {
     return lua_call(ls, 0, 1), 1;
 }
 
+// A free block of a private heap. Free blocks are kept in a list sorted by
+// address, so that adjacent blocks can be merged when freeing.
+typedef struct HeapBlock {
+    struct HeapBlock* next;
+    size_t size;
+} HeapBlock;
+
+// The block size granularity and alignment of private heaps.
+#define HEAP_ALIGN sizeof(HeapBlock)
+
+static_assert((HEAP_ALIGN & (HEAP_ALIGN - 1)) == 0 && HEAP_ALIGN >= 8,
+              "invalid heap alignment");
+
+static inline size_t heap_round(size_t size) {
+    return (size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
+}
+
+// Allocate a block from the private heap, using a first-fit strategy.
+static void* heap_alloc(MLuaGlobal* g, size_t size) {
+    size = heap_round(size);
+    HeapBlock** pb = (HeapBlock**)&g->alloc_heap_free;
+    for (HeapBlock* b = *pb; b != NULL; pb = &b->next, b = *pb) {
+        if (b->size < size) continue;
+        if (b->size == size) {
+            *pb = b->next;
+        } else {
+            HeapBlock* rest = (HeapBlock*)((uint8_t*)b + size);
+            rest->next = b->next;
+            rest->size = b->size - size;
+            *pb = rest;
+        }
+        return b;
+    }
+    return NULL;
+}
+
+// Return a block to the private heap, merging it with adjacent free blocks.
+static void heap_free(MLuaGlobal* g, void* ptr, size_t size) {
+    HeapBlock* blk = ptr;
+    blk->size = heap_round(size);
+    HeapBlock* prev = NULL;
+    HeapBlock** pb = (HeapBlock**)&g->alloc_heap_free;
+    while (*pb != NULL && *pb < blk) {
+        prev = *pb;
+        pb = &prev->next;
+    }
+    HeapBlock* next = *pb;
+    blk->next = next;
+    if (next != NULL && (uint8_t*)blk + blk->size == (uint8_t*)next) {
+        blk->size += next->size;
+        blk->next = next->next;
+    }
+    if (prev != NULL && (uint8_t*)prev + prev->size == (uint8_t*)blk) {
+        prev->size += blk->size;
+        prev->next = blk->next;
+    } else {
+        *pb = blk;
+    }
+}
+
+// Reallocate a block in the private heap. Blocks are shrunk in place, and
+// grown in place if they are followed by a large enough free block.
+static void* heap_realloc(MLuaGlobal* g, void* ptr, size_t old_size,
+                          size_t new_size) {
+    if (ptr == NULL) return new_size != 0 ? heap_alloc(g, new_size) : NULL;
+    if (new_size == 0) {
+        heap_free(g, ptr, old_size);
+        return NULL;
+    }
+    size_t old = heap_round(old_size), new = heap_round(new_size);
+    if (new <= old) {
+        if (new < old) heap_free(g, (uint8_t*)ptr + new, old - new);
+        return ptr;
+    }
+    HeapBlock* end = (HeapBlock*)((uint8_t*)ptr + old);
+    size_t grow = new - old;
+    HeapBlock** pb = (HeapBlock**)&g->alloc_heap_free;
+    while (*pb != NULL && *pb < end) pb = &(*pb)->next;
+    HeapBlock* b = *pb;
+    if (b == end && b->size >= grow) {
+        if (b->size == grow) {
+            *pb = b->next;
+        } else {
+            HeapBlock* rest = (HeapBlock*)((uint8_t*)b + grow);
+            rest->next = b->next;
+            rest->size = b->size - grow;
+            *pb = rest;
+        }
+        return ptr;
+    }
+    void* res = heap_alloc(g, new_size);
+    if (res == NULL) return NULL;
+    memcpy(res, ptr, old_size);
+    heap_free(g, ptr, old_size);
+    return res;
+}
+
+// Reallocate a block, in the private heap of the interpreter if it has one,
+// or in the shared heap otherwise.
+static void* raw_realloc(MLuaGlobal* g, void* ptr, size_t old_size,
+                         size_t new_size) {
+    if (g->alloc_heap != NULL) {
+        return heap_realloc(g, ptr, old_size, new_size);
+    }
+    if (new_size != 0) return realloc(ptr, new_size);
+    free(ptr);
+    return NULL;
+}
+
+#if MLUA_ALLOC_POOL
+
+// The size of the pages allocated by the pool allocator.
+#ifndef MLUA_ALLOC_POOL_PAGE
+#define MLUA_ALLOC_POOL_PAGE 1024
+#endif
+
+// The block size granularity and alignment of the pool allocator.
+#define POOL_ALIGN 8
+
+// The largest block size served by the pool allocator.
+#define POOL_MAX (MLUA_ALLOC_POOL_CLASSES * POOL_ALIGN)
+
+static_assert(MLUA_ALLOC_POOL_PAGE >= POOL_ALIGN + POOL_MAX,
+              "MLUA_ALLOC_POOL_PAGE is too small");
+
+static inline unsigned int pool_class(size_t size) {
+    return (size - 1) / POOL_ALIGN;
+}
+
+static inline size_t pool_block_size(unsigned int cls) {
+    return (cls + 1) * POOL_ALIGN;
+}
+
+// Allocate a block of the given size class. When the free list is empty, a new
+// page is allocated and carved into blocks. The first word of each page links
+// it into the page list, so that pages can be released when the interpreter
+// is closed.
+static void* pool_alloc(MLuaGlobal* g, unsigned int cls) {
+    size_t size = pool_block_size(cls);
+    void** blk = g->alloc_pool_free[cls];
+    if (blk == NULL) {
+        uint8_t* page = raw_realloc(g, NULL, 0, MLUA_ALLOC_POOL_PAGE);
+        if (page == NULL) return NULL;
+        *(void**)page = g->alloc_pool_pages;
+        g->alloc_pool_pages = page;
+        uint8_t* end = page + MLUA_ALLOC_POOL_PAGE;
+        for (uint8_t* p = page + POOL_ALIGN; p + size <= end; p += size) {
+            *(void**)p = blk;
+            blk = (void**)p;
+#if MLUA_ALLOC_STATS
+            g->alloc_pool_idle += size;
+#endif
+        }
+#if MLUA_ALLOC_STATS
+        g->alloc_pool_size += MLUA_ALLOC_POOL_PAGE;
+#endif
+    }
+    g->alloc_pool_free[cls] = *blk;
+#if MLUA_ALLOC_STATS
+    g->alloc_pool_idle -= size;
+#endif
+    return blk;
+}
+
+// Return a block to the free list of its size class.
+static void pool_free(MLuaGlobal* g, void* ptr, unsigned int cls) {
+    *(void**)ptr = g->alloc_pool_free[cls];
+    g->alloc_pool_free[cls] = ptr;
+#if MLUA_ALLOC_STATS
+    g->alloc_pool_idle += pool_block_size(cls);
+#endif
+}
+
+// Release all pool pages.
+static void pool_release(MLuaGlobal* g) {
+    void* page = g->alloc_pool_pages;
+    while (page != NULL) {
+        void* next = *(void**)page;
+        raw_realloc(g, page, MLUA_ALLOC_POOL_PAGE, 0);
+        page = next;
+    }
+}
+
+// Return true iff the given block lies within a pool page.
+static bool pool_owns(MLuaGlobal* g, void* ptr) {
+    for (uint8_t* page = g->alloc_pool_pages; page != NULL;
+            page = *(void**)page) {
+        uint8_t* p = ptr;
+        if (p >= page && p < page + MLUA_ALLOC_POOL_PAGE) return true;
+    }
+    return false;
+}
+
+// Reallocate a block, serving small sizes from the pool and larger ones with
+// raw_realloc(). Lua always passes the size of the existing block, so blocks don't
+// need a header to find their size class.
+static void* pool_realloc(MLuaGlobal* g, void* ptr, size_t old_size,
+                          size_t new_size) {
+    bool old_pool = ptr != NULL && old_size <= POOL_MAX;
+    // A failed shrink can leave a raw block with a pool size (see below). Such
+    // blocks are rare, so only search the pool pages when some exist.
+    bool old_small_raw = old_pool && g->alloc_pool_raw != 0
+                         && !pool_owns(g, ptr);
+    if (old_small_raw) old_pool = false;
+    bool new_pool = new_size != 0 && new_size <= POOL_MAX;
+    if (!old_pool && !new_pool) {
+        void* res = raw_realloc(g, ptr, old_size, new_size);
+        if (old_small_raw && (new_size == 0 || res != NULL)) {
+            --g->alloc_pool_raw;
+        }
+        return res;
+    }
+    if (old_pool && new_pool && pool_class(old_size) == pool_class(new_size)) {
+        return ptr;
+    }
+    void* res = NULL;
+    if (new_size != 0) {
+        res = new_pool ? pool_alloc(g, pool_class(new_size))
+                       : raw_realloc(g, NULL, 0, new_size);
+        if (res == NULL) {
+            if (ptr == NULL || new_size > old_size) return NULL;
+            // Lua assumes that shrinking a block never fails. A pool block
+            // stays in place, and is returned to the free list of the smaller
+            // class when freed, which it is large enough for. A raw block is
+            // shrunk in place and stays raw.
+            if (old_pool) return ptr;
+            res = raw_realloc(g, ptr, old_size, new_size);
+            if (res == NULL) res = ptr;
+            if (!old_small_raw) ++g->alloc_pool_raw;
+            return res;
+        }
+        if (ptr != NULL) {
+            memcpy(res, ptr, old_size < new_size ? old_size : new_size);
+        }
+    }
+    if (old_pool) {
+        pool_free(g, ptr, pool_class(old_size));
+    } else {
+        raw_realloc(g, ptr, old_size, 0);
+        if (old_small_raw) --g->alloc_pool_raw;
+    }
+    return res;
+}
+
+#endif  // MLUA_ALLOC_POOL
+
+#if MLUA_ALLOC_PROFILE
+
+// The allocation period at which the allocation profiler samples the current
+// source location.
+#ifndef MLUA_ALLOC_PROFILE_PERIOD
+#define MLUA_ALLOC_PROFILE_PERIOD 64
+#endif
+
+// Record the source location of the innermost Lua function of a thread.
+static void profile_sample(MLuaGlobal* g, lua_State* ls) {
+    MLuaAllocProfile* prof = &g->alloc_profile;
+    lua_Debug ar;
+    for (int level = 0; lua_getstack(ls, level, &ar); ++level) {
+        if (!lua_getinfo(ls, "Sl", &ar) || ar.currentline < 0) continue;
+        MLuaAllocSite* free = NULL;
+        for (int i = 0; i < MLUA_ALLOC_PROFILE_SITES; ++i) {
+            MLuaAllocSite* site = &prof->sites[i];
+            if (site->count == 0) {
+                if (free == NULL) free = site;
+                continue;
+            }
+            if (site->line == ar.currentline
+                    && strcmp(site->source, ar.short_src) == 0) {
+                ++site->count;
+                return;
+            }
+        }
+        if (free == NULL) break;
+        memcpy(free->source, ar.short_src, sizeof(free->source));
+        free->line = ar.currentline;
+        free->count = 1;
+        return;
+    }
+    ++prof->unattributed;
+}
+
+// Take a pending sample. The hook runs before the next instruction of the
+// thread, where its stack is consistent, and removes itself.
+static void profile_hook(lua_State* ls, lua_Debug* ar) {
+    lua_sethook(ls, NULL, 0, 0);
+    profile_sample(mlua_global(ls), ls);
+}
+
+// Record an allocation in the profiler. When ptr is NULL, old_size is the type
+// of the object being created. The allocator can be called while the stack of
+// the running thread is being reallocated, so sampling is deferred to a count
+// hook. Threads that already have a hook aren't sampled.
+static void profile_alloc(MLuaGlobal* g, void* ptr, size_t old_size,
+                          size_t new_size) {
+    MLuaAllocProfile* prof = &g->alloc_profile;
+    unsigned int bucket = 0;
+    while (bucket < MLUA_ALLOC_PROFILE_BUCKETS - 1
+           && (new_size >> (bucket + 1)) != 0) {
+        ++bucket;
+    }
+    ++prof->sizes[bucket];
+    if (ptr == NULL) {
+        unsigned int typ = old_size < MLUA_ALLOC_PROFILE_TYPES ? old_size : 0;
+        ++prof->type_count[typ];
+        prof->type_size[typ] += new_size;
+    }
+    if (prof->countdown > 0) {
+        --prof->countdown;
+        return;
+    }
+    prof->countdown = MLUA_ALLOC_PROFILE_PERIOD - 1;
+    lua_State* ls = g->alloc_running;
+    if (ls == NULL || lua_gethook(ls) != NULL) {
+        ++prof->unattributed;
+        return;
+    }
+    lua_sethook(ls, &profile_hook, LUA_MASKCOUNT, 1);
+}
+
+#endif  // MLUA_ALLOC_PROFILE
+
+#if MLUA_ALLOC_STATS
+
+// Update the soft limit state after a change of the memory usage.
+static inline void update_soft_limit(MLuaGlobal* g) {
+    if (g->alloc_soft_limit == 0 || g->alloc_used <= g->alloc_soft_limit) {
+        g->alloc_soft_state = MLUA_ALLOC_SOFT_BELOW;
+    } else if (g->alloc_soft_state == MLUA_ALLOC_SOFT_BELOW) {
+        g->alloc_soft_state = MLUA_ALLOC_SOFT_CROSSED;
+    }
+}
+
+#endif  // MLUA_ALLOC_STATS
+
 static void* allocate(void* ud, void* ptr, size_t old_size, size_t new_size) {
-    // TODO: Record per-object stats based on old_size
     if (new_size != 0) {
-        void* res = realloc(ptr, new_size);
 #if MLUA_ALLOC_STATS
-        if (res == NULL) return NULL;
+        // Fail allocations that would exceed the hard limit. Lua then runs an
+        // emergency collection and retries, and raises a memory error if the
+        // allocation fails again. Shrinking never fails.
         MLuaGlobal* g = ud;
+        size_t cur_size = ptr != NULL ? old_size : 0;
+        if (g->alloc_hard_limit != 0 && new_size > cur_size
+                && g->alloc_used + (new_size - cur_size)
+                   > g->alloc_hard_limit) {
+            return NULL;
+        }
+#endif
+#if MLUA_ALLOC_POOL
+        void* res = pool_realloc(ud, ptr, old_size, new_size);
+#else
+        void* res = raw_realloc(ud, ptr, old_size, new_size);
+#endif
+#if MLUA_ALLOC_PROFILE
+        if (res != NULL) profile_alloc(ud, ptr, old_size, new_size);
+#endif
+#if MLUA_ALLOC_STATS
+        if (res == NULL) return NULL;
         ++g->alloc_count;
         g->alloc_size += new_size;
-        if (ptr != NULL) new_size -= old_size;
-        g->alloc_used += new_size;
+        g->alloc_used += new_size - cur_size;
         if (g->alloc_used > g->alloc_peak) g->alloc_peak = g->alloc_used;
+        update_soft_limit(g);
 #endif
         return res;
     }
-    free(ptr);
+#if MLUA_ALLOC_POOL
+    pool_realloc(ud, ptr, old_size, 0);
+#else
+    raw_realloc(ud, ptr, old_size, 0);
+#endif
 #if MLUA_ALLOC_STATS
-    ((MLuaGlobal*)ud)->alloc_used -= old_size;
+    if (ptr != NULL) {
+        MLuaGlobal* g = ud;
+        g->alloc_used -= old_size;
+        update_soft_limit(g);
+    }
 #endif
     return NULL;
 }
@@ -136,17 +498,38 @@ static void on_warn_off(void* ud, char const* msg, int cont) {
 }
 
 lua_State* mlua_new_interpreter(void) {
+    return mlua_new_interpreter_heap(MLUA_HEAP_SIZE);
+}
+
+lua_State* mlua_new_interpreter_heap(size_t heap_size) {
     MLuaGlobal* g = realloc(NULL, sizeof(MLuaGlobal));
     if (g == NULL) return NULL;
     memset(g, 0, sizeof(*g));
+    heap_size &= ~(HEAP_ALIGN - 1);
+    if (heap_size != 0) {
+        // Allocate the private heap as a single free block.
+        HeapBlock* heap = malloc(heap_size);
+        if (heap == NULL) {
+            free(g);
+            return NULL;
+        }
+        heap->next = NULL;
+        heap->size = heap_size;
+        g->alloc_heap = g->alloc_heap_free = heap;
+    }
     lua_State* ls = lua_newstate(allocate, g);
     if (ls == NULL) {
+        free(g->alloc_heap);
         free(g);
         return NULL;
     }
+#if MLUA_ALLOC_PROFILE
+    g->alloc_running = ls;
+#endif
     lua_atpanic(ls, &on_panic);
     lua_setwarnf(ls, &on_warn_off, ls);
     memset(lua_getextraspace(ls), 0, LUA_EXTRASPACE);
+    mlua_set_gc_profile(ls, &mlua_gc_default_profile);
     return ls;
 }
 
@@ -159,6 +542,10 @@ void mlua_close_interpreter(lua_State* ls) {
         mlua_writestringerror("WARNING: interpreter memory leak\n");
     }
 #endif
+#if MLUA_ALLOC_POOL
+    pool_release(ud);
+#endif
+    free(((MLuaGlobal*)ud)->alloc_heap);
     free(ud);
 }
 
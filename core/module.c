@@ -7,6 +7,8 @@
 #include <stdio.h>
 #include <string.h>
 
+#include "lgc.h"
+#include "lstate.h"
 #include "lualib.h"
 #include "mlua/util.h"
 
@@ -190,13 +192,353 @@ static int global_alloc_stats(lua_State* ls) {
     lua_pushinteger(ls, g->alloc_used);
     lua_pushinteger(ls, g->alloc_peak);
     if (reset) g->alloc_peak = g->alloc_used;
-    return 4;
+#if MLUA_ALLOC_POOL
+    lua_pushinteger(ls, g->alloc_pool_size);
+    lua_pushinteger(ls, g->alloc_pool_idle);
+#else
+    lua_pushnil(ls);
+    lua_pushnil(ls);
+#endif
+    if (g->alloc_soft_limit != 0) {
+        lua_pushinteger(ls, g->alloc_soft_limit);
+    } else {
+        lua_pushnil(ls);
+    }
+    if (g->alloc_hard_limit != 0) {
+        lua_pushinteger(ls, g->alloc_hard_limit);
+    } else {
+        lua_pushnil(ls);
+    }
+    return 8;
 #else
     (void)reset;
     return 0;
 #endif
 }
 
+#if MLUA_ALLOC_STATS
+
+static size_t check_limit(lua_State* ls, int arg) {
+    lua_Integer limit = luaL_optinteger(ls, arg, 0);
+    luaL_argcheck(ls, limit >= 0, arg, "invalid limit");
+    return limit;
+}
+
+void mlua_check_soft_limit(lua_State* ls) {
+    MLuaGlobal* g = mlua_global(ls);
+    if (g->alloc_soft_state != MLUA_ALLOC_SOFT_CROSSED) return;
+    lua_gc(ls, LUA_GCCOLLECT);
+    if (g->alloc_soft_state == MLUA_ALLOC_SOFT_BELOW) return;
+    g->alloc_soft_state = MLUA_ALLOC_SOFT_ABOVE;
+    lua_warning(ls, "memory usage above soft limit", 0);
+}
+
+#endif  // MLUA_ALLOC_STATS
+
+static int global_set_alloc_limits(lua_State* ls) {
+#if MLUA_ALLOC_STATS
+    size_t soft = check_limit(ls, 1);
+    size_t hard = check_limit(ls, 2);
+    luaL_argcheck(ls, soft == 0 || hard == 0 || soft <= hard, 1,
+                  "soft limit above hard limit");
+    MLuaGlobal* g = mlua_global(ls);
+    g->alloc_soft_limit = soft;
+    g->alloc_hard_limit = hard;
+    g->alloc_soft_state = MLUA_ALLOC_SOFT_BELOW;
+    return 0;
+#else
+    return luaL_error(ls, "allocation statistics disabled");
+#endif
+}
+
+#if MLUA_GC_TARGET_PAUSE && !MLUA_ALLOC_STATS
+#error "GC auto-tuning requires MLUA_ALLOC_STATS"
+#endif
+
+MLuaGCProfile const mlua_gc_default_profile = {
+    .generational = MLUA_GC_GENERATIONAL,
+    .pause = MLUA_GC_PAUSE,
+    .stepmul = MLUA_GC_STEPMUL,
+    .stepsize = MLUA_GC_STEPSIZE,
+    .minormul = MLUA_GC_MINORMUL,
+    .majormul = MLUA_GC_MAJORMUL,
+    .target_pause = MLUA_GC_TARGET_PAUSE,
+};
+
+// Update the mode of a profile from the state of the collector, as
+// collectgarbage() can change it.
+static void sync_gc_mode(lua_State* ls, MLuaGCProfile* p) {
+    p->generational = isdecGCmodegen(G(ls));
+}
+
+static void apply_gc_profile(lua_State* ls, MLuaGCProfile const* p) {
+    if (p->generational) {
+        lua_gc(ls, LUA_GCGEN, p->minormul, p->majormul);
+    } else {
+        lua_gc(ls, LUA_GCINC, p->pause, p->stepmul, p->stepsize);
+    }
+}
+
+void mlua_set_gc_profile(lua_State* ls, MLuaGCProfile const* profile) {
+    MLuaGlobal* g = mlua_global(ls);
+    g->gc = *profile;
+    apply_gc_profile(ls, profile);
+}
+
+static lua_Integer gc_param(lua_State* ls, int arg, char const* name,
+                            lua_Integer value, lua_Integer min,
+                            lua_Integer max) {
+    if (lua_getfield(ls, arg, name) != LUA_TNIL) {
+        int ok;
+        value = lua_tointegerx(ls, -1, &ok);
+        if (!ok || value < min || value > max) {
+            luaL_error(ls, "invalid GC %s", name);
+        }
+    }
+    lua_pop(ls, 1);
+    return value;
+}
+
+void mlua_check_gc_profile(lua_State* ls, int arg, MLuaGCProfile* profile) {
+    arg = lua_absindex(ls, arg);
+    luaL_checktype(ls, arg, LUA_TTABLE);
+    if (lua_getfield(ls, arg, "mode") != LUA_TNIL) {
+        char const* mode = lua_tostring(ls, -1);
+        if (mode != NULL && strcmp(mode, "generational") == 0) {
+            profile->generational = true;
+        } else if (mode != NULL && strcmp(mode, "incremental") == 0) {
+            profile->generational = false;
+        } else {
+            luaL_error(ls, "invalid GC mode");
+        }
+    }
+    lua_pop(ls, 1);
+    profile->pause = gc_param(ls, arg, "pause", profile->pause, 1, 1023);
+    profile->stepmul = gc_param(ls, arg, "stepmul", profile->stepmul, 1,
+                                1023);
+    profile->stepsize = gc_param(ls, arg, "stepsize", profile->stepsize, 1,
+                                 30);
+    profile->minormul = gc_param(ls, arg, "minormul", profile->minormul, 1,
+                                 100);
+    profile->majormul = gc_param(ls, arg, "majormul", profile->majormul, 1,
+                                 1023);
+    profile->target_pause = gc_param(ls, arg, "target_pause",
+                                     profile->target_pause, 0, INT32_MAX);
+#if !MLUA_ALLOC_STATS
+    if (profile->target_pause != 0) {
+        luaL_error(ls, "GC auto-tuning requires allocation statistics");
+    }
+#endif
+}
+
+#if MLUA_ALLOC_STATS
+
+// The range of step sizes used by the GC auto-tuner, as log2 of bytes.
+#define GC_TUNE_STEPSIZE_MIN 8
+#define GC_TUNE_STEPSIZE_MAX 16
+
+void mlua_tune_gc(lua_State* ls) {
+    MLuaGlobal* g = mlua_global(ls);
+    MLuaGCProfile* p = &g->gc;
+    if (p->target_pause == 0) return;
+    uint64_t now = mlua_ticks64();
+    if (now < g->gc_tune_next) return;
+    g->gc_tune_next = now + MLUA_GC_TUNE_PERIOD;
+    sync_gc_mode(ls, p);
+    size_t allocated = g->alloc_size - g->gc_tune_size;
+    g->gc_tune_size = g->alloc_size;
+    bool new_peak = g->alloc_peak != g->gc_tune_peak;
+    g->gc_tune_peak = g->alloc_peak;
+    if (allocated < MLUA_GC_TUNE_MIN_ALLOC || !lua_gc(ls, LUA_GCISRUNNING)) {
+        return;
+    }
+
+    // Measure the duration of a basic step, i.e. an incremental step or a minor
+    // collection. The work is done earlier than it would have been otherwise,
+    // but isn't wasted.
+    uint64_t start = mlua_ticks64();
+    lua_gc(ls, LUA_GCSTEP, 0);
+    uint64_t duration = mlua_ticks64() - start;
+    bool slow = duration > p->target_pause;
+    bool fast = duration < p->target_pause / 2;
+
+    // A new peak above 3/4 of the hard limit means that the collector leaves
+    // too little headroom, so it should start cycles earlier.
+    size_t hard = g->alloc_hard_limit;
+    bool tight = new_peak && hard != 0 && g->alloc_peak > hard - hard / 4;
+
+    if (p->generational) {
+        // The duration of minor collections is proportional to the amount of
+        // memory allocated since the previous one.
+        if (slow && p->minormul > 1) {
+            p->minormul -= (p->minormul + 3) / 4;
+        } else if (fast && p->minormul < 100) {
+            p->minormul += (p->minormul + 3) / 4;
+            if (p->minormul > 100) p->minormul = 100;
+        }
+        if (tight && p->majormul > 10) p->majormul -= p->majormul / 8;
+    } else {
+        if (slow && p->stepsize > GC_TUNE_STEPSIZE_MIN) {
+            --p->stepsize;
+        } else if (fast && p->stepsize < GC_TUNE_STEPSIZE_MAX) {
+            ++p->stepsize;
+        }
+        if (tight && p->pause > 100) p->pause -= 10;
+    }
+    apply_gc_profile(ls, p);
+}
+
+#endif  // MLUA_ALLOC_STATS
+
+static void set_int_field(lua_State* ls, char const* name, lua_Integer v) {
+    lua_pushinteger(ls, v);
+    lua_setfield(ls, -2, name);
+}
+
+static int global_gc_profile(lua_State* ls) {
+    MLuaGlobal* g = mlua_global(ls);
+    sync_gc_mode(ls, &g->gc);
+    if (!lua_isnoneornil(ls, 1)) {
+        MLuaGCProfile profile = g->gc;
+        mlua_check_gc_profile(ls, 1, &profile);
+        mlua_set_gc_profile(ls, &profile);
+    }
+    MLuaGCProfile const* p = &g->gc;
+    lua_createtable(ls, 0, 7);
+    lua_pushstring(ls, p->generational ? "generational" : "incremental");
+    lua_setfield(ls, -2, "mode");
+    set_int_field(ls, "pause", p->pause);
+    set_int_field(ls, "stepmul", p->stepmul);
+    set_int_field(ls, "stepsize", p->stepsize);
+    set_int_field(ls, "minormul", p->minormul);
+    set_int_field(ls, "majormul", p->majormul);
+    set_int_field(ls, "target_pause", p->target_pause);
+    return 1;
+}
+
+#if MLUA_MODULE_PROFILE
+
+// The registry key of the list of module open records.
+static char const module_profile_key[] = "mlua.module_profile";
+
+// Call the module open function in upvalue 1, and record the time it takes and
+// the memory it allocates, including nested requires. Records are appended to
+// the list in the order in which modules start opening, with their nesting
+// depth, so that they form a pre-order traversal of the require tree.
+static int profile_open(lua_State* ls) {
+    MLuaGlobal* g = mlua_global(ls);
+    int nargs = lua_gettop(ls);
+    lua_rawgetp(ls, LUA_REGISTRYINDEX, module_profile_key);
+    lua_createtable(ls, 0, 4);
+    lua_pushvalue(ls, 1);
+    lua_setfield(ls, -2, "name");
+    lua_pushinteger(ls, g->module_depth);
+    lua_setfield(ls, -2, "depth");
+    lua_pushvalue(ls, -1);
+    lua_rawseti(ls, -3, luaL_len(ls, -3) + 1);
+    lua_remove(ls, -2);  // Remove records
+    lua_insert(ls, 1);  // Move record below the arguments
+
+    ++g->module_depth;
+#if MLUA_ALLOC_STATS
+    size_t alloc = g->alloc_size;
+#endif
+    uint64_t start = mlua_ticks64();
+    lua_pushvalue(ls, lua_upvalueindex(1));
+    lua_insert(ls, 2);
+    int res = lua_pcall(ls, nargs, LUA_MULTRET, 0);
+    uint64_t time = mlua_ticks64() - start;
+#if MLUA_ALLOC_STATS
+    alloc = g->alloc_size - alloc;
+#endif
+    --g->module_depth;
+    if (res != LUA_OK) return lua_error(ls);
+
+    lua_pushinteger(ls, time);
+    lua_setfield(ls, 1, "time");
+#if MLUA_ALLOC_STATS
+    lua_pushinteger(ls, alloc);
+    lua_setfield(ls, 1, "alloc");
+#endif
+    return lua_gettop(ls) - 1;
+}
+
+#endif  // MLUA_MODULE_PROFILE
+
+static int global_module_profile(lua_State* ls) {
+#if MLUA_MODULE_PROFILE
+    bool print = mlua_to_cbool(ls, 1);
+    lua_rawgetp(ls, LUA_REGISTRYINDEX, module_profile_key);
+    if (!print) return 1;
+    lua_Integer len = luaL_len(ls, -1);
+    for (lua_Integer i = 1; i <= len; ++i) {
+        lua_rawgeti(ls, -1, i);
+        lua_getfield(ls, -1, "depth");
+        lua_getfield(ls, -2, "name");
+        lua_getfield(ls, -3, "time");
+        lua_getfield(ls, -4, "alloc");
+        lua_Integer depth = lua_tointeger(ls, -4);
+        luaL_Buffer buf;
+        luaL_buffinit(ls, &buf);
+        for (lua_Integer d = 0; d < depth; ++d) luaL_addstring(&buf, "  ");
+        lua_pushfstring(ls, "%s: %I us", lua_tostring(ls, -3),
+                        (LUAI_UACINT)lua_tointeger(ls, -2));
+        luaL_addvalue(&buf);
+        if (!lua_isnil(ls, -1)) {
+            lua_pushfstring(ls, ", %I bytes", (LUAI_UACINT)lua_tointeger(ls, -1));
+            luaL_addvalue(&buf);
+        }
+        luaL_addchar(&buf, '\n');
+        luaL_pushresult(&buf);
+        mlua_writestringerror("%s", lua_tostring(ls, -1));
+        lua_pop(ls, 6);
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+// Open the module named in upvalue 1 on first use of a lazy module proxy, and
+// forward further accesses directly to the module.
+static void lazy_open(lua_State* ls) {
+    lua_getmetatable(ls, 1);
+    mlua_require(ls, lua_tostring(ls, lua_upvalueindex(1)), true);
+    lua_pushvalue(ls, -1);
+    lua_setfield(ls, -3, "__index");
+    lua_pushvalue(ls, -1);
+    lua_setfield(ls, -3, "__newindex");
+}
+
+static int lazy___index(lua_State* ls) {
+    lazy_open(ls);
+    lua_pushvalue(ls, 2);
+    return lua_gettable(ls, -2), 1;
+}
+
+static int lazy___newindex(lua_State* ls) {
+    lazy_open(ls);
+    lua_pushvalue(ls, 2);
+    lua_pushvalue(ls, 3);
+    lua_settable(ls, -3);
+    return 0;
+}
+
+static int global_lazy_require(lua_State* ls) {
+    luaL_checkstring(ls, 1);
+    lua_settop(ls, 1);
+    lua_createtable(ls, 0, 0);
+    lua_createtable(ls, 0, 2);
+    lua_pushvalue(ls, 1);
+    lua_pushcclosure(ls, &lazy___index, 1);
+    lua_setfield(ls, -2, "__index");
+    lua_pushvalue(ls, 1);
+    lua_pushcclosure(ls, &lazy___newindex, 1);
+    lua_setfield(ls, -2, "__newindex");
+    lua_setmetatable(ls, -2);
+    return 1;
+}
+
 static int global_with_traceback(lua_State* ls) {
     lua_settop(ls, 1);
     lua_pushcclosure(ls, &mlua_with_traceback, 1);
@@ -219,43 +561,110 @@ static int global_log_error(lua_State* ls) {
     return 1;
 }
 
-static int index2(lua_State* ls) {
-    // TODO: Cache __index2 as an upvalue
-    lua_pushliteral(ls, "__index2");
-    if (lua_rawget(ls, lua_upvalueindex(1)) == LUA_TNIL) {
+// Call the __index2 metamethod cached in the given upvalue.
+static int index2(lua_State* ls, int upvalue) {
+    if (lua_isnil(ls, lua_upvalueindex(upvalue))) {
         return mlua_index_undefined(ls);
     }
+    lua_pushvalue(ls, lua_upvalueindex(upvalue));
     lua_pushvalue(ls, 1);
     lua_pushvalue(ls, 2);
     return mlua_callk(ls, 2, 1, mlua_cont_return, 1);
 }
 
+// Push the __index2 metamethod of the metatable at the given index, or nil.
+static void push_index2(lua_State* ls, int arg) {
+    lua_pushliteral(ls, "__index2");
+    lua_rawget(ls, arg < 0 ? arg - 1 : arg);
+}
+
+#if MLUA_LAZY_SYMBOL_TABLES
+
+// Look up key 2 in the unhashed symbol table given by upvalues "up" (symbols)
+// and "up + 1" (symbol count), and store the symbol into the table at index
+// "arg". Returns true iff the symbol was found, with its value at the top of
+// the stack.
+static bool lookup_symbol(lua_State* ls, int arg, int up) {
+    if (lua_type(ls, 2) != LUA_TSTRING) return false;
+    char const* key = lua_tostring(ls, 2);
+    MLuaSym const* fields = lua_touserdata(ls, lua_upvalueindex(up));
+    int cnt = (int)lua_tointeger(ls, lua_upvalueindex(up + 1));
+    for (; cnt > 0; --cnt, ++fields) {
+        char const* name = fields->name;
+        if (name[0] == '_' && name[1] != '_') ++name;
+        if (strcmp(key, name) != 0) continue;
+        MLuaSymVal const* value = &fields->value;
+        value->push(ls, value);
+        lua_pushvalue(ls, 2);
+        lua_pushvalue(ls, -2);
+        lua_rawset(ls, arg);
+        return true;
+    }
+    return false;
+}
+
+// Push the given unhashed symbol table as two upvalues for lookup_symbol().
+static void push_symbols(lua_State* ls, MLuaSym const* fields, int cnt) {
+    lua_pushlightuserdata(ls, (void*)fields);
+    lua_pushinteger(ls, cnt);
+}
+
+static int symbols___index(lua_State* ls) {
+    if (lookup_symbol(ls, 1, 1)) return 1;
+    return mlua_index_undefined(ls);
+}
+
+#endif  // MLUA_LAZY_SYMBOL_TABLES
+
 static int nohash___index(lua_State* ls) {
     // Try the lookup in the class table.
     lua_pushvalue(ls, 2);
     if (lua_rawget(ls, lua_upvalueindex(1)) != LUA_TNIL) return 1;
     lua_pop(ls, 1);
 
+#if MLUA_LAZY_SYMBOL_TABLES
+    // Try the lookup in the symbol table.
+    if (lookup_symbol(ls, lua_upvalueindex(1), 3)) return 1;
+#endif
+
     // Fall back to __index2.
-    return index2(ls);
+    return index2(ls, 2);
 }
 
 void mlua_new_module_nohash_(lua_State* ls, MLuaSym const* fields, int narr,
                              int nrec) {
+#if MLUA_LAZY_SYMBOL_TABLES
+    lua_createtable(ls, narr, 0);
+    lua_createtable(ls, 0, 1);
+    push_symbols(ls, fields, nrec);
+    lua_pushcclosure(ls, &symbols___index, 2);
+    lua_setfield(ls, -2, "__index");
+#else
     lua_createtable(ls, narr, nrec);
     set_fields_(ls, fields, nrec);
     luaL_getmetatable(ls, Strict_name);
+#endif
     lua_setmetatable(ls, -2);
 }
 
 void mlua_new_class_nohash_(lua_State* ls, char const* name,
                             MLuaSym const* fields, int cnt,
                             MLuaSym const* nh_fields, int nh_cnt) {
+#if MLUA_LAZY_SYMBOL_TABLES
+    new_metatable(ls, name, 0, nh_cnt + 1);
+#else
     new_metatable(ls, name, 0, cnt + nh_cnt + 1);
     set_fields_(ls, fields, cnt);
+#endif
     set_fields_(ls, nh_fields, nh_cnt);
     lua_pushvalue(ls, -1);
-    lua_pushcclosure(ls, &nohash___index, 1);
+    push_index2(ls, -2);
+#if MLUA_LAZY_SYMBOL_TABLES
+    push_symbols(ls, fields, cnt);
+    lua_pushcclosure(ls, &nohash___index, 4);
+#else
+    lua_pushcclosure(ls, &nohash___index, 2);
+#endif
     lua_setfield(ls, -2, "__index");
 }
 
@@ -263,7 +672,7 @@ void mlua_new_class_nohash_(lua_State* ls, char const* name,
 
 static uint32_t hash(char const* key, uint32_t seed) {
     for (;;) {
-        uint32_t c = (uint32_t)*key;
+        uint32_t c = (uint32_t)(unsigned char)*key;
         if (c == 0) return seed & 0x7fffffff;
         seed = (seed ^ c) * HASH_MULT;
         ++key;
@@ -289,14 +698,33 @@ static uint32_t perfect_hash(char const* key, MLuaSymHash const* h) {
             + lookup_g(h->g, hash(key, h->seed2) % h->ng, h->bits)) % h->nkeys;
 }
 
+#if MLUA_SYMBOL_CACHE
+
+// Store the value at the top of the stack into the symbol table for key 2, so
+// that further lookups don't go through the hash. The number of cached symbols
+// is capped, to bound RAM usage.
+static void cache_symbol(lua_State* ls) {
+    MLuaGlobal* g = mlua_global(ls);
+    if (g->symbol_cache_count >= MLUA_SYMBOL_CACHE_MAX) return;
+    ++g->symbol_cache_count;
+    lua_pushvalue(ls, 2);
+    lua_pushvalue(ls, -2);
+    lua_rawset(ls, lua_upvalueindex(1));
+}
+
+#endif  // MLUA_SYMBOL_CACHE
+
 static int hash___index(lua_State* ls) {
-    // Try the lookup in the class table.
+    // Try the lookup in the symbol table.
     lua_pushvalue(ls, 2);
     if (lua_rawget(ls, lua_upvalueindex(1)) != LUA_TNIL) return 1;
     lua_pop(ls, 1);
 
     // Try the lookup in the hash table.
     if (lua_isstring(ls, 2)) {
+#if MLUA_SYMBOL_CACHE
+        bool cache = lua_type(ls, 2) == LUA_TSTRING;
+#endif
         char const* key = lua_tostring(ls, 2);
         MLuaSymHash const* h = lua_touserdata(ls, lua_upvalueindex(2));
         MLuaSymH const* field = h->fields;
@@ -312,23 +740,30 @@ static int hash___index(lua_State* ls) {
         value->push(ls, value);
 #else
         field->push(ls, field);
+#endif
+#if MLUA_SYMBOL_CACHE
+        if (cache) cache_symbol(ls);
 #endif
         return 1;
     }
 
     // Fall back to __index2.
-    return index2(ls);
+    return index2(ls, 3);
 }
 
-static void set_hash_index(lua_State* ls, int cnt, MLuaSymHash const* h) {
+// Set the __index metamethod of the metatable at the top of the stack to
+// perform hashed lookups. Symbols are cached into the table at the given index.
+static void set_hash_index(lua_State* ls, int arg, int cnt,
+                           MLuaSymHash const* h) {
     if (cnt != h->nkeys) {
         luaL_error(ls, "key count mismatch: %d symbols, expected %d", cnt,
                    h->nkeys);
         return;
     }
-    lua_pushvalue(ls, -1);
+    lua_pushvalue(ls, arg);
     lua_pushlightuserdata(ls, (void*)h);
-    lua_pushcclosure(ls, &hash___index, 2);
+    push_index2(ls, -3);
+    lua_pushcclosure(ls, &hash___index, 3);
     lua_setfield(ls, -2, "__index");
 }
 
@@ -336,7 +771,7 @@ void mlua_new_module_hash_(lua_State* ls, int narr, int nrec,
                            MLuaSymHash const* h) {
     lua_createtable(ls, narr, 0);
     lua_createtable(ls, 0, 1);
-    set_hash_index(ls, nrec, h);
+    set_hash_index(ls, -2, nrec, h);
     lua_setmetatable(ls, -2);
 }
 
@@ -345,7 +780,7 @@ void mlua_new_class_hash_(lua_State* ls, char const* name, int cnt,
                           int nh_cnt) {
     new_metatable(ls, name, 0, nh_cnt + 1);
     set_fields_(ls, nh_fields, nh_cnt);
-    set_hash_index(ls, cnt, h);
+    set_hash_index(ls, -1, cnt, h);
 }
 
 void mlua_set_metaclass(lua_State* ls) {
@@ -358,6 +793,88 @@ void mlua_set_metaclass(lua_State* ls) {
     lua_setmetatable(ls, -2);
 }
 
+static MLuaSym const* const_lookup(lua_State* ls, MLuaConstTable const* t,
+                                   int arg) {
+    if (t->hash == NULL) {
+        int ok;
+        lua_Integer i = lua_tointegerx(ls, arg, &ok);
+        if (!ok || i < 1 || (lua_Unsigned)i > t->cnt) return NULL;
+        return &t->syms[i - 1];
+    }
+    if (lua_type(ls, arg) != LUA_TSTRING) return NULL;
+    char const* key = lua_tostring(ls, arg);
+    MLuaSym const* sym = &t->syms[perfect_hash(key, t->hash)];
+    return strcmp(key, sym->name) == 0 ? sym : NULL;
+}
+
+static int Const___index(lua_State* ls) {
+    MLuaConstTable const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    MLuaSym const* sym = const_lookup(ls, t, 2);
+    if (sym == NULL) return 0;
+    sym->value.push(ls, &sym->value);
+    return 1;
+}
+
+static int Const___newindex(lua_State* ls) {
+    return luaL_error(ls, "read-only table");
+}
+
+static int Const___len(lua_State* ls) {
+    MLuaConstTable const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    return lua_pushinteger(ls, t->hash == NULL ? t->cnt : 0), 1;
+}
+
+static int Const_next(lua_State* ls) {
+    MLuaConstTable const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    MLuaSym const* sym = t->syms;
+    if (!lua_isnil(ls, 2)) {
+        sym = const_lookup(ls, t, 2);
+        if (sym == NULL) return luaL_error(ls, "invalid key to 'next'");
+        ++sym;
+    }
+    if (sym == t->syms + t->cnt) return 0;
+    if (t->hash == NULL) {
+        lua_pushinteger(ls, sym - t->syms + 1);
+    } else {
+        lua_pushstring(ls, sym->name);
+    }
+    sym->value.push(ls, &sym->value);
+    return 2;
+}
+
+static int Const___pairs(lua_State* ls) {
+    lua_pushvalue(ls, lua_upvalueindex(1));
+    lua_pushcclosure(ls, &Const_next, 1);
+    lua_pushvalue(ls, 1);
+    return 2;
+}
+
+void mlua_push_const_table(lua_State* ls, MLuaConstTable const* t) {
+    if (lua_rawgetp(ls, LUA_REGISTRYINDEX, t) != LUA_TNIL) return;
+    lua_pop(ls, 1);
+    lua_createtable(ls, 0, 0);
+    lua_createtable(ls, 0, 4);
+    static struct {
+        char const* name;
+        lua_CFunction fn;
+    } const methods[] = {
+        {"__index", &Const___index}, {"__newindex", &Const___newindex},
+        {"__len", &Const___len}, {"__pairs", &Const___pairs},
+    };
+    for (size_t i = 0; i < MLUA_SYMCNT(methods); ++i) {
+        lua_pushlightuserdata(ls, (void*)t);
+        lua_pushcclosure(ls, methods[i].fn, 1);
+        lua_setfield(ls, -2, methods[i].name);
+    }
+    lua_setmetatable(ls, -2);
+    lua_pushvalue(ls, -1);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, t);
+}
+
+void mlua_sym_push_const_table(lua_State* ls, MLuaSymVal const* value) {
+    mlua_push_const_table(ls, value->lightuserdata);
+}
+
 extern MLuaModule const __start_mlua_module_registry[];
 extern MLuaModule const __stop_mlua_module_registry[];
 
@@ -366,7 +883,11 @@ static int Preload___index(lua_State* ls) {
     for (MLuaModule const* m = __start_mlua_module_registry;
             m != __stop_mlua_module_registry; ++m) {
         if (strcmp(m->name, name) == 0) {
-            return lua_pushcfunction(ls, m->open), 1;
+            lua_pushcfunction(ls, m->open);
+#if MLUA_MODULE_PROFILE
+            lua_pushcclosure(ls, &profile_open, 1);
+#endif
+            return 1;
         }
     }
     return 0;
@@ -499,6 +1020,10 @@ void mlua_register_modules(lua_State* ls) {
     set_fields(ls, Preload_syms);
     lua_setmetatable(ls, -2);
     lua_pop(ls, 1);  // preload
+#if MLUA_MODULE_PROFILE
+    lua_newtable(ls);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, module_profile_key);
+#endif
 
     // Remove unused searchers.
     lua_getfield(ls, -1, "searchers");
@@ -540,6 +1065,14 @@ void mlua_register_modules(lua_State* ls) {
     lua_setglobal(ls, "equal");
     lua_pushcfunction(ls, &global_alloc_stats);
     lua_setglobal(ls, "alloc_stats");
+    lua_pushcfunction(ls, &global_set_alloc_limits);
+    lua_setglobal(ls, "set_alloc_limits");
+    lua_pushcfunction(ls, &global_gc_profile);
+    lua_setglobal(ls, "gc_profile");
+    lua_pushcfunction(ls, &global_module_profile);
+    lua_setglobal(ls, "module_profile");
+    lua_pushcfunction(ls, &global_lazy_require);
+    lua_setglobal(ls, "lazy_require");
     lua_pushcfunction(ls, &global_with_traceback);
     lua_setglobal(ls, "with_traceback");
     lua_pushcfunction(ls, &global_log_error);
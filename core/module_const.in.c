@@ -0,0 +1,12 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include "mlua/module.h"
+
+#include "mlua/util.h"
+
+@TABLES@
+MLUA_OPEN_MODULE(@MOD@) {
+    mlua_push_const_table(ls, &@ROOT@);
+    return 1;
+}
@@ -23,7 +23,17 @@ extern char const data_end[];
 
 #else
 
+// Strip debug information from compiled Lua modules. This reduces flash and
+// RAM usage, but tracebacks lose line numbers and local variable names.
+#ifndef MLUA_STRIP_LUA_DEBUG
+#define MLUA_STRIP_LUA_DEBUG 0
+#endif
+
+#if MLUA_STRIP_LUA_DEBUG
+static char const data[] = {@STRIPPED@};
+#else
 static char const data[] = {@DATA@};
+#endif
 #define data_size (sizeof(data))
 
 #endif
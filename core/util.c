@@ -77,6 +77,34 @@ bool mlua_get_ro_buffer(lua_State* ls, int arg, MLuaBuffer* buf) {
     return mlua_get_buffer(ls, arg, buf);
 }
 
+lua_Integer mlua_buffer_elt_size(lua_State* ls, int arg, lua_Integer def) {
+    if (luaL_testudata(ls, arg, "mlua.Array") == NULL) return def;
+    lua_getfield(ls, arg, "size");
+    lua_pushvalue(ls, arg);
+    lua_call(ls, 1, 1);
+    lua_Integer size = lua_tointeger(ls, -1);
+    lua_pop(ls, 1);
+    return size;
+}
+
+void mlua_check_buffer_range(lua_State* ls, int arg, MLuaBuffer* buf,
+                             size_t* off, size_t* len) {
+    luaL_argexpected(ls, mlua_get_buffer(ls, arg, buf), arg, "buffer");
+    lua_Integer o = luaL_optinteger(ls, arg + 1, 0);
+    luaL_argcheck(ls, 0 <= o && (lua_Unsigned)o <= buf->size, arg + 1,
+                  "out of bounds");
+    *off = o;
+    if (lua_isnoneornil(ls, arg + 2)) {
+        luaL_argcheck(ls, buf->size != SIZE_MAX, arg + 2, "length required");
+        *len = buf->size - *off;
+        return;
+    }
+    lua_Integer l = luaL_checkinteger(ls, arg + 2);
+    luaL_argcheck(ls, 0 <= l && (lua_Unsigned)l <= buf->size - *off, arg + 2,
+                  "out of bounds");
+    *len = l;
+}
+
 int mlua_push_fail(lua_State* ls, char const* err) {
     luaL_pushfail(ls);
     lua_pushstring(ls, err);
@@ -0,0 +1,27 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#ifndef _MLUA_LIB_COMMON_MLUA_BITS_H
+#define _MLUA_LIB_COMMON_MLUA_BITS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "mlua/platform.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Update a checksum state with a block of data. The checksum is computed by
+// the platform (e.g. with the DMA sniffer) if possible, and in software
+// otherwise. For CRC-32, the state is the reflected CRC before the final
+// inversion.
+uint32_t mlua_bits_checksum(MLuaChecksum algo, void const* ptr, size_t len,
+                            uint32_t state);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
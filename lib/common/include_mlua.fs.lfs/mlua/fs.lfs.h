@@ -21,6 +21,14 @@ int mlua_fs_lfs_mount(void* fs);
 // Push a Filesystem value to the stack.
 void mlua_fs_lfs_push(lua_State* ls, void* fs);
 
+// Return true iff the value at the given index is a File.
+bool mlua_fs_lfs_is_file(lua_State* ls, int arg);
+
+// Read up to size bytes from the File at the given index into dst, without
+// going through a Lua string. Returns the number of bytes read, or a negative
+// error code.
+lua_Integer mlua_fs_lfs_read(lua_State* ls, int arg, void* dst, size_t size);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,26 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#ifndef _MLUA_LIB_COMMON_MLUA_PROFILE_H
+#define _MLUA_LIB_COMMON_MLUA_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Start a periodic timer that calls the given handler every "period"
+// microseconds, from an interrupt context. Missed periods are skipped. Returns
+// false if no timer is available. This is implemented by the platform.
+bool mlua_profile_timer_start(uint32_t period, void (*handler)(void));
+
+// Stop the periodic timer, if it is running.
+void mlua_profile_timer_stop(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -52,6 +52,16 @@ static inline int mlua_thread_yield(lua_State* ls, int nresults,
 int mlua_thread_suspend(lua_State* ls, lua_KFunction cont, lua_KContext ctx,
                         int index);
 
+// Suspend the running thread until the given deadline. The deadline is passed to
+// the scheduler directly rather than yielded as a value, so that it doesn't
+// need to be boxed.
+int mlua_thread_suspend_until(lua_State* ls, lua_KFunction cont,
+                              lua_KContext ctx, uint64_t deadline);
+
+// Suspend the running thread until the given deadline has been reached. Clears
+// the stack, and returns no values. Doesn't allocate.
+int mlua_thread_sleep_until(lua_State* ls, uint64_t deadline);
+
 // Return the given argument as a thread. Raises an error if the argument is not
 // a thread.
 lua_State* mlua_check_thread(lua_State* ls, int arg);
@@ -79,13 +89,20 @@ static inline unsigned int mlua_event_multi(MLuaEvent const** evs,
     return mask >> (bit + 1);
 }
 
-// Resume the watcher of an event. "resume" is the index where Thread.resume
-// can be found.
+// Resume the watcher of an event. Must be called from main().
 bool mlua_event_resume_watcher(lua_State* ls, MLuaEvent const* ev);
 
 // Remove the watcher of an event.
 void mlua_event_remove_watcher(lua_State* ls, MLuaEvent const* ev);
 
+// Watch an event from the running thread, so that the thread gets resumed when
+// the event triggers. This allows waiting for events that aren't laid out as an
+// array. The event must be unwatched with mlua_event_unwatch().
+void mlua_event_watch(lua_State* ls, MLuaEvent const* ev);
+
+// Stop watching an event.
+void mlua_event_unwatch(lua_State* ls, MLuaEvent const* ev);
+
 // Return true iff waiting for the given events is possible, i.e. non-blocking
 // event handling is selected and the events are enabled.
 bool mlua_event_can_wait(lua_State* ls, MLuaEvent const* evs,
@@ -122,6 +139,25 @@ void mlua_event_stop_handler(lua_State* ls, MLuaEvent const* event);
 // Pushes the event handler thread for the given event onto the stack.
 int mlua_event_push_handler_thread(lua_State* ls, MLuaEvent const* event);
 
+// A condition variable, implemented by the mlua.Condition type. Threads wait
+// for conditions from Lua, and conditions can be notified from any context.
+typedef struct MLuaCondition MLuaCondition;
+
+// Create a new condition variable and push it onto the stack. The mlua.thread
+// module must have been loaded.
+MLuaCondition* mlua_condition_new(lua_State* ls);
+
+// Return the condition variable at the given index. Raises an error if the
+// argument is not a condition variable.
+MLuaCondition* mlua_check_condition(lua_State* ls, int arg);
+
+// Notify a condition variable. This can be called from any context, including
+// IRQ handlers. One waiting thread, or all of them if "all" is true, is resumed
+// when the notification is dispatched. Notifications are coalesced until then.
+// The caller must keep the condition variable alive, e.g. by referencing it
+// from the registry.
+void mlua_condition_notify(MLuaCondition* cond, bool all);
+
 #ifdef __cplusplus
 }
 #endif
@@ -48,6 +48,15 @@ typedef struct MLuaFlash {
     size_t erase_size;
 } MLuaFlash;
 
+// Checksum algorithms that can be computed by mlua_platform_checksum(). The
+// checksum state is the raw accumulator value; for CRC-32, it is the reflected
+// CRC before the final inversion.
+typedef enum MLuaChecksum {
+    MLUA_CHECKSUM_CRC32,    // CRC-32 (IEEE 802.3), reflected
+    MLUA_CHECKSUM_CRC16,    // CRC-16-CCITT, not reflected
+    MLUA_CHECKSUM_SUM,      // 32-bit sum of bytes
+} MLuaChecksum;
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,48 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local array = require 'mlua.array'
+
+local len = 1024
+
+local function new(typ)
+    return array(typ, len):fill(1)
+end
+
+function bench_fill(b)
+    local a = new('i')
+    b:bytes(len * a:size())
+    b:reset()
+    for i = 1, b.n do a:fill(i) end
+end
+
+function bench_sum(b)
+    local a = new('i')
+    b:bytes(len * a:size())
+    b:reset()
+    for i = 1, b.n do a:sum() end
+end
+
+function bench_add(b)
+    local a, o = new('i'), new('i')
+    b:bytes(len * a:size())
+    b:reset()
+    for i = 1, b.n do a:add(o) end
+end
+
+function bench_dot_float(b)
+    local a, o = new('f'), new('f')
+    b:bytes(len * a:size())
+    b:reset()
+    for i = 1, b.n do a:dot(o) end
+end
+
+function bench_index(b)
+    local a = new('i')
+    b:reset()
+    for i = 1, b.n do
+        local v = a[1 + i % len]
+    end
+end
@@ -4,15 +4,13 @@
 #include <assert.h>
 #include <float.h>
 #include <stdalign.h>
+#include <stdint.h>
 #include <string.h>
 
 #include "mlua/int64.h"
 #include "mlua/module.h"
 #include "mlua/util.h"
 
-// TODO: Add support for views into another buffer
-// TODO: Add support for stride
-
 #define HAS_LDOUBLE (LDBL_MANT_DIG != DBL_MANT_DIG)
 #ifndef LUAL_PACKPADBYTE
 #define LUAL_PACKPADBYTE 0
@@ -21,19 +19,30 @@
 struct Array;
 typedef struct Array Array;
 
+// The value kinds for which bulk operations are specialized.
+enum {
+    KIND_NONE = 0,
+    KIND_I8, KIND_U8, KIND_I16, KIND_U16, KIND_I32, KIND_U32, KIND_I64,
+    KIND_U64, KIND_F32, KIND_F64,
+    KIND_COUNT,
+};
+
 // Vtable for Array.
 typedef struct ArrayVT {
     void (*get)(lua_State*, Array const* arr, void const*);
     void (*set)(lua_State*, Array const* arr, int, void*);
+    uint8_t kind;
 } ArrayVT;
 
-// A fixed-capacity homogeneous array.
+// A fixed-capacity homogeneous array. Views share the data of another array or
+// buffer, which they keep alive as their user value.
 struct Array {
     ArrayVT const* vt;
     void* data;
     lua_Integer len;
     lua_Integer cap;
     size_t size;
+    size_t stride;  // The distance between elements, in bytes
     uint64_t d64[0];
 };
 
@@ -49,8 +58,10 @@ static void set_uint8(lua_State* ls, Array const* arr, int arg, void* data) {
     *(uint8_t*)data = luaL_checkinteger(ls, arg);
 }
 
-static ArrayVT const vt_int8 = {.get = &get_int8, .set = &set_uint8};
-static ArrayVT const vt_uint8 = {.get = &get_uint8, .set = &set_uint8};
+static ArrayVT const vt_int8 = {.get = &get_int8, .set = &set_uint8,
+                                .kind = KIND_I8};
+static ArrayVT const vt_uint8 = {.get = &get_uint8, .set = &set_uint8,
+                                 .kind = KIND_U8};
 
 static void get_int16(lua_State* ls, Array const* arr, void const* data) {
     lua_pushinteger(ls, *(int16_t const*)data);
@@ -64,8 +75,10 @@ static void set_uint16(lua_State* ls, Array const* arr, int arg, void* data) {
     *(uint16_t*)data = luaL_checkinteger(ls, arg);
 }
 
-static ArrayVT const vt_int16 = {.get = &get_int16, .set = &set_uint16};
-static ArrayVT const vt_uint16 = {.get = &get_uint16, .set = &set_uint16};
+static ArrayVT const vt_int16 = {.get = &get_int16, .set = &set_uint16,
+                                 .kind = KIND_I16};
+static ArrayVT const vt_uint16 = {.get = &get_uint16, .set = &set_uint16,
+                                  .kind = KIND_U16};
 
 static void get_int32(lua_State* ls, Array const* arr, void const* data) {
     lua_pushinteger(ls, *(int32_t const*)data);
@@ -79,8 +92,10 @@ static void set_uint32(lua_State* ls, Array const* arr, int arg, void* data) {
     *(uint32_t*)data = luaL_checkinteger(ls, arg);
 }
 
-static ArrayVT const vt_int32 = {.get = &get_int32, .set = &set_uint32};
-static ArrayVT const vt_uint32 = {.get = &get_uint32, .set = &set_uint32};
+static ArrayVT const vt_int32 = {.get = &get_int32, .set = &set_uint32,
+                                 .kind = KIND_I32};
+static ArrayVT const vt_uint32 = {.get = &get_uint32, .set = &set_uint32,
+                                  .kind = KIND_U32};
 
 static void get_uint64(lua_State* ls, Array const* arr, void const* data) {
     mlua_push_int64(ls, *(uint64_t const*)data);
@@ -90,7 +105,10 @@ static void set_uint64(lua_State* ls, Array const* arr, int arg, void* data) {
     *(uint64_t*)data = mlua_check_int64(ls, arg);
 }
 
-static ArrayVT const vt_uint64 = {.get = &get_uint64, .set = &set_uint64};
+static ArrayVT const vt_int64 = {.get = &get_uint64, .set = &set_uint64,
+                                 .kind = KIND_I64};
+static ArrayVT const vt_uint64 = {.get = &get_uint64, .set = &set_uint64,
+                                  .kind = KIND_U64};
 
 static lua_Unsigned read_uint(lua_State* ls, uint8_t const* data, size_t size) {
     union { int dummy; char little; } const endian = {1};
@@ -165,7 +183,8 @@ static void set_float(lua_State* ls, Array const* arr, int arg, void* data) {
     *(float*)data = luaL_checknumber(ls, arg);
 }
 
-static ArrayVT const vt_float = {.get = &get_float, .set = &set_float};
+static ArrayVT const vt_float = {.get = &get_float, .set = &set_float,
+                                 .kind = KIND_F32};
 
 static void get_double(lua_State* ls, Array const* arr, void const* data) {
     lua_pushnumber(ls, *(double const*)data);
@@ -175,7 +194,8 @@ static void set_double(lua_State* ls, Array const* arr, int arg, void* data) {
     *(double*)data = luaL_checknumber(ls, arg);
 }
 
-static ArrayVT const vt_double = {.get = &get_double, .set = &set_double};
+static ArrayVT const vt_double = {.get = &get_double, .set = &set_double,
+                                  .kind = KIND_F64};
 
 #if HAS_LDOUBLE
 
@@ -236,7 +256,7 @@ static inline ArrayVT const* int_vt(size_t size) {
     case sizeof(int8_t): return &vt_int8;
     case sizeof(int16_t): return &vt_int16;
     case sizeof(int32_t): return &vt_int32;
-    case sizeof(int64_t): return &vt_uint64;
+    case sizeof(int64_t): return &vt_int64;
     }
     if (size <= sizeof(int64_t)) return &vt_int;
     return NULL;
@@ -264,9 +284,10 @@ static inline ArrayVT const* number_vt(size_t size) {
     }
 }
 
-static int array___new(lua_State* ls) {
-    lua_remove(ls, 1);  // Remove class
-    char const* fmt = luaL_checkstring(ls, 1);
+// Parse the value format at the given argument, and return the corresponding
+// vtable and value size.
+static ArrayVT const* check_format(lua_State* ls, int arg, size_t* psize) {
+    char const* fmt = luaL_checkstring(ls, arg);
     size_t size;
     ArrayVT const* vt = NULL;
     switch (*fmt++) {
@@ -296,22 +317,44 @@ static int array___new(lua_State* ls) {
         break;
     }
     if (vt == NULL || *fmt != '\0') {
-        return luaL_argerror(ls, 1, "invalid value format");
+        luaL_argerror(ls, arg, "invalid value format");
+        return NULL;
     }
-    lua_Integer len = luaL_checkinteger(ls, 2);
-    lua_Integer cap = luaL_optinteger(ls, 3, len);
-    luaL_argcheck(ls, cap >= 0 && (lua_Unsigned)cap <= SIZE_MAX / size, 3,
-                  "invalid capacity");
-    luaL_argcheck(ls, len >= 0 && len <= cap, 2, "invalid length");
+    *psize = size;
+    return vt;
+}
 
+// Return the required alignment of values with the given vtable and size.
+static inline size_t value_align(ArrayVT const* vt, size_t size) {
+    if (vt == &vt_int || vt == &vt_uint || vt == &vt_string) return 1;
+    return size;
+}
+
+// Push a new array with inline storage.
+static Array* new_array(lua_State* ls, ArrayVT const* vt, size_t size,
+                        lua_Integer len, lua_Integer cap) {
     Array* arr = lua_newuserdatauv(ls, sizeof(Array) + cap * size, 0);
     luaL_getmetatable(ls, array_name);
     lua_setmetatable(ls, -2);
     arr->vt = vt;
     arr->data = arr->d64;
     arr->size = size;
+    arr->stride = size;
     arr->len = len;
     arr->cap = cap;
+    return arr;
+}
+
+static int array___new(lua_State* ls) {
+    lua_remove(ls, 1);  // Remove class
+    size_t size;
+    ArrayVT const* vt = check_format(ls, 1, &size);
+    lua_Integer len = luaL_checkinteger(ls, 2);
+    lua_Integer cap = luaL_optinteger(ls, 3, len);
+    luaL_argcheck(ls, cap >= 0 && (lua_Unsigned)cap <= SIZE_MAX / size, 3,
+                  "invalid capacity");
+    luaL_argcheck(ls, len >= 0 && len <= cap, 2, "invalid length");
+    new_array(ls, vt, size, len, cap);
     return 1;
 }
 
@@ -351,7 +394,7 @@ static int array___eq(lua_State* ls) {
     Array const* arr1 = check_array(ls, 1);
     Array const* arr2 = check_array(ls, 2);
     if (arr1->len != arr2->len) return lua_pushboolean(ls, false), 1;
-    size_t s1 = arr1->size, s2 = arr2->size;
+    size_t s1 = arr1->stride, s2 = arr2->stride;
     void const* p1 = arr1->data;
     void const* p2 = arr2->data;
     for (lua_Integer i = arr1->len; i > 0; p1 += s1, p2 += s2, --i) {
@@ -363,11 +406,61 @@ static int array___eq(lua_State* ls) {
     return lua_pushboolean(ls, true), 1;
 }
 
+// Return a pointer to the given byte of a strided view.
+static inline uint8_t* strided_byte(Array const* arr, lua_Unsigned off) {
+    return (uint8_t*)arr->data + (off / arr->size) * arr->stride
+           + off % arr->size;
+}
+
+static void strided_read(void* ptr, lua_Unsigned off, lua_Unsigned len,
+                         void* dest) {
+    Array const* arr = ptr;
+    uint8_t* d = dest;
+    for (; len > 0; ++off, --len) *d++ = *strided_byte(arr, off);
+}
+
+static void strided_write(void* ptr, lua_Unsigned off, lua_Unsigned len,
+                          void const* src) {
+    Array const* arr = ptr;
+    uint8_t const* s = src;
+    for (; len > 0; ++off, --len) *strided_byte(arr, off) = *s++;
+}
+
+static void strided_fill(void* ptr, lua_Unsigned off, lua_Unsigned len,
+                         int value) {
+    Array const* arr = ptr;
+    for (; len > 0; ++off, --len) *strided_byte(arr, off) = value;
+}
+
+static lua_Unsigned strided_find(void* ptr, lua_Unsigned off, lua_Unsigned len,
+                                 void const* needle, lua_Unsigned needle_len) {
+    Array const* arr = ptr;
+    uint8_t const* n = needle;
+    for (; len >= needle_len; ++off, --len) {
+        lua_Unsigned i = 0;
+        while (i < needle_len && *strided_byte(arr, off + i) == n[i]) ++i;
+        if (i == needle_len) return off;
+    }
+    return LUA_MAXUNSIGNED;
+}
+
+static MLuaBufferVt const strided_vt = {
+    .read = &strided_read, .write = &strided_write, .fill = &strided_fill,
+    .find = &strided_find,
+};
+
 static int array___buffer(lua_State* ls) {
-    Array const* arr = check_array(ls, 1);
-    lua_pushlightuserdata(ls, arr->data);
+    Array* arr = check_array(ls, 1);
+    if (arr->stride == arr->size) {
+        lua_pushlightuserdata(ls, arr->data);
+        lua_pushinteger(ls, arr->cap * arr->size);
+        return 2;
+    }
+    // Strided views aren't contiguous, so they are accessed through a vtable.
+    lua_pushlightuserdata(ls, arr);
     lua_pushinteger(ls, arr->cap * arr->size);
-    return 2;
+    lua_pushlightuserdata(ls, (void*)&strided_vt);
+    return 3;
 }
 
 static int array___repr(lua_State* ls) {
@@ -376,7 +469,7 @@ static int array___repr(lua_State* ls) {
     luaL_Buffer buf;
     luaL_buffinit(ls, &buf);
     luaL_addchar(&buf, '{');
-    size_t s = arr->size;
+    size_t s = arr->stride;
     void const* p = arr->data;
     for (lua_Integer i = arr->len; i > 0; p += s, --i) {
         lua_pushvalue(ls, 2);  // repr
@@ -405,14 +498,14 @@ static int array___index2(lua_State* ls) {
     Array const* arr = check_array(ls, 1);
     lua_Integer off = check_offset(ls, 2, arr);
     if (luai_unlikely(off < 0 || off >= arr->len)) return lua_pushnil(ls), 1;
-    return arr->vt->get(ls, arr, arr->data + off * arr->size), 1;
+    return arr->vt->get(ls, arr, arr->data + off * arr->stride), 1;
 }
 
 static int array___newindex(lua_State* ls) {
     Array const* arr = check_array(ls, 1);
     lua_Integer off = check_offset(ls, 2, arr);
     luaL_argcheck(ls, off >= 0 && off < arr->cap, 2, "out of bounds");
-    arr->vt->set(ls, arr, 3, arr->data + off * arr->size);
+    arr->vt->set(ls, arr, 3, arr->data + off * arr->stride);
     return 0;
 }
 
@@ -421,7 +514,7 @@ static int pairs_iter(lua_State* ls) {
     lua_Integer off = luaL_checkinteger(ls, 2);
     if (off >= arr->len) return 0;
     lua_pushinteger(ls, luaL_intop(+, off, 1));
-    arr->vt->get(ls, arr, arr->data + off * arr->size);
+    arr->vt->get(ls, arr, arr->data + off * arr->stride);
     return 2;
 }
 
@@ -442,7 +535,7 @@ static int array_get(lua_State* ls) {
     if (luai_unlikely(!lua_checkstack(ls, len))) {
         return luaL_error(ls, "too many results");
     }
-    size_t s = arr->size;
+    size_t s = arr->stride;
     void const* p = arr->data + off * s;
     for (lua_Integer end = off + len; off < end; p += s, ++off) {
         if (luai_likely(0 <= off && off < arr->len)) {
@@ -460,7 +553,7 @@ static int array_set(lua_State* ls) {
     int top = lua_gettop(ls);
     luaL_argcheck(ls, off >= 0 && off + top - 2 <= arr->cap, 2,
                   "out of bounds");
-    size_t s = arr->size;
+    size_t s = arr->stride;
     void* p = arr->data + off * s;
     for (int i = 3; i <= top; p += s, ++i) arr->vt->set(ls, arr, i, p);
     return lua_settop(ls, 1), 1;
@@ -471,7 +564,7 @@ static int array_append(lua_State* ls) {
     int cnt = lua_gettop(ls) - 1;
     lua_Integer new_len = arr->len + cnt;
     if (new_len > arr->cap) return luaL_error(ls, "out of capacity");
-    size_t s = arr->size;
+    size_t s = arr->stride;
     void* p = arr->data + arr->len * s;
     int top = lua_gettop(ls);
     for (int i = 2; i <= top; p += s, ++i) arr->vt->set(ls, arr, i, p);
@@ -486,12 +579,522 @@ static int array_fill(lua_State* ls) {
     lua_Integer len = luaL_optinteger(ls, 4, arr->cap - off);
     if (len <= 0) len = 0;
     luaL_argcheck(ls, off + len <= arr->cap, 4, "out of bounds");
-    size_t s = arr->size;
+    size_t s = arr->stride;
     void* p = arr->data + off * s;
     for (; len > 0; p += s, --len) arr->vt->set(ls, arr, 2, p);
     return lua_settop(ls, 1), 1;
 }
 
+static int array_move(lua_State* ls) {
+    Array const* arr = check_array(ls, 1);
+    lua_Integer from = check_offset(ls, 2, arr);
+    luaL_argcheck(ls, 0 <= from && from <= arr->len, 2, "out of bounds");
+    Array* dest = lua_isnoneornil(ls, 5) ? (Array*)arr : check_array(ls, 5);
+    luaL_argcheck(ls, dest->vt == arr->vt && dest->size == arr->size, 5,
+                  "incompatible value type");
+    lua_Integer to = check_offset(ls, 3, dest);
+    lua_Integer cnt = luaL_optinteger(ls, 4, arr->len - from);
+    luaL_argcheck(ls, 0 <= cnt && cnt <= arr->len - from, 4, "out of bounds");
+    luaL_argcheck(ls, 0 <= to && to <= dest->cap - cnt, 3, "out of bounds");
+    size_t s = arr->stride, ds = dest->stride;
+    uint8_t const* src = arr->data + from * s;
+    uint8_t* dst = dest->data + to * ds;
+    if (s == arr->size && ds == arr->size) {
+        memmove(dst, src, cnt * s);
+    } else if (dst <= src) {
+        for (lua_Integer i = 0; i < cnt; ++i) {
+            memmove(dst + i * ds, src + i * s, arr->size);
+        }
+    } else {
+        for (lua_Integer i = cnt - 1; i >= 0; --i) {
+            memmove(dst + i * ds, src + i * s, arr->size);
+        }
+    }
+    if (to + cnt > dest->len) dest->len = to + cnt;
+    return lua_settop(ls, lua_isnoneornil(ls, 5) ? 1 : 5), 1;
+}
+
+static int array_copy_from(lua_State* ls) {
+    Array* arr = check_array(ls, 1);
+    MLuaBuffer buf;
+    if (!mlua_get_ro_buffer(ls, 2, &buf)) {
+        return luaL_typeerror(ls, 2, "string or buffer");
+    }
+    lua_Integer off = opt_offset(ls, 3, arr, 0);
+    luaL_argcheck(ls, 0 <= off && off <= arr->cap, 3, "out of bounds");
+    lua_Integer cnt = arr->cap - off;
+    if ((lua_Unsigned)cnt > buf.size / arr->size) cnt = buf.size / arr->size;
+    size_t size = arr->size, s = arr->stride;
+    uint8_t* dst = arr->data + off * s;
+    if (s == size) {
+        mlua_buffer_read(&buf, 0, cnt * size, dst);
+    } else {
+        for (lua_Integer i = 0; i < cnt; ++i) {
+            mlua_buffer_read(&buf, i * size, size, dst + i * s);
+        }
+    }
+    if (off + cnt > arr->len) arr->len = off + cnt;
+    return lua_pushinteger(ls, cnt), 1;
+}
+
+// Push a new view of "len" values, referencing the data of the value at the
+// given argument.
+static void new_view(lua_State* ls, int arg, ArrayVT const* vt, size_t size,
+                     void* data, lua_Integer len, size_t stride) {
+    Array* arr = lua_newuserdatauv(ls, sizeof(Array), 1);
+    luaL_getmetatable(ls, array_name);
+    lua_setmetatable(ls, -2);
+    lua_pushvalue(ls, arg);
+    lua_setiuservalue(ls, -2, 1);
+    arr->vt = vt;
+    arr->data = data;
+    arr->size = size;
+    arr->stride = len > 1 ? stride : size;
+    arr->len = len;
+    arr->cap = len;
+}
+
+// Return the number of values that fit in "cnt" values starting at "off", when
+// taking every "stride" value.
+static inline lua_Integer view_avail(lua_Integer off, lua_Integer cnt,
+                                     lua_Integer stride) {
+    return off < cnt ? (cnt - off - 1) / stride + 1 : 0;
+}
+
+static int view_buffer(lua_State* ls) {
+    MLuaBuffer buf;
+    if (!mlua_get_buffer(ls, 1, &buf)) {
+        return luaL_typeerror(ls, 1, "buffer");
+    }
+    luaL_argcheck(ls, buf.vt == NULL, 1, "unsupported buffer");
+    size_t size;
+    ArrayVT const* vt = check_format(ls, 2, &size);
+    lua_Integer off = luaL_optinteger(ls, 3, 1) - 1;
+    luaL_argcheck(ls, off >= 0, 3, "out of bounds");
+    lua_Integer stride = luaL_optinteger(ls, 5, 1);
+    luaL_argcheck(ls, stride > 0, 5, "invalid stride");
+    lua_Integer cnt = (lua_Integer)((buf.size / size) & LUA_MAXINTEGER);
+    lua_Integer avail = view_avail(off, cnt, stride);
+    lua_Integer len = buf.size == SIZE_MAX ? luaL_checkinteger(ls, 4)
+                      : luaL_optinteger(ls, 4, avail);
+    luaL_argcheck(ls, 0 <= len && len <= avail, 4, "out of bounds");
+    void* data = buf.ptr + off * size;
+    luaL_argcheck(ls, (uintptr_t)data % value_align(vt, size) == 0, 1,
+                  "misaligned buffer");
+    new_view(ls, 1, vt, size, data, len, stride * size);
+    return 1;
+}
+
+static int array_view(lua_State* ls) {
+    if (lua_type(ls, 2) == LUA_TSTRING) return view_buffer(ls);
+    Array const* arr = check_array(ls, 1);
+    lua_Integer off = opt_offset(ls, 2, arr, 0);
+    luaL_argcheck(ls, 0 <= off && off <= arr->cap, 2, "out of bounds");
+    lua_Integer stride = luaL_optinteger(ls, 4, 1);
+    luaL_argcheck(ls, stride > 0, 4, "invalid stride");
+    lua_Integer len = luaL_optinteger(ls, 3, view_avail(off, arr->len, stride));
+    luaL_argcheck(ls, 0 <= len && len <= view_avail(off, arr->cap, stride), 3,
+                  "out of bounds");
+    new_view(ls, 1, arr->vt, arr->size, arr->data + off * arr->stride, len,
+             stride * arr->stride);
+    return 1;
+}
+
+// The integer kinds, with their value type, the type of scalar operands, the
+// value range, the upper bound of the range as an int64_t and the block field
+// and category used for conversions.
+#define INT_KINDS(X) \
+    X(I8, int8_t, int64_t, INT8_MIN, INT8_MAX, INT8_MAX, i, CAT_INT) \
+    X(U8, uint8_t, int64_t, 0, UINT8_MAX, UINT8_MAX, i, CAT_INT) \
+    X(I16, int16_t, int64_t, INT16_MIN, INT16_MAX, INT16_MAX, i, CAT_INT) \
+    X(U16, uint16_t, int64_t, 0, UINT16_MAX, UINT16_MAX, i, CAT_INT) \
+    X(I32, int32_t, int64_t, INT32_MIN, INT32_MAX, INT32_MAX, i, CAT_INT) \
+    X(U32, uint32_t, int64_t, 0, UINT32_MAX, UINT32_MAX, i, CAT_INT) \
+    X(I64, int64_t, int64_t, INT64_MIN, INT64_MAX, INT64_MAX, i, CAT_INT) \
+    X(U64, uint64_t, uint64_t, 0, UINT64_MAX, INT64_MAX, u, CAT_UINT)
+
+// The floating-point kinds, with their value type.
+#define FLOAT_KINDS(X) \
+    X(F32, float) \
+    X(F64, double)
+
+// Bulk operations process values in blocks of this size when converting.
+#define BLOCK_SIZE 32
+
+// The categories of values held in a conversion block.
+enum { CAT_INT, CAT_UINT, CAT_FLOAT };
+
+typedef union Block {
+    int64_t i[BLOCK_SIZE];
+    uint64_t u[BLOCK_SIZE];
+    double d[BLOCK_SIZE];
+} Block;
+
+typedef uint8_t* Ptr;
+typedef uint8_t const* CPtr;
+
+enum { OP_ADD, OP_SUB, OP_MUL };
+
+#define BINOP_LOOP(K, T, F) \
+    if (b != NULL) { \
+        for (; len > 0; a += as, b += bs, --len) { \
+            *(T*)a = F ## _ ## K(*(T*)a, *(T const*)b, sat); \
+        } \
+    } else { \
+        for (; len > 0; a += as, --len) *(T*)a = F ## _ ## K(*(T*)a, y, sat); \
+    }
+
+#define INT_KERNELS(K, T, S, MIN, MAX, HI, F, CAT) \
+static inline T add_ ## K(T x, S y, bool sat) { \
+    T r; \
+    if (__builtin_add_overflow(x, y, &r) && sat) r = y > 0 ? MAX : MIN; \
+    return r; \
+} \
+\
+static inline T sub_ ## K(T x, S y, bool sat) { \
+    T r; \
+    if (__builtin_sub_overflow(x, y, &r) && sat) r = y > 0 ? MIN : MAX; \
+    return r; \
+} \
+\
+static inline T mul_ ## K(T x, S y, bool sat) { \
+    T r; \
+    if (__builtin_mul_overflow(x, y, &r) && sat) { \
+        r = (x < 0) != (y < 0) ? MIN : MAX; \
+    } \
+    return r; \
+} \
+\
+static inline T from_int_ ## K(int64_t v, bool sat) { \
+    if (sat && v < MIN) return MIN; \
+    if (sat && v > HI) return MAX; \
+    return (T)v; \
+} \
+\
+static inline T from_uint_ ## K(uint64_t v, bool sat) { \
+    if (sat && v > (uint64_t)MAX) return MAX; \
+    return (T)v; \
+} \
+\
+static inline T from_float_ ## K(double v) { \
+    if (v != v) return 0; \
+    if (v <= (double)MIN) return MIN; \
+    if (v >= (double)MAX) return MAX; \
+    return (T)(v < 0 ? v - 0.5 : v + 0.5); \
+} \
+\
+static void binop_ ## K(int op, bool sat, Ptr a, size_t as, CPtr b, size_t bs, \
+                        int64_t si, lua_Number sn, lua_Integer len) { \
+    S y = (S)si; \
+    switch (op) { \
+    case OP_ADD: BINOP_LOOP(K, T, add) break; \
+    case OP_SUB: BINOP_LOOP(K, T, sub) break; \
+    case OP_MUL: BINOP_LOOP(K, T, mul) break; \
+    } \
+} \
+\
+static void sum_ ## K(lua_State* ls, CPtr a, size_t as, lua_Integer len) { \
+    uint64_t acc = 0; \
+    for (; len > 0; a += as, --len) acc += (uint64_t)*(T const*)a; \
+    mlua_push_minint(ls, (int64_t)acc); \
+} \
+\
+static void dot_ ## K(lua_State* ls, CPtr a, size_t as, CPtr b, size_t bs, \
+                      lua_Integer len) { \
+    uint64_t acc = 0; \
+    for (; len > 0; a += as, b += bs, --len) { \
+        acc += (uint64_t)*(T const*)a * (uint64_t)*(T const*)b; \
+    } \
+    mlua_push_minint(ls, (int64_t)acc); \
+} \
+\
+static lua_Integer minmax_ ## K(CPtr a, size_t as, lua_Integer len, \
+                                bool max) { \
+    T best = *(T const*)a; \
+    lua_Integer bi = 0; \
+    a += as; \
+    for (lua_Integer i = 1; i < len; a += as, ++i) { \
+        T v = *(T const*)a; \
+        if (max ? v > best : v < best) best = v, bi = i; \
+    } \
+    return bi; \
+} \
+\
+static void scale_ ## K(Ptr a, size_t as, lua_Integer len, double f, \
+                        double o) { \
+    for (; len > 0; a += as, --len) { \
+        *(T*)a = from_float_ ## K((double)*(T*)a * f + o); \
+    } \
+} \
+\
+static void clamp_ ## K(Ptr a, size_t as, lua_Integer len, int64_t lo_i, \
+                        int64_t hi_i, lua_Number lo_n, lua_Number hi_n) { \
+    T lo = from_int_ ## K(lo_i, true), hi = from_int_ ## K(hi_i, true); \
+    for (; len > 0; a += as, --len) { \
+        T v = *(T*)a; \
+        *(T*)a = v < lo ? lo : v > hi ? hi : v; \
+    } \
+} \
+\
+static int load_ ## K(Block* blk, CPtr a, size_t as, int n) { \
+    for (int i = 0; i < n; a += as, ++i) blk->F[i] = *(T const*)a; \
+    return CAT; \
+} \
+\
+static void store_ ## K(Block const* blk, int cat, int n, Ptr a, size_t as, \
+                        bool sat) { \
+    switch (cat) { \
+    case CAT_INT: \
+        for (int i = 0; i < n; a += as, ++i) { \
+            *(T*)a = from_int_ ## K(blk->i[i], sat); \
+        } \
+        break; \
+    case CAT_UINT: \
+        for (int i = 0; i < n; a += as, ++i) { \
+            *(T*)a = from_uint_ ## K(blk->u[i], sat); \
+        } \
+        break; \
+    case CAT_FLOAT: \
+        for (int i = 0; i < n; a += as, ++i) { \
+            *(T*)a = from_float_ ## K(blk->d[i]); \
+        } \
+        break; \
+    } \
+}
+
+INT_KINDS(INT_KERNELS)
+
+#define FLOAT_KERNELS(K, T) \
+static inline T add_ ## K(T x, T y, bool sat) { return x + y; } \
+static inline T sub_ ## K(T x, T y, bool sat) { return x - y; } \
+static inline T mul_ ## K(T x, T y, bool sat) { return x * y; } \
+\
+static void binop_ ## K(int op, bool sat, Ptr a, size_t as, CPtr b, size_t bs, \
+                        int64_t si, lua_Number sn, lua_Integer len) { \
+    T y = (T)sn; \
+    switch (op) { \
+    case OP_ADD: BINOP_LOOP(K, T, add) break; \
+    case OP_SUB: BINOP_LOOP(K, T, sub) break; \
+    case OP_MUL: BINOP_LOOP(K, T, mul) break; \
+    } \
+} \
+\
+static void sum_ ## K(lua_State* ls, CPtr a, size_t as, lua_Integer len) { \
+    lua_Number acc = 0; \
+    for (; len > 0; a += as, --len) acc += (lua_Number)*(T const*)a; \
+    lua_pushnumber(ls, acc); \
+} \
+\
+static void dot_ ## K(lua_State* ls, CPtr a, size_t as, CPtr b, size_t bs, \
+                      lua_Integer len) { \
+    lua_Number acc = 0; \
+    for (; len > 0; a += as, b += bs, --len) { \
+        acc += (lua_Number)*(T const*)a * (lua_Number)*(T const*)b; \
+    } \
+    lua_pushnumber(ls, acc); \
+} \
+\
+static lua_Integer minmax_ ## K(CPtr a, size_t as, lua_Integer len, \
+                                bool max) { \
+    T best = *(T const*)a; \
+    lua_Integer bi = 0; \
+    a += as; \
+    for (lua_Integer i = 1; i < len; a += as, ++i) { \
+        T v = *(T const*)a; \
+        if (max ? v > best : v < best) best = v, bi = i; \
+    } \
+    return bi; \
+} \
+\
+static void scale_ ## K(Ptr a, size_t as, lua_Integer len, double f, \
+                        double o) { \
+    T tf = (T)f, to = (T)o; \
+    for (; len > 0; a += as, --len) *(T*)a = *(T*)a * tf + to; \
+} \
+\
+static void clamp_ ## K(Ptr a, size_t as, lua_Integer len, int64_t lo_i, \
+                        int64_t hi_i, lua_Number lo_n, lua_Number hi_n) { \
+    T lo = (T)lo_n, hi = (T)hi_n; \
+    for (; len > 0; a += as, --len) { \
+        T v = *(T*)a; \
+        *(T*)a = v < lo ? lo : v > hi ? hi : v; \
+    } \
+} \
+\
+static int load_ ## K(Block* blk, CPtr a, size_t as, int n) { \
+    for (int i = 0; i < n; a += as, ++i) blk->d[i] = (double)*(T const*)a; \
+    return CAT_FLOAT; \
+} \
+\
+static void store_ ## K(Block const* blk, int cat, int n, Ptr a, size_t as, \
+                        bool sat) { \
+    switch (cat) { \
+    case CAT_INT: \
+        for (int i = 0; i < n; a += as, ++i) *(T*)a = (T)blk->i[i]; \
+        break; \
+    case CAT_UINT: \
+        for (int i = 0; i < n; a += as, ++i) *(T*)a = (T)blk->u[i]; \
+        break; \
+    case CAT_FLOAT: \
+        for (int i = 0; i < n; a += as, ++i) *(T*)a = (T)blk->d[i]; \
+        break; \
+    } \
+}
+
+FLOAT_KINDS(FLOAT_KERNELS)
+
+// The bulk operation kernels, indexed by value kind.
+typedef struct Kernels {
+    void (*binop)(int, bool, Ptr, size_t, CPtr, size_t, int64_t, lua_Number,
+                  lua_Integer);
+    void (*sum)(lua_State*, CPtr, size_t, lua_Integer);
+    void (*dot)(lua_State*, CPtr, size_t, CPtr, size_t, lua_Integer);
+    lua_Integer (*minmax)(CPtr, size_t, lua_Integer, bool);
+    void (*scale)(Ptr, size_t, lua_Integer, double, double);
+    void (*clamp)(Ptr, size_t, lua_Integer, int64_t, int64_t, lua_Number,
+                  lua_Number);
+    int (*load)(Block*, CPtr, size_t, int);
+    void (*store)(Block const*, int, int, Ptr, size_t, bool);
+} Kernels;
+
+#define KERNELS_ENTRY(K, ...) [KIND_ ## K] = { \
+    .binop = &binop_ ## K, .sum = &sum_ ## K, .dot = &dot_ ## K, \
+    .minmax = &minmax_ ## K, .scale = &scale_ ## K, .clamp = &clamp_ ## K, \
+    .load = &load_ ## K, .store = &store_ ## K, \
+},
+
+static Kernels const kernels[KIND_COUNT] = {
+    INT_KINDS(KERNELS_ENTRY)
+    FLOAT_KINDS(KERNELS_ENTRY)
+};
+
+static inline bool is_float_kind(int kind) {
+    return kind == KIND_F32 || kind == KIND_F64;
+}
+
+// Check that the given argument is an array supporting bulk operations.
+static Array* check_kernels(lua_State* ls, int arg, Kernels const** k) {
+    Array* arr = check_array(ls, arg);
+    luaL_argcheck(ls, arr->vt->kind != KIND_NONE, arg,
+                  "unsupported value type");
+    *k = &kernels[arr->vt->kind];
+    return arr;
+}
+
+// Check that the given argument is an array compatible with "arr".
+static Array const* check_operand(lua_State* ls, int arg, Array const* arr) {
+    Array const* other = check_array(ls, arg);
+    luaL_argcheck(ls, other->vt->kind == arr->vt->kind, arg,
+                  "incompatible value type");
+    luaL_argcheck(ls, other->len == arr->len, arg, "length mismatch");
+    return other;
+}
+
+static int array_sum(lua_State* ls) {
+    Kernels const* k;
+    Array const* arr = check_kernels(ls, 1, &k);
+    k->sum(ls, arr->data, arr->stride, arr->len);
+    return 1;
+}
+
+static int minmax(lua_State* ls, bool max) {
+    Kernels const* k;
+    Array const* arr = check_kernels(ls, 1, &k);
+    if (arr->len == 0) return 0;
+    lua_Integer i = k->minmax(arr->data, arr->stride, arr->len, max);
+    arr->vt->get(ls, arr, arr->data + i * arr->stride);
+    lua_pushinteger(ls, i + 1);
+    return 2;
+}
+
+static int array_min(lua_State* ls) { return minmax(ls, false); }
+static int array_max(lua_State* ls) { return minmax(ls, true); }
+
+static int binop(lua_State* ls, int op) {
+    Kernels const* k;
+    Array* arr = check_kernels(ls, 1, &k);
+    bool sat = mlua_to_cbool(ls, 3);
+    CPtr b = NULL;
+    size_t bs = 0;
+    int64_t si = 0;
+    lua_Number sn = 0;
+    if (luaL_testudata(ls, 2, array_name) != NULL) {
+        Array const* other = check_operand(ls, 2, arr);
+        b = other->data;
+        bs = other->stride;
+    } else if (is_float_kind(arr->vt->kind)) {
+        sn = luaL_checknumber(ls, 2);
+    } else {
+        si = mlua_check_int64(ls, 2);
+    }
+    k->binop(op, sat, arr->data, arr->stride, b, bs, si, sn, arr->len);
+    return lua_settop(ls, 1), 1;
+}
+
+static int array_add(lua_State* ls) { return binop(ls, OP_ADD); }
+static int array_sub(lua_State* ls) { return binop(ls, OP_SUB); }
+static int array_mul(lua_State* ls) { return binop(ls, OP_MUL); }
+
+static int array_dot(lua_State* ls) {
+    Kernels const* k;
+    Array const* arr = check_kernels(ls, 1, &k);
+    Array const* other = check_operand(ls, 2, arr);
+    k->dot(ls, arr->data, arr->stride, other->data, other->stride, arr->len);
+    return 1;
+}
+
+static int array_scale(lua_State* ls) {
+    Kernels const* k;
+    Array* arr = check_kernels(ls, 1, &k);
+    double f = (double)luaL_checknumber(ls, 2);
+    double o = (double)luaL_optnumber(ls, 3, 0);
+    k->scale(arr->data, arr->stride, arr->len, f, o);
+    return lua_settop(ls, 1), 1;
+}
+
+static int array_clamp(lua_State* ls) {
+    Kernels const* k;
+    Array* arr = check_kernels(ls, 1, &k);
+    int64_t lo_i = 0, hi_i = 0;
+    lua_Number lo_n = 0, hi_n = 0;
+    if (is_float_kind(arr->vt->kind)) {
+        lo_n = luaL_checknumber(ls, 2);
+        hi_n = luaL_checknumber(ls, 3);
+        luaL_argcheck(ls, lo_n <= hi_n, 3, "invalid range");
+    } else {
+        lo_i = mlua_check_int64(ls, 2);
+        hi_i = mlua_check_int64(ls, 3);
+        luaL_argcheck(ls, lo_i <= hi_i, 3, "invalid range");
+    }
+    k->clamp(arr->data, arr->stride, arr->len, lo_i, hi_i, lo_n, hi_n);
+    return lua_settop(ls, 1), 1;
+}
+
+static int array_convert(lua_State* ls) {
+    Kernels const* k;
+    Array const* arr = check_kernels(ls, 1, &k);
+    size_t size;
+    ArrayVT const* vt = check_format(ls, 2, &size);
+    luaL_argcheck(ls, vt->kind != KIND_NONE, 2, "unsupported value type");
+    bool sat = mlua_to_cbool(ls, 3);
+    luaL_argcheck(ls, (lua_Unsigned)arr->len <= SIZE_MAX / size, 1,
+                  "array too large");
+    Array* res = new_array(ls, vt, size, arr->len, arr->len);
+    Kernels const* rk = &kernels[vt->kind];
+    CPtr a = arr->data;
+    Ptr r = res->data;
+    Block blk;
+    for (lua_Integer len = arr->len; len > 0;) {
+        int n = len < BLOCK_SIZE ? (int)len : BLOCK_SIZE;
+        int cat = k->load(&blk, a, arr->stride, n);
+        rk->store(&blk, cat, n, r, res->stride, sat);
+        a += n * arr->stride;
+        r += n * res->stride;
+        len -= n;
+    }
+    return 1;
+}
+
 MLUA_SYMBOLS(array_syms) = {
     MLUA_SYM_F(size, array_),
     MLUA_SYM_F(len, array_),
@@ -501,7 +1104,19 @@ MLUA_SYMBOLS(array_syms) = {
     MLUA_SYM_F(set, array_),
     MLUA_SYM_F(append, array_),
     MLUA_SYM_F(fill, array_),
-    // TODO: MLUA_SYM_F(move, array_),
+    MLUA_SYM_F(view, array_),
+    MLUA_SYM_F(sum, array_),
+    MLUA_SYM_F(min, array_),
+    MLUA_SYM_F(max, array_),
+    MLUA_SYM_F(add, array_),
+    MLUA_SYM_F(sub, array_),
+    MLUA_SYM_F(mul, array_),
+    MLUA_SYM_F(dot, array_),
+    MLUA_SYM_F(scale, array_),
+    MLUA_SYM_F(clamp, array_),
+    MLUA_SYM_F(convert, array_),
+    MLUA_SYM_F(move, array_),
+    MLUA_SYM_F(copy_from, array_),
 };
 
 MLUA_SYMBOLS_NOHASH(array_syms_nh) = {
@@ -350,3 +350,201 @@ function test_fill(t)
         else exp:raises("out of bounds") end
     end
 end
+
+function test_view(t)
+    local a = array('j', 6, 8):set(1, 1, 2, 3, 4, 5, 6)
+    for _, test in ipairs{
+        {{}, {1, 2, 3, 4, 5, 6}},
+        {{3}, {3, 4, 5, 6}},
+        {{-2}, {5, 6}},
+        {{2, 3}, {2, 3, 4}},
+        {{1, 3, 2}, {1, 3, 5}},
+        {{2, 3, 2}, {2, 4, 6}},
+        {{7}, {}},
+        {{1, 9}, nil},
+        {{2, 5, 2}, nil},
+        {{1, 1, 0}, "invalid stride"},
+    } do
+        local args, want = table.unpack(test)
+        local exp = t:expect(t.expr(a):view(table.unpack(args)))
+        if type(want) == 'table' then
+            exp:eq(array('j', #want):set(1, table.unpack(want)))
+        else exp:raises(want or "out of bounds") end
+    end
+
+    -- Views share the data of their parent.
+    local v = a:view(2, 3, 2)
+    v[1], v[3] = 20, 60
+    t:expect(a):eq(array('j', 6):set(1, 1, 20, 3, 4, 5, 60))
+    a[4] = 40
+    t:expect(v):eq(array('j', 3):set(1, 20, 40, 60))
+    t:expect(t.expr(v):view(2)):eq(array('j', 2):set(1, 40, 60))
+    t:expect(t.expr(v):append(7)):raises("out of capacity")
+
+    -- Views keep their parent alive.
+    v = array('j', 4):set(1, 1, 2, 3, 4):view(2, 2)
+    collectgarbage()
+    collectgarbage()
+    t:expect(v):eq(array('j', 2):set(1, 2, 3))
+end
+
+function test_view_buffer(t)
+    local a = array('h', 4):set(1, 1, 2, -1, 4)
+    t:expect(t.expr(array).view(a, 'H'))
+        :eq(array('H', 4):set(1, 1, 2, 65535, 4))
+    t:expect(t.expr(array).view(a, 'h', 2, 2)):eq(array('h', 2):set(1, 2, -1))
+    t:expect(t.expr(array).view(a, 'h', 2, nil, 2))
+        :eq(array('h', 2):set(1, 2, 4))
+    t:expect(t.expr(array).view(a, 'I4', 1, 1))
+        :eq(array('I4', 1):set(1, 0x20001))
+    t:expect(t.expr(array).view(a, 'h', 0)):raises("out of bounds")
+    t:expect(t.expr(array).view(a, 'h', 1, 5)):raises("out of bounds")
+    t:expect(t.expr(array).view({}, 'h')):raises("buffer expected")
+
+    local buf = mem.alloc(8)
+    mem.write(buf, 'abcdefgh')
+    local v = array.view(buf, 'c2', 2, 2)
+    t:expect(t.mexpr(v):get(1, 2)):eq{'cd', 'ef'}
+
+    -- Strided views implement the buffer protocol through a vtable.
+    v = array('c1', 8):set(1, 'a', 'b', 'c', 'd', 'e', 'f', 'g', 'h')
+        :view(1, 4, 2)
+    t:expect(t.expr(mem).read(v)):eq('aceg')
+    mem.write(v, 'XY', 1)
+    t:expect(t.mexpr(v):get(1, 4)):eq{'a', 'X', 'Y', 'g'}
+end
+
+function test_sum_min_max(t)
+    for _, typ in ipairs{'b', 'B', 'h', 'H', 'i', 'I', 'j', 'J', 'f', 'd'} do
+        t:context({type = typ})
+        local a = array(typ, 5):set(1, 3, 1, 4, 1, 5)
+        t:expect(t.expr(a):sum()):eq(14)
+        t:expect(t.mexpr(a):min()):eq{1, 2}
+        t:expect(t.mexpr(a):max()):eq{5, 5}
+        local v = a:view(2, nil, 2)
+        t:expect(t.expr(v):sum()):eq(2)
+        t:expect(t.mexpr(array(typ, 0)):min()):eq{}
+    end
+    t:expect(t.expr(array('b', 3):set(1, 100, 100, 100)):sum()):eq(300)
+    t:expect(t.expr(array('i3', 1)):sum()):raises("unsupported value type")
+    t:expect(t.expr(array('c2', 1)):sum()):raises("unsupported value type")
+end
+
+function test_binops(t)
+    for _, test in ipairs{
+        {'b', 'add', {100, -100, 1}, {50}, {-106, -50, 51}},
+        {'b', 'add', {100, -100, 1}, {50, true}, {127, -50, 51}},
+        {'b', 'sub', {100, -100, 1}, {50, true}, {50, -128, -49}},
+        {'b', 'mul', {100, -100, 1}, {2, true}, {127, -128, 2}},
+        {'B', 'add', {200, 10, 0}, {100, true}, {255, 110, 100}},
+        {'B', 'sub', {200, 10, 0}, {100, true}, {100, 0, 0}},
+        {'B', 'sub', {200, 10, 0}, {100}, {100, 166, 156}},
+        {'h', 'mul', {300, -300, 2}, {200, true}, {32767, -32768, 400}},
+        {'i', 'add', {1, 2, 3}, {-1000}, {-999, -998, -997}},
+        {'f', 'mul', {1.5, -2, 4}, {2}, {3, -4, 8}},
+        {'d', 'sub', {1.5, -2, 4}, {0.5}, {1, -2.5, 3.5}},
+    } do
+        local typ, op, values, args, want = table.unpack(test)
+        t:context({type = typ, op = op, args = args})
+        local a = array(typ, #values):set(1, table.unpack(values))
+        t:expect(a[op](a, table.unpack(args))):label("result")
+            :eq(array(typ, #want):set(1, table.unpack(want)))
+    end
+
+    local a = array('h', 3):set(1, 1, 2, 30000)
+    local b = array('h', 3):set(1, 10, 20, 30000)
+    t:expect(t.expr(a):add(b, true)):eq(array('h', 3):set(1, 11, 22, 32767))
+    t:expect(t.expr(a):add(array('i', 3))):raises("incompatible value type")
+    t:expect(t.expr(a):add(array('h', 2))):raises("length mismatch")
+
+    -- Operations apply to views.
+    local s = array('h', 6):set(1, 1, 2, 3, 4, 5, 6)
+    s:view(1, nil, 2):mul(10)
+    t:expect(s):eq(array('h', 6):set(1, 10, 2, 30, 4, 50, 6))
+end
+
+function test_dot_scale_clamp(t)
+    local a = array('h', 3):set(1, 1, -2, 3)
+    local b = array('h', 3):set(1, 4, 5, -6)
+    t:expect(t.expr(a):dot(b)):eq(-24)
+    local f = array('f', 2):set(1, 0.5, 2)
+    t:expect(t.expr(f):dot(array('f', 2):set(1, 4, 3))):eq(8)
+    t:expect(t.expr(array('h', 3):set(1, 100, -100, 1000)):scale(0.5, 1))
+        :eq(array('h', 3):set(1, 51, -49, 501))
+    t:expect(t.expr(array('b', 3):set(1, 100, -100, 3)):scale(1.5))
+        :eq(array('b', 3):set(1, 127, -128, 5))
+    t:expect(t.expr(array('d', 2):set(1, 1, 2)):scale(2, -1))
+        :eq(array('d', 2):set(1, 1, 3))
+    t:expect(t.expr(array('i', 4):set(1, -5, 0, 5, 10)):clamp(0, 6))
+        :eq(array('i', 4):set(1, 0, 0, 5, 6))
+    t:expect(t.expr(array('B', 2):set(1, 0, 255)):clamp(-10, 1000))
+        :eq(array('B', 2):set(1, 0, 255))
+    t:expect(t.expr(array('f', 2):set(1, -1.5, 1.5)):clamp(-1, 1))
+        :eq(array('f', 2):set(1, -1, 1))
+    t:expect(t.expr(array('i', 1)):clamp(1, 0)):raises("invalid range")
+end
+
+function test_convert(t)
+    for _, test in ipairs{
+        {'h', {1, -2, 300}, 'b', false, {1, -2, 44}},
+        {'h', {1, -2, 300}, 'b', true, {1, -2, 127}},
+        {'h', {1, -2, 300}, 'B', true, {1, 0, 255}},
+        {'h', {1, -2, 300}, 'f', false, {1, -2, 300}},
+        {'f', {1.4, -2.5, 1e6}, 'h', false, {1, -3, 32767}},
+        {'d', {0.5, -0.5, 2.25}, 'f', false, {0.5, -0.5, 2.25}},
+        {'B', {1, 2, 255}, 'j', false, {1, 2, 255}},
+    } do
+        local from, values, to, sat, want = table.unpack(test)
+        t:context({from = from, to = to, saturate = sat})
+        local a = array(from, #values):set(1, table.unpack(values))
+        t:expect(t.expr(a):convert(to, sat))
+            :eq(array(to, #want):set(1, table.unpack(want)))
+    end
+    t:expect(t.expr(array('h', 1)):convert('c2'))
+        :raises("unsupported value type")
+end
+
+function test_move(t)
+    for _, test in ipairs{
+        {{2, 1}, {2, 3, 4, 5, 5}},
+        {{1, 2, 3}, {1, 1, 2, 3, 5}},
+        {{4, 1, 2}, {4, 5, 3, 4, 5}},
+        {{1, 4, 2}, {1, 2, 3, 1, 2}},
+        {{1, 6, 2}, {1, 2, 3, 4, 5, 1, 2}},
+        {{1, 1, 0}, {1, 2, 3, 4, 5}},
+        {{6, 1}, {1, 2, 3, 4, 5}},
+        {{7, 1}, nil},
+        {{1, 8, 2}, nil},
+        {{2, 1, 5}, nil},
+    } do
+        local args, want = table.unpack(test)
+        local a = array('j', 5, 8):set(1, 1, 2, 3, 4, 5)
+        local exp = t:expect(t.expr(a):move(table.unpack(args)))
+        if want then exp:eq(array('j', #want):set(1, table.unpack(want)))
+        else exp:raises("out of bounds") end
+    end
+
+    -- Move to another array, and through strided views.
+    local a = array('h', 4):set(1, 1, 2, 3, 4)
+    local b = array('h', 0, 4)
+    t:expect(t.expr(a):move(3, 1, 2, b)):eq(array('h', 2):set(1, 3, 4))
+    t:expect(t.expr(a):move(1, 1, 1, array('j', 1)))
+        :raises("incompatible value type")
+    local s = array('h', 6):set(1, 1, 2, 3, 4, 5, 6)
+    s:view(1, nil, 2):move(1, 2, 2)
+    t:expect(s):eq(array('h', 6):set(1, 1, 2, 1, 4, 3, 6))
+end
+
+function test_copy_from(t)
+    local a = array('h', 0, 4)
+    t:expect(t.expr(a):copy_from(('<hhh'):pack(1, -2, 3))):eq(3)
+    t:expect(a):eq(array('h', 3):set(1, 1, -2, 3))
+    t:expect(t.expr(a):copy_from(('<hhh'):pack(4, 5, 6), 3)):eq(2)
+    t:expect(a):eq(array('h', 4):set(1, 1, -2, 4, 5))
+    t:expect(t.expr(a):copy_from(array('h', 1):set(1, 7), -1)):eq(1)
+    t:expect(a):eq(array('h', 4):set(1, 1, -2, 4, 7))
+    t:expect(t.expr(a):copy_from({})):raises("string or buffer expected")
+    local v = array('h', 4):view(1, nil, 2)
+    t:expect(t.expr(v):copy_from(('<hh'):pack(8, 9))):eq(2)
+    t:expect(v):eq(array('h', 2):set(1, 8, 9))
+end
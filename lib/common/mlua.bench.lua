@@ -0,0 +1,56 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local mem = require 'mlua.mem'
+local time = require 'mlua.time'
+
+-- Measure the lookup of a function in a C module.
+function bench_module_lookup(b)
+    local mod = time
+    b:reset()
+    for i = 1, b.n do
+        local fn = mod.ticks
+    end
+end
+
+-- Measure the lookup of a method on a C class instance.
+function bench_method_lookup(b)
+    local buf = mem.alloc(16)
+    b:reset()
+    for i = 1, b.n do
+        local fn = buf.ptr
+    end
+end
+
+-- Measure a call to a C function.
+function bench_c_call(b)
+    local ticks = time.ticks
+    b:reset()
+    for i = 1, b.n do ticks() end
+end
+
+-- Measure a call to a Lua function.
+function bench_lua_call(b)
+    local function fn(v) return v end
+    b:reset()
+    for i = 1, b.n do fn(i) end
+end
+
+-- Measure the creation of a small table.
+function bench_table_new(b)
+    b:reset()
+    for i = 1, b.n do
+        local t = {i, i}
+    end
+end
+
+-- Measure the concatenation of short strings.
+function bench_string_concat(b)
+    local s = 'abc'
+    b:reset()
+    for i = 1, b.n do
+        local r = s .. i
+    end
+end
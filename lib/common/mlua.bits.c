@@ -1,10 +1,16 @@
 // Copyright 2024 Remy Blank <remy@c-space.org>
 // SPDX-License-Identifier: MIT
 
+#include "mlua/bits.h"
+
+#include <stdint.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 #include "mlua/int64.h"
 #include "mlua/module.h"
+#include "mlua/platform.h"
+#include "mlua/util.h"
 
 #if MLUA_IS64INT
 #define CLZ __builtin_clzll
@@ -89,12 +95,95 @@ static int mod_mask(lua_State* ls) {
     return luaL_argerror(ls, 1, "too large");
 }
 
+// Nibble-wise lookup tables for CRC-32 (reflected, polynomial 0xedb88320) and
+// CRC-16-CCITT (polynomial 0x1021).
+static uint32_t const crc32_table[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+    0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+    0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+static uint16_t const crc16_table[16] = {
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+};
+
+uint32_t mlua_bits_checksum(MLuaChecksum algo, void const* ptr, size_t len,
+                            uint32_t state) {
+    if (mlua_platform_checksum(algo, ptr, len, &state)) return state;
+    uint8_t const* p = ptr;
+    uint8_t const* end = p + len;
+    switch (algo) {
+    case MLUA_CHECKSUM_CRC32:
+        for (; p != end; ++p) {
+            state ^= *p;
+            state = (state >> 4) ^ crc32_table[state & 0xf];
+            state = (state >> 4) ^ crc32_table[state & 0xf];
+        }
+        break;
+    case MLUA_CHECKSUM_CRC16:
+        for (; p != end; ++p) {
+            state ^= (uint32_t)*p << 8;
+            state = (state << 4) ^ crc16_table[(state >> 12) & 0xf];
+            state = (state << 4) ^ crc16_table[(state >> 12) & 0xf];
+        }
+        state &= 0xffffu;
+        break;
+    case MLUA_CHECKSUM_SUM:
+        for (; p != end; ++p) state += *p;
+        break;
+    }
+    return state;
+}
+
+// Compute a checksum over the string or buffer at index 1.
+static uint32_t buffer_checksum(lua_State* ls, MLuaChecksum algo,
+                                uint32_t state) {
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_ro_buffer(ls, 1, &buf), 1,
+                     "string or buffer");
+    luaL_argcheck(ls, buf.size != SIZE_MAX, 1, "infinite buffer");
+    if (buf.vt == NULL) {
+        return mlua_bits_checksum(algo, buf.ptr, buf.size, state);
+    }
+    uint8_t chunk[64];
+    for (size_t off = 0; off < buf.size; off += sizeof(chunk)) {
+        size_t len = buf.size - off;
+        if (len > sizeof(chunk)) len = sizeof(chunk);
+        mlua_buffer_read(&buf, off, len, chunk);
+        state = mlua_bits_checksum(algo, chunk, len, state);
+    }
+    return state;
+}
+
+static int mod_crc32(lua_State* ls) {
+    uint32_t crc = luaL_optinteger(ls, 2, 0);
+    crc = ~buffer_checksum(ls, MLUA_CHECKSUM_CRC32, ~crc);
+    return lua_pushinteger(ls, (lua_Integer)crc), 1;
+}
+
+static int mod_crc16(lua_State* ls) {
+    uint32_t crc = luaL_optinteger(ls, 2, 0xffff) & 0xffffu;
+    crc = buffer_checksum(ls, MLUA_CHECKSUM_CRC16, crc);
+    return lua_pushinteger(ls, crc), 1;
+}
+
+static int mod_sum(lua_State* ls) {
+    uint32_t sum = luaL_optinteger(ls, 2, 0);
+    sum = buffer_checksum(ls, MLUA_CHECKSUM_SUM, sum);
+    return lua_pushinteger(ls, (lua_Integer)sum), 1;
+}
+
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(leading_zeros, mod_),
     MLUA_SYM_F(trailing_zeros, mod_),
     MLUA_SYM_F(ones, mod_),
     MLUA_SYM_F(parity, mod_),
     MLUA_SYM_F(mask, mod_),
+    MLUA_SYM_F(crc32, mod_),
+    MLUA_SYM_F(crc16, mod_),
+    MLUA_SYM_F(sum, mod_),
 };
 
 MLUA_OPEN_MODULE(mlua.bits) {
@@ -5,6 +5,7 @@ _ENV = module(...)
 
 local bits = require 'mlua.bits'
 local int64 = require 'mlua.int64'
+local mem = require 'mlua.mem'
 local string = require 'string'
 local table = require 'table'
 
@@ -53,3 +54,34 @@ function test_mask(t)
         t:expect(t.expr(bits).mask(arg)):fmt(hex):eq(want)
     end
 end
+
+function test_checksums(t)
+    local long = ('The quick brown fox jumps over the lazy dog. '):rep(20)
+    for _, test in ipairs{
+        {'', 0x00000000, 0xffff, 0},
+        {'123456789', 0xcbf43926, 0x29b1, 477},
+        {long, 0xb0664ae6, 0xb43f, 82700},
+    } do
+        local data, crc32, crc16, sum = table.unpack(test)
+        local buf = mem.alloc(#data)
+        mem.write(buf, data)
+        local args = {data, buf}
+        if #data > 0 then  -- Use a Ring for a non-raw buffer
+            local ring = mem.Ring(#data)
+            ring:write(data)
+            args[#args + 1] = ring
+        end
+        for _, arg in ipairs(args) do
+            t:expect(t.expr(bits).crc32(arg)):fmt(hex):eq(crc32)
+            t:expect(t.expr(bits).crc16(arg)):fmt(hex):eq(crc16)
+            t:expect(t.expr(bits).sum(arg)):eq(sum)
+        end
+        local crc = bits.crc32(data:sub(1, 5))
+        t:expect(t.expr(bits).crc32(data:sub(6), crc)):fmt(hex):eq(crc32)
+        crc = bits.crc16(data:sub(1, 5))
+        t:expect(t.expr(bits).crc16(data:sub(6), crc)):fmt(hex):eq(crc16)
+        t:expect(t.expr(bits).sum(data:sub(6), bits.sum(data:sub(1, 5))))
+            :eq(sum)
+    end
+    t:expect(t.expr(bits).crc32(1)):raises("string or buffer expected")
+end
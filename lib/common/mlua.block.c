@@ -6,6 +6,7 @@
 #include "mlua/errors.h"
 #include "mlua/int64.h"
 #include "mlua/module.h"
+#include "mlua/thread.h"
 #include "mlua/util.h"
 
 static char const Dev_name[] = "mlua.block.Dev";
@@ -34,25 +35,55 @@ static int Dev_read(lua_State* ls) {
     return luaL_pushresultsize(&buf, size), 1;
 }
 
-static int Dev_write(lua_State* ls) {
+// Writes and erases are performed in chunks of erase_size bytes when
+// non-blocking, and the thread yields between chunks so that other threads can
+// run during long operations.
+static size_t chunk_size(lua_State* ls, MLuaBlockDev* dev, size_t size) {
+    if (mlua_thread_blocking(ls) || size <= dev->erase_size) return size;
+    return dev->erase_size;
+}
+
+static int Dev_write_1(lua_State* ls, int status, lua_KContext ctx) {
     MLuaBlockDev* dev = mlua_block_check(ls, 1);
     uint64_t off = mlua_check_int64(ls, 2);
     size_t len;
-    void const* src = luaL_checklstring(ls, 3, &len);
-    int err = dev->write(dev, off, src, len);
+    uint8_t const* src = (uint8_t const*)luaL_checklstring(ls, 3, &len);
+    size_t done = (size_t)ctx;
+    size_t size = chunk_size(ls, dev, len - done);
+    int err = dev->write(dev, off + done, src + done, size);
     if (err < 0) return mlua_err_push(ls, err);
+    done += size;
+    if (done < len) {
+        return mlua_thread_yield(ls, 0, &Dev_write_1, (lua_KContext)done);
+    }
     return lua_pushboolean(ls, true), 1;
 }
 
-static int Dev_erase(lua_State* ls) {
+static int Dev_write(lua_State* ls) {
+    lua_settop(ls, 3);
+    return Dev_write_1(ls, LUA_OK, 0);
+}
+
+static int Dev_erase_1(lua_State* ls, int status, lua_KContext ctx) {
     MLuaBlockDev* dev = mlua_block_check(ls, 1);
     uint64_t off = mlua_check_int64(ls, 2);
-    size_t size = luaL_checkinteger(ls, 3);
-    int err = dev->erase(dev, off, size);
+    size_t len = luaL_checkinteger(ls, 3);
+    size_t done = (size_t)ctx;
+    size_t size = chunk_size(ls, dev, len - done);
+    int err = dev->erase(dev, off + done, size);
     if (err < 0) return mlua_err_push(ls, err);
+    done += size;
+    if (done < len) {
+        return mlua_thread_yield(ls, 0, &Dev_erase_1, (lua_KContext)done);
+    }
     return lua_pushboolean(ls, true), 1;
 }
 
+static int Dev_erase(lua_State* ls) {
+    lua_settop(ls, 3);
+    return Dev_erase_1(ls, LUA_OK, 0);
+}
+
 static int Dev_sync(lua_State* ls) {
     MLuaBlockDev* dev = mlua_block_check(ls, 1);
     int err = dev->sync(dev);
@@ -81,6 +112,7 @@ MLUA_SYMBOLS(module_syms) = {
 };
 
 MLUA_OPEN_MODULE(mlua.block) {
+    mlua_thread_require(ls);
     mlua_require(ls, "mlua.int64", false);
 
     // Create the Dev class.
@@ -0,0 +1,387 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/block.h"
+#include "mlua/errors.h"
+#include "mlua/int64.h"
+#include "mlua/module.h"
+#include "mlua/util.h"
+
+// The default number of cache lines.
+#ifndef MLUA_BLOCK_CACHE_LINES
+#define MLUA_BLOCK_CACHE_LINES 4
+#endif
+
+// The default number of lines to read ahead on sequential reads.
+#ifndef MLUA_BLOCK_CACHE_READAHEAD
+#define MLUA_BLOCK_CACHE_READAHEAD 1
+#endif
+
+typedef struct CacheStats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t prefetches;
+    uint32_t reads;
+    uint32_t writes;
+    uint32_t coalesced;
+    uint32_t erases;
+    uint32_t syncs;
+} CacheStats;
+
+// A cache line. It holds the content of the underlying device at "off", with
+// the range [dirty_start, dirty_end) not yet written back.
+typedef struct Line {
+    uint64_t off;
+    uint32_t stamp;
+    uint32_t dirty_start;
+    uint32_t dirty_end;
+    bool valid;
+} Line;
+
+typedef struct Cache {
+    MLuaBlockDev dev;
+    MLuaBlockDev* base;
+    uint32_t line_size;
+    uint32_t nlines;
+    uint32_t readahead;
+    uint32_t stamp;
+    uint64_t next_read;
+    uint8_t* data;
+    CacheStats stats;
+    Line lines[];
+} Cache;
+
+static inline uint8_t* line_data(Cache* c, Line* line) {
+    return c->data + (line - c->lines) * c->line_size;
+}
+
+static inline bool line_dirty(Line const* line) {
+    return line->dirty_end > line->dirty_start;
+}
+
+static Line* find_line(Cache* c, uint64_t off) {
+    for (uint32_t i = 0; i < c->nlines; ++i) {
+        Line* line = &c->lines[i];
+        if (line->valid && line->off == off) return line;
+    }
+    return NULL;
+}
+
+// Write back the dirty range of a line, extended to the write size of the
+// underlying device.
+static int write_back(Cache* c, Line* line) {
+    if (!line_dirty(line)) return MLUA_EOK;
+    uint32_t ws = c->base->write_size;
+    uint32_t start = line->dirty_start - line->dirty_start % ws;
+    uint32_t end = (line->dirty_end + ws - 1) / ws * ws;
+    int err = c->base->write(c->base, line->off + start,
+                             line_data(c, line) + start, end - start);
+    if (err < 0) return err;
+    ++c->stats.writes;
+    line->dirty_start = line->dirty_end = 0;
+    return MLUA_EOK;
+}
+
+// Return an unused line, or evict the least recently used one.
+static int alloc_line(Cache* c, Line** res) {
+    Line* lru = &c->lines[0];
+    for (uint32_t i = 0; i < c->nlines; ++i) {
+        Line* line = &c->lines[i];
+        if (!line->valid) {
+            lru = line;
+            break;
+        }
+        if ((int32_t)(line->stamp - lru->stamp) < 0) lru = line;
+    }
+    if (lru->valid) {
+        int err = write_back(c, lru);
+        if (err < 0) return err;
+        lru->valid = false;
+    }
+    *res = lru;
+    return MLUA_EOK;
+}
+
+// Load the line at "off" from the underlying device.
+static int load_line(Cache* c, uint64_t off, Line** res) {
+    Line* line;
+    int err = alloc_line(c, &line);
+    if (err < 0) return err;
+    err = c->base->read(c->base, off, line_data(c, line), c->line_size);
+    if (err < 0) return err;
+    ++c->stats.reads;
+    line->off = off;
+    line->dirty_start = line->dirty_end = 0;
+    line->valid = true;
+    *res = line;
+    return MLUA_EOK;
+}
+
+static inline void touch(Cache* c, Line* line) { line->stamp = ++c->stamp; }
+
+static int cache_dev_read(MLuaBlockDev* dev, uint64_t off, void* dst,
+                          size_t size) {
+    Cache* c = (Cache*)dev;
+    if (off + size > c->dev.size) return MLUA_EINVAL;
+    bool sequential = off == c->next_read;
+    bool missed = false;
+    uint64_t loff = off - off % c->line_size;
+    uint8_t* d = dst;
+    while (size > 0) {
+        Line* line = find_line(c, loff);
+        if (line != NULL) {
+            ++c->stats.hits;
+        } else {
+            ++c->stats.misses;
+            missed = true;
+            int err = load_line(c, loff, &line);
+            if (err < 0) return err;
+        }
+        touch(c, line);
+        size_t start = off - loff;
+        size_t len = c->line_size - start;
+        if (len > size) len = size;
+        memcpy(d, line_data(c, line) + start, len);
+        d += len;
+        off += len;
+        size -= len;
+        loff += c->line_size;
+    }
+    c->next_read = off;
+
+    // Sequential reads that missed the cache are likely to continue, so fetch
+    // the following lines ahead of time. Errors are ignored, as the data
+    // hasn't been requested yet.
+    if (!sequential || !missed) return MLUA_EOK;
+    for (uint32_t i = 0; i < c->readahead && loff < c->dev.size;
+            ++i, loff += c->line_size) {
+        if (find_line(c, loff) != NULL) continue;
+        Line* line;
+        if (load_line(c, loff, &line) < 0) break;
+        touch(c, line);
+        ++c->stats.prefetches;
+    }
+    return MLUA_EOK;
+}
+
+static int cache_dev_write(MLuaBlockDev* dev, uint64_t off, void const* src,
+                           size_t size) {
+    Cache* c = (Cache*)dev;
+    if (off + size > c->dev.size) return MLUA_EINVAL;
+    uint64_t loff = off - off % c->line_size;
+    uint8_t const* s = src;
+    while (size > 0) {
+        size_t start = off - loff;
+        size_t len = c->line_size - start;
+        if (len > size) len = size;
+        Line* line = find_line(c, loff);
+        if (line != NULL) {
+            if (line_dirty(line)) ++c->stats.coalesced;
+        } else if (len == c->line_size) {
+            // The whole line is overwritten, so it doesn't need to be read.
+            int err = alloc_line(c, &line);
+            if (err < 0) return err;
+            line->off = loff;
+            line->dirty_start = line->dirty_end = 0;
+            line->valid = true;
+        } else {
+            int err = load_line(c, loff, &line);
+            if (err < 0) return err;
+        }
+        touch(c, line);
+        memcpy(line_data(c, line) + start, s, len);
+        if (!line_dirty(line)) {
+            line->dirty_start = start;
+            line->dirty_end = start + len;
+        } else {
+            if (start < line->dirty_start) line->dirty_start = start;
+            if (start + len > line->dirty_end) line->dirty_end = start + len;
+        }
+        s += len;
+        off += len;
+        size -= len;
+        loff += c->line_size;
+    }
+    return MLUA_EOK;
+}
+
+static int cache_dev_erase(MLuaBlockDev* dev, uint64_t off, size_t size) {
+    Cache* c = (Cache*)dev;
+    if (off + size > c->dev.size) return MLUA_EINVAL;
+    // The line size divides the erase size, so lines are either fully inside
+    // or fully outside of the erased range. Pending writes to erased lines are
+    // dropped.
+    for (uint32_t i = 0; i < c->nlines; ++i) {
+        Line* line = &c->lines[i];
+        if (line->valid && line->off >= off && line->off < off + size) {
+            line->valid = false;
+        }
+    }
+    int err = c->base->erase(c->base, off, size);
+    if (err < 0) return err;
+    ++c->stats.erases;
+    return MLUA_EOK;
+}
+
+static int flush(Cache* c) {
+    for (uint32_t i = 0; i < c->nlines; ++i) {
+        Line* line = &c->lines[i];
+        if (!line->valid) continue;
+        int err = write_back(c, line);
+        if (err < 0) return err;
+    }
+    return MLUA_EOK;
+}
+
+static int cache_dev_sync(MLuaBlockDev* dev) {
+    Cache* c = (Cache*)dev;
+    int err = flush(c);
+    if (err < 0) return err;
+    ++c->stats.syncs;
+    return c->base->sync(c->base);
+}
+
+static Cache* check_cache(lua_State* ls, int arg) {
+    MLuaBlockDev* dev = mlua_block_check(ls, arg);
+    luaL_argexpected(ls, dev->read == &cache_dev_read, arg,
+                     "mlua.block.cache device");
+    return (Cache*)dev;
+}
+
+typedef struct CacheParams {
+    uint32_t lines;
+    uint32_t line_size;
+    uint32_t readahead;
+} CacheParams;
+
+// Parse the cache parameters from the options table at index arg, and check
+// them against the limits of the block device.
+static void check_params(lua_State* ls, int arg, MLuaBlockDev* dev,
+                         CacheParams* params) {
+    params->lines = MLUA_BLOCK_CACHE_LINES;
+    params->line_size = dev->write_size > dev->read_size ? dev->write_size
+                                                         : dev->read_size;
+    params->readahead = MLUA_BLOCK_CACHE_READAHEAD;
+    if (lua_isnoneornil(ls, arg)) return;
+    luaL_checktype(ls, arg, LUA_TTABLE);
+    if (lua_getfield(ls, arg, "lines") != LUA_TNIL) {
+        lua_Integer v = luaL_checkinteger(ls, -1);
+        luaL_argcheck(ls, v > 0 && v <= UINT16_MAX, arg, "invalid lines");
+        params->lines = v;
+    }
+    if (lua_getfield(ls, arg, "line_size") != LUA_TNIL) {
+        lua_Integer v = luaL_checkinteger(ls, -1);
+        luaL_argcheck(ls, v > 0 && v <= (lua_Integer)dev->erase_size
+                      && v % dev->read_size == 0 && v % dev->write_size == 0
+                      && dev->erase_size % v == 0,
+                      arg, "invalid line_size");
+        params->line_size = v;
+    }
+    if (lua_getfield(ls, arg, "readahead") != LUA_TNIL) {
+        lua_Integer v = luaL_checkinteger(ls, -1);
+        luaL_argcheck(ls, v >= 0 && v < (lua_Integer)params->lines, arg,
+                      "invalid readahead");
+        params->readahead = v;
+    }
+    lua_pop(ls, 3);
+    if (params->readahead >= params->lines) {
+        params->readahead = params->lines - 1;
+    }
+}
+
+static int mod_new(lua_State* ls) {
+    MLuaBlockDev* base = mlua_block_check(ls, 1);
+    CacheParams params;
+    check_params(ls, 2, base, &params);
+    size_t lines_size = params.lines * sizeof(Line);
+    Cache* c = mlua_block_push(
+        ls, sizeof(Cache) + lines_size + params.lines * params.line_size, 1);
+    lua_pushvalue(ls, 1);
+    lua_setiuservalue(ls, -2, 1);  // Keep the underlying device alive
+    memset(c, 0, sizeof(Cache) + lines_size);
+    c->dev.read = &cache_dev_read;
+    c->dev.write = &cache_dev_write;
+    c->dev.erase = &cache_dev_erase;
+    c->dev.sync = &cache_dev_sync;
+    c->dev.size = base->size;
+    c->dev.read_size = 1;
+    c->dev.write_size = base->write_size;
+    c->dev.erase_size = base->erase_size;
+    c->base = base;
+    c->line_size = params.line_size;
+    c->nlines = params.lines;
+    c->readahead = params.readahead;
+    c->next_read = -1;
+    c->data = (uint8_t*)&c->lines[params.lines];
+    return 1;
+}
+
+static int mod_flush(lua_State* ls) {
+    Cache* c = check_cache(ls, 1);
+    int err = flush(c);
+    if (err < 0) return mlua_err_push(ls, err);
+    return lua_pushboolean(ls, true), 1;
+}
+
+static int mod_invalidate(lua_State* ls) {
+    Cache* c = check_cache(ls, 1);
+    int err = flush(c);
+    if (err < 0) return mlua_err_push(ls, err);
+    for (uint32_t i = 0; i < c->nlines; ++i) c->lines[i].valid = false;
+    c->next_read = -1;
+    return lua_pushboolean(ls, true), 1;
+}
+
+#define SET_STAT(name) \
+    mlua_push_minint(ls, st.name); \
+    lua_setfield(ls, -2, #name)
+
+static int mod_stats(lua_State* ls) {
+    Cache* c = check_cache(ls, 1);
+    bool reset = mlua_to_cbool(ls, 2);
+    CacheStats st = c->stats;
+    if (reset) memset(&c->stats, 0, sizeof(c->stats));
+    uint32_t dirty = 0;
+    for (uint32_t i = 0; i < c->nlines; ++i) {
+        Line const* line = &c->lines[i];
+        if (line->valid && line_dirty(line)) ++dirty;
+    }
+    lua_createtable(ls, 0, 12);
+    SET_STAT(hits);
+    SET_STAT(misses);
+    SET_STAT(prefetches);
+    SET_STAT(reads);
+    SET_STAT(writes);
+    SET_STAT(coalesced);
+    SET_STAT(erases);
+    SET_STAT(syncs);
+    lua_pushinteger(ls, dirty);
+    lua_setfield(ls, -2, "dirty");
+    lua_pushinteger(ls, c->nlines);
+    lua_setfield(ls, -2, "lines");
+    lua_pushinteger(ls, c->line_size);
+    lua_setfield(ls, -2, "line_size");
+    lua_pushinteger(ls, c->readahead);
+    lua_setfield(ls, -2, "readahead");
+    return 1;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_F(new, mod_),
+    MLUA_SYM_F(flush, mod_),
+    MLUA_SYM_F(invalidate, mod_),
+    MLUA_SYM_F(stats, mod_),
+};
+
+MLUA_OPEN_MODULE(mlua.block.cache) {
+    mlua_require(ls, "mlua.block", false);
+    mlua_require(ls, "mlua.int64", false);
+
+    mlua_new_module(ls, 0, module_syms);
+    return 1;
+}
@@ -0,0 +1,135 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local cache = require 'mlua.block.cache'
+local block_mem = require 'mlua.block.mem'
+local errors = require 'mlua.errors'
+local fs = require 'mlua.fs'
+local lfs = require 'mlua.fs.lfs'
+local mem = require 'mlua.mem'
+local string = require 'string'
+
+local function new_cache(opts)
+    local base = block_mem.new(mem.alloc(4 << 10), 16, 256)
+    assert(base:erase(0, base:size()))
+    return base, cache.new(base, opts)
+end
+
+local function expect_stats(t, dev, want)
+    local stats = cache.stats(dev, true)
+    for k, v in pairs(want) do t:expect(stats[k]):label(k):eq(v) end
+end
+
+function test_params(t)
+    local base = block_mem.new(mem.alloc(4 << 10), 16, 256)
+    for _, opts in ipairs{
+        {lines = 0}, {line_size = 24}, {line_size = 512}, {line_size = 96},
+        {lines = 2, readahead = 2}, {readahead = -1},
+    } do
+        t:expect(t.expr(cache).new(base, opts)):raises("invalid")
+    end
+    t:expect(t.expr(cache).stats(base)):raises("mlua.block.cache device")
+    local dev = cache.new(base, {lines = 2, line_size = 128})
+    t:expect(t.mexpr(dev):size()):eq{4096, 1, 16, 256}
+    expect_stats(t, dev, {lines = 2, line_size = 128, readahead = 1})
+    dev = cache.new(base, {lines = 1})
+    expect_stats(t, dev, {lines = 1, line_size = 16, readahead = 0})
+end
+
+function test_read(t)
+    local base, dev = new_cache({lines = 4, line_size = 64, readahead = 1})
+    local data = string.rep('0123456789abcdef', 256 // 16)
+    assert(base:write(0, data))
+    t:expect(t.expr(dev):read(0, 8)):eq(data:sub(1, 8))
+    t:expect(t.expr(dev):read(8, 8)):eq(data:sub(9, 16))
+    expect_stats(t, dev, {hits = 1, misses = 1, reads = 1, prefetches = 0})
+
+    -- A sequential read that misses fetches the next line ahead of time.
+    t:expect(t.expr(dev):read(16, 64)):eq(data:sub(17, 80))
+    expect_stats(t, dev, {hits = 1, misses = 1, reads = 2, prefetches = 1})
+    t:expect(t.expr(dev):read(80, 48)):eq(data:sub(81, 128))
+    expect_stats(t, dev, {hits = 1, misses = 0, reads = 0})
+
+    -- Non-sequential reads don't read ahead.
+    t:expect(t.expr(dev):read(200, 8)):eq(data:sub(201, 208))
+    expect_stats(t, dev, {hits = 0, misses = 1, reads = 1, prefetches = 0})
+
+    -- The least recently used line is evicted.
+    t:expect(t.expr(dev):read(0, 4)):eq(data:sub(1, 4))
+    t:expect(t.expr(dev):read(256, 4)):eq(string.rep('\xff', 4))
+    t:expect(t.expr(dev):read(128, 4)):eq(data:sub(129, 132))
+    expect_stats(t, dev, {hits = 1, misses = 2, reads = 2})
+
+    t:expect(t.mexpr(dev):read(4090, 8))
+        :eq{nil, "invalid argument", errors.EINVAL}
+end
+
+function test_write(t)
+    local base, dev = new_cache({lines = 2, line_size = 64})
+    assert(dev:write(0, '0123456789abcdef'))
+    assert(dev:write(16, 'ghijklmnopqrstuv'))
+    assert(dev:write(48, 'wxyz'))
+    t:expect(t.expr(base):read(0, 16)):eq(string.rep('\xff', 16))
+    t:expect(t.expr(dev):read(0, 20)):eq('0123456789abcdefghij')
+    expect_stats(t, dev, {dirty = 1, coalesced = 2, writes = 0})
+
+    -- Syncing writes dirty lines back in a single write, extended to the write
+    -- size of the underlying device.
+    t:assert(dev:sync())
+    t:expect(t.expr(base):read(0, 52)):eq('0123456789abcdefghijklmnopqrstuv'
+                                          .. string.rep('\xff', 16) .. 'wxyz')
+    expect_stats(t, dev, {dirty = 0, writes = 1, syncs = 1})
+    t:assert(dev:sync())
+    expect_stats(t, dev, {writes = 0, syncs = 1})
+
+    -- Full-line writes don't read the line, and evicted lines are written back.
+    local line = string.rep('L', 64)
+    assert(dev:write(64, line))
+    assert(dev:write(128, line))
+    assert(dev:write(192, line))
+    expect_stats(t, dev, {reads = 0, writes = 1, dirty = 2})
+    t:expect(t.expr(base):read(64, 64)):eq(line)
+    t:expect(t.expr(cache).flush(dev)):eq(true)
+    t:expect(t.expr(base):read(128, 128)):eq(line .. line)
+    expect_stats(t, dev, {writes = 2, dirty = 0, syncs = 0})
+end
+
+function test_erase(t)
+    local base, dev = new_cache({lines = 4, line_size = 64})
+    assert(dev:write(0, '0123456789abcdef'))
+    assert(dev:write(256, '0123456789abcdef'))
+    t:assert(dev:erase(0, 256))
+    t:expect(t.expr(dev):read(0, 4)):eq(string.rep('\xff', 4))
+    t:assert(dev:sync())
+    t:expect(t.expr(base):read(0, 16)):eq(string.rep('\xff', 16))
+    t:expect(t.expr(base):read(256, 16)):eq('0123456789abcdef')
+    expect_stats(t, dev, {erases = 1, writes = 1})
+
+    -- Invalidated lines are re-read from the underlying device.
+    assert(base:write(0, 'ABCDEFGHIJKLMNOP'))
+    t:expect(t.expr(dev):read(0, 4)):eq(string.rep('\xff', 4))
+    t:expect(t.expr(cache).invalidate(dev)):eq(true)
+    t:expect(t.expr(dev):read(0, 4)):eq('ABCD')
+end
+
+function test_filesystem(t)
+    local base = block_mem.new(mem.alloc(32 << 10), 64, 1024)
+    local dev = cache.new(base, {lines = 8, line_size = 256, readahead = 2})
+    local dfs = lfs.new(dev)
+    t:assert(dfs:format())
+    t:assert(dfs:mount())
+    t:cleanup(function() assert(dfs:unmount()) end)
+    local data = ('0123456789'):rep(500)
+    do
+        local f<close> = assert(dfs:open('/file', fs.O_WRONLY | fs.O_CREAT))
+        assert(f:write(data))
+    end
+    local f<close> = assert(dfs:open('/file', fs.O_RDONLY))
+    t:expect(t.expr(f):read(#data)):eq(data)
+    local stats = cache.stats(dev)
+    t:expect(stats.hits):label("hits"):gt(0)
+    t:expect(stats.coalesced):label("coalesced"):gt(0)
+    t:expect(stats.dirty):label("dirty"):eq(0)
+end
@@ -54,7 +54,7 @@ function parse_opts(opts, defs)
         opts[k] = def(n, v)
     end
     for k, def in pairs(defs) do
-        if not opts[k] then opts[k] = def(k:gsub('_', '-'), nil) end
+        if opts[k] == nil then opts[k] = def(k:gsub('_', '-'), nil) end
     end
 end
 
@@ -0,0 +1,82 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local fixed = require 'mlua.fixed'
+local array = require 'mlua.array'
+
+-- The "number" benchmarks use Lua numbers, whose type is selected by
+-- MLUA_FLOAT, so comparing float and double requires running them on two
+-- builds. The "fixed" benchmarks use Q16.16 values.
+
+local from, mul = fixed.from, fixed.mul
+
+-- A PID controller step, tracking a constant setpoint.
+function bench_pid_number(b)
+    local kp, ki, kd, dt = 1.2, 0.5, 0.01, 0.001
+    local setpoint, value, integral, prev = 1.0, 0.0, 0.0, 0.0
+    b:reset()
+    for i = 1, b.n do
+        local err = setpoint - value
+        integral = integral + err * dt
+        local out = kp * err + ki * integral + kd * (err - prev) / dt
+        prev = err
+        value = value + out * dt
+    end
+end
+
+function bench_pid_fixed(b)
+    local kp, ki, kd = from(1.2), from(0.5), from(0.01)
+    local dt, inv_dt = from(0.001), from(1000)
+    local setpoint, value, integral, prev = from(1.0), 0, 0, 0
+    b:reset()
+    for i = 1, b.n do
+        local err = setpoint - value
+        integral = integral + mul(err, dt)
+        local out = mul(kp, err) + mul(ki, integral)
+                    + mul(kd, mul(err - prev, inv_dt))
+        prev = err
+        value = value + mul(out, dt)
+    end
+end
+
+-- A first-order low-pass IIR filter.
+function bench_iir_number(b)
+    local alpha, y = 0.1, 0.0
+    b:reset()
+    for i = 1, b.n do y = y + alpha * ((i & 0xff) - y) end
+end
+
+function bench_iir_fixed(b)
+    local alpha, y = from(0.1), 0
+    b:reset()
+    for i = 1, b.n do y = y + mul(alpha, ((i & 0xff) << 16) - y) end
+end
+
+-- A 16-tap FIR filter over a 256-sample block.
+local taps, samples = 16, 256
+
+function bench_fir_number(b)
+    local coeffs, src = {}, {}
+    for i = 1, taps do coeffs[i] = 1 / taps end
+    for i = 1, samples do src[i] = i & 0xff end
+    local dst = {}
+    b:reset()
+    for n = 1, b.n do
+        for i = 1, samples - taps + 1 do
+            local acc = 0.0
+            for j = 1, taps do acc = acc + coeffs[j] * src[i + j - 1] end
+            dst[i] = acc
+        end
+    end
+end
+
+function bench_fir_fixed(b)
+    local coeffs = array('i', taps):fill(from(1 / taps))
+    local src = array('i', samples)
+    for i = 1, samples do src:set(i, (i & 0xff) << 16) end
+    local dst = array('i', samples)
+    b:reset()
+    for n = 1, b.n do fixed.fir(dst, src, coeffs) end
+end
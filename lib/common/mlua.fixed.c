@@ -0,0 +1,159 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/module.h"
+#include "mlua/util.h"
+
+// Fixed-point values are stored as plain 32-bit integers, with a number of
+// fractional bits given per operation. Intermediate results are computed with
+// 64-bit integers, and final results are rounded to nearest and saturated.
+
+static int check_frac(lua_State* ls, int arg) {
+    lua_Unsigned frac = luaL_optinteger(ls, arg, 16);
+    luaL_argcheck(ls, frac < 32, arg, "invalid fractional bits");
+    return frac;
+}
+
+static inline int32_t saturate(int64_t v) {
+    return v > INT32_MAX ? INT32_MAX : v < INT32_MIN ? INT32_MIN : (int32_t)v;
+}
+
+// Shift a product right by "frac" bits, rounding to nearest, and saturate.
+static inline int32_t round_shift(int64_t v, int frac) {
+    if (frac > 0) v = (v + ((int64_t)1 << (frac - 1))) >> frac;
+    return saturate(v);
+}
+
+static inline int32_t check_fixed(lua_State* ls, int arg) {
+    return (int32_t)luaL_checkinteger(ls, arg);
+}
+
+// Return a pointer to the 32-bit elements of the raw buffer at the given index,
+// typically an mlua.Array of 'i' values, and set "len" to their number.
+static int32_t* check_values(lua_State* ls, int arg, size_t* len) {
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, arg, &buf) && buf.vt == NULL
+                         && buf.size != SIZE_MAX, arg, "raw buffer");
+    luaL_argcheck(ls, buf.size % 4 == 0 && ((uintptr_t)buf.ptr & 3) == 0, arg,
+                  "invalid buffer size or alignment");
+    *len = buf.size / 4;
+    return buf.ptr;
+}
+
+static int mod_from(lua_State* ls) {
+    lua_Number num = luaL_checknumber(ls, 1);
+    int frac = check_frac(ls, 2);
+    lua_Number v = l_mathop(floor)(l_mathop(ldexp)(num, frac) + 0.5);
+    luaL_argcheck(ls, v == v, 1, "not a number");
+    int32_t res = v >= (lua_Number)INT32_MAX ? INT32_MAX
+                  : v <= (lua_Number)INT32_MIN ? INT32_MIN : (int32_t)v;
+    return lua_pushinteger(ls, res), 1;
+}
+
+static int mod_to(lua_State* ls) {
+    int32_t v = check_fixed(ls, 1);
+    int frac = check_frac(ls, 2);
+    return lua_pushnumber(ls, l_mathop(ldexp)((lua_Number)v, -frac)), 1;
+}
+
+static int mod_mul(lua_State* ls) {
+    int64_t a = check_fixed(ls, 1);
+    int64_t b = check_fixed(ls, 2);
+    int frac = check_frac(ls, 3);
+    return lua_pushinteger(ls, round_shift(a * b, frac)), 1;
+}
+
+static int mod_div(lua_State* ls) {
+    int64_t a = check_fixed(ls, 1);
+    int64_t b = check_fixed(ls, 2);
+    int frac = check_frac(ls, 3);
+    luaL_argcheck(ls, b != 0, 2, "division by zero");
+    // Divide the magnitudes, rounding to nearest, and apply the sign.
+    uint64_t n = (uint64_t)(a < 0 ? -a : a) << frac;
+    uint64_t d = b < 0 ? -b : b;
+    int64_t q = (n + d / 2) / d;
+    return lua_pushinteger(ls, saturate((a < 0) != (b < 0) ? -q : q)), 1;
+}
+
+static int mod_mul_array(lua_State* ls) {
+    size_t len, alen, blen;
+    int32_t* dst = check_values(ls, 1, &len);
+    int32_t const* a = check_values(ls, 2, &alen);
+    int32_t const* b = check_values(ls, 3, &blen);
+    int frac = check_frac(ls, 4);
+    luaL_argcheck(ls, alen == len, 2, "length mismatch");
+    luaL_argcheck(ls, blen == len, 3, "length mismatch");
+    for (size_t i = 0; i < len; ++i) {
+        dst[i] = round_shift((int64_t)a[i] * b[i], frac);
+    }
+    return 0;
+}
+
+static int mod_scale(lua_State* ls) {
+    size_t len, slen;
+    int32_t* dst = check_values(ls, 1, &len);
+    int32_t const* src = check_values(ls, 2, &slen);
+    int64_t k = check_fixed(ls, 3);
+    int frac = check_frac(ls, 4);
+    luaL_argcheck(ls, slen == len, 2, "length mismatch");
+    for (size_t i = 0; i < len; ++i) dst[i] = round_shift(k * src[i], frac);
+    return 0;
+}
+
+static int mod_dot(lua_State* ls) {
+    size_t alen, blen;
+    int32_t const* a = check_values(ls, 1, &alen);
+    int32_t const* b = check_values(ls, 2, &blen);
+    int frac = check_frac(ls, 3);
+    luaL_argcheck(ls, blen == alen, 2, "length mismatch");
+    int64_t acc = 0;
+    for (size_t i = 0; i < alen; ++i) acc += (int64_t)a[i] * b[i];
+    return lua_pushinteger(ls, round_shift(acc, frac)), 1;
+}
+
+static int mod_fir(lua_State* ls) {
+    size_t len, slen, clen;
+    int32_t* dst = check_values(ls, 1, &len);
+    int32_t const* src = check_values(ls, 2, &slen);
+    int32_t const* coeffs = check_values(ls, 3, &clen);
+    int frac = check_frac(ls, 4);
+    luaL_argcheck(ls, clen > 0 && clen <= slen, 3, "invalid filter length");
+    size_t n = slen - clen + 1;
+    luaL_argcheck(ls, len >= n, 1, "destination too small");
+    for (size_t i = 0; i < n; ++i) {
+        int64_t acc = 0;
+        for (size_t j = 0; j < clen; ++j) {
+            acc += (int64_t)coeffs[j] * src[i + j];
+        }
+        dst[i] = round_shift(acc, frac);
+    }
+    return lua_pushinteger(ls, n), 1;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_V(Q16, integer, 16),
+    MLUA_SYM_V(Q31, integer, 31),
+    MLUA_SYM_V(ONE, integer, 1 << 16),
+    MLUA_SYM_V(MAX, integer, INT32_MAX),
+    MLUA_SYM_V(MIN, integer, INT32_MIN),
+
+    MLUA_SYM_F(from, mod_),
+    MLUA_SYM_F(to, mod_),
+    MLUA_SYM_F(mul, mod_),
+    MLUA_SYM_F(div, mod_),
+    MLUA_SYM_F(mul_array, mod_),
+    MLUA_SYM_F(scale, mod_),
+    MLUA_SYM_F(dot, mod_),
+    MLUA_SYM_F(fir, mod_),
+};
+
+MLUA_OPEN_MODULE(mlua.fixed) {
+    mlua_new_module(ls, 0, module_syms);
+    return 1;
+}
@@ -0,0 +1,55 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local fixed = require 'mlua.fixed'
+local array = require 'mlua.array'
+local table = require 'table'
+
+function test_from_to(t)
+    for _, test in ipairs{
+        {1.0, nil, 0x10000}, {-1.5, nil, -0x18000}, {0.5, 31, 0x40000000},
+        {1.0, 31, fixed.MAX}, {-1.0, 31, fixed.MIN}, {1e9, nil, fixed.MAX},
+        {3.0, 0, 3},
+    } do
+        local num, frac, want = table.unpack(test, 1, 3)
+        t:expect(t.expr(fixed).from(num, frac)):eq(want)
+    end
+    t:expect(t.expr(fixed).to(0x18000)):eq(1.5)
+    t:expect(t.expr(fixed).to(-0x40000000, 31)):eq(-0.5)
+    t:expect(t.expr(fixed).from(1, 32)):raises("invalid fractional bits")
+end
+
+function test_mul_div(t)
+    local one, half = fixed.ONE, fixed.ONE // 2
+    t:expect(t.expr(fixed).mul(3 * one, half)):eq(3 * half)
+    t:expect(t.expr(fixed).mul(-3 * one, half)):eq(-3 * half)
+    t:expect(t.expr(fixed).mul(0x40000000, 0x40000000, 31)):eq(0x20000000)
+    t:expect(t.expr(fixed).mul(0x7fff0000, 4 * one)):eq(fixed.MAX)
+    t:expect(t.expr(fixed).div(3 * one, 2 * one)):eq(3 * half)
+    t:expect(t.expr(fixed).div(-3 * one, 2 * one)):eq(-3 * half)
+    t:expect(t.expr(fixed).div(one, 3 * one)):eq(0x5555)
+    t:expect(t.expr(fixed).div(2 * one, 3 * one)):eq(0xaaab)
+    t:expect(t.expr(fixed).div(one, 0)):raises("division by zero")
+end
+
+function test_arrays(t)
+    local one = fixed.ONE
+    local a = array('i', 3):set(1, one, 2 * one, -3 * one)
+    local b = array('i', 3):set(1, one // 2, one // 4, one)
+    local dst = array('i', 3)
+    fixed.mul_array(dst, a, b)
+    t:expect(dst):eq(array('i', 3):set(1, one // 2, one // 2, -3 * one))
+    fixed.scale(dst, a, 2 * one)
+    t:expect(dst):eq(array('i', 3):set(1, 2 * one, 4 * one, -6 * one))
+    t:expect(t.expr(fixed).dot(a, b)):eq(-2 * one)
+    t:expect(t.expr(fixed).mul_array(dst, a, array('i', 2)))
+        :raises("length mismatch")
+
+    local src = array('i', 5):set(1, 1, 2, 3, 4, 5)
+    local coeffs = array('i', 2):set(1, one // 2, one // 2)
+    local out = array('i', 5)
+    t:expect(t.expr(fixed).fir(out, src, coeffs, 16)):eq(4)
+    t:expect(out):eq(array('i', 5):set(1, 2, 3, 4, 5, 0))
+end
@@ -0,0 +1,48 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local block_mem = require 'mlua.block.mem'
+local fs = require 'mlua.fs'
+local lfs = require 'mlua.fs.lfs'
+local mem = require 'mlua.mem'
+
+local size = 4 << 10
+local data = ('0123456789abcdef'):rep(size // 16)
+local dfs
+
+function set_up(t)
+    -- Create a filesystem in RAM, so that the benchmarks measure the overhead
+    -- of the filesystem and not the speed of the storage.
+    dfs = lfs.new(block_mem.new(mem.alloc(64 << 10), 256, 4096))
+    t:assert(dfs:format())
+    t:assert(dfs:mount())
+    t:cleanup(function() assert(dfs:unmount()) end)
+    local f<close> = assert(dfs:open('/read', fs.O_WRONLY | fs.O_CREAT))
+    t:assert(f:write(data))
+end
+
+function bench_write(b)
+    b:bytes(size)
+    for i = 1, b.n do
+        local f<close> = assert(dfs:open(
+            '/write', fs.O_WRONLY | fs.O_CREAT | fs.O_TRUNC))
+        assert(f:write(data))
+        assert(f:close())
+    end
+end
+
+function bench_read(b)
+    local f<close> = assert(dfs:open('/read', fs.O_RDONLY))
+    b:bytes(size)
+    b:reset()
+    for i = 1, b.n do
+        assert(f:seek(0))
+        assert(f:read(size))
+    end
+end
+
+function bench_stat(b)
+    for i = 1, b.n do assert(dfs:stat('/read')) end
+end
@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -19,14 +20,31 @@
 #include "mlua/fs.h"
 #include "mlua/int64.h"
 #include "mlua/module.h"
+#include "mlua/thread.h"
 #include "mlua/util.h"
 
 static char const Filesystem_name[] = "mlua.fs.lfs.Filesystem";
 static char const File_name[] = "mlua.fs.lfs.File";
 static char const Dir_name[] = "mlua.fs.lfs.Dir";
 
+// The default size of the lookahead buffer, in bytes.
 #define LOOKAHEAD_SIZE 16
 
+// The default number of erase cycles before metadata is moved to another block.
+#define BLOCK_CYCLES 500
+
+// Block device access statistics.
+typedef struct FSStats {
+    uint64_t read_bytes;
+    uint64_t prog_bytes;
+    uint32_t reads;
+    uint32_t progs;
+    uint32_t erases;
+    uint32_t syncs;
+    uint32_t cache_hits;  // File reads served without reading the device
+    uint32_t cache_misses;  // File reads that read from the device
+} FSStats;
+
 typedef struct Filesystem {
     struct lfs_config config;
     lfs_t lfs;
@@ -34,8 +52,8 @@ typedef struct Filesystem {
     mutex_t mu;
 #endif
     bool mounted;
-    uint32_t lookahead_buffer[LOOKAHEAD_SIZE / sizeof(uint32_t)];
-    uint8_t buffers[0];
+    FSStats stats;
+    uint32_t buffers[0];  // Read cache, prog cache, lookahead buffer
 } Filesystem;
 
 typedef struct File {
@@ -125,22 +143,30 @@ static int push_lfs_result_int(lua_State* ls, lua_Integer res) {
 
 static int fs_read(struct lfs_config const* c, lfs_block_t block,
                    lfs_off_t off, void* buffer, lfs_size_t size) {
+    FSStats* st = &((Filesystem*)c)->stats;
+    ++st->reads;
+    st->read_bytes += size;
     MLuaBlockDev* dev = c->context;
     return dev->read(dev, (uint64_t)block * c->block_size + off, buffer, size);
 }
 
 static int fs_prog(struct lfs_config const* c, lfs_block_t block,
                    lfs_off_t off, void const* buffer, lfs_size_t size) {
+    FSStats* st = &((Filesystem*)c)->stats;
+    ++st->progs;
+    st->prog_bytes += size;
     MLuaBlockDev* dev = c->context;
     return dev->write(dev, (uint64_t)block * c->block_size + off, buffer, size);
 }
 
 static int fs_erase(struct lfs_config const* c, lfs_block_t block) {
+    ++((Filesystem*)c)->stats.erases;
     MLuaBlockDev* dev = c->context;
     return dev->erase(dev, (uint64_t)block * c->block_size, c->block_size);
 }
 
 static int fs_sync(struct lfs_config const* c) {
+    ++((Filesystem*)c)->stats.syncs;
     MLuaBlockDev* dev = c->context;
     return dev->sync(dev);
 }
@@ -161,7 +187,66 @@ static int fs_unlock(struct lfs_config const* c) {
 
 #endif  // LFS_THREADSAFE
 
-static void init_filesystem(Filesystem* fs, MLuaBlockDev* dev) {
+// Filesystem configuration parameters.
+typedef struct FSParams {
+    lfs_size_t cache_size;
+    lfs_size_t lookahead_size;
+    int32_t block_cycles;
+} FSParams;
+
+static void default_params(FSParams* params, MLuaBlockDev* dev) {
+    params->cache_size = dev->write_size;
+    params->lookahead_size = LOOKAHEAD_SIZE;
+    params->block_cycles = BLOCK_CYCLES;
+}
+
+// Return the offset of the lookahead buffer in the buffers of a Filesystem.
+static inline size_t lookahead_offset(FSParams const* params) {
+    return (2 * params->cache_size + sizeof(uint32_t) - 1)
+           & ~(sizeof(uint32_t) - 1);
+}
+
+// Return the size of a Filesystem with the given parameters.
+static inline size_t filesystem_size(FSParams const* params) {
+    return sizeof(Filesystem) + lookahead_offset(params)
+           + params->lookahead_size;
+}
+
+// Parse the filesystem parameters from the options table at index arg, and
+// check them against the limits of the block device.
+static void check_params(lua_State* ls, int arg, MLuaBlockDev* dev,
+                         FSParams* params) {
+    default_params(params, dev);
+    if (lua_isnoneornil(ls, arg)) return;
+    luaL_checktype(ls, arg, LUA_TTABLE);
+    if (lua_getfield(ls, arg, "cache_size") != LUA_TNIL) {
+        lua_Integer v = luaL_checkinteger(ls, -1);
+        luaL_argcheck(ls, v > 0 && v <= (lua_Integer)dev->erase_size
+                      && v % dev->read_size == 0 && v % dev->write_size == 0
+                      && dev->erase_size % v == 0,
+                      arg, "invalid cache_size");
+        params->cache_size = v;
+    }
+    if (lua_getfield(ls, arg, "lookahead_size") != LUA_TNIL) {
+        lua_Integer v = luaL_checkinteger(ls, -1);
+        // Each byte of the lookahead buffer tracks 8 blocks.
+        uint64_t blocks = dev->size / dev->erase_size;
+        luaL_argcheck(ls, v > 0 && v % 8 == 0
+                      && (uint64_t)v <= (blocks + 63) / 64 * 8,
+                      arg, "invalid lookahead_size");
+        params->lookahead_size = v;
+    }
+    if (lua_getfield(ls, arg, "block_cycles") != LUA_TNIL) {
+        lua_Integer v = luaL_checkinteger(ls, -1);
+        luaL_argcheck(ls, v == -1 || (v > 0 && v <= INT32_MAX), arg,
+                      "invalid block_cycles");
+        params->block_cycles = v;
+    }
+    lua_pop(ls, 3);
+}
+
+static void init_filesystem(Filesystem* fs, MLuaBlockDev* dev,
+                            FSParams const* params) {
     memset(fs, 0, sizeof(*fs));
     fs->config.context = dev;
     fs->config.read = &fs_read;
@@ -176,12 +261,13 @@ static void init_filesystem(Filesystem* fs, MLuaBlockDev* dev) {
     fs->config.read_size = dev->read_size;
     fs->config.prog_size = dev->write_size;
     fs->config.block_size = dev->erase_size;
-    fs->config.block_cycles = 500;
-    fs->config.cache_size = fs->config.prog_size;
-    fs->config.lookahead_size = LOOKAHEAD_SIZE;
-    fs->config.read_buffer = fs->buffers;
-    fs->config.prog_buffer = &fs->buffers[fs->config.cache_size];
-    fs->config.lookahead_buffer = fs->lookahead_buffer;
+    fs->config.block_cycles = params->block_cycles;
+    fs->config.cache_size = params->cache_size;
+    fs->config.lookahead_size = params->lookahead_size;
+    uint8_t* buffers = (uint8_t*)fs->buffers;
+    fs->config.read_buffer = buffers;
+    fs->config.prog_buffer = buffers + params->cache_size;
+    fs->config.lookahead_buffer = buffers + lookahead_offset(params);
 }
 
 static inline Filesystem* check_Filesystem(lua_State* ls, int arg) {
@@ -291,6 +377,33 @@ static int Filesystem_gc(lua_State* ls) {
     return push_lfs_result_bool(ls, lfs_fs_gc(&fs->lfs));
 }
 
+#define SET_STAT(name) \
+    mlua_push_minint(ls, st.name); \
+    lua_setfield(ls, -2, #name)
+
+static int Filesystem_stats(lua_State* ls) {
+    Filesystem* fs = check_Filesystem(ls, 1);
+    bool reset = mlua_to_cbool(ls, 2);
+    FSStats st = fs->stats;
+    if (reset) memset(&fs->stats, 0, sizeof(fs->stats));
+    lua_createtable(ls, 0, 11);
+    SET_STAT(reads);
+    SET_STAT(read_bytes);
+    SET_STAT(progs);
+    SET_STAT(prog_bytes);
+    SET_STAT(erases);
+    SET_STAT(syncs);
+    SET_STAT(cache_hits);
+    SET_STAT(cache_misses);
+    lua_pushinteger(ls, fs->config.cache_size);
+    lua_setfield(ls, -2, "cache_size");
+    lua_pushinteger(ls, fs->config.lookahead_size);
+    lua_setfield(ls, -2, "lookahead_size");
+    lua_pushinteger(ls, fs->config.block_cycles);
+    lua_setfield(ls, -2, "block_cycles");
+    return 1;
+}
+
 static int fs_traverse(void* data, lfs_block_t block) {
     lua_State* ls = data;
     lua_pushvalue(ls, 2);
@@ -329,7 +442,7 @@ static int Filesystem_open(lua_State* ls) {
     }
 #endif
 
-    File* f = lua_newuserdatauv(ls, sizeof(File) + fs_dev(fs)->write_size, 1);
+    File* f = lua_newuserdatauv(ls, sizeof(File) + fs->config.cache_size, 1);
     memset(f, 0, sizeof(File));
     f->config.buffer = f->buffer;
     int res = lfs_file_opencfg(&fs->lfs, &f->file, path, from_open_flags(flags),
@@ -474,6 +587,7 @@ MLUA_SYMBOLS(Filesystem_syms) = {
     MLUA_SYM_F(statvfs, Filesystem_),
     MLUA_SYM_F(size, Filesystem_),
     MLUA_SYM_F(gc, Filesystem_),
+    MLUA_SYM_F(stats, Filesystem_),
     MLUA_SYM_F(traverse, Filesystem_),
     MLUA_SYM_F(mkconsistent, Filesystem_),
     MLUA_SYM_F(open, Filesystem_),
@@ -525,30 +639,97 @@ static int File_sync(lua_State* ls) {
     return push_lfs_result_bool(ls, lfs_file_sync(&fs->lfs, &f->file));
 }
 
+static lfs_ssize_t file_read(Filesystem* fs, File* f, void* dst,
+                             lfs_size_t size) {
+    uint32_t reads = fs->stats.reads;
+    lfs_ssize_t res = lfs_file_read(&fs->lfs, &f->file, dst, size);
+    if (res < 0) return res;
+    if (fs->stats.reads == reads) {
+        ++fs->stats.cache_hits;
+    } else {
+        ++fs->stats.cache_misses;
+    }
+    return res;
+}
+
+// Return the number of bytes between the current position and the end of the
+// file, or a negative error code.
+static lfs_soff_t file_remaining(Filesystem* fs, File* f) {
+    lfs_soff_t size = lfs_file_size(&fs->lfs, &f->file);
+    if (size < 0) return size;
+    lfs_soff_t pos = lfs_file_tell(&fs->lfs, &f->file);
+    if (pos < 0) return pos;
+    return pos < size ? size - pos : 0;
+}
+
 static int File_read(lua_State* ls) {
     Filesystem* fs = NULL;
     File* f = check_File(ls, 1, &fs);
-    // TODO: Make size optional
-    // TODO: Use file size as maximum buffer size
-    lfs_size_t size = luaL_checkinteger(ls, 2);
+    lfs_soff_t rem = file_remaining(fs, f);
+    if (rem < 0) return push_error(ls, rem);
+    lfs_size_t size = rem;
+    if (!lua_isnoneornil(ls, 2)) {
+        lua_Integer want = luaL_checkinteger(ls, 2);
+        luaL_argcheck(ls, want >= 0, 2, "invalid size");
+        if ((lua_Unsigned)want < size) size = want;
+    }
     luaL_Buffer buf;
     void* dst = luaL_buffinitsize(ls, &buf, size);
-    lfs_ssize_t res = lfs_file_read(&fs->lfs, &f->file, dst, size);
+    lfs_ssize_t res = file_read(fs, f, dst, size);
     if (res < 0) return push_error(ls, res);
     return luaL_pushresultsize(&buf, res), 1;
 }
 
-static int File_write(lua_State* ls) {
-#ifdef LFS_READONLY
-    return mlua_err_push(ls, MLUA_EROFS);
-#else
+#ifndef LFS_READONLY
+
+static int File_write_1(lua_State* ls, int status, lua_KContext ctx) {
     Filesystem* fs = NULL;
     File* f = check_File(ls, 1, &fs);
-    size_t size;
-    void const* src = luaL_checklstring(ls, 2, &size);
-    lfs_ssize_t res = lfs_file_write(&fs->lfs, &f->file, src, size);
+    size_t len;
+    uint8_t const* src = (uint8_t const*)luaL_checklstring(ls, 2, &len);
+    size_t done = (size_t)ctx;
+    size_t size = len - done;
+    if (!mlua_thread_blocking(ls) && size > fs->config.block_size) {
+        size = fs->config.block_size;
+    }
+    lfs_ssize_t res = lfs_file_write(&fs->lfs, &f->file, src + done, size);
     if (res < 0) return push_error(ls, res);
+    done += res;
+    if (done < len && (size_t)res == size) {
+        return mlua_thread_yield(ls, 0, &File_write_1, (lua_KContext)done);
+    }
+    return lua_pushinteger(ls, done), 1;
+}
+
+#endif
+
+static int File_read_into(lua_State* ls) {
+    Filesystem* fs = NULL;
+    File* f = check_File(ls, 1, &fs);
+    MLuaBuffer buf;
+    size_t off, len;
+    mlua_check_buffer_range(ls, 2, &buf, &off, &len);
+    if (buf.vt == NULL) {
+        lfs_ssize_t res = file_read(fs, f, (uint8_t*)buf.ptr + off, len);
+        if (res < 0) return push_error(ls, res);
+        return lua_pushinteger(ls, res), 1;
+    }
+    lfs_soff_t rem = file_remaining(fs, f);
+    if (rem < 0) return push_error(ls, rem);
+    if ((lua_Unsigned)rem < len) len = rem;
+    uint8_t* dst = lua_newuserdatauv(ls, len, 0);
+    lfs_ssize_t res = file_read(fs, f, dst, len);
+    if (res < 0) return push_error(ls, res);
+    mlua_buffer_write(&buf, off, res, dst);
     return lua_pushinteger(ls, res), 1;
+}
+
+static int File_write(lua_State* ls) {
+#ifdef LFS_READONLY
+    return mlua_err_push(ls, MLUA_EROFS);
+#else
+    lua_settop(ls, 2);
+    return File_write_1(ls, LUA_OK, 0);
 #endif
 }
 
@@ -591,16 +772,41 @@ static int File_truncate(lua_State* ls) {
 #endif
 }
 
+static int File_extent(lua_State* ls) {
+    Filesystem* fs = NULL;
+    File* f = check_File(ls, 1, &fs);
+#ifndef LFS_READONLY
+    if ((f->file.flags & (LFS_F_DIRTY | LFS_F_WRITING)) != 0) {
+        int res = lfs_file_sync(&fs->lfs, &f->file);
+        if (res < 0) return push_error(ls, res);
+    }
+#endif
+    // Inline files are stored in their directory's metadata, which can move
+    // when the directory is compacted. Files larger than a block are split
+    // into blocks that start with skip-list pointers.
+    if ((f->file.flags & LFS_F_INLINE) != 0) {
+        return mlua_err_push(ls, MLUA_ENODATA);
+    }
+    if (f->file.ctz.size > fs->config.block_size) {
+        return mlua_err_push(ls, MLUA_EFBIG);
+    }
+    mlua_push_minint(ls, (uint64_t)f->file.ctz.head * fs->config.block_size);
+    lua_pushinteger(ls, f->file.ctz.size);
+    return 2;
+}
+
 MLUA_SYMBOLS(File_syms) = {
     MLUA_SYM_F(close, File_),
     MLUA_SYM_F(sync, File_),
     MLUA_SYM_F(read, File_),
+    MLUA_SYM_F(read_into, File_),
     MLUA_SYM_F(write, File_),
     MLUA_SYM_F(seek, File_),
     MLUA_SYM_F(tell, File_),
     MLUA_SYM_F(rewind, File_),
     MLUA_SYM_F(size, File_),
     MLUA_SYM_F(truncate, File_),
+    MLUA_SYM_F(extent, File_),
 };
 
 #define File___close File_close
@@ -658,8 +864,10 @@ MLUA_SYMBOLS_NOHASH(Dir_syms_nh) = {
 };
 
 void* mlua_fs_lfs_alloc(MLuaBlockDev* dev) {
-    Filesystem* fs = malloc(sizeof(Filesystem) + 2 * dev->write_size);
-    init_filesystem(fs, dev);
+    FSParams params;
+    default_params(&params, dev);
+    Filesystem* fs = malloc(filesystem_size(&params));
+    init_filesystem(fs, dev, &params);
     return fs;
 }
 
@@ -677,15 +885,31 @@ void mlua_fs_lfs_push(lua_State* ls, void* fs) {
     lua_setmetatable(ls, -2);
 }
 
+bool mlua_fs_lfs_is_file(lua_State* ls, int arg) {
+    return luaL_testudata(ls, arg, File_name) != NULL;
+}
+
+lua_Integer mlua_fs_lfs_read(lua_State* ls, int arg, void* dst, size_t size) {
+    File* f = lua_touserdata(ls, arg);
+    if (lua_getiuservalue(ls, arg, 1) == LUA_TNIL) {
+        return lua_pop(ls, 1), MLUA_EBADF;
+    }
+    Filesystem* fs = to_Filesystem(ls, -1);
+    lua_pop(ls, 1);
+    lfs_ssize_t res = file_read(fs, f, dst, size);
+    return res < 0 ? mlua_err(res) : res;
+}
+
 static int mod_new(lua_State* ls) {
     MLuaBlockDev* dev = mlua_block_check(ls, 1);
-    Filesystem* fs = lua_newuserdatauv(
-        ls, sizeof(Filesystem) + 2 * dev->write_size, 1);
+    FSParams params;
+    check_params(ls, 2, dev, &params);
+    Filesystem* fs = lua_newuserdatauv(ls, filesystem_size(&params), 1);
     luaL_getmetatable(ls, Filesystem_name);
     lua_setmetatable(ls, -2);
     lua_pushvalue(ls, 1);  // Keep dev alive
     lua_setiuservalue(ls, -2, 1);
-    init_filesystem(fs, dev);
+    init_filesystem(fs, dev, &params);
     return 1;
 }
 
@@ -700,6 +924,7 @@ MLUA_SYMBOLS(module_syms) = {
 };
 
 MLUA_OPEN_MODULE(mlua.fs.lfs) {
+    mlua_thread_require(ls);
     mlua_require(ls, "mlua.int64", false);
     mlua_require(ls, "mlua.block", false);
 
@@ -9,6 +9,7 @@ local fs = require 'mlua.fs'
 local lfs = require 'mlua.fs.lfs'
 local list = require 'mlua.list'
 local mem = require 'mlua.mem'
+local thread = require 'mlua.thread'
 local util = require 'mlua.util'
 local table = require 'table'
 
@@ -78,6 +79,42 @@ function test_statvfs(t)
     t:expect(bc2):label("block_count"):eq(size // erase_size)
 end
 
+function test_params(t)
+    local dev = block_mem.new(mem.alloc(32 << 10), 64, 1024)
+    for _, opts in ipairs{
+        {cache_size = 100}, {cache_size = 2048}, {cache_size = 192},
+        {lookahead_size = 12}, {lookahead_size = 16}, {block_cycles = 0},
+    } do
+        t:expect(t.expr(lfs).new(dev, opts)):raises("invalid")
+    end
+    local dfs = lfs.new(dev, {cache_size = 512, lookahead_size = 8,
+                              block_cycles = 100})
+    local stats = dfs:stats()
+    t:expect(stats.cache_size):label("cache_size"):eq(512)
+    t:expect(stats.lookahead_size):label("lookahead_size"):eq(8)
+    t:expect(stats.block_cycles):label("block_cycles"):eq(100)
+    t:assert(dfs:format())
+    t:assert(dfs:mount())
+    t:cleanup(function() assert(dfs:unmount()) end)
+    local data = ('0123456789'):rep(100)
+    do
+        local f<close> = assert(dfs:open('/file', fs.O_WRONLY | fs.O_CREAT))
+        assert(f:write(data))
+    end
+    t:expect(dfs:stats(true)):label("stats")
+        :has('reads'):has('progs'):has('erases'):has('syncs')
+    local f<close> = assert(dfs:open('/file', fs.O_RDONLY))
+    local got = {}
+    for i = 1, #data // 10 do got[i] = f:read(10) end
+    t:expect(table.concat(got)):label("data"):eq(data)
+    stats = dfs:stats()
+    t:expect(stats.cache_hits + stats.cache_misses):label("file reads")
+        :eq(#data // 10)
+    t:expect(stats.cache_hits):label("cache_hits"):gt(stats.cache_misses)
+    t:expect(stats.progs):label("progs"):eq(0)
+    t:expect(stats.read_bytes):label("read_bytes"):gte(#data)
+end
+
 function test_block_accounting(t)
     t:expect(t.expr(dfs):gc()):eq(true)
     t:expect(t.expr(dfs):size()):gt(0)
@@ -145,6 +182,21 @@ function test_file(t)
         local f<close> = assert(dfs:open('/file', fs.O_RDONLY))
         t:expect(t.expr(f):read(100))
             :eq("The quick brown fox flies over the fence")
+        t:expect(t.expr(f):seek(10)):eq(10)
+        t:expect(t.expr(f):read()):eq("brown fox flies over the fence")
+        t:expect(t.expr(f):read()):eq("")
+    end
+    do
+        local f<close> = assert(dfs:open('/file', fs.O_RDONLY))
+        local buf = mem.alloc(16)
+        mem.fill(buf, ('.'):byte())
+        t:expect(t.expr(f):read_into(buf, 2, 9)):eq(9)
+        t:expect(t.expr(mem).read(buf)):eq("..The quick.....")
+        t:expect(t.expr(f):read_into(buf)):eq(16)
+        t:expect(t.expr(mem).read(buf)):eq(" brown fox flies")
+        t:expect(t.expr(f):seek(-2, fs.SEEK_END)):eq(38)
+        t:expect(t.expr(f):read_into(buf, 4)):eq(2)
+        t:expect(t.expr(mem).read(buf, 0, 8)):eq(" broce f")
     end
     t:expect(t.mexpr(dfs):open('/not-found', fs.O_RDONLY))
         :eq{nil, "no such file or directory", errors.ENOENT}
@@ -158,6 +210,40 @@ local function read_dir(path)
     return entries:sort(util.table_comp{1})
 end
 
+function test_write_yields(t)
+    local blocking = thread.blocking(false)
+    t:cleanup(function() thread.blocking(blocking) end)
+    local ticks = 0
+    local counter = thread.start(function()
+        while true do
+            ticks = ticks + 1
+            thread.yield()
+        end
+    end)
+    t:cleanup(function() counter:kill() end)
+    local data = ('0123456789abcdef'):rep(256)
+    local f<close> = assert(dfs:open('/big', fs.O_WRONLY | fs.O_CREAT))
+    t:expect(t.expr(f):write(data)):eq(#data)
+    t:expect(ticks):label("ticks"):gt(0)
+    t:assert(f:close())
+    t:expect(t.mexpr(dfs):stat('/big')):eq{'big', fs.TYPE_REG, #data}
+end
+
+function test_extent(t)
+    local data = ('0123456789'):rep(10)
+    local f<close> = assert(dfs:open('/extent', fs.O_WRONLY | fs.O_CREAT))
+    assert(f:write('abc'))
+    t:expect(t.mexpr(f):extent())
+        :eq{nil, errors.message(errors.ENODATA), errors.ENODATA}
+    assert(f:write(data))
+    local off, size = f:extent()
+    t:expect(size):label("size"):eq(#data + 3)
+    t:expect(t.expr(dev):read(off, size)):eq('abc' .. data)
+    assert(f:write(('x'):rep(256)))
+    t:expect(t.mexpr(f):extent())
+        :eq{nil, errors.message(errors.EFBIG), errors.EFBIG}
+end
+
 function test_dir(t)
     local _ = read_dir  -- Capture the upvalue
     t:expect(t.expr.read_dir('/dir')):eq{
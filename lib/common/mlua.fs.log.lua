@@ -0,0 +1,135 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local fs = require 'mlua.fs'
+local oo = require 'mlua.oo'
+local table = require 'table'
+
+-- An append-only log file. Records are batched in RAM and written to the file
+-- in whole pages, and the file is rotated when it reaches a maximum size.
+Log = oo.class('Log')
+
+function Log:__init(dfs, path, opts)
+    opts = opts or {}
+    self._fs, self._path = dfs, path
+    self._page = opts.page_size or dfs:stats().cache_size
+    self._max_size = opts.max_size or 64 << 10
+    self._files = opts.files or 4
+    if self._page <= 0 or self._max_size < self._page or self._files < 1 then
+        error("invalid log parameters", 2)
+    end
+    self._buf, self._len = {}, 0
+    self.records, self.writes, self.commits, self.rotations = 0, 0, 0, 0
+end
+
+-- Open the current log file, if it isn't open yet.
+function Log:_open(flags)
+    if self._f then return true end
+    local f, msg, err = self._fs:open(
+        self._path, fs.O_WRONLY | fs.O_CREAT | fs.O_APPEND | (flags or 0))
+    if not f then return f, msg, err end
+    local size, msg, err = f:size()
+    if not size then
+        f:close()
+        return size, msg, err
+    end
+    self._f, self._size = f, size
+    return true
+end
+
+-- Return the path of the rotated file with the given index.
+function Log:path(index)
+    if (index or 0) == 0 then return self._path end
+    return ('%s.%d'):format(self._path, index)
+end
+
+-- Rotate the log files: the current file becomes file 1, file 1 becomes file
+-- 2, etc., and the oldest file is removed.
+function Log:_rotate()
+    local ok, msg, err = self._f:close()
+    self._f = nil
+    if not ok then return ok, msg, err end
+    self.rotations = self.rotations + 1
+    if self._files == 1 then return self:_open(fs.O_TRUNC) end
+    local dfs = self._fs
+    dfs:remove(self:path(self._files - 1))
+    for i = self._files - 2, 0, -1 do
+        local from = self:path(i)
+        if dfs:stat(from) then
+            ok, msg, err = dfs:rename(from, self:path(i + 1))
+            if not ok then return ok, msg, err end
+        end
+    end
+    return self:_open()
+end
+
+-- Write the buffered data to the file. Unless "all" is true, only write up to
+-- the last page boundary of the file.
+function Log:_flush(all)
+    local size = self._size
+    local n = self._len
+    if not all then n = n - (size + n) % self._page end
+    if n <= 0 then return true end
+    local data = table.concat(self._buf)
+    if size > 0 and size + n > self._max_size then
+        local ok, msg, err = self:_rotate()
+        if not ok then return ok, msg, err end
+        size = 0
+        if not all then n = self._len - self._len % self._page end
+        if n <= 0 then
+            self._buf = {data}
+            return true
+        end
+    end
+    local ok, msg, err = self._f:write(n < #data and data:sub(1, n) or data)
+    if not ok then
+        self._buf = {data}
+        return ok, msg, err
+    end
+    self.writes = self.writes + 1
+    self._size = size + n
+    self._len = #data - n
+    self._buf = {self._len > 0 and data:sub(n + 1) or nil}
+    return true
+end
+
+-- Append records to the log. Whole pages are written to the file as soon as
+-- they are complete, but the data only becomes durable on commit().
+function Log:write(...)
+    local ok, msg, err = self:_open()
+    if not ok then return ok, msg, err end
+    local buf, len = self._buf, self._len
+    for i = 1, select('#', ...) do
+        local data = select(i, ...)
+        buf[#buf + 1] = data
+        len = len + #data
+    end
+    self._len = len
+    self.records = self.records + select('#', ...)
+    return self:_flush(false)
+end
+
+-- Write all buffered records to the file and make them durable. Calling this
+-- after a group of records, rather than after each record, amortizes the cost
+-- of the sync over the whole group.
+function Log:commit()
+    if not self._f then return true end
+    local ok, msg, err = self:_flush(true)
+    if not ok then return ok, msg, err end
+    self.commits = self.commits + 1
+    return self._f:sync()
+end
+
+-- Commit the buffered records and close the log file.
+function Log:close()
+    if not self._f then return true end
+    local ok, msg, err = self:commit()
+    local cok, cmsg, cerr = self._f:close()
+    self._f = nil
+    if not ok then return ok, msg, err end
+    return cok, cmsg, cerr
+end
+
+Log.__close = Log.close
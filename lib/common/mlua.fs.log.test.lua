@@ -0,0 +1,73 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local block_mem = require 'mlua.block.mem'
+local fs = require 'mlua.fs'
+local lfs = require 'mlua.fs.lfs'
+local log = require 'mlua.fs.log'
+local mem = require 'mlua.mem'
+local string = require 'string'
+
+local dfs
+
+function set_up(t)
+    dfs = lfs.new(block_mem.new(mem.alloc(32 << 10), 64, 1024),
+                  {cache_size = 64})
+    t:assert(dfs:format())
+    t:assert(dfs:mount())
+    t:cleanup(function() assert(dfs:unmount()) end)
+end
+
+local function read_file(path)
+    local f<close> = assert(dfs:open(path, fs.O_RDONLY))
+    return assert(f:read())
+end
+
+local function file_size(path)
+    local _, _, size = dfs:stat(path)
+    return size
+end
+
+function test_params(t)
+    for _, opts in ipairs{{page_size = 0}, {max_size = 32}, {files = 0}} do
+        t:expect(t.expr(log).Log(dfs, '/log', opts)):raises("invalid")
+    end
+end
+
+function test_batching(t)
+    local l<close> = log.Log(dfs, '/log')
+    local rec = '0123456789\n'
+    for i = 1, 5 do t:assert(l:write(rec)) end
+    t:expect(l.writes):label("writes"):eq(0)
+
+    -- Whole pages are written as soon as they are complete.
+    t:assert(l:write(rec, rec))
+    t:expect(l.writes):label("writes"):eq(1)
+    t:expect(l.records):label("records"):eq(7)
+    t:expect(file_size('/log')):label("size"):eq(0)
+
+    -- A commit writes the partial page and makes the data durable.
+    t:assert(l:commit())
+    t:expect(file_size('/log')):label("size"):eq(7 * #rec)
+    t:expect(read_file('/log')):eq(rec:rep(7))
+
+    -- Subsequent writes complete the partial page first.
+    t:assert(l:write(string.rep('x', 64 - 7 * #rec % 64)))
+    t:expect(l.writes):label("writes"):eq(3)
+    t:assert(l:close())
+    t:expect(file_size('/log')):label("size"):eq(128)
+end
+
+function test_rotation(t)
+    local l<close> = log.Log(dfs, '/log', {max_size = 128, files = 3})
+    local page = ('%-63s\n')
+    for i = 1, 7 do t:assert(l:write(page:format(i))) end
+    t:assert(l:commit())
+    t:expect(l.rotations):label("rotations"):eq(3)
+    t:expect(read_file(l:path())):eq(page:format(7))
+    t:expect(read_file(l:path(1))):eq(page:format(5) .. page:format(6))
+    t:expect(read_file(l:path(2))):eq(page:format(3) .. page:format(4))
+    t:expect(dfs:stat(l:path(3))):label("stat(3)"):eq(nil)
+end
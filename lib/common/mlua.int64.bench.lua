@@ -0,0 +1,32 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local int64 = require 'mlua.int64'
+
+function bench_add(b)
+    local v, d = int64(0), int64(3)
+    b:reset()
+    for i = 1, b.n do v = v + d end
+end
+
+function bench_mul(b)
+    local v, m = int64(1), int64(3)
+    b:reset()
+    for i = 1, b.n do v = v * m end
+end
+
+function bench_compare(b)
+    local v, w = int64(1), int64(2)
+    b:reset()
+    for i = 1, b.n do
+        local lt = v < w
+    end
+end
+
+function bench_tostring(b)
+    local v = int64('0x123456789abcdef')
+    b:reset()
+    for i = 1, b.n do tostring(v) end
+end
@@ -93,13 +93,57 @@ bool mlua_string_to_int64(char const* s, int base, int64_t* value) {
 
 #if !MLUA_IS64INT
 
-void mlua_push_int64(lua_State* ls, int64_t value) {
-    int64_t* v = lua_newuserdatauv(ls, sizeof(int64_t), 0);
+// The number of slots in the per-interpreter cache of boxed Int64 values, or 0
+// to disable the cache. The cache is direct-mapped on the value, and each slot
+// keeps one Int64 alive.
+#ifndef MLUA_INT64_CACHE_SIZE
+#define MLUA_INT64_CACHE_SIZE 0
+#endif
+
+// The allocation size of mutable Int64 values. The extra byte distinguishes
+// them from immutable values, which may be shared through the cache.
+#define MUTABLE_SIZE (sizeof(int64_t) + 1)
+
+static void new_int64(lua_State* ls, int64_t value, size_t size) {
+    int64_t* v = lua_newuserdatauv(ls, size, 0);
     *v = value;
     luaL_getmetatable(ls, mlua_int64_name);
     lua_setmetatable(ls, -2);
 }
 
+#if MLUA_INT64_CACHE_SIZE > 0
+
+static char const cache_key[] = "mlua.Int64.cache";
+
+void mlua_push_int64(lua_State* ls, int64_t value) {
+    if (luai_unlikely(
+            lua_rawgetp(ls, LUA_REGISTRYINDEX, cache_key) != LUA_TTABLE)) {
+        lua_pop(ls, 1);
+        new_int64(ls, value, sizeof(int64_t));
+        return;
+    }
+    uint32_t hash = (uint32_t)value ^ (uint32_t)((uint64_t)value >> 32);
+    lua_Integer slot = hash % MLUA_INT64_CACHE_SIZE + 1;
+    if (lua_rawgeti(ls, -1, slot) == LUA_TUSERDATA
+            && *(int64_t*)lua_touserdata(ls, -1) == value) {
+        lua_remove(ls, -2);
+        return;
+    }
+    lua_pop(ls, 1);
+    new_int64(ls, value, sizeof(int64_t));
+    lua_pushvalue(ls, -1);
+    lua_rawseti(ls, -3, slot);
+    lua_remove(ls, -2);
+}
+
+#else  // MLUA_INT64_CACHE_SIZE == 0
+
+void mlua_push_int64(lua_State* ls, int64_t value) {
+    new_int64(ls, value, sizeof(int64_t));
+}
+
+#endif  // MLUA_INT64_CACHE_SIZE == 0
+
 void mlua_push_minint(lua_State* ls, int64_t value) {
     if (luai_likely(LUA_MININTEGER <= value && value <= LUA_MAXINTEGER)) {
         lua_pushinteger(ls, (lua_Integer)value);
@@ -188,6 +232,9 @@ static int int64___new(lua_State* ls) {
 
     case LUA_TUSERDATA:
         if (mlua_test_int64(ls, 1, &value)) {
+#if !MLUA_IS64INT
+            if (lua_rawlen(ls, 1) == MUTABLE_SIZE) break;  // Snapshot
+#endif
             lua_settop(ls, 1);
             return 1;
         }
@@ -413,6 +460,35 @@ CMP_OP(eq, ==, LUA_OPEQ, eq, 1, eq, 1)
 CMP_OP(lt, <, LUA_OPLT, floor, lhs, ceil, rhs)
 CMP_OP(le, <=, LUA_OPLE, floor, lhs, ceil, rhs)
 
+static int64_t* check_mutable(lua_State* ls, int arg) {
+    int64_t* v = luaL_checkudata(ls, arg, mlua_int64_name);
+    luaL_argexpected(ls, lua_rawlen(ls, arg) == MUTABLE_SIZE, arg,
+                     "mutable Int64");
+    return v;
+}
+
+static int int64_mutable(lua_State* ls) {
+    new_int64(ls, luaL_opt(ls, mlua_check_int64, 1, 0), MUTABLE_SIZE);
+    return 1;
+}
+
+static int int64_set(lua_State* ls) {
+    *check_mutable(ls, 1) = mlua_check_int64(ls, 2);
+    lua_settop(ls, 1);
+    return 1;
+}
+
+#define INPLACE_OP(n, op) \
+static int int64_ ## n(lua_State* ls) { \
+    int64_t* v = check_mutable(ls, 1); \
+    *v = INT64_OP(*v, op, mlua_check_int64(ls, 2)); \
+    lua_settop(ls, 1); \
+    return 1; \
+}
+
+INPLACE_OP(add_to, +)
+INPLACE_OP(sub_from, -)
+
 static int int64___tostring(lua_State* ls) {
     int64_t v = mlua_check_int64(ls, 1);
     char s[MLUA_MAX_INT64_STR_SIZE];
@@ -448,6 +524,17 @@ MLUA_SYMBOLS(int64_syms) = {
     MLUA_SYM_F(tointeger, int64_),
     MLUA_SYM_F(tonumber, int64_),
     MLUA_SYM_F(ult, int64_),
+#if !MLUA_IS64INT
+    MLUA_SYM_F(mutable, int64_),
+    MLUA_SYM_F(set, int64_),
+    MLUA_SYM_F(add_to, int64_),
+    MLUA_SYM_F(sub_from, int64_),
+#else
+    MLUA_SYM_V(mutable, boolean, false),
+    MLUA_SYM_V(set, boolean, false),
+    MLUA_SYM_V(add_to, boolean, false),
+    MLUA_SYM_V(sub_from, boolean, false),
+#endif
 };
 
 MLUA_SYMBOLS_NOHASH(int64_syms_nh) = {
@@ -487,5 +574,9 @@ MLUA_OPEN_MODULE(mlua.int64) {
     lua_setfield(ls, -2, "max");
     mlua_push_int64(ls, INT64_MIN);
     lua_setfield(ls, -2, "min");
+#if !MLUA_IS64INT && MLUA_INT64_CACHE_SIZE > 0
+    lua_createtable(ls, MLUA_INT64_CACHE_SIZE, 0);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, cache_key);
+#endif
     return 1;
 }
@@ -385,3 +385,25 @@ function test_concat(t)
     }
     run_binary_ops_tests(t, ops, values, values)
 end
+
+function test_mutable(t)
+    if integer_bits >= 64 then t:skip("Int64 is an alias for integer") end
+    local v = int64.mutable(int64('0x100000000'))
+    t:expect(t.expr(v):set(int64.max)):eq(int64.max)
+    t:expect(t.expr(v):set(-1)):eq(-1)
+    local snap = int64(v)
+    t:expect(t.expr(v):add_to(int64('0x100000001'))):eq(int64('0x100000000'))
+    t:expect(t.expr(v):sub_from(1)):eq(int64('0xffffffff'))
+    t:expect(snap):label("snapshot"):eq(int64(-1))
+    t:expect(t.expr(int64).mutable()):eq(int64(0))
+    t:expect(t.expr(int64(1)):add_to(1)):raises("mutable Int64 expected")
+    t:expect(t.expr(int64.max):set(0)):raises("mutable Int64 expected")
+
+    local step = int64('0x100000000')
+    local count1 = alloc_stats()
+    if not count1 then return end
+    for _ = 1, 100 do v:add_to(step) end
+    local count2 = alloc_stats()
+    t:expect(count2 - count1):label("allocs"):eq(0)
+    t:expect(v):label("v"):eq(int64('0x64ffffffff'))
+end
@@ -3,6 +3,7 @@
 
 _ENV = module(...)
 
+local math = require 'math'
 local oo = require 'mlua.oo'
 local string = require 'string'
 local table = require 'table'
@@ -77,7 +78,7 @@ end
 
 -- Read one newline-terminated line from a reader. May return an unterminated
 -- line if the reader reaches EOF. This function is inefficient, because it
--- reads one character at a time.
+-- reads one character at a time. Prefer BufferedReader:read_line().
 function read_line(reader, ...)
     local parts = {}
     while true do
@@ -90,6 +91,82 @@ function read_line(reader, ...)
     return table.concat(parts)
 end
 
+-- A reader that reads from another reader in large chunks, and allows reading
+-- lines and delimited records efficiently.
+BufferedReader = oo.class('BufferedReader')
+
+function BufferedReader:__init(reader, size)
+    self._r, self._size, self._buf, self._pos = reader, size or 256, '', 1
+end
+
+-- Append a chunk from the underlying reader to the buffered data, discarding
+-- the data that has already been consumed. Returns true if data was read, false
+-- on EOF, or (fail, err).
+function BufferedReader:_fill(...)
+    local data, err = self._r:read(self._size, ...)
+    if not data then return data, err end
+    if #data == 0 then return false end
+    local buf, pos = self._buf, self._pos
+    self._buf = pos > #buf and data or buf:sub(pos) .. data
+    self._pos = 1
+    return true
+end
+
+-- Read at most "len" bytes. Returns buffered data if there is any, or reads
+-- from the underlying reader otherwise.
+function BufferedReader:read(len, ...)
+    local buf, pos = self._buf, self._pos
+    if pos > #buf then
+        if len >= self._size then return self._r:read(len, ...) end
+        local ok, err = self:_fill(...)
+        if not ok then return ok == false and '' or ok, err end
+        buf, pos = self._buf, 1
+    end
+    local e = math.min(pos + len - 1, #buf)
+    self._pos = e + 1
+    return buf:sub(pos, e)
+end
+
+-- Read up to and including the next occurrence of "delim". May return an
+-- unterminated record if the reader reaches EOF.
+function BufferedReader:read_until(delim, ...)
+    local from = self._pos
+    while true do
+        local buf, pos = self._buf, self._pos
+        local _, e = buf:find(delim, from, true)
+        if e then
+            self._pos = e + 1
+            return buf:sub(pos, e)
+        end
+        local ok, err = self:_fill(...)
+        if ok == nil then return ok, err end
+        if not ok then
+            self._buf, self._pos = '', 1
+            return buf:sub(pos)
+        end
+        -- Re-scan the end of the previous data, in case the delimiter spans
+        -- the chunk boundary.
+        from = math.max(1, #buf - pos + 3 - #delim)
+    end
+end
+
+-- Read one newline-terminated line. May return an unterminated line if the
+-- reader reaches EOF.
+function BufferedReader:read_line(...)
+    return self:read_until('\n', ...)
+end
+
+-- Return an iterator over the newline-terminated lines of the reader. Raises an
+-- error if reading fails.
+function BufferedReader:lines(...)
+    local args = table.pack(...)
+    return function()
+        local line, err = self:read_line(table.unpack(args, 1, args.n))
+        if not line then error(err, 2) end
+        if line ~= '' then return line end
+    end
+end
+
 -- A writer that collects writes and can replay them.
 Recorder = oo.class('Recorder')
 
@@ -24,6 +24,49 @@ function test_write(t)
     t:expect(t.expr.tostring(r)):eq('12|34|56|78|90')
 end
 
+local Chunks = oo.class('Chunks')
+
+function Chunks:__init(...) self.chunks, self.reads = {...}, 0 end
+
+function Chunks:read(len)
+    self.reads = self.reads + 1
+    local data = table.remove(self.chunks, 1)
+    if data == false then return nil, 'failed' end
+    if not data then return '' end
+    if #data > len then
+        table.insert(self.chunks, 1, data:sub(len + 1))
+        data = data:sub(1, len)
+    end
+    return data
+end
+
+function test_BufferedReader(t)
+    local r = io.BufferedReader(
+        Chunks('ab\ncd', 'e\n\nf', 'gh--', '-ij\n', 'k'), 4)
+    t:expect(t.expr(r):read_line()):eq('ab\n')
+    t:expect(t.expr(r):read_until('e')):eq('cde')
+    t:expect(t.expr(r):read(1)):eq('\n')
+    t:expect(t.expr(r):read_line()):eq('\n')
+    t:expect(t.expr(r):read_until('---')):eq('fgh---')
+    t:expect(t.expr(r):read(10)):eq('ij\n')
+    t:expect(t.expr(r):read_line()):eq('k')
+    t:expect(t.expr(r):read_line()):eq('')
+    t:expect(t.expr(r):read(1)):eq('')
+
+    local src = Chunks('line 1\nline 2\n', 'line 3')
+    local lines = {}
+    for line in io.BufferedReader(src, 64):lines() do
+        table.insert(lines, line)
+    end
+    t:expect(lines):eq{'line 1\n', 'line 2\n', 'line 3'}
+    t:expect(src.reads):label("reads"):eq(4)
+
+    r = io.BufferedReader(Chunks('abc', false, false), 4)
+    t:expect(t.mexpr(r):read_line()):eq{nil, 'failed'}
+    t:expect(t.expr(function() for _ in r:lines() do end end)())
+        :raises('failed')
+end
+
 function test_Recorder(t)
     local r = io.Recorder()
     t:expect(t.expr(r):is_empty()):eq(true)
@@ -1,6 +1,8 @@
 // Copyright 2023 Remy Blank <remy@c-space.org>
 // SPDX-License-Identifier: MIT
 
+#include <limits.h>
+
 #include "lua.h"
 #include "lauxlib.h"
 #include "mlua/module.h"
@@ -64,6 +66,15 @@ static int list___new(lua_State* ls) {
     return 1;
 }
 
+static int list_new(lua_State* ls) {
+    lua_Integer cap = luaL_optinteger(ls, 1, 0);
+    luaL_argcheck(ls, 0 <= cap && cap <= INT_MAX, 1, "invalid capacity");
+    new_list(ls, cap);
+    lua_pushinteger(ls, 0);
+    lua_rawseti(ls, -2, LEN_IDX);
+    return 1;
+}
+
 static int list___len(lua_State* ls) {
     if (lua_isnoneornil(ls, 1)) return lua_pushinteger(ls, 0), 1;
     if (lua_rawgeti(ls, 1, LEN_IDX) == LUA_TNIL) {
@@ -113,13 +124,13 @@ static int list_append(lua_State* ls) {
     case 1: return 1;
     }
     lua_Integer len = 0;
+    int cnt = lua_gettop(ls) - 1;
     if (lua_isnil(ls, 1)) {
-        new_list(ls, 0);
+        new_list(ls, cnt);
         lua_replace(ls, 1);
     } else {
         len = length(ls, 1);
     }
-    int cnt = lua_gettop(ls) - 1;
 #if MLUA_APPEND_DESCENDING
     // Depending on Lua's allocation strategy for the array part of tables,
     // appending in descending order could be faster (allocate the full size
@@ -190,6 +201,24 @@ static int list_remove(lua_State* ls) {
     return 1;
 }
 
+static int list_slice(lua_State* ls) {
+    lua_Integer b = luaL_optinteger(ls, 2, 1);
+    lua_Integer e = luaL_opt(ls, luaL_checkinteger, 3, length(ls, 1));
+    luaL_argcheck(ls, b >= 1 || b > e, 2, "out of bounds");
+    lua_Integer n = b <= e ? e - b + 1 : 0;
+    luaL_argcheck(ls, n < INT_MAX, 3, "too many elements");
+    if (lua_isnoneornil(ls, 1)) n = 0;
+    else luaL_checktype(ls, 1, LUA_TTABLE);
+    new_list(ls, (int)n);
+    for (lua_Integer i = 1; i <= n; ++i) {
+        lua_rawgeti(ls, 1, b + i - 1);
+        lua_rawseti(ls, -2, i);
+    }
+    lua_pushinteger(ls, n);
+    lua_rawseti(ls, -2, LEN_IDX);
+    return 1;
+}
+
 static int list_pack(lua_State* ls) {
     lua_Integer len = lua_gettop(ls);
     new_list(ls, len);
@@ -256,6 +285,43 @@ static void add_value(lua_State* ls, luaL_Buffer* buf, lua_Integer i) {
     luaL_addvalue(buf);
 }
 
+static int list_move(lua_State* ls) {
+    luaL_checktype(ls, 1, LUA_TTABLE);
+    lua_Integer f = luaL_checkinteger(ls, 2);
+    lua_Integer e = luaL_checkinteger(ls, 3);
+    lua_Integer t = luaL_checkinteger(ls, 4);
+    int dest = lua_isnoneornil(ls, 5) ? 1 : 5;
+    luaL_checktype(ls, dest, LUA_TTABLE);
+    lua_settop(ls, 5);
+    if (e >= f) {
+        luaL_argcheck(ls, f > 0 || e < LUA_MAXINTEGER + f, 3,
+                      "too many elements to move");
+        lua_Integer n = e - f;
+        luaL_argcheck(ls, t >= 1, 4, "out of bounds");
+        luaL_argcheck(ls, t <= LUA_MAXINTEGER - n, 4,
+                      "destination wrap around");
+        if (t > e || t <= f || (dest != 1 && !lua_rawequal(ls, 1, dest))) {
+            for (lua_Integer i = 0; i <= n; ++i) {
+                lua_rawgeti(ls, 1, f + i);
+                lua_rawseti(ls, dest, t + i);
+            }
+        } else {
+            for (lua_Integer i = n; i >= 0; --i) {
+                lua_rawgeti(ls, 1, f + i);
+                lua_rawseti(ls, dest, t + i);
+            }
+        }
+        // Extend the explicit length of the destination if necessary.
+        if (lua_rawgeti(ls, dest, LEN_IDX) != LUA_TNIL
+                && luaL_checkinteger(ls, -1) < t + n) {
+            lua_pushinteger(ls, t + n);
+            lua_rawseti(ls, dest, LEN_IDX);
+        }
+        lua_pop(ls, 1);
+    }
+    return lua_pushvalue(ls, dest), 1;
+}
+
 static int list_concat(lua_State* ls) {
     lua_Integer last = length(ls, 1);
     size_t lsep;
@@ -326,16 +392,17 @@ static int list___repr(lua_State* ls) {
 #define list_eq list___eq
 
 MLUA_SYMBOLS(list_syms) = {
+    MLUA_SYM_F(new, list_),
     MLUA_SYM_F(len, list_),
     MLUA_SYM_F(eq, list_),
     MLUA_SYM_F(ipairs, list_),
     MLUA_SYM_F(append, list_),
     MLUA_SYM_F(insert, list_),
     MLUA_SYM_F(remove, list_),
-    // TODO: MLUA_SYM_F(slice, list_),
+    MLUA_SYM_F(slice, list_),
     MLUA_SYM_F(pack, list_),
     MLUA_SYM_F(unpack, list_),
-    // TODO: MLUA_SYM_F(move, list_),
+    MLUA_SYM_F(move, list_),
     MLUA_SYM_F(concat, list_),
     MLUA_SYM_F(find, list_),
 };
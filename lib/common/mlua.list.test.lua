@@ -20,6 +20,16 @@ function test_list(t)
     end
 end
 
+function test_new(t)
+    t:expect(t.expr(list).new()):eq({[0] = 0})
+    local l = list.new(10)
+    t:expect(l):eq({[0] = 0})
+    t:expect(getmetatable(l)):label("metatable"):eq(list)
+    l:append(1, 2, 3)
+    t:expect(l):eq({[0] = 3, 1, 2, 3})
+    t:expect(t.expr(list).new(-1)):raises("invalid capacity")
+end
+
 function test_len(t)
     for _, test in ipairs{
         {nil, nil, 0, nil},
@@ -157,6 +167,38 @@ function test_unpack(t)
     end
 end
 
+function test_slice(t)
+    for _, test in ipairs{
+        {{nil}, {}},
+        {{{}}, {}},
+        {{{1, 2, 3}}, {1, 2, 3}},
+        {{{[0] = 3, nil, 2, nil}}, {[0] = 3, nil, 2, nil}},
+        {{{1, 2, 3, 4, 5}, 3}, {3, 4, 5}},
+        {{{1, 2, 3, 4, 5}, 2, 3}, {2, 3}},
+        {{{1, 2, 3}, 2, 5}, {[0] = 4, 2, 3}},
+        {{{1, 2, 3}, 4, 3}, {}},
+    } do
+        local args, want = table.unpack(test)
+        t:expect(t.expr(list).slice(table.unpack(args))):eq(want, list.eq)
+    end
+    t:expect(t.expr(list).slice({1, 2}, 0)):raises("out of bounds")
+end
+
+function test_move(t)
+    for _, test in ipairs{
+        {{{1, 2, 3, 4, 5}, 2, 4, 1}, {2, 3, 4, 4, 5}},
+        {{{1, 2, 3, 4, 5}, 1, 3, 3}, {1, 2, 1, 2, 3}},
+        {{{1, 2, 3}, 1, 3, 3}, {1, 2, 1, 2, 3}},
+        {{{1, 2, 3}, 2, 1, 1}, {1, 2, 3}},
+        {{list{1, nil, 3}, 1, 3, 2}, {1, 1, nil, 3}},
+        {{{1, 2, 3}, 1, 2, 2, list{7, 8, 9, 10}}, {7, 1, 2, 10}},
+    } do
+        local args, want = table.unpack(test)
+        t:expect(t.expr(list).move(table.unpack(args))):eq(want, list.eq)
+    end
+    t:expect(t.expr(list).move({}, 1, 2, 0)):raises("out of bounds")
+end
+
 function test_sort(t)
     for _, test in ipairs{
         {{nil}, nil},
@@ -0,0 +1,33 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local mem = require 'mlua.mem'
+
+local size = 256
+
+function bench_read(b)
+    local buf = mem.alloc(size)
+    local read = mem.read
+    b:bytes(size)
+    b:reset()
+    for i = 1, b.n do read(buf) end
+end
+
+function bench_write(b)
+    local buf = mem.alloc(size)
+    local data = ('x'):rep(size)
+    local write = mem.write
+    b:bytes(size)
+    b:reset()
+    for i = 1, b.n do write(buf, data) end
+end
+
+function bench_fill(b)
+    local buf = mem.alloc(size)
+    local fill = mem.fill
+    b:bytes(size)
+    b:reset()
+    for i = 1, b.n do fill(buf, i & 0xff) end
+end
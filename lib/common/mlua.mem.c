@@ -1,16 +1,26 @@
 // Copyright 2023 Remy Blank <remy@c-space.org>
 // SPDX-License-Identifier: MIT
 
+#include <limits.h>
 #include <malloc.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 
+#include "lapi.h"
+#include "lfunc.h"
+#include "lgc.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "lstring.h"
+#include "ltable.h"
 #include "mlua/int64.h"
 #include "mlua/module.h"
 #include "mlua/util.h"
 
-// TODO: Use Buffer for read operations (I2C, SPI, UART, stdio). Allow providing
-//       a buffer when reading, so that it can be re-used.
-
 char const Buffer_name[] = "mlua.mem.Buffer";
 
 static inline void* check_Buffer(lua_State* ls, int arg) {
@@ -161,6 +171,369 @@ static int mod_set(lua_State* ls) {
     return 0;
 }
 
+// The maximum size of integers in pack formats.
+#define PACK_MAXINTSIZE 16
+
+// The size of a lua_Integer.
+#define PACK_SZINT ((size_t)sizeof(lua_Integer))
+
+// The native maximum alignment for the "!" pack format option.
+struct pack_align {
+    char c;
+    union { lua_Number n; double d; void* p; lua_Integer i; long l; } u;
+};
+#define PACK_MAXALIGN offsetof(struct pack_align, u)
+
+// The kinds of pack format options.
+typedef enum PackOpt {
+    PK_INT, PK_UINT, PK_FLOAT, PK_DOUBLE, PK_NUMBER, PK_CHAR, PK_STRING,
+    PK_ZSTR, PK_PADDING, PK_PADDALIGN, PK_NOP,
+} PackOpt;
+
+// The state of a pack_into() or unpack_from() operation.
+typedef struct PackState {
+    lua_State* ls;
+    int arg;  // The index of the format argument
+    bool little;
+    size_t max_align;
+} PackState;
+
+static inline bool native_little(void) {
+    uint16_t v = 1;
+    return *(uint8_t*)&v == 1;
+}
+
+static inline bool is_digit(int c) { return '0' <= c && c <= '9'; }
+
+static size_t get_num(char const** fmt, size_t def) {
+    char const* f = *fmt;
+    if (!is_digit(*f)) return def;
+    size_t v = 0;
+    do {
+        v = v * 10 + (*f++ - '0');
+    } while (is_digit(*f) && v <= ((size_t)INT_MAX - 9) / 10);
+    *fmt = f;
+    return v;
+}
+
+static size_t get_num_limit(PackState* st, char const** fmt, size_t def) {
+    size_t size = get_num(fmt, def);
+    if (luai_unlikely(size > PACK_MAXINTSIZE || size <= 0)) {
+        luaL_error(st->ls, "integral size (%d) out of limits [1,%d]",
+                   (int)size, PACK_MAXINTSIZE);
+    }
+    return size;
+}
+
+// Parse the next pack format option, and return its kind and size.
+static PackOpt get_option(PackState* st, char const** fmt, size_t* size) {
+    int opt = *(*fmt)++;
+    *size = 0;
+    switch (opt) {
+    case 'b': *size = sizeof(char); return PK_INT;
+    case 'B': *size = sizeof(char); return PK_UINT;
+    case 'h': *size = sizeof(short); return PK_INT;
+    case 'H': *size = sizeof(short); return PK_UINT;
+    case 'l': *size = sizeof(long); return PK_INT;
+    case 'L': *size = sizeof(long); return PK_UINT;
+    case 'j': *size = sizeof(lua_Integer); return PK_INT;
+    case 'J': *size = sizeof(lua_Integer); return PK_UINT;
+    case 'T': *size = sizeof(size_t); return PK_UINT;
+    case 'f': *size = sizeof(float); return PK_FLOAT;
+    case 'd': *size = sizeof(double); return PK_DOUBLE;
+    case 'n': *size = sizeof(lua_Number); return PK_NUMBER;
+    case 'i': *size = get_num_limit(st, fmt, sizeof(int)); return PK_INT;
+    case 'I': *size = get_num_limit(st, fmt, sizeof(int)); return PK_UINT;
+    case 's': *size = get_num_limit(st, fmt, sizeof(size_t)); return PK_STRING;
+    case 'c':
+        *size = get_num(fmt, (size_t)-1);
+        if (luai_unlikely(*size == (size_t)-1)) {
+            luaL_error(st->ls, "missing size for format option 'c'");
+        }
+        return PK_CHAR;
+    case 'z': return PK_ZSTR;
+    case 'x': *size = 1; return PK_PADDING;
+    case 'X': return PK_PADDALIGN;
+    case ' ': break;
+    case '<': st->little = true; break;
+    case '>': st->little = false; break;
+    case '=': st->little = native_little(); break;
+    case '!': st->max_align = get_num_limit(st, fmt, PACK_MAXALIGN); break;
+    default: luaL_error(st->ls, "invalid format option '%c'", opt);
+    }
+    return PK_NOP;
+}
+
+// Parse the next pack format option, and return its kind, its size, and the
+// padding required to align it at the given position.
+static PackOpt get_details(PackState* st, size_t pos, char const** fmt,
+                           size_t* size, size_t* ntoalign) {
+    PackOpt opt = get_option(st, fmt, size);
+    size_t align = *size;
+    if (opt == PK_PADDALIGN) {
+        if (**fmt == '\0' || get_option(st, fmt, &align) == PK_CHAR
+                || align == 0) {
+            luaL_argerror(st->ls, st->arg,
+                          "invalid next option for option 'X'");
+        }
+    }
+    *ntoalign = 0;
+    if (align > 1 && opt != PK_CHAR) {
+        if (align > st->max_align) align = st->max_align;
+        if (luai_unlikely((align & (align - 1)) != 0)) {
+            luaL_argerror(st->ls, st->arg,
+                          "format asks for alignment not power of 2");
+        }
+        *ntoalign = (align - (pos & (align - 1))) & (align - 1);
+    }
+    return opt;
+}
+
+static inline void check_space(lua_State* ls, MLuaBuffer const* buf,
+                               lua_Unsigned pos, lua_Unsigned len) {
+    if (luai_unlikely(len > buf->size || pos > buf->size - len)) {
+        luaL_error(ls, "out of bounds");
+    }
+}
+
+// Encode an integer with the given size and endianness.
+static void pack_int(uint8_t* p, lua_Unsigned v, bool little, size_t size,
+                     bool neg) {
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t b = i < PACK_SZINT ? (uint8_t)(v >> (8 * i)) : neg ? 0xff : 0;
+        p[little ? i : size - 1 - i] = b;
+    }
+}
+
+// Decode an integer with the given size and endianness.
+static lua_Integer unpack_int(lua_State* ls, uint8_t const* p, bool little,
+                              size_t size, bool is_signed) {
+    lua_Unsigned v = 0;
+    size_t limit = size <= PACK_SZINT ? size : PACK_SZINT;
+    for (size_t i = limit; i-- > 0;) {
+        v = (v << 8) | p[little ? i : size - 1 - i];
+    }
+    if (size < PACK_SZINT) {
+        if (is_signed) {
+            lua_Unsigned mask = (lua_Unsigned)1 << (size * 8 - 1);
+            v = (v ^ mask) - mask;
+        }
+    } else if (size > PACK_SZINT) {
+        int ext = !is_signed || (lua_Integer)v >= 0 ? 0 : 0xff;
+        for (size_t i = limit; i < size; ++i) {
+            if (luai_unlikely(p[little ? i : size - 1 - i] != ext)) {
+                luaL_error(ls, "%d-byte integer does not fit into Lua Integer",
+                           (int)size);
+            }
+        }
+    }
+    return (lua_Integer)v;
+}
+
+// Copy a floating-point value, converting between native and the given
+// endianness.
+static void copy_endian(void* dest, void const* src, size_t size,
+                        bool little) {
+    if (little == native_little()) {
+        memcpy(dest, src, size);
+        return;
+    }
+    uint8_t* d = dest;
+    uint8_t const* s = src;
+    for (size_t i = 0; i < size; ++i) d[i] = s[size - 1 - i];
+}
+
+static int mod_pack_into(lua_State* ls) {
+    MLuaBuffer dest;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 1, &dest), 1, "buffer");
+    lua_Unsigned off = luaL_optinteger(ls, 2, 0);
+    luaL_argcheck(ls, off <= dest.size, 2, "out of bounds");
+    char const* fmt = luaL_checkstring(ls, 3);
+    PackState st = {.ls = ls, .arg = 3, .little = native_little(),
+                    .max_align = 1};
+
+    int arg = 3;
+    lua_Unsigned pos = off;
+    while (*fmt != '\0') {
+        size_t size, ntoalign;
+        PackOpt opt = get_details(&st, pos - off, &fmt, &size, &ntoalign);
+        check_space(ls, &dest, pos, ntoalign + size);
+        mlua_buffer_fill(&dest, pos, ntoalign, 0);
+        pos += ntoalign;
+        uint8_t tmp[PACK_MAXINTSIZE];
+        switch (opt) {
+        case PK_INT: {
+            lua_Integer v = luaL_checkinteger(ls, ++arg);
+            if (size < PACK_SZINT) {
+                lua_Integer lim = (lua_Integer)1 << (size * 8 - 1);
+                luaL_argcheck(ls, -lim <= v && v < lim, arg,
+                              "integer overflow");
+            }
+            pack_int(tmp, v, st.little, size, v < 0);
+            mlua_buffer_write(&dest, pos, size, tmp);
+            break;
+        }
+        case PK_UINT: {
+            lua_Integer v = luaL_checkinteger(ls, ++arg);
+            if (size < PACK_SZINT) {
+                luaL_argcheck(ls,
+                    (lua_Unsigned)v < ((lua_Unsigned)1 << (size * 8)), arg,
+                    "unsigned overflow");
+            }
+            pack_int(tmp, v, st.little, size, false);
+            mlua_buffer_write(&dest, pos, size, tmp);
+            break;
+        }
+        case PK_FLOAT: {
+            float v = (float)luaL_checknumber(ls, ++arg);
+            copy_endian(tmp, &v, size, st.little);
+            mlua_buffer_write(&dest, pos, size, tmp);
+            break;
+        }
+        case PK_DOUBLE: {
+            double v = (double)luaL_checknumber(ls, ++arg);
+            copy_endian(tmp, &v, size, st.little);
+            mlua_buffer_write(&dest, pos, size, tmp);
+            break;
+        }
+        case PK_NUMBER: {
+            lua_Number v = luaL_checknumber(ls, ++arg);
+            copy_endian(tmp, &v, size, st.little);
+            mlua_buffer_write(&dest, pos, size, tmp);
+            break;
+        }
+        case PK_CHAR: {
+            size_t len;
+            char const* s = luaL_checklstring(ls, ++arg, &len);
+            luaL_argcheck(ls, len <= size, arg, "string longer than given size");
+            mlua_buffer_write(&dest, pos, len, s);
+            mlua_buffer_fill(&dest, pos + len, size - len, 0);
+            break;
+        }
+        case PK_STRING: {
+            size_t len;
+            char const* s = luaL_checklstring(ls, ++arg, &len);
+            luaL_argcheck(ls, size >= sizeof(size_t)
+                              || len < ((size_t)1 << (size * 8)),
+                          arg, "string length does not fit in given size");
+            check_space(ls, &dest, pos + size, len);
+            pack_int(tmp, len, st.little, size, false);
+            mlua_buffer_write(&dest, pos, size, tmp);
+            mlua_buffer_write(&dest, pos + size, len, s);
+            size += len;
+            break;
+        }
+        case PK_ZSTR: {
+            size_t len;
+            char const* s = luaL_checklstring(ls, ++arg, &len);
+            luaL_argcheck(ls, strlen(s) == len, arg, "string contains zeros");
+            check_space(ls, &dest, pos, len + 1);
+            mlua_buffer_write(&dest, pos, len + 1, s);
+            size = len + 1;
+            break;
+        }
+        case PK_PADDING:
+            mlua_buffer_fill(&dest, pos, size, 0);
+            break;
+        case PK_PADDALIGN:
+        case PK_NOP:
+            break;
+        }
+        pos += size;
+    }
+    return lua_pushinteger(ls, pos), 1;
+}
+
+static int mod_unpack_from(lua_State* ls) {
+    MLuaBuffer src;
+    check_ro_buffer(ls, 1, &src);
+    lua_Unsigned off = luaL_optinteger(ls, 2, 0);
+    luaL_argcheck(ls, off <= src.size, 2, "out of bounds");
+    char const* fmt = luaL_checkstring(ls, 3);
+    PackState st = {.ls = ls, .arg = 3, .little = native_little(),
+                    .max_align = 1};
+
+    int cnt = 0;
+    lua_Unsigned pos = off;
+    while (*fmt != '\0') {
+        size_t size, ntoalign;
+        PackOpt opt = get_details(&st, pos - off, &fmt, &size, &ntoalign);
+        check_space(ls, &src, pos, ntoalign + size);
+        pos += ntoalign;
+        luaL_checkstack(ls, 2, "too many results");
+        uint8_t tmp[PACK_MAXINTSIZE];
+        ++cnt;
+        switch (opt) {
+        case PK_INT:
+        case PK_UINT:
+            mlua_buffer_read(&src, pos, size, tmp);
+            lua_pushinteger(ls,
+                            unpack_int(ls, tmp, st.little, size, opt == PK_INT));
+            break;
+        case PK_FLOAT: {
+            float v;
+            mlua_buffer_read(&src, pos, size, tmp);
+            copy_endian(&v, tmp, size, st.little);
+            lua_pushnumber(ls, (lua_Number)v);
+            break;
+        }
+        case PK_DOUBLE: {
+            double v;
+            mlua_buffer_read(&src, pos, size, tmp);
+            copy_endian(&v, tmp, size, st.little);
+            lua_pushnumber(ls, (lua_Number)v);
+            break;
+        }
+        case PK_NUMBER: {
+            lua_Number v;
+            mlua_buffer_read(&src, pos, size, tmp);
+            copy_endian(&v, tmp, size, st.little);
+            lua_pushnumber(ls, v);
+            break;
+        }
+        case PK_CHAR: {
+            luaL_Buffer buf;
+            mlua_buffer_read(&src, pos, size,
+                             luaL_buffinitsize(ls, &buf, size));
+            luaL_pushresultsize(&buf, size);
+            break;
+        }
+        case PK_STRING: {
+            mlua_buffer_read(&src, pos, size, tmp);
+            lua_Unsigned len = unpack_int(ls, tmp, st.little, size, false);
+            check_space(ls, &src, pos + size, len);
+            luaL_Buffer buf;
+            mlua_buffer_read(&src, pos + size, len,
+                             luaL_buffinitsize(ls, &buf, len));
+            luaL_pushresultsize(&buf, len);
+            size += len;
+            break;
+        }
+        case PK_ZSTR: {
+            uint8_t zero = 0;
+            lua_Unsigned end = mlua_buffer_find(&src, pos, src.size - pos,
+                                                &zero, 1);
+            luaL_argcheck(ls, end != LUA_MAXUNSIGNED, 1,
+                          "unfinished string for format 'z'");
+            size_t len = end - pos;
+            luaL_Buffer buf;
+            mlua_buffer_read(&src, pos, len, luaL_buffinitsize(ls, &buf, len));
+            luaL_pushresultsize(&buf, len);
+            size = len + 1;
+            break;
+        }
+        case PK_PADDING:
+        case PK_PADDALIGN:
+        case PK_NOP:
+            --cnt;
+            break;
+        }
+        pos += size;
+    }
+    lua_pushinteger(ls, pos);
+    return cnt + 1;
+}
+
 static int mod_alloc(lua_State* ls) {
     lua_newuserdatauv(ls, luaL_checkinteger(ls, 1), 0);
     luaL_getmetatable(ls, Buffer_name);
@@ -168,6 +541,644 @@ static int mod_alloc(lua_State* ls) {
     return 1;
 }
 
+char const Builder_name[] = "mlua.mem.Builder";
+
+// A growable byte buffer for assembling strings. The data is stored in a
+// Buffer held in the first user value, which is replaced when it grows.
+typedef struct Builder {
+    uint8_t* data;
+    size_t len;
+    size_t cap;
+} Builder;
+
+static inline Builder* check_Builder(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Builder_name);
+}
+
+// Allocate the data buffer of a builder at the given index.
+static void builder_alloc(lua_State* ls, int arg, Builder* b, size_t cap) {
+    uint8_t* data = lua_newuserdatauv(ls, cap, 0);
+    luaL_getmetatable(ls, Buffer_name);
+    lua_setmetatable(ls, -2);
+    if (b->len > 0) memcpy(data, b->data, b->len);
+    lua_setiuservalue(ls, arg, 1);
+    b->data = data;
+    b->cap = cap;
+}
+
+// Ensure that the builder at the given index has space for "n" more bytes, and
+// return a pointer to the end of its data.
+static uint8_t* builder_reserve(lua_State* ls, int arg, Builder* b, size_t n) {
+    if (luai_likely(n <= b->cap - b->len)) return b->data + b->len;
+    if (n > MAX_SIZE - b->len) luaL_error(ls, "builder too large");
+    size_t cap = b->cap < MAX_SIZE / 2 ? 2 * b->cap : MAX_SIZE;
+    if (cap < b->len + n) cap = b->len + n;
+    builder_alloc(ls, lua_absindex(ls, arg), b, cap);
+    return b->data + b->len;
+}
+
+static void builder_add(lua_State* ls, int arg, Builder* b, void const* ptr,
+                        size_t len) {
+    memcpy(builder_reserve(ls, arg, b, len), ptr, len);
+    b->len += len;
+}
+
+static int Builder___new(lua_State* ls) {
+    lua_Integer cap = luaL_optinteger(ls, 2, 64);
+    luaL_argcheck(ls, 0 < cap && (lua_Unsigned)cap <= MAX_SIZE, 2,
+                  "invalid capacity");
+    Builder* b = lua_newuserdatauv(ls, sizeof(Builder), 1);
+    *b = (Builder){0};
+    luaL_getmetatable(ls, Builder_name);
+    lua_setmetatable(ls, -2);
+    builder_alloc(ls, -2, b, cap);
+    return 1;
+}
+
+static int Builder___len(lua_State* ls) {
+    return lua_pushinteger(ls, check_Builder(ls, 1)->len), 1;
+}
+
+static int Builder___buffer(lua_State* ls) {
+    Builder const* b = check_Builder(ls, 1);
+    lua_pushlightuserdata(ls, b->data);
+    lua_pushinteger(ls, b->len);
+    return 2;
+}
+
+static int Builder___tostring(lua_State* ls) {
+    Builder const* b = check_Builder(ls, 1);
+    return lua_pushlstring(ls, (char const*)b->data, b->len), 1;
+}
+
+static int Builder_capacity(lua_State* ls) {
+    return lua_pushinteger(ls, check_Builder(ls, 1)->cap), 1;
+}
+
+static int Builder_add(lua_State* ls) {
+    Builder* b = check_Builder(ls, 1);
+    int top = lua_gettop(ls);
+    for (int i = 2; i <= top; ++i) {
+        if (lua_type(ls, i) == LUA_TNUMBER) {
+            size_t len;
+            char const* s = lua_tolstring(ls, i, &len);
+            builder_add(ls, 1, b, s, len);
+            continue;
+        }
+        MLuaBuffer buf;
+        check_ro_buffer(ls, i, &buf);
+        luaL_argcheck(ls, buf.size != (size_t)-1, i, "buffer has no size");
+        uint8_t* p = builder_reserve(ls, 1, b, buf.size);
+        mlua_buffer_read(&buf, 0, buf.size, p);
+        b->len += buf.size;
+    }
+    return lua_settop(ls, 1), 1;
+}
+
+// Format a single value into the builder at the given index.
+static void builder_format(lua_State* ls, int arg, Builder* b,
+                           char const* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t space = b->cap - b->len;
+    int n = vsnprintf((char*)b->data + b->len, space, fmt, ap);
+    va_end(ap);
+    if (n < 0) luaL_error(ls, "invalid format");
+    if ((size_t)n >= space) {
+        builder_reserve(ls, arg, b, (size_t)n + 1);
+        va_start(ap, fmt);
+        vsnprintf((char*)b->data + b->len, (size_t)n + 1, fmt, ap);
+        va_end(ap);
+    }
+    b->len += n;
+}
+
+// The maximum length of a conversion specification, including its flags,
+// width, precision and length modifier.
+#define MAX_SPEC 32
+
+static int Builder_addf(lua_State* ls) {
+    Builder* b = check_Builder(ls, 1);
+    size_t len;
+    char const* fmt = luaL_checklstring(ls, 2, &len);
+    char const* end = fmt + len;
+    int arg = 2;
+    while (fmt < end) {
+        char const* pct = memchr(fmt, '%', end - fmt);
+        if (pct == NULL) pct = end;
+        if (pct > fmt) builder_add(ls, 1, b, fmt, pct - fmt);
+        if (pct == end) break;
+        fmt = pct + 1;
+        if (fmt < end && *fmt == '%') {
+            builder_add(ls, 1, b, "%", 1);
+            ++fmt;
+            continue;
+        }
+
+        // Parse the flags, width and precision, like string.format().
+        char spec[MAX_SPEC] = "%";
+        size_t n = 1;
+        char const* start = fmt;
+        while (fmt < end && *fmt != '\0' && strchr("-+ #0", *fmt) != NULL) {
+            ++fmt;
+        }
+        for (int i = 0; i < 2 && fmt < end && is_digit(*fmt); ++i) ++fmt;
+        if (fmt < end && *fmt == '.') {
+            ++fmt;
+            for (int i = 0; i < 2 && fmt < end && is_digit(*fmt); ++i) ++fmt;
+        }
+        if (fmt >= end || (size_t)(fmt - start) > MAX_SPEC - 8) {
+            return luaL_error(ls, "invalid conversion '%%%s'", start);
+        }
+        memcpy(spec + n, start, fmt - start);
+        n += fmt - start;
+        char conv = *fmt++;
+        ++arg;
+        switch (conv) {
+        case 'c':
+            spec[n] = 'c';
+            spec[n + 1] = '\0';
+            builder_format(ls, 1, b, spec, (int)luaL_checkinteger(ls, arg));
+            break;
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            memcpy(spec + n, LUA_INTEGER_FRMLEN, sizeof(LUA_INTEGER_FRMLEN));
+            n += sizeof(LUA_INTEGER_FRMLEN) - 1;
+            spec[n] = conv;
+            spec[n + 1] = '\0';
+            builder_format(ls, 1, b, spec,
+                           (LUAI_UACINT)luaL_checkinteger(ls, arg));
+            break;
+        case 'a': case 'A': case 'e': case 'E': case 'f': case 'F': case 'g':
+        case 'G':
+            memcpy(spec + n, LUA_NUMBER_FRMLEN, sizeof(LUA_NUMBER_FRMLEN));
+            n += sizeof(LUA_NUMBER_FRMLEN) - 1;
+            spec[n] = conv;
+            spec[n + 1] = '\0';
+            builder_format(ls, 1, b, spec,
+                           (LUAI_UACNUMBER)luaL_checknumber(ls, arg));
+            break;
+        case 's': {
+            size_t slen;
+            char const* s = luaL_tolstring(ls, arg, &slen);
+            if (n == 1) {
+                builder_add(ls, 1, b, s, slen);
+            } else {
+                spec[n] = 's';
+                spec[n + 1] = '\0';
+                builder_format(ls, 1, b, spec, s);
+            }
+            lua_pop(ls, 1);
+            break;
+        }
+        default:
+            return luaL_error(ls, "invalid conversion '%%%c'", conv);
+        }
+    }
+    return lua_settop(ls, 1), 1;
+}
+
+static int Builder_add_int(lua_State* ls) {
+    Builder* b = check_Builder(ls, 1);
+    lua_Integer v = luaL_checkinteger(ls, 2);
+    char buf[24];
+    char* p = buf + sizeof(buf);
+    lua_Unsigned u = v < 0 ? 0u - (lua_Unsigned)v : (lua_Unsigned)v;
+    do {
+        *--p = '0' + u % 10;
+        u /= 10;
+    } while (u != 0);
+    if (v < 0) *--p = '-';
+    builder_add(ls, 1, b, p, buf + sizeof(buf) - p);
+    return lua_settop(ls, 1), 1;
+}
+
+static int Builder_clear(lua_State* ls) {
+    check_Builder(ls, 1)->len = 0;
+    return lua_settop(ls, 1), 1;
+}
+
+#define Builder_tostring Builder___tostring
+
+MLUA_SYMBOLS(Builder_syms) = {
+    MLUA_SYM_F(capacity, Builder_),
+    MLUA_SYM_F(add, Builder_),
+    MLUA_SYM_F(addf, Builder_),
+    MLUA_SYM_F(add_int, Builder_),
+    MLUA_SYM_F(clear, Builder_),
+    MLUA_SYM_F(tostring, Builder_),
+};
+
+MLUA_SYMBOLS_NOHASH(Builder_syms_nh) = {
+    MLUA_SYM_F_NH(__new, Builder_),
+    MLUA_SYM_F_NH(__len, Builder_),
+    MLUA_SYM_F_NH(__buffer, Builder_),
+    MLUA_SYM_F_NH(__tostring, Builder_),
+};
+
+char const Ring_name[] = "mlua.mem.Ring";
+
+// A byte ring buffer. The data is stored inline, after the header. "head" is
+// the position of the first byte, and "len" the number of bytes in the ring.
+typedef struct Ring {
+    size_t cap;
+    size_t head;
+    size_t len;
+    uint8_t data[];
+} Ring;
+
+static inline Ring* check_Ring(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Ring_name);
+}
+
+// Return the position in the data of the given offset from the head.
+static inline size_t ring_pos(Ring const* r, lua_Unsigned off) {
+    size_t pos = r->head + off;
+    return pos >= r->cap ? pos - r->cap : pos;
+}
+
+static void ring_read(void* ptr, lua_Unsigned off, lua_Unsigned len,
+                      void* dest) {
+    Ring const* r = ptr;
+    size_t pos = ring_pos(r, off);
+    size_t n = r->cap - pos;
+    if (n > len) n = len;
+    memcpy(dest, &r->data[pos], n);
+    memcpy((uint8_t*)dest + n, &r->data[0], len - n);
+}
+
+static void ring_write(void* ptr, lua_Unsigned off, lua_Unsigned len,
+                       void const* src) {
+    Ring* r = ptr;
+    size_t pos = ring_pos(r, off);
+    size_t n = r->cap - pos;
+    if (n > len) n = len;
+    memcpy(&r->data[pos], src, n);
+    memcpy(&r->data[0], (uint8_t const*)src + n, len - n);
+}
+
+static void ring_fill(void* ptr, lua_Unsigned off, lua_Unsigned len,
+                      int value) {
+    Ring* r = ptr;
+    size_t pos = ring_pos(r, off);
+    size_t n = r->cap - pos;
+    if (n > len) n = len;
+    memset(&r->data[pos], value, n);
+    memset(&r->data[0], value, len - n);
+}
+
+static lua_Unsigned ring_find(void* ptr, lua_Unsigned off, lua_Unsigned len,
+                              void const* needle, lua_Unsigned needle_len) {
+    Ring const* r = ptr;
+    if (needle_len > len) return LUA_MAXUNSIGNED;
+    if (needle_len == 0) return off;
+    uint8_t const* nd = needle;
+    lua_Unsigned end = off + len - needle_len;
+    while (off <= end) {
+        // Find the next occurrence of the first byte of the needle.
+        size_t pos = ring_pos(r, off);
+        size_t n = r->cap - pos;
+        if (n > end - off + 1) n = end - off + 1;
+        uint8_t const* p = memchr(&r->data[pos], nd[0], n);
+        if (p == NULL) {
+            off += n;
+            continue;
+        }
+        off += p - &r->data[pos];
+
+        // Compare the rest of the needle, possibly across the wraparound.
+        size_t i = 1, q = ring_pos(r, off + 1);
+        for (; i < needle_len; ++i, ++q) {
+            if (q == r->cap) q = 0;
+            if (r->data[q] != nd[i]) break;
+        }
+        if (i == needle_len) return off;
+        ++off;
+    }
+    return LUA_MAXUNSIGNED;
+}
+
+static MLuaBufferVt const ring_vt = {.read = &ring_read, .write = &ring_write,
+                                     .fill = &ring_fill, .find = &ring_find};
+
+static int Ring___new(lua_State* ls) {
+    lua_Integer cap = luaL_checkinteger(ls, 2);
+    luaL_argcheck(ls, 0 < cap, 2, "invalid capacity");
+    Ring* r = lua_newuserdatauv(ls, sizeof(Ring) + cap, 0);
+    r->cap = cap;
+    r->head = 0;
+    r->len = 0;
+    luaL_getmetatable(ls, Ring_name);
+    lua_setmetatable(ls, -2);
+    return 1;
+}
+
+static int Ring___len(lua_State* ls) {
+    return lua_pushinteger(ls, check_Ring(ls, 1)->len), 1;
+}
+
+static int Ring___buffer(lua_State* ls) {
+    Ring* r = check_Ring(ls, 1);
+    lua_pushlightuserdata(ls, r);
+    lua_pushinteger(ls, r->cap);
+    lua_pushlightuserdata(ls, (void*)&ring_vt);
+    return 3;
+}
+
+static int Ring_capacity(lua_State* ls) {
+    return lua_pushinteger(ls, check_Ring(ls, 1)->cap), 1;
+}
+
+static int Ring_space(lua_State* ls) {
+    Ring const* r = check_Ring(ls, 1);
+    return lua_pushinteger(ls, r->cap - r->len), 1;
+}
+
+static int Ring_write(lua_State* ls) {
+    Ring* r = check_Ring(ls, 1);
+    MLuaBuffer src;
+    check_ro_buffer(ls, 2, &src);
+    lua_Unsigned off = luaL_optinteger(ls, 3, 0);
+    lua_Unsigned len = optlen(ls, &src, 4, src.size - off);
+    check_bounds(ls, &src, off, 3, len, 4);
+
+    size_t space = r->cap - r->len;
+    if (len > space) len = space;
+    if (len > 0) {
+        // Read the source in at most two parts, around the wraparound.
+        size_t pos = ring_pos(r, r->len);
+        size_t n = r->cap - pos;
+        if (n > len) n = len;
+        mlua_buffer_read(&src, off, n, &r->data[pos]);
+        mlua_buffer_read(&src, off + n, len - n, &r->data[0]);
+        r->len += len;
+    }
+    return lua_pushinteger(ls, len), 1;
+}
+
+static int Ring_commit(lua_State* ls) {
+    Ring* r = check_Ring(ls, 1);
+    lua_Unsigned len = luaL_checkinteger(ls, 2);
+    luaL_argcheck(ls, len <= r->cap - r->len, 2, "out of bounds");
+    r->len += len;
+    return 0;
+}
+
+static int peek(lua_State* ls, Ring* r) {
+    lua_Unsigned len = luaL_optinteger(ls, 2, r->len);
+    if (len > r->len) len = r->len;
+    if (len == 0) return lua_pushliteral(ls, ""), 1;
+    luaL_Buffer buf;
+    ring_read(r, 0, len, luaL_buffinitsize(ls, &buf, len));
+    return luaL_pushresultsize(&buf, len), 1;
+}
+
+static void discard(Ring* r, lua_Unsigned len) {
+    r->head = ring_pos(r, len);
+    r->len -= len;
+    if (r->len == 0) r->head = 0;
+}
+
+static int Ring_peek(lua_State* ls) {
+    return peek(ls, check_Ring(ls, 1));
+}
+
+static int Ring_read(lua_State* ls) {
+    Ring* r = check_Ring(ls, 1);
+    peek(ls, r);
+    discard(r, lua_rawlen(ls, -1));
+    return 1;
+}
+
+static int Ring_discard(lua_State* ls) {
+    Ring* r = check_Ring(ls, 1);
+    lua_Unsigned len = luaL_optinteger(ls, 2, r->len);
+    if (len > r->len) len = r->len;
+    discard(r, len);
+    return lua_pushinteger(ls, len), 1;
+}
+
+static int Ring_find(lua_State* ls) {
+    Ring* r = check_Ring(ls, 1);
+    size_t needle_len;
+    char const* needle = luaL_checklstring(ls, 2, &needle_len);
+    lua_Unsigned off = luaL_optinteger(ls, 3, 0);
+    luaL_argcheck(ls, off <= r->len, 3, "out of bounds");
+
+    lua_Unsigned pos = ring_find(r, off, r->len - off, needle, needle_len);
+    if (pos == LUA_MAXUNSIGNED) return 0;
+    return lua_pushinteger(ls, pos), 1;
+}
+
+static int Ring_clear(lua_State* ls) {
+    Ring* r = check_Ring(ls, 1);
+    r->head = 0;
+    r->len = 0;
+    return 0;
+}
+
+MLUA_SYMBOLS(Ring_syms) = {
+    MLUA_SYM_F(capacity, Ring_),
+    MLUA_SYM_F(space, Ring_),
+    MLUA_SYM_F(write, Ring_),
+    MLUA_SYM_F(commit, Ring_),
+    MLUA_SYM_F(read, Ring_),
+    MLUA_SYM_F(peek, Ring_),
+    MLUA_SYM_F(find, Ring_),
+    MLUA_SYM_F(discard, Ring_),
+    MLUA_SYM_F(clear, Ring_),
+};
+
+MLUA_SYMBOLS_NOHASH(Ring_syms_nh) = {
+    MLUA_SYM_F_NH(__new, Ring_),
+    MLUA_SYM_F_NH(__len, Ring_),
+    MLUA_SYM_F_NH(__buffer, Ring_),
+};
+
+char const Pool_name[] = "mlua.mem.Pool";
+char const PoolBuffer_name[] = "mlua.mem.PoolBuffer";
+
+// The alignment of pool blocks.
+#define POOL_ALIGN 8
+
+// A pool of fixed-size memory blocks, allocated in a single contiguous region
+// after the header. Each block is permanently associated with a PoolBuffer,
+// and the PoolBuffers of the free blocks are kept in a stack in the first user
+// value, so that acquiring and releasing blocks doesn't allocate.
+typedef struct Pool {
+    size_t block_size;
+    size_t count;
+    size_t free;
+    size_t peak;
+    size_t failures;
+    _Alignas(POOL_ALIGN) uint8_t data[];
+} Pool;
+
+// A block acquired from a pool. The first user value is the pool.
+typedef struct PoolBuffer {
+    uint8_t* ptr;
+    bool active;
+} PoolBuffer;
+
+static inline Pool* check_Pool(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Pool_name);
+}
+
+static inline PoolBuffer* check_PoolBuffer(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, PoolBuffer_name);
+}
+
+static int Pool___new(lua_State* ls) {
+    lua_Integer size = luaL_checkinteger(ls, 2);
+    luaL_argcheck(ls, 0 < size && (lua_Unsigned)size <= SIZE_MAX - POOL_ALIGN,
+                  2, "invalid block size");
+    lua_Integer count = luaL_checkinteger(ls, 3);
+    luaL_argcheck(ls, 0 < count && count <= INT_MAX, 3, "invalid count");
+    size_t stride = (size + POOL_ALIGN - 1) & ~(size_t)(POOL_ALIGN - 1);
+    luaL_argcheck(ls, (size_t)count <= (SIZE_MAX - sizeof(Pool)) / stride, 3,
+                  "pool too large");
+    Pool* pool = lua_newuserdatauv(ls, sizeof(Pool) + count * stride, 1);
+    pool->block_size = size;
+    pool->count = count;
+    pool->free = count;
+    pool->peak = 0;
+    pool->failures = 0;
+    luaL_getmetatable(ls, Pool_name);
+    lua_setmetatable(ls, -2);
+
+    // Create the PoolBuffers for all blocks.
+    lua_createtable(ls, count, 0);
+    for (lua_Integer i = 0; i < count; ++i) {
+        PoolBuffer* buf = lua_newuserdatauv(ls, sizeof(PoolBuffer), 1);
+        buf->ptr = &pool->data[(count - 1 - i) * stride];
+        buf->active = false;
+        lua_pushvalue(ls, -3);
+        lua_setiuservalue(ls, -2, 1);
+        luaL_getmetatable(ls, PoolBuffer_name);
+        lua_setmetatable(ls, -2);
+        lua_rawseti(ls, -2, i + 1);
+    }
+    lua_setiuservalue(ls, -2, 1);
+    return 1;
+}
+
+static int Pool_acquire(lua_State* ls) {
+    Pool* pool = check_Pool(ls, 1);
+    if (pool->free == 0) {
+        ++pool->failures;
+        return 0;
+    }
+    lua_getiuservalue(ls, 1, 1);
+    lua_rawgeti(ls, -1, pool->free);
+    lua_pushnil(ls);
+    lua_rawseti(ls, -3, pool->free);
+    --pool->free;
+    size_t used = pool->count - pool->free;
+    if (used > pool->peak) pool->peak = used;
+    ((PoolBuffer*)lua_touserdata(ls, -1))->active = true;
+    return 1;
+}
+
+static int Pool___len(lua_State* ls) {
+    return lua_pushinteger(ls, check_Pool(ls, 1)->free), 1;
+}
+
+static int Pool_block_size(lua_State* ls) {
+    return lua_pushinteger(ls, check_Pool(ls, 1)->block_size), 1;
+}
+
+static int Pool_count(lua_State* ls) {
+    return lua_pushinteger(ls, check_Pool(ls, 1)->count), 1;
+}
+
+static int Pool_stats(lua_State* ls) {
+    Pool* pool = check_Pool(ls, 1);
+    bool reset = mlua_to_cbool(ls, 2);
+    lua_pushinteger(ls, pool->count - pool->free);
+    lua_pushinteger(ls, pool->peak);
+    lua_pushinteger(ls, pool->failures);
+    if (reset) {
+        pool->peak = pool->count - pool->free;
+        pool->failures = 0;
+    }
+    return 3;
+}
+
+MLUA_SYMBOLS(Pool_syms) = {
+    MLUA_SYM_F(acquire, Pool_),
+    MLUA_SYM_F(block_size, Pool_),
+    MLUA_SYM_F(count, Pool_),
+    MLUA_SYM_F(stats, Pool_),
+};
+
+MLUA_SYMBOLS_NOHASH(Pool_syms_nh) = {
+    MLUA_SYM_F_NH(__new, Pool_),
+    MLUA_SYM_F_NH(__len, Pool_),
+};
+
+// Return the PoolBuffer at the given index to its pool.
+static void release(lua_State* ls, int arg, PoolBuffer* buf) {
+    if (!buf->active) return;
+    buf->active = false;
+    lua_getiuservalue(ls, arg, 1);
+    Pool* pool = lua_touserdata(ls, -1);
+    lua_getiuservalue(ls, -1, 1);
+    lua_pushvalue(ls, arg);
+    lua_rawseti(ls, -2, ++pool->free);
+    lua_pop(ls, 2);
+}
+
+static int PoolBuffer_release(lua_State* ls) {
+    release(ls, 1, check_PoolBuffer(ls, 1));
+    return 0;
+}
+
+static int PoolBuffer___gc(lua_State* ls) {
+    PoolBuffer* buf = check_PoolBuffer(ls, 1);
+    if (!buf->active) return 0;
+
+    // Returning the buffer to the pool resurrects it. Set its metatable again,
+    // so that it gets finalized the next time it becomes unreachable.
+    release(ls, 1, buf);
+    lua_getmetatable(ls, 1);
+    lua_setmetatable(ls, 1);
+    return 0;
+}
+
+static int PoolBuffer_ptr(lua_State* ls) {
+    PoolBuffer* buf = check_PoolBuffer(ls, 1);
+    if (!buf->active) return 0;
+    return lua_pushlightuserdata(ls, buf->ptr), 1;
+}
+
+static int PoolBuffer___len(lua_State* ls) {
+    check_PoolBuffer(ls, 1);
+    lua_getiuservalue(ls, 1, 1);
+    return lua_pushinteger(ls, ((Pool*)lua_touserdata(ls, -1))->block_size), 1;
+}
+
+static int PoolBuffer___buffer(lua_State* ls) {
+    PoolBuffer* buf = check_PoolBuffer(ls, 1);
+    if (!buf->active) return 0;
+    lua_getiuservalue(ls, 1, 1);
+    lua_pushlightuserdata(ls, buf->ptr);
+    lua_pushinteger(ls, ((Pool*)lua_touserdata(ls, -2))->block_size);
+    return 2;
+}
+
+MLUA_SYMBOLS(PoolBuffer_syms) = {
+    MLUA_SYM_F(ptr, PoolBuffer_),
+    MLUA_SYM_F(release, PoolBuffer_),
+};
+
+#define PoolBuffer___close PoolBuffer_release
+
+MLUA_SYMBOLS_NOHASH(PoolBuffer_syms_nh) = {
+    MLUA_SYM_F_NH(__gc, PoolBuffer_),
+    MLUA_SYM_F_NH(__close, PoolBuffer_),
+    MLUA_SYM_F_NH(__len, PoolBuffer_),
+    MLUA_SYM_F_NH(__buffer, PoolBuffer_),
+};
+
 static int mod_mallinfo(lua_State* ls) {
 #ifdef __GLIBC__
     struct mallinfo2 info = mallinfo2();
@@ -179,6 +1190,340 @@ static int mod_mallinfo(lua_State* ls) {
     return 2;
 }
 
+#if MLUA_ALLOC_PROFILE
+
+static char const* const profile_type_names[MLUA_ALLOC_PROFILE_TYPES] = {
+    [0] = "other",
+    [LUA_NUMTYPES] = "upvalue",
+    [LUA_NUMTYPES + 1] = "proto",
+};
+
+static int mod_profile(lua_State* ls) {
+    bool reset = mlua_to_cbool(ls, 1);
+    MLuaAllocProfile* prof = &mlua_global(ls)->alloc_profile;
+    lua_createtable(ls, 0, 4);
+
+    // Size histogram.
+    lua_createtable(ls, MLUA_ALLOC_PROFILE_BUCKETS, 0);
+    for (int i = 0; i < MLUA_ALLOC_PROFILE_BUCKETS; ++i) {
+        lua_pushinteger(ls, prof->sizes[i]);
+        lua_rawseti(ls, -2, i + 1);
+    }
+    lua_setfield(ls, -2, "sizes");
+
+    // Objects by type.
+    lua_createtable(ls, 0, MLUA_ALLOC_PROFILE_TYPES);
+    for (int i = 0; i < MLUA_ALLOC_PROFILE_TYPES; ++i) {
+        if (prof->type_count[i] == 0) continue;
+        lua_createtable(ls, 0, 2);
+        lua_pushinteger(ls, prof->type_count[i]);
+        lua_setfield(ls, -2, "count");
+        mlua_push_size(ls, prof->type_size[i]);
+        lua_setfield(ls, -2, "size");
+        char const* name = profile_type_names[i];
+        lua_setfield(ls, -2, name != NULL ? name : lua_typename(ls, i));
+    }
+    lua_setfield(ls, -2, "types");
+
+    // Sampled locations, by decreasing sample count.
+    uint8_t order[MLUA_ALLOC_PROFILE_SITES];
+    int count = 0;
+    for (int i = 0; i < MLUA_ALLOC_PROFILE_SITES; ++i) {
+        uint32_t c = prof->sites[i].count;
+        if (c == 0) continue;
+        int j = count++;
+        for (; j > 0 && prof->sites[order[j - 1]].count < c; --j) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+    }
+    lua_createtable(ls, count, 0);
+    for (int i = 0; i < count; ++i) {
+        MLuaAllocSite const* site = &prof->sites[order[i]];
+        lua_createtable(ls, 0, 3);
+        lua_pushstring(ls, site->source);
+        lua_setfield(ls, -2, "source");
+        lua_pushinteger(ls, site->line);
+        lua_setfield(ls, -2, "line");
+        lua_pushinteger(ls, site->count);
+        lua_setfield(ls, -2, "count");
+        lua_rawseti(ls, -2, i + 1);
+    }
+    lua_setfield(ls, -2, "sites");
+    lua_pushinteger(ls, prof->unattributed);
+    lua_setfield(ls, -2, "unattributed");
+
+    if (reset) memset(prof, 0, sizeof(*prof));
+    return 1;
+}
+
+#else
+
+static int mod_profile(lua_State* ls) { return 0; }
+
+#endif  // MLUA_ALLOC_PROFILE
+
+// The number of table size buckets in heap snapshots. Bucket i > 0 counts
+// tables with [2^(i-1), 2^i) slots, bucket 0 counts empty tables, and the last
+// bucket counts all larger tables.
+#define SNAPSHOT_TABLE_BUCKETS 20
+
+// Heap snapshot aggregates by object type, including upvalues and prototypes.
+#define SNAPSHOT_TYPES (LUA_NUMTYPES + 2)
+
+typedef struct SnapshotEntry {
+    lua_Integer count;
+    lua_Integer size;
+} SnapshotEntry;
+
+typedef struct Snapshot {
+    SnapshotEntry types[SNAPSHOT_TYPES];
+    SnapshotEntry tables[SNAPSHOT_TABLE_BUCKETS];
+} Snapshot;
+
+// Return the approximate memory size of a collectable object, as computed by
+// the collector when freeing it.
+static size_t object_size(GCObject* o) {
+    switch (o->tt) {
+    case LUA_VSHRSTR:
+    case LUA_VLNGSTR:
+        return sizelstring(tsslen(gco2ts(o)));
+    case LUA_VTABLE: {
+        Table* t = gco2t(o);
+        size_t size = sizeof(Table) + luaH_realasize(t) * sizeof(TValue);
+        if (!isdummy(t)) size += sizenode(t) * sizeof(Node);
+        return size;
+    }
+    case LUA_VUSERDATA: {
+        Udata* u = gco2u(o);
+        return sizeudata(u->nuvalue, u->len);
+    }
+    case LUA_VLCL:
+        return sizeLclosure(gco2lcl(o)->nupvalues);
+    case LUA_VCCL:
+        return sizeCclosure(gco2ccl(o)->nupvalues);
+    case LUA_VUPVAL:
+        return sizeof(UpVal);
+    case LUA_VPROTO: {
+        Proto* p = gco2p(o);
+        return sizeof(Proto) + p->sizecode * sizeof(Instruction)
+               + p->sizek * sizeof(TValue) + p->sizep * sizeof(Proto*)
+               + p->sizelineinfo + p->sizeabslineinfo * sizeof(AbsLineInfo)
+               + p->sizelocvars * sizeof(LocVar)
+               + p->sizeupvalues * sizeof(Upvaldesc);
+    }
+    case LUA_VTHREAD: {
+        lua_State* th = gco2th(o);
+        return sizeof(lua_State) + LUA_EXTRASPACE
+               + (stacksize(th) + EXTRA_STACK) * sizeof(StackValue)
+               + th->nci * sizeof(CallInfo);
+    }
+    default:
+        return 0;
+    }
+}
+
+// Add an entry to the aggregate table at the top of the stack, under the key
+// below it, and pop the key.
+static void add_entry(lua_State* ls, lua_Integer count, lua_Integer size) {
+    lua_pushvalue(ls, -2);
+    if (lua_rawget(ls, -2) == LUA_TNIL) {
+        lua_pop(ls, 1);
+        lua_createtable(ls, 0, 2);
+        lua_pushinteger(ls, 0);
+        lua_setfield(ls, -2, "count");
+        lua_pushinteger(ls, 0);
+        lua_setfield(ls, -2, "size");
+        lua_pushvalue(ls, -3);
+        lua_pushvalue(ls, -2);
+        lua_rawset(ls, -4);
+    }
+    lua_getfield(ls, -1, "count");
+    lua_pushinteger(ls, lua_tointeger(ls, -1) + count);
+    lua_setfield(ls, -3, "count");
+    lua_getfield(ls, -2, "size");
+    lua_pushinteger(ls, lua_tointeger(ls, -1) + size);
+    lua_setfield(ls, -4, "size");
+    lua_pop(ls, 3);
+    lua_remove(ls, -2);
+}
+
+// Add an object to the per-name aggregate at the given index, if its metatable
+// has a __name field.
+static void add_named(lua_State* ls, int names, Table* mt, size_t size) {
+    if (mt == NULL) return;
+    sethvalue2s(ls, ls->top.p, mt);
+    api_incr_top(ls);
+    lua_pushliteral(ls, "__name");
+    if (lua_rawget(ls, -2) != LUA_TSTRING) {
+        lua_pop(ls, 2);
+        return;
+    }
+    lua_remove(ls, -2);
+    lua_pushvalue(ls, names);
+    add_entry(ls, 1, size);
+    lua_pop(ls, 1);
+}
+
+static void walk_objects(lua_State* ls, Snapshot* snap, int names,
+                         GCObject* o) {
+    global_State* g = G(ls);
+    for (; o != NULL; o = o->next) {
+        if (isdead(g, o)) continue;
+        size_t size = object_size(o);
+        int type = novariant(o->tt);
+        SnapshotEntry* e = &snap->types[type];
+        ++e->count;
+        e->size += size;
+        if (o->tt == LUA_VTABLE) {
+            Table* t = gco2t(o);
+            lua_Unsigned slots = luaH_realasize(t);
+            if (!isdummy(t)) slots += sizenode(t);
+            int bucket = 0;
+            while (slots != 0 && bucket < SNAPSHOT_TABLE_BUCKETS - 1) {
+                slots >>= 1;
+                ++bucket;
+            }
+            e = &snap->tables[bucket];
+            ++e->count;
+            e->size += size;
+            add_named(ls, names, t->metatable, size);
+        } else if (o->tt == LUA_VUSERDATA) {
+            add_named(ls, names, gco2u(o)->metatable, size);
+        }
+    }
+}
+
+static char const* const snapshot_type_names[SNAPSHOT_TYPES] = {
+    [LUA_NUMTYPES] = "upvalue",
+    [LUA_NUMTYPES + 1] = "proto",
+};
+
+static void push_entries(lua_State* ls, SnapshotEntry const* entries, int n,
+                         bool by_type) {
+    lua_createtable(ls, 0, n);
+    for (int i = 0; i < n; ++i) {
+        SnapshotEntry const* e = &entries[i];
+        if (e->count == 0) continue;
+        if (!by_type) {
+            lua_pushinteger(ls, i == 0 ? 0 : (lua_Integer)1 << (i - 1));
+        } else if (snapshot_type_names[i] != NULL) {
+            lua_pushstring(ls, snapshot_type_names[i]);
+        } else {
+            lua_pushstring(ls, lua_typename(ls, i));
+        }
+        lua_createtable(ls, 0, 2);
+        lua_pushinteger(ls, e->count);
+        lua_setfield(ls, -2, "count");
+        lua_pushinteger(ls, e->size);
+        lua_setfield(ls, -2, "size");
+        lua_rawset(ls, -3);
+    }
+}
+
+static int mod_snapshot(lua_State* ls) {
+    // Stop the collector while walking the object lists, so that no object is
+    // freed. Objects created during the walk are prepended to the lists, so
+    // they aren't visited.
+    lua_settop(ls, 0);
+    bool running = lua_gc(ls, LUA_GCISRUNNING);
+    lua_gc(ls, LUA_GCSTOP);
+    Snapshot snap;
+    memset(&snap, 0, sizeof(snap));
+    lua_newtable(ls);  // names
+    global_State* g = G(ls);
+    walk_objects(ls, &snap, 1, g->allgc);
+    walk_objects(ls, &snap, 1, g->finobj);
+    walk_objects(ls, &snap, 1, g->tobefnz);
+    walk_objects(ls, &snap, 1, g->fixedgc);
+    if (running) lua_gc(ls, LUA_GCRESTART);
+
+    lua_createtable(ls, 0, 3);
+    push_entries(ls, snap.types, SNAPSHOT_TYPES, true);
+    lua_setfield(ls, -2, "types");
+    lua_pushvalue(ls, 1);
+    lua_setfield(ls, -2, "names");
+    push_entries(ls, snap.tables, SNAPSHOT_TABLE_BUCKETS, false);
+    lua_setfield(ls, -2, "tables");
+    return 1;
+}
+
+static char const* const diff_categories[] = {"types", "names", "tables"};
+
+// Return the count and size of an entry of a snapshot category table at the
+// given index, or zero if the entry doesn't exist.
+static void get_entry(lua_State* ls, int cat, int key, lua_Integer* count,
+                      lua_Integer* size) {
+    *count = *size = 0;
+    lua_pushvalue(ls, key);
+    if (lua_gettable(ls, cat) == LUA_TTABLE) {
+        lua_getfield(ls, -1, "count");
+        *count = lua_tointeger(ls, -1);
+        lua_getfield(ls, -2, "size");
+        *size = lua_tointeger(ls, -1);
+        lua_pop(ls, 2);
+    }
+    lua_pop(ls, 1);
+}
+
+// Write the entries that differ between two snapshots. The stack holds: old,
+// new, out, the current key. The context is 2 * category + pass, where pass 0
+// iterates over the entries of the new snapshot, and pass 1 over the entries
+// of the old snapshot that are missing in the new one.
+static int diff_1(lua_State* ls, int status, lua_KContext ctx) {
+    for (; ctx < 2 * (lua_KContext)MLUA_SIZE(diff_categories); ++ctx) {
+        char const* name = diff_categories[ctx / 2];
+        bool pass = ctx % 2;
+        lua_settop(ls, 4);
+        lua_getfield(ls, 1, name);  // 5: old category
+        lua_getfield(ls, 2, name);  // 6: new category
+        int src = pass ? 5 : 6;
+        if (!lua_istable(ls, src)) {
+            lua_pushnil(ls);
+            lua_replace(ls, 4);
+            continue;
+        }
+        lua_pushvalue(ls, 4);
+        while (lua_next(ls, src)) {
+            lua_pop(ls, 1);
+            lua_Integer old_count = 0, old_size = 0, count = 0, size = 0;
+            if (lua_istable(ls, 5)) get_entry(ls, 5, -1, &old_count, &old_size);
+            if (lua_istable(ls, 6)) get_entry(ls, 6, -1, &count, &size);
+            if (pass && (count != 0 || size != 0)) continue;
+            if (count == old_count && size == old_size) continue;
+            lua_replace(ls, 4);  // Save the key
+            char line[96];
+            char const* key = luaL_tolstring(ls, 4, NULL);
+            snprintf(line, sizeof(line), "%-6s %-32s %+8lld %+10lld\n", name,
+                     key, (long long)(count - old_count),
+                     (long long)(size - old_size));
+            lua_settop(ls, 4);
+            lua_getfield(ls, 3, "write");
+            lua_pushvalue(ls, 3);
+            lua_pushstring(ls, line);
+            lua_callk(ls, 2, 0, ctx, &diff_1);
+            lua_getfield(ls, 1, name);
+            lua_getfield(ls, 2, name);
+            lua_pushvalue(ls, 4);
+        }
+        lua_pushnil(ls);
+        lua_replace(ls, 4);
+    }
+    return 0;
+}
+
+static int mod_diff(lua_State* ls) {
+    luaL_checktype(ls, 1, LUA_TTABLE);
+    luaL_checktype(ls, 2, LUA_TTABLE);
+    lua_settop(ls, 3);
+    if (lua_isnil(ls, 3)) {
+        lua_getglobal(ls, "stdout");
+        lua_replace(ls, 3);
+    }
+    lua_pushnil(ls);
+    return diff_1(ls, LUA_OK, 0);
+}
+
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(read, mod_),
     MLUA_SYM_F(read_cstr, mod_),
@@ -187,8 +1532,16 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(find, mod_),
     MLUA_SYM_F(get, mod_),
     MLUA_SYM_F(set, mod_),
+    MLUA_SYM_F(pack_into, mod_),
+    MLUA_SYM_F(unpack_from, mod_),
     MLUA_SYM_F(alloc, mod_),
+    MLUA_SYM_V(Builder, boolean, false),
+    MLUA_SYM_V(Ring, boolean, false),
+    MLUA_SYM_V(Pool, boolean, false),
     MLUA_SYM_F(mallinfo, mod_),
+    MLUA_SYM_F(profile, mod_),
+    MLUA_SYM_F(snapshot, mod_),
+    MLUA_SYM_F(diff, mod_),
 };
 
 MLUA_OPEN_MODULE(mlua.mem) {
@@ -202,5 +1555,22 @@ MLUA_OPEN_MODULE(mlua.mem) {
     // Create the Buffer class.
     mlua_new_class(ls, Buffer_name, Buffer_syms, Buffer_syms_nh);
     lua_pop(ls, 1);
+
+    // Create the Builder class.
+    mlua_new_class(ls, Builder_name, Builder_syms, Builder_syms_nh);
+    mlua_set_metaclass(ls);
+    lua_setfield(ls, -2, "Builder");
+
+    // Create the Ring class.
+    mlua_new_class(ls, Ring_name, Ring_syms, Ring_syms_nh);
+    mlua_set_metaclass(ls);
+    lua_setfield(ls, -2, "Ring");
+
+    // Create the Pool and PoolBuffer classes.
+    mlua_new_class(ls, Pool_name, Pool_syms, Pool_syms_nh);
+    mlua_set_metaclass(ls);
+    lua_setfield(ls, -2, "Pool");
+    mlua_new_class(ls, PoolBuffer_name, PoolBuffer_syms, PoolBuffer_syms_nh);
+    lua_pop(ls, 1);
     return 1;
 }
@@ -3,6 +3,7 @@
 
 _ENV = module(...)
 
+local math = require 'math'
 local mem = require 'mlua.mem'
 local string = require 'string'
 local table = require 'table'
@@ -205,3 +206,232 @@ function _test_set(t)
         else exp:raises("out of bounds") end
     end
 end
+
+function test_pack_into_unpack_from(t)
+    local buf = mem.alloc(40)
+    for _, test in ipairs{
+        {'<i4', -2},
+        {'>I3 b B', 0x123456, -1, 255},
+        {'<h >H =j', -300, 0xabcd, math.mininteger},
+        {'!4 b i4 Xi8 d', 1, 2, 3.5},
+        {'<f n x', 1.5, -2.25},
+        {'<i12 >I16', -5, 7},
+        {'c5 z s1 s', 'ab', 'cde', 'fg', ''},
+        {'<!8 Xd c3 xXi2 T', 'xyz', 42},
+    } do
+        local fmt = test[1]
+        local want = string.pack(fmt, table.unpack(test, 2))
+        mem.fill(buf, 0xaa)
+        t:expect(t.expr(mem).pack_into(buf, 3, fmt, table.unpack(test, 2)))
+            :eq(3 + #want)
+        t:expect(t.expr(mem).read(buf, 3, #want)):eq(want)
+        t:expect(t.expr(mem).read(buf, 0, 3)):eq('\xaa\xaa\xaa')
+        local got = table.pack(mem.unpack_from(buf, 3, fmt))
+        local exp = table.pack(string.unpack(fmt, want))
+        t:expect(got.n):label("%s: n", fmt):eq(exp.n)
+        for i = 1, exp.n - 1 do
+            t:expect(got[i]):label("%s: value %s", fmt, i):eq(exp[i])
+        end
+        t:expect(got[got.n]):label("%s: next", fmt):eq(3 + exp[exp.n] - 1)
+        local vals = {table.unpack(got, 1, got.n - 1)}
+        vals[#vals + 1] = #want
+        t:expect(t.mexpr(mem).unpack_from(want, 0, fmt)):eq(vals)
+    end
+
+    -- Bounds and errors.
+    t:expect(t.expr(mem).pack_into(buf, 38, '<i4', 1)):raises("out of bounds")
+    t:expect(t.expr(mem).pack_into(buf, 41, 'b', 1)):raises("out of bounds")
+    t:expect(t.expr(mem).pack_into(buf, 0, 'b', 128))
+        :raises("integer overflow")
+    t:expect(t.expr(mem).pack_into(buf, 0, 'q', 1))
+        :raises("invalid format option 'q'")
+    t:expect(t.expr(mem).unpack_from(buf, 37, '<i4')):raises("out of bounds")
+    t:expect(t.expr(mem).unpack_from('abc', 0, 'z'))
+        :raises("unfinished string for format 'z'")
+    local r = mem.Ring(8)
+    r:write('\x01\x00\x02\x00')
+    t:expect(t.mexpr(mem).unpack_from(r, 0, '<I2 I2')):eq{1, 2, 4}
+end
+
+function test_Builder(t)
+    local b = mem.Builder(4)
+    t:expect(#b):label("#b"):eq(0)
+    t:expect(t.expr(b):capacity()):eq(4)
+    t:expect(t.expr(b):tostring()):eq('')
+    local r = mem.Ring(2)
+    r:write('ef')
+    t:expect(t.expr(b):add('ab', 12, r)):eq(b)
+    t:expect(t.expr(b):tostring()):eq('ab12ef')
+    t:expect(t.expr(b):capacity()):eq(8)
+    b:add_int(0):add_int(-123):add_int(math.mininteger)
+    t:expect(t.expr(b):tostring())
+        :eq(('ab12ef0-123%d'):format(math.mininteger))
+    t:expect(t.expr(mem).read(b, 0, 2)):eq('ab')
+    t:expect(t.expr(b):clear()):eq(b)
+    t:expect(#b):label("#b"):eq(0)
+
+    -- Formatted output.
+    for _, test in ipairs{
+        {'plain', {}, 'plain'},
+        {'%d|%5d|%-3d|%03d|%x|%X|%o', {12, -3, 4, 7, 255, 255, 8},
+         '12|   -3|4  |007|ff|FF|10'},
+        {'%c%c%%', {72, 105}, 'Hi%'},
+        {'%s %s %s|%5s|%-4s|%.2s', {'ab', 3, true, 'x', 'y', 'abc'},
+         'ab 3 true|    x|y   |ab'},
+        {'%.3f %g', {1.5, 0.25}, '1.500 0.25'},
+    } do
+        local fmt, args, want = table.unpack(test)
+        t:expect(t.expr(tostring)(mem.Builder():addf(fmt, table.unpack(args))))
+            :label("addf(%q)", fmt):eq(want)
+    end
+    t:expect(t.expr(b):addf('%d', 'x')):raises("number expected")
+    t:expect(t.expr(b):addf('%q', 'x')):raises("invalid conversion")
+
+    -- Growing by large amounts.
+    local s = ('0123456789'):rep(100)
+    b = mem.Builder(1):addf('%s%s', s, s)
+    t:expect(#b):label("#b"):eq(2000)
+    t:expect(t.expr(tostring)(b)):eq(s .. s)
+end
+
+function test_Ring(t)
+    local r = mem.Ring(8)
+    t:expect(#r):label("#r"):eq(0)
+    t:expect(t.expr(r):capacity()):eq(8)
+    t:expect(t.expr(r):space()):eq(8)
+    t:expect(t.expr(r):write('abcdef')):eq(6)
+    t:expect(t.expr(r):peek(2)):eq('ab')
+    t:expect(t.expr(r):read(4)):eq('abcd')
+    t:expect(t.expr(r):write('gh\nijklm')):eq(6)  -- Wraps around
+    t:expect(#r):label("#r"):eq(8)
+    t:expect(t.expr(r):space()):eq(0)
+    t:expect(t.expr(r):write('x')):eq(0)
+    t:expect(t.expr(r):find('\n')):eq(4)
+    t:expect(t.expr(r):find('gh\ni')):eq(2)
+    t:expect(t.expr(r):find('e', 1)):eq(nil)
+    t:expect(t.expr(r):find('x')):eq(nil)
+    t:expect(t.expr(r):find('e', 9)):raises("out of bounds")
+    t:expect(t.expr(mem).read(r, 0, #r)):eq('efgh\nijk')
+    t:expect(t.expr(mem).find(r, 'hi', 0, #r)):eq(nil)
+    t:expect(t.expr(r):discard(5)):eq(5)
+    t:expect(t.expr(r):read()):eq('ijk')
+    t:expect(t.expr(r):read()):eq('')
+    t:expect(t.expr(r):discard()):eq(0)
+
+    -- Write through the buffer protocol and commit.
+    r:write('01234')
+    r:discard(3)
+    mem.write(r, 'abcde', #r)  -- Wraps around
+    t:expect(t.expr(r):commit(5)):eq(nil)
+    t:expect(t.expr(r):commit(2)):raises("out of bounds")
+    t:expect(t.expr(r):peek()):eq('34abcde')
+    mem.fill(r, ('.'):byte(), 1, 3)
+    t:expect(t.expr(r):peek()):eq('3...cde')
+    t:expect(t.expr(r):write(r, 4, 1)):eq(1)
+    t:expect(t.expr(r):read()):eq('3...cdec')
+    r:write('abc')
+    r:clear()
+    t:expect(#r):label("#r"):eq(0)
+end
+
+function test_Pool(t)
+    local pool = mem.Pool(10, 3)
+    t:expect(#pool):label("#pool"):eq(3)
+    t:expect(t.expr(pool):block_size()):eq(10)
+    t:expect(t.expr(pool):count()):eq(3)
+    local b1, b2, b3 = pool:acquire(), pool:acquire(), pool:acquire()
+    t:expect(#pool):label("#pool"):eq(0)
+    t:expect(t.expr(pool):acquire()):eq(nil)
+    t:expect(t.mexpr(pool):stats()):eq{3, 3, 1}
+    t:expect(#b1):label("#b1"):eq(10)
+    t:expect(b2:ptr() - b1:ptr() >= 10, "blocks overlap")
+    t:expect(b3:ptr() - b2:ptr() >= 10, "blocks overlap")
+    mem.write(b2, 'abcdefghij')
+    t:expect(t.expr(mem).read(b2)):eq('abcdefghij')
+
+    -- Release and re-acquire blocks.
+    local ptr = b2:ptr()
+    b2:release()
+    b2:release()
+    t:expect(#pool):label("#pool"):eq(1)
+    t:expect(t.expr(b2):ptr()):eq(nil)
+    t:expect(t.expr(mem).read(b2)):raises("string or buffer")
+    local b4 = pool:acquire()
+    t:expect(b4):label("b4"):eq(b2)
+    t:expect(t.expr(b4):ptr()):eq(ptr)
+    do local b<close> = b4 end
+    t:expect(#pool):label("#pool"):eq(1)
+    t:expect(t.mexpr(pool):stats(true)):eq{2, 3, 1}
+    t:expect(t.mexpr(pool):stats()):eq{2, 2, 0}
+
+    -- Unreachable buffers are returned to the pool.
+    b1, b2, b3, b4 = nil, nil, nil, nil
+    collectgarbage()
+    collectgarbage()
+    t:expect(#pool):label("#pool"):eq(3)
+    local b = pool:acquire()
+    b = nil
+    collectgarbage()
+    collectgarbage()
+    t:expect(#pool):label("#pool"):eq(3)
+end
+
+function test_profile(t)
+    if not mem.profile(true) then t:skip("Allocation profiling disabled") end
+    local strs = {}
+    for i = 1, 200 do strs[i] = string.rep('x', 50 + i) end
+    local prof = mem.profile()
+    t:expect(#prof.sizes):label("#sizes"):gt(0)
+    local total = 0
+    for _, c in ipairs(prof.sizes) do total = total + c end
+    t:expect(total):label("total"):gte(200)
+    t:expect(prof.types.string.count):label("string count"):gte(200)
+    t:expect(prof.types.string.size):label("string size"):gte(200 * 50)
+    t:expect(#prof.sites + prof.unattributed):label("samples"):gt(0)
+    for i = 2, #prof.sites do
+        t:expect(prof.sites[i - 1].count >= prof.sites[i].count,
+                 "sites aren't sorted by count")
+    end
+end
+
+local function entry(snap, cat, key)
+    local e = snap[cat][key]
+    if e then return e.count, e.size end
+    return 0, 0
+end
+
+function test_snapshot(t)
+    local before = mem.snapshot()
+    local bufs, tabs = {}, {}
+    for i = 1, 50 do
+        bufs[i] = mem.alloc(100)
+        tabs[i] = {1, 2, 3, 4, 5}
+    end
+    local after = mem.snapshot()
+    local count, size = entry(after, 'names', 'mlua.mem.Buffer')
+    local bcount, bsize = entry(before, 'names', 'mlua.mem.Buffer')
+    t:expect(count - bcount):label("Buffer count delta"):gte(50)
+    t:expect(size - bsize):label("Buffer size delta"):gte(50 * 100)
+    count = entry(after, 'types', 'table')
+    bcount = entry(before, 'types', 'table')
+    t:expect(count - bcount):label("table count delta"):gte(50)
+    count = entry(after, 'tables', 4)
+    bcount = entry(before, 'tables', 4)
+    t:expect(count - bcount):label("4-slot table count delta"):gte(50)
+    t:expect((entry(after, 'types', 'proto'))):label("proto count"):gt(0)
+
+    local lines = {}
+    mem.diff(before, after, {write = function(self, s)
+        table.insert(lines, s)
+    end})
+    local found = false
+    for _, line in ipairs(lines) do
+        if line:find('^names +mlua%.mem%.Buffer +%+') then found = true end
+    end
+    t:expect(found, "Buffer increase not reported: %s", table.concat(lines))
+    lines = {}
+    mem.diff(after, after, {write = function(self, s)
+        table.insert(lines, s)
+    end})
+    t:expect(#lines):label("#lines"):eq(0)
+end
@@ -25,15 +25,71 @@ function Metaclass.__call(cls, ...)
     return obj
 end
 
--- Define a class, optionally inheriting from the given base class.
-function class(name, base)
+local function is_meta(k) return type(k) == 'string' and k:sub(1, 2) == '__' end
+
+-- Keys that are specific to each class, and aren't inherited.
+local class_keys = {__name = true, __base = true, __index = true}
+
+-- Update the resolved value of a member of a flat class, and propagate it to
+-- subclasses that don't define the member themselves.
+local function flat_update(cls, k)
+    local mt = getmetatable(cls)
+    local v = mt.own[k]
+    if v == nil and cls.__base then v = cls.__base[k] end
+    mt.__index[k] = v
+    for sub in pairs(mt.subs) do
+        if getmetatable(sub).own[k] == nil then flat_update(sub, k) end
+    end
+end
+
+-- Set a member of a flat class.
+local function flat_set(cls, k, v)
+    if is_meta(k) and not class_keys[k] then rawset(cls, k, v) end
+    getmetatable(cls).own[k] = v
+    flat_update(cls, k)
+end
+
+-- Create a flat class, whose members are resolved into a single table.
+local function flat_class(cls, base)
+    local members = {}
+    local b = base
+    while b do
+        local mt = getmetatable(b)
+        local flat = mt.own ~= nil
+        for k, v in pairs(flat and mt.__index or b) do
+            if members[k] == nil and not class_keys[k] then members[k] = v end
+        end
+        if flat then break end
+        b = b.__base
+    end
+    cls.__index = members
+    local mt = {
+        __index = members,
+        __newindex = flat_set,
+        __tostring = Metaclass.__tostring,
+        __call = Metaclass.__call,
+        own = {},
+        subs = setmetatable({}, {__mode = 'k'}),
+    }
+    if base then
+        local bmt = getmetatable(base)
+        if bmt.subs then bmt.subs[cls] = true end
+    end
+    return setmetatable(cls, mt)
+end
+
+-- Define a class, optionally inheriting from the given base class. If "flat"
+-- is true, inherited members are copied to the class, so that they are found
+-- with a single lookup.
+function class(name, base, flat)
     local cls = {}
     if base then
         for k, v in pairs(base) do
-            if k:sub(1, 2) == '__' then cls[k] = v end
+            if is_meta(k) then cls[k] = v end
         end
     end
     cls.__name, cls.__base, cls.__index = name, base, cls
+    if flat then return flat_class(cls, base) end
     return setmetatable(cls, not base and Metaclass or {
         __index = cls.__base,
         __tostring = Metaclass.__tostring,
@@ -80,3 +80,36 @@ function test_isinstance(t)
     t:expect(not oo.isinstance(a, B), "isinstance(a, B) = true")
     t:expect(oo.isinstance(b, A), "isinstance(b, A) = false")
 end
+
+function test_flat_class(t)
+    local C = oo.class('C', nil, true)
+    function C:__init(v) self.v = v end
+    function C:a() return 'C.a' end
+    function C:__len() return self.v end
+    local D = oo.class('D', C, true)
+    local E = oo.class('E', D, true)
+    t:expect(t.expr(E(3)):a()):eq('C.a')
+    t:expect(#E(3)):label("#E(3)"):eq(3)
+    t:expect(rawget(E.__index, 'a')):label("E.__index.a"):eq(C.a)
+    t:expect(t.expr(oo).isinstance(E(1), C)):eq(true)
+
+    -- Members defined after the subclasses are propagated to them.
+    function C:b() return 'C.b' end
+    t:expect(t.expr(E(1)):b()):eq('C.b')
+    function D:a() return 'D.a' end
+    t:expect(t.expr(E(1)):a()):eq('D.a')
+    t:expect(t.expr(C(1)):a()):eq('C.a')
+    function C:a() return 'C.a2' end
+    t:expect(t.expr(E(1)):a()):eq('D.a')
+    D.a = nil
+    t:expect(t.expr(E(1)):a()):eq('C.a2')
+    t:expect(t.expr(D(1)):a()):eq('C.a2')
+
+    -- Flat classes can inherit from non-flat classes.
+    local F = oo.class('F', B, true)
+    local f = F(4, 5)
+    t:expect(t.expr(f):method()):eq(4)
+    t:expect(t.expr(f).cls_a):eq(1)
+    t:expect(t.expr(f).cls_b):eq(2)
+    t:expect(#f):label("#f"):eq(4)
+end
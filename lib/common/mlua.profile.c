@@ -0,0 +1,687 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "lobject.h"
+#include "lstate.h"
+#include "mlua/module.h"
+#include "mlua/platform.h"
+#include "mlua/profile.h"
+#include "mlua/thread.h"
+#include "mlua/util.h"
+
+// The maximum number of stack frames recorded per sample, including the
+// thread.
+#ifndef MLUA_PROFILE_DEPTH
+#define MLUA_PROFILE_DEPTH 16
+#endif
+
+// The minimum sampling period, in microseconds.
+#ifndef MLUA_PROFILE_MIN_PERIOD
+#define MLUA_PROFILE_MIN_PERIOD 100
+#endif
+
+// The number of functions tracked by the call profiler. Must be a power of 2.
+#ifndef MLUA_PROFILE_FUNCTIONS
+#define MLUA_PROFILE_FUNCTIONS 256
+#endif
+
+// The number of threads tracked concurrently by the call profiler.
+#ifndef MLUA_PROFILE_THREADS
+#define MLUA_PROFILE_THREADS 16
+#endif
+
+// The maximum call depth tracked per thread by the call profiler. Deeper calls
+// are counted, but their time is attributed to their deepest tracked caller.
+#ifndef MLUA_PROFILE_CALL_DEPTH
+#define MLUA_PROFILE_CALL_DEPTH 64
+#endif
+
+// A recorded sample. Frames are stored innermost first, except for the thread,
+// which is always in frames[0]. Frames are IDs into the object table.
+typedef struct Sample {
+    uint16_t frames[MLUA_PROFILE_DEPTH];
+    uint16_t line;
+    uint8_t depth;
+} Sample;
+
+// A function tracked by the call profiler.
+typedef struct Func {
+    void const* key;    // The Proto* of a Lua function, or the C function
+    uint32_t calls;     // The number of calls
+    uint32_t active;    // The number of activations on the call stacks
+    uint64_t incl;      // The inclusive time, in cycles
+    uint64_t excl;      // The exclusive time, in cycles
+    char name[LUA_IDSIZE + 24];
+} Func;
+
+// An activation on the call stack of a thread.
+typedef struct Frame {
+    Func* fn;           // The function, or NULL if it isn't tracked
+    CallInfo* ci;       // The call info of the activation
+    uint64_t start;     // The thread time when the function was called
+    uint64_t child;     // The inclusive time of the callees
+} Frame;
+
+// A thread tracked by the call profiler. Thread time excludes the time during
+// which the thread is suspended by the scheduler.
+typedef struct CallThread {
+    lua_State* ls;
+    uint64_t last;      // The time of the last event, for eviction
+    uint64_t paused;    // The total time spent suspended
+    uint64_t since;     // The start of the current suspension
+    bool suspended;
+    uint32_t depth;     // The call depth, possibly beyond the tracked frames
+    Frame frames[MLUA_PROFILE_CALL_DEPTH];
+} CallThread;
+
+// The state of the call profiler. Functions are stored in an open-addressing
+// hash table keyed by their prototype.
+typedef struct Calls {
+    CallThread* cur;
+    uint32_t nfuncs;
+    uint32_t dropped;
+    Func funcs[MLUA_PROFILE_FUNCTIONS];
+    CallThread threads[MLUA_PROFILE_THREADS];
+} Calls;
+
+// The state of the profiler. The timer interrupt only selects the thread to
+// sample and arms a count hook on it. The hook runs at the next instruction of
+// that thread, where it is safe to walk the stack and record the sample. The
+// same hook handles the call and return events of the call profiler.
+typedef struct Profiler {
+    lua_State* main;
+    MLuaGlobal* g;
+    lua_State* volatile target;
+    volatile bool armed;
+    bool running;
+    Sample* samples;
+    uint32_t cap;
+    uint32_t head;
+    uint32_t len;
+    volatile uint32_t ticks;
+    uint32_t recorded;
+    Calls* calls;
+    volatile bool calls_enabled;
+} Profiler;
+
+static Profiler profiler;
+
+static char const Ring_name[] = "mlua.profile.Ring";
+static char const Calls_name[] = "mlua.profile.Calls";
+
+// Registry keys for the sample ring, the object -> ID table, the ID -> name
+// table and the call profiler state.
+static char const ring_key = 0;
+static char const ids_key = 0;
+static char const names_key = 0;
+static char const calls_key = 0;
+
+static void profile_hook(lua_State* ls, lua_Debug* ar);
+
+static inline int call_mask(Profiler* p) {
+    return p->calls_enabled ? LUA_MASKCALL | LUA_MASKRET : 0;
+}
+
+// Set the hook of a thread according to the state of the profiler.
+static void update_hook(lua_State* ls) {
+    Profiler* p = &profiler;
+    int mask = call_mask(p);
+    if (p->armed && p->target == ls) mask |= LUA_MASKCOUNT;
+    lua_sethook(ls, mask != 0 ? &profile_hook : NULL, mask, 1);
+}
+
+static void handle_tick(void) {
+    Profiler* p = &profiler;
+    ++p->ticks;
+    lua_State* ls = p->g->profile_running;
+    if (ls == NULL) ls = p->main;
+    if (p->armed && p->target == ls) return;
+    p->target = ls;
+    p->armed = true;
+    lua_sethook(ls, &profile_hook, LUA_MASKCOUNT | call_mask(p), 1);
+}
+
+// Return the ID of the object at the top of the stack, and pop it. New objects
+// are registered with the name pushed by the given function. IDs are assigned
+// sequentially from 1, and 0 is returned when they are exhausted.
+static uint16_t object_id(lua_State* ls, void (*push_name)(lua_State*, void*),
+                          void* ctx) {
+    lua_rawgetp(ls, LUA_REGISTRYINDEX, &ids_key);
+    lua_pushvalue(ls, -2);
+    if (lua_rawget(ls, -2) != LUA_TNIL) {
+        uint16_t id = lua_tointeger(ls, -1);
+        lua_pop(ls, 3);
+        return id;
+    }
+    lua_pop(ls, 1);
+    lua_rawgetp(ls, LUA_REGISTRYINDEX, &names_key);
+    lua_Unsigned id = lua_rawlen(ls, -1) + 1;
+    if (id > UINT16_MAX) {
+        lua_pop(ls, 3);
+        return 0;
+    }
+    push_name(ls, ctx);
+    lua_rawseti(ls, -2, id);
+    lua_pop(ls, 1);
+    lua_rotate(ls, -2, 1);
+    lua_pushinteger(ls, id);
+    lua_rawset(ls, -3);  // ids[obj] = id
+    lua_pop(ls, 1);
+    return id;
+}
+
+static void push_thread_name(lua_State* ls, void* ctx) {
+    if (ls == profiler.main) {
+        lua_pushliteral(ls, "main");
+        return;
+    }
+#if LIB_MLUA_MOD_MLUA_THREAD
+    if (mlua_thread_meta(ls, "name") != LUA_TNIL) {
+        lua_pushthread(ls);
+        lua_call(ls, 1, 1);
+        return;
+    }
+#endif
+    lua_pushfstring(ls, "%p", ls);
+}
+
+static void push_function_name(lua_State* ls, void* ctx) {
+    lua_Debug* ar = ctx;
+    char const* name = ar->name != NULL ? ar->name : "?";
+    if (*ar->what == 'C') {
+        lua_pushfstring(ls, "%s [C]", name);
+    } else {
+        lua_pushfstring(ls, "%s (%s:%d)", name, ar->short_src,
+                        ar->linedefined);
+    }
+}
+
+static int record_sample(lua_State* ls) {
+    Profiler* p = &profiler;
+    Sample* s = &p->samples[p->head];
+    lua_pushthread(ls);
+    s->frames[0] = object_id(ls, &push_thread_name, NULL);
+    s->line = 0;
+    int depth = 1;
+    lua_Debug ar;
+    // Level 0 is this function, level 1 the function that was interrupted.
+    for (int level = 1; depth < MLUA_PROFILE_DEPTH
+                        && lua_getstack(ls, level, &ar); ++level) {
+        if (!lua_getinfo(ls, "Slnf", &ar)) continue;
+        if (depth == 1 && ar.currentline > 0) s->line = ar.currentline;
+        s->frames[depth++] = object_id(ls, &push_function_name, &ar);
+    }
+    s->depth = depth;
+    p->head = (p->head + 1) % p->cap;
+    if (p->len < p->cap) ++p->len;
+    ++p->recorded;
+    return 0;
+}
+
+static void sample_hook(lua_State* ls) {
+    Profiler* p = &profiler;
+    if (!p->armed || p->target != ls) {
+        update_hook(ls);
+        return;
+    }
+    p->armed = false;
+    update_hook(ls);
+    if (!p->running) return;
+    lua_pushcfunction(ls, &record_sample);
+    if (lua_pcall(ls, 0, 0, 0) != LUA_OK) lua_pop(ls, 1);
+}
+
+// Return the function called in the given activation, registering it if it
+// isn't tracked yet. Returns NULL if the function table is full.
+static Func* call_func(Calls* c, lua_State* ls, lua_Debug* ar) {
+    TValue const* f = s2v(ar->i_ci->func.p);
+    void const* key;
+    if (ttisLclosure(f)) {
+        key = clLvalue(f)->p;
+    } else if (ttislcf(f)) {
+        key = (void const*)fvalue(f);
+    } else if (ttisCclosure(f)) {
+        key = (void const*)clCvalue(f)->f;
+    } else {
+        return NULL;
+    }
+    uint32_t mask = MLUA_PROFILE_FUNCTIONS - 1;
+    uint32_t i = ((uintptr_t)key >> 2) * 2654435761u;
+    for (;; ++i) {
+        Func* fn = &c->funcs[i & mask];
+        if (fn->key == key) return fn;
+        if (fn->key == NULL) break;
+    }
+    if (c->nfuncs >= MLUA_PROFILE_FUNCTIONS * 3 / 4) return NULL;
+    ++c->nfuncs;
+    Func* fn = &c->funcs[i & mask];
+    fn->key = key;
+    lua_getinfo(ls, "Sn", ar);
+    char const* name = ar->name != NULL ? ar->name : "?";
+    if (*ar->what == 'C') {
+        snprintf(fn->name, sizeof(fn->name), "%s [C]", name);
+    } else {
+        snprintf(fn->name, sizeof(fn->name), "%s (%s:%d)", name,
+                 ar->short_src, ar->linedefined);
+    }
+    return fn;
+}
+
+// Unwind the call stack of a thread without accounting for the open frames.
+static void clear_thread(CallThread* t) {
+    uint32_t depth = t->depth < MLUA_PROFILE_CALL_DEPTH ? t->depth
+                     : MLUA_PROFILE_CALL_DEPTH;
+    for (uint32_t i = 0; i < depth; ++i) {
+        if (t->frames[i].fn != NULL) --t->frames[i].fn->active;
+    }
+    memset(t, 0, sizeof(*t) - sizeof(t->frames));
+}
+
+static CallThread* find_thread(Calls* c, lua_State* ls) {
+    if (c->cur != NULL && c->cur->ls == ls) return c->cur;
+    for (int i = 0; i < MLUA_PROFILE_THREADS; ++i) {
+        CallThread* t = &c->threads[i];
+        if (t->ls == ls) return c->cur = t;
+    }
+    return NULL;
+}
+
+// Return the state of the given thread. If all slots are in use, the least
+// recently active thread is evicted.
+static CallThread* call_thread(Calls* c, lua_State* ls, uint64_t now) {
+    CallThread* t = find_thread(c, ls);
+    if (t != NULL) return t;
+    t = &c->threads[0];
+    for (int i = 1; i < MLUA_PROFILE_THREADS && t->ls != NULL; ++i) {
+        CallThread* ti = &c->threads[i];
+        if (ti->ls == NULL || ti->last < t->last) t = ti;
+    }
+    clear_thread(t);
+    t->ls = ls;
+    t->last = now;
+    return c->cur = t;
+}
+
+static void push_frame(Calls* c, CallThread* t, Func* fn, CallInfo* ci,
+                       uint64_t now) {
+    if (fn != NULL) ++fn->calls; else ++c->dropped;
+    if (t->depth++ >= MLUA_PROFILE_CALL_DEPTH) return;
+    Frame* f = &t->frames[t->depth - 1];
+    f->fn = fn;
+    f->ci = ci;
+    f->start = now;
+    f->child = 0;
+    if (fn != NULL) ++fn->active;
+}
+
+static void pop_frame(CallThread* t, uint64_t now) {
+    Frame* f = &t->frames[--t->depth];
+    uint64_t incl = now - f->start;
+    Func* fn = f->fn;
+    if (fn != NULL) {
+        fn->excl += incl - f->child;
+        // Only the outermost activation of recursive calls counts.
+        if (--fn->active == 0) fn->incl += incl;
+    }
+    if (t->depth > 0) t->frames[t->depth - 1].child += incl;
+}
+
+static void call_hook(lua_State* ls, lua_Debug* ar) {
+    Profiler* p = &profiler;
+    Calls* c = p->calls;
+    if (!p->calls_enabled || c == NULL) {
+        update_hook(ls);
+        return;
+    }
+    uint64_t cycles = mlua_cycles64();
+    CallThread* t = call_thread(c, ls, cycles);
+    t->last = cycles;
+    uint64_t now = cycles - t->paused;
+    switch (ar->event) {
+    case LUA_HOOKTAILCALL:
+        // The caller's frame is replaced, and no return event is generated.
+        if (t->depth > 0 && t->depth <= MLUA_PROFILE_CALL_DEPTH) {
+            pop_frame(t, now);
+        } else if (t->depth > 0) {
+            --t->depth;
+        }
+        // Fall through
+    case LUA_HOOKCALL:
+        push_frame(c, t, call_func(c, ls, ar), ar->i_ci, now);
+        break;
+    case LUA_HOOKRET:
+        if (t->depth > MLUA_PROFILE_CALL_DEPTH) {
+            --t->depth;
+            break;
+        }
+        // Frames that were unwound by an error never return, so pop up to the
+        // frame of the returning activation, if it is on the stack.
+        for (uint32_t i = t->depth; i > 0; --i) {
+            if (t->frames[i - 1].ci != ar->i_ci) continue;
+            while (t->depth >= i) pop_frame(t, now);
+            break;
+        }
+        break;
+    }
+}
+
+static void profile_hook(lua_State* ls, lua_Debug* ar) {
+    if (ar->event == LUA_HOOKCOUNT) {
+        sample_hook(ls);
+    } else {
+        call_hook(ls, ar);
+    }
+}
+
+// Called by the scheduler before resuming and after suspending a thread.
+static void profile_switch(lua_State* ls, bool resume) {
+    Profiler* p = &profiler;
+    if (!p->calls_enabled) return;
+    if (resume && (lua_gethookmask(ls) & LUA_MASKCALL) == 0) {
+        update_hook(ls);
+    }
+    CallThread* t = find_thread(p->calls, ls);
+    if (t == NULL) return;
+    if (resume) {
+        if (t->suspended) t->paused += mlua_cycles64() - t->since;
+        t->suspended = false;
+    } else if (lua_status(ls) != LUA_YIELD) {
+        clear_thread(t);
+    } else {
+        t->since = mlua_cycles64();
+        t->suspended = true;
+    }
+}
+
+static void stop(void) {
+    Profiler* p = &profiler;
+    mlua_profile_timer_stop();
+    p->running = false;
+    p->armed = false;
+}
+
+static void set_calls(MLuaGlobal* g, bool enable) {
+    Profiler* p = &profiler;
+    if (!enable && p->calls != NULL) {
+        for (int i = 0; i < MLUA_PROFILE_THREADS; ++i) {
+            clear_thread(&p->calls->threads[i]);
+        }
+    }
+    p->calls_enabled = enable;
+    g->profile_switch = enable ? &profile_switch : NULL;
+}
+
+static void reset(lua_State* ls) {
+    Profiler* p = &profiler;
+    p->head = p->len = p->ticks = p->recorded = 0;
+    lua_newtable(ls);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, &ids_key);
+    lua_newtable(ls);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, &names_key);
+}
+
+static void reset_calls(void) {
+    Calls* c = profiler.calls;
+    for (int i = 0; i < MLUA_PROFILE_THREADS; ++i) {
+        clear_thread(&c->threads[i]);
+    }
+    memset(c, 0, sizeof(*c) - sizeof(c->threads));
+}
+
+// Stop the profiler when the sample ring is garbage-collected, i.e. at the
+// latest when the interpreter is closed.
+static int Ring___gc(lua_State* ls) {
+    if (lua_touserdata(ls, 1) != profiler.samples) return 0;
+    stop();
+    profiler.samples = NULL;
+    return 0;
+}
+
+MLUA_SYMBOLS_NOHASH(Ring_syms_nh) = {
+    MLUA_SYM_F_NH(__gc, Ring_),
+};
+
+// Disable the call profiler when its state is garbage-collected.
+static int Calls___gc(lua_State* ls) {
+    if (lua_touserdata(ls, 1) != profiler.calls) return 0;
+    set_calls(mlua_global(ls), false);
+    profiler.calls = NULL;
+    return 0;
+}
+
+MLUA_SYMBOLS_NOHASH(Calls_syms_nh) = {
+    MLUA_SYM_F_NH(__gc, Calls_),
+};
+
+static int mod_start(lua_State* ls) {
+    lua_Integer period = luaL_optinteger(ls, 1, 1000);
+    lua_Integer cap = luaL_optinteger(ls, 2, 256);
+    luaL_argcheck(ls, period >= MLUA_PROFILE_MIN_PERIOD && period <= INT32_MAX,
+                  1, "invalid period");
+    luaL_argcheck(ls, cap > 0 && cap <= (1 << 16), 2, "invalid sample count");
+    Profiler* p = &profiler;
+    if (p->running) return mlua_push_fail(ls, "profiler already running");
+
+    // Allocate the sample ring, and keep it alive in the registry.
+    p->samples = lua_newuserdatauv(ls, cap * sizeof(Sample), 0);
+    luaL_getmetatable(ls, Ring_name);
+    lua_setmetatable(ls, -2);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, &ring_key);
+    p->cap = cap;
+    reset(ls);
+    lua_rawgeti(ls, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    p->main = lua_tothread(ls, -1);
+    lua_pop(ls, 1);
+    p->g = mlua_global(ls);
+    p->running = true;
+    if (!mlua_profile_timer_start(period, &handle_tick)) {
+        p->running = false;
+        return mlua_push_fail(ls, "no sampling timer available");
+    }
+    return lua_pushboolean(ls, true), 1;
+}
+
+static int mod_stop(lua_State* ls) {
+    stop();
+    return 0;
+}
+
+static int mod_reset(lua_State* ls) {
+    if (profiler.samples != NULL) reset(ls);
+    if (profiler.calls != NULL) reset_calls();
+    return 0;
+}
+
+static int mod_stats(lua_State* ls) {
+    Profiler* p = &profiler;
+    lua_pushinteger(ls, p->ticks);
+    lua_pushinteger(ls, p->recorded);
+    lua_pushinteger(ls, p->recorded - p->len);
+    return 3;
+}
+
+// Push a table mapping folded stacks to sample counts.
+static void push_folded(lua_State* ls) {
+    Profiler* p = &profiler;
+    lua_createtable(ls, 0, p->len);
+    if (p->len == 0) return;
+    lua_rawgetp(ls, LUA_REGISTRYINDEX, &names_key);
+    uint32_t start = (p->head + p->cap - p->len) % p->cap;
+    for (uint32_t i = 0; i < p->len; ++i) {
+        Sample const* s = &p->samples[(start + i) % p->cap];
+        luaL_Buffer buf;
+        luaL_buffinit(ls, &buf);
+        for (int j = 0; j < s->depth; ++j) {
+            int f = j == 0 ? 0 : s->depth - j;
+            if (j > 0) luaL_addchar(&buf, ';');
+            if (lua_rawgeti(ls, -2, s->frames[f]) == LUA_TSTRING) {
+                luaL_addvalue(&buf);
+            } else {
+                lua_pop(ls, 1);
+                luaL_addchar(&buf, '?');
+            }
+        }
+        if (s->line > 0) {
+            lua_pushfstring(ls, ":%d", s->line);
+            luaL_addvalue(&buf);
+        }
+        luaL_pushresult(&buf);
+        lua_pushvalue(ls, -1);
+        lua_Integer count = lua_rawget(ls, -4) == LUA_TNIL ? 0
+                            : lua_tointeger(ls, -1);
+        lua_pop(ls, 1);
+        lua_pushinteger(ls, count + 1);
+        lua_rawset(ls, -4);
+    }
+    lua_pop(ls, 1);
+}
+
+static int mod_folded(lua_State* ls) {
+    push_folded(ls);
+    return 1;
+}
+
+// Write the strings in the list at index 3 to the writer at index 1, starting
+// at the given index.
+static int write_lines(lua_State* ls, int status, lua_KContext ctx) {
+    lua_Unsigned len = lua_rawlen(ls, 3);
+    for (lua_Unsigned i = ctx; i <= len; ++i) {
+        lua_settop(ls, 3);
+        lua_getfield(ls, 1, "write");
+        lua_pushvalue(ls, 1);
+        lua_rawgeti(ls, 3, i);
+        lua_callk(ls, 2, 0, i + 1, &write_lines);
+    }
+    return 0;
+}
+
+static int mod_write(lua_State* ls) {
+    lua_settop(ls, 1);
+    push_folded(ls);
+    // Sort the stacks, so that the output is deterministic.
+    lua_createtable(ls, 0, 0);
+    for (lua_pushnil(ls); lua_next(ls, 2); lua_pop(ls, 1)) {
+        lua_pushvalue(ls, -2);
+        lua_rawseti(ls, 3, lua_rawlen(ls, 3) + 1);
+    }
+    lua_pushvalue(ls, lua_upvalueindex(1));  // table.sort
+    lua_pushvalue(ls, 3);
+    lua_call(ls, 1, 0);
+    lua_Unsigned len = lua_rawlen(ls, 3);
+    for (lua_Unsigned i = 1; i <= len; ++i) {
+        lua_rawgeti(ls, 3, i);
+        lua_pushvalue(ls, -1);
+        lua_rawget(ls, 2);
+        lua_pushfstring(ls, "%s %I\n", lua_tostring(ls, -2),
+                        lua_tointeger(ls, -1));
+        lua_rawseti(ls, 3, i);
+        lua_pop(ls, 2);
+    }
+    return write_lines(ls, LUA_OK, 1);
+}
+
+static int mod_calls(lua_State* ls) {
+    bool enable = mlua_to_cbool(ls, 1);
+    Profiler* p = &profiler;
+    lua_pushboolean(ls, p->calls_enabled);
+    if (enable == p->calls_enabled) return 1;
+    if (enable && p->calls == NULL) {
+        // Allocate the call profiler state, and keep it alive in the registry.
+        p->calls = lua_newuserdatauv(ls, sizeof(Calls), 0);
+        memset(p->calls, 0, sizeof(Calls));
+        luaL_getmetatable(ls, Calls_name);
+        lua_setmetatable(ls, -2);
+        lua_rawsetp(ls, LUA_REGISTRYINDEX, &calls_key);
+    }
+    set_calls(mlua_global(ls), enable);
+    update_hook(ls);
+    return 1;
+}
+
+static int compare_funcs(void const* a, void const* b) {
+    Func const* fa = *(Func const* const*)a;
+    Func const* fb = *(Func const* const*)b;
+    if (fa->excl != fb->excl) return fa->excl < fb->excl ? 1 : -1;
+    return strcmp(fa->name, fb->name);
+}
+
+static int mod_report(lua_State* ls) {
+    lua_Integer n = luaL_optinteger(ls, 1, 20);
+    lua_settop(ls, 2);
+    lua_rotate(ls, 1, 1);
+    if (lua_isnil(ls, 1)) {
+        lua_getglobal(ls, "stdout");
+        lua_replace(ls, 1);
+    }
+
+    // Sort the functions by decreasing exclusive time.
+    Func* funcs[MLUA_PROFILE_FUNCTIONS];
+    int count = 0;
+    Calls* c = profiler.calls;
+    for (int i = 0; c != NULL && i < MLUA_PROFILE_FUNCTIONS; ++i) {
+        Func* fn = &c->funcs[i];
+        if (fn->key != NULL && fn->calls > 0) funcs[count++] = fn;
+    }
+    qsort(funcs, count, sizeof(funcs[0]), &compare_funcs);
+    if (n >= 0 && n < count) count = n;
+
+    // Format the report before writing it, as the writer may yield.
+    char line[sizeof(funcs[0]->name) + 48];
+    lua_createtable(ls, count + 1, 0);
+    lua_pushliteral(ls, "     calls    incl (us)    excl (us)  function\n");
+    lua_rawseti(ls, 3, 1);
+    uint64_t freq = mlua_cycles_freq();
+    for (int i = 0; i < count; ++i) {
+        Func const* fn = funcs[i];
+        snprintf(line, sizeof(line), "%10" PRIu32 " %12" PRIu64 " %12" PRIu64
+                 "  %s\n", fn->calls, fn->incl * 1000000 / freq,
+                 fn->excl * 1000000 / freq, fn->name);
+        lua_pushstring(ls, line);
+        lua_rawseti(ls, 3, i + 2);
+    }
+    if (c != NULL && c->dropped > 0) {
+        lua_pushfstring(ls, "%d calls to untracked functions\n",
+                        (int)c->dropped);
+        lua_rawseti(ls, 3, count + 2);
+    }
+    return write_lines(ls, LUA_OK, 1);
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_F(start, mod_),
+    MLUA_SYM_F(stop, mod_),
+    MLUA_SYM_F(reset, mod_),
+    MLUA_SYM_F(stats, mod_),
+    MLUA_SYM_F(folded, mod_),
+    MLUA_SYM_V(write, boolean, false),  // Preallocate
+    MLUA_SYM_F(calls, mod_),
+    MLUA_SYM_F(report, mod_),
+};
+
+MLUA_OPEN_MODULE(mlua.profile) {
+    mlua_require(ls, "table", true);
+
+    // Create the Ring class.
+    mlua_new_class_nohash(ls, Ring_name, mlua_nosyms, Ring_syms_nh);
+    lua_pop(ls, 1);
+
+    // Create the Calls class.
+    mlua_new_class_nohash(ls, Calls_name, mlua_nosyms, Calls_syms_nh);
+    lua_pop(ls, 1);
+
+    // Create the module.
+    mlua_new_module(ls, 0, module_syms);
+    lua_getfield(ls, -2, "sort");
+    lua_pushcclosure(ls, &mod_write, 1);
+    lua_setfield(ls, -2, "write");
+    return 1;
+}
@@ -0,0 +1,124 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local math = require 'math'
+local io = require 'mlua.io'
+local platform = require 'mlua.platform'
+local profile = require 'mlua.profile'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local string = require 'string'
+local table = require 'table'
+
+local function spin(duration)
+    local dl = time.deadline(duration)
+    while time.compare(time.ticks(), dl) < 0 do end
+end
+
+function test_profile(t)
+    if platform.name == 'host' then
+        return t:skip("no sampling timer on the host")
+    end
+    t:cleanup(function()
+        profile.stop()
+        profile.reset()
+    end)
+    t:expect(t.expr(profile).start(10)):raises("invalid period")
+    t:assert(profile.start(200, 64))
+    t:expect(t.mexpr(profile).start())
+        :eq{nil, "profiler already running"}
+    spin(20 * time.msec)
+    local th<close> = thread.start(function() spin(20 * time.msec) end,
+                                   'spinner')
+    th:join()
+    profile.stop()
+
+    local ticks, samples, dropped = profile.stats()
+    t:expect(ticks):label("ticks"):gt(50)
+    t:expect(samples):label("samples"):gt(0):lte(ticks)
+    t:expect(dropped):label("dropped"):eq(math.max(0, samples - 64))
+    local nmain, nspinner = 0, 0
+    for stack, count in pairs(profile.folded()) do
+        if stack:find('^main;.*;spin %(') then nmain = nmain + count end
+        if stack:find('^spinner;.*spin %(') then
+            nspinner = nspinner + count
+        end
+    end
+    t:expect(nmain):label("main samples"):gt(0)
+    t:expect(nspinner):label("spinner samples"):gt(0)
+
+    local out = io.Recorder()
+    profile.write(out)
+    for line in tostring(out):gmatch('[^\n]*\n') do
+        t:expect(line):label("line"):matches('^[^;]+;.* %d+\n$')
+    end
+
+    profile.reset()
+    t:expect(t.mexpr(profile).stats()):eq{0, 0, 0}
+    t:expect(next(profile.folded())):label("folded"):eq(nil)
+end
+
+local function fib(n)
+    if n < 2 then return n end
+    return fib(n - 1) + fib(n - 2)
+end
+
+local function handler() spin(2 * time.msec) end
+
+-- Parse a call profiler report into a table mapping function names to
+-- {calls, incl, excl}.
+local function parse_report(report)
+    local res = {}
+    for line in report:gmatch('[^\n]*\n') do
+        local calls, incl, excl, name = line:match(
+            '^ *(%d+) +(%d+) +(%d+)  ([^(]*) ')
+        if calls then
+            res[name] = {tonumber(calls), tonumber(incl), tonumber(excl)}
+        end
+    end
+    return res
+end
+
+function test_calls(t)
+    t:cleanup(function()
+        profile.calls(false)
+        profile.reset()
+    end)
+    t:expect(t.expr(profile).calls(true)):eq(false)
+    t:expect(t.expr(profile).calls(true)):eq(true)
+    fib(10)
+    local th<close> = thread.start(function()
+        for i = 1, 5 do
+            handler()
+            thread.yield()
+        end
+    end)
+    th:join()
+    t:expect(t.expr(profile).calls(false)):eq(true)
+    fib(5)
+
+    local out = io.Recorder()
+    profile.report(nil, out)
+    local report = tostring(out)
+    t:expect(report):label("report"):matches('^ +calls +incl')
+    local funcs = parse_report(report)
+    local calls, incl, excl = table.unpack(funcs.fib or {})
+    t:expect(calls):label("fib calls"):eq(177)
+    t:expect(excl):label("fib excl"):lte(incl)
+    calls, incl, excl = table.unpack(funcs.handler or {})
+    t:expect(calls):label("handler calls"):eq(5)
+    t:expect(incl):label("handler incl"):gte(10 * time.msec)
+    t:expect(excl):label("handler excl"):lte(incl)
+
+    out = io.Recorder()
+    profile.report(2, out)
+    local _, lines = string.gsub(tostring(out), '\n', '')
+    t:expect(lines):label("lines"):eq(3)
+
+    profile.reset()
+    out = io.Recorder()
+    profile.report(nil, out)
+    t:expect(next(parse_report(tostring(out)))):label("functions"):eq(nil)
+end
@@ -73,4 +73,70 @@ repr = function(v, seen)
     else return tostring(v) end
 end
 
-return repr
+local write_value
+
+-- Write the items of a table to an output stream, limiting the number of items
+-- to opts.width. Returns true iff items were omitted, and the number of items
+-- written.
+local function write_items(out, v, seen, opts, depth)
+    local width, n = opts.width, 0
+    local function item(key, value)
+        if width and n >= width then return false end
+        if n > 0 then out:write(', ') end
+        if key then out:write(key) end
+        write_value(out, value, seen, opts, depth)
+        n = n + 1
+        return true
+    end
+    local ok, len = try(is_list, v)
+    if ok then
+        local v0 = v[0]
+        if v0 and not item('[0] = ', v0) then return true, n end
+        for i = 1, len do
+            if not item(nil, v[i]) then return true, n end
+        end
+        return false
+    end
+    local keys = list()
+    for k in pairs(v) do
+        keys:append(list{('%s = '):format(repr_key(k, seen)), k})
+    end
+    keys:sort(function(a, b) return a[1] < b[1] end)
+    for _, key in ipairs(keys) do
+        if not item(key[1], v[key[2]]) then return true, n end
+    end
+    return false
+end
+
+local function write_table(out, v, seen, opts, depth)
+    if rawget(seen, v) then return out:write('...') end
+    if opts.depth and depth >= opts.depth then return out:write('{...}') end
+    rawset(seen, v, true)
+    local done<close> = function() rawset(seen, v, nil) end
+    out:write('{')
+    local omitted, n = write_items(out, v, seen, opts, depth + 1)
+    if omitted then out:write(n > 0 and ', ...' or '...') end
+    out:write('}')
+end
+
+write_value = function(out, v, seen, opts, depth)
+    local ok, r = pcall(function() return rawget(getmetatable(v), '__repr') end)
+    if ok and r then
+        if rawget(seen, v) then return out:write('...') end
+        return out:write(r(v, repr, seen))
+    end
+    local typ = type(v)
+    if typ == 'string' then return out:write(repr_string(v))
+    elseif typ == 'table' then return write_table(out, v, seen, opts, depth)
+    else return out:write(tostring(v)) end
+end
+
+-- Write the representation of a value to an output stream, without building
+-- the whole representation in memory.
+local function write(out, v, opts)
+    write_value(out, v, {}, opts or {}, 0)
+end
+
+return setmetatable({write = write}, {
+    __call = function(_, v, seen) return repr(v, seen) end,
+})
@@ -3,6 +3,7 @@
 
 _ENV = module(...)
 
+local io = require 'mlua.io'
 local repr = require 'mlua.repr'
 local table = require 'table'
 
@@ -39,3 +40,28 @@ function test_repr(t)
         t:expect(t.expr.repr(v)):eq(want)
     end
 end
+
+function test_write(t)
+    local rec = {a = {b = 2, d = 4}}
+    rec.a.c = rec
+    for _, test in ipairs{
+        {'abc', nil, '"abc"'},
+        {{1, {2, 3}, x = 'y'}, nil, repr{1, {2, 3}, x = 'y'}},
+        {{[0] = 3, 1, nil, 3}, nil, '{[0] = 3, 1, nil, 3}'},
+        {rec, nil, '{a = {b = 2, c = ..., d = 4}}'},
+        {{a = {b = {}}}, {depth = 1}, '{a = {...}}'},
+        {{a = {b = {}}}, {depth = 2}, '{a = {b = {...}}}'},
+        {{a = {b = {}}}, {depth = 0}, '{...}'},
+        {{1, 2, 3}, {width = 2}, '{1, 2, ...}'},
+        {{1, 2}, {width = 2}, '{1, 2}'},
+        {{1, 2}, {width = 0}, '{...}'},
+        {{a = 1, b = 2, c = 3}, {width = 1}, '{a = 1, ...}'},
+        {{{1, 2, 3}, {4}}, {depth = 2, width = 1}, '{{1, ...}, ...}'},
+    } do
+        local v, opts, want = table.unpack(test, 1, 3)
+        local out = io.Recorder()
+        repr.write(out, v, opts)
+        t:expect(tostring(out))
+            :label("repr.write(%s, %s)", repr(v), repr(opts)):eq(want)
+    end
+end
@@ -0,0 +1,228 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/module.h"
+#include "mlua/platform.h"
+#include "mlua/util.h"
+
+// The number of shared values.
+#ifndef MLUA_SHARED_VALUES
+#define MLUA_SHARED_VALUES 32
+#endif
+
+// The maximum length of the names of shared values.
+#ifndef MLUA_SHARED_NAME_LEN
+#define MLUA_SHARED_NAME_LEN 15
+#endif
+
+typedef enum Kind {
+    KIND_FREE = 0,
+    KIND_COUNTER,
+    KIND_FLAG,
+} Kind;
+
+// A shared value. Values are single words, so reading them doesn't require
+// locking. Updates are performed with the shared lock held.
+typedef struct Shared {
+    int32_t volatile value;
+    uint8_t kind;
+    char name[MLUA_SHARED_NAME_LEN + 1];
+} Shared;
+
+// The shared values, accessible from all cores.
+static Shared shared[MLUA_SHARED_VALUES];
+
+static char const* const kind_names[] = {
+    [KIND_COUNTER] = "counter", [KIND_FLAG] = "flag",
+};
+
+// Find or allocate the shared value with the given name and kind.
+static Shared* find_shared(lua_State* ls, Kind kind) {
+    size_t len;
+    char const* name = luaL_checklstring(ls, 1, &len);
+    luaL_argcheck(ls, 0 < len && len <= MLUA_SHARED_NAME_LEN, 1,
+                  "invalid name length");
+    Shared* res = NULL;
+    Shared* unused = NULL;
+    uint32_t save = mlua_platform_shared_lock();
+    for (Shared* s = shared; s != shared + MLUA_SHARED_VALUES; ++s) {
+        if (s->kind == KIND_FREE) {
+            if (unused == NULL) unused = s;
+        } else if (strcmp(s->name, name) == 0) {
+            res = s;
+            break;
+        }
+    }
+    if (res == NULL && unused != NULL) {
+        res = unused;
+        memcpy(res->name, name, len + 1);
+        res->value = 0;
+        res->kind = kind;
+    }
+    mlua_platform_shared_unlock(save);
+    if (res == NULL) {
+        luaL_error(ls, "too many shared values");
+        return NULL;
+    }
+    if (res->kind != kind) {
+        luaL_error(ls, "%s is a shared %s", name, kind_names[res->kind]);
+        return NULL;
+    }
+    return res;
+}
+
+static Shared* push_shared(lua_State* ls, Kind kind, char const* cls) {
+    Shared* s = find_shared(ls, kind);
+    Shared** ps = lua_newuserdatauv(ls, sizeof(Shared*), 0);
+    *ps = s;
+    luaL_getmetatable(ls, cls);
+    lua_setmetatable(ls, -2);
+    return s;
+}
+
+static char const Counter_name[] = "mlua.shared.Counter";
+
+static inline Shared* check_Counter(lua_State* ls, int arg) {
+    return *(Shared**)luaL_checkudata(ls, arg, Counter_name);
+}
+
+static int Counter__name(lua_State* ls) {
+    return lua_pushstring(ls, check_Counter(ls, 1)->name), 1;
+}
+
+static int Counter_get(lua_State* ls) {
+    return lua_pushinteger(ls, check_Counter(ls, 1)->value), 1;
+}
+
+static int Counter_set(lua_State* ls) {
+    Shared* s = check_Counter(ls, 1);
+    int32_t value = luaL_checkinteger(ls, 2);
+    uint32_t save = mlua_platform_shared_lock();
+    s->value = value;
+    mlua_platform_shared_unlock(save);
+    return 0;
+}
+
+static int Counter_add(lua_State* ls) {
+    Shared* s = check_Counter(ls, 1);
+    int32_t delta = luaL_optinteger(ls, 2, 1);
+    uint32_t save = mlua_platform_shared_lock();
+    int32_t value = (int32_t)((uint32_t)s->value + (uint32_t)delta);
+    s->value = value;
+    mlua_platform_shared_unlock(save);
+    return lua_pushinteger(ls, value), 1;
+}
+
+static int Counter_swap(lua_State* ls) {
+    Shared* s = check_Counter(ls, 1);
+    int32_t value = luaL_optinteger(ls, 2, 0);
+    uint32_t save = mlua_platform_shared_lock();
+    int32_t old = s->value;
+    s->value = value;
+    mlua_platform_shared_unlock(save);
+    return lua_pushinteger(ls, old), 1;
+}
+
+static int Counter_compare_and_set(lua_State* ls) {
+    Shared* s = check_Counter(ls, 1);
+    int32_t expected = luaL_checkinteger(ls, 2);
+    int32_t value = luaL_checkinteger(ls, 3);
+    uint32_t save = mlua_platform_shared_lock();
+    bool ok = s->value == expected;
+    if (ok) s->value = value;
+    mlua_platform_shared_unlock(save);
+    return lua_pushboolean(ls, ok), 1;
+}
+
+MLUA_SYMBOLS(Counter_syms) = {
+    MLUA_SYM_F(_name, Counter_),
+    MLUA_SYM_F(get, Counter_),
+    MLUA_SYM_F(set, Counter_),
+    MLUA_SYM_F(add, Counter_),
+    MLUA_SYM_F(swap, Counter_),
+    MLUA_SYM_F(compare_and_set, Counter_),
+};
+
+static char const Flag_name[] = "mlua.shared.Flag";
+
+static inline Shared* check_Flag(lua_State* ls, int arg) {
+    return *(Shared**)luaL_checkudata(ls, arg, Flag_name);
+}
+
+static int Flag__name(lua_State* ls) {
+    return lua_pushstring(ls, check_Flag(ls, 1)->name), 1;
+}
+
+static int Flag_get(lua_State* ls) {
+    return lua_pushboolean(ls, check_Flag(ls, 1)->value != 0), 1;
+}
+
+static int Flag_set(lua_State* ls) {
+    Shared* s = check_Flag(ls, 1);
+    int32_t value = lua_isnone(ls, 2) || lua_toboolean(ls, 2);
+    uint32_t save = mlua_platform_shared_lock();
+    s->value = value;
+    mlua_platform_shared_unlock(save);
+    return 0;
+}
+
+static int Flag_clear(lua_State* ls) {
+    Shared* s = check_Flag(ls, 1);
+    uint32_t save = mlua_platform_shared_lock();
+    s->value = 0;
+    mlua_platform_shared_unlock(save);
+    return 0;
+}
+
+static int Flag_test_and_set(lua_State* ls) {
+    Shared* s = check_Flag(ls, 1);
+    uint32_t save = mlua_platform_shared_lock();
+    bool old = s->value != 0;
+    s->value = 1;
+    mlua_platform_shared_unlock(save);
+    return lua_pushboolean(ls, old), 1;
+}
+
+MLUA_SYMBOLS(Flag_syms) = {
+    MLUA_SYM_F(_name, Flag_),
+    MLUA_SYM_F(get, Flag_),
+    MLUA_SYM_F(set, Flag_),
+    MLUA_SYM_F(clear, Flag_),
+    MLUA_SYM_F(test_and_set, Flag_),
+};
+
+static int mod_counter(lua_State* ls) {
+    push_shared(ls, KIND_COUNTER, Counter_name);
+    return 1;
+}
+
+static int mod_flag(lua_State* ls) {
+    push_shared(ls, KIND_FLAG, Flag_name);
+    return 1;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_V(MAX_VALUES, integer, MLUA_SHARED_VALUES),
+
+    MLUA_SYM_F(counter, mod_),
+    MLUA_SYM_F(flag, mod_),
+};
+
+MLUA_OPEN_MODULE(mlua.shared) {
+    mlua_new_module(ls, 0, module_syms);
+
+    // Create the Counter class.
+    mlua_new_class(ls, Counter_name, Counter_syms, mlua_nosyms);
+    lua_pop(ls, 1);
+
+    // Create the Flag class.
+    mlua_new_class(ls, Flag_name, Flag_syms, mlua_nosyms);
+    lua_pop(ls, 1);
+    return 1;
+}
@@ -0,0 +1,46 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local shared = require 'mlua.shared'
+
+function test_counter(t)
+    local c = shared.counter('test.counter')
+    t:expect(t.expr(c):name()):eq('test.counter')
+    c:set(0)
+    t:expect(t.expr(c):add()):eq(1)
+    t:expect(t.expr(c):add(5)):eq(6)
+    t:expect(t.expr(c):add(-2)):eq(4)
+    t:expect(t.expr(c):get()):eq(4)
+    t:expect(t.expr(shared.counter('test.counter')):get()):eq(4)
+    t:expect(t.expr(c):swap()):eq(4)
+    t:expect(t.expr(c):get()):eq(0)
+    t:expect(t.expr(c):compare_and_set(1, 10)):eq(false)
+    t:expect(t.expr(c):compare_and_set(0, 10)):eq(true)
+    t:expect(t.expr(c):get()):eq(10)
+    c:set(0x7fffffff)
+    t:expect(t.expr(c):add()):eq(-0x80000000)
+end
+
+function test_flag(t)
+    local f = shared.flag('test.flag')
+    f:clear()
+    t:expect(t.expr(f):get()):eq(false)
+    t:expect(t.expr(f):test_and_set()):eq(false)
+    t:expect(t.expr(f):test_and_set()):eq(true)
+    t:expect(t.expr(shared.flag('test.flag')):get()):eq(true)
+    f:set(false)
+    t:expect(t.expr(f):get()):eq(false)
+    f:set()
+    t:expect(t.expr(f):get()):eq(true)
+end
+
+function test_errors(t)
+    shared.counter('test.counter')
+    t:expect(t.expr(shared).flag('test.counter'))
+        :raises("test.counter is a shared counter")
+    t:expect(t.expr(shared).counter('')):raises("invalid name length")
+    t:expect(t.expr(shared).counter(('x'):rep(16)))
+        :raises("invalid name length")
+end
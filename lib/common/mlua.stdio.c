@@ -1,13 +1,23 @@
 // Copyright 2023 Remy Blank <remy@c-space.org>
 // SPDX-License-Identifier: MIT
 
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "lua.h"
 #include "lauxlib.h"
 #include "mlua/module.h"
+#include "mlua/platform.h"
+#include "mlua/thread.h"
 #include "mlua/util.h"
 
+// The default size of the buffer of buffered output streams.
+#ifndef MLUA_STDIO_BUFFER_SIZE
+#define MLUA_STDIO_BUFFER_SIZE 256
+#endif
+
 static char const InStream_name[] = "mlua.stdio.InStream";
 
 __attribute__((weak, noinline))
@@ -22,17 +32,67 @@ int mlua_stdio_read(lua_State* ls, int fd, int arg) {
     return 1;
 }
 
+int mlua_stdio_read_buffer(lua_State* ls, int fd, MLuaBuffer const* buf,
+                           size_t off, size_t len) {
+    int cnt;
+    if (buf->vt == NULL) {
+        cnt = read(fd, (char*)buf->ptr + off, len);
+    } else {
+        char chunk[64];
+        cnt = read(fd, chunk, len < sizeof(chunk) ? len : sizeof(chunk));
+        if (cnt > 0) mlua_buffer_write(buf, off, cnt, chunk);
+    }
+    if (cnt < 0) return luaL_fileresult(ls, 0, NULL);
+    lua_pushinteger(ls, cnt);
+    return 1;
+}
+
+__attribute__((weak, noinline))
+int mlua_stdio_read_into(lua_State* ls, int fd, int arg) {
+    MLuaBuffer buf;
+    size_t off, len;
+    mlua_check_buffer_range(ls, arg, &buf, &off, &len);
+    return mlua_stdio_read_buffer(ls, fd, &buf, off, len);
+}
+
 static int InStream_read(lua_State* ls) {
     int fd = *((int*)luaL_checkudata(ls, 1, InStream_name));
     return mlua_stdio_read(ls, fd, 2);
 }
 
+static int InStream_read_into(lua_State* ls) {
+    int fd = *((int*)luaL_checkudata(ls, 1, InStream_name));
+    return mlua_stdio_read_into(ls, fd, 2);
+}
+
 MLUA_SYMBOLS(InStream_syms) = {
     MLUA_SYM_F(read, InStream_),
+    MLUA_SYM_F(read_into, InStream_),
 };
 
 static char const OutStream_name[] = "mlua.stdio.OutStream";
 
+// The buffering modes of an output stream.
+typedef enum BufMode {
+    BUF_NO,
+    BUF_FULL,
+    BUF_LINE,
+} BufMode;
+
+static char const* const buf_modes[] = {"no", "full", "line", NULL};
+
+// An output stream. The buffer of buffered streams is stored in uservalue 1,
+// and the thread flushing the buffer after an idle period in uservalue 2.
+typedef struct OutStream {
+    int fd;
+    uint8_t mode;
+    uint32_t size;
+    uint32_t len;
+    uint32_t idle;
+    uint64_t last;
+    char* buf;
+} OutStream;
+
 __attribute__((weak, noinline))
 int mlua_stdio_write(lua_State* ls, int fd, int arg) {
     size_t len;
@@ -43,19 +103,156 @@ int mlua_stdio_write(lua_State* ls, int fd, int arg) {
     return 1;
 }
 
+static inline OutStream* check_OutStream(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, OutStream_name);
+}
+
+// Write all the given data to a file descriptor through mlua_stdio_write().
+// Returns false on error.
+static bool write_all(lua_State* ls, int fd, char const* data, size_t len) {
+    int top = lua_gettop(ls);
+    while (len > 0) {
+        lua_pushlstring(ls, data, len);
+        mlua_stdio_write(ls, fd, top + 1);
+        lua_Integer cnt = lua_isinteger(ls, top + 2) ?
+                          lua_tointeger(ls, top + 2) : -1;
+        lua_settop(ls, top);
+        if (cnt < 0) return false;
+        data += cnt;
+        len -= cnt;
+    }
+    return true;
+}
+
+// Write the buffered data of a stream. The buffer is emptied even on error.
+static bool flush_stream(lua_State* ls, OutStream* s) {
+    uint32_t len = s->len;
+    s->len = 0;
+    return write_all(ls, s->fd, s->buf, len);
+}
+
+#if LIB_MLUA_MOD_MLUA_THREAD
+
+static int flusher_1(lua_State* ls, int status, lua_KContext ctx) {
+    OutStream* s = lua_touserdata(ls, lua_upvalueindex(1));
+    for (;;) {
+        if (s->len == 0 || s->idle == 0) {
+            return mlua_thread_suspend(ls, &flusher_1, 0, 0);
+        }
+        uint64_t deadline = s->last + s->idle;
+        if (!mlua_ticks64_reached(deadline)) {
+            return mlua_thread_suspend_until(ls, &flusher_1, 0, deadline);
+        }
+        flush_stream(ls, s);
+    }
+}
+
+static int flusher(lua_State* ls) { return flusher_1(ls, LUA_OK, 0); }
+
+// Wake up the flusher thread of the stream at the given index, if it exists.
+static void wake_flusher(lua_State* ls, int arg) {
+    if (lua_getiuservalue(ls, arg, 2) != LUA_TTHREAD) {
+        lua_pop(ls, 1);
+        return;
+    }
+    mlua_thread_meta(ls, "resume");
+    lua_rotate(ls, -2, 1);
+    lua_call(ls, 1, 0);
+}
+
+#else  // !LIB_MLUA_MOD_MLUA_THREAD
+
+static inline void wake_flusher(lua_State* ls, int arg) {}
+
+#endif  // !LIB_MLUA_MOD_MLUA_THREAD
+
 static int OutStream_write(lua_State* ls) {
-    int fd = *((int*)luaL_checkudata(ls, 1, OutStream_name));
-    return mlua_stdio_write(ls, fd, 2);
+    OutStream* s = check_OutStream(ls, 1);
+    if (s->mode == BUF_NO) return mlua_stdio_write(ls, s->fd, 2);
+    size_t len;
+    char const* data = luaL_checklstring(ls, 2, &len);
+    bool ok = true;
+    if (len >= s->size) {
+        // The data doesn't fit in the buffer; write it directly.
+        if (s->len > 0) ok = flush_stream(ls, s);
+        if (ok) ok = write_all(ls, s->fd, data, len);
+    } else if (s->len + len <= s->size || (ok = flush_stream(ls, s))) {
+        bool was_empty = s->len == 0;
+        memcpy(s->buf + s->len, data, len);
+        s->len += len;
+        s->last = mlua_ticks64();
+        if (s->mode == BUF_LINE && memchr(data, '\n', len) != NULL) {
+            ok = flush_stream(ls, s);
+        } else if (was_empty && s->len > 0 && s->idle > 0) {
+            wake_flusher(ls, 1);
+        }
+    }
+    if (!ok) return luaL_fileresult(ls, 0, NULL);
+    return lua_pushinteger(ls, len), 1;
+}
+
+static int OutStream_flush(lua_State* ls) {
+    OutStream* s = check_OutStream(ls, 1);
+    if (s->len > 0 && !flush_stream(ls, s)) return luaL_fileresult(ls, 0, NULL);
+    return lua_pushboolean(ls, true), 1;
+}
+
+static int OutStream_setvbuf(lua_State* ls) {
+    OutStream* s = check_OutStream(ls, 1);
+    BufMode mode = luaL_checkoption(ls, 2, NULL, buf_modes);
+    lua_Integer size = luaL_optinteger(ls, 3, MLUA_STDIO_BUFFER_SIZE);
+    luaL_argcheck(ls, 0 < size && size <= UINT32_MAX, 3, "invalid size");
+    lua_Integer idle = luaL_optinteger(ls, 4, 0);
+    luaL_argcheck(ls, 0 <= idle && idle <= UINT32_MAX, 4, "invalid idle time");
+    if (s->len > 0 && !flush_stream(ls, s)) return luaL_fileresult(ls, 0, NULL);
+    s->mode = mode;
+    s->idle = idle;
+    if (mode == BUF_NO) {
+        s->buf = NULL;
+        s->size = 0;
+        lua_pushnil(ls);
+        lua_setiuservalue(ls, 1, 1);
+    } else if (s->buf == NULL || s->size != size) {
+        s->buf = lua_newuserdatauv(ls, size, 0);
+        s->size = size;
+        lua_setiuservalue(ls, 1, 1);
+    }
+#if LIB_MLUA_MOD_MLUA_THREAD
+    // Start the flusher thread if an idle time is set.
+    if (mode != BUF_NO && idle > 0) {
+        if (lua_getiuservalue(ls, 1, 2) == LUA_TNIL) {
+            lua_pushvalue(ls, 1);
+            lua_pushcclosure(ls, &flusher, 1);
+            mlua_thread_start(ls);
+            lua_setiuservalue(ls, 1, 2);
+        }
+        lua_pop(ls, 1);
+    }
+#endif
+    return lua_pushboolean(ls, true), 1;
+}
+
+static int OutStream___gc(lua_State* ls) {
+    OutStream* s = check_OutStream(ls, 1);
+    if (s->len > 0) flush_stream(ls, s);
+    return 0;
 }
 
 MLUA_SYMBOLS(OutStream_syms) = {
     MLUA_SYM_F(write, OutStream_),
+    MLUA_SYM_F(flush, OutStream_),
+    MLUA_SYM_F(setvbuf, OutStream_),
+};
+
+MLUA_SYMBOLS_NOHASH(OutStream_syms_nh) = {
+    MLUA_SYM_F_NH(__gc, OutStream_),
 };
 
 static void create_stream(lua_State* ls, char const* name, char const* cls,
-                          int stream) {
+                          size_t size, int nuv, int stream) {
     int mod = lua_gettop(ls);
-    int* v = lua_newuserdatauv(ls, sizeof(int), 0);
+    int* v = lua_newuserdatauv(ls, size, nuv);
+    memset(v, 0, size);
     *v = stream;
     luaL_getmetatable(ls, cls);
     lua_setmetatable(ls, -2);
@@ -73,13 +270,18 @@ static void write_stdout(lua_State* ls, char const* s) {
 }
 
 static int global_print(lua_State* ls) {
+    // Format the whole line, and write it with a single call.
     int top = lua_gettop(ls);
+    luaL_Buffer buf;
+    luaL_buffinit(ls, &buf);
     for (int i = 1; i <= top; ++i) {
-        if (i > 1) write_stdout(ls, "\t");
+        if (i > 1) luaL_addchar(&buf, '\t');
         luaL_tolstring(ls, i, NULL);
-        write_stdout(ls, NULL);
+        luaL_addvalue(&buf);
     }
-    write_stdout(ls, "\n");
+    luaL_addchar(&buf, '\n');
+    luaL_pushresult(&buf);
+    write_stdout(ls, NULL);
     return 0;
 }
 
@@ -100,13 +302,15 @@ MLUA_OPEN_MODULE(mlua.stdio) {
     // Create the InStream and OutStream classes.
     mlua_new_class(ls, InStream_name, InStream_syms, mlua_nosyms);
     lua_pop(ls, 1);
-    mlua_new_class(ls, OutStream_name, OutStream_syms, mlua_nosyms);
+    mlua_new_class(ls, OutStream_name, OutStream_syms, OutStream_syms_nh);
     lua_pop(ls, 1);
 
     // Create objects for stdin, stdout and stderr. Set them in _G, too.
-    create_stream(ls, "stdin", InStream_name, STDIN_FILENO);
-    create_stream(ls, "stdout", OutStream_name, STDOUT_FILENO);
-    create_stream(ls, "stderr", OutStream_name, STDERR_FILENO);
+    create_stream(ls, "stdin", InStream_name, sizeof(int), 0, STDIN_FILENO);
+    create_stream(ls, "stdout", OutStream_name, sizeof(OutStream), 2,
+                  STDOUT_FILENO);
+    create_stream(ls, "stderr", OutStream_name, sizeof(OutStream), 2,
+                  STDERR_FILENO);
 
     // Override the print function.
     lua_pushcfunction(ls, global_print);
@@ -0,0 +1,603 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/int64.h"
+#include "mlua/module.h"
+#include "mlua/util.h"
+
+// The value kinds of fields.
+enum {
+    KIND_I8, KIND_U8, KIND_I16, KIND_U16, KIND_I32, KIND_U32, KIND_I64,
+    KIND_U64, KIND_F32, KIND_F64, KIND_BYTES,
+};
+
+// The field types, with their kind, size and mlua.array value format.
+static struct {
+    char const* name;
+    uint8_t kind;
+    uint8_t size;
+    char const* format;
+} const field_types[] = {
+    {"i8", KIND_I8, 1, "i1"}, {"u8", KIND_U8, 1, "I1"},
+    {"i16", KIND_I16, 2, "i2"}, {"u16", KIND_U16, 2, "I2"},
+    {"i32", KIND_I32, 4, "i4"}, {"u32", KIND_U32, 4, "I4"},
+    {"i64", KIND_I64, 8, "i8"}, {"u64", KIND_U64, 8, "I8"},
+    {"f32", KIND_F32, sizeof(float), "f"},
+    {"f64", KIND_F64, sizeof(double), "d"},
+};
+
+// A field of a struct type. The name is kept alive by the user value of the
+// type.
+typedef struct Field {
+    char const* name;
+    size_t len;
+    uint32_t offset;
+    uint32_t size;
+    uint8_t kind;
+} Field;
+
+// A struct type. Fields are looked up through a minimal perfect hash
+// (Czech, Havas, Majewski): each field name hashes to two vertices of a graph
+// with "nvertices" vertices, and the values "g" of the vertices are assigned so
+// that the sum of the values of both vertices, modulo "nfields", is the index
+// of the field.
+typedef struct Type {
+    uint32_t size;
+    uint32_t align;
+    uint32_t seed1;
+    uint32_t seed2;
+    uint32_t nvertices;
+    uint32_t nfields;
+    uint16_t* g;
+    Field fields[];
+} Type;
+
+// A record. The data is either inline, or references a buffer held in the
+// user value.
+typedef struct Record {
+    uint8_t* ptr;
+    alignas(8) uint8_t data[];
+} Record;
+
+static uint32_t hash(char const* key, size_t len, uint32_t seed) {
+    uint32_t h = seed ^ 0x811c9dc5u;
+    for (size_t i = 0; i < len; ++i) h = (h ^ (uint8_t)key[i]) * 0x01000193u;
+    h ^= h >> 16;
+    h *= 0x85ebca6bu;
+    h ^= h >> 13;
+    return h;
+}
+
+static Field const* find_field(Type const* t, char const* key, size_t len) {
+    uint16_t const* g = t->g;
+    uint32_t nv = t->nvertices;
+    uint32_t i = (g[hash(key, len, t->seed1) % nv]
+                  + g[hash(key, len, t->seed2) % nv]) % t->nfields;
+    Field const* f = &t->fields[i];
+    if (f->len != len || (f->name != key && memcmp(f->name, key, len) != 0)) {
+        return NULL;
+    }
+    return f;
+}
+
+#define NONE UINT32_MAX
+#define UNSET UINT16_MAX
+
+// Build the graph of the field names for the current seeds, and assign the
+// vertex values. Each field "i" contributes the edges "2 * i" and "2 * i + 1",
+// one in each direction. Returns false if the graph isn't acyclic, in which
+// case other seeds must be tried.
+static bool assign_hash(Type* t, uint32_t* head, uint32_t* next, uint32_t* to,
+                        uint32_t* stack) {
+    uint32_t nv = t->nvertices, n = t->nfields;
+    uint16_t* g = t->g;
+    for (uint32_t v = 0; v < nv; ++v) {
+        head[v] = NONE;
+        g[v] = UNSET;
+    }
+    for (uint32_t i = 0; i < n; ++i) {
+        Field const* f = &t->fields[i];
+        uint32_t v1 = hash(f->name, f->len, t->seed1) % nv;
+        uint32_t v2 = hash(f->name, f->len, t->seed2) % nv;
+        if (v1 == v2) return false;
+        to[2 * i] = v2;
+        next[2 * i] = head[v1];
+        head[v1] = 2 * i;
+        to[2 * i + 1] = v1;
+        next[2 * i + 1] = head[v2];
+        head[v2] = 2 * i + 1;
+    }
+
+    // Traverse each connected component depth-first. Every edge is pushed at
+    // most once, from the vertex where it starts, so the stack holds at most
+    // 2 * n edges.
+    for (uint32_t root = 0; root < nv; ++root) {
+        if (g[root] != UNSET) continue;
+        g[root] = 0;
+        uint32_t sp = 0;
+        for (uint32_t e = head[root]; e != NONE; e = next[e]) stack[sp++] = e;
+        while (sp > 0) {
+            uint32_t pe = stack[--sp];
+            uint32_t v = to[pe];
+            if (g[v] != UNSET) return false;  // Cycle
+            g[v] = (pe / 2 + n - g[to[pe ^ 1]]) % n;
+            for (uint32_t e = head[v]; e != NONE; e = next[e]) {
+                if (e != (pe ^ 1)) stack[sp++] = e;
+            }
+        }
+    }
+    return true;
+}
+
+// Compute the perfect hash of the field names. With three vertices per field,
+// a random graph is acyclic with a probability of about 0.5, so only a few
+// seeds need to be tried.
+static void find_hash(lua_State* ls, Type* t) {
+    uint32_t nv = t->nvertices, n = t->nfields;
+    uint32_t* head = lua_newuserdatauv(
+        ls, (nv + 6 * n) * sizeof(uint32_t), 0);
+    uint32_t* next = head + nv;
+    uint32_t* to = next + 2 * n;
+    uint32_t* stack = to + 2 * n;
+    for (uint32_t seed = 0;; seed += 2) {
+        t->seed1 = seed;
+        t->seed2 = seed + 1;
+        if (assign_hash(t, head, next, to, stack)) break;
+    }
+    lua_pop(ls, 1);
+}
+
+static void parse_type(lua_State* ls, Field* f, int index) {
+    size_t len;
+    char const* name = lua_tolstring(ls, -1, &len);
+    if (name == NULL) {
+        luaL_error(ls, "bad argument #1 (invalid field type #%d)", index);
+        return;
+    }
+    for (size_t i = 0; i < sizeof(field_types) / sizeof(field_types[0]); ++i) {
+        if (strcmp(name, field_types[i].name) != 0) continue;
+        f->kind = field_types[i].kind;
+        f->size = field_types[i].size;
+        return;
+    }
+    if (name[0] == 'c' && len > 1) {
+        char* end;
+        unsigned long size = strtoul(name + 1, &end, 10);
+        if (*end == '\0' && 0 < size && size <= UINT16_MAX) {
+            f->kind = KIND_BYTES;
+            f->size = size;
+            return;
+        }
+    }
+    luaL_error(ls, "bad argument #1 (invalid field type '%s')", name);
+}
+
+static inline uint32_t field_align(Field const* f) {
+    return f->kind == KIND_BYTES ? 1 : f->size;
+}
+
+static Type* check_type(lua_State* ls, int arg) {
+    if (lua_type(ls, arg) == LUA_TTABLE
+            && lua_getfield(ls, arg, "__struct") == LUA_TUSERDATA) {
+        Type* t = lua_touserdata(ls, -1);
+        lua_pop(ls, 1);
+        return t;
+    }
+    luaL_typeerror(ls, arg, "struct type");
+    return NULL;
+}
+
+// Return the record at the given index, which must be of the type whose record
+// metatable is upvalue 2.
+static bool is_record(lua_State* ls, int arg) {
+    if (lua_type(ls, arg) != LUA_TUSERDATA || !lua_getmetatable(ls, arg)) {
+        return false;
+    }
+    bool res = lua_rawequal(ls, -1, lua_upvalueindex(2));
+    lua_pop(ls, 1);
+    return res;
+}
+
+static Record* check_record(lua_State* ls, int arg) {
+    if (is_record(ls, arg)) return lua_touserdata(ls, arg);
+    lua_getfield(ls, lua_upvalueindex(2), "__name");
+    luaL_typeerror(ls, arg, lua_tostring(ls, -1));
+    return NULL;
+}
+
+static void push_field(lua_State* ls, Field const* f, uint8_t const* p) {
+    p += f->offset;
+    switch (f->kind) {
+    case KIND_I8: lua_pushinteger(ls, *(int8_t const*)p); break;
+    case KIND_U8: lua_pushinteger(ls, *(uint8_t const*)p); break;
+    case KIND_I16: lua_pushinteger(ls, *(int16_t const*)p); break;
+    case KIND_U16: lua_pushinteger(ls, *(uint16_t const*)p); break;
+    case KIND_I32: lua_pushinteger(ls, *(int32_t const*)p); break;
+    case KIND_U32: mlua_push_minint(ls, *(uint32_t const*)p); break;
+    case KIND_I64: mlua_push_minint(ls, *(int64_t const*)p); break;
+    case KIND_U64: mlua_push_minint(ls, *(uint64_t const*)p); break;
+    case KIND_F32: lua_pushnumber(ls, *(float const*)p); break;
+    case KIND_F64: lua_pushnumber(ls, *(double const*)p); break;
+    case KIND_BYTES: lua_pushlstring(ls, (char const*)p, f->size); break;
+    }
+}
+
+static void set_field(lua_State* ls, Field const* f, uint8_t* p, int arg) {
+    p += f->offset;
+    switch (f->kind) {
+    case KIND_I8: case KIND_U8:
+        *(uint8_t*)p = luaL_checkinteger(ls, arg);
+        break;
+    case KIND_I16: case KIND_U16:
+        *(uint16_t*)p = luaL_checkinteger(ls, arg);
+        break;
+    case KIND_I32: case KIND_U32:
+        *(uint32_t*)p = mlua_check_int64(ls, arg);
+        break;
+    case KIND_I64: case KIND_U64:
+        *(uint64_t*)p = mlua_check_int64(ls, arg);
+        break;
+    case KIND_F32: *(float*)p = luaL_checknumber(ls, arg); break;
+    case KIND_F64: *(double*)p = luaL_checknumber(ls, arg); break;
+    case KIND_BYTES: {
+        MLuaBuffer buf;
+        if (!mlua_get_ro_buffer(ls, arg, &buf) || buf.size == SIZE_MAX) {
+            luaL_typeerror(ls, arg, "string or sized buffer");
+            return;
+        }
+        size_t len = buf.size < f->size ? buf.size : f->size;
+        mlua_buffer_read(&buf, 0, len, p);
+        memset(p + len, 0, f->size - len);
+        break;
+    }
+    }
+}
+
+// Record metamethods. Upvalue 1 is the type, and upvalue 2 the record
+// metatable.
+
+static int Record___index(lua_State* ls) {
+    Record const* r = check_record(ls, 1);
+    size_t len;
+    char const* key = lua_tolstring(ls, 2, &len);
+    if (key != NULL) {
+        Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+        Field const* f = find_field(t, key, len);
+        if (f != NULL) return push_field(ls, f, r->ptr), 1;
+    }
+    lua_pushvalue(ls, 2);
+    lua_rawget(ls, lua_upvalueindex(2));
+    return 1;
+}
+
+static int Record___newindex(lua_State* ls) {
+    Record* r = check_record(ls, 1);
+    size_t len;
+    char const* key = lua_tolstring(ls, 2, &len);
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    Field const* f = key != NULL ? find_field(t, key, len) : NULL;
+    if (f == NULL) {
+        return luaL_error(ls, "unknown field: %s", luaL_tolstring(ls, 2, NULL));
+    }
+    set_field(ls, f, r->ptr, 3);
+    return 0;
+}
+
+static int Record___buffer(lua_State* ls) {
+    Record* r = check_record(ls, 1);
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    lua_pushlightuserdata(ls, r->ptr);
+    lua_pushinteger(ls, t->size);
+    return 2;
+}
+
+static int Record___eq(lua_State* ls) {
+    if (!is_record(ls, 1) || !is_record(ls, 2)) {
+        return lua_pushboolean(ls, false), 1;
+    }
+    Record const* r1 = lua_touserdata(ls, 1);
+    Record const* r2 = lua_touserdata(ls, 2);
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    return lua_pushboolean(ls, memcmp(r1->ptr, r2->ptr, t->size) == 0), 1;
+}
+
+static int Record___repr(lua_State* ls) {
+    Record const* r = check_record(ls, 1);
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    luaL_Buffer buf;
+    luaL_buffinit(ls, &buf);
+    luaL_addchar(&buf, '{');
+    for (uint32_t i = 0; i < t->nfields; ++i) {
+        Field const* f = &t->fields[i];
+        if (i > 0) luaL_addstring(&buf, ", ");
+        luaL_addlstring(&buf, f->name, f->len);
+        luaL_addstring(&buf, " = ");
+        lua_pushvalue(ls, 2);  // repr
+        push_field(ls, f, r->ptr);
+        lua_pushvalue(ls, 3);  // seen
+        lua_call(ls, 2, 1);
+        luaL_addvalue(&buf);
+    }
+    luaL_addchar(&buf, '}');
+    return luaL_pushresult(&buf), 1;
+}
+
+static int pairs_iter(lua_State* ls) {
+    Record const* r = check_record(ls, 1);
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    Field const* f = NULL;
+    if (lua_isnil(ls, 2)) {
+        f = &t->fields[0];
+    } else {
+        size_t len;
+        char const* key = lua_tolstring(ls, 2, &len);
+        f = key != NULL ? find_field(t, key, len) : NULL;
+        if (f == NULL) return luaL_error(ls, "invalid key");
+        ++f;
+    }
+    if (f == &t->fields[t->nfields]) return 0;
+    lua_pushlstring(ls, f->name, f->len);
+    push_field(ls, f, r->ptr);
+    return 2;
+}
+
+static int Record___pairs(lua_State* ls) {
+    check_record(ls, 1);
+    lua_pushvalue(ls, lua_upvalueindex(1));
+    lua_pushvalue(ls, lua_upvalueindex(2));
+    lua_pushcclosure(ls, &pairs_iter, 2);
+    lua_pushvalue(ls, 1);
+    return 2;
+}
+
+// Push a new record of the type whose record metatable is at the given index.
+static Record* new_record(lua_State* ls, int mt, Type const* t, bool inline_) {
+    Record* r = lua_newuserdatauv(ls, sizeof(Record) + (inline_ ? t->size : 0),
+                                  1);
+    r->ptr = r->data;
+    lua_pushvalue(ls, mt);
+    lua_setmetatable(ls, -2);
+    return r;
+}
+
+// Type functions. Upvalue 1 is the type, and upvalue 2 the record metatable.
+
+static int Type___call(lua_State* ls) {
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    Record* r = new_record(ls, lua_upvalueindex(2), t, true);
+    memset(r->data, 0, t->size);
+    switch (lua_type(ls, 2)) {
+    case LUA_TNONE:
+    case LUA_TNIL:
+        break;
+    case LUA_TTABLE:
+        lua_pushnil(ls);
+        while (lua_next(ls, 2)) {
+            size_t len;
+            char const* key = lua_type(ls, -2) == LUA_TSTRING ?
+                              lua_tolstring(ls, -2, &len) : NULL;
+            Field const* f = key != NULL ? find_field(t, key, len) : NULL;
+            if (f == NULL) {
+                return luaL_error(ls, "unknown field: %s",
+                                  luaL_tolstring(ls, -2, NULL));
+            }
+            set_field(ls, f, r->data, lua_gettop(ls));
+            lua_pop(ls, 1);
+        }
+        break;
+    default: {
+        MLuaBuffer buf;
+        if (!mlua_get_ro_buffer(ls, 2, &buf)) {
+            return luaL_typeerror(ls, 2, "table, string or buffer");
+        }
+        luaL_argcheck(ls, buf.size != SIZE_MAX && buf.size >= t->size, 2,
+                      "buffer too small");
+        mlua_buffer_read(&buf, 0, t->size, r->data);
+        break;
+    }
+    }
+    return 1;
+}
+
+static int Type_offset(lua_State* ls) {
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    size_t len;
+    char const* key = luaL_checklstring(ls, 2, &len);
+    Field const* f = find_field(t, key, len);
+    if (f == NULL) return luaL_error(ls, "unknown field: %s", key);
+    return lua_pushinteger(ls, f->offset), 1;
+}
+
+// Return a pointer to the raw data of the buffer at the given index, and set
+// "len" to the number of records that it contains.
+static uint8_t* check_records(lua_State* ls, int arg, Type const* t,
+                              lua_Integer* len) {
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, arg, &buf) && buf.vt == NULL
+                         && buf.size != SIZE_MAX, arg, "raw buffer");
+    luaL_argcheck(ls, (uintptr_t)buf.ptr % t->align == 0, arg,
+                  "misaligned buffer");
+    *len = buf.size / t->size;
+    return buf.ptr;
+}
+
+static int Type_at(lua_State* ls) {
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    lua_Integer len;
+    uint8_t* ptr = check_records(ls, 2, t, &len);
+    lua_Integer i = luaL_optinteger(ls, 3, 1);
+    luaL_argcheck(ls, 1 <= i && i <= len, 3, "out of bounds");
+    Record* r = new_record(ls, lua_upvalueindex(2), t, false);
+    r->ptr = ptr + (i - 1) * t->size;
+    lua_pushvalue(ls, 2);
+    lua_setiuservalue(ls, -2, 1);
+    return 1;
+}
+
+static int Type_array(lua_State* ls) {
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    lua_Integer len = luaL_checkinteger(ls, 2);
+    luaL_argcheck(ls, len >= 0, 2, "invalid length");
+    lua_pushvalue(ls, lua_upvalueindex(3));  // array
+    lua_pushfstring(ls, "c%d", (int)t->size);
+    lua_pushvalue(ls, 2);
+    lua_call(ls, 2, 1);
+    return 1;
+}
+
+static int Type_column(lua_State* ls) {
+    Type const* t = lua_touserdata(ls, lua_upvalueindex(1));
+    lua_Integer len;
+    check_records(ls, 2, t, &len);
+    size_t klen;
+    char const* key = luaL_checklstring(ls, 3, &klen);
+    Field const* f = find_field(t, key, klen);
+    if (f == NULL) return luaL_error(ls, "unknown field: %s", key);
+    if (f->kind == KIND_BYTES) {
+        return luaL_error(ls, "unsupported column: %s", key);
+    }
+    // A strided mlua.array view of the field in all records. The offset and
+    // the stride are multiples of the field size, as fields are aligned.
+    lua_getfield(ls, lua_upvalueindex(3), "view");
+    lua_pushvalue(ls, 2);
+    lua_pushstring(ls, field_types[f->kind].format);
+    lua_pushinteger(ls, f->offset / f->size + 1);
+    lua_pushinteger(ls, len);
+    lua_pushinteger(ls, t->size / f->size);
+    lua_call(ls, 5, 1);
+    return 1;
+}
+
+static int mod_define(lua_State* ls) {
+    luaL_checktype(ls, 1, LUA_TTABLE);
+    char const* name = luaL_optstring(ls, 2, "mlua.struct.Record");
+    lua_Integer n = luaL_len(ls, 1);
+    lua_settop(ls, 2);
+    mlua_require(ls, "mlua.array", true);
+    int array = lua_gettop(ls);
+    luaL_argcheck(ls, 0 < n && n < UINT16_MAX / 4, 1, "invalid field count");
+    uint32_t nv = 3 * n + 1;
+
+    // Create the type and its name table.
+    Type* t = lua_newuserdatauv(ls, sizeof(Type) + n * sizeof(Field)
+                                    + nv * sizeof(uint16_t), 1);
+    t->nfields = n;
+    t->nvertices = nv;
+    t->g = (uint16_t*)&t->fields[n];
+    lua_createtable(ls, n, 0);
+    lua_pushvalue(ls, -1);
+    lua_setiuservalue(ls, -3, 1);
+    int names = lua_gettop(ls);
+    lua_createtable(ls, 0, n);
+    int seen = names + 1;
+
+    // Parse the fields, and lay them out like a C struct.
+    uint32_t offset = 0, align = 1;
+    for (lua_Integer i = 0; i < n; ++i) {
+        Field* f = &t->fields[i];
+        if (lua_geti(ls, 1, i + 1) != LUA_TTABLE) {
+            return luaL_error(ls, "bad argument #1 (invalid field #%d)",
+                              (int)i + 1);
+        }
+        lua_geti(ls, -1, 1);
+        f->name = lua_tolstring(ls, -1, &f->len);
+        if (f->name == NULL) {
+            return luaL_error(ls, "bad argument #1 (invalid field name #%d)",
+                              (int)i + 1);
+        }
+        lua_pushvalue(ls, -1);
+        if (lua_rawget(ls, seen) != LUA_TNIL) {
+            return luaL_error(ls, "duplicate field: %s", f->name);
+        }
+        lua_pop(ls, 1);
+        lua_pushvalue(ls, -1);
+        lua_pushboolean(ls, true);
+        lua_rawset(ls, seen);
+        lua_rawseti(ls, names, i + 1);
+        lua_geti(ls, -1, 2);
+        parse_type(ls, f, i + 1);
+        lua_pop(ls, 2);
+        uint32_t fa = field_align(f);
+        offset = (offset + fa - 1) & ~(fa - 1);
+        f->offset = offset;
+        offset += f->size;
+        if (fa > align) align = fa;
+    }
+    t->align = align;
+    t->size = (offset + align - 1) & ~(align - 1);
+
+    lua_pop(ls, 1);  // seen
+    find_hash(ls, t);
+
+    // Create the record metatable, which doubles as the type object.
+    lua_createtable(ls, 0, 16);
+    int mt = lua_gettop(ls);
+    lua_pushstring(ls, name);
+    lua_setfield(ls, mt, "__name");
+    lua_pushvalue(ls, names - 1);
+    lua_setfield(ls, mt, "__struct");
+    lua_pushvalue(ls, names);
+    lua_setfield(ls, mt, "fields");
+    lua_pushinteger(ls, t->size);
+    lua_setfield(ls, mt, "size");
+    lua_pushinteger(ls, t->align);
+    lua_setfield(ls, mt, "align");
+    static struct {
+        char const* name;
+        lua_CFunction fn;
+    } const methods[] = {
+        {"__index", &Record___index}, {"__newindex", &Record___newindex},
+        {"__buffer", &Record___buffer}, {"__eq", &Record___eq},
+        {"__repr", &Record___repr}, {"__pairs", &Record___pairs},
+        {"offset", &Type_offset}, {"at", &Type_at}, {"array", &Type_array},
+        {"column", &Type_column},
+    };
+    for (size_t i = 0; i < sizeof(methods) / sizeof(methods[0]); ++i) {
+        lua_pushvalue(ls, names - 1);  // type
+        lua_pushvalue(ls, mt);
+        lua_pushvalue(ls, array);
+        lua_pushcclosure(ls, methods[i].fn, 3);
+        lua_setfield(ls, mt, methods[i].name);
+    }
+
+    // Make the type callable to create records.
+    lua_createtable(ls, 0, 1);
+    lua_pushvalue(ls, names - 1);  // type
+    lua_pushvalue(ls, mt);
+    lua_pushcclosure(ls, &Type___call, 2);
+    lua_setfield(ls, -2, "__call");
+    lua_setmetatable(ls, mt);
+    return 1;
+}
+
+static int mod_type(lua_State* ls) {
+    if (!lua_getmetatable(ls, 1)) return luaL_pushfail(ls), 1;
+    if (lua_getfield(ls, -1, "__struct") != LUA_TUSERDATA) {
+        return luaL_pushfail(ls), 1;
+    }
+    lua_pop(ls, 1);
+    return 1;
+}
+
+static int mod_size(lua_State* ls) {
+    return lua_pushinteger(ls, check_type(ls, 1)->size), 1;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_F(define, mod_),
+    MLUA_SYM_F(type, mod_),
+    MLUA_SYM_F(size, mod_),
+};
+
+MLUA_OPEN_MODULE(mlua.struct) {
+    mlua_new_module(ls, 0, module_syms);
+    return 1;
+}
@@ -0,0 +1,85 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local array = require 'mlua.array'
+local repr = require 'mlua.repr'
+local struct = require 'mlua.struct'
+local table = require 'table'
+
+local Sample = struct.define({
+    {'ts', 'u32'}, {'x', 'i16'}, {'y', 'i16'}, {'tag', 'c3'}, {'v', 'f64'},
+}, 'Sample')
+
+function test_define(t)
+    t:expect(t.expr(Sample).size):eq(24)
+    t:expect(t.expr(Sample).align):eq(8)
+    t:expect(t.expr(Sample).fields):eq({'ts', 'x', 'y', 'tag', 'v'})
+    for _, test in ipairs{{'ts', 0}, {'x', 4}, {'y', 6}, {'tag', 8},
+                          {'v', 16}} do
+        local name, want = table.unpack(test)
+        t:expect(t.expr(Sample):offset(name)):eq(want)
+    end
+    t:expect(t.expr(struct).size(Sample)):eq(24)
+    t:expect(t.expr(struct).define({{'a', 'u8'}, {'a', 'u8'}}))
+        :raises("duplicate field: a")
+    t:expect(t.expr(struct).define({{'a', 'u7'}}))
+        :raises("invalid field type 'u7'")
+    t:expect(t.expr(struct).define({}))
+        :raises("invalid field count")
+
+    -- Define a type with many fields, to exercise the perfect hash search.
+    local fields = {}
+    for i = 1, 200 do fields[i] = {('f%d'):format(i), 'u8'} end
+    local Many = struct.define(fields)
+    local m = Many()
+    for i = 1, 200 do m[('f%d'):format(i)] = i end
+    for i = 1, 200 do t:expect(m[('f%d'):format(i)]):eq(i) end
+end
+
+function test_fields(t)
+    local s = Sample{ts = 1234, x = -5, y = 7, tag = 'ab', v = 1.5}
+    t:expect(t.expr(struct).type(s)):eq(Sample)
+    t:expect(t.expr(struct).type({})):eq(nil)
+    t:expect(t.expr(s).ts):eq(1234)
+    t:expect(t.expr(s).x):eq(-5)
+    t:expect(t.expr(s).y):eq(7)
+    t:expect(t.expr(s).tag):eq('ab\0')
+    t:expect(t.expr(s).v):eq(1.5)
+    s.x, s.tag = 0x12345, 'abcdef'
+    t:expect(t.expr(s).x):eq(0x2345)
+    t:expect(t.expr(s).tag):eq('abc')
+    t:expect(t.expr(s).size):eq(24)
+    t:expect(function() s.z = 1 end):raises("unknown field: z")
+    t:expect(function() return Sample{z = 1} end):raises("unknown field: z")
+    local Point = struct.define{{'x', 'i8'}, {'y', 'i8'}}
+    t:expect(repr(Point{x = 1, y = -2})):eq("{x = 1, y = -2}")
+    local got = {}
+    for k, v in pairs(Sample{y = 3}) do got[#got + 1] = k end
+    t:expect(got):eq({'ts', 'x', 'y', 'tag', 'v'})
+end
+
+function test_buffer(t)
+    local s = Sample{ts = 1, x = 2, y = 3}
+    local c = Sample(s)
+    t:expect(c):eq(s)
+    c.y = 4
+    t:expect(c == s):eq(false)
+    t:expect(function() return Sample('abc') end):raises("buffer too small")
+
+    local arr = Sample:array(4)
+    t:expect(t.expr(arr):len()):eq(4)
+    for i = 1, 4 do
+        local r = Sample:at(arr, i)
+        r.ts, r.x, r.y = i, 10 * i, -i
+    end
+    t:expect(t.expr(Sample):at(arr, 3).x):eq(30)
+    t:expect(t.expr(Sample):at(arr, 5)):raises("out of bounds")
+    t:expect(t.expr(Sample):column(arr, 'x'))
+        :eq(array('h', 4):set(1, 10, 20, 30, 40))
+    t:expect(t.expr(Sample):column(arr, 'y'))
+        :eq(array('h', 4):set(1, -1, -2, -3, -4))
+    t:expect(t.expr(Sample):column(arr, 'tag'))
+        :raises("unsupported column: tag")
+end
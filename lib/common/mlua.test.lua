@@ -6,7 +6,9 @@ _ENV = module(...)
 local config = require 'mlua.config'
 local io = require 'mlua.io'
 local mem = require 'mlua.mem'
+local string = require 'string'
 local thread = require 'mlua.thread'
+local time = require 'mlua.time'
 local table = require 'table'
 
 local module_name = ...
@@ -46,6 +48,92 @@ function test_alloc_stats(t)
     t:expect(peak1):label("peak1"):gte(used1)
     t:expect(peak2):label("peak2"):gte(used2)
     t:expect(peak2):label("peak2"):gte(peak1)
+    local _, _, _, _, pool_size, pool_idle = alloc_stats()
+    if pool_size then
+        t:expect(pool_idle):label("pool_idle"):gte(0):lte(pool_size)
+    end
+end
+
+function test_alloc_limits(t)
+    if not alloc_stats() then t:skip("Allocation statistics disabled") end
+    t:cleanup(function() set_alloc_limits() end)
+    local _, _, used = alloc_stats()
+    set_alloc_limits(nil, used + 20000)
+    local _, _, _, _, _, _, soft, hard = alloc_stats()
+    t:expect(soft):label("soft"):eq(nil)
+    t:expect(hard):label("hard"):eq(used + 20000)
+    local ok, err = pcall(string.rep, 'x', 100000)
+    t:expect(ok):label("ok"):eq(false)
+    t:expect(err):label("err"):eq("not enough memory")
+    t:expect(#string.rep('x', 1000)):label("#rep"):eq(1000)
+    set_alloc_limits()
+    t:expect(#string.rep('x', 100000)):label("#rep"):eq(100000)
+    t:expect(t.expr(_G).set_alloc_limits(2000, 1000))
+        :raises("soft limit above hard limit")
+    t:expect(t.expr(_G).set_alloc_limits(-1)):raises("invalid limit")
+end
+
+function test_gc_profile(t)
+    local prev = gc_profile()
+    t:cleanup(function() gc_profile(prev) end)
+    t:expect(prev.mode):label("mode"):eq_one_of{'incremental', 'generational'}
+    local got = gc_profile{mode = 'generational', minormul = 10}
+    t:expect(got.mode):label("mode"):eq('generational')
+    t:expect(got.minormul):label("minormul"):eq(10)
+    t:expect(got.pause):label("pause"):eq(prev.pause)
+    t:expect(t.expr(_G).collectgarbage('incremental')):eq('generational')
+    t:expect(gc_profile().mode):label("mode"):eq('incremental')
+    got = gc_profile{mode = 'incremental', pause = 150, stepsize = 10}
+    t:expect(got.pause):label("pause"):eq(150)
+    t:expect(got.stepsize):label("stepsize"):eq(10)
+    t:expect(got.minormul):label("minormul"):eq(10)
+    t:expect(t.expr(_G).gc_profile({mode = 'other'})):raises("invalid GC mode")
+    t:expect(t.expr(_G).gc_profile({pause = 0})):raises("invalid GC pause")
+    t:expect(t.expr(_G).gc_profile({stepsize = 'x'}))
+        :raises("invalid GC stepsize")
+    if not alloc_stats() then
+        t:expect(t.expr(_G).gc_profile({target_pause = 100}))
+            :raises("requires allocation statistics")
+    end
+end
+
+function test_gc_tune(t)
+    if not alloc_stats() then t:skip("Allocation statistics disabled") end
+    local prev = gc_profile()
+    t:cleanup(function() gc_profile(prev) end)
+
+    -- With a target pause of 1us, steps are always too slow, so the auto-tuner
+    -- reduces the step size.
+    gc_profile{mode = 'incremental', stepsize = 16, target_pause = 1}
+    local deadline = time.deadline(2 * time.sec)
+    local garbage
+    while gc_profile().stepsize == 16
+            and time.compare(time.ticks(), deadline) < 0 do
+        garbage = {}
+        for i = 1, 100 do garbage[i] = {i} end
+        thread.yield()
+    end
+    t:expect(gc_profile().stepsize):label("stepsize"):lt(16)
+end
+
+function test_lazy_require(t)
+    local tab = lazy_require('table')
+    local mt = getmetatable(tab)
+    t:expect(t.expr(_G).type(mt.__index)):eq('function')
+    t:expect(t.expr(tab).concat({'a', 'b', 'c'})):eq('abc')
+    t:expect(mt.__index):label("__index"):eq(table)
+    t:expect(mt.__newindex):label("__newindex"):eq(table)
+end
+
+function test_module_profile(t)
+    local records = module_profile()
+    if not records then t:skip("Module profiling disabled") end
+    t:expect(#records):label("#records"):gt(0)
+    for _, r in ipairs(records) do
+        t:expect(t.expr(_G).type(r.name)):eq('string')
+        t:expect(r.depth):label("depth"):gte(0)
+        if r.time then t:expect(r.time):label("time"):gte(0) end
+    end
 end
 
 function test_with_traceback(t)
@@ -169,3 +257,27 @@ function test_Function_close(t)
     end)
     t:expect(called, "To-be-closed function wasn't called on error")
 end
+
+function test_const_module(t)
+    local data = require 'mlua.test.const'
+    t:expect(t.expr(data).name):eq("test")
+    t:expect(t.expr(data).version):eq(3)
+    t:expect(t.expr(data).scale):eq(1.5)
+    t:expect(t.expr(data).enabled):eq(true)
+    t:expect(t.expr(data).missing):eq(nil)
+    t:expect(t.expr(data).unknown):eq(nil)
+    t:expect(t.expr(data).curve[4]):eq(45)
+    t:expect(t.expr(data).curve[6]):eq(nil)
+    t:expect(#data.curve):label("#curve"):eq(5)
+    t:expect(rawequal(data.curve, data.curve), "Proxy isn't cached")
+    t:expect(t.expr(data).nested.list[2].a):eq(2)
+    t:expect(t.expr(data).nested.text):eq('é"\\')
+    local got = {}
+    for k, v in pairs(data.opcodes) do got[k] = v end
+    t:expect(got):label("opcodes")
+        :eq({nop = 0, load = 1, store = 2, jmp = 16})
+    got = {}
+    for i, v in ipairs(data.curve) do got[i] = v end
+    t:expect(got):label("curve"):eq({0, 10, 25, 45, 70})
+    t:expect(function() data.curve[1] = 1 end):raises("read%-only table")
+end
@@ -17,7 +17,10 @@ local package = require 'package'
 local string = require 'string'
 
 local def_mod_pat = '^(.*)%.test$'
+local bench_mod_pat = '^(.*)%.bench$'
 local def_func_pat = '^test_'
+local bench_pat = '^bench_'
+local max_iterations = 1 << 30
 local blocking_pat = '_BNB$'
 local err_terminate = {}
 
@@ -273,6 +276,40 @@ local PASS = '@{+GREEN}PASS@{NORM}'
 local SKIP = '@{+YELLOW}SKIP@{NORM}'
 local FAIL = '@{+RED}FAIL@{NORM}'
 local ERROR = '@{+RED}ERROR@{NORM}'
+local statuses = {[PASS] = 'pass', [SKIP] = 'skip', [FAIL] = 'fail',
+                  [ERROR] = 'error'}
+
+local json_escapes = {['"'] = '\\"', ['\\'] = '\\\\'}
+
+local function json_string(s)
+    return '"' .. s:gsub('[%c"\\]', function(c)
+        return json_escapes[c] or ('\\u%04x'):format(c:byte())
+    end) .. '"'
+end
+
+-- Encode a value as JSON. Tables are encoded as objects with sorted keys, and
+-- lists as arrays.
+local function json(v)
+    local typ = type(v)
+    if typ == 'string' then return json_string(v) end
+    if typ == 'number' then
+        if math.type(v) == 'integer' then return tostring(v) end
+        if v ~= v or v == math.huge or v == -math.huge then return 'null' end
+        return ('%.6g'):format(v)
+    end
+    if typ ~= 'table' then return tostring(v) end
+    local parts = list()
+    if list.len(v) > 0 then
+        for _, e in list.ipairs(v) do parts:append(json(e)) end
+        return '[' .. parts:concat(',') .. ']'
+    end
+    local keys = list()
+    for k in pairs(v) do keys:append(k) end
+    for _, k in keys:sort():ipairs() do
+        parts:append(json_string(k) .. ':' .. json(v[k]))
+    end
+    return '{' .. parts:concat(',') .. '}'
+end
 
 Test = oo.class('Test')
 Test.helper = 'xGJLirXXSePWnLIqptqM85UBIpZdaYs86P7zfF9sWaa3'
@@ -418,6 +455,10 @@ end
 
 function Test:run(name, fn) return Test(name, self):_run(fn) end
 
+function Test:bench(name, fn)
+    return Bench(name, self):_run(function(b) return b:_bench(fn) end)
+end
+
 function Test:_pre_run()
     collectgarbage()
     local count, size, used = alloc_stats(true)
@@ -481,20 +522,40 @@ function Test:_run(fn)
     elseif self._skip then root.nskip = root.nskip + 1
     else root.npass = root.npass + 1 end
 
-    -- Output results and stats.
+    -- Output results and stats. Benchmark results are always output.
     local level, opts = self._level, root._opts
-    if level >= 0 and level < opts.results then
+    local metrics = self._metrics
+    if level >= 0 and (level < opts.results or metrics) then
         local out = root._stdout
         local indent = (' '):rep(2 * level)
         local left = ('%s%s: %s'):format(indent, self:_result(), self.name)
-        local right = ('%.3f s'):format(duration / time.sec)
+        local right = metrics and ('%.1f ns/op'):format(metrics.ns)
+                      or ('%.3f s'):format(duration / time.sec)
         io.fprintf(out, "%s%s %s\n", io.ansi(left),
                    (' '):rep(78 - #io.ansi(left, io.empty_tags) - #right),
                    right)
+        if metrics then
+            self:_print_metrics(io.Indenter(out, indent .. ' '))
+        end
         if opts.stats then
             self:_print_stats(io.Indenter(out, indent .. ' '))
         end
     end
+    if level >= 0 and opts.records then
+        local rec = {type = metrics and 'bench' or 'test', path = self:path(),
+                     status = statuses[self:_result()],
+                     duration = duration / time.sec}
+        if metrics then self:_record_metrics(rec) end
+        root:_record(rec)
+    end
+end
+
+-- Emit a machine-readable record on the result channel. Records are JSON
+-- objects wrapped in an APC escape sequence, which terminals ignore, so that
+-- they can be interleaved with the human-readable output and extracted by
+-- tools/results.
+function Test:_record(rec)
+    return io.fprintf(self._root._stdout, '\27_mlua %s\27\\', json(rec))
 end
 
 local tb_exclude = {
@@ -574,6 +635,19 @@ end
 
 local fn_comp = util.table_comp{1, 2}
 
+-- Return the functions of a module whose name matches a pattern, sorted by
+-- definition order.
+local function module_functions(module, pat)
+    local fns = list()
+    for name, fn in pairs(module) do
+        if name:find(pat) then
+            local info = debug.getinfo(fn, 'S')
+            fns:append({info and info.linedefined or 0, name, fn})
+        end
+    end
+    return fns:sort(fn_comp)
+end
+
 function Test:run_module(name, pat)
     pat = pat or def_func_pat
     local root = self._root
@@ -591,14 +665,7 @@ function Test:run_module(name, pat)
     local module = require(name)
     local ok, fn = pcall(function() return module.set_up end)
     if ok and fn then fn(self) end
-    local fns = list()
-    for name, fn in pairs(module) do
-        if name:find(pat) then
-            local info = debug.getinfo(fn, 'S')
-            fns:append({info and info.linedefined or 0, name, fn})
-        end
-    end
-    for _, fn in fns:sort(fn_comp):ipairs() do
+    for _, fn in module_functions(module, pat):ipairs() do
         local b = thread and fn[2]:find(blocking_pat)
         self:run(fn[2] .. (b and " (non-blocking)" or ""), fn[3])
         if b then
@@ -609,6 +676,10 @@ function Test:run_module(name, pat)
             end)
         end
     end
+    if not root._opts.bench then return end
+    for _, fn in module_functions(module, bench_pat):ipairs() do
+        self:bench(fn[2], fn[3])
+    end
 end
 
 function Test:run_modules(mod_pat, func_pat)
@@ -627,11 +698,18 @@ end
 function Test:_main(runs)
     io.aprintf("@{CLR}")
     self._stdout = stdout
+    local opts = self._opts
+    local mod_pat = opts.modules
+    if opts.records then
+        self:_record{type = 'start', lua = _RELEASE, modules = mod_pat,
+                     bench = opts.bench, bench_time = opts.bench_time}
+    end
     local start = time.ticks()
     self:_run(function(t)
-        if runs == 1 then return t:run_modules() end
+        if runs == 1 then return t:run_modules(mod_pat) end
         for i = 1, runs do
-            t:run(("Run #%s"):format(i), function(t) return t:run_modules() end)
+            t:run(("Run #%s"):format(i),
+                  function(t) return t:run_modules(mod_pat) end)
         end
     end)
     local dt = time.ticks() - start
@@ -640,6 +718,107 @@ function Test:_main(runs)
               self.npass + self.nskip + self.nfail + self.nerror, dt / time.sec)
     self:_print_stats(stdout, '')
     io.printf("Result: %s\n", io.ansi(self:_result()))
+    if self._opts.records then
+        self:_record{type = 'end', status = statuses[self:_result()],
+                     pass = self.npass, skip = self.nskip, fail = self.nfail,
+                     error = self.nerror, duration = dt / time.sec}
+    end
+end
+
+-- A benchmark. The benchmark function is called with an increasing number of
+-- iterations in "n", until its duration reaches the target benchmark time.
+Bench = oo.class('Bench', Test)
+
+-- Restart measuring the current run. This can be called by the benchmark
+-- function to exclude its setup from the measurement.
+function Bench:reset()
+    self._b_extra = nil
+    collectgarbage()
+    self._b_allocs = alloc_stats()
+    self._b_resumes = thread and select(3, thread.stats())
+    self._b_start = time.ticks()
+    self._b_cycles = time.cycles()
+end
+
+-- Set the number of bytes processed per operation, to report the throughput.
+function Bench:bytes(n) self._b_bytes = n end
+
+-- Report a custom metric for the current run.
+function Bench:metric(name, value)
+    self._b_extra = list.append(self._b_extra, name, value)
+end
+
+-- Run the benchmark function and return the duration in ticks and in
+-- nanoseconds, as well as the allocation and resume counts. Short durations are
+-- measured with the cycle counter, for sub-microsecond resolution.
+function Bench:_measure(fn)
+    self:reset()
+    fn(self)
+    local dc = time.cycles_diff(self._b_cycles)
+    local dt = time.ticks() - self._b_start
+    local allocs = self._b_allocs and alloc_stats() - self._b_allocs
+    local resumes = self._b_resumes
+                    and select(3, thread.stats()) - self._b_resumes
+    local freq = time.cycles_freq()
+    local ns = dt * (1e9 / time.sec)
+    if dc >= 0 and dt < (1 << 30) // freq * time.sec then
+        ns = dc * (1e9 / freq)
+    end
+    return dt, ns, allocs, resumes
+end
+
+function Bench:_bench(fn)
+    local target = self._root._opts.bench_time * time.msec
+    self.n = 1
+    self:_measure(fn)  -- Warm up
+    local n = 1
+    while true do
+        self.n = n
+        local dt, dns, allocs, resumes = self:_measure(fn)
+        if dt >= target or n >= max_iterations then
+            local ns = dns / n
+            local bytes = self._b_bytes
+            self._metrics = {
+                n = n, ns = ns,
+                allocs = allocs and allocs / n,
+                resumes = resumes and resumes / n,
+                mbps = bytes and ns > 0 and bytes * 1e3 / ns or nil,
+                extra = self._b_extra,
+            }
+            return
+        end
+        -- Estimate the number of iterations required to reach the target time,
+        -- with some margin, and grow by at most 100x per run.
+        local want = dt > 0 and math.ceil(1.2 * n * target / dt) or 100 * n
+        n = math.tointeger(math.max(
+            math.min(want, 100.0 * n, max_iterations), n + 1))
+    end
+end
+
+local function format_per_op(v) return v and ('%.2f'):format(v) or '-' end
+
+function Bench:_record_metrics(rec)
+    local m = self._metrics
+    rec.n, rec.ns, rec.allocs, rec.resumes = m.n, m.ns, m.allocs, m.resumes
+    rec.mbps = m.mbps
+    for i = 1, list.len(m.extra), 2 do
+        if not rec.metrics then rec.metrics = {} end
+        rec.metrics[m.extra[i]] = m.extra[i + 1]
+    end
+end
+
+function Bench:_print_metrics(out)
+    local m = self._metrics
+    local parts = list()
+    if m.mbps then parts:append(('%.2f MB/s'):format(m.mbps)) end
+    for i = 1, list.len(m.extra), 2 do
+        local v = m.extra[i + 1]
+        if math.type(v) == 'float' then v = ('%.2f'):format(v) end
+        parts:append(('%s: %s'):format(m.extra[i], v))
+    end
+    io.fprintf(out, "%s iterations, %s allocs/op, %s resumes/op%s\n", m.n,
+               format_per_op(m.allocs), format_per_op(m.resumes),
+               #parts > 0 and ', ' .. parts:concat(', ') or '')
 end
 
 local reg_exclude = {
@@ -677,12 +856,8 @@ end
 function Runner:prompt()
     while true do
         io.printf("\n(testing) ")
-        local line = ''
-        while true do
-            local c = stdin:read(1)
-            if c == '\n' then break end
-            line = line .. c
-        end
+        if not self.stdin then self.stdin = io.BufferedReader(stdin, 64) end
+        local line = self.stdin:read_line() or ''
         local args, cmd = list()
         for t in line:gmatch('[^%s]+') do
             if not cmd then cmd = t else args:append(t) end
@@ -700,6 +875,16 @@ end
 -- TODO: Terminate on first failure
 -- TODO: Launch repl on failure
 
+function Runner:cmd_b(ms)
+    local opts = self.opts
+    if ms then
+        opts.bench = true
+        opts.bench_time = math.tointeger(tonumber(ms)) or opts.bench_time
+    else
+        opts.bench = not opts.bench
+    end
+end
+
 function Runner:cmd_out()
     self.opts.output = not self.opts.output
 end
@@ -709,6 +894,10 @@ function Runner:cmd_r(count)
     return true
 end
 
+function Runner:cmd_rec()
+    self.opts.records = not self.opts.records
+end
+
 function Runner:cmd_reg() print_registry() end
 
 function Runner:cmd_res(level)
@@ -738,12 +927,16 @@ function Runner:cmd_x()
     return true
 end
 
-local function pmain(opts, args)
+local function pmain(bench, mod_pat)
     local argv = util.get(_G, 'arg')
     local opts, args = cli.parse_args(argv)
     cli.parse_opts(opts, {
+        bench = cli.bool_opt(bench),
+        bench_time = cli.int_opt(100),
+        modules = cli.str_opt(mod_pat),
         output = cli.bool_opt(false),
         prompt = cli.bool_opt(true),
+        records = cli.bool_opt(false),
         results = cli.int_opt(0),
         runs = cli.int_opt(1),
         stats = cli.bool_opt(false),
@@ -751,13 +944,18 @@ local function pmain(opts, args)
     return Runner(opts):run()
 end
 
-function main()
+local function run_main(...)
     local ok, res = xpcall(pmain, function(err)
         io.aprintf("\n@{+RED}ERROR:@{NORM} %s\n", debug.traceback(err, 2))
         return err
-    end)
+    end, ...)
     return ok and res
 end
 
+function main() return run_main(false, def_mod_pat) end
+
+-- Run the benchmarks from all linked-in modules whose name ends with ".bench".
+function bench_main() return run_main(true, bench_mod_pat) end
+
 overrides = {}
 try(require, 'mlua.testing.platform')
@@ -3,8 +3,10 @@
 
 _ENV = module(...)
 
+local io = require 'mlua.io'
 local list = require 'mlua.list'
 local repr = require 'mlua.repr'
+local testing = require 'mlua.testing'
 local table = require 'table'
 
 function test_call_args(t)
@@ -56,3 +58,49 @@ function test_Expr(t)
         t:expect(t.expr(getmetatable(e)).__eval(e)):eq(want_eval)
     end
 end
+
+function test_Bench(t)
+    t:patch(t._root._opts, 'bench_time', 10)
+    local runs, total = 0, 0
+    local b = testing.Bench('bench', t)
+    b:_bench(function(b)
+        runs, total = runs + 1, total + b.n
+        for i = 1, b.n do local _ = {i} end
+    end)
+    local m = b._metrics
+    t:expect(runs):label("runs"):gte(3)
+    t:expect(m.n):label("n"):gt(1)
+    t:expect(total):label("total"):gt(m.n)
+    t:expect(m.ns):label("ns"):gt(0)
+    if m.allocs then t:expect(m.allocs):label("allocs"):gte(1) end
+end
+
+function test_records(t)
+    local out = io.Recorder()
+    local root = testing.Test()
+    root._opts = {records = true, results = 0, bench_time = 1}
+    root._stdout = out
+    root:run('pass "1"', function(t) end)
+    root:run('skip', function(t) t:skip("skipped") end)
+    root:bench('bench', function(b)
+        b:bytes(16)
+        b:metric('count', 3)
+    end)
+    local recs = list()
+    for rec in tostring(out):gmatch('\27_mlua (.-)\27\\') do
+        recs:append((rec:gsub('"duration":[^,}]*', '"duration":0')))
+    end
+    t:expect(recs:len()):label("records"):eq(3)
+    t:expect(recs[1]):label("pass")
+        :eq('{"duration":0,"path":"pass \\"1\\"","status":"pass",'
+            .. '"type":"test"}')
+    t:expect(recs[2]):label("skip")
+        :eq('{"duration":0,"path":"skip","status":"skip","type":"test"}')
+    t:expect(recs[3]):label("bench")
+        :matches('^{.*"metrics":{"count":3},.*"path":"bench",.*'
+                 .. '"type":"bench"}$')
+end
+
+function bench_Matcher_eq(b)
+    for i = 1, b.n do b:expect(i):eq(i) end
+end
@@ -0,0 +1,71 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+
+-- Start a thread that yields in a loop, until it is killed.
+local function start_yielder()
+    return thread.start(function()
+        while true do thread.yield() end
+    end)
+end
+
+function bench_yield(b)
+    local yielder = start_yielder()
+    local done<close> = function() yielder:kill() end
+    local yield = thread.yield
+    b:reset()
+    for i = 1, b.n do yield() end
+end
+
+function bench_channel(b)
+    local ch = thread.Channel(1)
+    local receiver = thread.start(function()
+        while true do ch:recv() end
+    end)
+    local done<close> = function() receiver:kill() end
+    b:reset()
+    for i = 1, b.n do ch:send(i) end
+end
+
+-- Measure the latency of event dispatch, as the delay between the deadline of
+-- a timer and the resumption of the thread waiting for it.
+function bench_wakeup_latency(b)
+    local ticks, sleep_until = time.ticks, time.sleep_until
+    local sum, max = 0, 0
+    for i = 1, b.n do
+        local want = ticks() + 200
+        sleep_until(want)
+        local delta = ticks() - want
+        sum = sum + delta
+        if delta > max then max = delta end
+    end
+    b:metric('latency_us', sum / b.n)
+    b:metric('max_latency_us', max)
+end
+
+-- Measure the cost of inserting a timer while other threads are sleeping.
+local function bench_sleepers(b, count)
+    local deadline = time.ticks() + time.min
+    local sleepers = {}
+    local done<close> = function()
+        for _, th in ipairs(sleepers) do th:kill() end
+    end
+    for i = 1, count do
+        sleepers[i] = thread.start(function()
+            time.sleep_until(deadline + i)
+        end)
+    end
+    thread.yield()
+    local sleep_for = time.sleep_for
+    b:reset()
+    for i = 1, b.n do sleep_for(1) end
+    b:metric('sleepers', count)
+end
+
+function bench_sleepers_1(b) return bench_sleepers(b, 1) end
+function bench_sleepers_16(b) return bench_sleepers(b, 16) end
+function bench_sleepers_64(b) return bench_sleepers(b, 64) end
@@ -5,6 +5,7 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <limits.h>
 
 #include "lapi.h"
 #include "lgc.h"
@@ -14,23 +15,106 @@
 #include "mlua/int64.h"
 #include "mlua/module.h"
 #include "mlua/platform.h"
+#include "mlua/trace.h"
 
 void mlua_thread_require(lua_State* ls) {
     mlua_require(ls, "mlua.thread", false);
 }
 
+// The number of thread priority levels.
+#ifndef MLUA_THREAD_PRIORITIES
+#define MLUA_THREAD_PRIORITIES 4
+#endif
+
+static_assert(1 <= MLUA_THREAD_PRIORITIES && MLUA_THREAD_PRIORITIES <= 32,
+              "MLUA_THREAD_PRIORITIES out of range");
+
+// The number of consecutive resumes of higher-priority threads after which the
+// heads of the lower-priority active queues are promoted by one level, to
+// avoid starvation. When zero, aging is disabled.
+#ifndef MLUA_THREAD_AGING
+#define MLUA_THREAD_AGING 0
+#endif
+
+// The maximum number of terminated threads that are kept for reuse by start().
+// When zero, thread recycling is disabled.
+#ifndef MLUA_THREAD_POOL_SIZE
+#define MLUA_THREAD_POOL_SIZE 0
+#endif
+
+// Run incremental garbage collection steps when the scheduler is idle.
+#ifndef MLUA_THREAD_IDLE_GC
+#define MLUA_THREAD_IDLE_GC 0
+#endif
+
+// The size of the garbage collection steps run when the scheduler is idle, in
+// the units of LUA_GCSTEP (Kbytes).
+#ifndef MLUA_THREAD_IDLE_GC_STEP
+#define MLUA_THREAD_IDLE_GC_STEP 1
+#endif
+
+// The minimum time until the next timer deadline for which the scheduler runs
+// garbage collection steps when idle, in microseconds.
+#ifndef MLUA_THREAD_IDLE_GC_WINDOW
+#define MLUA_THREAD_IDLE_GC_WINDOW 1000
+#endif
+
+// The default time slice after which a running thread is forced to yield, in
+// microseconds, when preemption is enabled with MLUA_THREAD_PREEMPT. When zero,
+// preemption is initially disabled.
+#ifndef MLUA_THREAD_SLICE
+#define MLUA_THREAD_SLICE 0
+#endif
+
+// The number of VM instructions between checks for the end of the time slice.
+#ifndef MLUA_THREAD_SLICE_COUNT
+#define MLUA_THREAD_SLICE_COUNT 1000
+#endif
+
 static char const mlua_Thread_name[] = "mlua.Thread";
 
+// Event watchers are stored in slots of the WATCHERS table, whose index is
+// stored in the event. Slots are allocated on the first wait, cleared when the
+// wait completes and released when the event is disabled, so that waiting and
+// waking up don't modify the table structure. The slot index isn't part of the
+// observable event state, so it is updated through const event pointers.
+static char const watchers_key;
+
 // Data stored in the per-thread extra space returned by lua_getextraspace().
 typedef struct ThreadExtra {
-    uint64_t deadline;
+    union {
+        uint64_t deadline;  // The deadline of a thread on the timer heap
+        uint64_t ready;     // The time when an active thread was queued
+    };
+    uint32_t seq;       // The insertion sequence number on the timer heap
+    uint32_t index;     // The (1-based) index of the thread in the timer heap
+#if MLUA_THREAD_STATS
+    uint32_t event_time;    // The time when the waking event was set
+#endif
     uint8_t state;
     uint8_t flags;
+    uint8_t priority;
 } ThreadExtra;
 
 static_assert(sizeof(ThreadExtra) <= LUA_EXTRASPACE,
               "LUA_EXTRASPACE too small");
 
+#if MLUA_THREAD_STATS
+
+// Per-thread statistics, stored as userdata in main.STATS.
+typedef struct ThreadStats {
+    uint64_t run_time;      // Cumulative time spent running
+    uint64_t wait_time;     // Cumulative time spent runnable but not running
+    uint64_t jitter;        // Cumulative lateness of precise wakeups
+    uint32_t max_slice;     // Longest time spent running in a single resume
+    uint32_t resumes;       // Number of resumes
+    uint32_t wakeups;       // Number of precise wakeups
+    uint32_t max_jitter;    // Largest lateness of a precise wakeup
+    uint32_t preemptions;   // Number of forced yields at the end of a slice
+} ThreadStats;
+
+#endif
+
 // Thread states, as stored in ThreadExtra.state.
 typedef enum ThreadState {
     STATE_ACTIVE,
@@ -42,22 +126,39 @@ typedef enum ThreadState {
 // Thread flags, as stored in ThreadExtra.flags.
 typedef enum ThreadFlags {
     FLAGS_BLOCKING = 1u << 0,
+    FLAGS_PRECISE = 1u << 1,
+    FLAGS_EVENT = 1u << 2,  // The thread was woken by an event
+    FLAGS_PREEMPTED = 1u << 3,  // The thread was forced to yield
+    FLAGS_JOINING = 1u << 4,  // The thread is linked in joiners lists
+    FLAGS_WAITING = 1u << 5,  // The thread is queued on a condition variable
+    FLAGS_DETACHED = 1u << 6,  // The thread can be recycled when it terminates
+    FLAGS_DEADLINE_SET = 1u << 7,  // ThreadExtra.deadline was set on suspend
 } ThreadFlags;
 
-// Non-running thread stack indexes.
+// Non-running thread stack indexes. Threads on the timer heap have a nil NEXT.
 #define FP_NEXT (-1)
 #define FP_COUNT 1
 
 // Upvalue indexes for main.
 typedef enum MainUpvalueIndex {
-    UV_HEAD = 1,
-    UV_TAIL,
-    UV_TIMERS,
+    UV_TIMERS = 1,
     UV_THREADS,
     UV_JOINERS,
     UV_NAMES,
+    UV_WATCHERS,
+#if MLUA_THREAD_STATS
+    UV_STATS,
+#endif
+#if MLUA_THREAD_POOL_SIZE > 0
+    UV_POOL,
+#endif
+    UV_QUEUES,  // (HEAD, TAIL) pairs of the active queues, by priority
 } MainUpvalueIndex;
 
+#define UV_HEAD(p) (UV_QUEUES + 2 * (p))
+#define UV_TAIL(p) (UV_QUEUES + 2 * (p) + 1)
+#define UV_COUNT (UV_QUEUES + 2 * MLUA_THREAD_PRIORITIES - 1)
+
 // Return a reference to the main thread.
 static inline lua_State* main_thread(lua_State* ls) {
     return G(ls)->mainthread;
@@ -98,26 +199,119 @@ static inline void replace_next(lua_State* thread, lua_State* next) {
     push_thread(thread, next);
 }
 
+// The timers are kept in a binary min-heap, stored in the array part of the
+// TIMERS table. The heap is ordered by deadline, then by insertion sequence
+// number, to keep FIFO ordering for threads with the same deadline. The index
+// of each thread in the heap is stored in its ThreadExtra, which enables O(log
+// n) removal of arbitrary threads. All heap operations are performed on the
+// stack of the main thread, while it is running main().
+#define TIMERS lua_upvalueindex(UV_TIMERS)
+
+// Return the number of threads on the timer heap.
+static inline uint32_t timers_len(lua_State* main) {
+    return lua_rawlen(main, TIMERS);
+}
+
+// Return the thread at the given index of the timer heap.
+static inline lua_State* timer_at(lua_State* main, uint32_t index) {
+    lua_rawgeti(main, TIMERS, index);
+    lua_State* thread = lua_tothread(main, -1);
+    lua_pop(main, 1);  // The thread is still referenced by TIMERS
+    return thread;
+}
+
+// Return true iff timer a must be resumed before timer b.
+static inline bool timer_before(ThreadExtra const* a, ThreadExtra const* b) {
+    return a->deadline < b->deadline
+           || (a->deadline == b->deadline && (int32_t)(a->seq - b->seq) < 0);
+}
+
+// Set the thread at the given index of the timer heap.
+static inline void set_timer(lua_State* main, uint32_t index,
+                             lua_State* thread) {
+    push_thread(main, thread);
+    lua_rawseti(main, TIMERS, index);
+    thread_extra(thread)->index = index;
+}
+
+// Move a thread up the timer heap, starting at the given index.
+static void sift_up(lua_State* main, uint32_t index, lua_State* thread) {
+    ThreadExtra const* ext = thread_extra(thread);
+    while (index > 1) {
+        uint32_t pi = index / 2;
+        lua_State* parent = timer_at(main, pi);
+        if (!timer_before(ext, thread_extra(parent))) break;
+        set_timer(main, index, parent);
+        index = pi;
+    }
+    set_timer(main, index, thread);
+}
+
+// Move a thread down the timer heap of the given length, starting at the given
+// index.
+static void sift_down(lua_State* main, uint32_t index, uint32_t len,
+                      lua_State* thread) {
+    ThreadExtra const* ext = thread_extra(thread);
+    for (;;) {
+        uint32_t ci = 2 * index;
+        if (ci > len) break;
+        lua_State* child = timer_at(main, ci);
+        if (ci < len) {
+            lua_State* right = timer_at(main, ci + 1);
+            if (timer_before(thread_extra(right), thread_extra(child))) {
+                child = right;
+                ++ci;
+            }
+        }
+        if (!timer_before(thread_extra(child), ext)) break;
+        set_timer(main, index, child);
+        index = ci;
+    }
+    set_timer(main, index, thread);
+}
+
+// Add a thread to the timer heap. The deadline must already be set.
+static void add_timer(lua_State* main, lua_State* thread) {
+    thread_extra(thread)->seq = mlua_global(main)->thread_timer_seq++;
+    sift_up(main, timers_len(main) + 1, thread);
+}
+
+// Remove a thread from the timer heap.
+static void remove_timer(lua_State* main, lua_State* thread) {
+    uint32_t index = thread_extra(thread)->index;
+    uint32_t len = timers_len(main);
+    lua_State* last = timer_at(main, len);
+    lua_pushnil(main);
+    lua_rawseti(main, TIMERS, len);
+    if (index == len) return;
+    if (index > 1 && timer_before(thread_extra(last),
+                                  thread_extra(timer_at(main, index / 2)))) {
+        sift_up(main, index, last);
+    } else {
+        sift_down(main, index, len - 1, last);
+    }
+}
+
 static void print_main_state(lua_State* ls, lua_State* running,
                              char const* msg) {
-    printf("# %s\n#   Running: %p\n#   Active:", msg, running);
+    printf("# %s\n#   Running: %p\n", msg, running);
     lua_State* main = main_thread(ls);
-    lua_State* tail = lua_tothread(main, lua_upvalueindex(UV_TAIL));
-    lua_State* ts = lua_tothread(main, lua_upvalueindex(UV_HEAD));
-    int i = 0;
-    while (ts != NULL) {
-        printf(" %p%s", ts, ts == tail ? "*" : "");
-        ts = lua_tothread(ts, FP_NEXT);
-        if (++i > 10) break;
-    }
-    printf("\n#   Timers:");
-    ts = lua_tothread(main, lua_upvalueindex(UV_TIMERS));
-    i = 0;
-    while (ts != NULL) {
-        printf(" %p", ts);
-        ts = lua_tothread(ts, FP_NEXT);
-        if (++i > 10) break;
+    int i;
+    for (int p = MLUA_THREAD_PRIORITIES - 1; p >= 0; --p) {
+        printf("#   Active[%d]:", p);
+        lua_State* tail = lua_tothread(main, lua_upvalueindex(UV_TAIL(p)));
+        lua_State* ts = lua_tothread(main, lua_upvalueindex(UV_HEAD(p)));
+        i = 0;
+        while (ts != NULL) {
+            printf(" %p%s", ts, ts == tail ? "*" : "");
+            ts = lua_tothread(ts, FP_NEXT);
+            if (++i > 10) break;
+        }
+        printf("\n");
     }
+    printf("#   Timers:");
+    uint32_t len = timers_len(main);
+    for (i = 1; i <= (int)len && i <= 10; ++i) printf(" %p", timer_at(main, i));
     printf("\n");
 }
 
@@ -147,6 +341,38 @@ int mlua_thread_suspend(lua_State* ls, lua_KFunction cont, lua_KContext ctx,
     return mlua_thread_yield(ls, 1, cont, ctx);
 }
 
+int mlua_thread_suspend_until(lua_State* ls, lua_KFunction cont,
+                              lua_KContext ctx, uint64_t deadline) {
+    ThreadExtra* extra = thread_extra(ls);
+    extra->deadline = deadline;
+    extra->flags |= FLAGS_DEADLINE_SET;
+    lua_pushnil(ls);
+    return mlua_thread_yield(ls, 1, cont, ctx);
+}
+
+// Return the deadline stored at the bottom of the stack by
+// mlua_thread_sleep_until(), as two 32-bit halves.
+static uint64_t sleep_deadline(lua_State* ls) {
+    return (uint32_t)lua_tointeger(ls, 1)
+           | ((uint64_t)(uint32_t)lua_tointeger(ls, 2) << 32);
+}
+
+static int sleep_until_1(lua_State* ls, int status, lua_KContext ctx) {
+    uint64_t deadline = sleep_deadline(ls);
+    if (mlua_ticks64_reached(deadline)) return 0;
+    return mlua_thread_suspend_until(ls, &sleep_until_1, 0, deadline);
+}
+
+int mlua_thread_sleep_until(lua_State* ls, uint64_t deadline) {
+    lua_settop(ls, 0);
+    if (mlua_ticks64_reached(deadline)) return 0;
+    // Keep a copy of the deadline on the stack, in case the thread is resumed
+    // before the deadline.
+    lua_pushinteger(ls, (lua_Integer)(uint32_t)deadline);
+    lua_pushinteger(ls, (lua_Integer)(uint32_t)(deadline >> 32));
+    return mlua_thread_suspend_until(ls, &sleep_until_1, 0, deadline);
+}
+
 lua_State* mlua_check_thread(lua_State* ls, int arg) {
     lua_State* thread = lua_tothread(ls, arg);
     luaL_argexpected(ls, thread != NULL, arg, "thread");
@@ -160,35 +386,14 @@ int mlua_thread_meta(lua_State* ls, char const* name) {
     return res;
 }
 
-static void remove_timer(lua_State* main, lua_State* thread) {
-    // prev = TIMERS
-    lua_State* prev = lua_tothread(main, lua_upvalueindex(UV_TIMERS));
-    if (thread == prev) {
-        lua_xmove(thread, main, 1);
-        lua_replace(main, lua_upvalueindex(UV_TIMERS));  // TIMERS = thread.NEXT
-        lua_pushnil(thread);  // thread.NEXT = nil
-        return;
-    }
-    for (;;) {
-        lua_State* next = lua_tothread(prev, FP_NEXT);  // next = prev.NEXT
-        if (next == NULL) return;
-        if (next == thread) {  // next == thread?
-            lua_pop(prev, 1);
-            lua_xmove(thread, prev, 1);  // prev.NEXT = thread.NEXT
-            lua_pushnil(thread);  // thread.NEXT = nil
-            return;
-        }
-        prev = next;
-    }
-}
-
-static void activate(lua_State* main, lua_State* thread) {
+// Append a thread to the active queue with the given priority.
+static void push_active(lua_State* main, int priority, lua_State* thread) {
     // tail = TAIL
-    lua_State* tail = lua_tothread(main, lua_upvalueindex(UV_TAIL));
+    lua_State* tail = lua_tothread(main, lua_upvalueindex(UV_TAIL(priority)));
     if (tail == NULL) {
         // HEAD = thread
         push_thread(main, thread);
-        lua_replace(main, lua_upvalueindex(UV_HEAD));
+        lua_replace(main, lua_upvalueindex(UV_HEAD(priority)));
     } else {
         // tail.NEXT = thread
         lua_pop(tail, 1);
@@ -196,18 +401,99 @@ static void activate(lua_State* main, lua_State* thread) {
     }
     // TAIL = thread
     push_thread(main, thread);
-    lua_replace(main, lua_upvalueindex(UV_TAIL));
+    lua_replace(main, lua_upvalueindex(UV_TAIL(priority)));
+}
+
+// Remove the thread at the head of the active queue with the given priority,
+// and return it, or NULL if the queue is empty.
+static lua_State* pop_active(lua_State* main, int priority) {
+    // head = HEAD
+    lua_State* head = lua_tothread(main, lua_upvalueindex(UV_HEAD(priority)));
+    if (head == NULL) return NULL;
+    // HEAD = head.NEXT
+    lua_pushvalue(head, FP_NEXT);
+    lua_xmove(head, main, 1);
+    if (lua_isnil(main, -1)) {
+        // TAIL = nil
+        lua_pushnil(main);
+        lua_replace(main, lua_upvalueindex(UV_TAIL(priority)));
+    }
+    lua_replace(main, lua_upvalueindex(UV_HEAD(priority)));
+    // head.NEXT = nil
+    lua_pop(head, 1);
+    lua_pushnil(head);
+    return head;
+}
+
+// Return true iff at least one of the active queues isn't empty.
+static bool has_active(lua_State* main) {
+    for (int p = 0; p < MLUA_THREAD_PRIORITIES; ++p) {
+        if (!lua_isnil(main, lua_upvalueindex(UV_TAIL(p)))) return true;
+    }
+    return false;
+}
+
+// Append a thread to the active queue corresponding to its priority.
+static inline void activate_at(lua_State* main, lua_State* thread,
+                               int priority) {
+#if MLUA_THREAD_STATS
+    thread_extra(thread)->ready = mlua_ticks64();
+#endif
+    push_active(main, priority, thread);
+}
+
+static inline void activate(lua_State* main, lua_State* thread) {
+    activate_at(main, thread, thread_extra(thread)->priority);
+}
+
+#if MLUA_THREAD_STATS
+
+// Return the statistics of a thread, or NULL if it doesn't have any. If
+// "create" is true, create the statistics if they don't exist yet. "arg" is the
+// index of the STATS table.
+static ThreadStats* thread_stats(lua_State* ls, int arg, lua_State* thread,
+                                 bool create) {
+    push_thread(ls, thread);
+    ThreadStats* stats = NULL;
+    if (lua_rawget(ls, arg) != LUA_TNIL) {
+        stats = lua_touserdata(ls, -1);
+    } else if (create) {
+        push_thread(ls, thread);
+        stats = lua_newuserdatauv(ls, sizeof(ThreadStats), 0);
+        *stats = (ThreadStats){0};
+        lua_rawset(ls, arg);  // STATS[thread] = stats
+    }
+    lua_pop(ls, 1);
+    return stats;
+}
+
+// Record the lateness of a precise wakeup of a thread.
+static void record_wakeup(lua_State* main, lua_State* thread, uint64_t late) {
+    ThreadStats* stats = thread_stats(main, lua_upvalueindex(UV_STATS), thread,
+                                      true);
+    ++stats->wakeups;
+    stats->jitter += late;
+    if (late > stats->max_jitter) {
+        stats->max_jitter = late < UINT32_MAX ? late : UINT32_MAX;
+    }
 }
 
-static bool resume(lua_State* main, lua_State* thread) {
+#endif
+
+// Resume a waiting thread onto the active queue with the given priority.
+static bool resume_at(lua_State* main, lua_State* thread, int priority) {
     int state = thread_state(thread);
     if (state == STATE_ACTIVE || state == STATE_DEAD) return false;
     if (state == STATE_TIMER) remove_timer(main, thread);
     thread_extra(thread)->state = STATE_ACTIVE;
-    activate(main, thread);
+    activate_at(main, thread, priority);
     return true;
 }
 
+static inline bool resume(lua_State* main, lua_State* thread) {
+    return resume_at(main, thread, thread_extra(thread)->priority);
+}
+
 static int Thread_name(lua_State* ls) {
     lua_State* self = mlua_check_thread(ls, 1);
     push_main_value(ls, lua_upvalueindex(UV_NAMES));
@@ -216,6 +502,26 @@ static int Thread_name(lua_State* ls) {
     return lua_pushfstring(ls, "%p", self), 1;
 }
 
+static int Thread_stats(lua_State* ls) {
+#if MLUA_THREAD_STATS
+    lua_State* self = mlua_check_thread(ls, 1);
+    push_main_value(ls, lua_upvalueindex(UV_STATS));
+    ThreadStats* stats = thread_stats(ls, lua_absindex(ls, -1), self, false);
+    if (stats == NULL) return 0;
+    lua_pushinteger(ls, stats->resumes);
+    lua_pushinteger(ls, stats->run_time);
+    lua_pushinteger(ls, stats->max_slice);
+    lua_pushinteger(ls, stats->wait_time);
+    lua_pushinteger(ls, stats->wakeups);
+    lua_pushinteger(ls, stats->max_jitter);
+    lua_pushinteger(ls, stats->jitter);
+    lua_pushinteger(ls, stats->preemptions);
+    return 8;
+#else
+    return 0;
+#endif
+}
+
 static int Thread_is_alive(lua_State* ls) {
     lua_State* self = mlua_check_thread(ls, 1);
     lua_pushboolean(ls, self == ls || thread_state(self) != STATE_DEAD);
@@ -230,6 +536,31 @@ static int Thread_is_waiting(lua_State* ls) {
     return 1;
 }
 
+// Return a thread priority argument, or the default if it is none or nil.
+static int check_priority(lua_State* ls, int arg, int def) {
+    lua_Integer priority = luaL_optinteger(ls, arg, def);
+    luaL_argcheck(ls, 0 <= priority && priority < MLUA_THREAD_PRIORITIES, arg,
+                  "invalid priority");
+    return priority;
+}
+
+static int Thread_priority(lua_State* ls) {
+    lua_State* self = mlua_check_thread(ls, 1);
+    return lua_pushinteger(ls, thread_extra(self)->priority), 1;
+}
+
+static int Thread_set_priority(lua_State* ls) {
+    lua_State* self = mlua_check_thread(ls, 1);
+    thread_extra(self)->priority = check_priority(ls, 2, 0);
+    return 0;
+}
+
+static int Thread_detach(lua_State* ls) {
+    lua_State* self = mlua_check_thread(ls, 1);
+    thread_extra(self)->flags |= FLAGS_DETACHED;
+    return 0;
+}
+
 static int Thread_resume(lua_State* ls) {
     lua_State* self = mlua_check_thread(ls, 1);
     if (self == ls) return lua_pushboolean(ls, false), 1;
@@ -237,6 +568,138 @@ static int Thread_resume(lua_State* ls) {
     return lua_pushboolean(ls, resume(main, self)), 1;
 }
 
+// Joiners are linked intrusively: main.JOINERS[self] holds the first thread
+// waiting for self to terminate, and each joiner holds a link to the next
+// joiner (or false for the last one) in a slot of its own suspended frame. In
+// Thread:join(), the frame is (self, link), and in select(), the link is the
+// stack slot of the source that is self.
+
+// Return the stack index of the slot holding the link from the joiner to the
+// next joiner of target, or zero if the joiner doesn't wait for target.
+static int joiner_link(lua_State* joiner, lua_State* target) {
+    if (lua_type(joiner, 1) == LUA_TTHREAD) return 2;  // Thread:join()
+    lua_Unsigned len = lua_rawlen(joiner, 1);  // select()
+    for (lua_Unsigned i = 1; i <= len; ++i) {
+        lua_rawgeti(joiner, 1, i);
+        lua_State* th = lua_tothread(joiner, -1);
+        lua_pop(joiner, 1);
+        if (th == target) return 1 + i;
+    }
+    return 0;
+}
+
+// Add the running thread to the joiners of the thread at the given index, so
+// that it gets resumed when the thread terminates. The link to the next joiner
+// is stored at index "link".
+static void add_joiner(lua_State* ls, int arg, int link) {
+    arg = lua_absindex(ls, arg);
+    thread_extra(ls)->flags |= FLAGS_JOINING;
+    push_main_value(ls, lua_upvalueindex(UV_JOINERS));
+    lua_pushvalue(ls, arg);
+    if (lua_rawget(ls, -2) == LUA_TNIL) {  // next = main.JOINERS[self]
+        lua_pop(ls, 1);
+        lua_pushboolean(ls, false);
+    }
+    lua_replace(ls, link);  // running.LINK = next
+    // main.JOINERS[self] = running
+    lua_pushvalue(ls, arg);
+    push_thread(ls, ls);
+    lua_rawset(ls, -3);
+    lua_pop(ls, 1);  // Remove JOINERS
+}
+
+// Remove a joiner from the joiners of the thread at the given index.
+static void remove_joiner(lua_State* ls, int arg, lua_State* joiner) {
+    arg = lua_absindex(ls, arg);
+    lua_State* target = lua_tothread(ls, arg);
+    int top = lua_gettop(ls);
+    push_main_value(ls, lua_upvalueindex(UV_JOINERS));
+    lua_pushvalue(ls, arg);
+    lua_rawget(ls, -2);  // cur = main.JOINERS[self]
+    lua_State* prev = NULL;
+    for (;;) {
+        lua_State* cur = lua_tothread(ls, -1);
+        if (cur == NULL) break;
+        int link = joiner_link(cur, target);
+        if (link == 0) break;
+        lua_pushvalue(cur, link);
+        lua_xmove(cur, ls, 1);  // next = cur.LINK
+        if (cur == joiner) {
+            if (prev != NULL) {  // prev.LINK = next
+                lua_xmove(ls, prev, 1);
+                lua_replace(prev, joiner_link(prev, target));
+            } else {  // main.JOINERS[self] = next or nil
+                if (!lua_toboolean(ls, -1)) {
+                    lua_pop(ls, 1);
+                    lua_pushnil(ls);
+                }
+                lua_pushvalue(ls, arg);
+                lua_rotate(ls, -2, 1);
+                lua_rawset(ls, top + 1);
+            }
+            break;
+        }
+        prev = cur;
+        lua_remove(ls, -2);  // Remove cur
+    }
+    lua_settop(ls, top);
+}
+
+// Resume the joiners of the thread at the given index, and return true iff
+// there were any.
+static bool resume_joiners(lua_State* ls, int arg) {
+    arg = lua_absindex(ls, arg);
+    lua_State* main = main_thread(ls);
+    lua_State* target = lua_tothread(ls, arg);
+    push_main_value(ls, lua_upvalueindex(UV_JOINERS));
+    lua_pushvalue(ls, arg);
+    lua_rawget(ls, -2);  // joiner = main.JOINERS[self]
+    bool any = !lua_isnil(ls, -1);
+    if (any) {
+        // main.JOINERS[self] = nil
+        lua_pushvalue(ls, arg);
+        lua_pushnil(ls);
+        lua_rawset(ls, -4);
+    }
+    for (;;) {
+        lua_State* joiner = lua_tothread(ls, -1);
+        if (joiner == NULL) break;
+        int link = joiner_link(joiner, target);
+        if (link == 0) break;
+        lua_pushvalue(joiner, link);
+        lua_xmove(joiner, ls, 1);  // next = joiner.LINK
+        resume(main, joiner);
+        lua_remove(ls, -2);  // Remove joiner
+    }
+    lua_pop(ls, 2);  // Remove joiner, JOINERS
+    return any;
+}
+
+// Remove a thread that is about to be killed from the joiners lists it is on.
+static void unlink_joiner(lua_State* ls, lua_State* joiner) {
+    ThreadExtra* ext = thread_extra(joiner);
+    if ((ext->flags & FLAGS_JOINING) == 0) return;
+    ext->flags &= ~FLAGS_JOINING;
+    if (lua_type(joiner, 1) == LUA_TTHREAD) {  // Thread:join()
+        lua_pushvalue(joiner, 1);
+        lua_xmove(joiner, ls, 1);
+        remove_joiner(ls, -1, joiner);
+        lua_pop(ls, 1);
+        return;
+    }
+    lua_Unsigned len = lua_rawlen(joiner, 1);  // select()
+    for (lua_Unsigned i = 1; i <= len; ++i) {
+        int typ = lua_type(joiner, 1 + i);
+        if (typ != LUA_TTHREAD && typ != LUA_TBOOLEAN) continue;
+        lua_rawgeti(joiner, 1, i);
+        lua_xmove(joiner, ls, 1);
+        remove_joiner(ls, -1, joiner);
+        lua_pop(ls, 1);
+    }
+}
+
+static void unlink_waiter(lua_State* ls, lua_State* waiter);
+
 static int Thread_kill(lua_State* ls) {
     lua_State* self = mlua_check_thread(ls, 1);
     if (self == ls) return luaL_error(ls, "thread cannot kill itself");
@@ -247,37 +710,16 @@ static int Thread_kill(lua_State* ls) {
     lua_State* main = main_thread(ls);
     if (state == STATE_TIMER) remove_timer(main, self);
 
-    // Close the Lua thread and store the termination below self.NEXT.
+    // Remove the thread from the joiners lists and wait queues, close the Lua
+    // thread and store the termination below self.NEXT.
+    unlink_joiner(ls, self);
+    unlink_waiter(ls, self);
     lua_xmove(self, ls, 1);  // next = self.NEXT
     if (lua_closethread(self, ls) == LUA_OK) lua_pushnil(self);
     thread_extra(self)->state = STATE_DEAD;
     lua_xmove(ls, self, 1);  // self.NEXT = next
 
-    // Resume joiners.
-    push_main_value(ls, lua_upvalueindex(UV_JOINERS));
-    lua_pushvalue(ls, 1);
-    int typ = lua_rawget(ls, -2);  // joiners = main.JOINERS[self]
-    if (typ != LUA_TNIL) {
-        // main.JOINERS[self] = nil
-        lua_pushvalue(ls, 1);
-        lua_pushnil(ls);
-        lua_rawset(ls, -3);
-        switch (typ) {
-        case LUA_TTHREAD: {  // Resume one joiner
-            resume(main, lua_tothread(ls, -1));
-            lua_pop(ls, 1);  // Remove joiners
-            break;
-        }
-        case LUA_TTABLE: {  // Resume multiple joiners
-            lua_pushnil(ls);
-            while (lua_next(ls, -2)) {
-                lua_pop(ls, 1);  // Remove value
-                resume(main, lua_tothread(ls, -1));
-            }
-            lua_pop(ls, 1);  // Remove joiners
-            break;
-        }}
-    }
+    resume_joiners(ls, 1);
 
     // main.THREADS[self] = nil
     push_main_value(ls, lua_upvalueindex(UV_THREADS));
@@ -297,43 +739,11 @@ static int Thread_join_1(lua_State* ls, int status, lua_KContext ctx);
 static int Thread_join_2(lua_State* ls, lua_State* self);
 
 static int Thread_join(lua_State* ls) {
-    // TODO: Remove from joiners list on exit
     lua_State* self = mlua_check_thread(ls, 1);
-    lua_settop(ls, 1);
+    lua_settop(ls, 2);
     if (thread_state(self) == STATE_DEAD) return Thread_join_2(ls, self);
-
-    // Add the running thread to main.JOINERS[self].
-    push_main_value(ls, lua_upvalueindex(UV_JOINERS));
-    lua_pushvalue(ls, 1);
-    switch (lua_rawget(ls, -2)) {  // joiners = main.JOINERS[self]
-    case LUA_TNIL:
-        lua_pop(ls, 1);  // Remove joiners
-        // main.JOINERS[self] = running
-        lua_pushvalue(ls, 1);
-        push_thread(ls, ls);
-        lua_rawset(ls, -3);
-        break;
-    case LUA_TTHREAD:
-        // main.JOINERS[self] = {[running] = true, [joiners] = true}
-        lua_pushvalue(ls, 1);
-        lua_createtable(ls, 0, 2);
-        push_thread(ls, ls);
-        lua_pushboolean(ls, true);
-        lua_rawset(ls, -3);
-        lua_rotate(ls, -3, -1);
-        lua_pushboolean(ls, true);
-        lua_rawset(ls, -3);
-        lua_rawset(ls, -3);
-        break;
-    case LUA_TTABLE:
-        // main.JOINERS[self][running] = true
-        lua_pushvalue(ls, 1);
-        lua_pushboolean(ls, true);
-        lua_rawset(ls, -3);
-        lua_pop(ls, 1);  // Remove joiners
-        break;
-    }
-    lua_settop(ls, 1);
+    if (self == ls) return luaL_error(ls, "thread cannot join itself");
+    add_joiner(ls, 1, 2);
     lua_pushnil(ls);
     return mlua_thread_yield(ls, 1, &Thread_join_1, (lua_KContext)self);
 }
@@ -345,12 +755,127 @@ static int Thread_join_1(lua_State* ls, int status, lua_KContext ctx) {
     return mlua_thread_yield(ls, 1, &Thread_join_1, (lua_KContext)self);
 }
 
+// Return the results of a terminated thread, or raise its error.
 static int Thread_join_2(lua_State* ls, lua_State* self) {
-    // TODO: Return results of thread function to caller
-    if (lua_isnil(self, FP_NEXT - 1)) return 0;
-    lua_pushvalue(self, FP_NEXT - 1);
-    lua_xmove(self, ls, 1);
-    return lua_error(ls);
+    thread_extra(ls)->flags &= ~FLAGS_JOINING;
+    if (!lua_isnil(self, FP_NEXT - 1)) {
+        lua_pushvalue(self, FP_NEXT - 1);
+        lua_xmove(self, ls, 1);
+        return lua_error(ls);
+    }
+    int n = lua_gettop(self) - FP_COUNT - 1;
+    luaL_checkstack(ls, n, "too many results");
+    if (!lua_checkstack(self, n)) return luaL_error(ls, "too many results");
+    for (int i = 1; i <= n; ++i) lua_pushvalue(self, i);
+    lua_xmove(self, ls, n);
+    return n;
+}
+
+static void unselect_sources(lua_State* ls, int n);
+
+// Check if the source at the given index in the sources table is ready. If it
+// isn't, arrange for the running thread to be resumed when it becomes ready,
+// and record what is watched in the stack slot following the sources table:
+// an event, as a light userdata, or the link to the next joiner of a thread.
+// Deadlines update "deadline". Errors stop watching all "n" sources.
+static bool select_source(lua_State* ls, int n, int i, uint64_t* deadline) {
+    int slot = 1 + i;
+    lua_rawgeti(ls, 1, i);
+    if (mlua_is_time(ls, -1)) {
+        bool reached = mlua_time_reached(ls, -1);
+        uint64_t t = mlua_to_time(ls, -1);
+        if (t < *deadline) *deadline = t;
+        lua_pop(ls, 1);
+        return reached;
+    }
+    lua_State* thread = lua_tothread(ls, -1);
+    if (thread != NULL) {
+        if (thread == ls) {
+            unselect_sources(ls, n);
+            return luaL_error(ls, "thread cannot select itself");
+        }
+        if (thread_state(thread) == STATE_DEAD) {
+            lua_pop(ls, 1);
+            return true;
+        }
+        // Join the thread once, through the slot of its first occurrence.
+        if (lua_isnil(ls, slot) && joiner_link(ls, thread) == slot) {
+            add_joiner(ls, -1, slot);
+        }
+        lua_pop(ls, 1);
+        return false;
+    }
+    if (luaL_getmetafield(ls, -1, "__select") == LUA_TNIL) {
+        unselect_sources(ls, n);
+        return luaL_error(ls, "source %d isn't selectable", i);
+    }
+    lua_rotate(ls, -2, 1);
+    if (lua_pcall(ls, 1, 2, 0) != LUA_OK) {
+        unselect_sources(ls, n);
+        return lua_error(ls);
+    }
+    bool ready = lua_toboolean(ls, -2);
+    MLuaEvent const* ev = lua_touserdata(ls, -1);
+    if (ready) {
+        lua_pop(ls, 2);
+        return true;
+    }
+    if (ev == NULL || !mlua_event_enabled(ev)) {
+        unselect_sources(ls, n);
+        return luaL_error(ls, "source %d: event not enabled", i);
+    }
+    mlua_event_watch(ls, ev);
+    lua_replace(ls, slot);
+    lua_pop(ls, 1);
+    return false;
+}
+
+// Stop watching the sources recorded in the stack slots following the sources
+// table.
+static void unselect_sources(lua_State* ls, int n) {
+    for (int slot = 2; slot <= n + 1; ++slot) {
+        switch (lua_type(ls, slot)) {
+        case LUA_TLIGHTUSERDATA:
+            mlua_event_unwatch(ls, lua_touserdata(ls, slot));
+            break;
+        case LUA_TTHREAD:
+        case LUA_TBOOLEAN:
+            lua_rawgeti(ls, 1, slot - 1);
+            remove_joiner(ls, -1, ls);
+            lua_pop(ls, 1);
+            break;
+        }
+    }
+    thread_extra(ls)->flags &= ~FLAGS_JOINING;
+}
+
+static int mod_select_1(lua_State* ls, int status, lua_KContext ctx);
+
+static int mod_select(lua_State* ls) {
+    luaL_checktype(ls, 1, LUA_TTABLE);
+    lua_settop(ls, 1);
+    lua_Unsigned n = lua_rawlen(ls, 1);
+    luaL_argcheck(ls, n > 0, 1, "no sources");
+    luaL_argcheck(ls, n <= INT_MAX - LUA_MINSTACK, 1, "too many sources");
+    luaL_checkstack(ls, n + LUA_MINSTACK, "too many sources");
+    for (lua_Unsigned i = 0; i < n; ++i) lua_pushnil(ls);
+    return mod_select_1(ls, LUA_OK, 0);
+}
+
+static int mod_select_1(lua_State* ls, int status, lua_KContext ctx) {
+    int n = lua_gettop(ls) - 1;
+    uint64_t deadline = MLUA_TICKS_MAX;
+    for (int i = 1; i <= n; ++i) {
+        if (!select_source(ls, n, i, &deadline)) continue;
+        unselect_sources(ls, n);
+        lua_pushinteger(ls, i);
+        lua_rawgeti(ls, 1, i);
+        return 2;
+    }
+    if (deadline == MLUA_TICKS_MAX) {
+        return mlua_thread_suspend(ls, &mod_select_1, 0, 0);
+    }
+    return mlua_thread_suspend_until(ls, &mod_select_1, 0, deadline);
 }
 
 static int mod_running(lua_State* ls) {
@@ -385,21 +910,89 @@ static int mod_blocking(lua_State* ls) {
     return lua_pushboolean(ls, b), 1;
 }
 
+static int mod_precise(lua_State* ls) {
+    bool b = (thread_extra(ls)->flags & FLAGS_PRECISE) != 0;
+    if (!lua_isnoneornil(ls, 1)) {
+        if (lua_toboolean(ls, 1)) {
+            thread_extra(ls)->flags |= FLAGS_PRECISE;
+        } else {
+            thread_extra(ls)->flags &= ~FLAGS_PRECISE;
+        }
+    }
+    return lua_pushboolean(ls, b), 1;
+}
+
+// Push a new thread, or a recycled one from the pool if available.
+static lua_State* new_thread(lua_State* ls, lua_State* main) {
+#if MLUA_THREAD_POOL_SIZE > 0
+    if (luai_likely(ls != main)) {
+        push_main_value(ls, lua_upvalueindex(UV_POOL));
+        lua_Unsigned len = lua_rawlen(ls, -1);
+        if (len > 0) {
+            lua_rawgeti(ls, -1, len);
+            lua_pushnil(ls);
+            lua_rawseti(ls, -3, len);  // POOL[len] = nil
+            lua_remove(ls, -2);  // Remove POOL
+            lua_State* thread = lua_tothread(ls, -1);
+            lua_settop(thread, 0);
+#if MLUA_THREAD_STATS
+            ++mlua_global(ls)->thread_pool_hits;
+#endif
+            return thread;
+        }
+        lua_pop(ls, 1);  // Remove POOL
+    }
+#endif
+#if MLUA_THREAD_STATS
+    ++mlua_global(ls)->thread_pool_misses;
+#endif
+    return lua_newthread(ls);
+}
+
+#if MLUA_THREAD_POOL_SIZE > 0
+
+// Add a terminated thread to the pool if it isn't full. The thread keeps its
+// (nil) termination and NEXT values until it is reused.
+static void recycle_thread(lua_State* main, lua_State* thread) {
+    if (lua_rawlen(main, lua_upvalueindex(UV_POOL)) >= MLUA_THREAD_POOL_SIZE) {
+        return;
+    }
+    // NAMES[thread] = nil
+    push_thread(main, thread);
+    lua_pushnil(main);
+    lua_rawset(main, lua_upvalueindex(UV_NAMES));
+#if MLUA_THREAD_STATS
+    // STATS[thread] = nil
+    push_thread(main, thread);
+    lua_pushnil(main);
+    lua_rawset(main, lua_upvalueindex(UV_STATS));
+#endif
+    // POOL[#POOL + 1] = thread
+    push_thread(main, thread);
+    lua_rawseti(main, lua_upvalueindex(UV_POOL),
+                lua_rawlen(main, lua_upvalueindex(UV_POOL)) + 1);
+}
+
+#endif
+
 static int mod_start(lua_State* ls) {
     luaL_checktype(ls, 1, LUA_TFUNCTION);
     bool has_name = !lua_isnoneornil(ls, 2);
     if (has_name) luaL_checktype(ls, 2, LUA_TSTRING);
+    int priority = check_priority(ls, 3, 0);
+    lua_settop(ls, 2);
 
     // Create the thread.
-    lua_State* thread = lua_newthread(ls);
+    lua_State* main = main_thread(ls);
+    lua_State* thread = new_thread(ls, main);
     ThreadExtra* ext = thread_extra(thread);
     ext->state = STATE_ACTIVE;
-    ext->flags = thread_extra(ls)->flags;
+    ext->flags = thread_extra(ls)->flags & FLAGS_BLOCKING;
+    ext->priority = priority;
     lua_pushvalue(ls, 1);
     lua_xmove(ls, thread, 1);
     lua_pushnil(thread);  // thread.NEXT = nil
 
-    lua_State* main = main_thread(ls);
     if (luai_likely(ls != main)) {
         // Set the name if provided.
         if (has_name) {
@@ -446,13 +1039,13 @@ static int mod_start(lua_State* ls) {
 
     // Add the thread to the active queue.
     // tail = main.TAIL
-    lua_getupvalue(ls, -1, UV_TAIL);
+    lua_getupvalue(ls, -1, UV_TAIL(priority));
     lua_State* tail = lua_tothread(ls, -1);
     lua_pop(ls, 1);
     if (tail == NULL) {
         // main.HEAD = thread
         push_thread(ls, thread);
-        lua_setupvalue(ls, -2, UV_HEAD);
+        lua_setupvalue(ls, -2, UV_HEAD(priority));
     } else {
         // tail.NEXT = thread
         lua_pop(tail, 1);
@@ -460,7 +1053,10 @@ static int mod_start(lua_State* ls) {
     }
     // main.TAIL = thread
     push_thread(ls, thread);
-    lua_setupvalue(ls, -2, UV_TAIL);
+    lua_setupvalue(ls, -2, UV_TAIL(priority));
+#if MLUA_THREAD_STATS
+    ext->ready = mlua_ticks64();
+#endif
     lua_pop(ls, 1);  // Remove main
     return 1;
 }
@@ -476,24 +1072,137 @@ static int mod_shutdown(lua_State* ls) {
     return lua_yield(ls, 2);
 }
 
-static int mod_stats(lua_State* ls) {
 #if MLUA_THREAD_STATS
-    MLuaGlobal* g = mlua_global(ls);
-    lua_pushinteger(ls, g->thread_dispatches);
-    lua_pushinteger(ls, g->thread_waits);
-    lua_pushinteger(ls, g->thread_resumes);
-    return 3;
-#else
-    return 0;
-#endif
+
+// Record the latency between setting an event and resuming its watcher.
+static void record_latency(MLuaGlobal* g, uint32_t latency) {
+    unsigned int bucket = latency < 2 ? 0 : 31 - __builtin_clz(latency);
+    if (bucket >= MLUA_THREAD_LATENCY_BUCKETS) {
+        bucket = MLUA_THREAD_LATENCY_BUCKETS - 1;
+    }
+    ++g->thread_latency[bucket];
+    if (latency > g->thread_latency_max) g->thread_latency_max = latency;
+}
+
+// Return an upper bound of the given percentile of the dispatch latency, from
+// the histogram.
+static uint32_t latency_percentile(MLuaGlobal const* g, uint32_t pct) {
+    lua_Unsigned total = 0;
+    for (int i = 0; i < MLUA_THREAD_LATENCY_BUCKETS; ++i) {
+        total += g->thread_latency[i];
+    }
+    if (total == 0) return 0;
+    lua_Unsigned want = (total * pct + 99) / 100, sum = 0;
+    for (int i = 0; i < MLUA_THREAD_LATENCY_BUCKETS - 1; ++i) {
+        sum += g->thread_latency[i];
+        if (sum < want) continue;
+        uint32_t bound = (2u << i) - 1;
+        return bound < g->thread_latency_max ? bound : g->thread_latency_max;
+    }
+    return g->thread_latency_max;
+}
+
+#endif
+
+static int mod_stats(lua_State* ls) {
+#if MLUA_THREAD_STATS
+    MLuaGlobal* g = mlua_global(ls);
+    lua_pushinteger(ls, g->thread_dispatches);
+    lua_pushinteger(ls, g->thread_waits);
+    lua_pushinteger(ls, g->thread_resumes);
+    lua_pushinteger(ls, g->thread_pool_hits);
+    lua_pushinteger(ls, g->thread_pool_misses);
+    lua_pushinteger(ls, latency_percentile(g, 50));
+    lua_pushinteger(ls, latency_percentile(g, 99));
+    lua_pushinteger(ls, g->thread_latency_max);
+    lua_pushinteger(ls, g->thread_preemptions);
+    lua_pushinteger(ls, g->thread_gc_steps);
+    return 10;
+#else
+    return 0;
+#endif
+}
+
+static int mod_dispatch_stats(lua_State* ls) {
+#if MLUA_THREAD_STATS
+    MLuaGlobal* g = mlua_global(ls);
+    for (int i = 0; i < MLUA_THREAD_BATCH_BUCKETS; ++i) {
+        lua_pushinteger(ls, g->thread_dispatch_batches[i]);
+    }
+    return MLUA_THREAD_BATCH_BUCKETS;
+#else
+    return 0;
+#endif
+}
+
+static int mod_latency_stats(lua_State* ls) {
+#if MLUA_THREAD_STATS
+    MLuaGlobal* g = mlua_global(ls);
+    for (int i = 0; i < MLUA_THREAD_LATENCY_BUCKETS; ++i) {
+        lua_pushinteger(ls, g->thread_latency[i]);
+    }
+    return MLUA_THREAD_LATENCY_BUCKETS;
+#else
+    return 0;
+#endif
+}
+
+static int mod_top(lua_State* ls) {
+#if MLUA_THREAD_STATS
+    lua_settop(ls, 0);
+    push_main_value(ls, lua_upvalueindex(UV_THREADS));
+    push_main_value(ls, lua_upvalueindex(UV_STATS));
+    lua_newtable(ls);
+
+    // Insert a row for each live thread, sorted by decreasing run time.
+    lua_Integer len = 0;
+    lua_pushnil(ls);
+    while (lua_next(ls, 1)) {
+        lua_pop(ls, 1);  // Remove value
+        lua_State* thread = lua_tothread(ls, -1);
+        ThreadStats* stats = thread_stats(ls, 2, thread, false);
+        if (stats == NULL) continue;
+        lua_createtable(ls, 0, 6);
+        lua_pushvalue(ls, -2);
+        lua_setfield(ls, -2, "thread");
+        lua_pushinteger(ls, stats->resumes);
+        lua_setfield(ls, -2, "resumes");
+        lua_pushinteger(ls, stats->run_time);
+        lua_setfield(ls, -2, "run_time");
+        lua_pushinteger(ls, stats->max_slice);
+        lua_setfield(ls, -2, "max_slice");
+        lua_pushinteger(ls, stats->wait_time);
+        lua_setfield(ls, -2, "wait_time");
+        lua_pushinteger(ls, stats->preemptions);
+        lua_setfield(ls, -2, "preemptions");
+        lua_Integer i = len++;
+        for (; i > 0; --i) {
+            lua_geti(ls, 3, i);
+            lua_getfield(ls, -1, "run_time");
+            lua_Integer run_time = lua_tointeger(ls, -1);
+            lua_pop(ls, 1);
+            if ((uint64_t)run_time >= stats->run_time) {
+                lua_pop(ls, 1);
+                break;
+            }
+            lua_seti(ls, 3, i + 1);
+        }
+        lua_seti(ls, 3, i + 1);
+    }
+    return 1;
+#else
+    return 0;
+#endif
 }
 
 static void reset_main_state(lua_State* ls, int arg) {
-    for (int i = UV_HEAD; i <= UV_TIMERS; ++i) {
+    for (int i = UV_QUEUES; i <= UV_COUNT; ++i) {
         lua_pushnil(ls);
         lua_setupvalue(ls, arg, i);
     }
     lua_createtable(ls, 0, 0);
+    lua_setupvalue(ls, arg, UV_TIMERS);
+    lua_createtable(ls, 0, 0);
     lua_setupvalue(ls, arg, UV_THREADS);
     lua_createtable(ls, 0, 0);
     luaL_setmetatable(ls, mlua_WeakK_name);
@@ -501,6 +1210,15 @@ static void reset_main_state(lua_State* ls, int arg) {
     lua_createtable(ls, 0, 0);
     luaL_setmetatable(ls, mlua_WeakK_name);
     lua_setupvalue(ls, arg, UV_NAMES);
+#if MLUA_THREAD_STATS
+    lua_createtable(ls, 0, 0);
+    luaL_setmetatable(ls, mlua_WeakK_name);
+    lua_setupvalue(ls, arg, UV_STATS);
+#endif
+#if MLUA_THREAD_POOL_SIZE > 0
+    lua_createtable(ls, MLUA_THREAD_POOL_SIZE, 0);
+    lua_setupvalue(ls, arg, UV_POOL);
+#endif
 }
 
 static int main_done(lua_State* ls) {
@@ -521,6 +1239,73 @@ static int main_done(lua_State* ls) {
     return 0;
 }
 
+#if MLUA_THREAD_PREEMPT
+
+// Force the running thread to yield if it has exceeded its time slice. The
+// hook is inherited by coroutines created by the thread, so it only yields the
+// thread resumed by main(), and only at yieldable points.
+static void slice_hook(lua_State* ls, lua_Debug* ar) {
+    MLuaGlobal* g = mlua_global(ls);
+    if (ls != g->thread_running || g->thread_slice == 0) return;
+    if (!mlua_ticks64_reached(g->thread_slice_end)) return;
+    if (!lua_isyieldable(ls)) return;
+    thread_extra(ls)->flags |= FLAGS_PREEMPTED;
+    lua_yield(ls, 0);
+}
+
+// Start the time slice of a thread that is about to be resumed. The slice hook
+// is only installed if the thread doesn't have another hook, so that it doesn't
+// interfere with debug hooks and the profiler.
+static void start_slice(lua_State* ls, lua_State* thread) {
+    MLuaGlobal* g = mlua_global(ls);
+    g->thread_running = thread;
+    lua_Hook hook = lua_gethook(thread);
+    if (g->thread_slice == 0) {
+        if (hook == &slice_hook) lua_sethook(thread, NULL, 0, 0);
+        return;
+    }
+    g->thread_slice_end = mlua_ticks64() + g->thread_slice;
+    if (hook == NULL) {
+        lua_sethook(thread, &slice_hook, LUA_MASKCOUNT,
+                    MLUA_THREAD_SLICE_COUNT);
+    }
+}
+
+// End the time slice of a thread, and account for a forced yield.
+static void end_slice(lua_State* ls, lua_State* thread, int res) {
+    MLuaGlobal* g = mlua_global(ls);
+    g->thread_running = NULL;
+    ThreadExtra* ext = thread_extra(thread);
+    if ((ext->flags & FLAGS_PREEMPTED) == 0) return;
+    ext->flags &= ~FLAGS_PREEMPTED;
+#if MLUA_THREAD_STATS
+    if (res == LUA_YIELD) {
+        ++g->thread_preemptions;
+        ThreadStats* stats = thread_stats(ls, lua_upvalueindex(UV_STATS),
+                                          thread, true);
+        ++stats->preemptions;
+    }
+#endif
+}
+
+#endif  // MLUA_THREAD_PREEMPT
+
+static int mod_slice(lua_State* ls) {
+#if MLUA_THREAD_PREEMPT
+    MLuaGlobal* g = mlua_global(ls);
+    lua_pushinteger(ls, g->thread_slice);
+    if (!lua_isnoneornil(ls, 1)) {
+        lua_Integer slice = luaL_checkinteger(ls, 1);
+        luaL_argcheck(ls, 0 <= slice && slice <= UINT32_MAX, 1,
+                      "invalid slice");
+        g->thread_slice = slice;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
 static int mod_main(lua_State* ls) {
     lua_settop(ls, 0);
 
@@ -533,90 +1318,112 @@ static int mod_main(lua_State* ls) {
 
     // Run the main scheduling loop.
     lua_State* running = NULL;
+#if MLUA_THREAD_AGING > 0
+    unsigned int aging = 0;
+#endif
+#if MLUA_THREAD_IDLE_GC
+    bool idle_gc = true;
+#endif
     for (;;) {
+#if MLUA_ALLOC_STATS
+        mlua_check_soft_limit(ls);
+        mlua_tune_gc(ls);
+#endif
+
         // Dispatch events.
         uint64_t deadline = MLUA_TICKS_MAX;
-        lua_State* timers = lua_tothread(ls, lua_upvalueindex(UV_TIMERS));
-        if (running != NULL || !lua_isnil(ls, lua_upvalueindex(UV_TAIL))) {
+        bool precise = false;
+        uint32_t ntimers = timers_len(ls);
+        if (running != NULL || has_active(ls)) {
             deadline = MLUA_TICKS_MIN;
-        } else if (timers != NULL) {
-            deadline = thread_extra(timers)->deadline;
+        } else if (ntimers > 0) {
+            ThreadExtra* ext = thread_extra(timer_at(ls, 1));
+            deadline = ext->deadline;
+            precise = (ext->flags & FLAGS_PRECISE) != 0;
         }
-        mlua_event_dispatch(ls, deadline);
-
-        // Resume threads whose deadline has elapsed.
-        timers = lua_tothread(ls, lua_upvalueindex(UV_TIMERS));
-        lua_State* tail = lua_tothread(ls, lua_upvalueindex(UV_TAIL));
-        uint64_t ticks = mlua_ticks64();
-        if (timers != NULL && thread_extra(timers)->deadline <= ticks) {
-            // Append the timer list to the tail of the active queue, then cut
-            // the combined list at the first thread whose deadline hasn't
-            // elapsed yet.
-            if (tail == NULL) {
-                // HEAD = timers
-                push_thread(ls, timers);
-                lua_replace(ls, lua_upvalueindex(UV_HEAD));
-            } else {
-                replace_next(tail, timers);  // tail.NEXT = timers
-            }
-            for (;;) {
-                tail = timers;
-                thread_extra(tail)->state = STATE_ACTIVE;
-                // timers = tail.NEXT
-                timers = lua_tothread(tail, FP_NEXT);
-                if (timers == NULL || thread_extra(timers)->deadline > ticks) {
-                    // TIMERS = timers
-                    push_thread_or_nil(ls, timers);
-                    lua_replace(ls, lua_upvalueindex(UV_TIMERS));
-                    break;
+#if MLUA_THREAD_IDLE_GC
+        // If no thread is runnable and the next deadline is far enough away,
+        // run a garbage collection step, then only poll for events so that the
+        // deadline is re-evaluated. Steps stop when a collection cycle
+        // completes, until a thread runs again. Precise deadlines are never
+        // delayed by collection steps.
+        if (idle_gc && !precise && deadline != MLUA_TICKS_MIN
+                && lua_gc(ls, LUA_GCISRUNNING)) {
+            uint64_t ticks = mlua_ticks64();
+            if (deadline > ticks
+                    && deadline - ticks >= MLUA_THREAD_IDLE_GC_WINDOW) {
+#if MLUA_THREAD_STATS
+                ++mlua_global(ls)->thread_gc_steps;
+#endif
+                if (lua_gc(ls, LUA_GCSTEP, MLUA_THREAD_IDLE_GC_STEP)) {
+                    idle_gc = false;
                 }
+                deadline = MLUA_TICKS_MIN;
             }
-            // TAIL = tail
-            push_thread(ls, tail);
-            lua_replace(ls, lua_upvalueindex(UV_TAIL));
-            // tail.NEXT = nil
-            lua_pop(tail, 1);
-            lua_pushnil(tail);
+        }
+#endif
+        mlua_event_dispatch(ls, deadline, precise);
+
+        // Move threads whose deadline has elapsed to the tail of their active
+        // queue, in heap order.
+        ntimers = timers_len(ls);
+        if (ntimers > 0) {
+            uint64_t ticks = mlua_ticks64();
+            do {
+                lua_State* timer = timer_at(ls, 1);
+                ThreadExtra* ext = thread_extra(timer);
+                if (ext->deadline > ticks) break;
+#if MLUA_THREAD_STATS
+                if (ext->flags & FLAGS_PRECISE) {
+                    record_wakeup(ls, timer, ticks - ext->deadline);
+                }
+#endif
+                remove_timer(ls, timer);
+                thread_extra(timer)->state = STATE_ACTIVE;
+                activate(ls, timer);
+            } while (--ntimers > 0);
         }
 
         // If the previous running thread is still active, move it to the end of
-        // the active queue, after threads resumed by events or timers. Then get
-        // the thread at the head of the active queue, skipping dead ones.
-        if (tail != NULL) {
-            if (running != NULL) {
-                replace_next(tail, running);  // tail.NEXT = running
-                // TAIL = tail = running;
-                tail = running;
-                push_thread(ls, tail);
-                lua_replace(ls, lua_upvalueindex(UV_TAIL));
-            }
-            // head = HEAD
-            lua_State* head = lua_tothread(ls, lua_upvalueindex(UV_HEAD));
-            for (;;) {
-                running = head;
-                head = lua_tothread(head, FP_NEXT);
+        // its active queue, after threads resumed by events or timers. Then get
+        // the thread at the head of the highest-priority non-empty active
+        // queue, skipping dead ones.
+        if (running != NULL) activate(ls, running);
+        running = NULL;
+        int priority = MLUA_THREAD_PRIORITIES - 1;
+        for (; priority >= 0; --priority) {
+            while ((running = pop_active(ls, priority)) != NULL) {
                 if (thread_state(running) != STATE_DEAD) break;
-                // running.NEXT = nil
-                lua_pop(running, 1);
-                lua_pushnil(running);
-                if (head == NULL) {
-                    running = NULL;
+            }
+            if (running != NULL) break;
+        }
+        if (running == NULL) continue;
+#if MLUA_THREAD_IDLE_GC
+        idle_gc = true;
+#endif
+
+#if MLUA_THREAD_AGING > 0
+        // Promote the heads of the lower-priority active queues if they have
+        // been waiting for too long.
+        if (priority > 0) {
+            bool waiting = false;
+            for (int p = priority - 1; p >= 0; --p) {
+                if (!lua_isnil(ls, lua_upvalueindex(UV_HEAD(p)))) {
+                    waiting = true;
                     break;
                 }
             }
-            if (head == NULL) {
-                // HEAD = TAIL = nil
-                lua_pushnil(ls);
-                lua_replace(ls, lua_upvalueindex(UV_HEAD));
-                lua_pushnil(ls);
-                lua_replace(ls, lua_upvalueindex(UV_TAIL));
-            } else {
-                // HEAD = head
-                push_thread(ls, head);
-                lua_replace(ls, lua_upvalueindex(UV_HEAD));
+            if (!waiting) {
+                aging = 0;
+            } else if (++aging >= MLUA_THREAD_AGING) {
+                aging = 0;
+                for (int p = priority - 1; p >= 0; --p) {
+                    lua_State* head = pop_active(ls, p);
+                    if (head != NULL) push_active(ls, p + 1, head);
+                }
             }
         }
-        if (running == NULL) continue;
+#endif
 
         // Resume the selected thread.
 #if MLUA_THREAD_STATS
@@ -624,40 +1431,88 @@ static int mod_main(lua_State* ls) {
 #endif
         lua_pop(running, FP_COUNT);
         int nres;
-        if (lua_resume(running, ls, 0, &nres) != LUA_YIELD) {
-            // Close the Lua thread and store the termination below NEXT.
-            if (lua_closethread(running, ls) == LUA_OK) lua_pushnil(running);
+#if MLUA_ALLOC_PROFILE
+        mlua_global(ls)->alloc_running = running;
+#endif
+#if MLUA_PROFILE
+        mlua_global(ls)->profile_running = running;
+        if (mlua_global(ls)->profile_switch != NULL) {
+            mlua_global(ls)->profile_switch(running, true);
+        }
+#endif
+        mlua_trace(MLUA_TRACE_RESUME, (uintptr_t)running);
+#if MLUA_THREAD_PREEMPT
+        start_slice(ls, running);
+#endif
+#if MLUA_THREAD_STATS
+        ThreadStats* stats = thread_stats(ls, lua_upvalueindex(UV_STATS),
+                                          running, true);
+        uint64_t start = mlua_ticks64();
+        ThreadExtra* ext = thread_extra(running);
+        stats->wait_time += start - ext->ready;
+        if ((ext->flags & FLAGS_EVENT) != 0) {
+            ext->flags &= ~FLAGS_EVENT;
+            record_latency(mlua_global(ls), (uint32_t)start - ext->event_time);
+        }
+        ++stats->resumes;
+        int res = lua_resume(running, ls, 0, &nres);
+        uint64_t slice = mlua_ticks64() - start;
+        stats->run_time += slice;
+        if (slice > stats->max_slice) {
+            stats->max_slice = slice < UINT32_MAX ? slice : UINT32_MAX;
+        }
+#else
+        int res = lua_resume(running, ls, 0, &nres);
+#endif
+        mlua_trace(MLUA_TRACE_SUSPEND, (uintptr_t)running);
+#if MLUA_THREAD_PREEMPT
+        end_slice(ls, running, res);
+#endif
+#if MLUA_ALLOC_PROFILE
+        mlua_global(ls)->alloc_running = ls;
+#endif
+#if MLUA_PROFILE
+        if (mlua_global(ls)->profile_switch != NULL) {
+            mlua_global(ls)->profile_switch(running, false);
+        }
+        mlua_global(ls)->profile_running = NULL;
+#endif
+        if (res != LUA_YIELD) {
+            // Close the Lua thread and store the termination below NEXT. The
+            // results of the thread function are kept at the bottom of the
+            // stack, for Thread:join().
+            if (res != LUA_OK || !lua_checkstack(ls, nres)) nres = 0;
+            lua_xmove(running, ls, nres);
+            bool ok = lua_closethread(running, ls) == LUA_OK;
+            if (ok && lua_checkstack(running, nres + FP_COUNT + 1)) {
+                lua_xmove(ls, running, nres);
+            } else {
+                lua_pop(ls, nres);
+                nres = 0;
+            }
+            if (ok) lua_pushnil(running);
             thread_extra(running)->state = STATE_DEAD;
             lua_pushnil(running);  // running.NEXT = nil
 
             // Resume joiners.
-            // joiners = JOINERS[running]
             push_thread(ls, running);
-            int typ = lua_rawget(ls, lua_upvalueindex(UV_JOINERS));
-            if (typ != LUA_TNIL) {
-                // JOINERS[running] = nil
-                push_thread(ls, running);
-                lua_pushnil(ls);
-                lua_rawset(ls, lua_upvalueindex(UV_JOINERS));
-                switch (typ) {
-                case LUA_TTHREAD: {  // Resume one joiner
-                    resume(ls, lua_tothread(ls, -1));
-                    break;
-                }
-                case LUA_TTABLE: {  // Resume multiple joiners
-                    lua_pushnil(ls);
-                    while (lua_next(ls, -2)) {
-                        lua_pop(ls, 1);  // Remove value
-                        resume(ls, lua_tothread(ls, -1));
-                    }
-                    break;
-                }}
-            }
-            lua_pop(ls, 1);  // Remove joiners
+            bool joined = resume_joiners(ls, -1);
+            lua_pop(ls, 1);
             // THREADS[running] = nil
             push_thread(ls, running);
             lua_pushnil(ls);
             lua_rawset(ls, lua_upvalueindex(UV_THREADS));
+#if MLUA_THREAD_POOL_SIZE > 0
+            // Recycle the thread if it was detached, terminated successfully
+            // without results, and nobody was waiting for it. Other threads
+            // may still be referenced, so they cannot be reused.
+            if (ok && nres == 0 && !joined
+                    && (thread_extra(running)->flags & FLAGS_DETACHED)) {
+                recycle_thread(ls, running);
+            }
+#else
+            (void)ok, (void)joined;
+#endif
             running = NULL;
             continue;
         }
@@ -681,48 +1536,473 @@ static int mod_main(lua_State* ls) {
         }
 
         // Suspend running.
-        if (lua_isnil(running, -1)) {
+        ThreadExtra* extra = thread_extra(running);
+        if (extra->flags & FLAGS_DEADLINE_SET) {
+            // The deadline was set by mlua_thread_suspend_until().
+            extra->flags &= ~FLAGS_DEADLINE_SET;
+        } else if (lua_isnil(running, -1)) {
             // Suspend indefinitely.
             lua_pop(running, 1);  // Remove deadline
-            thread_extra(running)->state = STATE_SUSPENDED;
+            extra->state = STATE_SUSPENDED;
             lua_pushnil(running);  // running.NEXT = nil
             running = NULL;
             continue;
+        } else {
+            extra->deadline = mlua_to_time(running, -1);
         }
 
-        // Add running to the timer list.
-        deadline = mlua_to_time(running, -1);
-        lua_pop(running, 1);  // Remove deadline
-        ThreadExtra* extra = thread_extra(running);
-        extra->deadline = deadline;
+        // Add running to the timer heap.
         extra->state = STATE_TIMER;
-        timers = lua_tothread(ls, lua_upvalueindex(UV_TIMERS));
-        if (timers == NULL || deadline < thread_extra(timers)->deadline) {
-            push_thread_or_nil(running, timers);  // running.NEXT = timers
-            // TIMERS = running
-            push_thread(ls, running);
-            lua_replace(ls, lua_upvalueindex(UV_TIMERS));
-            running = NULL;
-            continue;
+        lua_pop(running, 1);  // Remove deadline
+        lua_pushnil(running);  // running.NEXT = nil
+        add_timer(ls, running);
+        running = NULL;
+    }
+}
+
+static char const Channel_name[] = "mlua.Channel";
+
+// A FIFO queue of waiting threads, stored in a ring at keys [1, cap] of a
+// table. The ring is grown when it is full, but never shrunk, so that the table
+// doesn't need to be rehashed on every wait.
+typedef struct WaitQueue {
+    uint32_t cap;
+    uint32_t head;      // The ring index of the oldest waiter
+    uint32_t len;       // The number of entries in the ring
+} WaitQueue;
+
+// The initial capacity of wait queues.
+#define WAIT_QUEUE_MIN_CAP 4
+
+// A bounded FIFO channel between threads. The values are stored in a ring in
+// the first user value, preallocated to the capacity of the channel. Threads
+// blocked in send() and recv() are queued in the second and third user values.
+typedef struct Channel {
+    uint32_t cap;
+    uint32_t head;      // The ring index of the oldest value
+    uint32_t len;       // The number of values in the ring
+    WaitQueue senders;
+    WaitQueue receivers;
+} Channel;
+
+// User value indexes for channels.
+typedef enum ChannelUserValueIndex {
+    CUV_VALUES = 1,
+    CUV_SENDERS,
+    CUV_RECEIVERS,
+    CUV_COUNT = CUV_RECEIVERS,
+} ChannelUserValueIndex;
+
+static inline Channel* check_channel(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Channel_name);
+}
+
+// Append the running thread to a wait queue, stored in user value "uv" of the
+// userdata at index "arg".
+static void add_waiter(lua_State* ls, int arg, int uv, WaitQueue* q) {
+    lua_getiuservalue(ls, arg, uv);
+    if (q->len == q->cap) {
+        // Move the entries to a larger ring.
+        uint32_t cap = q->cap > 0 ? 2 * q->cap : WAIT_QUEUE_MIN_CAP;
+        lua_createtable(ls, cap, 0);
+        for (uint32_t i = 0; i < q->len; ++i) {
+            lua_rawgeti(ls, -2, (q->head + i) % q->cap + 1);
+            lua_rawseti(ls, -2, i + 1);
         }
-        for (;;) {
-            // next = timers.NEXT
-            lua_State* next = lua_tothread(timers, FP_NEXT);
-            if (next == NULL || deadline < thread_extra(next)->deadline) {
-                push_thread_or_nil(running, next);  // running.NEXT = next
-                replace_next(timers, running);  // timers.NEXT = running
-                break;
-            }
-            timers = next;
+        lua_pushvalue(ls, -1);
+        lua_setiuservalue(ls, arg, uv);
+        lua_remove(ls, -2);
+        q->cap = cap;
+        q->head = 0;
+    }
+    lua_pushthread(ls);
+    lua_rawseti(ls, -2, (q->head + q->len) % q->cap + 1);
+    ++q->len;
+    lua_pop(ls, 1);
+}
+
+// Remove a thread from a wait queue, if it is still queued. Returns true iff
+// the thread was found. Trailing removed entries are dropped, so that the queue
+// becomes empty when its last waiter leaves.
+static bool remove_thread(lua_State* ls, int arg, int uv, WaitQueue* q,
+                          lua_State* thread) {
+    if (q->len == 0) return false;
+    lua_getiuservalue(ls, arg, uv);
+    bool found = false;
+    for (uint32_t i = 0; i < q->len; ++i) {
+        uint32_t key = (q->head + i) % q->cap + 1;
+        if (lua_rawgeti(ls, -1, key) == LUA_TTHREAD
+                && lua_tothread(ls, -1) == thread) {
+            lua_pop(ls, 1);
+            lua_pushboolean(ls, false);
+            lua_rawseti(ls, -2, key);
+            found = true;
+            break;
         }
-        running = NULL;
+        lua_pop(ls, 1);
+    }
+    while (q->len != 0) {
+        uint32_t key = (q->head + q->len - 1) % q->cap + 1;
+        bool removed = lua_rawgeti(ls, -1, key) == LUA_TBOOLEAN;
+        lua_pop(ls, 1);
+        if (!removed) break;
+        lua_pushnil(ls);
+        lua_rawseti(ls, -2, key);
+        --q->len;
+    }
+    if (q->len == 0) q->head = 0;
+    lua_pop(ls, 1);
+    return found;
+}
+
+// Remove the running thread from a wait queue, if it is still queued. Returns
+// true iff the thread was found.
+static inline bool remove_waiter(lua_State* ls, int arg, int uv, WaitQueue* q) {
+    return remove_thread(ls, arg, uv, q, ls);
+}
+
+// Resume the first thread of a wait queue that is still waiting, or all of them
+// if "all" is true. Returns the number of resumed threads.
+static uint32_t wake_waiters(lua_State* ls, int arg, int uv, WaitQueue* q,
+                             bool all) {
+    if (q->len == 0) return 0;
+    lua_State* main = main_thread(ls);
+    lua_getiuservalue(ls, arg, uv);
+    uint32_t cnt = 0;
+    while (q->len != 0) {
+        int typ = lua_rawgeti(ls, -1, q->head + 1);
+        lua_pushnil(ls);
+        lua_rawseti(ls, -3, q->head + 1);
+        q->head = (q->head + 1) % q->cap;
+        --q->len;
+        bool resumed = typ == LUA_TTHREAD && resume(main, lua_tothread(ls, -1));
+        lua_pop(ls, 1);
+        if (!resumed) continue;
+        ++cnt;
+        if (!all) break;
+    }
+    if (q->len == 0) q->head = 0;
+    lua_pop(ls, 1);
+    return cnt;
+}
+
+static inline void wake_waiter(lua_State* ls, int uv, WaitQueue* q) {
+    wake_waiters(ls, 1, uv, q, false);
+}
+
+static int Channel___new(lua_State* ls) {
+    lua_Integer cap = luaL_checkinteger(ls, 2);
+    luaL_argcheck(ls, 0 < cap && cap <= INT_MAX, 2, "invalid capacity");
+    Channel* ch = lua_newuserdatauv(ls, sizeof(Channel), CUV_COUNT);
+    *ch = (Channel){.cap = cap};
+    luaL_getmetatable(ls, Channel_name);
+    lua_setmetatable(ls, -2);
+    lua_createtable(ls, cap, 0);
+    lua_setiuservalue(ls, -2, CUV_VALUES);
+    lua_createtable(ls, 0, 0);
+    lua_setiuservalue(ls, -2, CUV_SENDERS);
+    lua_createtable(ls, 0, 0);
+    lua_setiuservalue(ls, -2, CUV_RECEIVERS);
+    return 1;
+}
+
+// Append the value at the given index to the ring, and wake up a receiver.
+static void push_value(lua_State* ls, Channel* ch, int arg) {
+    lua_getiuservalue(ls, 1, CUV_VALUES);
+    lua_pushvalue(ls, arg);
+    lua_rawseti(ls, -2, (ch->head + ch->len) % ch->cap + 1);
+    lua_pop(ls, 1);
+    ++ch->len;
+    wake_waiter(ls, CUV_RECEIVERS, &ch->receivers);
+}
+
+// Push the oldest value from the ring, and wake up a sender.
+static void pop_value(lua_State* ls, Channel* ch) {
+    lua_getiuservalue(ls, 1, CUV_VALUES);
+    lua_rawgeti(ls, -1, ch->head + 1);
+    lua_pushnil(ls);
+    lua_rawseti(ls, -3, ch->head + 1);
+    lua_remove(ls, -2);
+    ch->head = (ch->head + 1) % ch->cap;
+    --ch->len;
+    wake_waiter(ls, CUV_SENDERS, &ch->senders);
+}
+
+// Check the optional deadline argument of a blocking operation, and return its
+// index, or zero if there is no deadline.
+static int check_deadline(lua_State* ls, int arg) {
+    if (lua_isnoneornil(ls, arg)) return 0;
+    luaL_argexpected(ls, mlua_is_time(ls, arg), arg, "integer or Int64");
+    return arg;
+}
+
+static int Channel_try_send(lua_State* ls) {
+    Channel* ch = check_channel(ls, 1);
+    luaL_argcheck(ls, !lua_isnoneornil(ls, 2), 2, "value expected");
+    if (ch->len == ch->cap) return lua_pushboolean(ls, false), 1;
+    push_value(ls, ch, 2);
+    return lua_pushboolean(ls, true), 1;
+}
+
+static int Channel_send_1(lua_State* ls, int status, lua_KContext ctx);
+static int Channel_send_2(lua_State* ls, Channel* ch, int index);
+
+static int Channel_send(lua_State* ls) {
+    Channel* ch = check_channel(ls, 1);
+    luaL_argcheck(ls, !lua_isnoneornil(ls, 2), 2, "value expected");
+    lua_settop(ls, 3);
+    return Channel_send_2(ls, ch, check_deadline(ls, 3));
+}
+
+static int Channel_send_1(lua_State* ls, int status, lua_KContext ctx) {
+    Channel* ch = lua_touserdata(ls, 1);
+    remove_waiter(ls, 1, CUV_SENDERS, &ch->senders);
+    return Channel_send_2(ls, ch, ctx);
+}
+
+static int Channel_send_2(lua_State* ls, Channel* ch, int index) {
+    if (ch->len < ch->cap) {
+        push_value(ls, ch, 2);
+        return lua_pushboolean(ls, true), 1;
+    }
+    if (index != 0 && mlua_time_reached(ls, index)) {
+        return lua_pushboolean(ls, false), 1;
+    }
+    add_waiter(ls, 1, CUV_SENDERS, &ch->senders);
+    return mlua_thread_suspend(ls, &Channel_send_1, index, index);
+}
+
+static int Channel_try_recv(lua_State* ls) {
+    Channel* ch = check_channel(ls, 1);
+    if (ch->len == 0) return 0;
+    return pop_value(ls, ch), 1;
+}
+
+static int Channel_recv_1(lua_State* ls, int status, lua_KContext ctx);
+static int Channel_recv_2(lua_State* ls, Channel* ch, int index);
+
+static int Channel_recv(lua_State* ls) {
+    Channel* ch = check_channel(ls, 1);
+    lua_settop(ls, 2);
+    return Channel_recv_2(ls, ch, check_deadline(ls, 2));
+}
+
+static int Channel_recv_1(lua_State* ls, int status, lua_KContext ctx) {
+    Channel* ch = lua_touserdata(ls, 1);
+    remove_waiter(ls, 1, CUV_RECEIVERS, &ch->receivers);
+    return Channel_recv_2(ls, ch, ctx);
+}
+
+static int Channel_recv_2(lua_State* ls, Channel* ch, int index) {
+    if (ch->len > 0) return pop_value(ls, ch), 1;
+    if (index != 0 && mlua_time_reached(ls, index)) return 0;
+    add_waiter(ls, 1, CUV_RECEIVERS, &ch->receivers);
+    return mlua_thread_suspend(ls, &Channel_recv_1, index, index);
+}
+
+static int Channel___len(lua_State* ls) {
+    Channel* ch = check_channel(ls, 1);
+    return lua_pushinteger(ls, ch->len), 1;
+}
+
+static int Channel_capacity(lua_State* ls) {
+    Channel* ch = check_channel(ls, 1);
+    return lua_pushinteger(ls, ch->cap), 1;
+}
+
+MLUA_SYMBOLS(Channel_syms) = {
+    MLUA_SYM_F(capacity, Channel_),
+    MLUA_SYM_F(send, Channel_),
+    MLUA_SYM_F(try_send, Channel_),
+    MLUA_SYM_F(recv, Channel_),
+    MLUA_SYM_F(try_recv, Channel_),
+};
+
+MLUA_SYMBOLS_NOHASH(Channel_syms_nh) = {
+    MLUA_SYM_F_NH(__new, Channel_),
+    MLUA_SYM_F_NH(__len, Channel_),
+};
+
+static char const Condition_name[] = "mlua.Condition";
+
+// Pending notifications of a condition variable, set from C and IRQ context.
+typedef enum NotifyMode {
+    NOTIFY_NONE,
+    NOTIFY_ONE,
+    NOTIFY_ALL,
+} NotifyMode;
+
+// A condition variable. Waiting threads are queued in the first user value.
+// While threads are waiting, the condition itself is the watcher of its event,
+// so that notifications from C and IRQ context are delivered when the event is
+// dispatched.
+struct MLuaCondition {
+    MLuaEvent event;
+    uint8_t notify;     // The pending NotifyMode, protected by the event lock
+    WaitQueue waiters;
+};
+
+// User value indexes for condition variables.
+typedef enum ConditionUserValueIndex {
+    DUV_WAITERS = 1,
+    DUV_COUNT = DUV_WAITERS,
+} ConditionUserValueIndex;
+
+static void watch_event_from(lua_State* ls, MLuaEvent const* ev, int arg);
+static void unwatch_event(lua_State* ls, MLuaEvent const* ev);
+
+MLuaCondition* mlua_check_condition(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Condition_name);
+}
+
+MLuaCondition* mlua_condition_new(lua_State* ls) {
+    MLuaCondition* cond = lua_newuserdatauv(ls, sizeof(MLuaCondition),
+                                            DUV_COUNT);
+    *cond = (MLuaCondition){.notify = NOTIFY_NONE};
+    luaL_getmetatable(ls, Condition_name);
+    lua_setmetatable(ls, -2);
+    lua_createtable(ls, 0, 0);
+    lua_setiuservalue(ls, -2, DUV_WAITERS);
+    mlua_event_enable(ls, &cond->event);
+    return cond;
+}
+
+void mlua_condition_notify(MLuaCondition* cond, bool all) {
+    mlua_event_lock();
+    if (all) {
+        cond->notify = NOTIFY_ALL;
+    } else if (cond->notify == NOTIFY_NONE) {
+        cond->notify = NOTIFY_ONE;
+    }
+    mlua_event_set_nolock(&cond->event);
+    mlua_event_unlock();
+}
+
+// Make the condition at the given index the watcher of its event while threads
+// are waiting, and release the watcher slot otherwise.
+static void update_condition_watch(lua_State* ls, int arg,
+                                   MLuaCondition* cond) {
+    if (cond->waiters.len == 0) {
+        unwatch_event(ls, &cond->event);
+    } else {
+        watch_event_from(ls, &cond->event, arg);
+    }
+}
+
+// Resume threads waiting on a condition, and return the number of resumed
+// threads.
+static uint32_t notify_condition(lua_State* ls, int arg, MLuaCondition* cond,
+                                 bool all) {
+    uint32_t cnt = wake_waiters(ls, arg, DUV_WAITERS, &cond->waiters, all);
+    update_condition_watch(ls, arg, cond);
+    return cnt;
+}
+
+// Deliver the pending notifications of the condition at the given index. Must
+// be called from main(). Returns true iff at least one thread was resumed.
+static bool deliver_notifications(lua_State* ls, int arg) {
+    MLuaCondition* cond = lua_touserdata(ls, arg);
+    mlua_event_lock();
+    NotifyMode mode = cond->notify;
+    cond->notify = NOTIFY_NONE;
+    mlua_event_unlock();
+    if (mode == NOTIFY_NONE) return false;
+    return notify_condition(ls, arg, cond, mode == NOTIFY_ALL) > 0;
+}
+
+static int Condition___new(lua_State* ls) {
+    mlua_condition_new(ls);
+    return 1;
+}
+
+static int Condition___gc(lua_State* ls) {
+    MLuaCondition* cond = mlua_check_condition(ls, 1);
+    mlua_event_disable(ls, &cond->event);
+    return 0;
+}
+
+static int Condition_wait_1(lua_State* ls, int status, lua_KContext ctx);
+static int Condition_wait_2(lua_State* ls, MLuaCondition* cond, int index);
+
+static int Condition_wait(lua_State* ls) {
+    MLuaCondition* cond = mlua_check_condition(ls, 1);
+    lua_settop(ls, 2);
+    int index = check_deadline(ls, 2);
+    if (index != 0 && mlua_time_reached(ls, index)) {
+        return lua_pushboolean(ls, false), 1;
     }
+    if (cond->waiters.len == 0) {
+        // Drop notifications from C that nobody was waiting for.
+        mlua_event_lock();
+        cond->notify = NOTIFY_NONE;
+        mlua_event_unlock();
+    }
+    return Condition_wait_2(ls, cond, index);
 }
 
+static int Condition_wait_1(lua_State* ls, int status, lua_KContext ctx) {
+    MLuaCondition* cond = lua_touserdata(ls, 1);
+    thread_extra(ls)->flags &= ~FLAGS_WAITING;
+    bool waiting = remove_waiter(ls, 1, DUV_WAITERS, &cond->waiters);
+    update_condition_watch(ls, 1, cond);
+    if (!waiting) return lua_pushboolean(ls, true), 1;
+    if (ctx != 0 && mlua_time_reached(ls, ctx)) {
+        return lua_pushboolean(ls, false), 1;
+    }
+    return Condition_wait_2(ls, cond, ctx);
+}
+
+static int Condition_wait_2(lua_State* ls, MLuaCondition* cond, int index) {
+    add_waiter(ls, 1, DUV_WAITERS, &cond->waiters);
+    thread_extra(ls)->flags |= FLAGS_WAITING;
+    update_condition_watch(ls, 1, cond);
+    return mlua_thread_suspend(ls, &Condition_wait_1, index, index);
+}
+
+// Remove a thread that is about to be killed from the wait queue of the
+// condition variable it is waiting on.
+static void unlink_waiter(lua_State* ls, lua_State* waiter) {
+    ThreadExtra* ext = thread_extra(waiter);
+    if ((ext->flags & FLAGS_WAITING) == 0) return;
+    ext->flags &= ~FLAGS_WAITING;
+    lua_pushvalue(waiter, 1);  // Condition:wait()
+    lua_xmove(waiter, ls, 1);
+    int arg = lua_gettop(ls);
+    MLuaCondition* cond = lua_touserdata(ls, arg);
+    remove_thread(ls, arg, DUV_WAITERS, &cond->waiters, waiter);
+    update_condition_watch(ls, arg, cond);
+    lua_pop(ls, 1);
+}
+
+static int Condition_notify(lua_State* ls) {
+    MLuaCondition* cond = mlua_check_condition(ls, 1);
+    return lua_pushinteger(ls, notify_condition(ls, 1, cond, false)), 1;
+}
+
+static int Condition_notify_all(lua_State* ls) {
+    MLuaCondition* cond = mlua_check_condition(ls, 1);
+    return lua_pushinteger(ls, notify_condition(ls, 1, cond, true)), 1;
+}
+
+MLUA_SYMBOLS(Condition_syms) = {
+    MLUA_SYM_F(wait, Condition_),
+    MLUA_SYM_F(notify, Condition_),
+    MLUA_SYM_F(notify_all, Condition_),
+};
+
+MLUA_SYMBOLS_NOHASH(Condition_syms_nh) = {
+    MLUA_SYM_F_NH(__new, Condition_),
+    MLUA_SYM_F_NH(__gc, Condition_),
+};
+
 MLUA_SYMBOLS(Thread_syms) = {
     MLUA_SYM_F(name, Thread_),
     MLUA_SYM_F(is_alive, Thread_),
     MLUA_SYM_F(is_waiting, Thread_),
+    MLUA_SYM_F(priority, Thread_),
+    MLUA_SYM_F(set_priority, Thread_),
+    MLUA_SYM_F(stats, Thread_),
+    MLUA_SYM_F(detach, Thread_),
 };
 
 #define Thread___close Thread_join
@@ -737,17 +2017,29 @@ MLUA_SYMBOLS_NOHASH(Thread_syms_nh) = {
 };
 
 MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_V(PRIORITIES, integer, MLUA_THREAD_PRIORITIES),
+    MLUA_SYM_V(POOL_SIZE, integer, MLUA_THREAD_POOL_SIZE),
+    MLUA_SYM_V(IDLE_GC, boolean, MLUA_THREAD_IDLE_GC),
     MLUA_SYM_F(running, mod_),
     MLUA_SYM_F(yield, mod_),
     MLUA_SYM_F(suspend, mod_),
+    MLUA_SYM_F(select, mod_),
     MLUA_SYM_F(blocking, mod_),
+    MLUA_SYM_F(precise, mod_),
     MLUA_SYM_F(start, mod_),
     MLUA_SYM_F(shutdown, mod_),
     MLUA_SYM_F(stats, mod_),
+    MLUA_SYM_F(top, mod_),
+    MLUA_SYM_F(dispatch_stats, mod_),
+    MLUA_SYM_F(latency_stats, mod_),
+    MLUA_SYM_F(slice, mod_),
 };
 
 MLUA_OPEN_MODULE(mlua.thread) {
     mlua_require(ls, "mlua.int64", false);
+#if MLUA_THREAD_PREEMPT
+    mlua_global(ls)->thread_slice = MLUA_THREAD_SLICE;
+#endif
 
     // Create the module.
     mlua_new_module(ls, 0, module_syms);
@@ -758,28 +2050,87 @@ MLUA_OPEN_MODULE(mlua.thread) {
     lua_setmetatable(ls, -2);
     lua_pop(ls, 1);
 
+    // Create the Channel class.
+    mlua_new_class(ls, Channel_name, Channel_syms, Channel_syms_nh);
+    mlua_set_metaclass(ls);
+    lua_setfield(ls, -2, "Channel");
+
+    // Create the Condition class.
+    mlua_new_class(ls, Condition_name, Condition_syms, Condition_syms_nh);
+    mlua_set_metaclass(ls);
+    lua_setfield(ls, -2, "Condition");
+
     // Create the main() closure.
-    for (int i = UV_HEAD; i <= UV_NAMES; ++i) lua_pushnil(ls);
-    lua_pushcclosure(ls, &mod_main, UV_NAMES - UV_HEAD + 1);
+    for (int i = 1; i <= UV_COUNT; ++i) lua_pushnil(ls);
+    lua_pushcclosure(ls, &mod_main, UV_COUNT);
     reset_main_state(ls, lua_absindex(ls, -1));
+
+    // Create the event watcher slots, and make them accessible through the
+    // registry for use outside of main().
+    lua_createtable(ls, 0, 0);
+    lua_pushvalue(ls, -1);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, &watchers_key);
+    lua_setupvalue(ls, -2, UV_WATCHERS);
     lua_setfield(ls, -2, "main");
     return 1;
 }
 
-static void watch_event(lua_State* ls, MLuaEvent const* ev) {
-    lua_pushthread(ls);
-    lua_rawsetp(ls, LUA_REGISTRYINDEX, ev);
+// Push the WATCHERS table. This works from any context, including finalizers.
+static inline void push_watchers(lua_State* ls) {
+    lua_rawgetp(ls, LUA_REGISTRYINDEX, &watchers_key);
 }
 
-static void watch_event_from_thread(lua_State* ls, MLuaEvent const* ev,
-                                    int thread) {
-    lua_pushvalue(ls, thread);
-    lua_rawsetp(ls, LUA_REGISTRYINDEX, ev);
+static inline int* watcher_slot(MLuaEvent const* ev) {
+    return (int*)&ev->watcher;
+}
+
+// Set the watcher of an event to the thread at the top of the stack, and pop
+// it. "wt" is the absolute index of the WATCHERS table.
+static void set_watcher(lua_State* ls, int wt, MLuaEvent const* ev) {
+    int* slot = watcher_slot(ev);
+    if (*slot == 0) {
+        *slot = luaL_ref(ls, wt);
+    } else {
+        lua_rawseti(ls, wt, *slot);
+    }
+}
+
+// Clear the watcher of an event, but keep its slot. The slot is set to false
+// rather than nil, as luaL_ref() relies on the table having no holes.
+static void clear_watcher(lua_State* ls, int wt, MLuaEvent const* ev) {
+    int slot = *watcher_slot(ev);
+    if (slot == 0) return;
+    lua_pushboolean(ls, false);
+    lua_rawseti(ls, wt, slot);
+}
+
+// Push the watcher of an event, or nil if there is none. Returns the type of
+// the pushed value. The watcher is either a thread or a condition variable.
+static int push_watcher(lua_State* ls, int wt, MLuaEvent const* ev) {
+    int slot = *watcher_slot(ev);
+    if (slot != 0) {
+        int typ = lua_rawgeti(ls, wt, slot);
+        if (typ == LUA_TTHREAD || typ == LUA_TUSERDATA) return typ;
+        lua_pop(ls, 1);
+    }
+    lua_pushnil(ls);
+    return LUA_TNIL;
+}
+
+// Set the watcher of an event to the value at the given index.
+static void watch_event_from(lua_State* ls, MLuaEvent const* ev, int arg) {
+    arg = lua_absindex(ls, arg);
+    push_watchers(ls);
+    lua_pushvalue(ls, arg);
+    set_watcher(ls, lua_absindex(ls, -2), ev);
+    lua_pop(ls, 1);  // Remove WATCHERS
 }
 
 static void unwatch_event(lua_State* ls, MLuaEvent const* ev) {
     if (!mlua_event_enabled(ev)) return;
-    mlua_event_remove_watcher(ls, ev);
+    push_watchers(ls);
+    clear_watcher(ls, lua_absindex(ls, -1), ev);
+    lua_pop(ls, 1);  // Remove WATCHERS
 }
 
 static inline void next_event(MLuaEvent const** evs, unsigned int* mask) {
@@ -788,36 +2139,77 @@ static inline void next_event(MLuaEvent const** evs, unsigned int* mask) {
     *mask >>= bit;
 }
 
+// Watch events from the running thread. This is on the hot path of waiting,
+// so WATCHERS is fetched from main() instead of the registry.
 static void watch_events(lua_State* ls, MLuaEvent const* evs,
                          unsigned int mask) {
+    push_main_value(ls, lua_upvalueindex(UV_WATCHERS));
+    int wt = lua_absindex(ls, -1);
     for (;;) {
-        watch_event(ls, evs);
-        if (mask == 0) return;
+        lua_pushthread(ls);
+        set_watcher(ls, wt, evs);
+        if (mask == 0) break;
         next_event(&evs, &mask);
     }
+    lua_pop(ls, 1);  // Remove WATCHERS
 }
 
 static void unwatch_events(lua_State* ls, MLuaEvent const* evs,
                            unsigned int mask) {
+    push_main_value(ls, lua_upvalueindex(UV_WATCHERS));
+    int wt = lua_absindex(ls, -1);
     for (;;) {
-        unwatch_event(ls, evs);
-        if (mask == 0) return;
+        if (mlua_event_enabled(evs)) clear_watcher(ls, wt, evs);
+        if (mask == 0) break;
         next_event(&evs, &mask);
     }
+    lua_pop(ls, 1);  // Remove WATCHERS
 }
 
 bool mlua_event_resume_watcher(lua_State* ls, MLuaEvent const* ev) {
     bool res = false;
-    if (lua_rawgetp(ls, LUA_REGISTRYINDEX, ev) != LUA_TNIL) {
-        res = resume(ls, lua_tothread(ls, -1));
+    switch (push_watcher(ls, lua_upvalueindex(UV_WATCHERS), ev)) {
+    case LUA_TTHREAD: {
+        lua_State* thread = lua_tothread(ls, -1);
+        // Watchers of events with a non-zero priority are resumed onto the
+        // highest-priority active queue, until they next suspend.
+        res = ev->priority > 0 ?
+              resume_at(ls, thread, MLUA_THREAD_PRIORITIES - 1)
+              : resume(ls, thread);
+#if MLUA_THREAD_STATS
+        if (res) {
+            ThreadExtra* ext = thread_extra(thread);
+            ext->event_time = ev->time;
+            ext->flags |= FLAGS_EVENT;
+        }
+#endif
+        break;
+    }
+    case LUA_TUSERDATA:  // A condition variable
+        res = deliver_notifications(ls, lua_absindex(ls, -1));
+        break;
     }
     lua_pop(ls, 1);
     return res;
 }
 
 void mlua_event_remove_watcher(lua_State* ls, MLuaEvent const* ev) {
-    lua_pushnil(ls);
-    lua_rawsetp(ls, LUA_REGISTRYINDEX, ev);
+    int* slot = watcher_slot(ev);
+    if (*slot == 0) return;
+    push_watchers(ls);
+    luaL_unref(ls, -1, *slot);
+    lua_pop(ls, 1);  // Remove WATCHERS
+    *slot = 0;
+}
+
+void mlua_event_watch(lua_State* ls, MLuaEvent const* ev) {
+    lua_pushthread(ls);
+    watch_event_from(ls, ev, -1);
+    lua_pop(ls, 1);
+}
+
+void mlua_event_unwatch(lua_State* ls, MLuaEvent const* ev) {
+    unwatch_event(ls, ev);
 }
 
 bool mlua_event_can_wait(lua_State* ls, MLuaEvent const* evs,
@@ -918,7 +2310,7 @@ int mlua_event_handle(lua_State* ls, MLuaEvent* ev, lua_KFunction cont,
     lua_pushlightuserdata(ls, ev);
     lua_pushcclosure(ls, &handler_thread, 3);
     mlua_thread_start(ls);
-    watch_event_from_thread(ls, ev, -1);
+    watch_event_from(ls, ev, -1);
     // If the handler thread is killed before it gets a chance to run, it will
     // remain as a watcher and therefore leak. Since we yield here, this can
     // only happen from other threads that are on the active queue right now,
@@ -928,7 +2320,7 @@ int mlua_event_handle(lua_State* ls, MLuaEvent* ev, lua_KFunction cont,
 }
 
 void mlua_event_stop_handler(lua_State* ls, MLuaEvent const* ev) {
-    if (lua_rawgetp(ls, LUA_REGISTRYINDEX, ev) != LUA_TNIL) {
+    if (mlua_event_push_handler_thread(ls, ev) != LUA_TNIL) {
         mlua_thread_kill(ls);
         lua_pop(ls, 1);
     } else {
@@ -937,5 +2329,8 @@ void mlua_event_stop_handler(lua_State* ls, MLuaEvent const* ev) {
 }
 
 int mlua_event_push_handler_thread(lua_State* ls, MLuaEvent const* ev) {
-    return lua_rawgetp(ls, LUA_REGISTRYINDEX, ev);
+    push_watchers(ls);
+    int typ = push_watcher(ls, lua_absindex(ls, -1), ev);
+    lua_remove(ls, -2);  // Remove WATCHERS
+    return typ;
 }
@@ -6,6 +6,9 @@ _ENV = module(...)
 local oo = require 'mlua.oo'
 local thread = require 'mlua.thread'
 
+local math = require 'math'
+
+local select = thread.select
 local start = thread.start
 
 -- A group of threads managed together.
@@ -13,8 +16,8 @@ Group = oo.class('Group')
 Group.__mode = 'k'
 
 -- Start a new thread and track it in the group.
-function Group:start(fn, name)
-    local th = start(fn, name)
+function Group:start(fn, name, priority)
+    local th = start(fn, name, priority)
     self[th] = true
     return th
 end
@@ -26,6 +29,48 @@ function Group:join()
     for th in pairs(self) do th:join() end
 end
 
+-- Wait for a thread in the group to terminate, remove it from the group and
+-- return it. Returns nil if the group is empty or if the deadline is reached
+-- first.
+function Group:wait_any(deadline)
+    local sources = {}
+    for th in pairs(self) do
+        if not th:is_alive() then
+            self[th] = nil
+            return th
+        end
+        sources[#sources + 1] = th
+    end
+    local len = #sources
+    if len == 0 then return end
+    if deadline then sources[len + 1] = deadline end
+    local i, th = select(sources)
+    if i > len then return end
+    self[th] = nil
+    return th
+end
+
+-- Call fn(item) for each item in items, in at most n threads of the group, and
+-- return the results.
+function Group:map(fn, items, n)
+    local len, results, next = #items, {}, 0
+    local workers = {}
+    for i = 1, math.min(n or len, len) do
+        workers[i] = self:start(function()
+            while next < len do
+                next = next + 1
+                local j = next
+                results[j] = fn(items[j])
+            end
+        end)
+    end
+    for _, th in ipairs(workers) do
+        self[th] = nil
+        th:join()
+    end
+    return results
+end
+
 -- Join the threads in the group on closure.
 Group.__close = Group.join
 
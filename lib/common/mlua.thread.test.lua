@@ -8,6 +8,7 @@ local math = require 'math'
 local int64 = require 'mlua.int64'
 local thread = require 'mlua.thread'
 local group = require 'mlua.thread.group'
+local list = require 'mlua.list'
 local time = require 'mlua.time'
 local string = require 'string'
 
@@ -79,6 +80,103 @@ function test_Thread_join(t)
     local ok, err = pcall(function() th3:join() end)
     t:assert(not ok, "join didn't raise an error")
     t:expect(err):label('error'):eq("boom")
+
+    -- Results are returned to all joiners, including late ones.
+    local th4 = thread.start(function() thread.yield() return 1, nil, 3 end)
+    local res = {}
+    local ths<close> = thread.Group()
+    for j = 1, 3 do
+        ths:start(function() res[j] = list.pack(th4:join()) end)
+    end
+    ths:join()
+    local want = list.pack(1, nil, 3)
+    for j = 1, 3 do t:expect(res[j]):label("res[%s]", j):eq(want) end
+    t:expect(list.pack(th4:join())):label("late"):eq(want)
+
+    -- Killed joiners are removed from the joiners list.
+    local target = thread.start(function() thread.suspend() end)
+    local joiners = {}
+    for j = 1, 3 do
+        joiners[j] = thread.start(function() target:join() end)
+    end
+    thread.yield()
+    joiners[2]:kill()
+    target:kill()
+    for j = 1, 3, 2 do joiners[j]:join() end
+end
+
+function test_Group(t)
+    -- wait_any() returns the threads in termination order.
+    local ths<close> = thread.Group()
+    t:expect(t.expr(ths):wait_any()):eq(nil)
+    local th1 = ths:start(function() time.sleep_for(2 * time.msec) end)
+    local th2 = ths:start(function() time.sleep_for(time.msec) end)
+    local th3 = ths:start(function() thread.suspend() end)
+    t:expect(t.expr(ths):wait_any()):eq(th2)
+    t:expect(t.expr(ths):wait_any()):eq(th1)
+    t:expect(t.expr(ths):wait_any(time.ticks() + time.msec)):eq(nil)
+    th3:kill()
+    t:expect(t.expr(ths):wait_any()):eq(th3)
+    t:expect(t.expr(ths):wait_any()):eq(nil)
+
+    -- map() runs at most n calls concurrently.
+    local items, running, max = {}, 0, 0
+    for i = 1, 10 do items[i] = i end
+    local res = ths:map(function(v)
+        running = running + 1
+        if running > max then max = running end
+        time.sleep_for(time.msec)
+        running = running - 1
+        return 2 * v
+    end, items, 3)
+    for i = 1, 10 do t:expect(res[i]):label("res[%s]", i):eq(2 * i) end
+    t:expect(max):label("max"):eq(3)
+end
+
+function test_select(t)
+    -- Sources that are ready immediately.
+    local dead = thread.start(function() end)
+    dead:join()
+    local ready = setmetatable({}, {__select = function() return true end})
+    local now = time.ticks()
+    t:expect(t.expr(thread).select({dead})):eq(1)
+    t:expect(t.expr(thread).select({now + time.sec, ready, dead})):eq(2)
+    t:expect(t.expr(thread).select({now + time.sec, now})):eq(2)
+
+    -- A deadline fires before a thread terminates.
+    local waiting<close> = thread.start(function() thread.suspend() end)
+    local start = time.ticks()
+    local i, src = thread.select({waiting, start + 2 * time.msec})
+    t:expect(i):label("index"):eq(2)
+    t:expect(time.ticks() - start):label("elapsed"):gte(2 * time.msec)
+
+    -- A thread terminates before a deadline.
+    local sleeping = thread.start(function() time.sleep_for(time.msec) end)
+    i, src = thread.select({time.ticks() + time.sec, sleeping})
+    t:expect(i):label("index"):eq(2)
+    t:expect(src):label("source"):eq(sleeping)
+    t:expect(not sleeping:is_alive(), "Selected thread is alive")
+
+    -- All joiners are resumed, including selecting ones.
+    local log = {}
+    local target = thread.start(function() time.sleep_for(time.msec) end)
+    local ths<close> = thread.Group()
+    for j = 1, 3 do
+        ths:start(function() target:join() log[#log + 1] = j end)
+    end
+    ths:start(function() thread.select({target}) log[#log + 1] = 4 end)
+    ths:join()
+    t:expect(#log):label("#log"):eq(4)
+
+    -- Invalid sources.
+    t:expect(t.expr(thread).select({})):raises("no sources")
+    t:expect(t.expr(thread).select({{}})):raises("source 1 isn't selectable")
+    local not_ready = setmetatable({},
+                                   {__select = function() return false end})
+    t:expect(t.expr(thread).select({not_ready}))
+        :raises("source 1: event not enabled")
+    t:expect(t.expr(thread).select({thread.running()}))
+        :raises("thread cannot select itself")
 end
 
 function test_active(t)
@@ -110,6 +208,198 @@ function test_active_spinning(t)
     t:expect(i):label("i"):eq(1000)
 end
 
+function test_priorities(t)
+    local log = ''
+    local ths<close> = thread.Group()
+    t:expect(t.expr(thread).start(function() end, nil, thread.PRIORITIES))
+        :raises("invalid priority")
+    for _, p in ipairs{0, 1, 1, 0} do
+        local th = ths:start(function()
+            for i = 1, 2 do
+                log = log .. ('(%s, %s) '):format(p, i)
+                thread.yield()
+            end
+        end, nil, p)
+        t:expect(t.expr(th):priority()):eq(p)
+    end
+    ths:join()
+    t:expect(log):label("log"):eq('(1, 1) (1, 1) (1, 2) (1, 2) ' ..
+                                  '(0, 1) (0, 1) (0, 2) (0, 2) ')
+
+    local th<close> = thread.start(function() end)
+    t:expect(t.expr(th):priority()):eq(0)
+    th:set_priority(thread.PRIORITIES - 1)
+    t:expect(t.expr(th):priority()):eq(thread.PRIORITIES - 1)
+    t:expect(t.expr(th):set_priority(-1)):raises("invalid priority")
+end
+
+function test_Thread_stats(t)
+    if not thread.stats() then t:skip("Thread statistics disabled") end
+    local th<close> = thread.start(function()
+        for i = 1, 3 do
+            local deadline = time.ticks() + 2000
+            while time.ticks() < deadline do end
+            thread.yield()
+        end
+    end, 'busy')
+    th:join()
+    local resumes, run_time, max_slice, wait_time = th:stats()
+    t:expect(resumes):label("resumes"):eq(4)
+    t:expect(run_time >= 6000, "run_time too small: %s", run_time)
+    t:expect(max_slice >= 2000, "max_slice too small: %s", max_slice)
+    t:expect(max_slice <= run_time, "max_slice larger than run_time")
+    t:expect(wait_time >= 0, "negative wait_time: %s", wait_time)
+
+    local ths<close> = thread.Group()
+    for i = 1, 3 do ths:start(function() thread.suspend() end) end
+    thread.yield()
+    local top = thread.top()
+    t:expect(#top >= 3, "top() is missing threads: %s", #top)
+    for i = 2, #top do
+        t:expect(top[i - 1].run_time >= top[i].run_time,
+                 "top() isn't sorted by run time")
+    end
+    for th in pairs(ths) do th:resume() end
+end
+
+function test_pool_stats(t)
+    local _, _, _, hits1, misses1 = thread.stats()
+    if not hits1 then t:skip("Thread statistics disabled") end
+    local th<close> = thread.start(function() end)
+    local _, _, _, hits2, misses2 = thread.stats()
+    t:expect((hits2 - hits1) + (misses2 - misses1)):label("hits + misses")
+        :eq(1)
+end
+
+function test_pool(t)
+    if not thread.stats() then t:skip("Thread statistics disabled") end
+    if thread.POOL_SIZE == 0 then t:skip("Thread recycling disabled") end
+
+    -- Threads that aren't detached aren't recycled.
+    local th1 = thread.start(function() end)
+    thread.yield()
+    t:expect(t.expr(th1):is_alive()):eq(false)
+    local th2<close> = thread.start(function() end)
+    t:expect(th2):label("th2"):neq(th1)
+    th2:join()
+
+    -- Detached threads are recycled.
+    thread.start(function() end):detach()
+    thread.yield()
+    local _, _, _, hits2 = thread.stats()
+    local th3<close> = thread.start(function() end)
+    local _, _, _, hits3 = thread.stats()
+    t:expect(hits3 - hits2):label("hits"):eq(1)
+end
+
+function test_latency_stats(t)
+    if not thread.stats() then t:skip("Thread statistics disabled") end
+    local buckets = list.pack(thread.latency_stats())
+    t:expect(buckets:len()):label("buckets"):eq(20)
+    local count = 0
+    for _, n in buckets:ipairs() do count = count + n end
+    local _, _, _, _, _, p50, p99, max = thread.stats()
+    t:expect(p50):label("p50"):lte(p99)
+    t:expect(p99):label("p99"):lte(max)
+    if count == 0 then t:expect(max):label("max"):eq(0) end
+end
+
+-- Return the IRQ module of the platform and up to n IRQs whose handlers run
+-- through events, or nil if the platform has none.
+local function event_irqs(t, n)
+    local nums = list()
+    local ok, irq = pcall(require, 'host.irq')
+    if ok then
+        for num = 0, math.min(n, irq.NUM_IRQS) - 1 do nums:append(num) end
+        return irq, nums
+    end
+    ok, irq = pcall(require, 'hardware.irq')
+    if not ok then return end
+    for i = 1, n do
+        local num = irq.user_irq_claim_unused(false)
+        if num < 0 then break end
+        t:cleanup(function() irq.user_irq_unclaim(num) end)
+        nums:append(num)
+    end
+    return irq, nums
+end
+
+function test_dispatch_batching(t)
+    if not thread.dispatch_stats() then t:skip("Thread statistics disabled") end
+    local irq, nums = event_irqs(t, 4)
+    if not irq then t:skip("No IRQs available") end
+    if nums:len() < 2 then t:skip("Not enough IRQs available") end
+
+    -- Set up IRQ handlers, and let them start waiting for their events.
+    local count = 0
+    for _, num in nums:ipairs() do
+        irq.set_handler(num, function() count = count + 1 end)
+        t:cleanup(function() irq.remove_handler(num) end)
+        irq.set_enabled(num, true)
+        t:cleanup(function() irq.set_enabled(num, false) end)
+    end
+    thread.yield()
+
+    -- Set all events pending without yielding. On the host, IRQs are raised
+    -- asynchronously, so give them some time.
+    local before = list.pack(thread.dispatch_stats())
+    for _, num in nums:ipairs() do irq.set_pending(num) end
+    local deadline = time.ticks() + 10 * time.msec
+    repeat until time.ticks() >= deadline
+
+    -- The events are detached in a single batch, and all handlers run in a
+    -- single dispatch pass.
+    thread.yield()
+    t:expect(count):label("count"):eq(nums:len())
+    local after = list.pack(thread.dispatch_stats())
+    local batches = 0
+    for i = math.floor(math.log(nums:len(), 2)) + 1, after:len() do
+        batches = batches + after[i] - before[i]
+    end
+    t:expect(batches):label("batches of %s+ events", nums:len()):gte(1)
+end
+
+function test_idle_gc(t)
+    if not thread.IDLE_GC then t:skip("Idle GC disabled") end
+    if not collectgarbage('isrunning') then t:skip("GC stopped") end
+
+    -- Create garbage, then sleep past the idle threshold without allocating.
+    local function make_garbage()
+        local tab = {}
+        for i = 1, 1000 do tab[i] = {i} end
+    end
+    make_garbage()
+    local steps = select(10, thread.stats())
+    local before = collectgarbage('count')
+    time.sleep_for(50 * time.msec)
+    t:expect(collectgarbage('count')):label("count"):lt(before)
+    if steps then
+        t:expect(select(10, thread.stats()) - steps):label("steps"):gte(1)
+    end
+end
+
+function test_preemption(t)
+    local prev = thread.slice(time.msec)
+    if not prev then t:skip("Preemption disabled") end
+    t:cleanup(function() thread.slice(prev) end)
+
+    -- Without preemption, the spinning thread would run until its deadline.
+    local done, preempted = false, false
+    local spinner<close> = thread.start(function()
+        local deadline = time.ticks() + 200 * time.msec
+        while not done and time.ticks() < deadline do end
+        preempted = done
+    end)
+    local other<close> = thread.start(function() done = true end)
+    spinner:join()
+    t:expect(preempted, "The spinning thread wasn't preempted")
+    local preemptions = select(8, spinner:stats())
+    if preemptions then
+        t:expect(preemptions):label("preemptions"):gte(1)
+        t:expect(select(9, thread.stats())):label("total"):gte(preemptions)
+    end
+end
+
 function test_timers(t)
     local log = ''
     local ths<close> = thread.Group()
@@ -128,6 +418,30 @@ function test_timers(t)
                                   '(3, 3) (4, 3) (5, 3) (1, 3) (2, 3) ')
 end
 
+function test_timers_heap(t)
+    local log, threads = list(), {}
+    local ths<close> = thread.Group()
+    local start = time.ticks() + 20000
+    local offsets = {7, 3, 9, 3, 1, 5, 3, 8, 2, 6, 4, 3, 0, 9, 1}
+    for i, off in ipairs(offsets) do
+        threads[i] = ths:start(function()
+            thread.suspend(start + off * 1000)
+            log:append(i)
+        end)
+    end
+    thread.yield()
+    for _, th in ipairs(threads) do
+        t:expect(th:is_waiting(), "Thread isn't waiting")
+    end
+
+    -- Remove threads from the middle of the heap, by resuming and killing.
+    threads[6]:resume()
+    t:expect(t.expr(threads[10]):kill()):eq(true)
+    thread.yield()
+    ths:join()
+    t:expect(log):label("log"):eq{6, 13, 5, 15, 9, 2, 4, 7, 12, 11, 1, 8, 3, 14}
+end
+
 function test_active_and_timers(t)
     local log = ''
     local ths<close> = thread.Group()
@@ -156,6 +470,96 @@ function test_active_and_timers(t)
     t:expect(log):label("log"):eq('adgbehcfi')
 end
 
+function test_Channel(t)
+    local ch = thread.Channel(2)
+    t:expect(t.expr(ch):capacity()):eq(2)
+    t:expect(t.expr(thread).Channel(0)):raises("invalid capacity")
+    t:expect(t.expr(ch):try_send(nil)):raises("value expected")
+    t:expect(t.expr(ch):try_recv()):eq(nil)
+    t:expect(t.expr(ch):try_send(1)):eq(true)
+    t:expect(t.expr(ch):try_send(2)):eq(true)
+    t:expect(t.expr(ch):try_send(3)):eq(false)
+    t:expect(#ch):label("#ch"):eq(2)
+    t:expect(t.expr(ch):try_recv()):eq(1)
+    t:expect(t.expr(ch):try_recv()):eq(2)
+    t:expect(t.expr(ch):recv(time.ticks() + 1000)):eq(nil)
+
+    local log = list()
+    local ths<close> = thread.Group()
+    ths:start(function()
+        for i = 1, 5 do
+            t:expect(t.expr(ch):send(i)):eq(true)
+            log:append(('s%s'):format(i))
+        end
+    end)
+    ths:start(function()
+        for i = 1, 5 do
+            local v = ch:recv()
+            log:append(('r%s'):format(v))
+        end
+    end)
+    ths:join()
+    t:expect(log):label("log")
+        :eq{'s1', 's2', 'r1', 'r2', 's3', 's4', 'r3', 'r4', 's5', 'r5'}
+
+    t:expect(t.expr(ch):try_send(1)):eq(true)
+    t:expect(t.expr(ch):try_send(2)):eq(true)
+    t:expect(t.expr(ch):send(3, time.ticks() + 1000)):eq(false)
+
+    -- Blocked senders are woken up in FIFO order, across ring growth and
+    -- wrap-around.
+    t:expect(t.expr(ch):try_recv()):eq(1)
+    t:expect(t.expr(ch):try_recv()):eq(2)
+    for round = 1, 3 do
+        for i = 1, 8 do ths:start(function() ch:send(i) end) end
+        thread.yield()
+        local got = list()
+        for i = 1, 8 do got:append(ch:recv()) end
+        t:expect(got):label("round %s", round)
+            :eq{1, 2, 3, 4, 5, 6, 7, 8}
+    end
+end
+
+function test_Condition(t)
+    local cond = thread.Condition()
+    t:expect(t.expr(cond):notify()):eq(0)
+    t:expect(t.expr(cond):notify_all()):eq(0)
+    t:expect(t.expr(cond):wait(time.ticks() + 1000)):eq(false)
+
+    -- Start waiters, and notify them one by one, then all at once.
+    local log = list()
+    local ths<close> = thread.Group()
+    for i = 1, 5 do
+        ths:start(function()
+            while cond:wait() do log:append(i) end
+        end)
+    end
+    thread.yield()
+    t:expect(t.expr(cond):notify()):eq(1)
+    t:expect(t.expr(cond):notify()):eq(1)
+    thread.yield()
+    t:expect(log):label("log"):eq{1, 2}
+    t:expect(t.expr(cond):notify_all()):eq(5)
+    thread.yield()
+    t:expect(log):label("log"):eq{1, 2, 3, 4, 5, 1, 2}
+
+    -- Waiters that time out leave the queue.
+    ths:start(function()
+        log:append(cond:wait(time.ticks() + 1000) and 'n' or 't')
+    end)
+    time.sleep_for(3000)
+    t:expect(log:len()):label("#log"):eq(8)
+    t:expect(log[8]):label("log[8]"):eq('t')
+    t:expect(t.expr(cond):notify_all()):eq(5)
+
+    -- Killed waiters leave the queue.
+    thread.yield()
+    local th = thread.start(function() cond:wait() end)
+    thread.yield()
+    th:kill()
+    t:expect(t.expr(cond):notify_all()):eq(5)
+end
+
 function test_blocking(t)
     t:cleanup(function() thread.blocking(false) end)
     local ths<close> = thread.Group()
@@ -176,6 +580,27 @@ function test_blocking(t)
     ths:join()
 end
 
+function test_precise(t)
+    t:expect(t.expr(thread).precise()):eq(false)
+    local th<close> = thread.start(function()
+        t:expect(t.expr(thread).precise(true)):eq(false)
+        t:expect(t.expr(thread).precise()):eq(true)
+        local child<close> = thread.start(function()
+            t:expect(t.expr(thread).precise()):eq(false)
+        end)
+        for i = 1, 5 do time.sleep_for(1000) end
+        child:join()
+    end, 'precise')
+    th:join()
+    t:expect(t.expr(thread).precise()):eq(false)
+    if not thread.stats() then return end
+    local _, _, _, _, wakeups, max_jitter, jitter = th:stats()
+    t:expect(wakeups):label("wakeups"):eq(5)
+    t:expect(max_jitter <= jitter, "max_jitter larger than jitter")
+    t:printf("Precise wakeups: max jitter: %s us, avg: %4.1f us\n",
+             max_jitter, jitter / wakeups)
+end
+
 function test_scheduling_latency(t)
     local samples = 10
     local ticks, sleep_until = time.ticks, time.sleep_until
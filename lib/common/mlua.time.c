@@ -16,6 +16,24 @@ static int mod_ticks64(lua_State* ls) {
     return mlua_push_int64(ls, mlua_ticks64()), 1;
 }
 
+static int mod_cycles(lua_State* ls) {
+    return lua_pushinteger(ls, (lua_Integer)mlua_cycles()), 1;
+}
+
+static int mod_cycles_diff(lua_State* ls) {
+    uint32_t from = luaL_checkinteger(ls, 1);
+    uint32_t to = luaL_optinteger(ls, 2, mlua_cycles());
+#if MLUA_IS64INT
+    return lua_pushinteger(ls, (uint32_t)(to - from)), 1;
+#else
+    return lua_pushinteger(ls, (int32_t)(to - from)), 1;
+#endif
+}
+
+static int mod_cycles_freq(lua_State* ls) {
+    return lua_pushinteger(ls, mlua_cycles_freq()), 1;
+}
+
 static int mod_to_ticks64(lua_State* ls) {
     lua_Unsigned t = luaL_checkinteger(ls, 1);
     uint64_t now = luaL_opt(ls, (uint64_t)mlua_check_int64, 2, mlua_ticks64());
@@ -39,30 +57,20 @@ static int mod_deadline(lua_State* ls) {
     return mlua_push_deadline(ls, delay), 1;
 }
 
-static int mod_sleep_until_1(lua_State* ls, int status, lua_KContext ctx);
-
 static int mod_sleep_until(lua_State* ls) {
-    if (!mlua_thread_blocking(ls)) {
-        luaL_argexpected(ls, mlua_is_time(ls, 1), 1, "integer or Int64");
-        if (mlua_time_reached(ls, 1)) return 0;
-        return mlua_thread_suspend(ls, &mod_sleep_until_1, 0, 1);
-    }
     uint64_t time = mlua_check_time(ls, 1);
+    if (!mlua_thread_blocking(ls)) return mlua_thread_sleep_until(ls, time);
     while (!mlua_wait(time)) {}
     return 0;
 }
 
-static int mod_sleep_until_1(lua_State* ls, int status, lua_KContext ctx) {
-    if (mlua_time_reached(ls, 1)) return 0;
-    return mlua_thread_suspend(ls, &mod_sleep_until_1, 0, 1);
-}
-
 static int mod_sleep_for(lua_State* ls) {
     int64_t delay = mlua_check_int64(ls, 1);
     if (delay <= 0) return 0;
-    lua_settop(ls, 0);
-    mlua_push_deadline(ls, delay);
-    return mod_sleep_until(ls);
+    uint64_t time = mlua_timeout_deadline(mlua_ticks64(), delay);
+    if (!mlua_thread_blocking(ls)) return mlua_thread_sleep_until(ls, time);
+    while (!mlua_wait(time)) {}
+    return 0;
 }
 
 MLUA_SYMBOLS(module_syms) = {
@@ -73,6 +81,9 @@ MLUA_SYMBOLS(module_syms) = {
 
     MLUA_SYM_F(ticks, mod_),
     MLUA_SYM_F(ticks64, mod_),
+    MLUA_SYM_F(cycles, mod_),
+    MLUA_SYM_F(cycles_diff, mod_),
+    MLUA_SYM_F(cycles_freq, mod_),
     MLUA_SYM_F(to_ticks64, mod_),
     MLUA_SYM_F(compare, mod_),
     MLUA_SYM_F(diff, mod_),
@@ -36,6 +36,22 @@ function test_ticks(t)
     end)
 end
 
+function test_cycles(t)
+    t:expect(t.expr(time).cycles()):apply(math.type):op('type is')
+        :eq('integer')
+    local freq = time.cycles_freq()
+    t:expect(t.expr(time).cycles_freq()):gt(0)
+    local c1, t1 = time.cycles(), time.ticks()
+    time.sleep_for(10 * time.msec)
+    local dc, dt = time.cycles_diff(c1), time.ticks() - t1
+    local want = dt * freq // time.sec
+    t:expect(dc):label("cycles"):gte(want * 9 // 10):lte(want * 11 // 10)
+
+    -- Differences wrap around at 32 bits.
+    t:expect(t.expr(time).cycles_diff(0xfffffff0, 0x10)):eq(0x20)
+    t:expect(t.expr(time).cycles_diff(5, 5)):eq(0)
+end
+
 local integer_bits = string.packsize('j') * 8
 
 function test_to_ticks64(t)
@@ -118,3 +134,15 @@ function test_sleep_BNB(t)
     t:expect(t2 - t1):label("sleep_for(%s) duration", delay)
         :gte(delay):lt(delay + 200)
 end
+
+function test_sleep_allocs_BNB(t)
+    local sleep_for, ticks, count = time.sleep_for, time.ticks, 100
+    sleep_for(1)  -- Warm up
+    local allocs = alloc_stats()
+    local t1 = ticks()
+    for _ = 1, count do sleep_for(1) end
+    local t2 = ticks()
+    if allocs then allocs = alloc_stats() - allocs end
+    t:printf("sleep_for(1): %.1f us / call\n", (t2 - t1) / count)
+    if allocs then t:expect(allocs):label("allocs"):eq(0) end
+end
@@ -0,0 +1,112 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/module.h"
+#include "mlua/platform.h"
+#include "mlua/trace.h"
+#include "mlua/util.h"
+
+MLuaTraceRing mlua_trace_rings[MLUA_PLATFORM_CORES];
+
+// The header of a trace dump. All values are little-endian. The header is
+// followed by the ring of each core, as a 32-bit head and MLUA_TRACE_SIZE
+// records.
+typedef struct DumpHeader {
+    char magic[4];
+    uint8_t version;
+    uint8_t cores;
+    uint16_t record_size;
+    uint32_t size;
+} DumpHeader;
+
+static int mod_mark(lua_State* ls) {
+    mlua_trace(MLUA_TRACE_MARK, (uint32_t)luaL_checkinteger(ls, 1));
+    return 0;
+}
+
+static int mod_clear(lua_State* ls) {
+    for (int i = 0; i < MLUA_PLATFORM_CORES; ++i) {
+        MLuaTraceRing* ring = &mlua_trace_rings[i];
+        uint32_t save = mlua_platform_irq_save();
+        ring->head = 0;
+        mlua_platform_irq_restore(save);
+    }
+    return 0;
+}
+
+// Push a dump of the trace rings. The rings of other cores aren't locked, so
+// their oldest records may be overwritten while they are copied.
+static void push_dump(lua_State* ls) {
+    luaL_Buffer buf;
+    luaL_buffinit(ls, &buf);
+    DumpHeader hdr = {
+        .magic = {'M', 'L', 'T', 'R'},
+        .version = 1,
+        .cores = MLUA_PLATFORM_CORES,
+        .record_size = sizeof(MLuaTraceRecord),
+        .size = MLUA_TRACE_SIZE,
+    };
+    luaL_addlstring(&buf, (char const*)&hdr, sizeof(hdr));
+    for (int i = 0; i < MLUA_PLATFORM_CORES; ++i) {
+        MLuaTraceRing* ring = &mlua_trace_rings[i];
+        char* p = luaL_prepbuffsize(&buf, sizeof(*ring));
+        uint32_t save = mlua_platform_irq_save();
+        memcpy(p, ring, sizeof(*ring));
+        mlua_platform_irq_restore(save);
+        luaL_addsize(&buf, sizeof(*ring));
+    }
+    luaL_pushresult(&buf);
+}
+
+static int mod_dump(lua_State* ls) {
+    push_dump(ls);
+    return 1;
+}
+
+// The number of dump bytes per line written by write().
+#define WRITE_LINE 32
+
+static int mod_write_1(lua_State* ls, int status, lua_KContext ctx) {
+    size_t len;
+    uint8_t const* data = (uint8_t const*)lua_tolstring(ls, 2, &len);
+    static char const digits[] = "0123456789abcdef";
+    for (size_t off = ctx; off < len; off += WRITE_LINE) {
+        lua_settop(ls, 2);
+        lua_getfield(ls, 1, "write");
+        lua_pushvalue(ls, 1);
+        char line[2 * WRITE_LINE + 1];
+        size_t n = len - off < WRITE_LINE ? len - off : WRITE_LINE;
+        for (size_t i = 0; i < n; ++i) {
+            line[2 * i] = digits[data[off + i] >> 4];
+            line[2 * i + 1] = digits[data[off + i] & 0xf];
+        }
+        line[2 * n] = '\n';
+        lua_pushlstring(ls, line, 2 * n + 1);
+        lua_callk(ls, 2, 0, off + WRITE_LINE, &mod_write_1);
+    }
+    return 0;
+}
+
+static int mod_write(lua_State* ls) {
+    lua_settop(ls, 1);
+    push_dump(ls);
+    return mod_write_1(ls, LUA_OK, 0);
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_V(size, integer, MLUA_TRACE_SIZE),
+    MLUA_SYM_F(mark, mod_),
+    MLUA_SYM_F(clear, mod_),
+    MLUA_SYM_F(dump, mod_),
+    MLUA_SYM_F(write, mod_),
+};
+
+MLUA_OPEN_MODULE(mlua.trace) {
+    mlua_new_module(ls, 0, module_syms);
+    return 1;
+}
@@ -0,0 +1,80 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local io = require 'mlua.io'
+local thread = require 'mlua.thread'
+local trace = require 'mlua.trace'
+local string = require 'string'
+
+local KIND_RESUME, KIND_SUSPEND, KIND_MARK = 6, 7, 8
+
+-- Parse a trace dump into a list of records per core, oldest first.
+local function parse(dump)
+    local magic, version, cores, rsize, size, pos =
+        ('<c4BBHI4'):unpack(dump)
+    local rings = {}
+    for core = 1, cores do
+        local head
+        head, pos = ('<I4'):unpack(dump, pos)
+        local recs = {}
+        for i = (head > size and head - size or 0), head - 1 do
+            local off = pos + (i % size) * rsize
+            local time, id, kind, c = ('<I4I4I2I2'):unpack(dump, off)
+            recs[#recs + 1] = {time = time, id = id, kind = kind, core = c}
+        end
+        rings[core] = recs
+        pos = pos + size * rsize
+    end
+    return {magic = magic, version = version, rsize = rsize, size = size,
+            rings = rings}
+end
+
+function test_dump(t)
+    local self = tonumber(('%p'):format(thread.running()):match('%x+$'), 16)
+        & 0xffffffff
+    trace.clear()
+    trace.mark(42)
+    thread.yield()
+    trace.mark(43)
+    local d = parse(trace.dump())
+    t:expect(d.magic):label("magic"):eq('MLTR')
+    t:expect(d.version):label("version"):eq(1)
+    t:expect(d.rsize):label("record size"):eq(12)
+    t:expect(d.size):label("size"):eq(trace.size)
+    local kinds
+    for core, recs in ipairs(d.rings) do
+        for i, rec in ipairs(recs) do
+            if rec.kind == KIND_MARK and rec.id == 42 then
+                t:expect(rec.core):label("core"):eq(core - 1)
+                kinds = {}
+                for j = i, #recs do
+                    local kind, id = recs[j].kind, recs[j].id
+                    local switch = kind == KIND_RESUME or kind == KIND_SUSPEND
+                    if kind == KIND_MARK or (switch and id == self) then
+                        kinds[#kinds + 1] = kind
+                    end
+                    t:expect(recs[j].time - rec.time):label("time")
+                        :lte(1 << 31)
+                end
+                break
+            end
+        end
+    end
+    t:expect(kinds):label("kinds")
+        :eq{KIND_MARK, KIND_SUSPEND, KIND_RESUME, KIND_MARK}
+end
+
+function test_write(t)
+    local out = io.Recorder()
+    trace.write(out)
+    local hex = tostring(out)
+    t:expect(hex):label("output"):matches('^[0-9a-f\n]+$')
+    local data = hex:gsub('\n', ''):gsub('..', function(b)
+        return string.char(tonumber(b, 16))
+    end)
+    local dump = trace.dump()
+    t:expect(#data):label("#data"):eq(#dump)
+    t:expect(data:sub(1, 12)):label("header"):eq(dump:sub(1, 12))
+end
@@ -0,0 +1,287 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/bits.h"
+#include "mlua/block.h"
+#include "mlua/errors.h"
+#include "mlua/module.h"
+#include "mlua/thread.h"
+#include "mlua/util.h"
+
+// The default target address corresponding to offset 0 of the block device,
+// i.e. the start of flash memory on the RP2040.
+#ifndef MLUA_UF2_WRITER_BASE
+#define MLUA_UF2_WRITER_BASE 0x10000000
+#endif
+
+#define MAGIC_START0 0x0a324655u
+#define MAGIC_START1 0x9e5d5157u
+#define MAGIC_END 0x0ab16f30u
+#define FLAG_NOFLASH 0x00000001u
+#define FLAG_FILE_CONTAINER 0x00001000u
+#define FLAG_FAMILY_ID_PRESENT 0x00002000u
+
+// An UF2 block. The format is little-endian, like all supported targets.
+typedef struct Block {
+    uint32_t magic_start0;
+    uint32_t magic_start1;
+    uint32_t flags;
+    uint32_t target_addr;
+    uint32_t payload_size;
+    uint32_t block_no;
+    uint32_t num_blocks;
+    uint32_t family_id;
+    uint8_t data[476];
+    uint32_t magic_end;
+} Block;
+
+static_assert(sizeof(Block) == 512, "unexpected UF2 block size");
+
+static char const Writer_name[] = "mlua.uf2.writer.Writer";
+
+// A streaming UF2 writer. Blocks are assembled in a fixed buffer, validated,
+// and their payload written to the block device. The device is erased just
+// ahead of the written data, and the CRC-32 of the image is accumulated as it
+// is written, so that it can be verified against the device at the end.
+typedef struct Writer {
+    MLuaBlockDev* dev;
+    uint32_t base;
+    uint32_t family_id;
+    uint32_t num_blocks;
+    uint32_t next_block;
+    uint64_t end;
+    uint64_t erased;
+    uint32_t crc;
+    uint32_t check;
+    uint32_t len;
+    int err;
+    char const* msg;
+    Block block;
+} Writer;
+
+static inline Writer* check_Writer(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Writer_name);
+}
+
+// Record an error. Errors are sticky: all subsequent operations fail with the
+// same error.
+static int set_error(Writer* w, int err, char const* msg) {
+    w->err = err;
+    w->msg = msg;
+    return err;
+}
+
+static int push_error(lua_State* ls, Writer* w) {
+    mlua_push_fail(ls, w->msg != NULL ? w->msg : mlua_err_msg(w->err));
+    lua_pushinteger(ls, w->err);
+    return 3;
+}
+
+static uint32_t crc32(void const* ptr, size_t len, uint32_t crc) {
+    return mlua_bits_checksum(MLUA_CHECKSUM_CRC32, ptr, len, crc);
+}
+
+// Accumulate the CRC-32 of "len" erased bytes.
+static uint32_t crc32_erased(uint64_t len, uint32_t crc) {
+    uint8_t chunk[64];
+    memset(chunk, 0xff, sizeof(chunk));
+    while (len > 0) {
+        size_t n = len < sizeof(chunk) ? len : sizeof(chunk);
+        crc = crc32(chunk, n, crc);
+        len -= n;
+    }
+    return crc;
+}
+
+// Validate the block in the buffer and write its payload to the device.
+static int write_block(Writer* w) {
+    Block const* b = &w->block;
+    if (b->magic_start0 != MAGIC_START0 || b->magic_start1 != MAGIC_START1
+            || b->magic_end != MAGIC_END) {
+        return set_error(w, MLUA_EINVAL, "invalid UF2 block");
+    }
+    if (w->next_block == 0) w->num_blocks = b->num_blocks;
+    if (b->block_no != w->next_block || b->num_blocks != w->num_blocks
+            || b->block_no >= b->num_blocks) {
+        return set_error(w, MLUA_EINVAL, "unexpected block number");
+    }
+    ++w->next_block;
+    if ((b->flags & FLAG_NOFLASH) != 0) return MLUA_EOK;
+    if ((b->flags & FLAG_FILE_CONTAINER) != 0) {
+        return set_error(w, MLUA_EINVAL, "unsupported UF2 block");
+    }
+    if (w->family_id != 0 && (b->flags & FLAG_FAMILY_ID_PRESENT) != 0
+            && b->family_id != w->family_id) {
+        return set_error(w, MLUA_EINVAL, "wrong family ID");
+    }
+
+    // Check that the block fits the device, after the previous block.
+    MLuaBlockDev* dev = w->dev;
+    uint32_t size = b->payload_size;
+    if (size == 0 || size > sizeof(b->data)) {
+        return set_error(w, MLUA_EINVAL, "invalid payload size");
+    }
+    if (b->target_addr < w->base
+            || b->target_addr - w->base + (uint64_t)size > dev->size) {
+        return set_error(w, MLUA_EINVAL, "block out of range");
+    }
+    uint64_t off = b->target_addr - w->base;
+    if (off < w->end) return set_error(w, MLUA_EINVAL, "out of order block");
+    if (off % dev->write_size != 0 || size % dev->write_size != 0) {
+        return set_error(w, MLUA_EINVAL, "unaligned block");
+    }
+
+    // Erase up to the end of the block, then write the payload. The gap since
+    // the previous block reads as erased, and is included in the CRC.
+    while (w->erased < off + size) {
+        int err = dev->erase(dev, w->erased, dev->erase_size);
+        if (err < 0) return set_error(w, err, NULL);
+        w->erased += dev->erase_size;
+    }
+    int err = dev->write(dev, off, b->data, size);
+    if (err < 0) return set_error(w, err, NULL);
+    w->crc = crc32(b->data, size, crc32_erased(off - w->end, w->crc));
+    w->end = off + size;
+    return MLUA_EOK;
+}
+
+static int Writer_write_1(lua_State* ls, int status, lua_KContext ctx) {
+    Writer* w = check_Writer(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_ro_buffer(ls, 2, &buf), 2,
+                     "string or buffer");
+    luaL_argcheck(ls, buf.size != SIZE_MAX, 2, "infinite buffer");
+    if (w->err < 0) return push_error(ls, w);
+    size_t done = (size_t)ctx;
+    while (done < buf.size) {
+        size_t len = sizeof(w->block) - w->len;
+        if (len > buf.size - done) len = buf.size - done;
+        mlua_buffer_read(&buf, done, len, (uint8_t*)&w->block + w->len);
+        w->len += len;
+        done += len;
+        if (w->len < sizeof(w->block)) break;
+        w->len = 0;
+        if (write_block(w) < 0) return push_error(ls, w);
+        if (done < buf.size && !mlua_thread_blocking(ls)) {
+            return mlua_thread_yield(ls, 0, &Writer_write_1,
+                                     (lua_KContext)done);
+        }
+    }
+    return lua_pushboolean(ls, true), 1;
+}
+
+static int Writer_write(lua_State* ls) {
+    lua_settop(ls, 2);
+    return Writer_write_1(ls, LUA_OK, 0);
+}
+
+static int Writer_finish_1(lua_State* ls, int status, lua_KContext ctx) {
+    Writer* w = check_Writer(ls, 1);
+    MLuaBlockDev* dev = w->dev;
+    uint64_t off = (uint64_t)ctx;
+    while (off < w->end) {
+        size_t len = w->end - off;
+        if (len > sizeof(w->block)) len = sizeof(w->block);
+        int err = dev->read(dev, off, &w->block, len);
+        if (err < 0) return set_error(w, err, NULL), push_error(ls, w);
+        w->check = crc32(&w->block, len, w->check);
+        off += len;
+        if (off < w->end && off % dev->erase_size == 0
+                && !mlua_thread_blocking(ls)) {
+            return mlua_thread_yield(ls, 0, &Writer_finish_1,
+                                     (lua_KContext)off);
+        }
+    }
+    if (w->check != w->crc) {
+        set_error(w, MLUA_ECORRUPT, "verification failed");
+        return push_error(ls, w);
+    }
+    lua_pushinteger(ls, w->end);
+    lua_pushinteger(ls, (uint32_t)~w->crc);
+    return 2;
+}
+
+static int Writer_finish(lua_State* ls) {
+    Writer* w = check_Writer(ls, 1);
+    if (w->err < 0) return push_error(ls, w);
+    if (w->len != 0) {
+        set_error(w, MLUA_EINVAL, "incomplete block");
+        return push_error(ls, w);
+    }
+    if (w->next_block == 0 || w->next_block != w->num_blocks) {
+        set_error(w, MLUA_EINVAL, "incomplete image");
+        return push_error(ls, w);
+    }
+    if (w->end == 0) {
+        set_error(w, MLUA_EINVAL, "empty image");
+        return push_error(ls, w);
+    }
+    int err = w->dev->sync(w->dev);
+    if (err < 0) return set_error(w, err, NULL), push_error(ls, w);
+    w->check = 0xffffffffu;
+    return Writer_finish_1(ls, LUA_OK, 0);
+}
+
+static int Writer_progress(lua_State* ls) {
+    Writer* w = check_Writer(ls, 1);
+    lua_pushinteger(ls, w->next_block);
+    lua_pushinteger(ls, w->num_blocks);
+    return 2;
+}
+
+MLUA_SYMBOLS(Writer_syms) = {
+    MLUA_SYM_F(write, Writer_),
+    MLUA_SYM_F(finish, Writer_),
+    MLUA_SYM_F(progress, Writer_),
+};
+
+static int mod_new(lua_State* ls) {
+    MLuaBlockDev* dev = mlua_block_check(ls, 1);
+    uint32_t base = MLUA_UF2_WRITER_BASE;
+    uint32_t family_id = 0;
+    if (!lua_isnoneornil(ls, 2)) {
+        luaL_checktype(ls, 2, LUA_TTABLE);
+        if (lua_getfield(ls, 2, "base") != LUA_TNIL) {
+            base = luaL_checkinteger(ls, -1);
+        }
+        if (lua_getfield(ls, 2, "family_id") != LUA_TNIL) {
+            family_id = luaL_checkinteger(ls, -1);
+        }
+        lua_pop(ls, 2);
+    }
+    Writer* w = lua_newuserdatauv(ls, sizeof(Writer), 1);
+    luaL_getmetatable(ls, Writer_name);
+    lua_setmetatable(ls, -2);
+    lua_pushvalue(ls, 1);  // Keep dev alive
+    lua_setiuservalue(ls, -2, 1);
+    memset(w, 0, sizeof(Writer));
+    w->dev = dev;
+    w->base = base;
+    w->family_id = family_id;
+    w->crc = 0xffffffffu;
+    return 1;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_F(new, mod_),
+};
+
+MLUA_OPEN_MODULE(mlua.uf2.writer) {
+    mlua_thread_require(ls);
+    mlua_require(ls, "mlua.block", false);
+
+    // Create the Writer class.
+    mlua_new_class(ls, Writer_name, Writer_syms, mlua_nosyms);
+    lua_pop(ls, 1);
+
+    // Create the module.
+    mlua_new_module(ls, 0, module_syms);
+    return 1;
+}
@@ -0,0 +1,126 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local bits = require 'mlua.bits'
+local block_mem = require 'mlua.block.mem'
+local errors = require 'mlua.errors'
+local mem = require 'mlua.mem'
+local thread = require 'mlua.thread'
+local uf2 = require 'mlua.uf2'
+local writer = require 'mlua.uf2.writer'
+local string = require 'string'
+local table = require 'table'
+
+local base = 0x10000000
+local dev_size = 8 << 10
+
+-- Create a block device that isn't erased, to check that the writer erases it.
+local function new_dev()
+    local buf = mem.alloc(dev_size)
+    mem.fill(buf, 0)
+    return block_mem.new(buf, 256, 1024), buf
+end
+
+-- Serialize a UF2 stream from a list of {addr, data, [flags]} entries.
+local function stream(blocks, opts)
+    opts = opts or {}
+    local parts = {}
+    for i, b in ipairs(blocks) do
+        parts[i] = assert(uf2.serialize{
+            flags = b[3] or uf2.flag_family_id_present,
+            target_addr = b[1], data = b[2],
+            block_no = i - 1, num_blocks = opts.num_blocks or #blocks,
+            reserved = opts.family_id or uf2.family_id_rp2040,
+        })
+    end
+    return table.concat(parts)
+end
+
+local function page(c) return c:rep(256) end
+
+function test_write(t)
+    local dev = new_dev()
+    local w = writer.new(dev, {family_id = uf2.family_id_rp2040})
+    local data = stream{
+        {base, page('a')},
+        {base + 256, page('b')},
+        {0x20000000, 'skipped', uf2.flag_noflash},
+        {base + 1024, page('c')},
+    }
+    t:expect(t.mexpr(w):progress()):eq{0, 0}
+    for i = 1, #data, 100 do t:assert(w:write(data:sub(i, i + 99))) end
+    t:expect(t.mexpr(w):progress()):eq{4, 4}
+    local image = page('a') .. page('b') .. page('\xff'):rep(2) .. page('c')
+    t:expect(t.mexpr(w):finish()):eq{#image, bits.crc32(image)}
+    t:expect(t.expr(dev):read(0, #image)):eq(image)
+    t:expect(t.expr(dev):read(#image, 768)):eq(page('\xff'):rep(3))
+    t:expect(t.expr(dev):read(2048, 4)):eq(('\0'):rep(4))
+end
+
+function test_errors(t)
+    local valid = stream{{base, page('a')}}
+    for _, test in ipairs{
+        {'\0' .. valid:sub(2), "invalid UF2 block"},
+        {stream{{base + 256, page('a')}, {base, page('b')}},
+         "out of order block"},
+        {stream({{base, page('a')}}, {family_id = 0x12345678}),
+         "wrong family ID"},
+        {stream{{base - 256, page('a')}}, "block out of range"},
+        {stream{{base + dev_size, page('a')}}, "block out of range"},
+        {stream{{base + 16, page('a')}}, "unaligned block"},
+        {stream{{base, 'abc'}}, "unaligned block"},
+        {valid .. valid, "unexpected block number"},
+    } do
+        local data, want = table.unpack(test)
+        local w = writer.new((new_dev()), {family_id = uf2.family_id_rp2040})
+        t:expect(t.mexpr(w):write(data)):eq{nil, want, errors.EINVAL}
+        t:expect(t.mexpr(w):finish()):eq{nil, want, errors.EINVAL}
+    end
+
+    for _, test in ipairs{
+        {valid:sub(1, 100), "incomplete block"},
+        {stream({{base, page('a')}}, {num_blocks = 2}), "incomplete image"},
+        {stream{{base, 'x', uf2.flag_noflash}}, "empty image"},
+    } do
+        local data, want = table.unpack(test)
+        local w = writer.new((new_dev()))
+        t:assert(w:write(data))
+        t:expect(t.mexpr(w):finish()):eq{nil, want, errors.EINVAL}
+    end
+end
+
+function test_verify(t)
+    local dev, buf = new_dev()
+    local w = writer.new(dev)
+    t:assert(w:write(stream{{base, page('a')}, {base + 256, page('b')}}))
+    mem.write(buf, 'x', 300)
+    t:expect(t.mexpr(w):finish())
+        :eq{nil, "verification failed", errors.ECORRUPT}
+end
+
+function test_yields(t)
+    local blocking = thread.blocking(false)
+    t:cleanup(function() thread.blocking(blocking) end)
+    local ticks = 0
+    local counter = thread.start(function()
+        while true do
+            ticks = ticks + 1
+            thread.yield()
+        end
+    end)
+    t:cleanup(function() counter:kill() end)
+    local blocks, pages = {}, {}
+    for i = 1, dev_size // 256 do
+        pages[i] = page(string.char(0x40 + i % 26))
+        blocks[i] = {base + (i - 1) * 256, pages[i]}
+    end
+    local w = writer.new((new_dev()))
+    t:assert(w:write(stream(blocks)))
+    t:expect(ticks):label("ticks"):gt(0)
+    ticks = 0
+    t:expect(t.mexpr(w):finish())
+        :eq{dev_size, bits.crc32(table.concat(pages))}
+    t:expect(ticks):label("ticks"):gt(0)
+end
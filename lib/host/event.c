@@ -3,11 +3,148 @@
 
 #include "mlua/thread.h"
 
+#include <assert.h>
+
+#include "lstate.h"
 #include "mlua/module.h"
 #include "mlua/platform.h"
+#include "mlua/trace.h"
+
+// The maximum number of pending events detached from the queue in a single
+// critical section during dispatching.
+#ifndef MLUA_EVENT_DISPATCH_BATCH
+#define MLUA_EVENT_DISPATCH_BATCH 16
+#endif
+
+// A pending event queue. The queue is a linked list, where the state of each
+// pending event contains a pointer to the next pending event, with the lower
+// bits set to EVENT_PENDING. The list is ordered by decreasing priority, and
+// events of the same priority are kept in FIFO order. Events that are made
+// pending are inserted after the last pending event of the same or a higher
+// priority, tracked in "tails", and event dispatching pops from the head.
+typedef struct EventQueue {
+    MLuaEvent* head;
+    MLuaEvent* tails[MLUA_EVENT_PRIORITIES];
+} EventQueue;
+
+static_assert(sizeof(EventQueue) <= LUA_EXTRASPACE, "LUA_EXTRASPACE too small");
+
+typedef enum EventState {
+    EVENT_IDLE = 0,
+    EVENT_PENDING = 1,
+    EVENT_ABANDONED = 2,
+    EVENT_MASK = 3,
+} EventState;
+
+static inline EventState event_state(MLuaEvent const* ev) {
+    return ev->state & EVENT_MASK;
+}
+
+static inline MLuaEvent* next_pending(MLuaEvent const* ev) {
+    return (MLuaEvent*)(ev->state & ~EVENT_MASK);
+}
+
+static inline EventQueue* get_queue(lua_State* ls) {
+    return (EventQueue*)lua_getextraspace(G(ls)->mainthread);
+}
 
-void mlua_event_dispatch(lua_State* ls, uint64_t deadline) {
+static void remove_pending_nolock(EventQueue* q, MLuaEvent const* ev) {
+    MLuaEvent* prev = NULL;
+    for (MLuaEvent* cur = q->head; cur != ev; cur = next_pending(cur)) {
+        if (cur == NULL) return;
+        prev = cur;
+    }
+    if (prev == NULL) {
+        q->head = next_pending(ev);
+    } else {
+        prev->state = ev->state;
+    }
+    MLuaEvent** tail = &q->tails[ev->priority];
+    if (*tail == ev) {
+        *tail = prev != NULL && prev->priority == ev->priority ? prev : NULL;
+    }
+}
+
+bool mlua_event_enable_priority(lua_State* ls, MLuaEvent* ev,
+                                unsigned int priority) {
+    EventQueue* q = get_queue(ls);
+    mlua_event_lock();
+    if (ev->state != 0) {
+        mlua_event_unlock();
+        return false;
+    }
+    ev->state = (uintptr_t)q;
+    ev->priority = priority;
+    mlua_event_unlock();
+    return true;
+}
+
+static void disable_event(lua_State* ls, MLuaEvent* ev, uintptr_t state) {
+    mlua_event_lock();
+    if (ev->state == 0) {
+        mlua_event_unlock();
+        return;
+    }
+    if (event_state(ev) == EVENT_PENDING) {
+        remove_pending_nolock(get_queue(ls), ev);
+    }
+    ev->state = state;
+    mlua_event_unlock();
+    mlua_event_remove_watcher(ls, ev);
+}
+
+void mlua_event_abandon(lua_State* ls, MLuaEvent* ev) {
+    disable_event(ls, ev, EVENT_ABANDONED);
+}
+
+void mlua_event_disable(lua_State* ls, MLuaEvent* ev) {
+    disable_event(ls, ev, 0);
+}
+
+void mlua_event_set_nolock(MLuaEvent* ev) {
+    if (ev->state == 0 || event_state(ev) != EVENT_IDLE) return;
+    mlua_trace(MLUA_TRACE_EVENT, (uintptr_t)ev);
+#if MLUA_THREAD_STATS
+    ev->time = (uint32_t)mlua_ticks();
+#endif
+    EventQueue* q = (EventQueue*)ev->state;
+    MLuaEvent* prev = NULL;
+    for (unsigned int p = ev->priority; p < MLUA_EVENT_PRIORITIES; ++p) {
+        if ((prev = q->tails[p]) != NULL) break;
+    }
+    if (prev == NULL) {
+        ev->state = (uintptr_t)q->head | EVENT_PENDING;
+        q->head = ev;
+    } else {
+        ev->state = prev->state;
+        prev->state = (uintptr_t)ev | EVENT_PENDING;
+    }
+    q->tails[ev->priority] = ev;
+    mlua_platform_sev();
+}
+
+bool mlua_event_disable_abandoned(MLuaEvent* ev) {
+    mlua_event_lock();
+    bool res = ev->state == EVENT_ABANDONED;
+    if (res) ev->state = 0;
+    mlua_event_unlock();
+    return res;
+}
+
+#if MLUA_THREAD_STATS
+
+// Return the histogram bucket for a dispatch batch size.
+static inline unsigned int batch_bucket(unsigned int n) {
+    unsigned int bucket = 31 - __builtin_clz(n);
+    return bucket < MLUA_THREAD_BATCH_BUCKETS ? bucket
+                                              : MLUA_THREAD_BATCH_BUCKETS - 1;
+}
+
+#endif
+
+void mlua_event_dispatch(lua_State* ls, uint64_t deadline, bool precise) {
     bool wake = deadline == MLUA_TICKS_MIN;
+    EventQueue* q = get_queue(ls);
 #if MLUA_THREAD_STATS
     MLuaGlobal* g = mlua_global(ls);
 #endif
@@ -16,6 +153,33 @@ void mlua_event_dispatch(lua_State* ls, uint64_t deadline) {
         ++g->thread_dispatches;
 #endif
 
+        // Check for pending events and resume their watchers. Pending events
+        // are detached from the queue in batches, in a single critical section
+        // per batch, and their watchers are resumed outside of the lock.
+        for (;;) {
+            MLuaEvent* batch[MLUA_EVENT_DISPATCH_BATCH];
+            unsigned int n = 0;
+            mlua_event_lock();
+            MLuaEvent* ev = q->head;
+            while (ev != NULL && n < MLUA_EVENT_DISPATCH_BATCH) {
+                MLuaEvent* next = next_pending(ev);
+                if (q->tails[ev->priority] == ev) q->tails[ev->priority] = NULL;
+                ev->state = (uintptr_t)q;
+                batch[n++] = ev;
+                ev = next;
+            }
+            q->head = ev;
+            mlua_event_unlock();
+            if (n == 0) break;
+            mlua_trace(MLUA_TRACE_DISPATCH, n);
+#if MLUA_THREAD_STATS
+            ++g->thread_dispatch_batches[batch_bucket(n)];
+#endif
+            for (unsigned int i = 0; i < n; ++i) {
+                if (mlua_event_resume_watcher(ls, batch[i])) wake = true;
+            }
+        }
+
         // Return if at least one thread was resumed or the deadline has passed.
         if (wake || mlua_ticks64_reached(deadline)) return;
         wake = false;
@@ -24,6 +188,8 @@ void mlua_event_dispatch(lua_State* ls, uint64_t deadline) {
 #if MLUA_THREAD_STATS
         ++g->thread_waits;
 #endif
+        mlua_trace(MLUA_TRACE_WAIT, 0);
         mlua_wait(deadline);
+        mlua_trace(MLUA_TRACE_WAKE, 0);
     }
 }
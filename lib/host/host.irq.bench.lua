@@ -0,0 +1,47 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local irq = require 'host.irq'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+
+-- Measure the round-trip time from triggering an emulated IRQ to running its
+-- handler thread, through the pending event queue.
+function bench_irq_round_trip(b)
+    local num, count = 0, 0
+    local current = thread.running()
+    irq.set_handler(num, function()
+        count = count + 1
+        current:resume()
+    end)
+    local done<close> = function()
+        irq.set_enabled(num, false)
+        irq.remove_handler(num)
+    end
+    irq.set_enabled(num, true)
+    b:reset()
+    for i = 1, b.n do
+        irq.set_pending(num)
+        while count < i do thread.suspend() end
+    end
+end
+
+-- Measure the dispatch overhead of a periodic emulated timer IRQ, while the
+-- main thread yields in a loop.
+function bench_timer_irq(b)
+    local num, count = 1, 0
+    irq.set_handler(num, function() count = count + 1 end)
+    local done<close> = function()
+        irq.set_timer(num)
+        irq.set_enabled(num, false)
+        irq.remove_handler(num)
+    end
+    irq.set_enabled(num, true)
+    irq.set_timer(num, 100 * time.usec)
+    local yield = thread.yield
+    b:reset()
+    for i = 1, b.n do yield() end
+    b:metric('irqs', count)
+end
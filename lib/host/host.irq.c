@@ -0,0 +1,277 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/module.h"
+#include "mlua/platform.h"
+#include "mlua/thread.h"
+#include "mlua/trace.h"
+#include "mlua/util.h"
+
+// The number of emulated IRQs.
+#define NUM_IRQS 8
+
+// The state of the emulated interrupt controller. The controller runs on its
+// own POSIX thread, and raises IRQs when they are triggered by set_pending() or
+// when their timer expires. Raised IRQs are handled with emulated interrupts
+// disabled, like a handler running in interrupt context on a device.
+typedef struct IRQState {
+    // Protected by ctrl_mutex.
+    uint64_t deadlines[NUM_IRQS];   // The next timer expiry, or MLUA_TICKS_MAX
+    uint64_t periods[NUM_IRQS];     // The timer period, or zero
+    uint32_t triggers;              // The IRQs to raise as soon as possible
+    bool started;
+
+    // Protected by mlua_platform_irq_save().
+    uint32_t enabled;
+    uint32_t pending;
+    MLuaEvent events[NUM_IRQS];
+} IRQState;
+
+static_assert(NUM_IRQS <= 8 * sizeof(uint32_t), "IRQ bitmasks too small");
+
+static IRQState irq_state;
+static pthread_mutex_t ctrl_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ctrl_cond;
+
+static __attribute__((constructor)) void init(void) {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&ctrl_cond, &attr);
+    pthread_condattr_destroy(&attr);
+    for (int i = 0; i < NUM_IRQS; ++i) irq_state.deadlines[i] = MLUA_TICKS_MAX;
+}
+
+static unsigned int check_irq(lua_State* ls, int index) {
+    lua_Unsigned irq = luaL_checkinteger(ls, index);
+    luaL_argcheck(ls, irq < NUM_IRQS, index, "invalid IRQ");
+    return irq;
+}
+
+// Raise IRQs. This runs on the controller thread, and emulates the interrupt
+// entry: enabled IRQs are set pending and their events are set, with emulated
+// interrupts disabled. Disabled IRQs remain pending until they are cleared.
+static void raise_irqs(uint32_t mask) {
+    IRQState* state = &irq_state;
+    uint32_t save = mlua_platform_irq_save();
+    state->pending |= mask;
+    mask &= state->enabled;
+    for (unsigned int irq = 0; mask != 0; ++irq, mask >>= 1) {
+        if ((mask & 1) == 0) continue;
+        // Trace IRQs as exception numbers, like on a device.
+        mlua_trace(MLUA_TRACE_IRQ, 16 + irq);
+        mlua_event_set_nolock(&state->events[irq]);
+    }
+    mlua_platform_irq_restore(save);
+}
+
+// Wait on the controller condition variable, up to the given deadline. Returns
+// immediately if the deadline has already passed.
+static void wait_ctrl(uint64_t deadline) {
+    if (deadline == MLUA_TICKS_MAX) {
+        pthread_cond_wait(&ctrl_cond, &ctrl_mutex);
+        return;
+    }
+    uint64_t now = mlua_ticks64();
+    if (deadline <= now) return;
+    uint64_t timeout = deadline - now;
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    ts.tv_sec += timeout / 1000000u;
+    ts.tv_nsec += (timeout % 1000000u) * 1000u;
+    if (ts.tv_nsec >= 1000000000) {
+        ++ts.tv_sec;
+        ts.tv_nsec -= 1000000000;
+    }
+    pthread_cond_timedwait(&ctrl_cond, &ctrl_mutex, &ts);
+}
+
+static void* controller(void* arg) {
+    IRQState* state = &irq_state;
+    pthread_mutex_lock(&ctrl_mutex);
+    for (;;) {
+        // Collect the triggered IRQs and the expired timers.
+        uint32_t mask = state->triggers;
+        state->triggers = 0;
+        uint64_t now = mlua_ticks64();
+        uint64_t next = MLUA_TICKS_MAX;
+        for (int i = 0; i < NUM_IRQS; ++i) {
+            uint64_t* deadline = &state->deadlines[i];
+            if (*deadline <= now) {
+                mask |= 1u << i;
+                // Missed expiries are coalesced, like a hardware timer.
+                *deadline += state->periods[i];
+                if (*deadline <= now) *deadline = now + state->periods[i];
+            }
+            if (*deadline < next) next = *deadline;
+        }
+
+        // Raise the IRQs outside of the controller lock, or wait for the next
+        // trigger or timer expiry.
+        if (mask != 0) {
+            pthread_mutex_unlock(&ctrl_mutex);
+            raise_irqs(mask);
+            pthread_mutex_lock(&ctrl_mutex);
+            continue;
+        }
+        wait_ctrl(next);
+    }
+    return NULL;
+}
+
+// Update the controller state. Must be called with ctrl_mutex held. Starts the
+// controller thread if it isn't running yet.
+static void notify_ctrl(lua_State* ls) {
+    IRQState* state = &irq_state;
+    if (!state->started) {
+        pthread_t th;
+        if (pthread_create(&th, NULL, &controller, NULL) != 0) {
+            pthread_mutex_unlock(&ctrl_mutex);
+            luaL_error(ls, "failed to start the interrupt controller");
+            return;
+        }
+        pthread_detach(th);
+        state->started = true;
+    }
+    pthread_cond_signal(&ctrl_cond);
+}
+
+static int handle_irq_event(lua_State* ls) {
+    IRQState* state = &irq_state;
+    unsigned int irq = lua_tointeger(ls, lua_upvalueindex(1));
+    uint32_t mask = 1u << irq;
+    uint32_t save = mlua_platform_irq_save();
+    uint32_t pending = state->pending;
+    state->pending &= ~mask;
+    mlua_platform_irq_restore(save);
+    if ((pending & mask) == 0) return 0;
+
+    // Call the handler
+    lua_pushvalue(ls, lua_upvalueindex(2));  // handler
+    lua_pushinteger(ls, irq);
+    return mlua_callk(ls, 1, 0, mlua_cont_return, 0);
+}
+
+static int irq_handler_done(lua_State* ls) {
+    unsigned int irq = lua_tointeger(ls, lua_upvalueindex(1));
+    mlua_event_disable(ls, &irq_state.events[irq]);
+    return 0;
+}
+
+static int mod_set_handler(lua_State* ls) {
+    unsigned int irq = check_irq(ls, 1);
+    lua_Unsigned priority = luaL_optinteger(ls, 3, 0);
+    luaL_argcheck(ls, priority < MLUA_EVENT_PRIORITIES, 3, "invalid priority");
+    MLuaEvent* ev = &irq_state.events[irq];
+    if (!mlua_event_enable_priority(ls, ev, priority)) {
+        return luaL_error(ls, "IRQ%d: handler already set", irq);
+    }
+
+    // Start the event handler thread.
+    lua_pushvalue(ls, 1);  // irq
+    lua_pushvalue(ls, 2);  // handler
+    lua_pushcclosure(ls, &handle_irq_event, 2);
+    lua_pushvalue(ls, 1);  // irq
+    lua_pushcclosure(ls, &irq_handler_done, 1);
+    return mlua_event_handle(ls, ev, &mlua_cont_return, 1);
+}
+
+static int mod_remove_handler(lua_State* ls) {
+    mlua_event_stop_handler(ls, &irq_state.events[check_irq(ls, 1)]);
+    return 0;
+}
+
+static int mod_set_enabled(lua_State* ls) {
+    unsigned int irq = check_irq(ls, 1);
+    bool enabled = mlua_to_cbool(ls, 2);
+    uint32_t mask = 1u << irq;
+    uint32_t save = mlua_platform_irq_save();
+    if (enabled) {
+        // Clear pending state before enabling, like irq_set_enabled().
+        irq_state.pending &= ~mask;
+        irq_state.enabled |= mask;
+    } else {
+        irq_state.enabled &= ~mask;
+    }
+    mlua_platform_irq_restore(save);
+    return 0;
+}
+
+static int mod_is_enabled(lua_State* ls) {
+    uint32_t mask = 1u << check_irq(ls, 1);
+    uint32_t save = mlua_platform_irq_save();
+    bool enabled = (irq_state.enabled & mask) != 0;
+    mlua_platform_irq_restore(save);
+    return lua_pushboolean(ls, enabled), 1;
+}
+
+static int mod_set_pending(lua_State* ls) {
+    unsigned int irq = check_irq(ls, 1);
+    pthread_mutex_lock(&ctrl_mutex);
+    irq_state.triggers |= 1u << irq;
+    notify_ctrl(ls);
+    pthread_mutex_unlock(&ctrl_mutex);
+    return 0;
+}
+
+static int mod_is_pending(lua_State* ls) {
+    uint32_t mask = 1u << check_irq(ls, 1);
+    pthread_mutex_lock(&ctrl_mutex);
+    bool pending = (irq_state.triggers & mask) != 0;
+    pthread_mutex_unlock(&ctrl_mutex);
+    uint32_t save = mlua_platform_irq_save();
+    if (irq_state.pending & mask) pending = true;
+    mlua_platform_irq_restore(save);
+    return lua_pushboolean(ls, pending), 1;
+}
+
+static int mod_clear(lua_State* ls) {
+    uint32_t mask = 1u << check_irq(ls, 1);
+    pthread_mutex_lock(&ctrl_mutex);
+    irq_state.triggers &= ~mask;
+    pthread_mutex_unlock(&ctrl_mutex);
+    uint32_t save = mlua_platform_irq_save();
+    irq_state.pending &= ~mask;
+    mlua_platform_irq_restore(save);
+    return 0;
+}
+
+static int mod_set_timer(lua_State* ls) {
+    unsigned int irq = check_irq(ls, 1);
+    lua_Integer period = luaL_optinteger(ls, 2, 0);
+    luaL_argcheck(ls, period >= 0, 2, "invalid period");
+    pthread_mutex_lock(&ctrl_mutex);
+    irq_state.periods[irq] = period;
+    irq_state.deadlines[irq] = period > 0 ? mlua_ticks64() + period
+                                          : MLUA_TICKS_MAX;
+    notify_ctrl(ls);
+    pthread_mutex_unlock(&ctrl_mutex);
+    return 0;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_V(NUM_IRQS, integer, NUM_IRQS),
+
+    MLUA_SYM_F(set_handler, mod_),
+    MLUA_SYM_F(remove_handler, mod_),
+    MLUA_SYM_F(set_enabled, mod_),
+    MLUA_SYM_F(is_enabled, mod_),
+    MLUA_SYM_F(set_pending, mod_),
+    MLUA_SYM_F(is_pending, mod_),
+    MLUA_SYM_F(clear, mod_),
+    MLUA_SYM_F(set_timer, mod_),
+};
+
+MLUA_OPEN_MODULE(host.irq) {
+    mlua_thread_require(ls);
+    mlua_new_module(ls, 0, module_syms);
+    return 1;
+}
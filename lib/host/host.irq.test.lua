@@ -0,0 +1,104 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local irq = require 'host.irq'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local util = require 'mlua.util'
+
+-- Wait until a condition is fulfilled, or until a timeout expires.
+local function wait_for(cond, timeout)
+    local deadline = time.ticks() + (timeout or 100 * time.msec)
+    while not cond() do
+        if time.ticks() >= deadline then return false end
+        time.sleep_for(time.msec)
+    end
+    return true
+end
+
+function test_pending(t)
+    local num = 0
+    irq.set_enabled(num, false)
+    irq.clear(num)
+    t:expect(t.expr(irq).is_pending(num)):eq(false)
+    irq.set_pending(num)
+    t:expect(wait_for(function() return irq.is_pending(num) end),
+             "IRQ%d didn't become pending", num)
+    irq.clear(num)
+    t:expect(t.expr(irq).is_pending(num)):eq(false)
+end
+
+function test_handlers(t)
+    local rounds = 10
+
+    -- Set up IRQ handlers.
+    local counts = {}
+    for num = 0, irq.NUM_IRQS - 1 do
+        counts[num] = 0
+        irq.set_handler(num, function(n) counts[n] = counts[n] + 1 end)
+        t:cleanup(function() irq.remove_handler(num) end)
+        irq.set_enabled(num, true)
+        t:cleanup(function() irq.set_enabled(num, false) end)
+    end
+    t:expect(t.expr(irq).set_handler(0, function() end))
+        :raises("IRQ0: handler already set")
+
+    -- Trigger IRQs.
+    for i = 1, rounds do
+        for num = 0, irq.NUM_IRQS - 1 do irq.set_pending(num) end
+        t:assert(wait_for(function()
+            for num = 0, irq.NUM_IRQS - 1 do
+                if counts[num] < i then return false end
+            end
+            return true
+        end), "IRQ handlers not called on round %s", i)
+        for num = 0, irq.NUM_IRQS - 1 do
+            t:expect(counts[num]):label("counts[%s]", num):eq(i)
+        end
+    end
+end
+
+function test_priorities(t)
+    -- Set up a low-priority and a high-priority handler.
+    local low, high, log = 0, 1, {}
+    for _, num in ipairs{low, high} do
+        irq.set_handler(num, function(n) log[#log + 1] = n end, num)
+        t:cleanup(function() irq.remove_handler(num) end)
+        irq.set_enabled(num, true)
+        t:cleanup(function() irq.set_enabled(num, false) end)
+    end
+    t:expect(t.expr(irq).set_handler(2, function() end, 2))
+        :raises("invalid priority")
+
+    -- Raise both IRQs without yielding, so that they are dispatched together.
+    -- The high-priority handler must run first.
+    for _, num in ipairs{low, high} do
+        irq.set_pending(num)
+        local deadline = time.ticks() + 10 * time.msec
+        repeat until time.ticks() >= deadline
+    end
+    t:assert(wait_for(function() return #log >= 2 end),
+             "IRQ handlers not called")
+    t:expect(log):label("log"):eq({high, low}, util.table_eq)
+end
+
+function test_timer(t)
+    local num, count = 1, 0
+    irq.set_handler(num, function() count = count + 1 end)
+    t:cleanup(function() irq.remove_handler(num) end)
+    irq.set_enabled(num, true)
+    t:cleanup(function() irq.set_enabled(num, false) end)
+    irq.set_timer(num, 2 * time.msec)
+    t:cleanup(function() irq.set_timer(num) end)
+    t:expect(wait_for(function() return count >= 5 end),
+             "Timer IRQ handler called %s times", count)
+
+    -- Stop the timer.
+    irq.set_timer(num)
+    time.sleep_for(5 * time.msec)
+    local prev = count
+    time.sleep_for(10 * time.msec)
+    t:expect(count):label("count"):eq(prev)
+end
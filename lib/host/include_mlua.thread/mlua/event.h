@@ -9,21 +9,100 @@
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/platform.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
-// An event.
+// Lock event handling. This disables emulated interrupts.
+static inline void mlua_event_lock(void) { mlua_platform_irq_save(); }
+
+// Unlock event handling.
+static inline void mlua_event_unlock(void) { mlua_platform_irq_restore(0); }
+
+// The number of event priorities. Pending events with a higher priority are
+// dispatched first, and the watchers of events with a non-zero priority are
+// resumed ahead of the threads on the active queues.
+#ifndef MLUA_EVENT_PRIORITIES
+#define MLUA_EVENT_PRIORITIES 2
+#endif
+
+// An event. The state is a tagged union of two pointers:
+//  - If the state is zero, the event is disabled.
+//  - If the lower bits are EVENT_IDLE, the event is enabled and the state
+//    contains a pointer to the pending event queue.
+//  - If the lower bits are EVENT_PENDING, the event is pending and the state
+//    contains a pointer to the next pending event in the queue.
+//  - If the lower bits are EVENT_ABANDONED, the event was abandoned, and can be
+//    disabled with mlua_event_disable_abandoned().
+// The watcher is the index of the slot holding the thread waiting for the
+// event, or zero if no slot has been allocated. The priority is set when the
+// event is enabled. With MLUA_THREAD_STATS, the time is the low-order bits of
+// the microsecond ticks when the event was last set pending.
 typedef struct MLuaEvent {
-    uintptr_t dummy;
+    uintptr_t state;
+    int watcher;
+#if MLUA_THREAD_STATS
+    uint32_t time;
+#endif
+    uint8_t priority;
 } MLuaEvent;
 
+// Initialize an event.
+static inline void mlua_event_init(MLuaEvent* ev) {
+    ev->state = 0;
+    ev->watcher = 0;
+}
+
+// Enable an event with the given priority, in [0, MLUA_EVENT_PRIORITIES).
+// Returns false iff the event was already enabled.
+bool mlua_event_enable_priority(lua_State* ls, MLuaEvent* ev,
+                                unsigned int priority);
+
+// Enable an event with the default priority (zero). Returns false iff the
+// event was already enabled.
+static inline bool mlua_event_enable(lua_State* ls, MLuaEvent* ev) {
+    return mlua_event_enable_priority(ls, ev, 0);
+}
+
+// Abandon an event. This keeps the event enabled, but allows disabling it from
+// a non-Lua context with mlua_event_disable_abandoned().
+void mlua_event_abandon(lua_State* ls, MLuaEvent* ev);
+
+// Disable an event.
+void mlua_event_disable(lua_State* ls, MLuaEvent* ev);
+
+// Return true iff the event is enabled. Must be in a locked section.
+static inline bool mlua_event_enabled_nolock(MLuaEvent const* ev) {
+    return ev->state != 0;
+}
+
 // Return true iff the event is enabled.
-static inline bool mlua_event_enabled(MLuaEvent const* ev) { return false; }
+static inline bool mlua_event_enabled(MLuaEvent const* ev) {
+    mlua_event_lock();
+    bool en = ev->state != 0;
+    mlua_event_unlock();
+    return en;
+}
+
+// Set an event pending. Must be in a locked section. This can be called from
+// any thread, in particular from emulated interrupt handlers.
+void mlua_event_set_nolock(MLuaEvent* ev);
+
+// Set an event pending.
+static inline void mlua_event_set(MLuaEvent* ev) {
+    mlua_event_lock();
+    mlua_event_set_nolock(ev);
+    mlua_event_unlock();
+}
+
+// Disable an event, and return true, iff the event has been abandoned.
+bool mlua_event_disable_abandoned(MLuaEvent* ev);
 
-// Dispatch pending events.
-void mlua_event_dispatch(lua_State* ls, uint64_t deadline);
+// Dispatch pending events, waiting up to the given deadline. The "precise"
+// argument is ignored, as waits always end at the deadline.
+void mlua_event_dispatch(lua_State* ls, uint64_t deadline, bool precise);
 
 #ifdef __cplusplus
 }
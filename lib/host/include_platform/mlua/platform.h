@@ -4,6 +4,7 @@
 #ifndef _MLUA_LIB_HOST_PLATFORM_H
 #define _MLUA_LIB_HOST_PLATFORM_H
 
+#include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -17,6 +18,8 @@ extern "C" {
 #endif
 
 #define MLUA_HASH_SYMBOL_TABLES_DEFAULT 0
+#define MLUA_GC_PAUSE_DEFAULT 200
+#define MLUA_GC_STEPSIZE_DEFAULT 13
 
 #define MLUA_PLATFORM_REGISTER_MODULE(n)
 
@@ -30,6 +33,42 @@ static inline void mlua_platform_setup_main(int* argc, char* argv[]) {}
 // Perform set up after creating an interpreter.
 static inline void mlua_platform_setup_interpreter(lua_State* ls) {}
 
+// The number of cores of the platform.
+#define MLUA_PLATFORM_CORES 1
+
+// Return the number of the core executing the caller.
+static inline unsigned int mlua_platform_core_num(void) { return 0; }
+
+// Disable interrupts on the current core, and return the previous state.
+// Interrupts are emulated by POSIX threads, which run their handlers with a
+// recursive mutex held. Disabling interrupts locks the same mutex.
+static inline uint32_t mlua_platform_irq_save(void) {
+    extern pthread_mutex_t mlua_platform_irq_mutex;
+    pthread_mutex_lock(&mlua_platform_irq_mutex);
+    return 0;
+}
+
+// Restore the interrupt state returned by mlua_platform_irq_save().
+static inline void mlua_platform_irq_restore(uint32_t save) {
+    extern pthread_mutex_t mlua_platform_irq_mutex;
+    pthread_mutex_unlock(&mlua_platform_irq_mutex);
+}
+
+// Acquire the lock protecting data shared between cores. The host has a single
+// core, so this only excludes interrupts.
+static inline uint32_t mlua_platform_shared_lock(void) {
+    return mlua_platform_irq_save();
+}
+
+// Release the lock acquired by mlua_platform_shared_lock().
+static inline void mlua_platform_shared_unlock(uint32_t save) {
+    mlua_platform_irq_restore(save);
+}
+
+// Signal an event, waking up mlua_wait(). This can be called from any thread,
+// and is the equivalent of the SEV instruction.
+void mlua_platform_sev(void);
+
 // Return the current microsecond ticks, as given by a monotonic clock.
 uint64_t mlua_ticks64(void);
 
@@ -46,14 +85,31 @@ static inline bool mlua_ticks_reached(lua_Unsigned ticks) {
     return (mlua_ticks() - ticks) <= LUA_MAXINTEGER;
 }
 
-// Wait for an event, up to the given deadline. Returns true iff the deadline
-// was reached.
+// Return a high-resolution monotonic count. The host has no portable cycle
+// counter, so this counts nanoseconds.
+uint64_t mlua_cycles64(void);
+
+// Return the low-order 32 bits of mlua_cycles64().
+static inline uint32_t mlua_cycles(void) { return mlua_cycles64(); }
+
+// Return the frequency of the cycle counter, in Hz.
+static inline uint32_t mlua_cycles_freq(void) { return 1000000000u; }
+
+// Wait for an event signalled by mlua_platform_sev(), up to the given deadline.
+// Returns true iff the deadline was reached.
 bool mlua_wait(uint64_t deadline);
 
 // Return a description of the flash memory of the platform, or NULL if the
 // platform doesn't have flash memory.
 static inline MLuaFlash const* mlua_platform_flash(void) { return NULL; }
 
+// Update a checksum state with a block of memory using hardware acceleration.
+// Returns false if the checksum must be computed in software.
+static inline bool mlua_platform_checksum(MLuaChecksum algo, void const* ptr,
+                                          size_t len, uint32_t* state) {
+    return false;
+}
+
 #ifdef __cplusplus
 }
 #endif
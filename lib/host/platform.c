@@ -11,6 +11,30 @@
 #define CLOCK CLOCK_MONOTONIC
 #endif
 
+pthread_mutex_t mlua_platform_irq_mutex;
+
+// The SEV emulation. The event flag is set by mlua_platform_sev(), and cleared
+// by mlua_wait().
+static pthread_mutex_t wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wait_cond;
+static bool wait_event;
+
+static __attribute__((constructor)) void init(void) {
+    pthread_mutexattr_t mattr;
+    pthread_mutexattr_init(&mattr);
+    pthread_mutexattr_settype(&mattr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&mlua_platform_irq_mutex, &mattr);
+    pthread_mutexattr_destroy(&mattr);
+
+    // Condition variables don't support CLOCK_BOOTTIME, so timed waits use
+    // CLOCK_MONOTONIC and a timeout relative to the current time.
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&wait_cond, &cattr);
+    pthread_condattr_destroy(&cattr);
+}
+
 uint64_t mlua_ticks64(void) {
     struct timespec ts;
     clock_gettime(CLOCK, &ts);
@@ -23,8 +47,44 @@ lua_Unsigned mlua_ticks(void) {
     return (lua_Unsigned)ts.tv_sec * 1000000u + ts.tv_nsec / 1000u;
 }
 
+uint64_t mlua_cycles64(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+void mlua_platform_sev(void) {
+    pthread_mutex_lock(&wait_mutex);
+    wait_event = true;
+    pthread_cond_broadcast(&wait_cond);
+    pthread_mutex_unlock(&wait_mutex);
+}
+
 bool mlua_wait(uint64_t deadline) {
-    struct timespec ts = {.tv_sec = deadline / 1000000u,
-                          .tv_nsec = (deadline % 1000000u) * 1000u};
-    return clock_nanosleep(CLOCK, TIMER_ABSTIME, &ts, NULL) == 0;
+    bool reached = false;
+    pthread_mutex_lock(&wait_mutex);
+    while (!wait_event) {
+        if (deadline == MLUA_TICKS_MAX) {
+            pthread_cond_wait(&wait_cond, &wait_mutex);
+            continue;
+        }
+        uint64_t now = mlua_ticks64();
+        if (now >= deadline) {
+            reached = true;
+            break;
+        }
+        uint64_t timeout = deadline - now;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        ts.tv_sec += timeout / 1000000u;
+        ts.tv_nsec += (timeout % 1000000u) * 1000u;
+        if (ts.tv_nsec >= 1000000000) {
+            ++ts.tv_sec;
+            ts.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&wait_cond, &wait_mutex, &ts);
+    }
+    wait_event = false;
+    pthread_mutex_unlock(&wait_mutex);
+    return reached;
 }
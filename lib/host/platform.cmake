@@ -13,5 +13,5 @@ endmacro()
 
 function(mlua_add_executable_platform TARGET)
     target_compile_definitions("${TARGET}" PRIVATE LUA_USE_POSIX)
-    target_link_libraries("${TARGET}" PRIVATE m)
+    target_link_libraries("${TARGET}" PRIVATE m pthread)
 endfunction()
@@ -0,0 +1,11 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include "mlua/profile.h"
+
+// The host doesn't provide a sampling timer.
+bool mlua_profile_timer_start(uint32_t period, void (*handler)(void)) {
+    return false;
+}
+
+void mlua_profile_timer_stop(void) {}
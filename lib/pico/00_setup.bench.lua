@@ -0,0 +1,15 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local uart = require 'hardware.uart'
+local stdlib = require 'pico.stdlib'
+
+function set_up(t)
+    -- Run the benchmarks at the same clock speed as the unit tests.
+    local u = uart.default
+    if u then u:tx_wait_blocking() end
+    stdlib.set_sys_clock_khz(250000, true)
+    if u then u:set_baudrate(uart.DEFAULT_BAUD_RATE) end
+end
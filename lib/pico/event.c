@@ -5,11 +5,19 @@
 
 #include <assert.h>
 
+#include "hardware/timer.h"
 #include "pico/platform.h"
 
 #include "lstate.h"
 #include "mlua/module.h"
 #include "mlua/platform.h"
+#include "mlua/trace.h"
+
+// The maximum number of pending events detached from the queue in a single
+// critical section during dispatching.
+#ifndef MLUA_EVENT_DISPATCH_BATCH
+#define MLUA_EVENT_DISPATCH_BATCH 16
+#endif
 
 spin_lock_t* mlua_event_spinlock;
 uint32_t mlua_event_lock_save;
@@ -18,13 +26,15 @@ static __attribute__((constructor)) void init(void) {
     mlua_event_spinlock = spin_lock_init(PICO_SPINLOCK_ID_OS1);
 }
 
-// A pending event queue. Events that are made pending are pushed to the tail,
-// and event dispatching pops from the head. The queue is a linked list, where
-// the state of each pending event contains a pointer to the next pending event,
-// with the lower bits set to EVENT_PENDING.
+// A pending event queue. The queue is a linked list, where the state of each
+// pending event contains a pointer to the next pending event, with the lower
+// bits set to EVENT_PENDING. The list is ordered by decreasing priority, and
+// events of the same priority are kept in FIFO order. Events that are made
+// pending are inserted after the last pending event of the same or a higher
+// priority, tracked in "tails", and event dispatching pops from the head.
 typedef struct EventQueue {
     MLuaEvent* head;
-    MLuaEvent* tail;
+    MLuaEvent* tails[MLUA_EVENT_PRIORITIES];
 } EventQueue;
 
 static_assert(sizeof(EventQueue) <= LUA_EXTRASPACE, "LUA_EXTRASPACE too small");
@@ -49,22 +59,24 @@ static inline EventQueue* get_queue(lua_State* ls) {
 }
 
 static void remove_pending_nolock(EventQueue* q, MLuaEvent const* ev) {
-    if (q->head == ev) {
+    MLuaEvent* prev = NULL;
+    for (MLuaEvent* cur = q->head; cur != ev; cur = next_pending(cur)) {
+        if (cur == NULL) return;
+        prev = cur;
+    }
+    if (prev == NULL) {
         q->head = next_pending(ev);
-        return;
+    } else {
+        prev->state = ev->state;
     }
-    for (MLuaEvent* cur = q->head;;) {
-        MLuaEvent* next = next_pending(cur);
-        if (next == NULL) break;
-        if (next == ev) {
-            cur->state = ev->state;
-            break;
-        }
-        cur = next;
+    MLuaEvent** tail = &q->tails[ev->priority];
+    if (*tail == ev) {
+        *tail = prev != NULL && prev->priority == ev->priority ? prev : NULL;
     }
 }
 
-bool mlua_event_enable(lua_State* ls, MLuaEvent* ev) {
+bool mlua_event_enable_priority(lua_State* ls, MLuaEvent* ev,
+                                unsigned int priority) {
     EventQueue* q = get_queue(ls);
     mlua_event_lock();
     if (ev->state != 0) {
@@ -72,6 +84,7 @@ bool mlua_event_enable(lua_State* ls, MLuaEvent* ev) {
         return false;
     }
     ev->state = (uintptr_t)q;
+    ev->priority = priority;
     mlua_event_unlock();
     return true;
 }
@@ -100,14 +113,27 @@ void mlua_event_disable(lua_State* ls, MLuaEvent* ev) {
 
 void __time_critical_func(mlua_event_set_nolock)(MLuaEvent* ev) {
     if (ev->state == 0 || event_state(ev) != EVENT_IDLE) return;
+#if MLUA_TRACE
+    uint exc = __get_current_exception();
+    if (exc != 0) mlua_trace(MLUA_TRACE_IRQ, exc);
+    mlua_trace(MLUA_TRACE_EVENT, (uintptr_t)ev);
+#endif
+#if MLUA_THREAD_STATS
+    ev->time = time_us_32();
+#endif
     EventQueue* q = (EventQueue*)ev->state;
-    ev->state = (uintptr_t)NULL | EVENT_PENDING;
-    if (q->head == NULL) {
-        q->head = q->tail = ev;
+    MLuaEvent* prev = NULL;
+    for (unsigned int p = ev->priority; p < MLUA_EVENT_PRIORITIES; ++p) {
+        if ((prev = q->tails[p]) != NULL) break;
+    }
+    if (prev == NULL) {
+        ev->state = (uintptr_t)q->head | EVENT_PENDING;
+        q->head = ev;
     } else {
-        q->tail->state = (uintptr_t)ev | EVENT_PENDING;
-        q->tail = ev;
+        ev->state = prev->state;
+        prev->state = (uintptr_t)ev | EVENT_PENDING;
     }
+    q->tails[ev->priority] = ev;
     __sev();
 }
 
@@ -119,7 +145,55 @@ bool mlua_event_disable_abandoned(MLuaEvent* ev) {
     return res;
 }
 
-void mlua_event_dispatch(lua_State* ls, uint64_t deadline) {
+#if MLUA_THREAD_STATS
+
+// Return the histogram bucket for a dispatch batch size.
+static inline uint batch_bucket(uint n) {
+    uint bucket = 31 - __builtin_clz(n);
+    return bucket < MLUA_THREAD_BATCH_BUCKETS ? bucket
+                                              : MLUA_THREAD_BATCH_BUCKETS - 1;
+}
+
+#endif
+
+#if PICO_ON_DEVICE
+
+// The hardware alarms used for precise wakeups, plus one, indexed by core. Zero
+// means that no alarm has been claimed yet.
+static uint8_t precise_alarms[NUM_CORES];
+
+static void __time_critical_func(handle_precise_alarm)(uint alarm) {
+    __sev();  // In case the alarm fires before the WFE
+}
+
+// Wait for events, up to the given deadline. A dedicated hardware alarm is set
+// at the deadline, so that the wait ends on time even if the default alarm pool
+// is busy or disabled. Falls back to mlua_wait() if no alarm is available.
+static void wait_precise(uint64_t deadline) {
+    uint8_t* alarm = &precise_alarms[get_core_num()];
+    if (*alarm == 0) {
+        int num = hardware_alarm_claim_unused(false);
+        if (num < 0) {
+            mlua_wait(deadline);
+            return;
+        }
+        hardware_alarm_set_callback(num, &handle_precise_alarm);
+        *alarm = num + 1;
+    }
+    if (hardware_alarm_set_target(*alarm - 1, from_us_since_boot(deadline))) {
+        return;  // The deadline has already passed
+    }
+    __wfe();
+    hardware_alarm_cancel(*alarm - 1);
+}
+
+#else
+
+static inline void wait_precise(uint64_t deadline) { mlua_wait(deadline); }
+
+#endif
+
+void mlua_event_dispatch(lua_State* ls, uint64_t deadline, bool precise) {
     bool wake = deadline == MLUA_TICKS_MIN;
     EventQueue* q = get_queue(ls);
 #if MLUA_THREAD_STATS
@@ -130,17 +204,31 @@ void mlua_event_dispatch(lua_State* ls, uint64_t deadline) {
         ++g->thread_dispatches;
 #endif
 
-        // Check for pending events and resume their watchers.
+        // Check for pending events and resume their watchers. Pending events
+        // are detached from the queue in batches, in a single critical section
+        // per batch, and their watchers are resumed outside of the lock.
         for (;;) {
+            MLuaEvent* batch[MLUA_EVENT_DISPATCH_BATCH];
+            uint n = 0;
             mlua_event_lock();
             MLuaEvent* ev = q->head;
-            if (ev != NULL) {
-                q->head = next_pending(ev);
+            while (ev != NULL && n < MLUA_EVENT_DISPATCH_BATCH) {
+                MLuaEvent* next = next_pending(ev);
+                if (q->tails[ev->priority] == ev) q->tails[ev->priority] = NULL;
                 ev->state = (uintptr_t)q;
+                batch[n++] = ev;
+                ev = next;
             }
+            q->head = ev;
             mlua_event_unlock();
-            if (ev == NULL) break;
-            if (mlua_event_resume_watcher(ls, ev)) wake = true;
+            if (n == 0) break;
+            mlua_trace(MLUA_TRACE_DISPATCH, n);
+#if MLUA_THREAD_STATS
+            ++g->thread_dispatch_batches[batch_bucket(n)];
+#endif
+            for (uint i = 0; i < n; ++i) {
+                if (mlua_event_resume_watcher(ls, batch[i])) wake = true;
+            }
         }
 
         // Return if at least one thread was resumed or the deadline has passed.
@@ -151,7 +239,13 @@ void mlua_event_dispatch(lua_State* ls, uint64_t deadline) {
 #if MLUA_THREAD_STATS
         ++g->thread_waits;
 #endif
-        mlua_wait(deadline);
+        mlua_trace(MLUA_TRACE_WAIT, 0);
+        if (precise && deadline != MLUA_TICKS_MAX) {
+            wait_precise(deadline);
+        } else {
+            mlua_wait(deadline);
+        }
+        mlua_trace(MLUA_TRACE_WAKE, 0);
     }
 }
 
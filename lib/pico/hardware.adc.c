@@ -2,17 +2,43 @@
 // SPDX-License-Identifier: MIT
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "hardware/adc.h"
+#include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "pico/platform.h"
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/hardware.dma.h"
+#include "mlua/int64.h"
 #include "mlua/module.h"
+#include "mlua/platform.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
 
+static char const Capture_name[] = "hardware.adc.Capture";
+
+// The state of a free-running capture. The buffer is split into two blocks,
+// each written by one of two DMA channels chained to each other. "blocks" is
+// the number of completed blocks, and "consumed" the number of blocks returned
+// by Capture:wait(). Capture objects hold the generation of the capture they
+// control, so that stale objects don't affect later captures.
+typedef struct CaptureState {
+    uint16_t* ptr;
+    uint32_t count;
+    uint8_t ch[2];
+    bool running;
+    uint32_t gen;
+    uint32_t volatile blocks;
+    uint32_t volatile fifo_overruns;
+    uint32_t consumed;
+    uint32_t overruns;
+} CaptureState;
+
+static CaptureState capture;
+
 static uint check_channel(lua_State* ls, int arg) {
     lua_Unsigned num = luaL_checkinteger(ls, arg);
     luaL_argcheck(ls, num < NUM_ADC_CHANNELS, arg, "invalid ADC channel");
@@ -23,6 +49,7 @@ static uint check_channel(lua_State* ls, int arg) {
 
 typedef struct ADCState {
     MLuaEvent event;
+    MLuaEvent capture_event;
 } ADCState;
 
 static ADCState adc_state;
@@ -42,6 +69,183 @@ static int mod_fifo_enable_irq(lua_State* ls) {
 
 #endif  // LIB_MLUA_MOD_MLUA_THREAD
 
+// Re-arm a DMA channel of a capture as its block completes. This is called
+// through the completion dispatcher of hardware.dma.
+static void __time_critical_func(handle_capture_dma)(uint ch, void* ctx) {
+    uint i = (uintptr_t)ctx;
+    dma_channel_set_write_addr(ch, capture.ptr + i * capture.count, false);
+    ++capture.blocks;
+    if ((adc_hw->fcs & ADC_FCS_OVER_BITS) != 0) {
+        hw_set_bits(&adc_hw->fcs, ADC_FCS_OVER_BITS);
+        ++capture.fifo_overruns;
+    }
+#if LIB_MLUA_MOD_MLUA_THREAD
+    mlua_event_set(&adc_state.capture_event);
+#endif
+}
+
+static void configure_capture_channel(uint i, bool trigger) {
+    uint ch = capture.ch[i];
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_16);
+    channel_config_set_read_increment(&cfg, false);
+    channel_config_set_write_increment(&cfg, true);
+    channel_config_set_dreq(&cfg, DREQ_ADC);
+    channel_config_set_chain_to(&cfg, capture.ch[i ^ 1]);
+    dma_channel_configure(ch, &cfg, capture.ptr + i * capture.count,
+                          &adc_hw->fifo, capture.count, trigger);
+}
+
+static void stop_capture(lua_State* ls) {
+    adc_run(false);
+    uint32_t mask = (1u << capture.ch[0]) | (1u << capture.ch[1]);
+    mlua_dma_clear_handler(capture.ch[0]);
+    mlua_dma_clear_handler(capture.ch[1]);
+    // Break the chain before aborting, so that aborting one channel doesn't
+    // trigger the other.
+    for (uint i = 0; i < 2; ++i) {
+        uint ch = capture.ch[i];
+        hw_write_masked(&dma_channel_hw_addr(ch)->al1_ctrl,
+                        ch << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB,
+                        DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS);
+    }
+    dma_hw->abort = mask;
+    while ((dma_hw->abort & mask) != 0) tight_loop_contents();
+    dma_hw->intr = mask;
+    dma_channel_unclaim(capture.ch[0]);
+    dma_channel_unclaim(capture.ch[1]);
+    adc_fifo_setup(false, false, 0, false, false);
+    adc_fifo_drain();
+    capture.running = false;
+#if LIB_MLUA_MOD_MLUA_THREAD
+    mlua_event_disable(ls, &adc_state.capture_event);
+#endif
+}
+
+static int mod_capture(lua_State* ls) {
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 1, &buf) && buf.vt == NULL
+                         && buf.size != SIZE_MAX, 1, "raw buffer");
+    luaL_argcheck(ls, buf.size >= 4 && buf.size % 4 == 0
+                      && ((uintptr_t)buf.ptr & 1) == 0, 1,
+                  "invalid buffer size or alignment");
+    if (!lua_isnoneornil(ls, 2)) {
+        luaL_checktype(ls, 2, LUA_TTABLE);
+        if (lua_getfield(ls, 2, "input") != LUA_TNIL) {
+            lua_Unsigned num = luaL_checkinteger(ls, -1);
+            luaL_argcheck(ls, num < NUM_ADC_CHANNELS, 2, "invalid ADC channel");
+            adc_select_input(num);
+        }
+        if (lua_getfield(ls, 2, "round_robin") != LUA_TNIL) {
+            adc_set_round_robin(luaL_checkinteger(ls, -1));
+        }
+        if (lua_getfield(ls, 2, "clkdiv") != LUA_TNIL) {
+            adc_set_clkdiv(luaL_checknumber(ls, -1));
+        }
+        lua_pop(ls, 3);
+    }
+    if (capture.running) return luaL_error(ls, "ADC: capture already running");
+
+    // Create the Capture object, which keeps the buffer alive.
+    uint32_t* gen = lua_newuserdatauv(ls, sizeof(uint32_t), 1);
+    *gen = capture.gen + 1;
+    lua_pushvalue(ls, 1);
+    lua_setiuservalue(ls, -2, 1);
+    luaL_getmetatable(ls, Capture_name);
+    lua_setmetatable(ls, -2);
+
+    int ch0 = dma_claim_unused_channel(false);
+    int ch1 = ch0 < 0 ? -1 : dma_claim_unused_channel(false);
+    if (ch1 < 0) {
+        if (ch0 >= 0) dma_channel_unclaim(ch0);
+        return luaL_error(ls, "ADC: no DMA channel available");
+    }
+    capture = (CaptureState){
+        .ptr = buf.ptr, .count = buf.size / 4, .ch = {ch0, ch1},
+        .running = true, .gen = *gen};
+#if LIB_MLUA_MOD_MLUA_THREAD
+    mlua_event_enable(ls, &adc_state.capture_event);
+#endif
+    mlua_dma_set_handler(ch0, &handle_capture_dma, (void*)0);
+    mlua_dma_set_handler(ch1, &handle_capture_dma, (void*)1);
+    configure_capture_channel(1, false);
+    configure_capture_channel(0, true);
+    adc_fifo_setup(true, true, 1, false, false);
+    adc_fifo_drain();
+    hw_set_bits(&adc_hw->fcs, ADC_FCS_OVER_BITS);
+    adc_run(true);
+    return 1;
+}
+
+// Return true iff the Capture at the given index controls a running capture.
+static bool check_Capture(lua_State* ls, int arg) {
+    uint32_t const* gen = luaL_checkudata(ls, arg, Capture_name);
+    return capture.running && *gen == capture.gen;
+}
+
+// Push the index and length of the next block.
+static int next_block(lua_State* ls) {
+    uint32_t blocks = capture.blocks;
+    if (blocks - capture.consumed > 1) {  // Older blocks were overwritten
+        capture.overruns += blocks - capture.consumed - 1;
+        capture.consumed = blocks - 1;
+    }
+    uint32_t i = capture.consumed++ & 1;
+    lua_pushinteger(ls, i * capture.count + 1);
+    lua_pushinteger(ls, capture.count);
+    return 2;
+}
+
+static int capture_wait_loop(lua_State* ls, bool timeout) {
+    if (capture.blocks != capture.consumed) return next_block(ls);
+    if (timeout) return 0;
+    return -1;
+}
+
+static int Capture_wait(lua_State* ls) {
+    if (!check_Capture(ls, 1)) return luaL_error(ls, "ADC: capture stopped");
+    lua_settop(ls, 2);  // Ensure deadline is set
+    bool has_deadline = !lua_isnil(ls, 2);
+    uint64_t deadline = has_deadline ? mlua_check_time(ls, 2) : MLUA_TICKS_MAX;
+#if LIB_MLUA_MOD_MLUA_THREAD
+    MLuaEvent* event = &adc_state.capture_event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        return mlua_event_wait(ls, event, 0, &capture_wait_loop,
+                               has_deadline ? 2 : 0);
+    }
+#endif
+    while (capture.blocks == capture.consumed) {
+        if (mlua_wait(deadline)) return 0;
+    }
+    return next_block(ls);
+}
+
+static int Capture_overruns(lua_State* ls) {
+    check_Capture(ls, 1);
+    lua_pushinteger(ls, capture.overruns);
+    lua_pushinteger(ls, capture.fifo_overruns);
+    return 2;
+}
+
+static int Capture_stop(lua_State* ls) {
+    if (check_Capture(ls, 1)) stop_capture(ls);
+    return 0;
+}
+
+MLUA_SYMBOLS(Capture_syms) = {
+    MLUA_SYM_F(wait, Capture_),
+    MLUA_SYM_F(overruns, Capture_),
+    MLUA_SYM_F(stop, Capture_),
+};
+
+#define Capture___close Capture_stop
+#define Capture___gc Capture_stop
+
+MLUA_SYMBOLS_NOHASH(Capture_syms_nh) = {
+    MLUA_SYM_F_NH(__close, Capture_),
+    MLUA_SYM_F_NH(__gc, Capture_),
+};
+
 static int fifo_get_loop(lua_State* ls, bool timeout) {
     if (adc_fifo_is_empty()) {
         adc_irq_set_enabled(true);
@@ -62,16 +266,16 @@ static int mod_fifo_get_blocking(lua_State* ls) {
 }
 
 MLUA_FUNC_V0(mod_, adc_, init)
-MLUA_FUNC_V1(mod_, adc_, gpio_init, luaL_checkinteger)
+MLUA_FUNC_V1(mod_, adc_, gpio_init, mlua_arg_integer)
 MLUA_FUNC_V1(mod_, adc_, select_input, check_channel)
 MLUA_FUNC_R0(mod_, adc_, get_selected_input, lua_pushinteger)
-MLUA_FUNC_V1(mod_, adc_, set_round_robin, luaL_checkinteger)
-MLUA_FUNC_V1(mod_, adc_, set_temp_sensor_enabled, mlua_to_cbool)
+MLUA_FUNC_V1(mod_, adc_, set_round_robin, mlua_arg_integer)
+MLUA_FUNC_V1(mod_, adc_, set_temp_sensor_enabled, mlua_arg_cbool)
 MLUA_FUNC_R0(mod_, adc_, read, lua_pushinteger)
-MLUA_FUNC_V1(mod_, adc_, run, mlua_to_cbool)
+MLUA_FUNC_V1(mod_, adc_, run, mlua_arg_cbool)
 MLUA_FUNC_V1(mod_, adc_, set_clkdiv, luaL_checknumber)
-MLUA_FUNC_V5(mod_, adc_, fifo_setup, mlua_to_cbool, mlua_to_cbool,
-             luaL_checkinteger, mlua_to_cbool, mlua_to_cbool)
+MLUA_FUNC_V5(mod_, adc_, fifo_setup, mlua_arg_cbool, mlua_arg_cbool,
+             mlua_arg_integer, mlua_arg_cbool, mlua_arg_cbool)
 MLUA_FUNC_R0(mod_, adc_, fifo_is_empty, lua_pushboolean)
 MLUA_FUNC_R0(mod_, adc_, fifo_get_level, lua_pushinteger)
 MLUA_FUNC_R0(mod_, adc_, fifo_get, lua_pushinteger)
@@ -94,11 +298,17 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(fifo_get_blocking, mod_),
     MLUA_SYM_F(fifo_drain, mod_),
     MLUA_SYM_F_THREAD(fifo_enable_irq, mod_),
+    MLUA_SYM_F(capture, mod_),
 };
 
 MLUA_OPEN_MODULE(hardware.adc) {
     mlua_thread_require(ls);
+    mlua_require(ls, "mlua.int64", false);
 
     mlua_new_module(ls, 0, module_syms);
+
+    // Create the Capture class.
+    mlua_new_class(ls, Capture_name, Capture_syms, Capture_syms_nh);
+    lua_pop(ls, 1);
     return 1;
 }
@@ -4,6 +4,7 @@
 _ENV = module(...)
 
 local adc = require 'hardware.adc'
+local array = require 'mlua.array'
 local thread = require 'mlua.thread'
 local time = require 'mlua.time'
 
@@ -56,3 +57,28 @@ function test_fifo_BNB(t)
                  "Temperature outside of [%.1f, %.1f]: %.1f", minT, maxT, temp)
     end
 end
+
+function test_capture_BNB(t)
+    adc.init()
+    adc.set_temp_sensor_enabled(true)
+    local arr = array('H', 64)
+    t:expect(t.expr(adc).capture(array('H', 3))):raises("invalid buffer size")
+    local cap<close> = adc.capture(arr, {input = input, clkdiv = 960 - 1})
+    t:expect(t.expr(adc).capture(arr)):raises("capture already running")
+    local want = 1
+    for i = 1, 10 do
+        local index, len = cap:wait()
+        t:expect(index):label("index"):eq(want)
+        t:expect(len):label("len"):eq(32)
+        local temp = to_celsius(arr[index + len - 1])
+        t:expect(minT <= temp and temp <= maxT,
+                 "Temperature outside of [%.1f, %.1f]: %.1f", minT, maxT, temp)
+        want = want == 1 and 33 or 1
+    end
+    t:expect(t.expr(cap):overruns()):eq(0)
+    time.sleep_for(5000)  -- Let blocks overrun
+    cap:wait()
+    t:expect(t.expr(cap):overruns()):gt(0)
+    cap:stop()
+    t:expect(t.expr(cap):wait()):raises("capture stopped")
+end
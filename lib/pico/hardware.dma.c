@@ -1,8 +1,12 @@
 // Copyright 2024 Remy Blank <remy@c-space.org>
 // SPDX-License-Identifier: MIT
 
+#include "mlua/hardware.dma.h"
+
 #include "hardware/address_mapped.h"
 #include "hardware/dma.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 #include "pico/platform.h"
 
 #include "lua.h"
@@ -59,25 +63,25 @@ static int Config_ctrl(lua_State* ls) {
 }
 
 MLUA_FUNC_S2(Config_, channel_config_, set_read_increment, check_Config,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 MLUA_FUNC_S2(Config_, channel_config_, set_write_increment, check_Config,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 MLUA_FUNC_S2(Config_, channel_config_, set_dreq, check_Config,
-             luaL_checkinteger)
+             mlua_arg_integer)
 MLUA_FUNC_S2(Config_, channel_config_, set_chain_to, check_Config,
              check_channel)
 MLUA_FUNC_S2(Config_, channel_config_, set_transfer_data_size, check_Config,
-             luaL_checkinteger)
-MLUA_FUNC_S3(Config_, channel_config_, set_ring, check_Config, mlua_to_cbool,
-             luaL_checkinteger)
-MLUA_FUNC_S2(Config_, channel_config_, set_bswap, check_Config, mlua_to_cbool)
+             mlua_arg_integer)
+MLUA_FUNC_S3(Config_, channel_config_, set_ring, check_Config, mlua_arg_cbool,
+             mlua_arg_integer)
+MLUA_FUNC_S2(Config_, channel_config_, set_bswap, check_Config, mlua_arg_cbool)
 MLUA_FUNC_S2(Config_, channel_config_, set_irq_quiet, check_Config,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 MLUA_FUNC_S2(Config_, channel_config_, set_high_priority, check_Config,
-             mlua_to_cbool)
-MLUA_FUNC_S2(Config_, channel_config_, set_enable, check_Config, mlua_to_cbool)
+             mlua_arg_cbool)
+MLUA_FUNC_S2(Config_, channel_config_, set_enable, check_Config, mlua_arg_cbool)
 MLUA_FUNC_S2(Config_, channel_config_, set_sniff_enable, check_Config,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 
 MLUA_SYMBOLS(Config_syms) = {
     MLUA_SYM_F(ctrl, Config_),
@@ -94,8 +98,6 @@ MLUA_SYMBOLS(Config_syms) = {
     MLUA_SYM_F(set_sniff_enable, Config_),
 };
 
-#if LIB_MLUA_MOD_MLUA_THREAD
-
 typedef struct DMAIntRegs {
     io_rw_32 inte;
     io_rw_32 intf;
@@ -104,27 +106,107 @@ typedef struct DMAIntRegs {
 
 #define INT_REGS(core) ((DMAIntRegs*)&dma_hw->inte0 + core)
 
+typedef struct DMAHandler {
+    MLuaDMAHandler fn;
+    void* ctx;
+} DMAHandler;
+
 typedef struct DMAState {
+    DMAHandler handlers[NUM_DMA_CHANNELS];
+    uint16_t volatile handled;  // Channels dispatched to a handler
+#if LIB_MLUA_MOD_MLUA_THREAD
     MLuaEvent events[NUM_DMA_CHANNELS];
     uint16_t pending[NUM_CORES];
+#endif
 } DMAState;
 
 static DMAState dma_state;
 
+// Dispatch the completion IRQs of the channels enabled on the current core.
+// Channels with a handler are dispatched to it, and the others set their event
+// and are recorded as pending for hardware.dma.wait_irq().
 static void __time_critical_func(handle_dma_irq)(void) {
     uint core = get_core_num();
     DMAIntRegs* ir = INT_REGS(core);
     uint32_t pending = ir->ints;
     if (pending == 0) return;
     ir->ints = pending;  // Clear pending IRQs
-    dma_state.pending[core] |= pending;
+    uint32_t handled = dma_state.handled;
+#if LIB_MLUA_MOD_MLUA_THREAD
+    dma_state.pending[core] |= pending & ~handled;
+#endif
     while (pending != 0) {
         uint ch = MLUA_CTZ(pending);
-        pending &= ~(1u << ch);
-        mlua_event_set(&dma_state.events[ch]);
+        uint32_t bm = 1u << ch;
+        pending &= ~bm;
+        if ((handled & bm) != 0) {
+            DMAHandler const* h = &dma_state.handlers[ch];
+            h->fn(ch, h->ctx);
+#if LIB_MLUA_MOD_MLUA_THREAD
+        } else {
+            mlua_event_set(&dma_state.events[ch]);
+#endif
+        }
     }
 }
 
+// Enable the IRQs of the given channels on a core, installing the IRQ handler
+// if necessary.
+static void enable_irqs(uint core, uint32_t mask, lua_Integer priority) {
+    DMAIntRegs* ir = INT_REGS(core);
+    if (ir->inte == 0) {
+        uint irq = DMA_IRQ_0 + core;
+        mlua_event_set_irq_handler(irq, &handle_dma_irq, priority);
+        irq_set_enabled(irq, true);
+    }
+    hw_set_bits(&ir->inte, mask);
+}
+
+// Disable the IRQs of the given channels on a core, removing the IRQ handler
+// when no channels remain enabled.
+static void disable_irqs(uint core, uint32_t mask) {
+    DMAIntRegs* ir = INT_REGS(core);
+    hw_clear_bits(&ir->inte, mask);
+    if (ir->inte == 0) {
+        uint irq = DMA_IRQ_0 + core;
+        irq_set_enabled(irq, false);
+        irq_remove_handler(irq, &handle_dma_irq);
+    }
+}
+
+void mlua_dma_set_handler(uint ch, MLuaDMAHandler handler, void* ctx) {
+    uint core = get_core_num();
+    uint32_t mask = 1u << ch;
+    DMAHandler* h = &dma_state.handlers[ch];
+    h->fn = handler;
+    h->ctx = ctx;
+    uint32_t save = save_and_disable_interrupts();
+    dma_state.handled |= mask;
+    restore_interrupts(save);
+    INT_REGS(core)->ints = mask;  // Clear pending IRQ
+    enable_irqs(core, mask, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+}
+
+void mlua_dma_clear_handler(uint ch) {
+    uint core = get_core_num();
+    uint32_t mask = 1u << ch;
+    if ((INT_REGS(core)->inte & mask) != 0) disable_irqs(core, mask);
+    INT_REGS(core)->ints = mask;  // Clear pending IRQ
+    uint32_t save = save_and_disable_interrupts();
+    dma_state.handled &= ~mask;
+    restore_interrupts(save);
+}
+
+#if LIB_MLUA_MOD_MLUA_THREAD
+
+static void __time_critical_func(set_event)(uint ch, void* ctx) {
+    mlua_event_set((MLuaEvent*)ctx);
+}
+
+void mlua_dma_set_event(uint ch, MLuaEvent* ev) {
+    mlua_dma_set_handler(ch, &set_event, ev);
+}
+
 #endif  // LIB_MLUA_MOD_MLUA_THREAD
 
 static int mod_channel_get_default_config(lua_State* ls) {
@@ -240,81 +322,231 @@ static void enable_events(lua_State* ls, uint32_t mask) {
 static int mod_enable_irq(lua_State* ls) {
     uint32_t mask = luaL_checkinteger(ls, 1) & MLUA_MASK(NUM_DMA_CHANNELS);
     uint core = get_core_num();
-    uint irq = DMA_IRQ_0 + core;
     DMAIntRegs* ir = INT_REGS(core);
     lua_Integer priority = -1;
     if (!mlua_event_enable_irq_arg(ls, 2, &priority)) {  // Disable IRQs
-        mask &= ir->inte;
+        mask &= ir->inte & ~dma_state.handled;
         if (mask == 0) return 0;
-        hw_clear_bits(&ir->inte, mask);
-        if (ir->inte == 0) {
-            irq_set_enabled(irq, false);
-            irq_remove_handler(irq, &handle_dma_irq);
-        }
+        disable_irqs(core, mask);
         disable_events(ls, mask);
         return 0;
     }
 
-    // Enable IRQs.
-    mask &= ~ir->inte;
+    // Enable IRQs. Channels whose IRQ is dispatched to a handler are skipped.
+    mask &= ~(ir->inte | dma_state.handled);
     if (mask == 0) return 0;
     enable_events(ls, mask);
     uint32_t save = save_and_disable_interrupts();
     dma_hw->intr = mask;  // Clear pending IRQs
     dma_state.pending[core] &= ~mask;
     restore_interrupts(save);
-    if (ir->inte == 0) {
-        mlua_event_set_irq_handler(irq, &handle_dma_irq, priority);
-        irq_set_enabled(irq, true);
-    }
-    hw_set_bits(&ir->inte, mask);
+    enable_irqs(core, mask, priority);
     return 0;
 }
 
 #endif  // LIB_MLUA_MOD_MLUA_THREAD
 
+static char const Chain_name[] = "hardware.dma.Chain";
+
+// A chain of transfers, run by a control channel that reprograms a data channel
+// from a list of control blocks. Each block holds the values to be written to
+// the AL3 registers of the data channel: CTRL, WRITE_ADDR, TRANS_COUNT and
+// READ_ADDR_TRIG. The list is terminated by a null trigger, which raises the
+// IRQ of the data channel.
+typedef struct Chain {
+    int8_t ctrl;
+    int8_t data;
+    uint count;
+    uint32_t blocks[][4];
+} Chain;
+
+static inline Chain* check_Chain(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Chain_name);
+}
+
+static Chain* check_active_Chain(lua_State* ls, int arg) {
+    Chain* chain = check_Chain(ls, arg);
+    luaL_argcheck(ls, chain->ctrl >= 0, arg, "chain is closed");
+    return chain;
+}
+
+static int mod_chain(lua_State* ls) {
+    luaL_checktype(ls, 1, LUA_TTABLE);
+    lua_Unsigned count = luaL_len(ls, 1);
+    luaL_argcheck(ls, count > 0, 1, "empty chain");
+    luaL_argcheck(ls, count < (SIZE_MAX - sizeof(Chain)) / 16 - 1, 1,
+                  "chain too long");
+    Chain* chain = lua_newuserdatauv(ls, sizeof(Chain) + (count + 1) * 16, 1);
+    chain->ctrl = chain->data = -1;
+    chain->count = count;
+    luaL_getmetatable(ls, Chain_name);
+    lua_setmetatable(ls, -2);
+    lua_pushvalue(ls, 1);  // Keep the segments and their buffers alive
+    lua_setiuservalue(ls, -2, 1);
+
+    int ctrl = dma_claim_unused_channel(false);
+    if (ctrl < 0) return luaL_error(ls, "DMA: no free channel");
+    int data = dma_claim_unused_channel(false);
+    if (data < 0) {
+        dma_channel_unclaim(ctrl);
+        return luaL_error(ls, "DMA: no free channel");
+    }
+    chain->ctrl = ctrl;
+    chain->data = data;
+
+    // Build the control blocks. The data channel chains to the control channel
+    // after each segment, and its completion IRQs are suppressed until the
+    // null trigger.
+    uint32_t ctrl_value = 0;
+    for (uint i = 0; i < count; ++i) {
+        lua_geti(ls, 1, i + 1);
+        int arg = lua_gettop(ls);
+        luaL_argexpected(ls, lua_istable(ls, arg), 1, "table of segments");
+        lua_geti(ls, arg, 1);
+        lua_geti(ls, arg, 2);
+        lua_geti(ls, arg, 3);
+        lua_geti(ls, arg, 4);
+        dma_channel_config cfg = *check_Config(ls, arg + 4);
+        channel_config_set_chain_to(&cfg, ctrl);
+        channel_config_set_irq_quiet(&cfg, true);
+        channel_config_set_enable(&cfg, true);
+        ctrl_value = channel_config_get_ctrl_value(&cfg);
+        uint32_t* blk = chain->blocks[i];
+        blk[0] = ctrl_value;
+        blk[1] = (uintptr_t)check_write_addr(ls, arg + 2);
+        blk[2] = luaL_checkinteger(ls, arg + 3);
+        blk[3] = (uintptr_t)check_read_addr(ls, arg + 1);
+        lua_settop(ls, arg - 1);
+    }
+    uint32_t* blk = chain->blocks[count];
+    blk[0] = ctrl_value;
+    blk[1] = blk[2] = blk[3] = 0;
+
+    // Configure the control channel to write one block at a time to the AL3
+    // registers of the data channel, wrapping around the 16-byte register set.
+    dma_channel_config cfg = dma_channel_get_default_config(ctrl);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, true);
+    channel_config_set_ring(&cfg, true, 4);
+    dma_channel_configure(ctrl, &cfg, &dma_hw->ch[data].al3_ctrl, NULL, 4,
+                          false);
+    return 1;
+}
+
+static int Chain_channels(lua_State* ls) {
+    Chain* chain = check_active_Chain(ls, 1);
+    lua_pushinteger(ls, chain->ctrl);
+    lua_pushinteger(ls, chain->data);
+    return 2;
+}
+
+static int Chain_start(lua_State* ls) {
+    Chain* chain = check_active_Chain(ls, 1);
+    if (dma_channel_is_busy(chain->ctrl) || dma_channel_is_busy(chain->data)) {
+        return luaL_error(ls, "DMA: chain already running");
+    }
+    uint16_t mask = 1u << chain->data;
+#if LIB_MLUA_MOD_MLUA_THREAD
+    uint32_t save = save_and_disable_interrupts();
+    dma_hw->intr = mask;
+    dma_state.pending[get_core_num()] &= ~mask;
+    restore_interrupts(save);
+#else
+    dma_hw->intr = mask;
+#endif
+    dma_channel_set_read_addr(chain->ctrl, chain->blocks, true);
+    return 0;
+}
+
+static int Chain_is_busy(lua_State* ls) {
+    Chain* chain = check_active_Chain(ls, 1);
+    return lua_pushboolean(ls, dma_channel_is_busy(chain->ctrl)
+                               || dma_channel_is_busy(chain->data)), 1;
+}
+
+static int Chain_wait(lua_State* ls) {
+    Chain* chain = check_active_Chain(ls, 1);
+    lua_settop(ls, 0);
+    lua_pushinteger(ls, 1u << chain->data);
+    return mod_wait_irq(ls);
+}
+
+static int Chain_close(lua_State* ls) {
+    Chain* chain = check_Chain(ls, 1);
+    if (chain->ctrl < 0) return 0;
+    // Break the chain before aborting, so that the data channel doesn't
+    // re-trigger the control channel.
+    hw_write_masked(&dma_channel_hw_addr(chain->data)->al1_ctrl,
+                    (uint)chain->data << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB,
+                    DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS);
+    dma_channel_abort(chain->ctrl);
+    dma_channel_abort(chain->data);
+    dma_hw->intr = 1u << chain->data;
+    dma_channel_unclaim(chain->ctrl);
+    dma_channel_unclaim(chain->data);
+    chain->ctrl = chain->data = -1;
+    return 0;
+}
+
+MLUA_SYMBOLS(Chain_syms) = {
+    MLUA_SYM_F(channels, Chain_),
+    MLUA_SYM_F(start, Chain_),
+    MLUA_SYM_F(is_busy, Chain_),
+    MLUA_SYM_F(wait, Chain_),
+    MLUA_SYM_F(close, Chain_),
+};
+
+#define Chain___close Chain_close
+#define Chain___gc Chain_close
+
+MLUA_SYMBOLS_NOHASH(Chain_syms_nh) = {
+    MLUA_SYM_F_NH(__close, Chain_),
+    MLUA_SYM_F_NH(__gc, Chain_),
+};
+
 MLUA_FUNC_V1(mod_, dma_, channel_claim, check_channel)
-MLUA_FUNC_V1(mod_, dma_, claim_mask, luaL_checkinteger)
+MLUA_FUNC_V1(mod_, dma_, claim_mask, mlua_arg_integer)
 MLUA_FUNC_V1(mod_, dma_, channel_unclaim, check_channel)
-MLUA_FUNC_V1(mod_, dma_, unclaim_mask, luaL_checkinteger)
+MLUA_FUNC_V1(mod_, dma_, unclaim_mask, mlua_arg_integer)
 MLUA_FUNC_R(mod_, dma_, claim_unused_channel, lua_pushinteger,
             mlua_opt_cbool(ls, 1, true))
 MLUA_FUNC_R1(mod_, dma_, channel_is_claimed, lua_pushboolean, check_channel)
 MLUA_FUNC_V3(mod_, dma_, channel_set_config, check_channel, check_Config,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 MLUA_FUNC_V3(mod_, dma_, channel_set_read_addr, check_channel, check_read_addr,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 MLUA_FUNC_V3(mod_, dma_, channel_set_write_addr, check_channel,
-             check_write_addr, mlua_to_cbool)
+             check_write_addr, mlua_arg_cbool)
 MLUA_FUNC_V3(mod_, dma_, channel_set_trans_count, check_channel,
-             luaL_checkinteger, mlua_to_cbool)
+             mlua_arg_integer, mlua_arg_cbool)
 MLUA_FUNC_V6(mod_, dma_, channel_configure, check_channel, check_Config,
-             check_write_addr, check_read_addr, luaL_checkinteger,
-             mlua_to_cbool)
+             check_write_addr, check_read_addr, mlua_arg_integer,
+             mlua_arg_cbool)
 MLUA_FUNC_V3(mod_, dma_, channel_transfer_from_buffer_now, check_channel,
-             check_read_addr, luaL_checkinteger)
+             check_read_addr, mlua_arg_integer)
 MLUA_FUNC_V3(mod_, dma_, channel_transfer_to_buffer_now, check_channel,
-             check_write_addr, luaL_checkinteger)
-MLUA_FUNC_V1(mod_, dma_, start_channel_mask, luaL_checkinteger)
+             check_write_addr, mlua_arg_integer)
+MLUA_FUNC_V1(mod_, dma_, start_channel_mask, mlua_arg_integer)
 MLUA_FUNC_V1(mod_, dma_, channel_start, check_channel)
 MLUA_FUNC_V1(mod_, dma_, channel_abort, check_channel)
 MLUA_FUNC_R1(mod_, dma_, channel_is_busy, lua_pushboolean, check_channel)
 MLUA_FUNC_V1(mod_, dma_, channel_wait_for_finish_blocking, check_channel)
-MLUA_FUNC_V3(mod_, dma_, sniffer_enable, check_channel, luaL_checkinteger,
-             mlua_to_cbool)
-MLUA_FUNC_V1(mod_, dma_, sniffer_set_byte_swap_enabled, mlua_to_cbool)
-MLUA_FUNC_V1(mod_, dma_, sniffer_set_output_invert_enabled, mlua_to_cbool)
-MLUA_FUNC_V1(mod_, dma_, sniffer_set_output_reverse_enabled, mlua_to_cbool)
+MLUA_FUNC_V3(mod_, dma_, sniffer_enable, check_channel, mlua_arg_integer,
+             mlua_arg_cbool)
+MLUA_FUNC_V1(mod_, dma_, sniffer_set_byte_swap_enabled, mlua_arg_cbool)
+MLUA_FUNC_V1(mod_, dma_, sniffer_set_output_invert_enabled, mlua_arg_cbool)
+MLUA_FUNC_V1(mod_, dma_, sniffer_set_output_reverse_enabled, mlua_arg_cbool)
 MLUA_FUNC_V0(mod_, dma_, sniffer_disable)
-MLUA_FUNC_V1(mod_, dma_, sniffer_set_data_accumulator, luaL_checkinteger)
+MLUA_FUNC_V1(mod_, dma_, sniffer_set_data_accumulator, mlua_arg_integer)
 MLUA_FUNC_R0(mod_, dma_, sniffer_get_data_accumulator, lua_pushinteger)
 MLUA_FUNC_V1(mod_, dma_, timer_claim, check_timer)
 MLUA_FUNC_V1(mod_, dma_, timer_unclaim, check_timer)
 MLUA_FUNC_R(mod_, dma_, claim_unused_timer, lua_pushinteger,
             mlua_opt_cbool(ls, 1, true))
 MLUA_FUNC_R1(mod_, dma_, timer_is_claimed, lua_pushboolean, check_timer)
-MLUA_FUNC_V3(mod_, dma_, timer_set_fraction, check_timer, luaL_checkinteger,
-             luaL_checkinteger)
+MLUA_FUNC_V3(mod_, dma_, timer_set_fraction, check_timer, mlua_arg_integer,
+             mlua_arg_integer)
 MLUA_FUNC_R1(mod_, dma_, get_timer_dreq, lua_pushinteger, check_timer)
 MLUA_FUNC_V1(mod_, dma_, channel_cleanup, check_timer)
 
@@ -385,6 +617,7 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(timer_set_fraction, mod_),
     MLUA_SYM_F(get_timer_dreq, mod_),
     MLUA_SYM_F(channel_cleanup, mod_),
+    MLUA_SYM_F(chain, mod_),
     MLUA_SYM_F(wait_irq, mod_),
     MLUA_SYM_F_THREAD(enable_irq, mod_),
 };
@@ -398,5 +631,9 @@ MLUA_OPEN_MODULE(hardware.dma) {
     // Create the Config class.
     mlua_new_class(ls, Config_name, Config_syms, mlua_nosyms);
     lua_pop(ls, 1);
+
+    // Create the Chain class.
+    mlua_new_class(ls, Chain_name, Chain_syms, Chain_syms_nh);
+    lua_pop(ls, 1);
     return 1;
 }
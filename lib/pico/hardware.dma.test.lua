@@ -100,3 +100,36 @@ function test_mem_to_mem_BNB(t)
         t:expect(t2 - t1):label("duration"):gte(50 * #src - 20)
     end
 end
+
+function test_chain_BNB(t)
+    local cfg = dma.channel_get_default_config(0)
+        :set_read_increment(true)
+        :set_write_increment(true)
+        :set_transfer_data_size(dma.SIZE_8)
+    local dst = mem.alloc(16)
+    local p = dst:ptr()
+    local chain<close> = dma.chain{
+        {'head', p, 4, cfg},
+        {'payload', p + 4, 7, cfg},
+        {'CRC', p + 11, 3, cfg},
+    }
+    local ctrl, data = chain:channels()
+    t:expect(t.expr(dma).channel_is_claimed(ctrl)):eq(true)
+    t:expect(t.expr(dma).channel_is_claimed(data)):eq(true)
+    if not thread.blocking() then
+        dma.enable_irq(1 << data)
+        t:cleanup(function() dma.enable_irq(1 << data, false) end)
+    end
+    for i = 1, 2 do
+        mem.fill(dst, 0)
+        chain:start()
+        t:expect(t.expr(chain):wait()):eq(1 << data)
+        t:expect(t.expr(chain):is_busy()):eq(false)
+        t:expect(t.expr(mem).read(dst, 0, 14)):eq('headpayloadCRC')
+    end
+    chain:close()
+    t:expect(t.expr(dma).channel_is_claimed(ctrl)):eq(false)
+    t:expect(t.expr(dma).channel_is_claimed(data)):eq(false)
+    t:expect(t.expr(chain):start()):raises("chain is closed")
+    t:expect(t.expr(dma).chain({})):raises("empty chain")
+end
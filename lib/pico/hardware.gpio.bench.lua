@@ -0,0 +1,38 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local gpio = require 'hardware.gpio'
+
+-- These benchmarks measure the call overhead of MLUA_FUNC_* bindings.
+-- Comparing checked and unchecked argument conversions requires running them
+-- on two builds, with and without MLUA_FAST_BINDINGS. The masked functions
+-- are called with an empty mask, and the output value of the GPIO is only
+-- driven if it is configured as an SIO output, so the benchmarks have no
+-- visible effect.
+local pin = 0
+
+function bench_lua_call(b)
+    local function put(pin, value) end
+    b:reset()
+    for i = 1, b.n do put(pin, true) end
+end
+
+function bench_put(b)
+    local put = gpio.put
+    b:reset()
+    for i = 1, b.n do put(pin, i & 1) end
+end
+
+function bench_put_masked(b)
+    local put_masked = gpio.put_masked
+    b:reset()
+    for i = 1, b.n do put_masked(0, i) end
+end
+
+function bench_xor_mask(b)
+    local xor_mask = gpio.xor_mask
+    b:reset()
+    for i = 1, b.n do xor_mask(0) end
+end
@@ -3,27 +3,59 @@
 
 #include "mlua/hardware.gpio.h"
 
+#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "hardware/gpio.h"
 #include "hardware/sync.h"
 #include "hardware/structs/iobank0.h"
+#include "hardware/timer.h"
 #include "pico/platform.h"
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/int64.h"
 #include "mlua/module.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
 
 #if LIB_MLUA_MOD_MLUA_THREAD
 
+// The priority of GPIO IRQ events.
+#ifndef MLUA_GPIO_IRQ_EVENT_PRIORITY
+#define MLUA_GPIO_IRQ_EVENT_PRIORITY (MLUA_EVENT_PRIORITIES - 1)
+#endif
+
+// The number of entries in the edge queue of each core. Must be a power of two.
+#ifndef MLUA_GPIO_EDGE_QUEUE_SIZE
+#define MLUA_GPIO_EDGE_QUEUE_SIZE 32
+#endif
+
+static_assert((MLUA_GPIO_EDGE_QUEUE_SIZE
+               & (MLUA_GPIO_EDGE_QUEUE_SIZE - 1)) == 0,
+              "MLUA_GPIO_EDGE_QUEUE_SIZE must be a power of two");
+
 #define EVENTS_SIZE ((NUM_BANK0_GPIOS + 7) / 8)
 
+// An edge event recorded by the IRQ handler.
+typedef struct Edge {
+    uint64_t time;
+    uint8_t gpio;
+    uint8_t events;
+} Edge;
+
 typedef struct IRQState {
     uint32_t pending[EVENTS_SIZE];
     uint32_t mask[EVENTS_SIZE];
+    uint32_t queue_mask[EVENTS_SIZE];
     MLuaEvent irq_event;
+    // "head" and "tail" are free-running counters, respectively written only
+    // by the reader and the IRQ handler.
+    uint32_t volatile head;
+    uint32_t volatile tail;
+    uint32_t volatile dropped;
+    Edge edges[MLUA_GPIO_EDGE_QUEUE_SIZE];
 } IRQState;
 
 static IRQState irq_state[NUM_CORES];
@@ -44,16 +76,42 @@ io_irq_ctrl_hw_t* core_irq_ctrl_base(uint core) {
         : &iobank0_hw->proc0_irq_ctrl;
 }
 
+// Append the queued edge events of a block to the edge queue.
+static void __time_critical_func(queue_edges)(IRQState* state, uint block,
+                                              uint32_t pending, uint64_t time) {
+    uint32_t tail = state->tail;
+    while (pending != 0) {
+        int shift = MLUA_CTZ(pending) & ~3;
+        if (tail - state->head < MLUA_GPIO_EDGE_QUEUE_SIZE) {
+            Edge* edge = &state->edges[tail & (MLUA_GPIO_EDGE_QUEUE_SIZE - 1)];
+            edge->time = time;
+            edge->gpio = 8 * block + shift / 4;
+            edge->events = (pending >> shift) & 0xfu;
+            ++tail;
+        } else {
+            ++state->dropped;
+        }
+        pending &= ~(0xfu << shift);
+    }
+    state->tail = tail;
+}
+
 static void __time_critical_func(handle_gpio_irq)(void) {
     uint core = get_core_num();
     IRQState* state = &irq_state[core];
     io_irq_ctrl_hw_t* irq_ctrl_base = core_irq_ctrl_base(core);
     bool notify = false;
+    uint64_t time = 0;
     for (uint block = 0; block < MLUA_SIZE(state->pending); ++block) {
         uint32_t pending = irq_ctrl_base->ints[block] & state->mask[block];
         iobank0_hw->intr[block] = pending;  // Acknowledge
         state->pending[block] |= pending & EDGE_MASK_BLOCK;
         notify = notify || pending != 0;
+        uint32_t queued = pending & state->queue_mask[block];
+        if (queued != 0) {
+            if (time == 0) time = time_us_64();
+            queue_edges(state, block, queued, time);
+        }
 
         // Disable active level-triggered events.
         hw_clear_bits(&irq_ctrl_base->inte[block], pending & LEVEL_MASK_BLOCK);
@@ -125,7 +183,8 @@ static int mod_set_irq_callback(lua_State* ls) {
     }
 
     // Set the IRQ handler.
-    bool enabled = mlua_event_enable(ls, event);
+    bool enabled = mlua_event_enable_priority(ls, event,
+                                              MLUA_GPIO_IRQ_EVENT_PRIORITY);
     if (enabled) {
         irq_add_shared_handler(IO_IRQ_BANK0, &handle_gpio_irq,
                                GPIO_IRQ_CALLBACK_ORDER_PRIORITY);
@@ -171,6 +230,45 @@ static int mod_set_irq_enabled_with_callback_1(lua_State* ls, int status,
     return ctx;
 }
 
+static int mod_set_edge_queue_enabled(lua_State* ls) {
+    uint gpio = mlua_check_gpio(ls, 1);
+    bool enabled = mlua_to_cbool(ls, 2);
+    IRQState* state = &irq_state[get_core_num()];
+    uint32_t mask = EDGE_MASK << 4 * (gpio % 8);
+    uint32_t save = save_and_disable_interrupts();
+    if (enabled) {
+        state->queue_mask[gpio / 8] |= mask;
+    } else {
+        state->queue_mask[gpio / 8] &= ~mask;
+    }
+    restore_interrupts(save);
+    return 0;
+}
+
+static int mod_read_edge_queue(lua_State* ls) {
+    IRQState* state = &irq_state[get_core_num()];
+    uint32_t head = state->head;
+    uint32_t count = state->tail - head;
+    lua_createtable(ls, 3 * count, 0);
+    for (uint32_t i = 0; i < count; ++i, ++head) {
+        Edge const* edge =
+            &state->edges[head & (MLUA_GPIO_EDGE_QUEUE_SIZE - 1)];
+        lua_pushinteger(ls, edge->gpio);
+        lua_rawseti(ls, -2, 3 * i + 1);
+        lua_pushinteger(ls, edge->events);
+        lua_rawseti(ls, -2, 3 * i + 2);
+        mlua_push_minint(ls, edge->time);
+        lua_rawseti(ls, -2, 3 * i + 3);
+    }
+    state->head = head;  // Release the entries
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t dropped = state->dropped;
+    state->dropped = 0;
+    restore_interrupts(save);
+    lua_pushinteger(ls, dropped);
+    return 2;
+}
+
 #endif  // LIB_MLUA_MOD_MLUA_THREAD
 
 typedef void (*IRQEnabler)(uint, uint32_t, bool);
@@ -249,46 +347,46 @@ static int mod_get_status(lua_State* ls) {
 }
 
 MLUA_FUNC_R1(mod_, gpio_, get_pad, lua_pushboolean, mlua_check_gpio)
-MLUA_FUNC_V2(mod_, gpio_, set_function, mlua_check_gpio, luaL_checkinteger)
+MLUA_FUNC_V2(mod_, gpio_, set_function, mlua_check_gpio, mlua_arg_integer)
 MLUA_FUNC_R1(mod_, gpio_, get_function, lua_pushinteger, mlua_check_gpio)
-MLUA_FUNC_V3(mod_, gpio_, set_pulls, mlua_check_gpio, mlua_to_cbool,
-             mlua_to_cbool)
+MLUA_FUNC_V3(mod_, gpio_, set_pulls, mlua_check_gpio, mlua_arg_cbool,
+             mlua_arg_cbool)
 MLUA_FUNC_V1(mod_, gpio_, pull_up, mlua_check_gpio)
 MLUA_FUNC_R1(mod_, gpio_, is_pulled_up, lua_pushboolean, mlua_check_gpio)
 MLUA_FUNC_V1(mod_, gpio_, pull_down, mlua_check_gpio)
 MLUA_FUNC_R1(mod_, gpio_, is_pulled_down, lua_pushboolean, mlua_check_gpio)
 MLUA_FUNC_V1(mod_, gpio_, disable_pulls, mlua_check_gpio)
-MLUA_FUNC_V2(mod_, gpio_, set_irqover, mlua_check_gpio, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, gpio_, set_outover, mlua_check_gpio, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, gpio_, set_inover, mlua_check_gpio, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, gpio_, set_oeover, mlua_check_gpio, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, gpio_, set_input_enabled, mlua_check_gpio, mlua_to_cbool)
+MLUA_FUNC_V2(mod_, gpio_, set_irqover, mlua_check_gpio, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, gpio_, set_outover, mlua_check_gpio, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, gpio_, set_inover, mlua_check_gpio, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, gpio_, set_oeover, mlua_check_gpio, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, gpio_, set_input_enabled, mlua_check_gpio, mlua_arg_cbool)
 MLUA_FUNC_V2(mod_, gpio_, set_input_hysteresis_enabled, mlua_check_gpio,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 MLUA_FUNC_R1(mod_, gpio_, is_input_hysteresis_enabled, lua_pushboolean,
              mlua_check_gpio)
-MLUA_FUNC_V2(mod_, gpio_, set_slew_rate, mlua_check_gpio, luaL_checkinteger)
+MLUA_FUNC_V2(mod_, gpio_, set_slew_rate, mlua_check_gpio, mlua_arg_integer)
 MLUA_FUNC_R1(mod_, gpio_, get_slew_rate, lua_pushinteger, mlua_check_gpio)
 MLUA_FUNC_V2(mod_, gpio_, set_drive_strength, mlua_check_gpio,
-             luaL_checkinteger)
+             mlua_arg_integer)
 MLUA_FUNC_R1(mod_, gpio_, get_drive_strength, lua_pushinteger, mlua_check_gpio)
 MLUA_FUNC_V1(mod_, gpio_, init, mlua_check_gpio)
 MLUA_FUNC_V1(mod_, gpio_, deinit, mlua_check_gpio)
-MLUA_FUNC_V1(mod_, gpio_, init_mask, luaL_checkinteger)
+MLUA_FUNC_V1(mod_, gpio_, init_mask, mlua_arg_integer)
 MLUA_FUNC_R1(mod_, gpio_, get, lua_pushboolean, mlua_check_gpio)
 MLUA_FUNC_R0(mod_, gpio_, get_all, lua_pushinteger)
-MLUA_FUNC_V1(mod_, gpio_, set_mask, luaL_checkinteger)
-MLUA_FUNC_V1(mod_, gpio_, clr_mask, luaL_checkinteger)
-MLUA_FUNC_V1(mod_, gpio_, xor_mask, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, gpio_, put_masked, luaL_checkinteger, luaL_checkinteger)
-MLUA_FUNC_V1(mod_, gpio_, put_all, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, gpio_, put, mlua_check_gpio, mlua_to_cbool)
+MLUA_FUNC_V1(mod_, gpio_, set_mask, mlua_arg_integer)
+MLUA_FUNC_V1(mod_, gpio_, clr_mask, mlua_arg_integer)
+MLUA_FUNC_V1(mod_, gpio_, xor_mask, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, gpio_, put_masked, mlua_arg_integer, mlua_arg_integer)
+MLUA_FUNC_V1(mod_, gpio_, put_all, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, gpio_, put, mlua_check_gpio, mlua_arg_cbool)
 MLUA_FUNC_R1(mod_, gpio_, get_out_level, lua_pushboolean, mlua_check_gpio)
-MLUA_FUNC_V1(mod_, gpio_, set_dir_out_masked, luaL_checkinteger)
-MLUA_FUNC_V1(mod_, gpio_, set_dir_in_masked, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, gpio_, set_dir_masked, luaL_checkinteger, luaL_checkinteger)
-MLUA_FUNC_V1(mod_, gpio_, set_dir_all_bits, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, gpio_, set_dir, mlua_check_gpio, mlua_to_cbool)
+MLUA_FUNC_V1(mod_, gpio_, set_dir_out_masked, mlua_arg_integer)
+MLUA_FUNC_V1(mod_, gpio_, set_dir_in_masked, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, gpio_, set_dir_masked, mlua_arg_integer, mlua_arg_integer)
+MLUA_FUNC_V1(mod_, gpio_, set_dir_all_bits, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, gpio_, set_dir, mlua_check_gpio, mlua_arg_cbool)
 MLUA_FUNC_R1(mod_, gpio_, is_dir_out, lua_pushboolean, mlua_check_gpio)
 MLUA_FUNC_R1(mod_, gpio_, get_dir, lua_pushinteger, mlua_check_gpio)
 
@@ -345,6 +443,8 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(set_irq_enabled, mod_),
     MLUA_SYM_F_THREAD(set_irq_callback, mod_),
     MLUA_SYM_F_THREAD(set_irq_enabled_with_callback, mod_),
+    MLUA_SYM_F_THREAD(set_edge_queue_enabled, mod_),
+    MLUA_SYM_F_THREAD(read_edge_queue, mod_),
     MLUA_SYM_F(set_dormant_irq_enabled, mod_),
     MLUA_SYM_F(get_irq_event_mask, mod_),
     MLUA_SYM_F(acknowledge_irq, mod_),
@@ -377,6 +477,7 @@ MLUA_SYMBOLS(module_syms) = {
 
 MLUA_OPEN_MODULE(hardware.gpio) {
     mlua_thread_require(ls);
+    mlua_require(ls, "mlua.int64", false);
 
     mlua_new_module(ls, 0, module_syms);
     return 1;
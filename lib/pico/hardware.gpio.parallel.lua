@@ -0,0 +1,191 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local asm = require 'hardware.pio.asm'
+local pio = require 'hardware.pio'
+local oo = require 'mlua.oo'
+local thread = require 'mlua.thread'
+
+-- Return the output program for a bus of the given width. If "strobe" is
+-- true, the program drives a strobe pin through side-set, which is asserted
+-- for "hold + 1" cycles after the data has been stable for "setup + 1" cycles.
+function output_program(width, strobe, setup, hold, active_low)
+    local inactive = active_low and 1 or 0
+    local active = 1 - inactive
+    setup, hold = setup or 0, hold or 0
+    return asm.assemble(function(_ENV)
+        if strobe then side_set(1) end
+    public(start):
+    wrap_target()
+        if strobe then
+            out(pins, width)    side(inactive)  (setup)
+            nop()               side(active)    (hold)
+        else
+            out(pins, width)                    (setup)
+        end
+    wrap()
+    end)
+end
+
+-- Return the input program for a bus of the given width. If "strobe" is a pin
+-- number, a sample is taken on each active edge of the pin. Otherwise, samples
+-- are taken every "delay + 1" cycles.
+function input_program(width, strobe, delay, active_low)
+    local active = active_low and 0 or 1
+    delay = delay or 0
+    return asm.assemble(function(_ENV)
+    public(start):
+    wrap_target()
+        if strobe then
+            wait(active, gpio, strobe)
+            in_(pins, width)
+            wait(1 - active, gpio, strobe)
+        else
+            in_(pins, width)                    (delay)
+        end
+    wrap()
+    end)
+end
+
+-- Find an available state machine, and load the given program on its PIO.
+local function claim(self, prog, inst)
+    for i = inst or 0, inst or pio.NUM - 1 do
+        local p = pio[i]
+        if p:can_add_program(prog) then
+            local sm = p:claim_unused_sm(false)
+            if sm >= 0 then
+                self._pio, self._sm, self._prog = p, p:sm(sm), prog
+                self._offset = p:add_program(prog)
+                return
+            end
+        end
+    end
+    error("no PIO state machine available", 3)
+end
+
+local function check_width(width)
+    if not (0 < width and width <= 32) then
+        error(("invalid width: %s"):format(width), 3)
+    end
+end
+
+-- A parallel bus driven by a PIO state machine.
+local Bus = oo.class('Bus')
+
+function Bus:__init(prog, opts, irq)
+    claim(self, prog, opts.pio)
+    local sm = self._sm
+    self._cfg = prog:config(self._offset)
+        :set_clkdiv(opts.clkdiv or 1)
+    if not thread.blocking() then
+        self._irq = 1 << (irq + sm:index())
+        self._pio:enable_irq(self._irq)
+    end
+end
+
+function Bus:_start()
+    local sm, cfg = self._sm, self._cfg
+    sm:init(self._prog.labels.start + self._offset, cfg)
+    sm:set_enabled(true)
+end
+
+-- Return the PIO state machine driving the bus.
+function Bus:sm() return self._sm end
+
+-- Stop the state machine and release the PIO resources of the bus.
+function Bus:close()
+    local sm = self._sm
+    if not sm then return end
+    self._sm = nil
+    sm:set_enabled(false)
+    if self._irq then self._pio:enable_irq(self._irq, false) end
+    self._pio:remove_program(self._prog, self._offset)
+    sm:unclaim()
+end
+
+Bus.__close = Bus.close
+
+-- An output bus, which writes array elements to a group of contiguous pins.
+local Output = oo.class('Output', Bus)
+
+function Output:__init(opts)
+    local base, width, strobe = opts.base, opts.width, opts.strobe
+    check_width(width)
+    local prog = output_program(width, strobe, opts.setup, opts.hold,
+                                opts.active_low)
+    Bus.__init(self, prog, opts, pio.pis_sm0_tx_fifo_not_full)
+    self._cfg:set_out_pins(base, width)
+        :set_out_shift(true, true, width)
+        :set_fifo_join(pio.FIFO_JOIN_TX)
+    local inst, sm = self._pio, self._sm
+    for pin = base, base + width - 1 do inst:gpio_init(pin) end
+    sm:set_consecutive_pindirs(base, width, true)
+    if strobe then
+        self._cfg:set_sideset_pins(strobe)
+        inst:gpio_init(strobe)
+        sm:set_pins_with_mask((opts.active_low and 1 or 0) << strobe,
+                              1 << strobe)
+        sm:set_consecutive_pindirs(strobe, 1, true)
+    end
+    self:_start()
+end
+
+-- Write the elements of a string or raw buffer to the bus, one element per
+-- strobe, and return the number of bytes written. "size" and "deadline" are as
+-- for SM:put_dma().
+function Output:write(src, size, deadline)
+    return self._sm:put_dma(src, size, deadline)
+end
+
+-- Wait until the TX FIFO of the state machine is empty. The last word pulled
+-- from the FIFO may still be shifting out to the pins when this returns.
+function Output:flush()
+    local sm = self._sm
+    while not sm:is_tx_fifo_empty() do thread.yield() end
+end
+
+-- An input bus, which samples a group of contiguous pins into an array.
+local Input = oo.class('Input', Bus)
+
+function Input:__init(opts)
+    local base, width, strobe = opts.base, opts.width, opts.strobe
+    check_width(width)
+    local prog = input_program(width, strobe, opts.delay, opts.active_low)
+    Bus.__init(self, prog, opts, pio.pis_sm0_rx_fifo_not_empty)
+    self._cfg:set_in_pins(base)
+        :set_in_shift(false, true, width)
+        :set_fifo_join(pio.FIFO_JOIN_RX)
+end
+
+-- Capture samples into a raw buffer until it is full or the deadline is
+-- reached, and return the number of bytes read. Sampling starts with the call,
+-- and stops when the call returns, so that no stale samples are returned.
+-- "size" and "deadline" are as for SM:get_dma().
+function Input:read(buf, size, deadline)
+    local sm = self._sm
+    self:_start()
+    local done<close> = function() sm:set_enabled(false) end
+    return sm:get_dma(buf, size, deadline)
+end
+
+-- Create an output bus. "opts" is a table with the following fields:
+--  - base: The first pin of the bus.
+--  - width: The number of pins of the bus.
+--  - strobe: The strobe pin (optional).
+--  - active_low: When true, the strobe is active low.
+--  - setup, hold: Additional cycles before and while asserting the strobe.
+--  - clkdiv: The state machine clock divider.
+--  - pio: The index of the PIO instance to use (optional).
+function output(opts) return Output(opts) end
+
+-- Create an input bus. "opts" is a table with the following fields:
+--  - base: The first pin of the bus.
+--  - width: The number of pins of the bus.
+--  - strobe: The pin whose active edges trigger sampling (optional).
+--  - active_low: When true, sampling is triggered by falling edges.
+--  - delay: Additional cycles between samples, without a strobe.
+--  - clkdiv: The state machine clock divider.
+--  - pio: The index of the PIO instance to use (optional).
+function input(opts) return Input(opts) end
@@ -0,0 +1,51 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local parallel = require 'hardware.gpio.parallel'
+local array = require 'mlua.array'
+local config = require 'mlua.config'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local table = require 'table'
+
+local pin1 = config.GPIO_PIN1
+local pin2 = config.GPIO_PIN2
+
+function test_programs(t)
+    for _, test in ipairs{
+        {parallel.output_program(8), {0x6008}},
+        {parallel.output_program(8, 10, 1, 2), {0x6108, 0xb242}},
+        {parallel.output_program(8, 10, 0, 0, true), {0x7008, 0xa042}},
+        {parallel.input_program(4, 7), {0x2087, 0x4004, 0x2007}},
+        {parallel.input_program(4, 7, 0, true), {0x2007, 0x4004, 0x2087}},
+        {parallel.input_program(4, nil, 3), {0x4304}},
+    } do
+        local prog, want = table.unpack(test)
+        t:expect({table.unpack(prog)}):label("program"):eq(want)
+        t:expect(prog.labels.start):label("start"):eq(0)
+    end
+    t:expect(function() parallel.output{base = 0, width = 0} end)
+        :raises("invalid width: 0")
+end
+
+function test_loopback(t)
+    -- Drive a one-bit bus with a strobe, and sample it on the strobe edges.
+    local out<close> = parallel.output{base = pin1, width = 1, strobe = pin2,
+                                       setup = 3, hold = 3, clkdiv = 16}
+    local inp<close> = parallel.input{base = pin1, width = 1, strobe = pin2}
+    local src, dst = array('B', 32), array('B', 32)
+    for i = 1, #src do src[i] = (i * 7 >> 2) & 1 end
+    local writer<close> = thread.start(function() out:write(src) end)
+    t:expect(t.expr(inp):read(dst)):eq(#dst)
+    t:expect(dst):label("dst"):eq(src)
+end
+
+function test_read_deadline(t)
+    -- Without strobe edges, the read times out with a partial transfer.
+    local inp<close> = parallel.input{base = pin1, width = 1, strobe = pin2}
+    local dst = array('B', 4)
+    t:expect(t.expr(inp):read(dst, nil, time.deadline(10 * time.msec)))
+        :eq(0)
+end
@@ -255,3 +255,37 @@ function test_set_irq_callback(t)
     }
     t:expect(log):label("log"):eq(want, util.table_eq)
 end
+
+function test_edge_queue(t)
+    config_pin(t)
+    gpio.put(pin1, 0)
+    gpio.set_dir(pin1, gpio.OUT)
+    local mask = gpio.IRQ_EDGE_FALL | gpio.IRQ_EDGE_RISE
+    gpio.set_edge_queue_enabled(pin1, true)
+    t:cleanup(function() gpio.set_edge_queue_enabled(pin1, false) end)
+    local log = ''
+    gpio.set_irq_enabled_with_callback(pin1, mask, true, function(p, em)
+        local edges, dropped = gpio.read_edge_queue()
+        for i = 1, #edges, 3 do
+            log = log .. ('(%s %s) '):format(edges[i], edges[i + 1])
+        end
+        log = log .. ('%s; '):format(dropped)
+    end)
+    t:cleanup(function()
+        irq.set_enabled(irq.IO_IRQ_BANK0, false)
+        gpio.set_irq_callback(nil)
+    end)
+
+    -- Generate pulses faster than the callback is dispatched.
+    local rise, fall = gpio.IRQ_EDGE_RISE, gpio.IRQ_EDGE_FALL
+    for i = 1, 3 do
+        gpio.put(pin1, 1)
+        gpio.put(pin1, 0)
+    end
+    thread.yield()
+    local pulse = ('(%s %s) (%s %s) '):format(pin1, rise, pin1, fall)
+    t:expect(log):label("log"):eq(pulse:rep(3) .. '0; ')
+    local edges, dropped = gpio.read_edge_queue()
+    t:expect(#edges):label("#edges"):eq(0)
+    t:expect(dropped):label("dropped"):eq(0)
+end
@@ -5,7 +5,9 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
 
+#include "hardware/sync.h"
 #include "pico.h"
 #include "pico/time.h"
 
@@ -13,7 +15,7 @@
 #include "mlua/module.h"
 #include "mlua/util.h"
 
-// TODO: Accept and return mutable buffers when writing and reading
+// TODO: Accept buffers when writing
 
 char const mlua_I2C_name[] = "hardware.i2c.I2C";
 
@@ -28,14 +30,119 @@ static int I2C_regs(lua_State* ls) {
     return lua_pushlightuserdata(ls, i2c_get_hw(mlua_check_I2C(ls, 1))), 1;
 }
 
+#define RX_FIFO_DEPTH 16
+
+// A single operation of a transaction. The write data is sent first, then
+// "rlen" bytes are read into "dst" after a RESTART, and the operation ends with
+// a STOP.
+typedef struct TxnOp {
+    uint8_t const* src;
+    uint8_t* dst;
+    uint32_t wlen;
+    uint32_t rlen;
+    uint16_t addr;
+    bool str;
+} TxnOp;
+
+// The state of a transaction. "cmds" is the number of commands written to
+// IC_DATA_CMD for the current operation, and "rcnt" the number of bytes read.
+typedef struct Txn {
+    uint32_t count;
+    uint32_t index;
+    uint32_t cmds;
+    uint32_t rcnt;
+    uint32_t abort_reason;
+    bool started;
+    bool volatile done;
+    TxnOp ops[];
+} Txn;
+
+// Advance a transaction as far as possible without blocking. Returns true iff
+// the transaction has completed. Otherwise, the interrupts that allow further
+// progress are unmasked. Must be called with the I2C IRQ masked.
+static bool __time_critical_func(txn_step)(i2c_inst_t* inst, Txn* t) {
+    i2c_hw_t* hw = i2c_get_hw(inst);
+    while (t->index < t->count) {
+        TxnOp* op = &t->ops[t->index];
+        uint32_t total = op->wlen + op->rlen;
+        if (!t->started) {
+            hw->enable = 0;
+            hw->tar = op->addr;
+            hw->enable = 1;
+            t->started = true;
+        }
+
+        if (t->abort_reason == 0) {
+            uint32_t abort_reason = hw->tx_abrt_source;
+            if (abort_reason != 0) {  // Tx was aborted, stop the transaction
+                hw->clr_tx_abrt;
+                t->abort_reason = abort_reason;
+            }
+        }
+        if (t->abort_reason == 0) {
+            // Read received data.
+            while (t->rcnt < op->rlen && i2c_get_read_available(inst) > 0) {
+                op->dst[t->rcnt++] = hw->data_cmd;
+            }
+
+            // Fill the Tx FIFO, avoiding Rx FIFO overflows.
+            while (t->cmds < total && i2c_get_write_available(inst) > 0
+                   && (t->cmds < op->wlen
+                       || t->cmds - op->wlen - t->rcnt < RX_FIFO_DEPTH)) {
+                uint32_t cmd = t->cmds < op->wlen ? op->src[t->cmds]
+                                                  : I2C_IC_DATA_CMD_CMD_BITS;
+                if (t->cmds == op->wlen && op->wlen > 0) {
+                    cmd |= I2C_IC_DATA_CMD_RESTART_BITS;
+                }
+                if (t->cmds == total - 1) cmd |= I2C_IC_DATA_CMD_STOP_BITS;
+                hw->data_cmd = cmd;
+                ++t->cmds;
+            }
+            if (t->cmds < total || t->rcnt < op->rlen) {
+                bool feed = t->cmds < total
+                    && (t->cmds < op->wlen
+                        || t->cmds - op->wlen - t->rcnt < RX_FIFO_DEPTH);
+                hw->intr_mask =
+                    bool_to_bit(feed) << I2C_IC_INTR_MASK_M_TX_EMPTY_LSB
+                    | bool_to_bit(t->rcnt < op->rlen)
+                        << I2C_IC_INTR_MASK_M_RX_FULL_LSB
+                    | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+                return false;
+            }
+        }
+
+        // Wait for the STOP condition.
+        if ((hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_STOP_DET_BITS) == 0) {
+            hw->intr_mask = I2C_IC_INTR_MASK_M_STOP_DET_BITS
+                            | I2C_IC_INTR_MASK_M_TX_ABRT_BITS;
+            return false;
+        }
+        hw->clr_stop_det;
+        if (t->abort_reason != 0) break;
+        ++t->index;
+        t->cmds = t->rcnt = 0;
+        t->started = false;
+    }
+    hw->intr_mask = 0;
+    return true;
+}
+
 #if LIB_MLUA_MOD_MLUA_THREAD
 
 MLuaI2CState mlua_i2c_state[NUM_I2CS];
 
+// The transactions in progress, driven by the IRQ handler.
+static Txn* volatile txns[NUM_I2CS];
+
 static void __time_critical_func(handle_i2c_irq)(void) {
     uint num = __get_current_exception() - VTABLE_FIRST_IRQ - I2C0_IRQ;
-    i2c_hw_t* hw = i2c_get_hw(i2c_get_instance(num));
-    hw->intr_mask = 0;
+    i2c_inst_t* inst = i2c_get_instance(num);
+    i2c_get_hw(inst)->intr_mask = 0;
+    Txn* t = txns[num];
+    if (t != NULL && !t->done) {
+        if (!txn_step(inst, t)) return;
+        t->done = true;
+    }
     mlua_event_set(&mlua_i2c_state[num].event);
 }
 
@@ -188,6 +295,10 @@ static int read_loop(lua_State* ls, bool timeout) {
     i2c_hw_t* hw = i2c_get_hw(inst);
     size_t wcnt = lua_tointeger(ls, 6);
     size_t offset = lua_tointeger(ls, 7);
+    MLuaBuffer dest;
+    bool into = !lua_isnil(ls, 8);
+    if (into) mlua_get_buffer(ls, 8, &dest);
+    size_t boff = lua_tointeger(ls, 9);
 
     // Initialize the transfer.
     if (offset == (size_t)-1) {
@@ -227,9 +338,16 @@ static int read_loop(lua_State* ls, bool timeout) {
         }
 
         // Read received data.
-        if (offset < rend) {
+        if (offset < rend && into) {
+            uint8_t chunk[16];
+            if (rend > offset + sizeof(chunk)) rend = offset + sizeof(chunk);
+            size_t cnt = rend - offset;
+            for (size_t i = 0; i < cnt; ++i) chunk[i] = hw->data_cmd;
+            mlua_buffer_write(&dest, boff + offset, cnt, chunk);
+            offset = rend;
+        } else if (offset < rend) {
             if (lua_gettop(ls) >= LUA_MINSTACK - 2) {
-                lua_concat(ls, lua_gettop(ls) - 7);
+                lua_concat(ls, lua_gettop(ls) - 9);
             }
             size_t cnt = rend - offset;
             luaL_Buffer buf;
@@ -260,7 +378,8 @@ static int read_loop(lua_State* ls, bool timeout) {
         lua_pushinteger(ls, PICO_ERROR_GENERIC);
         return 2;
     }
-    lua_concat(ls, lua_gettop(ls) - 7);
+    if (into) return lua_pushinteger(ls, len), 1;
+    lua_concat(ls, lua_gettop(ls) - 9);
     return 1;
 }
 
@@ -275,6 +394,8 @@ static int I2C_read_blocking(lua_State* ls) {
         lua_settop(ls, 5);
         lua_pushinteger(ls, 0);  // wcnt
         lua_pushinteger(ls, -1);  // offset
+        lua_pushnil(ls);  // buf
+        lua_pushinteger(ls, 0);  // boff
         return mlua_event_wait(ls, event, 0, &read_loop, 5);
     }
 
@@ -305,6 +426,235 @@ static int I2C_read_timeout_us(lua_State* ls) {
     return I2C_read_blocking(ls);
 }
 
+static int I2C_read_blocking_into(lua_State* ls) {
+    i2c_inst_t* inst = mlua_check_I2C(ls, 1);
+    uint16_t addr = luaL_checkinteger(ls, 2);
+    MLuaBuffer buf;
+    size_t off, len;
+    mlua_check_buffer_range(ls, 3, &buf, &off, &len);
+    bool nostop = mlua_to_cbool(ls, 6);
+
+    lua_settop(ls, 7);
+    MLuaEvent* event = &mlua_i2c_state[i2c_hw_index(inst)].event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        // Arrange the stack for read_loop().
+        lua_remove(ls, 4);  // inst, addr, buf, len, nostop, deadline
+        lua_rotate(ls, 3, -1);  // inst, addr, len, nostop, deadline, buf
+        lua_pushinteger(ls, len);
+        lua_replace(ls, 3);
+        lua_pushinteger(ls, 0);  // wcnt
+        lua_pushinteger(ls, -1);  // offset
+        lua_rotate(ls, 6, 2);  // ..., deadline, wcnt, offset, buf
+        lua_pushinteger(ls, off);  // boff
+        return mlua_event_wait(ls, event, 0, &read_loop, 5);
+    }
+
+    uint8_t* dst = buf.vt == NULL ? (uint8_t*)buf.ptr + off
+                                  : lua_newuserdatauv(ls, len, 0);
+    int count;
+    if (lua_isnoneornil(ls, 7)) {
+        count = i2c_read_blocking(inst, addr, dst, len, nostop);
+    } else {
+        count = i2c_read_blocking_until(
+            inst, addr, dst, len, nostop,
+            from_us_since_boot(mlua_check_time(ls, 7)));
+    }
+    if (count < 0) {
+        luaL_pushfail(ls);
+        lua_pushinteger(ls, count);
+        return 2;
+    }
+    if (buf.vt != NULL) mlua_buffer_write(&buf, off, count, dst);
+    return lua_pushinteger(ls, count), 1;
+}
+
+static int I2C_write_timeout_per_char_us(lua_State* ls) {
+    i2c_inst_t* inst = mlua_check_I2C(ls, 1);
+    uint16_t addr = luaL_checkinteger(ls, 2);
+    size_t len;
+    uint8_t const* src = (uint8_t const*)luaL_checklstring(ls, 3, &len);
+    bool nostop = mlua_to_cbool(ls, 4);
+    uint timeout = luaL_checkinteger(ls, 5);
+    int res = i2c_write_timeout_per_char_us(inst, addr, src, len, nostop,
+                                            timeout);
+    if (res < 0) {
+        luaL_pushfail(ls);
+        lua_pushinteger(ls, res);
+        return 2;
+    }
+    lua_pushinteger(ls, res);
+    return 1;
+}
+
+static int I2C_read_timeout_per_char_us(lua_State* ls) {
+    i2c_inst_t* inst = mlua_check_I2C(ls, 1);
+    uint16_t addr = luaL_checkinteger(ls, 2);
+    size_t len = luaL_checkinteger(ls, 3);
+    bool nostop = mlua_to_cbool(ls, 4);
+    uint timeout = luaL_checkinteger(ls, 5);
+    luaL_Buffer buf;
+    uint8_t* dst = (uint8_t*)luaL_buffinitsize(ls, &buf, len);
+    int count = i2c_read_timeout_per_char_us(inst, addr, dst, len, nostop,
+                                             timeout);
+    if (count < 0) {
+        luaL_pushfail(ls);
+        lua_pushinteger(ls, count);
+        return 2;
+    }
+    luaL_pushresultsize(&buf, count);
+    return 1;
+}
+
+static int I2C_write_raw_blocking(lua_State* ls) {
+    i2c_inst_t* inst = mlua_check_I2C(ls, 1);
+    size_t len;
+    uint8_t const* src = (uint8_t const*)luaL_checklstring(ls, 2, &len);
+    i2c_write_raw_blocking(inst, src, len);
+    return 0;
+}
+
+static int I2C_read_raw_blocking(lua_State* ls) {
+    i2c_inst_t* inst = mlua_check_I2C(ls, 1);
+    size_t len = luaL_checkinteger(ls, 2);
+    luaL_Buffer buf;
+    uint8_t* dst = (uint8_t*)luaL_buffinitsize(ls, &buf, len);
+    i2c_read_raw_blocking(inst, dst, len);
+    luaL_pushresultsize(&buf, len);
+    return 1;
+}
+
+// Detach the transaction from the IRQ handler. This is called through a
+// to-be-closed variable, so that the IRQ handler doesn't access the transaction
+// after the thread is killed.
+static int release_txn(lua_State* ls) {
+    uint num = lua_tointeger(ls, lua_upvalueindex(1));
+    i2c_get_hw(i2c_get_instance(num))->intr_mask = 0;
+    txns[num] = NULL;
+    return 0;
+}
+
+static int txn_result(lua_State* ls, Txn* t) {
+    i2c_inst_t* inst = mlua_to_I2C(ls, 1);
+    inst->restart_on_next = false;
+    if (t->abort_reason != 0) {
+        luaL_pushfail(ls);
+        lua_pushinteger(ls, PICO_ERROR_GENERIC);
+        lua_pushinteger(ls, t->index + 1);
+        return 3;
+    }
+    lua_pushboolean(ls, true);
+    int cnt = 1;
+    for (uint32_t i = 0; i < t->count; ++i) {
+        TxnOp* op = &t->ops[i];
+        if (!op->str) continue;
+        luaL_checkstack(ls, 1, NULL);
+        lua_pushlstring(ls, (char const*)op->dst, op->rlen);
+        ++cnt;
+    }
+    return cnt;
+}
+
+static int transact_loop(lua_State* ls, bool timeout) {
+    Txn* t = lua_touserdata(ls, 4);
+    if (t->done) return txn_result(ls, t);
+    if (timeout) {
+        luaL_pushfail(ls);
+        lua_pushinteger(ls, PICO_ERROR_TIMEOUT);
+        lua_pushinteger(ls, t->index + 1);
+        return 3;
+    }
+    return -1;
+}
+
+static int I2C_transact(lua_State* ls) {
+    i2c_inst_t* inst = mlua_check_I2C(ls, 1);
+    uint num = i2c_hw_index(inst);
+    luaL_checktype(ls, 2, LUA_TTABLE);
+    lua_settop(ls, 3);
+    bool has_deadline = !lua_isnil(ls, 3);
+    uint64_t deadline = has_deadline ? mlua_check_time(ls, 3) : 0;
+
+    // Compute the size of the transaction state, including the write data and
+    // the space for reads returned as strings.
+    lua_Unsigned count = luaL_len(ls, 2);
+    size_t size = sizeof(Txn) + count * sizeof(TxnOp);
+    for (lua_Unsigned i = 1; i <= count; ++i) {
+        luaL_argexpected(ls, lua_geti(ls, 2, i) == LUA_TTABLE, 2,
+                         "table of operations");
+        MLuaBuffer buf;
+        lua_getfield(ls, -1, "write");
+        if (!lua_isnil(ls, -1)) {
+            luaL_argexpected(ls, mlua_get_ro_buffer(ls, -1, &buf)
+                                 && buf.vt == NULL && buf.size != SIZE_MAX,
+                             2, "string or raw buffer");
+            size += buf.size;
+        }
+        if (lua_getfield(ls, -2, "read") == LUA_TNUMBER) {
+            lua_Integer len = lua_tointeger(ls, -1);
+            luaL_argcheck(ls, len >= 0, 2, "invalid read length");
+            size += len;
+        }
+        lua_pop(ls, 3);
+    }
+
+    // Set up the transaction.
+    Txn* t = lua_newuserdatauv(ls, size, 0);
+    *t = (Txn){.count = count};
+    uint8_t* data = (uint8_t*)&t->ops[count];
+    for (lua_Unsigned i = 1; i <= count; ++i) {
+        TxnOp* op = &t->ops[i - 1];
+        *op = (TxnOp){0};
+        lua_geti(ls, 2, i);
+        lua_geti(ls, -1, 1);
+        op->addr = luaL_checkinteger(ls, -1);
+        MLuaBuffer buf;
+        if (lua_getfield(ls, -2, "write") != LUA_TNIL) {
+            mlua_get_ro_buffer(ls, -1, &buf);
+            memcpy(data, buf.ptr, buf.size);
+            op->src = data;
+            op->wlen = buf.size;
+            data += buf.size;
+        }
+        int typ = lua_getfield(ls, -3, "read");
+        if (typ == LUA_TNUMBER) {
+            op->dst = data;
+            op->rlen = lua_tointeger(ls, -1);
+            op->str = true;
+            data += op->rlen;
+        } else if (typ != LUA_TNIL) {
+            luaL_argexpected(ls, mlua_get_buffer(ls, -1, &buf)
+                                 && buf.vt == NULL && buf.size != SIZE_MAX,
+                             2, "integer or raw buffer");
+            op->dst = buf.ptr;
+            op->rlen = buf.size;
+        }
+        luaL_argcheck(ls, op->wlen + op->rlen > 0, 2, "empty operation");
+        lua_pop(ls, 4);
+    }
+    if (count == 0) return lua_pushboolean(ls, true), 1;
+
+    lua_pushinteger(ls, num);
+    lua_pushcclosure(ls, &release_txn, 1);
+    lua_toclose(ls, -1);
+    MLuaEvent* event = &mlua_i2c_state[num].event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        uint32_t save = save_and_disable_interrupts();
+        txns[num] = t;
+        t->done = txn_step(inst, t);
+        restore_interrupts(save);
+        return mlua_event_wait(ls, event, 0, &transact_loop,
+                               has_deadline ? 3 : 0);
+    }
+    while (!txn_step(inst, t)) {
+        if (has_deadline && time_reached(from_us_since_boot(deadline))) {
+            t->done = false;
+            return transact_loop(ls, true);
+        }
+    }
+    t->done = true;
+    return transact_loop(ls, false);
+}
+
 static int I2C_read_data_cmd(lua_State* ls) {
     i2c_inst_t* inst = mlua_check_I2C(ls, 1);
     i2c_hw_t* hw = i2c_get_hw(inst);
@@ -313,18 +663,18 @@ static int I2C_read_data_cmd(lua_State* ls) {
 }
 
 MLUA_FUNC_R2(I2C_, i2c_, init, lua_pushinteger, mlua_check_I2C,
-             luaL_checkinteger)
+             mlua_arg_integer)
 MLUA_FUNC_R2(I2C_, i2c_, set_baudrate, lua_pushinteger, mlua_check_I2C,
-             luaL_checkinteger)
-MLUA_FUNC_V3(I2C_, i2c_, set_slave_mode, mlua_check_I2C, mlua_to_cbool,
-             luaL_checkinteger)
+             mlua_arg_integer)
+MLUA_FUNC_V3(I2C_, i2c_, set_slave_mode, mlua_check_I2C, mlua_arg_cbool,
+             mlua_arg_integer)
 MLUA_FUNC_R1(I2C_, i2c_, hw_index, lua_pushinteger, mlua_check_I2C)
 MLUA_FUNC_R1(I2C_, i2c_, get_write_available, lua_pushinteger, mlua_check_I2C)
 MLUA_FUNC_R1(I2C_, i2c_, get_read_available, lua_pushinteger, mlua_check_I2C)
 MLUA_FUNC_R1(I2C_, i2c_, read_byte_raw, lua_pushinteger, mlua_check_I2C)
-MLUA_FUNC_V2(I2C_, i2c_, write_byte_raw, mlua_check_I2C, luaL_checkinteger)
+MLUA_FUNC_V2(I2C_, i2c_, write_byte_raw, mlua_check_I2C, mlua_arg_integer)
 MLUA_FUNC_R2(I2C_, i2c_, get_dreq, lua_pushinteger, mlua_check_I2C,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 
 #define I2C_write_blocking_until I2C_write_blocking
 #define I2C_read_blocking_until I2C_read_blocking
@@ -339,15 +689,17 @@ MLUA_SYMBOLS(I2C_syms) = {
     MLUA_SYM_F(write_blocking_until, I2C_),
     MLUA_SYM_F(read_blocking_until, I2C_),
     MLUA_SYM_F(write_timeout_us, I2C_),
-    // TODO: MLUA_SYM_F(write_timeout_per_char_us, I2C_),
+    MLUA_SYM_F(write_timeout_per_char_us, I2C_),
     MLUA_SYM_F(read_timeout_us, I2C_),
-    // TODO: MLUA_SYM_F(read_timeout_per_char_us, I2C_),
+    MLUA_SYM_F(read_timeout_per_char_us, I2C_),
     MLUA_SYM_F(write_blocking, I2C_),
     MLUA_SYM_F(read_blocking, I2C_),
+    MLUA_SYM_F(read_blocking_into, I2C_),
     MLUA_SYM_F(get_write_available, I2C_),
     MLUA_SYM_F(get_read_available, I2C_),
-    // TODO: MLUA_SYM_F(write_raw_blocking, I2C_),
-    // TODO: MLUA_SYM_F(read_raw_blocking, I2C_),
+    MLUA_SYM_F(write_raw_blocking, I2C_),
+    MLUA_SYM_F(read_raw_blocking, I2C_),
+    MLUA_SYM_F(transact, I2C_),
     MLUA_SYM_F(read_data_cmd, I2C_),
     MLUA_SYM_F(read_byte_raw, I2C_),
     MLUA_SYM_F(write_byte_raw, I2C_),
@@ -8,8 +8,10 @@ local i2c = require 'hardware.i2c'
 local addressmap = require 'hardware.regs.addressmap'
 local regs = require 'hardware.regs.i2c'
 local config = require 'mlua.config'
+local mem = require 'mlua.mem'
 local testing_i2c = require 'mlua.testing.i2c'
 local thread = require 'mlua.thread'
+local pico = require 'pico'
 local multicore = require 'pico.multicore'
 
 local module_name = ...
@@ -73,6 +75,39 @@ function test_master_BNB(t)
     t:expect(t.expr(master):write_blocking(slave_addr, '\x00', true)):eq(1)
     t:expect(t.expr(master):read_blocking(slave_addr, 10 * #data, false))
         :eq(data:rep(10))
+
+    -- Read into a buffer.
+    local buf = mem.alloc(10)
+    mem.fill(buf, ('.'):byte())
+    t:expect(t.expr(master):write_blocking(slave_addr, '\x03', true)):eq(1)
+    t:expect(t.expr(master):read_blocking_into(slave_addr, buf, 2, 6, false))
+        :eq(6)
+    t:expect(t.expr(mem).read(buf)):eq('..defghi..')
+
+    -- Perform a batched transaction.
+    mem.fill(buf, ('.'):byte())
+    local ok, r1, r2 = master:transact({
+        {slave_addr, write = '\x00ABCDEFGH'},
+        {slave_addr, write = '\x02', read = 3},
+        {slave_addr, write = '\x04', read = buf},
+        {slave_addr, write = '\x06', read = 2},
+    })
+    t:expect(ok):label("ok"):eq(true)
+    t:expect(r1):label("r1"):eq('CDE')
+    t:expect(r2):label("r2"):eq('GH')
+    t:expect(t.expr(mem).read(buf, 0, 4)):eq('EFGH')
+    t:expect(t.expr(master):transact({})):eq(true)
+    t:expect(t.expr(master):transact({{slave_addr}}))
+        :raises("empty operation")
+
+    -- Fail a transaction.
+    local res, err, index = master:transact({
+        {slave_addr, write = '\x00'},
+        {slave_addr + 1, read = 1},
+    })
+    t:expect(res):label("res"):eq(nil)
+    t:expect(err):label("err"):eq(pico.ERROR_GENERIC)
+    t:expect(index):label("index"):eq(2)
 end
 
 function core1_slave()
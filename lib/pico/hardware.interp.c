@@ -0,0 +1,343 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "hardware/interp.h"
+#include "pico/platform.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/module.h"
+#include "mlua/util.h"
+
+static interp_hw_t* check_interp(lua_State* ls, int arg) {
+    lua_Unsigned num = luaL_checkinteger(ls, arg);
+    luaL_argcheck(ls, num < 2, arg, "invalid interpolator");
+    return num == 0 ? interp0 : interp1;
+}
+
+static uint check_lane(lua_State* ls, int arg) {
+    lua_Unsigned num = luaL_checkinteger(ls, arg);
+    luaL_argcheck(ls, num < 2, arg, "invalid lane");
+    return num;
+}
+
+static uint check_base(lua_State* ls, int arg) {
+    lua_Unsigned num = luaL_checkinteger(ls, arg);
+    luaL_argcheck(ls, num < 3, arg, "invalid base");
+    return num;
+}
+
+static char const Config_name[] = "hardware.interp.Config";
+
+static inline interp_config* check_Config(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Config_name);
+}
+
+static int Config_ctrl(lua_State* ls) {
+    interp_config const* cfg = check_Config(ls, 1);
+    return lua_pushinteger(ls, cfg->ctrl), 1;
+}
+
+MLUA_FUNC_S2(Config_, interp_config_, set_shift, check_Config,
+             mlua_arg_integer)
+MLUA_FUNC_S3(Config_, interp_config_, set_mask, check_Config,
+             mlua_arg_integer, mlua_arg_integer)
+MLUA_FUNC_S2(Config_, interp_config_, set_cross_input, check_Config,
+             mlua_arg_cbool)
+MLUA_FUNC_S2(Config_, interp_config_, set_cross_result, check_Config,
+             mlua_arg_cbool)
+MLUA_FUNC_S2(Config_, interp_config_, set_signed, check_Config, mlua_arg_cbool)
+MLUA_FUNC_S2(Config_, interp_config_, set_add_raw, check_Config,
+             mlua_arg_cbool)
+MLUA_FUNC_S2(Config_, interp_config_, set_blend, check_Config, mlua_arg_cbool)
+MLUA_FUNC_S2(Config_, interp_config_, set_clamp, check_Config, mlua_arg_cbool)
+MLUA_FUNC_S2(Config_, interp_config_, set_force_bits, check_Config,
+             mlua_arg_integer)
+
+MLUA_SYMBOLS(Config_syms) = {
+    MLUA_SYM_F(ctrl, Config_),
+    MLUA_SYM_F(set_shift, Config_),
+    MLUA_SYM_F(set_mask, Config_),
+    MLUA_SYM_F(set_cross_input, Config_),
+    MLUA_SYM_F(set_cross_result, Config_),
+    MLUA_SYM_F(set_signed, Config_),
+    MLUA_SYM_F(set_add_raw, Config_),
+    MLUA_SYM_F(set_blend, Config_),
+    MLUA_SYM_F(set_clamp, Config_),
+    MLUA_SYM_F(set_force_bits, Config_),
+};
+
+static int mod_default_config(lua_State* ls) {
+    interp_config* cfg = lua_newuserdatauv(ls, sizeof(interp_config), 0);
+    luaL_getmetatable(ls, Config_name);
+    lua_setmetatable(ls, -2);
+    *cfg = interp_default_config();
+    return 1;
+}
+
+static int mod_set_config(lua_State* ls) {
+    interp_set_config(check_interp(ls, 1), check_lane(ls, 2),
+                      check_Config(ls, 3));
+    return 0;
+}
+
+static int mod_regs(lua_State* ls) {
+    return lua_pushlightuserdata(ls, check_interp(ls, 1)), 1;
+}
+
+static int mod_lane_is_claimed(lua_State* ls) {
+    interp_hw_t* interp = check_interp(ls, 1);
+    uint lane = check_lane(ls, 2);
+    return lua_pushboolean(ls, interp_lane_is_claimed(interp, lane)), 1;
+}
+
+MLUA_FUNC_V2(mod_, interp_, claim_lane, check_interp, check_lane)
+MLUA_FUNC_V2(mod_, interp_, claim_lane_mask, check_interp, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, interp_, unclaim_lane, check_interp, check_lane)
+MLUA_FUNC_V2(mod_, interp_, unclaim_lane_mask, check_interp,
+             mlua_arg_integer)
+MLUA_FUNC_V3(mod_, interp_, set_force_bits, check_interp, check_lane,
+             mlua_arg_integer)
+MLUA_FUNC_V3(mod_, interp_, set_base, check_interp, check_base,
+             mlua_arg_integer)
+MLUA_FUNC_R2(mod_, interp_, get_base, lua_pushinteger, check_interp,
+             check_base)
+MLUA_FUNC_V2(mod_, interp_, set_base_both, check_interp, mlua_arg_integer)
+MLUA_FUNC_V3(mod_, interp_, set_accumulator, check_interp, check_lane,
+             mlua_arg_integer)
+MLUA_FUNC_R2(mod_, interp_, get_accumulator, lua_pushinteger, check_interp,
+             check_lane)
+MLUA_FUNC_V3(mod_, interp_, add_accumulater, check_interp, check_lane,
+             mlua_arg_integer)
+MLUA_FUNC_R2(mod_, interp_, get_raw, lua_pushinteger, check_interp,
+             check_lane)
+MLUA_FUNC_R2(mod_, interp_, pop_lane_result, lua_pushinteger, check_interp,
+             check_lane)
+MLUA_FUNC_R2(mod_, interp_, peek_lane_result, lua_pushinteger, check_interp,
+             check_lane)
+MLUA_FUNC_R1(mod_, interp_, pop_full_result, lua_pushinteger, check_interp)
+MLUA_FUNC_R1(mod_, interp_, peek_full_result, lua_pushinteger, check_interp)
+
+#define mod_add_accumulator mod_add_accumulater
+
+// A raw buffer of elements of 1, 2 or 4 bytes.
+typedef struct Elements {
+    void* ptr;
+    size_t len;
+    uint8_t size;
+    uint8_t shift;
+} Elements;
+
+static void check_elements(lua_State* ls, int arg, Elements* e, bool ro) {
+    MLuaBuffer buf;
+    bool ok = ro ? mlua_get_ro_buffer(ls, arg, &buf)
+                 : mlua_get_buffer(ls, arg, &buf);
+    luaL_argexpected(ls, ok && buf.vt == NULL && buf.size != SIZE_MAX, arg,
+                     "raw buffer");
+    lua_Integer size = mlua_buffer_elt_size(ls, arg, 1);
+    luaL_argcheck(ls, (size == 1 || size == 2 || size == 4)
+                      && ((uintptr_t)buf.ptr & (size - 1)) == 0, arg,
+                  "invalid element size or alignment");
+    e->ptr = buf.ptr;
+    e->size = size;
+    e->shift = size >> 1;
+    e->len = buf.size >> e->shift;
+}
+
+static inline uint32_t load(void const* ptr, uint8_t size, size_t i) {
+    switch (size) {
+    case 1: return ((uint8_t const*)ptr)[i];
+    case 2: return ((uint16_t const*)ptr)[i];
+    default: return ((uint32_t const*)ptr)[i];
+    }
+}
+
+static inline void store(void* ptr, uint8_t size, size_t i, uint32_t value) {
+    switch (size) {
+    case 1: ((uint8_t*)ptr)[i] = value; break;
+    case 2: ((uint16_t*)ptr)[i] = value; break;
+    default: ((uint32_t*)ptr)[i] = value; break;
+    }
+}
+
+static int mod_lookup(lua_State* ls) {
+    interp_hw_t* interp = check_interp(ls, 1);
+    Elements dst, src, pal;
+    check_elements(ls, 2, &dst, false);
+    check_elements(ls, 3, &src, true);
+    check_elements(ls, 4, &pal, true);
+    luaL_argcheck(ls, pal.size == dst.size, 4, "element size mismatch");
+    luaL_argcheck(ls, pal.len >= 2, 4, "palette too small");
+    luaL_argcheck(ls, dst.len >= src.len, 2, "destination too small");
+    size_t len = src.len;
+
+    // Mask indexes to the largest power of two that fits in the palette.
+    uint bits = 31 - __builtin_clz(pal.len < 256 ? (uint32_t)pal.len : 256);
+    interp_hw_save_t save;
+    interp_save(interp, &save);
+    interp_config cfg = interp_default_config();
+    interp_config_set_mask(&cfg, pal.shift, pal.shift + bits - 1);
+    interp_set_config(interp, 0, &cfg);
+    interp_set_base(interp, 0, (uintptr_t)pal.ptr);
+    for (size_t i = 0; i < len; ++i) {
+        interp_set_accumulator(interp, 0, load(src.ptr, src.size, i)
+                                          << pal.shift);
+        void const* entry = (void const*)interp_peek_lane_result(interp, 0);
+        store(dst.ptr, dst.size, i, load(entry, pal.size, 0));
+    }
+    interp_restore(interp, &save);
+    return 0;
+}
+
+static int mod_step(lua_State* ls) {
+    interp_hw_t* interp = check_interp(ls, 1);
+    Elements dst, tex;
+    check_elements(ls, 2, &dst, false);
+    check_elements(ls, 3, &tex, true);
+    luaL_argcheck(ls, tex.size == dst.size, 3, "element size mismatch");
+    lua_Unsigned wbits = luaL_checkinteger(ls, 4);
+    lua_Unsigned hbits = luaL_checkinteger(ls, 5);
+    lua_Unsigned frac = luaL_checkinteger(ls, 6);
+    luaL_argcheck(ls, wbits >= 1 && wbits + tex.shift < 32, 4,
+                  "invalid width");
+    luaL_argcheck(ls, hbits >= 1 && wbits + hbits + tex.shift <= 32, 5,
+                  "invalid height");
+    luaL_argcheck(ls, frac >= wbits + tex.shift && frac < 32, 6,
+                  "invalid fractional bits");
+    luaL_argcheck(ls, (tex.len >> wbits) >> hbits >= 1, 3,
+                  "texture too small");
+    uint32_t u = luaL_checkinteger(ls, 7);
+    uint32_t v = luaL_checkinteger(ls, 8);
+    uint32_t du = luaL_checkinteger(ls, 9);
+    uint32_t dv = luaL_checkinteger(ls, 10);
+    size_t len = dst.len;
+
+    // Lane 0 extracts the texel column from u, and lane 1 the row from v.
+    // Both accumulators are stepped by the raw bases on every pop.
+    interp_hw_save_t save;
+    interp_save(interp, &save);
+    interp_config cfg = interp_default_config();
+    interp_config_set_add_raw(&cfg, true);
+    interp_config_set_shift(&cfg, frac - tex.shift);
+    interp_config_set_mask(&cfg, tex.shift, tex.shift + wbits - 1);
+    interp_set_config(interp, 0, &cfg);
+    interp_config_set_shift(&cfg, frac - wbits - tex.shift);
+    interp_config_set_mask(&cfg, tex.shift + wbits,
+                           tex.shift + wbits + hbits - 1);
+    interp_set_config(interp, 1, &cfg);
+    interp_set_base(interp, 0, du);
+    interp_set_base(interp, 1, dv);
+    interp_set_base(interp, 2, (uintptr_t)tex.ptr);
+    interp_set_accumulator(interp, 0, u);
+    interp_set_accumulator(interp, 1, v);
+    for (size_t i = 0; i < len; ++i) {
+        void const* texel = (void const*)interp_pop_full_result(interp);
+        store(dst.ptr, dst.size, i, load(texel, tex.size, 0));
+    }
+    u = interp_get_accumulator(interp, 0);
+    v = interp_get_accumulator(interp, 1);
+    interp_restore(interp, &save);
+    lua_pushinteger(ls, u);
+    lua_pushinteger(ls, v);
+    return 2;
+}
+
+static int mod_clamp(lua_State* ls) {
+    Elements dst, src;
+    check_elements(ls, 1, &dst, false);
+    check_elements(ls, 2, &src, true);
+    luaL_argcheck(ls, dst.size == 4, 1, "invalid element size");
+    luaL_argcheck(ls, src.size == 4, 2, "invalid element size");
+    uint32_t min = luaL_checkinteger(ls, 3);
+    uint32_t max = luaL_checkinteger(ls, 4);
+    bool is_signed = lua_isnoneornil(ls, 5) || mlua_to_cbool(ls, 5);
+    luaL_argcheck(ls, dst.len >= src.len, 1, "destination too small");
+    size_t len = src.len;
+
+    // Only interpolator 1 has a clamp mode.
+    interp_hw_save_t save;
+    interp_save(interp1, &save);
+    interp_config cfg = interp_default_config();
+    interp_config_set_clamp(&cfg, true);
+    interp_config_set_signed(&cfg, is_signed);
+    interp_set_config(interp1, 0, &cfg);
+    interp_set_base(interp1, 0, min);
+    interp_set_base(interp1, 1, max);
+    for (size_t i = 0; i < len; ++i) {
+        interp_set_accumulator(interp1, 0, ((uint32_t const*)src.ptr)[i]);
+        ((uint32_t*)dst.ptr)[i] = interp_peek_lane_result(interp1, 0);
+    }
+    interp_restore(interp1, &save);
+    return 0;
+}
+
+static int mod_blend(lua_State* ls) {
+    Elements dst, a, b;
+    check_elements(ls, 1, &dst, false);
+    check_elements(ls, 2, &a, true);
+    check_elements(ls, 3, &b, true);
+    lua_Unsigned alpha = luaL_checkinteger(ls, 4);
+    luaL_argcheck(ls, alpha < 256, 4, "invalid alpha");
+    luaL_argcheck(ls, a.size == dst.size, 2, "element size mismatch");
+    luaL_argcheck(ls, b.size == dst.size, 3, "element size mismatch");
+    size_t len = a.len < b.len ? a.len : b.len;
+    luaL_argcheck(ls, dst.len >= len, 1, "destination too small");
+
+    // Only interpolator 0 has a blend mode. Lane 1 interpolates between the
+    // two bases, using the 8 LSBs of its shift and mask value as the factor.
+    interp_hw_save_t save;
+    interp_save(interp0, &save);
+    interp_config cfg = interp_default_config();
+    interp_config_set_blend(&cfg, true);
+    interp_set_config(interp0, 0, &cfg);
+    cfg = interp_default_config();
+    interp_set_config(interp0, 1, &cfg);
+    interp_set_accumulator(interp0, 1, alpha);
+    for (size_t i = 0; i < len; ++i) {
+        interp_set_base(interp0, 0, load(a.ptr, a.size, i));
+        interp_set_base(interp0, 1, load(b.ptr, b.size, i));
+        store(dst.ptr, dst.size, i, interp_peek_lane_result(interp0, 1));
+    }
+    interp_restore(interp0, &save);
+    return 0;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_F(default_config, mod_),
+    MLUA_SYM_F(set_config, mod_),
+    MLUA_SYM_F(regs, mod_),
+    MLUA_SYM_F(claim_lane, mod_),
+    MLUA_SYM_F(claim_lane_mask, mod_),
+    MLUA_SYM_F(unclaim_lane, mod_),
+    MLUA_SYM_F(unclaim_lane_mask, mod_),
+    MLUA_SYM_F(lane_is_claimed, mod_),
+    MLUA_SYM_F(set_force_bits, mod_),
+    MLUA_SYM_F(set_base, mod_),
+    MLUA_SYM_F(get_base, mod_),
+    MLUA_SYM_F(set_base_both, mod_),
+    MLUA_SYM_F(set_accumulator, mod_),
+    MLUA_SYM_F(get_accumulator, mod_),
+    MLUA_SYM_F(add_accumulator, mod_),
+    MLUA_SYM_F(get_raw, mod_),
+    MLUA_SYM_F(pop_lane_result, mod_),
+    MLUA_SYM_F(peek_lane_result, mod_),
+    MLUA_SYM_F(pop_full_result, mod_),
+    MLUA_SYM_F(peek_full_result, mod_),
+    MLUA_SYM_F(lookup, mod_),
+    MLUA_SYM_F(step, mod_),
+    MLUA_SYM_F(clamp, mod_),
+    MLUA_SYM_F(blend, mod_),
+};
+
+MLUA_OPEN_MODULE(hardware.interp) {
+    // Create the module.
+    mlua_new_module(ls, 0, module_syms);
+
+    // Create the Config class.
+    mlua_new_class(ls, Config_name, Config_syms, mlua_nosyms);
+    lua_pop(ls, 1);
+    return 1;
+}
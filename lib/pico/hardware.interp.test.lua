@@ -0,0 +1,73 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local interp = require 'hardware.interp'
+local addressmap = require 'hardware.regs.addressmap'
+local array = require 'mlua.array'
+
+function test_regs(t)
+    t:expect(t.expr(interp).regs(0)):eq(addressmap.SIO_BASE + 0x080)
+    t:expect(t.expr(interp).regs(1)):eq(addressmap.SIO_BASE + 0x0c0)
+    t:expect(t.expr(interp).regs(2)):raises("invalid interpolator")
+end
+
+function test_lanes(t)
+    interp.claim_lane(0, 0)
+    t:cleanup(function() interp.unclaim_lane(0, 0) end)
+    t:expect(t.expr(interp).lane_is_claimed(0, 0)):eq(true)
+    t:expect(t.expr(interp).lane_is_claimed(0, 1)):eq(false)
+
+    -- Lane 0 extracts bits 4..7 of the accumulator, and adds base 0.
+    local cfg = interp.default_config():set_shift(4):set_mask(0, 3)
+    interp.set_config(0, 0, cfg)
+    interp.set_base(0, 0, 100)
+    interp.set_accumulator(0, 0, 0x1234)
+    t:expect(t.expr(interp).get_accumulator(0, 0)):eq(0x1234)
+    t:expect(t.expr(interp).get_raw(0, 0)):eq(3)
+    t:expect(t.expr(interp).peek_lane_result(0, 0)):eq(103)
+    t:expect(t.expr(interp).pop_lane_result(0, 0)):eq(103)
+    t:expect(t.expr(interp).get_accumulator(0, 0)):eq(103)
+    interp.add_accumulator(0, 0, 0x10)
+    t:expect(t.expr(interp).peek_lane_result(0, 0)):eq(107)
+end
+
+function test_lookup(t)
+    local pal = array('H', 16)
+    for i = 1, 16 do pal:set(i, 1000 + i - 1) end
+    local src = array('B', 5):set(1, 0, 3, 15, 16, 255)
+    local dst = array('H', 5)
+    interp.lookup(0, dst, src, pal)
+    t:expect(dst):eq(array('H', 5):set(1, 1000, 1003, 1015, 1000, 1015))
+    t:expect(t.expr(interp).lookup(0, array('H', 1), src, pal))
+        :raises("destination too small")
+    t:expect(t.expr(interp).lookup(0, array('B', 5), src, pal))
+        :raises("element size mismatch")
+end
+
+function test_step(t)
+    -- A 4x4 texture, stepped by 1/2 texel horizontally and 1 texel vertically.
+    local tex = array('B', 16)
+    for i = 1, 16 do tex:set(i, i - 1) end
+    local dst = array('B', 4)
+    local u, v = interp.step(0, dst, tex, 2, 2, 16, 0, 0, 0x8000, 0x10000)
+    t:expect(dst):eq(array('B', 4):set(1, 0, 4, 9, 13))
+    t:expect(u):label("u"):eq(0x20000)
+    t:expect(v):label("v"):eq(0x40000)
+end
+
+function test_clamp(t)
+    local src = array('i', 5):set(1, -100, -5, 0, 5, 100)
+    local dst = array('i', 5)
+    interp.clamp(dst, src, -10, 10)
+    t:expect(dst):eq(array('i', 5):set(1, -10, -5, 0, 5, 10))
+end
+
+function test_blend(t)
+    local a = array('B', 3):set(1, 0, 100, 10)
+    local b = array('B', 3):set(1, 255, 200, 20)
+    local dst = array('B', 3)
+    interp.blend(dst, a, b, 128)
+    t:expect(dst):eq(array('B', 3):set(1, 127, 150, 15))
+end
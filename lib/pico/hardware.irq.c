@@ -4,13 +4,16 @@
 #include <assert.h>
 #include <stdbool.h>
 
+#include "hardware/gpio.h"
 #include "hardware/irq.h"
 #include "hardware/structs/nvic.h"
+#include "hardware/structs/timer.h"
 #include "hardware/sync.h"
 #include "pico/platform.h"
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/hardware.gpio.h"
 #include "mlua/module.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
@@ -124,6 +127,179 @@ static int mod_remove_handler(lua_State* ls) {
 
 #endif  // LIB_MLUA_MOD_MLUA_THREAD
 
+// The kinds of native IRQ actions.
+typedef enum ActionKind {
+    ACTION_COUNT,
+    ACTION_MIRROR,
+    ACTION_CAPTURE,
+} ActionKind;
+
+// A native IRQ action, run directly by the IRQ handler. The action triggers
+// when the bits in "mask" of the "status" register are set, or on every IRQ if
+// "status" is NULL. The triggering bits are then written to the "ack"
+// register, if set, to acknowledge them.
+typedef struct Action {
+    struct Action* next;
+    io_ro_32* status;
+    io_wo_32* ack;
+    uint32_t mask;
+    uint32_t volatile count;
+    uint32_t* slots;
+    uint32_t num_slots;
+    int16_t irq;
+    uint8_t kind;
+    uint8_t in;
+    uint8_t out;
+} Action;
+
+static char const Action_name[] = "hardware.irq.Action";
+
+// The actions attached to each IRQ.
+static Action* actions[NUM_IRQS];
+
+static void __time_critical_func(handle_actions)(void) {
+    uint irq = __get_current_exception() - VTABLE_FIRST_IRQ;
+    for (Action* a = actions[irq]; a != NULL; a = a->next) {
+        uint32_t pending = a->status != NULL ? *a->status & a->mask : 1;
+        if (pending == 0) continue;
+        if (a->ack != NULL) *a->ack = pending;
+        uint32_t count = a->count;
+        switch (a->kind) {
+        case ACTION_MIRROR:
+            gpio_put(a->out, gpio_get(a->in));
+            break;
+        case ACTION_CAPTURE:
+            a->slots[count % a->num_slots] = timer_hw->timerawl;
+            break;
+        }
+        a->count = count + 1;
+    }
+}
+
+static void* check_reg(lua_State* ls, int arg) {
+    if (lua_isnoneornil(ls, arg)) return NULL;
+    MLuaBuffer buf;
+    if (mlua_get_buffer(ls, arg, &buf) && buf.vt == NULL) return buf.ptr;
+    luaL_typeerror(ls, arg, "nil or pointer");
+    return NULL;
+}
+
+static Action* new_Action(lua_State* ls, ActionKind kind) {
+    io_ro_32* status = check_reg(ls, 1);
+    io_wo_32* ack = check_reg(ls, 2);
+    uint32_t mask = luaL_optinteger(ls, 3, 0);
+    Action* a = lua_newuserdatauv(ls, sizeof(Action), 1);
+    *a = (Action){.status = status, .ack = ack, .mask = mask, .irq = -1,
+                  .kind = kind};
+    luaL_getmetatable(ls, Action_name);
+    lua_setmetatable(ls, -2);
+    return a;
+}
+
+static int mod_count_action(lua_State* ls) {
+    new_Action(ls, ACTION_COUNT);
+    return 1;
+}
+
+static int mod_mirror_action(lua_State* ls) {
+    uint in = mlua_check_gpio(ls, 4);
+    uint out = mlua_check_gpio(ls, 5);
+    Action* a = new_Action(ls, ACTION_MIRROR);
+    a->in = in;
+    a->out = out;
+    return 1;
+}
+
+static int mod_capture_action(lua_State* ls) {
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 4, &buf) && buf.vt == NULL, 4,
+                     "raw buffer");
+    luaL_argcheck(ls, buf.size != SIZE_MAX && buf.size >= sizeof(uint32_t)
+                      && ((uintptr_t)buf.ptr & 3) == 0, 4, "invalid buffer");
+    Action* a = new_Action(ls, ACTION_CAPTURE);
+    a->slots = buf.ptr;
+    a->num_slots = buf.size / sizeof(uint32_t);
+    lua_pushvalue(ls, 4);  // Keep the buffer alive
+    lua_setiuservalue(ls, -2, 1);
+    return 1;
+}
+
+static inline Action* check_Action(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Action_name);
+}
+
+static int Action_attach(lua_State* ls) {
+    Action* a = check_Action(ls, 1);
+    uint irq = check_irq(ls, 2);
+    lua_Integer priority = luaL_optinteger(
+        ls, 3, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+    luaL_argcheck(ls,
+                  PICO_SHARED_IRQ_HANDLER_LOWEST_ORDER_PRIORITY <= priority &&
+                  priority <= PICO_SHARED_IRQ_HANDLER_HIGHEST_ORDER_PRIORITY,
+                  3, "invalid priority");
+    if (a->irq >= 0) return luaL_error(ls, "IRQ action already attached");
+    bool first = actions[irq] == NULL;
+    if (first) irq_add_shared_handler(irq, &handle_actions, priority);
+    uint32_t save = save_and_disable_interrupts();
+    a->irq = irq;
+    a->next = actions[irq];
+    actions[irq] = a;
+    restore_interrupts(save);
+
+    // Keep the action alive while it is attached.
+    lua_pushvalue(ls, 1);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, a);
+    return lua_settop(ls, 1), 1;
+}
+
+static int Action_detach(lua_State* ls) {
+    Action* a = check_Action(ls, 1);
+    if (a->irq < 0) return 0;
+    uint irq = a->irq;
+    uint32_t save = save_and_disable_interrupts();
+    for (Action** p = &actions[irq]; *p != NULL; p = &(*p)->next) {
+        if (*p == a) {
+            *p = a->next;
+            break;
+        }
+    }
+    a->next = NULL;
+    a->irq = -1;
+    restore_interrupts(save);
+    if (actions[irq] == NULL) irq_remove_handler(irq, &handle_actions);
+    lua_pushnil(ls);
+    lua_rawsetp(ls, LUA_REGISTRYINDEX, a);
+    return 0;
+}
+
+static int Action_count(lua_State* ls) {
+    return lua_pushinteger(ls, check_Action(ls, 1)->count), 1;
+}
+
+static int Action_reset(lua_State* ls) {
+    Action* a = check_Action(ls, 1);
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t count = a->count;
+    a->count = 0;
+    restore_interrupts(save);
+    return lua_pushinteger(ls, count), 1;
+}
+
+MLUA_SYMBOLS(Action_syms) = {
+    MLUA_SYM_F(attach, Action_),
+    MLUA_SYM_F(detach, Action_),
+    MLUA_SYM_F(count, Action_),
+    MLUA_SYM_F(reset, Action_),
+};
+
+#define Action___close Action_detach
+#define Action___gc Action_detach
+
+MLUA_SYMBOLS_NOHASH(Action_syms_nh) = {
+    MLUA_SYM_F_NH(__close, Action_),
+    MLUA_SYM_F_NH(__gc, Action_),
+};
+
 static int mod_clear(lua_State* ls) {
     uint irq = check_irq(ls, 1);
 #if LIB_MLUA_MOD_MLUA_THREAD
@@ -172,10 +348,10 @@ static int mod_set_enabled(lua_State* ls) {
     return 0;
 }
 
-MLUA_FUNC_V2(mod_, irq_, set_priority, check_irq, luaL_checkinteger)
+MLUA_FUNC_V2(mod_, irq_, set_priority, check_irq, mlua_arg_integer)
 MLUA_FUNC_R1(mod_, irq_, get_priority, lua_pushinteger, check_irq)
 MLUA_FUNC_R1(mod_, irq_, is_enabled, lua_pushboolean, check_irq)
-MLUA_FUNC_V2(mod_, irq_, set_mask_enabled, luaL_checkinteger, mlua_to_cbool)
+MLUA_FUNC_V2(mod_, irq_, set_mask_enabled, mlua_arg_integer, mlua_arg_cbool)
 MLUA_FUNC_R1(mod_, irq_, has_shared_handler, lua_pushboolean, check_irq)
 MLUA_FUNC_V1(mod_, irq_, set_pending, check_irq)
 MLUA_FUNC_V1(mod_,, user_irq_claim, check_user_irq)
@@ -237,11 +413,18 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(user_irq_claim, mod_),
     MLUA_SYM_F(user_irq_claim_unused, mod_),
     MLUA_SYM_F(user_irq_unclaim, mod_),
+    MLUA_SYM_F(count_action, mod_),
+    MLUA_SYM_F(mirror_action, mod_),
+    MLUA_SYM_F(capture_action, mod_),
 };
 
 MLUA_OPEN_MODULE(hardware.irq) {
     mlua_thread_require(ls);
 
     mlua_new_module(ls, 0, module_syms);
+
+    // Create the Action class.
+    mlua_new_class(ls, Action_name, Action_syms, Action_syms_nh);
+    lua_pop(ls, 1);
     return 1;
 }
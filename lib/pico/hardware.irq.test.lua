@@ -3,7 +3,10 @@
 
 _ENV = module(...)
 
+local gpio = require 'hardware.gpio'
 local irq = require 'hardware.irq'
+local array = require 'mlua.array'
+local config = require 'mlua.config'
 local thread = require 'mlua.thread'
 local list = require 'mlua.list'
 local string = require 'string'
@@ -46,3 +49,72 @@ function test_user_irqs(t)
         t:expect(log == nums, "Unexpected sequence on round %s: %s", i, log)
     end
 end
+
+function test_native_actions(t)
+    local num = irq.user_irq_claim_unused()
+    t:cleanup(function() irq.user_irq_unclaim(num) end)
+
+    -- Set up the pins for mirroring.
+    local pin1, pin2 = config.GPIO_PIN1, config.GPIO_PIN2
+    for _, pin in ipairs{pin1, pin2} do
+        gpio.init(pin)
+        gpio.set_dir(pin, gpio.OUT)
+        t:cleanup(function() gpio.deinit(pin) end)
+    end
+
+    -- Attach actions.
+    local slots = array('I', 2)
+    local counter<close> = irq.count_action():attach(num)
+    local mirror<close> = irq.mirror_action(nil, nil, 0, pin1, pin2):attach(num)
+    local capture<close> = irq.capture_action(nil, nil, 0, slots):attach(num)
+    t:expect(t.expr(counter):attach(num))
+        :raises("IRQ action already attached")
+    irq.set_enabled(num, true)
+    t:cleanup(function() irq.set_enabled(num, false) end)
+
+    -- Trigger the IRQ.
+    for i = 1, 3 do
+        local level = i % 2 == 1
+        gpio.put(pin1, level)
+        irq.set_pending(num)
+        t:expect(t.expr(gpio).get(pin2)):eq(level)
+    end
+    t:expect(t.expr(counter):count()):eq(3)
+    t:expect(t.expr(mirror):count()):eq(3)
+    t:expect(t.expr(capture):count()):eq(3)
+    t:expect(slots[1] - slots[2]):label("slots[1] - slots[2]"):gt(0)
+    t:expect(t.expr(counter):reset()):eq(3)
+    t:expect(t.expr(counter):count()):eq(0)
+
+    -- Detach an action.
+    counter:detach()
+    irq.set_pending(num)
+    t:expect(t.expr(counter):count()):eq(0)
+    t:expect(t.expr(mirror):count()):eq(4)
+end
+
+function test_native_action_gc(t)
+    local num = irq.user_irq_claim_unused()
+    t:cleanup(function() irq.user_irq_unclaim(num) end)
+
+    -- Attach an action, and drop all strong references to it.
+    local weak = setmetatable({}, {__mode = 'v'})
+    weak[1] = irq.count_action():attach(num)
+    t:cleanup(function() if weak[1] then weak[1]:detach() end end)
+    irq.set_enabled(num, true)
+    t:cleanup(function() irq.set_enabled(num, false) end)
+    collectgarbage()
+    collectgarbage()
+
+    -- The action is kept alive and keeps triggering.
+    t:assert(weak[1] ~= nil, "Attached action was collected")
+    irq.set_pending(num)
+    t:expect(t.expr(weak[1]):count()):eq(1)
+
+    -- The action can be collected once detached.
+    weak[1]:detach()
+    collectgarbage()
+    collectgarbage()
+    t:expect(weak[1]):label("weak[1]"):eq(nil)
+    irq.set_pending(num)
+end
@@ -66,6 +66,13 @@ function Program:__init(prog)
     setmetatable(self.labels, nil)
 end
 
+-- Create a Program from pre-assembled data, as generated at build time by
+-- mlua_add_pio_modules().
+function program(data) return setmetatable(data, Program) end
+
+-- Return true iff the given value is a Program.
+function is_program(v) return getmetatable(v) == Program end
+
 function Program:config(offset)
     offset = offset or self.origin
     local cfg = pio.get_default_sm_config()
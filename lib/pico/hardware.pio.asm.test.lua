@@ -350,9 +350,7 @@ want_pio_quadrature_encoder = {
     config = function(cfg) cfg:set_wrap(15, 23) end,
 }
 
-local function assemble(t, name)
-    local prog = asm.assemble(_ENV[name])
-    local want = _ENV['want_' .. name]
+local function check_program(t, prog, want)
     t:expect(prog):label('instr'):fmt(instructions):eq(want.instr, list.eq)
     t:expect(t.expr(prog).labels):eq(want.labels, util.table_eq)
     t:expect(t.expr(prog).origin):eq(want.origin)
@@ -363,6 +361,20 @@ local function assemble(t, name)
     t:expect(cfg:execctrl()):label('execctrl'):fmt(hex8):eq(wcfg:execctrl())
 end
 
+local function assemble(t, name)
+    return check_program(t, asm.assemble(_ENV[name]), _ENV['want_' .. name])
+end
+
+function test_prebuilt(t)
+    local progs = require 'hardware.pio.asm.test_programs'
+    for _, name in ipairs{'timer', 'differential_manchester_tx'} do
+        t:context({name = name})
+        local prog = progs[name]
+        t:expect(t.expr(asm).is_program(prog)):eq(true)
+        check_program(t, prog, _ENV['want_pio_' .. name])
+    end
+end
+
 for name in pairs(_ENV) do
     if name:find('^pio_') then
         _ENV[('test_%s'):format(name)] = function(t)
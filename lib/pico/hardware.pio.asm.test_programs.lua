@@ -0,0 +1,45 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+-- PIO programs that are assembled at build time, for hardware.pio.asm.test.
+
+_ENV = module(...)
+
+local asm = require 'hardware.pio.asm'
+
+timer = asm.assemble(function(_ENV)
+public(start):
+    set(y, 0)
+    mov(y, ~y)
+wrap_target()
+delay:
+    pull()
+    mov(x, osr)
+loop:
+    jmp(x_dec, loop)
+    mov(isr, ~y)
+    push()
+    jmp(y_dec, delay)
+end)
+
+differential_manchester_tx = asm.assemble(function(_ENV)
+    side_set(1)
+initial_high:
+public(start):
+    out(x, 1)
+    jmp(~x, high_0)     side(1) (6)
+high_1:
+    nop()
+    jmp(initial_high)   side(0) (6)
+high_0:
+    jmp(initial_low)            (7)
+
+initial_low:
+    out(x, 1)
+    jmp(~x, low_0)      side(0) (6)
+low_1:
+    nop()
+    jmp(initial_low)    side(1) (6)
+low_0:
+    jmp(initial_high)           (7)
+end)
@@ -2,8 +2,10 @@
 // SPDX-License-Identifier: MIT
 
 #include <assert.h>
+#include <stdint.h>
 
 #include "hardware/address_mapped.h"
+#include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "hardware/pio.h"
 #include "hardware/sync.h"
@@ -11,7 +13,10 @@
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/hardware.dma.h"
+#include "mlua/int64.h"
 #include "mlua/module.h"
+#include "mlua/platform.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
 
@@ -48,31 +53,31 @@ static int Config_pinctrl(lua_State* ls) {
     return lua_pushinteger(ls, cfg->pinctrl), 1;
 }
 
-MLUA_FUNC_S3(Config_, sm_config_, set_out_pins, check_Config, luaL_checkinteger,
-             luaL_checkinteger)
-MLUA_FUNC_S3(Config_, sm_config_, set_set_pins, check_Config, luaL_checkinteger,
-             luaL_checkinteger)
-MLUA_FUNC_S2(Config_, sm_config_, set_in_pins, check_Config, luaL_checkinteger)
+MLUA_FUNC_S3(Config_, sm_config_, set_out_pins, check_Config, mlua_arg_integer,
+             mlua_arg_integer)
+MLUA_FUNC_S3(Config_, sm_config_, set_set_pins, check_Config, mlua_arg_integer,
+             mlua_arg_integer)
+MLUA_FUNC_S2(Config_, sm_config_, set_in_pins, check_Config, mlua_arg_integer)
 MLUA_FUNC_S2(Config_, sm_config_, set_sideset_pins, check_Config,
-             luaL_checkinteger)
-MLUA_FUNC_S4(Config_, sm_config_, set_sideset, check_Config, luaL_checkinteger,
-             mlua_to_cbool, mlua_to_cbool)
+             mlua_arg_integer)
+MLUA_FUNC_S4(Config_, sm_config_, set_sideset, check_Config, mlua_arg_integer,
+             mlua_arg_cbool, mlua_arg_cbool)
 MLUA_FUNC_S(Config_, sm_config_, set_clkdiv_int_frac, check_Config(ls, 1),
             luaL_checkinteger(ls, 2), luaL_optinteger(ls, 3, 0));
 MLUA_FUNC_S2(Config_, sm_config_, set_clkdiv, check_Config, luaL_checknumber)
-MLUA_FUNC_S3(Config_, sm_config_, set_wrap, check_Config, luaL_checkinteger,
-             luaL_checkinteger)
-MLUA_FUNC_S2(Config_, sm_config_, set_jmp_pin, check_Config, luaL_checkinteger)
-MLUA_FUNC_S4(Config_, sm_config_, set_in_shift, check_Config, mlua_to_cbool,
-             mlua_to_cbool, luaL_checkinteger)
-MLUA_FUNC_S4(Config_, sm_config_, set_out_shift, check_Config, mlua_to_cbool,
-             mlua_to_cbool, luaL_checkinteger)
+MLUA_FUNC_S3(Config_, sm_config_, set_wrap, check_Config, mlua_arg_integer,
+             mlua_arg_integer)
+MLUA_FUNC_S2(Config_, sm_config_, set_jmp_pin, check_Config, mlua_arg_integer)
+MLUA_FUNC_S4(Config_, sm_config_, set_in_shift, check_Config, mlua_arg_cbool,
+             mlua_arg_cbool, mlua_arg_integer)
+MLUA_FUNC_S4(Config_, sm_config_, set_out_shift, check_Config, mlua_arg_cbool,
+             mlua_arg_cbool, mlua_arg_integer)
 MLUA_FUNC_S2(Config_, sm_config_, set_fifo_join, check_Config,
-             luaL_checkinteger)
-MLUA_FUNC_S4(Config_, sm_config_, set_out_special, check_Config, mlua_to_cbool,
-             mlua_to_cbool, luaL_checkinteger)
+             mlua_arg_integer)
+MLUA_FUNC_S4(Config_, sm_config_, set_out_special, check_Config, mlua_arg_cbool,
+             mlua_arg_cbool, mlua_arg_integer)
 MLUA_FUNC_S3(Config_, sm_config_, set_mov_status, check_Config,
-             luaL_checkinteger, luaL_checkinteger)
+             mlua_arg_integer, mlua_arg_integer)
 
 MLUA_SYMBOLS(Config_syms) = {
     MLUA_SYM_F(clkdiv, Config_),
@@ -157,8 +162,11 @@ typedef struct PIOIntRegs {
 
 #define INT_REGS(pio, core) ((PIOIntRegs*)&pio->inte0 + core)
 
+// The DMA events are indexed like the corresponding FIFO events, and are
+// enabled together with them.
 typedef struct PIOState {
     MLuaEvent events[2 * NUM_PIO_STATE_MACHINES + NUM_SYS_IRQ_FLAGS];
+    MLuaEvent dma_events[2 * NUM_PIO_STATE_MACHINES];
     uint32_t mask[NUM_CORES];
 } PIOState;
 
@@ -185,6 +193,36 @@ static void __time_critical_func(handle_pio_irq)(void) {
     }
 }
 
+// The state of a free-running capture from an Rx FIFO. The buffer is split into
+// two blocks, each written by one of two DMA channels chained to each other.
+// "blocks" is the number of completed blocks, and "consumed" the number of
+// blocks returned by Capture:wait(). Capture objects hold the generation of the
+// capture they control, so that stale objects don't affect later captures.
+typedef struct PIOCapture {
+    uint8_t* ptr;
+    uint32_t size;
+    uint32_t count;
+    uint8_t ch[2];
+    bool running;
+    uint32_t gen;
+    uint32_t volatile blocks;
+    uint32_t consumed;
+    uint32_t overruns;
+    MLuaEvent* event;
+} PIOCapture;
+
+static PIOCapture pio_captures[NUM_PIOS][NUM_PIO_STATE_MACHINES];
+
+// Re-arm a DMA channel of a capture as its block completes. This is called
+// through the completion dispatcher of hardware.dma.
+static void __time_critical_func(handle_capture_dma)(uint ch, void* ctx) {
+    PIOCapture* cap = ctx;
+    uint i = cap->ch[1] == ch;
+    dma_channel_set_write_addr(ch, cap->ptr + i * cap->size, false);
+    ++cap->blocks;
+    if (cap->event != NULL) mlua_event_set(cap->event);
+}
+
 #endif  // LIB_MLUA_MOD_MLUA_THREAD
 
 static int put_loop(lua_State* ls, bool timeout) {
@@ -236,6 +274,425 @@ static int SM_get_blocking(lua_State* ls) {
     return lua_pushinteger(ls, pio_sm_get_blocking(sm->pio, sm->sm)), 1;
 }
 
+// Check the transfer size argument at index sarg for the buffer at index arg.
+// The size defaults to the element size of an mlua.Array, and to 4 otherwise.
+static uint check_transfer_size(lua_State* ls, int arg, int sarg,
+                                MLuaBuffer const* buf) {
+    lua_Integer size = lua_isnoneornil(ls, sarg)
+                       ? mlua_buffer_elt_size(ls, arg, 4)
+                       : luaL_checkinteger(ls, sarg);
+    luaL_argcheck(ls, size == 1 || size == 2 || size == 4, sarg,
+                  "invalid transfer size");
+    luaL_argcheck(ls, buf->size % size == 0
+                      && ((uintptr_t)buf->ptr & (size - 1)) == 0, arg,
+                  "buffer not aligned to transfer size");
+    return size;
+}
+
+static inline enum dma_channel_transfer_size dma_size(uint size) {
+    return size == 1 ? DMA_SIZE_8 : size == 2 ? DMA_SIZE_16 : DMA_SIZE_32;
+}
+
+// Check the (offset, count) arguments at index arg, in elements, for the buffer
+// at index arg - 1, and convert them to a byte offset and length.
+static void check_elt_range(lua_State* ls, int arg, MLuaBuffer const* buf,
+                            uint size, size_t* off, size_t* len) {
+    luaL_argcheck(ls, size == 1 || size == 2 || size == 4, arg - 1,
+                  "invalid element size");
+    lua_Unsigned cnt = buf->size == SIZE_MAX ? SIZE_MAX : buf->size / size;
+    lua_Unsigned o = luaL_optinteger(ls, arg, 0);
+    luaL_argcheck(ls, o <= cnt, arg, "out of bounds");
+    lua_Unsigned c = luaL_opt(ls, luaL_checkinteger, arg + 1, cnt - o);
+    luaL_argcheck(ls, c <= cnt - o && c <= SIZE_MAX / size, arg + 1,
+                  "out of bounds");
+    *off = o * size;
+    *len = c * size;
+}
+
+static inline uint32_t load_elt(uint8_t const* p, uint size) {
+    switch (size) {
+    case 1: return p[0];
+    case 2: return p[0] | (p[1] << 8);
+    default: return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+}
+
+static inline void store_elt(uint8_t* p, uint size, uint32_t v) {
+    for (uint i = 0; i < size; ++i, v >>= 8) p[i] = v;
+}
+
+// Stack: (sm, buf, pos, end, size, len).
+static int put_many_loop(lua_State* ls, bool timeout) {
+    SM* sm = to_SM(ls, 1);
+    MLuaBuffer buf;
+    mlua_get_ro_buffer(ls, 2, &buf);
+    size_t pos = lua_tointeger(ls, 3);
+    size_t end = lua_tointeger(ls, 4);
+    uint size = lua_tointeger(ls, 5);
+    while (pos < end) {
+        if (pio_sm_is_tx_fifo_full(sm->pio, sm->sm)) {
+            hw_set_bits(&INT_REGS(sm->pio, get_core_num())->inte,
+                        PIO_INTR_SM0_TXNFULL_BITS << sm->sm);
+            lua_pushinteger(ls, pos);
+            lua_replace(ls, 3);
+            return -1;
+        }
+        uint8_t data[4];
+        uint8_t const* p = data;
+        if (buf.vt == NULL) {
+            p = (uint8_t const*)buf.ptr + pos;
+        } else {
+            mlua_buffer_read(&buf, pos, size, data);
+        }
+        pio_sm_put(sm->pio, sm->sm, load_elt(p, size));
+        pos += size;
+    }
+    return lua_pushinteger(ls, lua_tointeger(ls, 6) / size), 1;
+}
+
+static int SM_put_many(lua_State* ls) {
+    SM* sm = check_SM(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_ro_buffer(ls, 2, &buf), 2,
+                     "string or buffer");
+    uint size = mlua_buffer_elt_size(ls, 2, 4);
+    size_t off, len;
+    check_elt_range(ls, 3, &buf, size, &off, &len);
+    PIOState* state = &pio_state[pio_get_index(sm->pio)];
+    MLuaEvent* ev = &state->events[sm->sm + PIO_INTR_SM0_TXNFULL_LSB];
+    if (((state->mask[get_core_num()]
+            & (PIO_INTR_SM0_TXNFULL_BITS << sm->sm)) != 0)
+            && mlua_event_can_wait(ls, ev, 0)) {
+        lua_settop(ls, 2);
+        lua_pushinteger(ls, off);  // pos
+        lua_pushinteger(ls, off + len);  // end
+        lua_pushinteger(ls, size);
+        lua_pushinteger(ls, len);
+        return mlua_event_wait(ls, ev, 0, &put_many_loop, 0);
+    }
+    for (size_t pos = off; pos < off + len; pos += size) {
+        uint8_t data[4];
+        uint8_t const* p = data;
+        if (buf.vt == NULL) {
+            p = (uint8_t const*)buf.ptr + pos;
+        } else {
+            mlua_buffer_read(&buf, pos, size, data);
+        }
+        pio_sm_put_blocking(sm->pio, sm->sm, load_elt(p, size));
+    }
+    return lua_pushinteger(ls, len / size), 1;
+}
+
+// Stack: (sm, buf, pos, end, size, len).
+static int get_many_loop(lua_State* ls, bool timeout) {
+    SM* sm = to_SM(ls, 1);
+    MLuaBuffer buf;
+    mlua_get_buffer(ls, 2, &buf);
+    size_t pos = lua_tointeger(ls, 3);
+    size_t end = lua_tointeger(ls, 4);
+    uint size = lua_tointeger(ls, 5);
+    while (pos < end) {
+        if (pio_sm_is_rx_fifo_empty(sm->pio, sm->sm)) {
+            hw_set_bits(&INT_REGS(sm->pio, get_core_num())->inte,
+                        PIO_INTR_SM0_RXNEMPTY_BITS << sm->sm);
+            lua_pushinteger(ls, pos);
+            lua_replace(ls, 3);
+            return -1;
+        }
+        uint8_t data[4];
+        store_elt(buf.vt == NULL ? (uint8_t*)buf.ptr + pos : data, size,
+                  pio_sm_get(sm->pio, sm->sm));
+        if (buf.vt != NULL) mlua_buffer_write(&buf, pos, size, data);
+        pos += size;
+    }
+    return lua_pushinteger(ls, lua_tointeger(ls, 6) / size), 1;
+}
+
+static int SM_get_many(lua_State* ls) {
+    SM* sm = check_SM(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 2, &buf), 2, "buffer");
+    uint size = mlua_buffer_elt_size(ls, 2, 4);
+    size_t off, len;
+    check_elt_range(ls, 3, &buf, size, &off, &len);
+    PIOState* state = &pio_state[pio_get_index(sm->pio)];
+    MLuaEvent* ev = &state->events[sm->sm + PIO_INTR_SM0_RXNEMPTY_LSB];
+    if (((state->mask[get_core_num()]
+            & (PIO_INTR_SM0_RXNEMPTY_BITS << sm->sm)) != 0)
+            && mlua_event_can_wait(ls, ev, 0)) {
+        lua_settop(ls, 2);
+        lua_pushinteger(ls, off);  // pos
+        lua_pushinteger(ls, off + len);  // end
+        lua_pushinteger(ls, size);
+        lua_pushinteger(ls, len);
+        return mlua_event_wait(ls, ev, 0, &get_many_loop, 0);
+    }
+    for (size_t pos = off; pos < off + len; pos += size) {
+        uint8_t data[4];
+        store_elt(buf.vt == NULL ? (uint8_t*)buf.ptr + pos : data, size,
+                  pio_sm_get_blocking(sm->pio, sm->sm));
+        if (buf.vt != NULL) mlua_buffer_write(&buf, pos, size, data);
+    }
+    return lua_pushinteger(ls, len / size), 1;
+}
+
+// Release the DMA channel of a transfer. This is called through a to-be-closed
+// variable, so that the transfer is aborted if the thread is killed.
+static int release_dma(lua_State* ls) {
+    uint ch = lua_tointeger(ls, lua_upvalueindex(1));
+    mlua_dma_clear_handler(ch);
+    dma_channel_abort(ch);
+    dma_channel_unclaim(ch);
+    return 0;
+}
+
+// Return the number of bytes transferred. When the deadline is reached, the
+// transfer is aborted and the number of bytes transferred so far is returned.
+static int dma_loop(lua_State* ls, bool timeout) {
+    uint ch = lua_tointeger(ls, 6);
+    if (dma_channel_is_busy(ch)) {
+        if (!timeout) return -1;
+        dma_channel_abort(ch);
+    }
+    dma_channel_hw_t* hw = dma_channel_hw_addr(ch);
+    uint size = 1u << ((hw->ctrl_trig & DMA_CH0_CTRL_TRIG_DATA_SIZE_BITS)
+                       >> DMA_CH0_CTRL_TRIG_DATA_SIZE_LSB);
+    lua_Integer len = lua_tointeger(ls, 5);
+    return lua_pushinteger(ls, len - (lua_Integer)hw->transfer_count * size), 1;
+}
+
+// Transfer data between a FIFO and memory, paced by the FIFO DREQ. Expects the
+// stack to be (sm, buf, size, deadline, len). Pushes the DMA channel and the
+// to-be-closed function releasing it, then waits for the transfer to complete.
+static int start_dma(lua_State* ls, SM* sm, bool tx, void* ptr, size_t len,
+                     uint size) {
+    int ch = dma_claim_unused_channel(false);
+    if (ch < 0) {
+        return luaL_error(ls, "PIO%d: no DMA channel available",
+                          pio_get_index(sm->pio));
+    }
+    lua_pushinteger(ls, ch);
+    lua_pushinteger(ls, ch);
+    lua_pushcclosure(ls, &release_dma, 1);
+    lua_toclose(ls, -1);
+
+    PIOState* state = &pio_state[pio_get_index(sm->pio)];
+    uint bit = sm->sm + (tx ? PIO_INTR_SM0_TXNFULL_LSB
+                            : PIO_INTR_SM0_RXNEMPTY_LSB);
+    MLuaEvent* ev = &state->dma_events[bit];
+    bool wait = (state->mask[get_core_num()] & (1u << bit)) != 0
+                && mlua_event_can_wait(ls, ev, 0);
+    if (wait) mlua_dma_set_event(ch, ev);
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+    channel_config_set_transfer_data_size(&cfg, dma_size(size));
+    channel_config_set_read_increment(&cfg, tx);
+    channel_config_set_write_increment(&cfg, !tx);
+    channel_config_set_dreq(&cfg, pio_get_dreq(sm->pio, sm->sm, tx));
+    if (tx) {
+        dma_channel_configure(ch, &cfg, &sm->pio->txf[sm->sm], ptr, len / size,
+                              true);
+    } else {
+        dma_channel_configure(ch, &cfg, ptr, &sm->pio->rxf[sm->sm], len / size,
+                              true);
+    }
+    bool has_deadline = !lua_isnil(ls, 4);
+    if (wait) {
+        return mlua_event_wait(ls, ev, 0, &dma_loop, has_deadline ? 4 : 0);
+    }
+    if (!has_deadline) {
+        dma_channel_wait_for_finish_blocking(ch);
+        return dma_loop(ls, false);
+    }
+    uint64_t deadline = mlua_check_time(ls, 4);
+    while (dma_channel_is_busy(ch) && !mlua_ticks64_reached(deadline)) {
+        tight_loop_contents();
+    }
+    return dma_loop(ls, true);
+}
+
+static int SM_put_dma(lua_State* ls) {
+    SM* sm = check_SM(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_ro_buffer(ls, 2, &buf) && buf.vt == NULL
+                         && buf.size != SIZE_MAX, 2, "string or raw buffer");
+    uint size = check_transfer_size(ls, 2, 3, &buf);
+    lua_settop(ls, 4);
+    if (!lua_isnil(ls, 4)) mlua_check_time(ls, 4);
+    lua_pushinteger(ls, buf.size);
+    if (buf.size == 0) return 1;
+    return start_dma(ls, sm, true, buf.ptr, buf.size, size);
+}
+
+static int SM_get_dma(lua_State* ls) {
+    SM* sm = check_SM(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 2, &buf) && buf.vt == NULL
+                         && buf.size != SIZE_MAX, 2, "raw buffer");
+    uint size = check_transfer_size(ls, 2, 3, &buf);
+    lua_settop(ls, 4);
+    if (!lua_isnil(ls, 4)) mlua_check_time(ls, 4);
+    lua_pushinteger(ls, buf.size);
+    if (buf.size == 0) return 1;
+    return start_dma(ls, sm, false, buf.ptr, buf.size, size);
+}
+
+static char const Capture_name[] = "hardware.pio.Capture";
+
+typedef struct CaptureRef {
+    uint32_t gen;
+    uint8_t pio;
+    uint8_t sm;
+} CaptureRef;
+
+static void configure_capture_channel(SM* sm, PIOCapture* cap, uint i,
+                                      uint size, bool trigger) {
+    uint ch = cap->ch[i];
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+    channel_config_set_transfer_data_size(&cfg, dma_size(size));
+    channel_config_set_read_increment(&cfg, false);
+    channel_config_set_write_increment(&cfg, true);
+    channel_config_set_dreq(&cfg, pio_get_dreq(sm->pio, sm->sm, false));
+    channel_config_set_chain_to(&cfg, cap->ch[i ^ 1]);
+    dma_channel_configure(ch, &cfg, cap->ptr + i * cap->size,
+                          &sm->pio->rxf[sm->sm], cap->count, trigger);
+}
+
+static void stop_capture(PIOCapture* cap) {
+    uint32_t mask = (1u << cap->ch[0]) | (1u << cap->ch[1]);
+    mlua_dma_clear_handler(cap->ch[0]);
+    mlua_dma_clear_handler(cap->ch[1]);
+    // Break the chain before aborting, so that aborting one channel doesn't
+    // trigger the other.
+    for (uint i = 0; i < 2; ++i) {
+        uint ch = cap->ch[i];
+        hw_write_masked(&dma_channel_hw_addr(ch)->al1_ctrl,
+                        ch << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB,
+                        DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS);
+    }
+    dma_hw->abort = mask;
+    while ((dma_hw->abort & mask) != 0) tight_loop_contents();
+    dma_hw->intr = mask;
+    for (uint i = 0; i < 2; ++i) dma_channel_unclaim(cap->ch[i]);
+    cap->running = false;
+}
+
+static int SM_capture(lua_State* ls) {
+    SM* sm = check_SM(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 2, &buf) && buf.vt == NULL
+                         && buf.size != SIZE_MAX, 2, "raw buffer");
+    uint size = check_transfer_size(ls, 2, 3, &buf);
+    luaL_argcheck(ls, buf.size >= 2 * size && buf.size % (2 * size) == 0, 2,
+                  "invalid buffer size");
+    uint num = pio_get_index(sm->pio);
+    PIOCapture* cap = &pio_captures[num][sm->sm];
+    if (cap->running) {
+        return luaL_error(ls, "PIO%d: SM%d capture already running", num,
+                          sm->sm);
+    }
+
+    // Create the Capture object, which keeps the buffer alive.
+    CaptureRef* ref = lua_newuserdatauv(ls, sizeof(CaptureRef), 1);
+    *ref = (CaptureRef){.gen = cap->gen + 1, .pio = num, .sm = sm->sm};
+    lua_pushvalue(ls, 2);
+    lua_setiuservalue(ls, -2, 1);
+    luaL_getmetatable(ls, Capture_name);
+    lua_setmetatable(ls, -2);
+
+    int ch0 = dma_claim_unused_channel(false);
+    int ch1 = ch0 < 0 ? -1 : dma_claim_unused_channel(false);
+    if (ch1 < 0) {
+        if (ch0 >= 0) dma_channel_unclaim(ch0);
+        return luaL_error(ls, "PIO%d: no DMA channel available", num);
+    }
+    *cap = (PIOCapture){
+        .ptr = buf.ptr, .size = buf.size / 2, .count = buf.size / 2 / size,
+        .ch = {ch0, ch1}, .running = true, .gen = ref->gen};
+    MLuaEvent* ev = &pio_state[num].dma_events[
+        sm->sm + PIO_INTR_SM0_RXNEMPTY_LSB];
+    if (mlua_event_enabled(ev)) cap->event = ev;
+    mlua_dma_set_handler(ch0, &handle_capture_dma, cap);
+    mlua_dma_set_handler(ch1, &handle_capture_dma, cap);
+    configure_capture_channel(sm, cap, 1, size, false);
+    configure_capture_channel(sm, cap, 0, size, true);
+    return 1;
+}
+
+// Return the capture controlled by the Capture at the given index, or NULL if
+// it has been stopped.
+static PIOCapture* check_Capture(lua_State* ls, int arg, CaptureRef** pref) {
+    CaptureRef* ref = luaL_checkudata(ls, arg, Capture_name);
+    if (pref != NULL) *pref = ref;
+    PIOCapture* cap = &pio_captures[ref->pio][ref->sm];
+    if (!cap->running || cap->gen != ref->gen) return NULL;
+    return cap;
+}
+
+// Push the index and length of the next block.
+static int next_block(lua_State* ls, PIOCapture* cap) {
+    uint32_t blocks = cap->blocks;
+    if (blocks - cap->consumed > 1) {  // Older blocks were overwritten
+        cap->overruns += blocks - cap->consumed - 1;
+        cap->consumed = blocks - 1;
+    }
+    uint32_t i = cap->consumed++ & 1;
+    lua_pushinteger(ls, i * cap->count + 1);
+    lua_pushinteger(ls, cap->count);
+    return 2;
+}
+
+static int capture_wait_loop(lua_State* ls, bool timeout) {
+    PIOCapture* cap = check_Capture(ls, 1, NULL);
+    if (cap == NULL) return luaL_error(ls, "PIO: capture stopped");
+    if (cap->blocks != cap->consumed) return next_block(ls, cap);
+    if (timeout) return 0;
+    return -1;
+}
+
+static int Capture_wait(lua_State* ls) {
+    CaptureRef* ref;
+    PIOCapture* cap = check_Capture(ls, 1, &ref);
+    if (cap == NULL) return luaL_error(ls, "PIO: capture stopped");
+    lua_settop(ls, 2);  // Ensure deadline is set
+    bool has_deadline = !lua_isnil(ls, 2);
+    uint64_t deadline = has_deadline ? mlua_check_time(ls, 2) : MLUA_TICKS_MAX;
+    MLuaEvent* ev = cap->event;
+    if (ev != NULL && mlua_event_can_wait(ls, ev, 0)) {
+        return mlua_event_wait(ls, ev, 0, &capture_wait_loop,
+                               has_deadline ? 2 : 0);
+    }
+    while (cap->blocks == cap->consumed) {
+        if (mlua_wait(deadline)) return 0;
+    }
+    return next_block(ls, cap);
+}
+
+static int Capture_overruns(lua_State* ls) {
+    CaptureRef* ref;
+    check_Capture(ls, 1, &ref);
+    return lua_pushinteger(ls, pio_captures[ref->pio][ref->sm].overruns), 1;
+}
+
+static int Capture_stop(lua_State* ls) {
+    PIOCapture* cap = check_Capture(ls, 1, NULL);
+    if (cap != NULL) stop_capture(cap);
+    return 0;
+}
+
+MLUA_SYMBOLS(Capture_syms) = {
+    MLUA_SYM_F(wait, Capture_),
+    MLUA_SYM_F(overruns, Capture_),
+    MLUA_SYM_F(stop, Capture_),
+};
+
+#define Capture___close Capture_stop
+#define Capture___gc Capture_stop
+
+MLUA_SYMBOLS_NOHASH(Capture_syms_nh) = {
+    MLUA_SYM_F_NH(__close, Capture_),
+    MLUA_SYM_F_NH(__gc, Capture_),
+};
+
 SM_FUNC_V1(set_config, check_Config)
 SM_FUNC_V2(init, luaL_checkinteger, check_Config)
 SM_FUNC_V1(set_enabled, mlua_to_cbool)
@@ -298,6 +755,11 @@ MLUA_SYMBOLS(SM_syms) = {
     MLUA_SYM_F(get_tx_fifo_level, SM_),
     MLUA_SYM_F(put_blocking, SM_),
     MLUA_SYM_F(get_blocking, SM_),
+    MLUA_SYM_F(put_many, SM_),
+    MLUA_SYM_F(get_many, SM_),
+    MLUA_SYM_F(put_dma, SM_),
+    MLUA_SYM_F(get_dma, SM_),
+    MLUA_SYM_F(capture, SM_),
     MLUA_SYM_F(drain_tx_fifo, SM_),
     MLUA_SYM_F(set_clkdiv_int_frac, SM_),
     MLUA_SYM_F(set_clkdiv, SM_),
@@ -466,6 +928,9 @@ static void disable_events(lua_State* ls, PIOState* state, uint32_t mask) {
         uint bit = MLUA_CTZ(mask);
         mask &= ~(1u << bit);
         mlua_event_disable(ls, &state->events[bit]);
+        if (bit < MLUA_SIZE(state->dma_events)) {
+            mlua_event_disable(ls, &state->dma_events[bit]);
+        }
     }
 }
 
@@ -490,6 +955,9 @@ static void enable_events(lua_State* ls, PIOState* state, uint32_t mask) {
             }
             return;
         }
+        if (bit < MLUA_SIZE(state->dma_events)) {
+            mlua_event_enable(ls, &state->dma_events[bit]);
+        }
         done |= bm;
     }
 }
@@ -538,17 +1006,17 @@ static int PIO_interrupt_clear_mask(lua_State* ls) {
 }
 
 MLUA_FUNC_R1(PIO_, pio_, get_index, lua_pushinteger, check_PIO)
-MLUA_FUNC_V2(PIO_, pio_, gpio_init, check_PIO, luaL_checkinteger)
+MLUA_FUNC_V2(PIO_, pio_, gpio_init, check_PIO, mlua_arg_integer)
 MLUA_FUNC_V1(PIO_, pio_, clear_instruction_memory, check_PIO)
-MLUA_FUNC_V3(PIO_, pio_, set_sm_mask_enabled, check_PIO, luaL_checkinteger,
-             mlua_to_cbool)
-MLUA_FUNC_V2(PIO_, pio_, restart_sm_mask, check_PIO, luaL_checkinteger)
-MLUA_FUNC_V2(PIO_, pio_, clkdiv_restart_sm_mask, check_PIO, luaL_checkinteger)
-MLUA_FUNC_V2(PIO_, pio_, enable_sm_mask_in_sync, check_PIO, luaL_checkinteger)
+MLUA_FUNC_V3(PIO_, pio_, set_sm_mask_enabled, check_PIO, mlua_arg_integer,
+             mlua_arg_cbool)
+MLUA_FUNC_V2(PIO_, pio_, restart_sm_mask, check_PIO, mlua_arg_integer)
+MLUA_FUNC_V2(PIO_, pio_, clkdiv_restart_sm_mask, check_PIO, mlua_arg_integer)
+MLUA_FUNC_V2(PIO_, pio_, enable_sm_mask_in_sync, check_PIO, mlua_arg_integer)
 MLUA_FUNC_R2(PIO_, pio_, interrupt_get, lua_pushboolean, check_PIO,
-             luaL_checkinteger)
-MLUA_FUNC_V2(PIO_, pio_, interrupt_clear, check_PIO, luaL_checkinteger)
-MLUA_FUNC_V2(PIO_, pio_, claim_sm_mask, check_PIO, luaL_checkinteger)
+             mlua_arg_integer)
+MLUA_FUNC_V2(PIO_, pio_, interrupt_clear, check_PIO, mlua_arg_integer)
+MLUA_FUNC_V2(PIO_, pio_, claim_sm_mask, check_PIO, mlua_arg_integer)
 MLUA_FUNC_R(PIO_, pio_, claim_unused_sm, lua_pushinteger, check_PIO(ls, 1),
              mlua_opt_cbool(ls, 2, true))
 
@@ -619,6 +1087,7 @@ MLUA_SYMBOLS(module_syms) = {
 
 MLUA_OPEN_MODULE(hardware.pio) {
     mlua_thread_require(ls);
+    mlua_require(ls, "mlua.int64", false);
 
     // Create the module.
     mlua_new_module(ls, NUM_PIOS, module_syms);
@@ -632,6 +1101,10 @@ MLUA_OPEN_MODULE(hardware.pio) {
     mlua_new_class(ls, SM_name, SM_syms, mlua_nosyms);
     lua_pop(ls, 1);
 
+    // Create the Capture class.
+    mlua_new_class(ls, Capture_name, Capture_syms, Capture_syms_nh);
+    lua_pop(ls, 1);
+
     // Create the PIO class.
     mlua_new_class(ls, PIO_name, PIO_syms, mlua_nosyms);
     lua_pop(ls, 1);
@@ -5,6 +5,7 @@ _ENV = module(...)
 
 local pio = require 'hardware.pio'
 local addressmap = require 'hardware.regs.addressmap'
+local array = require 'mlua.array'
 local list = require 'mlua.list'
 local thread = require 'mlua.thread'
 local time = require 'mlua.time'
@@ -130,6 +131,83 @@ function test_get_BNB(t)
     end
 end
 
+local pio_echo = {
+    0x80a0, 0x8020,
+    labels = {start = 0}, wrap_target = 0, wrap = 1,
+}
+
+function test_dma_BNB(t)
+    local inst, sm = setup(t, pio_echo, 1)
+    local src = array('I', 6):fill(0x12345678):set(2, 0xfedcba98, 7, 3)
+    local dst = array('I', 6)
+    t:expect(t.expr(sm):put_dma(src)):eq(#src * 4)
+    t:expect(t.expr(sm):get_dma(dst)):eq(#dst * 4)
+    t:expect(dst):label("dst"):eq(src)
+    local src8, dst8 = array('B', 5):fill(0xa5), array('B', 5)
+    sm:put_dma(src8)
+    t:expect(t.expr(sm):get_dma(dst8)):eq(5)
+    t:expect(dst8):label("dst8"):eq(src8)
+    t:expect(t.expr(sm):put_dma('abc', 3)):raises("invalid transfer size")
+    t:expect(t.expr(sm):put_dma(array('B', 3), 2))
+        :raises("buffer not aligned to transfer size")
+end
+
+function test_many_BNB(t)
+    local inst, sm = setup(t, pio_echo, 1)
+    local src = array('I', 6):fill(0x12345678):set(2, 0xfedcba98, 7, 3)
+    local dst = array('I', 6)
+    t:expect(t.expr(sm):put_many(src, 1, 3)):eq(3)
+    t:expect(t.expr(sm):get_many(dst, 2, 3)):eq(3)
+    t:expect(dst:view(3, 3)):label("dst"):eq(src:view(2, 3))
+    t:expect(t.expr(sm):put_many('\x01\x02\x03\x04\x05\x06\x07\x08')):eq(2)
+    local dst8 = array('B', 4)
+    t:expect(t.expr(sm):get_many(dst8, 0, 2)):eq(2)
+    t:expect(dst8):label("dst8"):eq(array('B', 4):set(1, 0x01, 0x05))
+    t:expect(t.expr(sm):put_many(src, 7)):raises("out of bounds")
+    t:expect(t.expr(sm):get_many(dst, 4, 3)):raises("out of bounds")
+end
+
+function test_threaded_many(t)
+    local inst, sm = setup(t, pio_echo, 1)
+    local src, dst = array('H', 256), array('H', 256)
+    for i = 1, #src do src[i] = i * 7 end
+    local writer<close> = thread.start(function() sm:put_many(src) end)
+    t:expect(t.expr(sm):get_many(dst)):eq(#dst)
+    t:expect(dst):label("dst"):eq(src)
+end
+
+function test_threaded_dma(t)
+    local inst, sm = setup(t, pio_echo, 1)
+    local src, dst = array('H', 256), array('H', 256)
+    for i = 1, #src do src[i] = i * 7 end
+    local writer<close> = thread.start(function() sm:put_dma(src) end)
+    t:expect(t.expr(sm):get_dma(dst)):eq(2 * #dst)
+    t:expect(dst):label("dst"):eq(src)
+end
+
+function test_capture(t)
+    local inst, sm = setup(t, pio_echo, 1)
+    local src, buf = array('I', 64), array('I', 16)
+    for i = 1, #src do src[i] = i end
+    local cap<close> = sm:capture(buf)
+    t:expect(t.expr(sm):capture(buf)):raises("capture already running")
+    local writer<close> = thread.start(function()
+        for i = 1, #src, 8 do
+            sm:put_dma(src:view(i, 8))
+            time.sleep_for(2000)
+        end
+    end)
+    for i = 1, #src, 8 do
+        local index, len = cap:wait()
+        t:expect(index):label("index"):eq(((i - 1) % 16) + 1)
+        t:expect(len):label("len"):eq(8)
+        t:expect(buf:view(index, len)):label("block"):eq(src:view(i, 8))
+    end
+    t:expect(t.expr(cap):overruns()):eq(0)
+    cap:stop()
+    t:expect(t.expr(cap):wait()):raises("capture stopped")
+end
+
 local pio_irqs = {
     0xca20, 0xca21, 0xca22, 0xca23,
     labels = {start = 0}, wrap_target = 0, wrap = 3,
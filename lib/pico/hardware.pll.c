@@ -9,8 +9,8 @@
 #include "mlua/module.h"
 #include "mlua/util.h"
 
-MLUA_FUNC_V5(mod_, pll_, init, mlua_check_userdata, luaL_checkinteger,
-             luaL_checkinteger, luaL_checkinteger, luaL_checkinteger)
+MLUA_FUNC_V5(mod_, pll_, init, mlua_check_userdata, mlua_arg_integer,
+             mlua_arg_integer, mlua_arg_integer, mlua_arg_integer)
 MLUA_FUNC_V1(mod_, pll_, deinit, mlua_check_userdata)
 
 MLUA_SYMBOLS(module_syms) = {
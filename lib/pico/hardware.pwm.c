@@ -2,13 +2,21 @@
 // SPDX-License-Identifier: MIT
 
 #include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
 
+#include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "hardware/pwm.h"
 #include "pico/platform.h"
 
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/hardware.dma.h"
 #include "mlua/hardware.gpio.h"
+#include "mlua/int64.h"
 #include "mlua/module.h"
+#include "mlua/platform.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
 
@@ -40,15 +48,15 @@ static int Config_top(lua_State* ls) {
 }
 
 MLUA_FUNC_S2(Config_, pwm_config_, set_phase_correct, check_Config,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 MLUA_FUNC_S2(Config_, pwm_config_, set_clkdiv, check_Config, luaL_checknumber)
 MLUA_FUNC_S(Config_, pwm_config_, set_clkdiv_int_frac, check_Config(ls, 1),
             luaL_checkinteger(ls, 2), luaL_optinteger(ls, 3, 0));
 MLUA_FUNC_S2(Config_, pwm_config_, set_clkdiv_mode, check_Config,
-             luaL_checkinteger)
+             mlua_arg_integer)
 MLUA_FUNC_S3(Config_, pwm_config_, set_output_polarity, check_Config,
-             mlua_to_cbool, mlua_to_cbool)
-MLUA_FUNC_S2(Config_, pwm_config_, set_wrap, check_Config, luaL_checkinteger)
+             mlua_arg_cbool, mlua_arg_cbool)
+MLUA_FUNC_S2(Config_, pwm_config_, set_wrap, check_Config, mlua_arg_integer)
 
 #define Config_set_clkdiv_int Config_set_clkdiv_int_frac
 
@@ -157,30 +165,279 @@ static int mod_clear_irq(lua_State* ls) {
     return 0;
 }
 
-MLUA_FUNC_R1(mod_, pwm_, gpio_to_slice_num, lua_pushinteger, luaL_checkinteger)
-MLUA_FUNC_R1(mod_, pwm_, gpio_to_channel, lua_pushinteger, luaL_checkinteger)
-MLUA_FUNC_V3(mod_, pwm_, init, check_slice, check_Config, mlua_to_cbool)
-MLUA_FUNC_V2(mod_, pwm_, set_wrap, check_slice, luaL_checkinteger)
-MLUA_FUNC_V3(mod_, pwm_, set_chan_level, check_slice, luaL_checkinteger,
-             luaL_checkinteger)
-MLUA_FUNC_V3(mod_, pwm_, set_both_levels, check_slice, luaL_checkinteger,
-             luaL_checkinteger)
-MLUA_FUNC_V2(mod_, pwm_, set_gpio_level, mlua_check_gpio, luaL_checkinteger)
+static char const Player_name[] = "hardware.pwm.Player";
+
+// The playback modes.
+typedef enum PlayMode {
+    PLAY_ONCE,
+    PLAY_LOOP,
+    PLAY_PINGPONG,
+} PlayMode;
+
+static char const* const play_modes[] = {"once", "loop", "pingpong", NULL};
+
+// The state of a waveform playback on a slice. The buffer is split into
+// "num_blocks" blocks of "count" elements, played by two DMA channels chained
+// to each other. In loop mode, both channels play the whole buffer. The DMA
+// IRQ handler re-arms a channel when it completes its block. "blocks" is the
+// number of completed blocks, and "consumed" the number of blocks returned by
+// Player:wait(). Player objects hold the generation of the playback they
+// control, so that stale objects don't affect later playbacks.
+typedef struct PlayState {
+    uint8_t* ptr;
+    uint32_t count;
+    uint8_t size;
+    uint8_t mode;
+    uint8_t num_blocks;
+    uint8_t ch[2];
+    bool running;
+    uint32_t gen;
+    uint32_t volatile blocks;
+    uint32_t consumed;
+    uint32_t overruns;
+} PlayState;
+
+typedef struct PlayerRef {
+    uint32_t gen;
+    uint8_t slice;
+} PlayerRef;
+
+static PlayState players[NUM_PWM_SLICES];
+
+#if LIB_MLUA_MOD_MLUA_THREAD
+static MLuaEvent play_events[NUM_PWM_SLICES];
+#endif
+
+// Return the address of the block played by channel i of a playback.
+static inline uint8_t* block_ptr(PlayState const* p, uint i) {
+    return p->mode == PLAY_PINGPONG ? p->ptr + i * p->count * p->size : p->ptr;
+}
+
+// Re-arm a DMA channel of a playback as its block completes. This is called
+// through the completion dispatcher of hardware.dma.
+static void __time_critical_func(handle_play_dma)(uint ch, void* ctx) {
+    uint slice = (uintptr_t)ctx;
+    PlayState* p = &players[slice];
+    uint i = ch == p->ch[1];
+    if (p->mode != PLAY_ONCE) {
+        dma_channel_set_read_addr(ch, block_ptr(p, i), false);
+    }
+    ++p->blocks;
+#if LIB_MLUA_MOD_MLUA_THREAD
+    mlua_event_set(&play_events[slice]);
+#endif
+}
+
+static void configure_play_channel(uint slice, uint i, bool trigger) {
+    PlayState* p = &players[slice];
+    uint ch = p->ch[i];
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+    channel_config_set_transfer_data_size(
+        &cfg, p->size == 4 ? DMA_SIZE_32 : DMA_SIZE_16);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_dreq(&cfg, pwm_get_dreq(slice));
+    channel_config_set_chain_to(
+        &cfg, p->mode == PLAY_ONCE ? ch : p->ch[i ^ 1]);
+    dma_channel_configure(ch, &cfg, &pwm_hw->slice[slice].cc, block_ptr(p, i),
+                          p->count, trigger);
+}
+
+static void stop_play(lua_State* ls, uint slice) {
+    PlayState* p = &players[slice];
+    uint n = p->mode == PLAY_ONCE ? 1 : 2;
+    uint32_t mask = 0;
+    for (uint i = 0; i < n; ++i) {
+        mask |= 1u << p->ch[i];
+        mlua_dma_clear_handler(p->ch[i]);
+    }
+    // Break the chain before aborting, so that aborting one channel doesn't
+    // trigger the other.
+    for (uint i = 0; i < n; ++i) {
+        uint ch = p->ch[i];
+        hw_write_masked(&dma_channel_hw_addr(ch)->al1_ctrl,
+                        ch << DMA_CH0_CTRL_TRIG_CHAIN_TO_LSB,
+                        DMA_CH0_CTRL_TRIG_CHAIN_TO_BITS);
+    }
+    dma_hw->abort = mask;
+    while ((dma_hw->abort & mask) != 0) tight_loop_contents();
+    dma_hw->intr = mask;
+    for (uint i = 0; i < n; ++i) dma_channel_unclaim(p->ch[i]);
+    p->running = false;
+#if LIB_MLUA_MOD_MLUA_THREAD
+    mlua_event_disable(ls, &play_events[slice]);
+#endif
+}
+
+// Return the element size of the buffer at index arg, as given by the "size"
+// field of the options at index oarg, or the element size of an mlua.Array.
+static lua_Integer play_elt_size(lua_State* ls, int arg, int oarg) {
+    if (lua_getfield(ls, oarg, "size") != LUA_TNIL) {
+        lua_Integer size = luaL_checkinteger(ls, -1);
+        lua_pop(ls, 1);
+        return size;
+    }
+    lua_pop(ls, 1);
+    return mlua_buffer_elt_size(ls, arg, 4);
+}
+
+static int mod_play(lua_State* ls) {
+    uint slice = check_slice(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 2, &buf) && buf.vt == NULL
+                         && buf.size != SIZE_MAX, 2, "raw buffer");
+    if (lua_isnoneornil(ls, 3)) {
+        lua_settop(ls, 2);
+        lua_newtable(ls);
+    }
+    luaL_checktype(ls, 3, LUA_TTABLE);
+    lua_getfield(ls, 3, "mode");
+    PlayMode mode = luaL_checkoption(ls, -1, "once", play_modes);
+    lua_pop(ls, 1);
+    lua_Integer size = play_elt_size(ls, 2, 3);
+    luaL_argcheck(ls, size == 2 || size == 4, 3, "invalid transfer size");
+    uint num_blocks = mode == PLAY_PINGPONG ? 2 : 1;
+    luaL_argcheck(ls, buf.size >= num_blocks * size
+                      && buf.size % (num_blocks * size) == 0
+                      && ((uintptr_t)buf.ptr & (size - 1)) == 0, 2,
+                  "invalid buffer size or alignment");
+    PlayState* p = &players[slice];
+    if (p->running) {
+        return luaL_error(ls, "PWM: slice %d already playing", slice);
+    }
+
+    // Create the Player object, which keeps the buffer alive.
+    PlayerRef* ref = lua_newuserdatauv(ls, sizeof(PlayerRef), 1);
+    ref->gen = p->gen + 1;
+    ref->slice = slice;
+    lua_pushvalue(ls, 2);
+    lua_setiuservalue(ls, -2, 1);
+    luaL_getmetatable(ls, Player_name);
+    lua_setmetatable(ls, -2);
+
+    int ch0 = dma_claim_unused_channel(false);
+    int ch1 = mode == PLAY_ONCE ? ch0
+              : ch0 < 0 ? -1 : dma_claim_unused_channel(false);
+    if (ch1 < 0) {
+        if (ch0 >= 0) dma_channel_unclaim(ch0);
+        return luaL_error(ls, "PWM: no DMA channel available");
+    }
+    *p = (PlayState){
+        .ptr = buf.ptr, .count = buf.size / (num_blocks * size), .size = size,
+        .mode = mode, .num_blocks = num_blocks, .ch = {ch0, ch1},
+        .running = true, .gen = ref->gen};
+#if LIB_MLUA_MOD_MLUA_THREAD
+    mlua_event_enable(ls, &play_events[slice]);
+#endif
+    mlua_dma_set_handler(ch0, &handle_play_dma, (void*)(uintptr_t)slice);
+    if (ch1 != ch0) {
+        mlua_dma_set_handler(ch1, &handle_play_dma, (void*)(uintptr_t)slice);
+    }
+    if (mode != PLAY_ONCE) configure_play_channel(slice, 1, false);
+    configure_play_channel(slice, 0, true);
+    return 1;
+}
+
+// Return the slice controlled by the Player at the given index, or -1 if the
+// playback has been stopped.
+static int check_Player(lua_State* ls, int arg) {
+    PlayerRef const* ref = luaL_checkudata(ls, arg, Player_name);
+    PlayState const* p = &players[ref->slice];
+    return p->running && ref->gen == p->gen ? ref->slice : -1;
+}
+
+// Push the index and length of the next completed block.
+static int next_block(lua_State* ls, PlayState* p) {
+    uint32_t blocks = p->blocks;
+    if (blocks - p->consumed > 1) {  // Older blocks were missed
+        p->overruns += blocks - p->consumed - 1;
+        p->consumed = blocks - 1;
+    }
+    uint32_t i = p->consumed++ % p->num_blocks;
+    lua_pushinteger(ls, i * p->count + 1);
+    lua_pushinteger(ls, p->count);
+    return 2;
+}
+
+static int play_wait_loop(lua_State* ls, bool timeout) {
+    PlayState* p = &players[lua_tointeger(ls, 3)];
+    if (p->blocks != p->consumed) return next_block(ls, p);
+    if (timeout) return 0;
+    return -1;
+}
+
+static int Player_wait(lua_State* ls) {
+    int slice = check_Player(ls, 1);
+    if (slice < 0) return luaL_error(ls, "PWM: playback stopped");
+    PlayState* p = &players[slice];
+    if (p->mode == PLAY_ONCE && p->consumed != 0) return 0;
+    lua_settop(ls, 2);  // Ensure deadline is set
+    bool has_deadline = !lua_isnil(ls, 2);
+    uint64_t deadline = has_deadline ? mlua_check_time(ls, 2) : MLUA_TICKS_MAX;
+#if LIB_MLUA_MOD_MLUA_THREAD
+    MLuaEvent* event = &play_events[slice];
+    if (mlua_event_can_wait(ls, event, 0)) {
+        lua_pushinteger(ls, slice);
+        return mlua_event_wait(ls, event, 0, &play_wait_loop,
+                               has_deadline ? 2 : 0);
+    }
+#endif
+    while (p->blocks == p->consumed) {
+        if (mlua_wait(deadline)) return 0;
+    }
+    return next_block(ls, p);
+}
+
+static int Player_overruns(lua_State* ls) {
+    int slice = check_Player(ls, 1);
+    lua_pushinteger(ls, slice >= 0 ? players[slice].overruns : 0);
+    return 1;
+}
+
+static int Player_stop(lua_State* ls) {
+    int slice = check_Player(ls, 1);
+    if (slice >= 0) stop_play(ls, slice);
+    return 0;
+}
+
+MLUA_SYMBOLS(Player_syms) = {
+    MLUA_SYM_F(wait, Player_),
+    MLUA_SYM_F(overruns, Player_),
+    MLUA_SYM_F(stop, Player_),
+};
+
+#define Player___close Player_stop
+#define Player___gc Player_stop
+
+MLUA_SYMBOLS_NOHASH(Player_syms_nh) = {
+    MLUA_SYM_F_NH(__close, Player_),
+    MLUA_SYM_F_NH(__gc, Player_),
+};
+
+MLUA_FUNC_R1(mod_, pwm_, gpio_to_slice_num, lua_pushinteger, mlua_arg_integer)
+MLUA_FUNC_R1(mod_, pwm_, gpio_to_channel, lua_pushinteger, mlua_arg_integer)
+MLUA_FUNC_V3(mod_, pwm_, init, check_slice, check_Config, mlua_arg_cbool)
+MLUA_FUNC_V2(mod_, pwm_, set_wrap, check_slice, mlua_arg_integer)
+MLUA_FUNC_V3(mod_, pwm_, set_chan_level, check_slice, mlua_arg_integer,
+             mlua_arg_integer)
+MLUA_FUNC_V3(mod_, pwm_, set_both_levels, check_slice, mlua_arg_integer,
+             mlua_arg_integer)
+MLUA_FUNC_V2(mod_, pwm_, set_gpio_level, mlua_check_gpio, mlua_arg_integer)
 MLUA_FUNC_R1(mod_, pwm_, get_counter, lua_pushinteger, check_slice)
-MLUA_FUNC_V2(mod_, pwm_, set_counter, check_slice, luaL_checkinteger)
+MLUA_FUNC_V2(mod_, pwm_, set_counter, check_slice, mlua_arg_integer)
 MLUA_FUNC_V1(mod_, pwm_, advance_count, check_slice)
 MLUA_FUNC_V1(mod_, pwm_, retard_count, check_slice)
 MLUA_FUNC_V(mod_, pwm_, set_clkdiv_int_frac, check_slice(ls, 1),
             luaL_checkinteger(ls, 2), luaL_optinteger(ls, 3, 0));
 MLUA_FUNC_V2(mod_, pwm_, set_clkdiv, check_slice, luaL_checknumber)
-MLUA_FUNC_V3(mod_, pwm_, set_output_polarity, check_slice, mlua_to_cbool,
-             mlua_to_cbool)
-MLUA_FUNC_V2(mod_, pwm_, set_clkdiv_mode, check_slice, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, pwm_, set_phase_correct, check_slice, mlua_to_cbool)
-MLUA_FUNC_V2(mod_, pwm_, set_enabled, check_slice, mlua_to_cbool)
-MLUA_FUNC_V1(mod_, pwm_, set_mask_enabled, luaL_checkinteger)
-MLUA_FUNC_V2(mod_, pwm_, set_irq_enabled, check_slice, mlua_to_cbool)
-MLUA_FUNC_V2(mod_, pwm_, set_irq_mask_enabled, luaL_checkinteger, mlua_to_cbool)
+MLUA_FUNC_V3(mod_, pwm_, set_output_polarity, check_slice, mlua_arg_cbool,
+             mlua_arg_cbool)
+MLUA_FUNC_V2(mod_, pwm_, set_clkdiv_mode, check_slice, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, pwm_, set_phase_correct, check_slice, mlua_arg_cbool)
+MLUA_FUNC_V2(mod_, pwm_, set_enabled, check_slice, mlua_arg_cbool)
+MLUA_FUNC_V1(mod_, pwm_, set_mask_enabled, mlua_arg_integer)
+MLUA_FUNC_V2(mod_, pwm_, set_irq_enabled, check_slice, mlua_arg_cbool)
+MLUA_FUNC_V2(mod_, pwm_, set_irq_mask_enabled, mlua_arg_integer, mlua_arg_cbool)
 MLUA_FUNC_R0(mod_, pwm_, get_irq_status_mask, lua_pushinteger)
 MLUA_FUNC_V1(mod_, pwm_, force_irq, check_slice)
 MLUA_FUNC_R1(mod_, pwm_, get_dreq, lua_pushinteger, check_slice)
@@ -221,14 +478,22 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(get_irq_status_mask, mod_),
     MLUA_SYM_F(force_irq, mod_),
     MLUA_SYM_F(get_dreq, mod_),
+    MLUA_SYM_F(play, mod_),
 };
 
 MLUA_OPEN_MODULE(hardware.pwm) {
+    mlua_thread_require(ls);
+    mlua_require(ls, "mlua.int64", false);
+
     // Create the module.
     mlua_new_module(ls, 0, module_syms);
 
     // Create the Config class.
     mlua_new_class(ls, Config_name, Config_syms, mlua_nosyms);
     lua_pop(ls, 1);
+
+    // Create the Player class.
+    mlua_new_class(ls, Player_name, Player_syms, Player_syms_nh);
+    lua_pop(ls, 1);
     return 1;
 }
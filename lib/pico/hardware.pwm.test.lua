@@ -7,7 +7,9 @@ local gpio = require 'hardware.gpio'
 local pwm = require 'hardware.pwm'
 local addressmap = require 'hardware.regs.addressmap'
 local regs = require 'hardware.regs.pwm'
+local array = require 'mlua.array'
 local config = require 'mlua.config'
+local mem = require 'mlua.mem'
 local thread = require 'mlua.thread'
 local util = require 'mlua.util'
 local pico = require 'pico'
@@ -106,3 +108,42 @@ function test_irq_handler(t)
     thread.suspend()
     t:expect(counts):label("counts"):eq(want_counts, util.table_eq)
 end
+
+local function cc()
+    return mem.unpack_from(pwm.regs(slice), regs.CH0_CC_OFFSET, '<I4')
+end
+
+function test_play_BNB(t)
+    setup(t)
+    pwm.set_clkdiv_int_frac(slice, 10)
+    pwm.set_wrap(slice, 99)
+    pwm.set_enabled(slice, true)
+
+    -- Play a waveform once. 16-bit levels drive both channels.
+    local wave = array('H', 4):set(1, 10, 20, 30, 40)
+    local player<close> = pwm.play(slice, wave)
+    t:expect(t.expr(pwm).play(slice, wave)):raises("already playing")
+    local index, len = player:wait()
+    t:expect(index):label("index"):eq(1)
+    t:expect(len):label("len"):eq(4)
+    t:expect(select('#', player:wait())):label("results"):eq(0)
+    t:expect(t.expr(cc)()):fmt(hex8):eq(0x00280028)
+    player:stop()
+    t:expect(t.expr(player):wait()):raises("playback stopped")
+
+    -- Play a waveform in ping-pong mode, refilling each half as it completes.
+    local levels = array('I', 4)
+    for i = 1, #levels do levels[i] = i | (i << 16) end
+    local pp<close> = pwm.play(slice, levels, {mode = 'pingpong'})
+    for i = 1, 6 do
+        local index, len = pp:wait()
+        t:expect(index):label("index"):eq(i % 2 == 1 and 1 or 3)
+        t:expect(len):label("len"):eq(2)
+    end
+    t:expect(t.expr(pp):overruns()):eq(0)
+    pp:stop()
+    t:expect(t.expr(pwm).play(slice, array('B', 4)))
+        :raises("invalid transfer size")
+    t:expect(t.expr(pwm).play(slice, array('I', 3), {mode = 'pingpong'}))
+        :raises("invalid buffer size")
+end
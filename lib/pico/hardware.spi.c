@@ -5,11 +5,14 @@
 #include <stdint.h>
 
 #include "hardware/address_mapped.h"
+#include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "hardware/regs/intctrl.h"
 #include "hardware/spi.h"
+#include "hardware/sync.h"
 #include "pico/platform.h"
 
+#include "mlua/hardware.dma.h"
 #include "mlua/module.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
@@ -43,14 +46,61 @@ static int SPI_regs(lua_State* ls) {
     return lua_pushlightuserdata(ls, spi_get_hw(check_SPI(ls, 1))), 1;
 }
 
+// The state of a double-buffered DMA stream. Buffers are filled alternately by
+// the streaming thread, and transferred in the same order. "ready" is the mask
+// of buffers that have been filled and are waiting to be transferred, and
+// "active" is the index of the buffer being transferred, or -1.
+typedef struct SPIStream {
+    void const* ptr[2];
+    uint32_t count[2];
+    uint8_t ch;
+    uint8_t fill;
+    uint8_t next;
+    bool running;
+    bool finished;
+    uint8_t volatile ready;
+    int8_t volatile active;
+} SPIStream;
+
+static SPIStream spi_streams[NUM_SPIS];
+
+static inline bool stream_is_free(SPIStream* s, uint i) {
+    return (s->ready & (1u << i)) == 0 && s->active != (int8_t)i;
+}
+
+static inline bool stream_is_idle(SPIStream* s) {
+    return s->ready == 0 && s->active < 0;
+}
+
+// Mark the active transfer as complete, and start the next buffer if it is
+// ready. Must be called with the DMA IRQ masked.
+static void __time_critical_func(stream_advance)(SPIStream* s) {
+    s->active = -1;
+    uint i = s->next;
+    if ((s->ready & (1u << i)) == 0) return;
+    s->ready &= ~(1u << i);
+    s->active = i;
+    s->next = i ^ 1;
+    dma_channel_transfer_from_buffer_now(s->ch, s->ptr[i], s->count[i]);
+}
+
 #if LIB_MLUA_MOD_MLUA_THREAD
 
 typedef struct SPIState {
     MLuaEvent event;
+    MLuaEvent stream_event;
 } SPIState;
 
 static SPIState spi_state[NUM_SPIS];
 
+// Advance a stream on completion of its DMA transfer. The IRQ is acknowledged
+// by the dispatcher of hardware.dma before the next transfer is started.
+static void __time_critical_func(handle_stream_dma)(uint ch, void* ctx) {
+    uint num = (uintptr_t)ctx;
+    stream_advance(&spi_streams[num]);
+    mlua_event_set(&spi_state[num].stream_event);
+}
+
 static void __time_critical_func(handle_spi_irq)(void) {
     uint num = __get_current_exception() - VTABLE_FIRST_IRQ - SPI0_IRQ;
     spi_hw_t* hw = spi_get_hw(get_instance(num));
@@ -70,11 +120,13 @@ static int SPI_enable_irq(lua_State* ls) {
         irq_set_enabled(irq, false);
         irq_remove_handler(irq, &handle_spi_irq);
         mlua_event_disable(ls, &state->event);
+        mlua_event_disable(ls, &state->stream_event);
         return 0;
     }
     if (!mlua_event_enable(ls, &state->event)) {
         return luaL_error(ls, "SPI%d: IRQ already enabled", num);
     }
+    mlua_event_enable(ls, &state->stream_event);
     mlua_event_set_irq_handler(irq, &handle_spi_irq, priority);
     irq_set_enabled(irq, true);
     return 0;
@@ -100,18 +152,11 @@ static int SPI_deinit(lua_State* ls) {
 // into a single implementation. The functions from the SDK are placed in RAM,
 // probbaly for performance reasons, but since performance matters less with Lua
 // but RAM is scarce, we trade a bit of performance against RAM.
-static int write_read_blocking(lua_State* ls, spi_inst_t* inst, bool read,
-                               uint8_t const* src, size_t len) {
+static void write_read_blocking(spi_inst_t* inst, uint8_t const* src,
+                                uint16_t tx_data, uint8_t* dst, size_t len) {
     size_t tx = len, rx = len;
     spi_hw_t* hw = spi_get_hw(inst);
     bool b16 = use_16_bit_values(hw);
-    uint16_t tx_data = src == NULL ? lua_tointeger(ls, 2) : 0;
-    luaL_Buffer buf;
-    uint8_t* dst = NULL;
-    if (read) {
-        if (b16) len *= 2;
-        dst = (uint8_t*)luaL_buffinitsize(ls, &buf, len);
-    }
     while (tx > 0 || rx > 0) {
         // Feed the TX FIFO, avoiding RX FIFO overflows.
         if (tx > 0 && rx < tx + WR_FIFO_DEPTH && spi_is_writable(inst)) {
@@ -133,21 +178,22 @@ static int write_read_blocking(lua_State* ls, spi_inst_t* inst, bool read,
             --rx;
         }
     }
-    if (dst == NULL) return 0;
-    luaL_pushresultsize(&buf, len);
-    return 1;
 }
 
 static int write_read_loop(lua_State* ls, bool timeout) {
     spi_inst_t* inst = to_SPI(ls, 1);
+    MLuaBuffer dest;
+    bool into = lua_type(ls, 3) != LUA_TBOOLEAN;
+    if (into) mlua_get_buffer(ls, 3, &dest);
     bool read = lua_toboolean(ls, 3);
     size_t tx = lua_tointeger(ls, 4);
     size_t rx = lua_tointeger(ls, 5);
+    size_t boff = lua_tointeger(ls, 6);
     spi_hw_t* hw = spi_get_hw(inst);
     bool b16 = use_16_bit_values(hw);
     uint8_t const* src = NULL;
     uint32_t tx_data = 0;
-    if (lua_isstring(ls, 2)) {
+    if (lua_type(ls, 2) == LUA_TSTRING) {
         size_t len;
         src = (uint8_t const*)lua_tolstring(ls, 2, &len);
         src += len - tx;
@@ -157,7 +203,7 @@ static int write_read_loop(lua_State* ls, bool timeout) {
     }
     luaL_Buffer buf;
     uint8_t* dst = NULL;
-    if (read && rx > 0) {
+    if (read && rx > 0 && !into) {
         dst = (uint8_t*)luaL_buffinitsize(ls, &buf, rx);
     }
 
@@ -176,7 +222,22 @@ static int write_read_loop(lua_State* ls, bool timeout) {
         }
 
         // Drain the RX FIFO.
-        while (rx > 0 && spi_is_readable(inst)) {
+        if (into) {
+            uint8_t chunk[2 * WR_FIFO_DEPTH];
+            size_t cnt = 0;
+            while (rx > 0 && cnt < sizeof(chunk) && spi_is_readable(inst)) {
+                uint32_t data = hw->dr;
+                chunk[cnt++] = data;
+                if (b16) chunk[cnt++] = data >> 8;
+                --rx;
+            }
+            if (cnt > 0) {
+                mlua_buffer_write(&dest, boff, cnt, chunk);
+                boff += cnt;
+                suspend = false;
+            }
+        }
+        while (rx > 0 && !into && spi_is_readable(inst)) {
             uint32_t data = hw->dr;
             if (dst != NULL) {
                 *dst++ = data;
@@ -199,19 +260,22 @@ static int write_read_loop(lua_State* ls, bool timeout) {
             if (dst != NULL && luaL_bufflen(&buf) > 0) {
                 luaL_pushresult(&buf);
                 if (lua_gettop(ls) >= LUA_MINSTACK - 1) {
-                    lua_concat(ls, lua_gettop(ls) - 5);
+                    lua_concat(ls, lua_gettop(ls) - 6);
                 }
             }
             lua_pushinteger(ls, tx);
             lua_replace(ls, 4);
             lua_pushinteger(ls, rx);
             lua_replace(ls, 5);
+            lua_pushinteger(ls, boff);
+            lua_replace(ls, 6);
             return -1;
         }
     }
+    if (into) return lua_pushinteger(ls, lua_tointeger(ls, 7)), 1;
     if (dst == NULL) return 0;
     if (luaL_bufflen(&buf) > 0) luaL_pushresult(&buf);
-    lua_concat(ls, lua_gettop(ls) - 5);
+    lua_concat(ls, lua_gettop(ls) - 6);
     return 1;
 }
 
@@ -223,19 +287,28 @@ static int write_read_non_blocking(lua_State* ls, spi_inst_t* inst, bool read,
     lua_pushboolean(ls, read);  // read
     lua_pushinteger(ls, len);  // tx
     lua_pushinteger(ls, len);  // rx
+    lua_pushinteger(ls, 0);  // boff
     return mlua_event_wait(ls, event, 0, &write_read_loop, 0);
 }
 
 static int write_read(lua_State* ls, bool read, uint8_t const* src,
                       size_t len) {
     spi_inst_t* inst = to_SPI(ls, 1);
-    if (src != NULL && use_16_bit_values(spi_get_hw(inst))) {
+    bool b16 = use_16_bit_values(spi_get_hw(inst));
+    if (src != NULL && b16) {
         luaL_argcheck(ls, len % 2 == 0, 2, "length must be even");
         len /= 2;
     }
     int res = write_read_non_blocking(ls, inst, read, len);
     if (res >= 0) return res;
-    return write_read_blocking(ls, inst, read, src, len);
+    uint16_t tx_data = src == NULL ? lua_tointeger(ls, 2) : 0;
+    if (!read) return write_read_blocking(inst, src, tx_data, NULL, len), 0;
+    size_t size = b16 ? 2 * len : len;
+    luaL_Buffer buf;
+    uint8_t* dst = (uint8_t*)luaL_buffinitsize(ls, &buf, size);
+    write_read_blocking(inst, src, tx_data, dst, len);
+    luaL_pushresultsize(&buf, size);
+    return 1;
 }
 
 static int SPI_write_read_blocking(lua_State* ls) {
@@ -256,6 +329,183 @@ static int SPI_read_blocking(lua_State* ls) {
     return write_read(ls, true, NULL, len);
 }
 
+static int SPI_read_blocking_into(lua_State* ls) {
+    spi_inst_t* inst = check_SPI(ls, 1);
+    luaL_argexpected(ls, lua_isinteger(ls, 2), 2, "integer");
+    MLuaBuffer buf;
+    size_t off, len;
+    mlua_check_buffer_range(ls, 3, &buf, &off, &len);
+    size_t cnt = len;
+    if (use_16_bit_values(spi_get_hw(inst))) {
+        luaL_argcheck(ls, len % 2 == 0, 5, "length must be even");
+        cnt /= 2;
+    }
+    MLuaEvent* event = &spi_state[spi_get_index(inst)].event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        lua_settop(ls, 3);  // inst, tx_data, buf
+        lua_pushinteger(ls, cnt);  // tx
+        lua_pushinteger(ls, cnt);  // rx
+        lua_pushinteger(ls, off);  // boff
+        lua_pushinteger(ls, len);
+        return mlua_event_wait(ls, event, 0, &write_read_loop, 0);
+    }
+    uint16_t tx_data = lua_tointeger(ls, 2);
+    uint8_t* dst = buf.vt == NULL ? (uint8_t*)buf.ptr + off
+                                  : lua_newuserdatauv(ls, len, 0);
+    write_read_blocking(inst, NULL, tx_data, dst, cnt);
+    if (buf.vt != NULL) mlua_buffer_write(&buf, off, len, dst);
+    return lua_pushinteger(ls, len), 1;
+}
+
+// Stop a stream and release its DMA channel. This is called through a
+// to-be-closed variable, so that the stream is stopped if the thread is killed.
+// The RX FIFO, which overflows during the stream, is drained once the
+// peripheral is idle.
+static int release_stream(lua_State* ls) {
+    uint num = lua_tointeger(ls, lua_upvalueindex(1));
+    SPIStream* s = &spi_streams[num];
+    if (!s->running) return 0;
+    uint ch = s->ch;
+    mlua_dma_clear_handler(ch);
+    dma_channel_abort(ch);
+    dma_channel_unclaim(ch);
+    s->ready = 0;
+    s->active = -1;
+    s->running = false;
+    spi_inst_t* inst = get_instance(num);
+    spi_hw_t* hw = spi_get_hw(inst);
+    while (spi_is_busy(inst)) tight_loop_contents();
+    while (spi_is_readable(inst)) (void)hw->dr;
+    hw->icr = SPI_SSPICR_RORIC_BITS;
+    return 0;
+}
+
+static int stream_wait_loop(lua_State* ls, bool timeout) {
+    SPIStream* s = &spi_streams[spi_get_index(to_SPI(ls, 1))];
+    if (s->finished ? stream_is_idle(s) : stream_is_free(s, s->fill)) return 0;
+    return -1;
+}
+
+// Wait until the next buffer can be filled, or until the stream is idle after
+// it has finished.
+static int stream_wait(lua_State* ls) {
+    spi_inst_t* inst = to_SPI(ls, 1);
+    MLuaEvent* event = &spi_state[spi_get_index(inst)].stream_event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        return mlua_event_wait(ls, event, 0, &stream_wait_loop, 0);
+    }
+    SPIStream* s = &spi_streams[spi_get_index(inst)];
+    while (stream_wait_loop(ls, false) < 0) {
+        if (s->active >= 0 && !dma_channel_is_busy(s->ch)) stream_advance(s);
+    }
+    return 0;
+}
+
+#define STREAM_START 0
+#define STREAM_FILLED 1
+#define STREAM_WAITED 2
+
+static int stream_cont(lua_State* ls, int status, lua_KContext ctx) {
+    spi_inst_t* inst = to_SPI(ls, 1);
+    SPIStream* s = &spi_streams[spi_get_index(inst)];
+    bool b16 = use_16_bit_values(spi_get_hw(inst));
+    for (;;) {
+        if (ctx == STREAM_FILLED) {
+            uint i = s->fill;
+            lua_Integer len = 0;
+            if (!lua_isnil(ls, -1)) {
+                len = luaL_checkinteger(ls, -1);
+                if (len < 0 || (lua_Unsigned)len > s->count[i]) {
+                    return luaL_error(ls, "fill: length out of bounds");
+                }
+                if (b16 && len % 2 != 0) {
+                    return luaL_error(ls, "fill: length must be even");
+                }
+            }
+            lua_pop(ls, 1);
+            if (len == 0) {
+                s->finished = true;
+            } else {
+                lua_pushinteger(ls, lua_tointeger(ls, 4) + len);
+                lua_replace(ls, 4);
+                uint32_t save = save_and_disable_interrupts();
+                s->count[i] = b16 ? len / 2 : len;
+                s->ready |= 1u << i;
+                if (s->active < 0) stream_advance(s);
+                restore_interrupts(save);
+                s->fill = i ^ 1;
+            }
+        }
+        if (!s->finished && stream_is_free(s, s->fill)) {
+            // Restore the full buffer size, which was reduced by a short fill.
+            uint i = s->fill;
+            MLuaBuffer buf;
+            lua_geti(ls, 2, i + 1);
+            mlua_get_buffer(ls, -1, &buf);
+            s->count[i] = buf.size;
+            lua_pushvalue(ls, 3);
+            lua_insert(ls, -2);
+            lua_pushinteger(ls, i + 1);
+            ctx = STREAM_FILLED;
+            lua_callk(ls, 2, 1, ctx, &stream_cont);
+            continue;
+        }
+        if (s->finished && stream_is_idle(s)) break;
+        lua_pushcfunction(ls, &stream_wait);
+        lua_pushvalue(ls, 1);
+        ctx = STREAM_WAITED;
+        lua_callk(ls, 1, 0, ctx, &stream_cont);
+    }
+    return lua_pushvalue(ls, 4), 1;
+}
+
+static int SPI_stream(lua_State* ls) {
+    spi_inst_t* inst = check_SPI(ls, 1);
+    uint num = spi_get_index(inst);
+    luaL_checktype(ls, 2, LUA_TTABLE);
+    if (lua_istable(ls, 3)) lua_getfield(ls, 3, "fill");
+    else lua_pushvalue(ls, 3);
+    luaL_argexpected(ls, lua_isfunction(ls, -1), 3, "fill function");
+    lua_replace(ls, 3);
+    lua_settop(ls, 3);
+    SPIStream* s = &spi_streams[num];
+    if (s->running) return luaL_error(ls, "SPI%d: stream already running", num);
+    bool b16 = use_16_bit_values(spi_get_hw(inst));
+    for (uint i = 0; i < 2; ++i) {
+        MLuaBuffer buf;
+        lua_geti(ls, 2, i + 1);
+        luaL_argcheck(ls, mlua_get_buffer(ls, -1, &buf) && buf.vt == NULL
+                          && buf.size != SIZE_MAX, 2, "two raw buffers expected");
+        luaL_argcheck(ls, !b16 || ((uintptr_t)buf.ptr & 1) == 0, 2,
+                      "buffer must be 16-bit aligned");
+        lua_pop(ls, 1);
+        s->ptr[i] = buf.ptr;
+    }
+    lua_pushinteger(ls, 0);  // total
+    lua_pushinteger(ls, num);
+    lua_pushcclosure(ls, &release_stream, 1);
+    lua_toclose(ls, -1);
+    int ch = dma_claim_unused_channel(false);
+    if (ch < 0) return luaL_error(ls, "SPI%d: no DMA channel available", num);
+    s->ch = ch;
+    s->fill = s->next = 0;
+    s->ready = 0;
+    s->active = -1;
+    s->finished = false;
+    s->running = true;
+
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+    channel_config_set_transfer_data_size(&cfg, b16 ? DMA_SIZE_16 : DMA_SIZE_8);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_dreq(&cfg, spi_get_dreq(inst, true));
+    dma_channel_configure(ch, &cfg, &spi_get_hw(inst)->dr, NULL, 0, false);
+    if (mlua_event_can_wait(ls, &spi_state[num].stream_event, 0)) {
+        mlua_dma_set_handler(ch, &handle_stream_dma, (void*)(uintptr_t)num);
+    }
+    return stream_cont(ls, LUA_OK, STREAM_START);
+}
+
 static int SPI_enable_loopback(lua_State* ls) {
     spi_inst_t* inst = check_SPI(ls, 1);
     if (mlua_to_cbool(ls, 2)) {
@@ -266,19 +516,19 @@ static int SPI_enable_loopback(lua_State* ls) {
     return 0;
 }
 
-MLUA_FUNC_R2(SPI_, spi_, init, lua_pushinteger, check_SPI, luaL_checkinteger)
+MLUA_FUNC_R2(SPI_, spi_, init, lua_pushinteger, check_SPI, mlua_arg_integer)
 MLUA_FUNC_R2(SPI_, spi_, set_baudrate, lua_pushinteger, check_SPI,
-             luaL_checkinteger)
+             mlua_arg_integer)
 MLUA_FUNC_R1(SPI_, spi_, get_baudrate, lua_pushinteger, check_SPI)
 MLUA_FUNC_R1(SPI_, spi_, get_index, lua_pushinteger, check_SPI)
 MLUA_FUNC_V(SPI_, spi_, set_format, check_SPI(ls, 1), luaL_checkinteger(ls, 2),
             luaL_checkinteger(ls, 3), luaL_checkinteger(ls, 4),
             luaL_optinteger(ls, 5, SPI_MSB_FIRST))
-MLUA_FUNC_V2(SPI_, spi_, set_slave, check_SPI, mlua_to_cbool)
+MLUA_FUNC_V2(SPI_, spi_, set_slave, check_SPI, mlua_arg_cbool)
 MLUA_FUNC_R1(SPI_, spi_, is_writable, lua_pushboolean, check_SPI)
 MLUA_FUNC_R1(SPI_, spi_, is_readable, lua_pushboolean, check_SPI)
 MLUA_FUNC_R1(SPI_, spi_, is_busy, lua_pushboolean, check_SPI)
-MLUA_FUNC_R2(SPI_, spi_, get_dreq, lua_pushinteger, check_SPI, mlua_to_cbool)
+MLUA_FUNC_R2(SPI_, spi_, get_dreq, lua_pushinteger, check_SPI, mlua_arg_cbool)
 
 MLUA_SYMBOLS(SPI_syms) = {
     MLUA_SYM_F(init, SPI_),
@@ -295,6 +545,8 @@ MLUA_SYMBOLS(SPI_syms) = {
     MLUA_SYM_F(write_read_blocking, SPI_),
     MLUA_SYM_F(write_blocking, SPI_),
     MLUA_SYM_F(read_blocking, SPI_),
+    MLUA_SYM_F(read_blocking_into, SPI_),
+    MLUA_SYM_F(stream, SPI_),
     MLUA_SYM_F(get_dreq, SPI_),
     MLUA_SYM_F(enable_loopback, SPI_),
     MLUA_SYM_F_THREAD(enable_irq, SPI_),
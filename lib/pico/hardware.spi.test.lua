@@ -5,6 +5,7 @@ _ENV = module(...)
 
 local addressmap = require 'hardware.regs.addressmap'
 local spi = require 'hardware.spi'
+local mem = require 'mlua.mem'
 local thread = require 'mlua.thread'
 local string = require 'string'
 
@@ -47,6 +48,9 @@ function test_write_read_blocking_8bit_BNB(t)
     t:expect(t.expr(inst):write_read_blocking(data)):eq(data)
     inst:write_blocking(data)
     t:expect(t.expr(inst):read_blocking(0x42, 13)):eq(('\x42'):rep(13))
+    local buf = mem.alloc(#data + 2)
+    t:expect(t.expr(inst):read_blocking_into(0x43, buf, 1, #data)):eq(#data)
+    t:expect(t.expr(mem).read(buf, 1, #data)):eq(('\x43'):rep(#data))
 end
 
 function test_write_read_blocking_12bit_BNB(t)
@@ -58,4 +62,30 @@ function test_write_read_blocking_12bit_BNB(t)
             .. '\x96\x07\x78\x09\x5a\x0b\x3c\x0d\x1e\x0f')
     inst:write_blocking(data)
     t:expect(t.expr(inst):read_blocking(0xf123, 17)):eq(('\x23\x01'):rep(17))
+    local buf = mem.alloc(2 * 17)
+    t:expect(t.expr(inst):read_blocking_into(0xf123, buf)):eq(2 * 17)
+    t:expect(t.expr(mem).read(buf)):eq(('\x23\x01'):rep(17))
+    t:expect(t.expr(inst):read_blocking_into(0xf123, buf, 0, 3))
+        :raises("length must be even")
+end
+
+function test_stream(t)
+    local inst = setup(t, 8)
+    local bufs = {mem.alloc(16), mem.alloc(16)}
+    local fills, data = '', ('0123456789abcdef'):rep(10) .. 'xyz'
+    local pos = 1
+    t:expect(t.expr(inst):stream(bufs, {fill = function(buf, i)
+        fills = fills .. i
+        local chunk = data:sub(pos, pos + 15)
+        pos = pos + #chunk
+        mem.write(buf, chunk)
+        if #chunk > 0 then return #chunk end
+    end})):eq(#data)
+    t:expect(fills):label("fills"):eq('121212121212')
+    t:expect(t.expr(inst):is_readable()):eq(false)
+    t:expect(t.expr(inst):write_read_blocking('abc')):eq('abc')
+    t:expect(t.expr(inst):stream(bufs, function() return 17 end))
+        :raises("length out of bounds")
+    t:expect(t.expr(inst):stream({bufs[1]}, function() end))
+        :raises("two raw buffers expected")
 end
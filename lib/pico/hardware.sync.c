@@ -16,7 +16,7 @@ MLUA_FUNC_V0(mod_, __, isb)
 MLUA_FUNC_V0(mod_, __, mem_fence_acquire)
 MLUA_FUNC_V0(mod_, __, mem_fence_release)
 MLUA_FUNC_R0(mod_,, save_and_disable_interrupts, lua_pushinteger)
-MLUA_FUNC_V1(mod_,, restore_interrupts, luaL_checkinteger)
+MLUA_FUNC_V1(mod_,, restore_interrupts, mlua_arg_integer)
 
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(sev, mod_),
@@ -7,17 +7,19 @@
 #include <stdint.h>
 
 #include "hardware/address_mapped.h"
+#include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "hardware/regs/intctrl.h"
 #include "pico/platform.h"
 #include "pico/time.h"
 
+#include "mlua/hardware.dma.h"
 #include "mlua/int64.h"
 #include "mlua/module.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
 
-// TODO: Accept and return mutable buffers when writing and reading
+// TODO: Accept buffers when writing
 
 char const mlua_UART_name[] = "hardware.uart.UART";
 
@@ -70,6 +72,8 @@ static int UART_tx_wait_blocking_1(lua_State* ls, int status,
 typedef struct UARTState {
     MLuaEvent rx_event;
     MLuaEvent tx_event;
+    MLuaEvent rx_dma_event;
+    MLuaEvent tx_dma_event;
 } UARTState;
 
 static UARTState uart_state[NUM_UARTS];
@@ -101,6 +105,8 @@ static int UART_enable_irq(lua_State* ls) {
         irq_remove_handler(irq, &handle_uart_irq);
         mlua_event_disable(ls, &state->rx_event);
         mlua_event_disable(ls, &state->tx_event);
+        mlua_event_disable(ls, &state->rx_dma_event);
+        mlua_event_disable(ls, &state->tx_dma_event);
         return 0;
     }
     if (!mlua_event_enable(ls, &state->rx_event)) {
@@ -110,6 +116,8 @@ static int UART_enable_irq(lua_State* ls) {
         mlua_event_disable(ls, &state->rx_event);
         return luaL_error(ls, "UART%d: Tx IRQ already enabled", num);
     }
+    mlua_event_enable(ls, &state->rx_dma_event);
+    mlua_event_enable(ls, &state->tx_dma_event);
     hw_write_masked(&uart_get_hw(inst)->ifls,  // Thresholds: 1/2 FIFO capacity
                     (2 << UART_UARTIFLS_RXIFLSEL_LSB)
                     | (2 << UART_UARTIFLS_TXIFLSEL_LSB),
@@ -220,6 +228,161 @@ static int UART_read_blocking(lua_State* ls) {
     return 1;
 }
 
+static int read_into_loop(lua_State* ls, bool timeout) {
+    uart_inst_t* inst = to_UART(ls, 1);
+    MLuaBuffer buf;
+    mlua_get_buffer(ls, 2, &buf);
+    size_t off = lua_tointeger(ls, 3);
+    size_t len = lua_tointeger(ls, 4);
+    size_t offset = lua_tointeger(ls, 5);
+    while (offset < len) {
+        if (!uart_is_readable(inst)) {
+            lua_pushinteger(ls, offset);
+            lua_replace(ls, 5);
+            enable_rx_irq(inst);
+            return -1;
+        }
+        uint8_t chunk[32];
+        size_t cnt = 0;
+        while (cnt < sizeof(chunk) && offset + cnt < len
+               && uart_is_readable(inst)) {
+            chunk[cnt++] = (uint8_t)uart_get_hw(inst)->dr;
+        }
+        mlua_buffer_write(&buf, off + offset, cnt, chunk);
+        offset += cnt;
+    }
+    return lua_pushinteger(ls, len), 1;
+}
+
+static int UART_read_blocking_into(lua_State* ls) {
+    uart_inst_t* inst = mlua_check_UART(ls, 1);
+    MLuaBuffer buf;
+    size_t off, len;
+    mlua_check_buffer_range(ls, 2, &buf, &off, &len);
+    if (len == 0) return lua_pushinteger(ls, 0), 1;
+    MLuaEvent* event = &uart_state[uart_get_index(inst)].rx_event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        lua_settop(ls, 2);
+        lua_pushinteger(ls, off);
+        lua_pushinteger(ls, len);
+        lua_pushinteger(ls, 0);  // offset
+        return mlua_event_wait(ls, event, 0, &read_into_loop, 0);
+    }
+    if (buf.vt == NULL) {
+        uart_read_blocking(inst, (uint8_t*)buf.ptr + off, len);
+    } else {
+        uint8_t* dst = lua_newuserdatauv(ls, len, 0);
+        uart_read_blocking(inst, dst, len);
+        mlua_buffer_write(&buf, off, len, dst);
+    }
+    return lua_pushinteger(ls, len), 1;
+}
+
+// Release the DMA channel of a transfer. This is called through a to-be-closed
+// variable, so that the transfer is aborted if the thread is killed.
+static int release_dma(lua_State* ls) {
+    uint ch = lua_tointeger(ls, lua_upvalueindex(1));
+    mlua_dma_clear_handler(ch);
+    dma_channel_abort(ch);
+    dma_channel_unclaim(ch);
+    return 0;
+}
+
+// Start a DMA transfer between the UART and memory, paced by the UART DREQ.
+// Expects the stack to be (inst, buf, len, tmp | nil). Pushes the DMA channel
+// and the to-be-closed function releasing it, then waits for the transfer to
+// complete.
+static int start_dma(lua_State* ls, uart_inst_t* inst, bool tx, void* ptr,
+                     size_t len, MLuaEventLoopFn loop) {
+    int ch = dma_claim_unused_channel(false);
+    if (ch < 0) {
+        return luaL_error(ls, "UART%d: no DMA channel available",
+                          uart_get_index(inst));
+    }
+    lua_pushinteger(ls, ch);
+    lua_pushinteger(ls, ch);
+    lua_pushcclosure(ls, &release_dma, 1);
+    lua_toclose(ls, -1);
+
+    UARTState* state = &uart_state[uart_get_index(inst)];
+    MLuaEvent* event = tx ? &state->tx_dma_event : &state->rx_dma_event;
+    bool wait = mlua_event_can_wait(ls, event, 0);
+    if (wait) mlua_dma_set_event(ch, event);
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
+    channel_config_set_read_increment(&cfg, tx);
+    channel_config_set_write_increment(&cfg, !tx);
+    channel_config_set_dreq(&cfg, uart_get_dreq(inst, tx));
+    io_rw_32* dr = &uart_get_hw(inst)->dr;
+    if (tx) {
+        dma_channel_configure(ch, &cfg, dr, ptr, len, true);
+    } else {
+        dma_channel_configure(ch, &cfg, ptr, dr, len, true);
+    }
+    if (wait) return mlua_event_wait(ls, event, 0, loop, 0);
+    dma_channel_wait_for_finish_blocking(ch);
+    return loop(ls, false);
+}
+
+static int write_dma_loop(lua_State* ls, bool timeout) {
+    if (dma_channel_is_busy(lua_tointeger(ls, 5))) return -1;
+    return lua_pushvalue(ls, 3), 1;
+}
+
+static int UART_write_dma(lua_State* ls) {
+    uart_inst_t* inst = mlua_check_UART(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_ro_buffer(ls, 2, &buf), 2,
+                     "string or buffer");
+    luaL_argcheck(ls, buf.size != SIZE_MAX, 2, "infinite buffer");
+    lua_settop(ls, 2);
+    lua_pushinteger(ls, buf.size);
+    if (buf.size == 0) return 1;
+    void* ptr = buf.ptr;
+    if (buf.vt != NULL) {  // Copy to a temporary raw buffer
+        ptr = lua_newuserdatauv(ls, buf.size, 0);
+        mlua_buffer_read(&buf, 0, buf.size, ptr);
+    } else {
+        lua_pushnil(ls);
+    }
+    return start_dma(ls, inst, true, ptr, buf.size, &write_dma_loop);
+}
+
+static int read_dma_loop(lua_State* ls, bool timeout) {
+    if (dma_channel_is_busy(lua_tointeger(ls, 5))) return -1;
+    if (!lua_isnil(ls, 4)) {  // Copy from the temporary raw buffer
+        MLuaBuffer buf;
+        mlua_get_buffer(ls, 2, &buf);
+        mlua_buffer_write(&buf, 0, lua_tointeger(ls, 3), lua_touserdata(ls, 4));
+    }
+    return lua_pushvalue(ls, 3), 1;
+}
+
+static int UART_read_dma(lua_State* ls) {
+    uart_inst_t* inst = mlua_check_UART(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 2, &buf), 2, "buffer");
+    lua_Integer len;
+    if (lua_isnoneornil(ls, 3)) {
+        luaL_argcheck(ls, buf.size != SIZE_MAX, 3, "length required");
+        len = buf.size;
+    } else {
+        len = luaL_checkinteger(ls, 3);
+        luaL_argcheck(ls, 0 <= len && (lua_Unsigned)len <= buf.size, 3,
+                      "out of bounds");
+    }
+    lua_settop(ls, 2);
+    lua_pushinteger(ls, len);
+    if (len == 0) return 1;
+    void* ptr = buf.ptr;
+    if (buf.vt != NULL) {  // Receive into a temporary raw buffer
+        ptr = lua_newuserdatauv(ls, len, 0);
+    } else {
+        lua_pushnil(ls);
+    }
+    return start_dma(ls, inst, false, ptr, len, &read_dma_loop);
+}
+
 static int getc_loop(lua_State* ls, bool timeout) {
     uart_inst_t* inst = to_UART(ls, 1);
     if (!uart_is_readable(inst)) return -1;
@@ -257,6 +420,19 @@ static int UART_is_readable_within_us(lua_State* ls) {
     return 1;
 }
 
+#if LIB_MLUA_MOD_MLUA_THREAD
+
+static int UART___select(lua_State* ls) {
+    uart_inst_t* inst = mlua_check_UART(ls, 1);
+    bool readable = uart_is_readable(inst);
+    if (!readable) enable_rx_irq(inst);
+    lua_pushboolean(ls, readable);
+    lua_pushlightuserdata(ls, &uart_state[uart_get_index(inst)].rx_event);
+    return 2;
+}
+
+#endif  // LIB_MLUA_MOD_MLUA_THREAD
+
 static int UART_enable_loopback(lua_State* ls) {
     uart_inst_t* inst = mlua_check_UART(ls, 1);
     if (mlua_to_cbool(ls, 2)) {
@@ -272,26 +448,26 @@ static int UART_enable_loopback(lua_State* ls) {
 
 MLUA_FUNC_R1(UART_, uart_, get_index, lua_pushinteger, mlua_check_UART)
 MLUA_FUNC_R2(UART_, uart_, init, lua_pushinteger, mlua_check_UART,
-             luaL_checkinteger)
+             mlua_arg_integer)
 MLUA_FUNC_R2(UART_, uart_, set_baudrate, lua_pushinteger, mlua_check_UART,
-             luaL_checkinteger)
-MLUA_FUNC_V3(UART_, uart_, set_hw_flow, mlua_check_UART, mlua_to_cbool,
-             mlua_to_cbool)
-MLUA_FUNC_V4(UART_, uart_, set_format, mlua_check_UART, luaL_checkinteger,
-             luaL_checkinteger, luaL_checkinteger)
-MLUA_FUNC_V3(UART_, uart_, set_irq_enables, mlua_check_UART, mlua_to_cbool,
-             mlua_to_cbool)
+             mlua_arg_integer)
+MLUA_FUNC_V3(UART_, uart_, set_hw_flow, mlua_check_UART, mlua_arg_cbool,
+             mlua_arg_cbool)
+MLUA_FUNC_V4(UART_, uart_, set_format, mlua_check_UART, mlua_arg_integer,
+             mlua_arg_integer, mlua_arg_integer)
+MLUA_FUNC_V3(UART_, uart_, set_irq_enables, mlua_check_UART, mlua_arg_cbool,
+             mlua_arg_cbool)
 MLUA_FUNC_R1(UART_, uart_, is_enabled, lua_pushboolean, mlua_check_UART)
-MLUA_FUNC_V2(UART_, uart_, set_fifo_enabled, mlua_check_UART, mlua_to_cbool)
+MLUA_FUNC_V2(UART_, uart_, set_fifo_enabled, mlua_check_UART, mlua_arg_cbool)
 MLUA_FUNC_R1(UART_, uart_, is_writable, lua_pushboolean, mlua_check_UART)
 MLUA_FUNC_R1(UART_, uart_, is_readable, lua_pushboolean, mlua_check_UART)
-MLUA_FUNC_V2(UART_, uart_, putc_raw, mlua_check_UART, luaL_checkinteger)
-MLUA_FUNC_V2(UART_, uart_, putc, mlua_check_UART, luaL_checkinteger)
+MLUA_FUNC_V2(UART_, uart_, putc_raw, mlua_check_UART, mlua_arg_integer)
+MLUA_FUNC_V2(UART_, uart_, putc, mlua_check_UART, mlua_arg_integer)
 MLUA_FUNC_V2(UART_, uart_, puts, mlua_check_UART, luaL_checkstring)
-MLUA_FUNC_V2(UART_, uart_, set_break, mlua_check_UART, mlua_to_cbool)
-MLUA_FUNC_V2(UART_, uart_, set_translate_crlf, mlua_check_UART, mlua_to_cbool)
+MLUA_FUNC_V2(UART_, uart_, set_break, mlua_check_UART, mlua_arg_cbool)
+MLUA_FUNC_V2(UART_, uart_, set_translate_crlf, mlua_check_UART, mlua_arg_cbool)
 MLUA_FUNC_R2(UART_, uart_, get_dreq, lua_pushinteger, mlua_check_UART,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 
 MLUA_SYMBOLS(UART_syms) = {
     MLUA_SYM_F(get_index, UART_),
@@ -310,6 +486,9 @@ MLUA_SYMBOLS(UART_syms) = {
     MLUA_SYM_F(is_readable, UART_),
     MLUA_SYM_F(write_blocking, UART_),
     MLUA_SYM_F(read_blocking, UART_),
+    MLUA_SYM_F(read_blocking_into, UART_),
+    MLUA_SYM_F(write_dma, UART_),
+    MLUA_SYM_F(read_dma, UART_),
     MLUA_SYM_F(putc_raw, UART_),
     MLUA_SYM_F(putc, UART_),
     MLUA_SYM_F(puts, UART_),
@@ -322,6 +501,12 @@ MLUA_SYMBOLS(UART_syms) = {
     MLUA_SYM_F_THREAD(enable_irq, UART_),
 };
 
+MLUA_SYMBOLS_NOHASH(UART_syms_nh) = {
+#if LIB_MLUA_MOD_MLUA_THREAD
+    MLUA_SYM_F_NH(__select, UART_),
+#endif
+};
+
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(NUM, integer, NUM_UARTS),
     MLUA_SYM_V(_default, boolean, false),
@@ -343,7 +528,7 @@ MLUA_OPEN_MODULE(hardware.uart) {
     int mod_index = lua_gettop(ls);
 
     // Create the UART class.
-    mlua_new_class(ls, mlua_UART_name, UART_syms, mlua_nosyms);
+    mlua_new_class(ls, mlua_UART_name, UART_syms, UART_syms_nh);
     lua_pop(ls, 1);
 
     // Create UART instances.
@@ -7,6 +7,7 @@ local addressmap = require 'hardware.regs.addressmap'
 local uart = require 'hardware.uart'
 local math = require 'math'
 local list = require 'mlua.list'
+local mem = require 'mlua.mem'
 local testing_uart = require 'mlua.testing.uart'
 local thread = require 'mlua.thread'
 local time = require 'mlua.time'
@@ -75,6 +76,52 @@ function test_blocking_write_read_BNB(t)
     t:expect(t.expr(inst):is_readable()):eq(false)
 end
 
+function test_read_blocking_into_BNB(t)
+    local inst = setup(t)
+    local data = '0123456789abcdefghijklmnopqrstuv'  -- Fits the FIFO
+    local buf = mem.alloc(#data + 4)
+    mem.fill(buf, ('.'):byte())
+    inst:write_blocking(data)
+    t:expect(t.expr(inst):read_blocking_into(buf, 2, #data)):eq(#data)
+    t:expect(t.expr(mem).read(buf)):eq('..' .. data .. '..')
+    inst:write_blocking('ab')
+    t:expect(t.expr(inst):read_blocking_into(buf, #data + 2)):eq(2)
+    t:expect(t.expr(mem).read(buf, #data)):eq('uvab')
+    t:expect(t.expr(inst):read_blocking_into(buf, 0, 0)):eq(0)
+    t:expect(t.expr(inst):read_blocking_into(buf, 1, #data + 4))
+        :raises("out of bounds")
+    t:expect(t.expr(inst):is_readable()):eq(false)
+end
+
+function test_dma_BNB(t)
+    local inst = setup(t)
+    local data = '0123456789abcdefghijklmnopqrstuv'  -- Fits the FIFO
+    local buf = mem.alloc(#data + 4)
+    mem.fill(buf, ('.'):byte())
+    t:expect(t.expr(inst):write_dma(data)):eq(#data)
+    t:expect(t.expr(inst):read_dma(buf, #data)):eq(#data)
+    t:expect(t.expr(mem).read(buf)):eq(data .. '....')
+    local ring = mem.Ring(8)
+    ring:write('ABCDEFGH')
+    t:expect(t.expr(inst):write_dma(ring)):eq(8)
+    t:expect(t.expr(inst):read_dma(ring, 5)):eq(5)
+    t:expect(t.expr(ring):read(8)):eq('ABCDEFGH')
+    t:expect(t.expr(inst):write_dma('')):eq(0)
+    t:expect(t.expr(inst):read_dma(buf, #data + 5)):raises("out of bounds")
+    t:expect(t.expr(inst):is_readable()):eq(false)
+end
+
+function test_threaded_dma(t)
+    local inst = setup(t)
+    local data = ('0123456789abcdef'):rep(64)
+    local buf = mem.alloc(#data)
+    inst:set_hw_flow(true, true)
+    local writer<close> = thread.start(function() inst:write_dma(data) end)
+    t:expect(t.expr(inst):read_dma(buf)):eq(#data)
+    t:expect(mem.read(buf) == data, "unexpected data received")
+    t:expect(t.expr(inst):is_readable()):eq(false)
+end
+
 function test_threaded_write_read(t)
     local inst = setup(t)
     local cnt, data = 50, '0123456'
@@ -0,0 +1,40 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#ifndef _MLUA_LIB_PICO_HARDWARE_DMA_H
+#define _MLUA_LIB_PICO_HARDWARE_DMA_H
+
+#include "pico/platform.h"
+
+#include "mlua/thread.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// A handler for the completion IRQ of a DMA channel. It is called in IRQ
+// context, after the IRQ of the channel has been acknowledged.
+typedef void (*MLuaDMAHandler)(uint ch, void* ctx);
+
+// Dispatch the completion IRQ of a DMA channel to a handler. Completion IRQs
+// are handled on the DMA_IRQ_0 + core line of the calling core, which is shared
+// with the channel IRQs enabled through hardware.dma.enable_irq(). Any pending
+// IRQ of the channel is cleared.
+void mlua_dma_set_handler(uint ch, MLuaDMAHandler handler, void* ctx);
+
+// Stop dispatching the completion IRQ of a DMA channel, and clear any pending
+// IRQ. This must be called on the core that set the handler.
+void mlua_dma_clear_handler(uint ch);
+
+#if LIB_MLUA_MOD_MLUA_THREAD
+
+// Set an event on completion of a DMA channel.
+void mlua_dma_set_event(uint ch, MLuaEvent* ev);
+
+#endif  // LIB_MLUA_MOD_MLUA_THREAD
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -8,15 +8,16 @@
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/module.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
 // Return the given argument as a GPIO number. Raises an error if the argument
-// value is out of bounds.
+// value is out of bounds. The bounds are checked even with MLUA_FAST_BINDINGS.
 static inline uint mlua_check_gpio(lua_State* ls, int arg) {
-    lua_Unsigned num = luaL_checkinteger(ls, arg);
+    lua_Unsigned num = mlua_arg_integer(ls, arg);
     luaL_argcheck(ls, num < NUM_BANK0_GPIOS, arg, "invalid GPIO");
     return num;
 }
@@ -10,14 +10,11 @@
 #define MEM_LIBC_MALLOC             0
 #define MEM_ALIGNMENT               4
 #define TCP_MSS                     1460
-#define TCP_WND                     (8 * TCP_MSS)
-#define TCP_SND_BUF                 (8 * TCP_MSS)
-#define TCP_SND_QUEUELEN            ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) \
-                                     / TCP_MSS)
 #define LWIP_NETIF_HOSTNAME         1
 #define LWIP_NETIF_STATUS_CALLBACK  1
 #define LWIP_NETIF_LINK_CALLBACK    1
 #define LWIP_NETIF_TX_SINGLE_PBUF   1
+#define LWIP_SUPPORT_CUSTOM_PBUF    1
 #define LWIP_CHKSUM_ALGORITHM       3
 #define LWIP_TCP_KEEPALIVE          1
 #define DHCP_DOES_ARP_CHECK         0
@@ -27,6 +24,50 @@
 #define LWIP_DEBUG                  1
 #endif
 
+// Memory profiles. A profile sets the defaults for the heap size, the pool
+// sizes, the PCB counts and the TCP window sizes. It is selected by setting
+// LWIP_PROFILE to one of the LWIP_PROFILE_* values, e.g.
+// LWIP_PROFILE=LWIP_PROFILE_LOW_MEMORY. Individual options can still be
+// overridden through their own compile definitions.
+#define LWIP_PROFILE_LOW_MEMORY         1
+#define LWIP_PROFILE_BALANCED           2
+#define LWIP_PROFILE_HIGH_THROUGHPUT    3
+
+#ifndef LWIP_PROFILE
+#define LWIP_PROFILE                    LWIP_PROFILE_BALANCED
+#endif
+
+#if LWIP_PROFILE == LWIP_PROFILE_LOW_MEMORY
+#define LWIP_PROFILE_MEM_SIZE           3000
+#define LWIP_PROFILE_PBUF_POOL_SIZE     8
+#define LWIP_PROFILE_NUM_UDP_PCB        4
+#define LWIP_PROFILE_NUM_TCP_PCB        2
+#define LWIP_PROFILE_NUM_TCP_PCB_LISTEN 2
+#define LWIP_PROFILE_NUM_TCP_SEG        16
+#define LWIP_PROFILE_TCP_WND            (2 * TCP_MSS)
+#define LWIP_PROFILE_TCP_SND_BUF        (2 * TCP_MSS)
+#elif LWIP_PROFILE == LWIP_PROFILE_BALANCED
+#define LWIP_PROFILE_MEM_SIZE           4000
+#define LWIP_PROFILE_PBUF_POOL_SIZE     16
+#define LWIP_PROFILE_NUM_UDP_PCB        4
+#define LWIP_PROFILE_NUM_TCP_PCB        5
+#define LWIP_PROFILE_NUM_TCP_PCB_LISTEN 5
+#define LWIP_PROFILE_NUM_TCP_SEG        32
+#define LWIP_PROFILE_TCP_WND            (8 * TCP_MSS)
+#define LWIP_PROFILE_TCP_SND_BUF        (8 * TCP_MSS)
+#elif LWIP_PROFILE == LWIP_PROFILE_HIGH_THROUGHPUT
+#define LWIP_PROFILE_MEM_SIZE           32000
+#define LWIP_PROFILE_PBUF_POOL_SIZE     32
+#define LWIP_PROFILE_NUM_UDP_PCB        8
+#define LWIP_PROFILE_NUM_TCP_PCB        8
+#define LWIP_PROFILE_NUM_TCP_PCB_LISTEN 8
+#define LWIP_PROFILE_NUM_TCP_SEG        80
+#define LWIP_PROFILE_TCP_WND            (16 * TCP_MSS)
+#define LWIP_PROFILE_TCP_SND_BUF        (16 * TCP_MSS)
+#else
+#error "lwipopts.h: unknown LWIP_PROFILE"
+#endif
+
 // Subsystems.
 #ifndef LWIP_UDP
 #define LWIP_UDP                    0
@@ -37,7 +78,7 @@
 
 // Heap memory.
 #ifndef LWIP_MEM_SIZE
-#define LWIP_MEM_SIZE               4000
+#define LWIP_MEM_SIZE               LWIP_PROFILE_MEM_SIZE
 #endif
 #define MEM_SIZE                    LWIP_MEM_SIZE
 
@@ -53,22 +94,22 @@
 #define MEMP_NUM_RAW_PCB                LWIP_MEMP_NUM_RAW_PCB
 
 #ifndef LWIP_MEMP_NUM_UDP_PCB
-#define LWIP_MEMP_NUM_UDP_PCB           4
+#define LWIP_MEMP_NUM_UDP_PCB           LWIP_PROFILE_NUM_UDP_PCB
 #endif
 #define MEMP_NUM_UDP_PCB                LWIP_MEMP_NUM_UDP_PCB
 
 #ifndef LWIP_MEMP_NUM_TCP_PCB
-#define LWIP_MEMP_NUM_TCP_PCB           5
+#define LWIP_MEMP_NUM_TCP_PCB           LWIP_PROFILE_NUM_TCP_PCB
 #endif
 #define MEMP_NUM_TCP_PCB                LWIP_MEMP_NUM_TCP_PCB
 
 #ifndef LWIP_MEMP_NUM_TCP_PCB_LISTEN
-#define LWIP_MEMP_NUM_TCP_PCB_LISTEN    5
+#define LWIP_MEMP_NUM_TCP_PCB_LISTEN    LWIP_PROFILE_NUM_TCP_PCB_LISTEN
 #endif
 #define MEMP_NUM_TCP_PCB_LISTEN         LWIP_MEMP_NUM_TCP_PCB_LISTEN
 
 #ifndef LWIP_MEMP_NUM_TCP_SEG
-#define LWIP_MEMP_NUM_TCP_SEG           32
+#define LWIP_MEMP_NUM_TCP_SEG           LWIP_PROFILE_NUM_TCP_SEG
 #endif
 #define MEMP_NUM_TCP_SEG                LWIP_MEMP_NUM_TCP_SEG
 
@@ -108,10 +149,23 @@
 #define MEMP_NUM_MLD6_GROUP             LWIP_MEMP_NUM_MLD6_GROUP
 
 #ifndef LWIP_PBUF_POOL_SIZE
-#define LWIP_PBUF_POOL_SIZE             16
+#define LWIP_PBUF_POOL_SIZE             LWIP_PROFILE_PBUF_POOL_SIZE
 #endif
 #define PBUF_POOL_SIZE                  LWIP_PBUF_POOL_SIZE
 
+// TCP windows.
+#ifndef LWIP_TCP_WND
+#define LWIP_TCP_WND                    LWIP_PROFILE_TCP_WND
+#endif
+#define TCP_WND                         LWIP_TCP_WND
+
+#ifndef LWIP_TCP_SND_BUF
+#define LWIP_TCP_SND_BUF                LWIP_PROFILE_TCP_SND_BUF
+#endif
+#define TCP_SND_BUF                     LWIP_TCP_SND_BUF
+#define TCP_SND_QUEUELEN                ((4 * (TCP_SND_BUF) + (TCP_MSS - 1)) \
+                                         / TCP_MSS)
+
 // Statistics.
 #ifndef LWIP_STATS
 #define LWIP_STATS                  0
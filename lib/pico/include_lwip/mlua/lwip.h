@@ -11,6 +11,7 @@
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/event.h"
 #include "mlua/platform.h"
 
 #ifdef __cplusplus
@@ -24,6 +25,34 @@ int mlua_lwip_push_err(lua_State* ls, err_t err);
 // the number of pushed values.
 int mlua_lwip_push_result(lua_State* ls, err_t err);
 
+// Readiness conditions for lwip.poll().
+#define MLUA_LWIP_POLL_RECV 0x01
+#define MLUA_LWIP_POLL_SEND 0x02
+
+// The readiness interface of objects that can be polled with lwip.poll(). A
+// pointer to the interface is stored as a light userdata in the __poll field of
+// the metatable of the objects.
+typedef struct MLuaLwipPollVt {
+    // Return the subset of the conditions in "cond" that are fulfilled for the
+    // object at index arg.
+    unsigned int (*ready)(lua_State* ls, int arg, unsigned int cond);
+
+    // Return the event that is set when the given condition of the object at
+    // index arg may have changed, or NULL if there is none.
+    MLuaEvent* (*event)(lua_State* ls, int arg, unsigned int cond);
+} MLuaLwipPollVt;
+
+// Statistics about the DNS result cache of lwip.dns. The fields are protected
+// by the lwIP lock.
+typedef struct MLuaLwipDnsCacheStats {
+    uint32_t hits;       // Lookups served from a positive entry
+    uint32_t neg_hits;   // Lookups served from a negative entry
+    uint32_t misses;     // Lookups forwarded to the resolver
+    uint32_t evictions;  // Live entries replaced by newer results
+} MLuaLwipDnsCacheStats;
+
+extern MLuaLwipDnsCacheStats mlua_lwip_dns_cache_stats;
+
 // Acquire the lwIP lock.
 static inline void mlua_lwip_lock(void) {
     async_context_acquire_lock_blocking(mlua_async_context());
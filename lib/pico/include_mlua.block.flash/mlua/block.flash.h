@@ -4,6 +4,10 @@
 #ifndef _MLUA_LIB_PICO_MLUA_BLOCK_FLASH_H
 #define _MLUA_LIB_PICO_MLUA_BLOCK_FLASH_H
 
+#include <stdbool.h>
+
+#include "pico.h"
+
 #include "mlua/block.h"
 
 #ifdef __cplusplus
@@ -20,6 +24,12 @@ typedef struct MLuaBlockFlash {
 // FLASH_SECTOR_SIZE boundary. "size" must be a multiple of FLASH_SECTOR_SIZE.
 void mlua_block_flash_init(MLuaBlockFlash* dev, uint32_t offset, size_t size);
 
+// Return true iff the given core is running code that may execute from flash,
+// and hasn't been set up as a lockout victim. The default (weak) implementation
+// returns true for core 0 only; pico.multicore overrides it to also return true
+// for core 1 while it runs an interpreter.
+bool mlua_block_flash_core_running(uint core);
+
 #ifdef __cplusplus
 }
 #endif
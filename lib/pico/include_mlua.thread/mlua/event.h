@@ -34,6 +34,13 @@ static inline void mlua_event_unlock(void) {
     spin_unlock(mlua_event_spinlock, mlua_event_lock_save);
 }
 
+// The number of event priorities. Pending events with a higher priority are
+// dispatched first, and the watchers of events with a non-zero priority are
+// resumed ahead of the threads on the active queues.
+#ifndef MLUA_EVENT_PRIORITIES
+#define MLUA_EVENT_PRIORITIES 2
+#endif
+
 // An event. The state is a tagged union of two pointers:
 //  - If the state is zero, the event is disabled.
 //  - If the lower bits are EVENT_IDLE, the event is enabled and the state
@@ -42,15 +49,32 @@ static inline void mlua_event_unlock(void) {
 //    contains a pointer to the next pending event in the queue.
 //  - If the lower bits are EVENT_ABANDONED, the event was abandoned, and can be
 //    disabled with mlua_event_disable_abandoned().
+// The watcher is the index of the slot holding the thread waiting for the
+// event, or zero if no slot has been allocated. The priority is set when the
+// event is enabled. With MLUA_THREAD_STATS, the time is the low-order bits of
+// the microsecond ticks when the event was last set pending.
 typedef struct MLuaEvent {
     uintptr_t state;
+    int watcher;
+#if MLUA_THREAD_STATS
+    uint32_t time;
+#endif
+    uint8_t priority;
 } MLuaEvent;
 
 // Initialize an event.
-inline void mlua_event_init(MLuaEvent* ev) { ev->state = 0; }
+inline void mlua_event_init(MLuaEvent* ev) { ev->state = 0; ev->watcher = 0; }
 
-// Enable an event. Returns false iff the event was already enabled.
-bool mlua_event_enable(lua_State* ls, MLuaEvent* ev);
+// Enable an event with the given priority, in [0, MLUA_EVENT_PRIORITIES).
+// Returns false iff the event was already enabled.
+bool mlua_event_enable_priority(lua_State* ls, MLuaEvent* ev,
+                                unsigned int priority);
+
+// Enable an event with the default priority (zero). Returns false iff the
+// event was already enabled.
+static inline bool mlua_event_enable(lua_State* ls, MLuaEvent* ev) {
+    return mlua_event_enable_priority(ls, ev, 0);
+}
 
 // Abandon an event. This keeps the event enabled, but allows disabling it from
 // a non-Lua context with mlua_event_disable_abandoned().
@@ -85,8 +109,10 @@ static inline void mlua_event_set(MLuaEvent* ev) {
 // Disable an event, and return true, iff the event has been abandoned.
 bool mlua_event_disable_abandoned(MLuaEvent* ev);
 
-// Dispatch pending events.
-void mlua_event_dispatch(lua_State* ls, uint64_t deadline);
+// Dispatch pending events, waiting up to the given deadline. If "precise" is
+// true, a dedicated hardware alarm is used to wake up at the deadline, if
+// available.
+void mlua_event_dispatch(lua_State* ls, uint64_t deadline, bool precise);
 
 // Parse an IRQ priority argument, which must be an integer or nil.
 lua_Integer mlua_event_parse_irq_priority(lua_State* ls, int arg,
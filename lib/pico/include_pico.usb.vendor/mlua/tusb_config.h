@@ -0,0 +1,46 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#ifndef _MLUA_LIB_PICO_PICO_USB_VENDOR_TUSB_CONFIG_H
+#define _MLUA_LIB_PICO_PICO_USB_VENDOR_TUSB_CONFIG_H
+
+// TinyUSB configuration for a composite device with a CDC interface for stdio
+// and a vendor interface with a pair of bulk endpoints.
+
+#define CFG_TUSB_RHPORT0_MODE (OPT_MODE_DEVICE)
+#define CFG_TUSB_OS (OPT_OS_PICO)
+
+#ifndef CFG_TUSB_MEM_SECTION
+#define CFG_TUSB_MEM_SECTION
+#endif
+
+#ifndef CFG_TUSB_MEM_ALIGN
+#define CFG_TUSB_MEM_ALIGN __attribute__((aligned(4)))
+#endif
+
+#define CFG_TUD_ENDPOINT0_SIZE (64)
+
+#define CFG_TUD_CDC (1)
+#define CFG_TUD_CDC_RX_BUFSIZE (256)
+#define CFG_TUD_CDC_TX_BUFSIZE (256)
+
+// The sizes of the FIFOs of the vendor interface. Larger FIFOs allow more
+// packets to be queued per service round, which is necessary to approach the
+// full-speed bulk throughput limit.
+#ifndef MLUA_USB_VENDOR_RX_BUFSIZE
+#define MLUA_USB_VENDOR_RX_BUFSIZE (1024)
+#endif
+#ifndef MLUA_USB_VENDOR_TX_BUFSIZE
+#define MLUA_USB_VENDOR_TX_BUFSIZE (2048)
+#endif
+
+#define CFG_TUD_VENDOR (1)
+#define CFG_TUD_VENDOR_RX_BUFSIZE MLUA_USB_VENDOR_RX_BUFSIZE
+#define CFG_TUD_VENDOR_TX_BUFSIZE MLUA_USB_VENDOR_TX_BUFSIZE
+
+// Other classes aren't used.
+#define CFG_TUD_MSC (0)
+#define CFG_TUD_HID (0)
+#define CFG_TUD_MIDI (0)
+
+#endif
@@ -23,6 +23,8 @@ extern "C" {
 #endif
 
 #define MLUA_HASH_SYMBOL_TABLES_DEFAULT 1
+#define MLUA_GC_PAUSE_DEFAULT 120
+#define MLUA_GC_STEPSIZE_DEFAULT 12
 
 #define MLUA_BI_TAG BINARY_INFO_MAKE_TAG('M', 'L')
 #define MLUA_BI_FROZEN_MODULE 0xcb9305cf
@@ -48,6 +50,35 @@ static inline void mlua_platform_setup_main(int* argc, char* argv[]) {
 // Perform set up after creating an interpreter.
 void mlua_platform_setup_interpreter(lua_State* ls);
 
+// The number of cores of the platform.
+#define MLUA_PLATFORM_CORES NUM_CORES
+
+// Return the number of the core executing the caller.
+static inline uint mlua_platform_core_num(void) { return get_core_num(); }
+
+// Disable interrupts on the current core, and return the previous state.
+static inline uint32_t mlua_platform_irq_save(void) {
+    return save_and_disable_interrupts();
+}
+
+// Restore the interrupt state returned by mlua_platform_irq_save().
+static inline void mlua_platform_irq_restore(uint32_t save) {
+    restore_interrupts(save);
+}
+
+// Acquire the lock protecting data shared between cores, and disable
+// interrupts on the current core. Returns the previous interrupt state.
+static inline uint32_t mlua_platform_shared_lock(void) {
+    extern spin_lock_t* mlua_platform_shared_spinlock;
+    return spin_lock_blocking(mlua_platform_shared_spinlock);
+}
+
+// Release the lock acquired by mlua_platform_shared_lock().
+static inline void mlua_platform_shared_unlock(uint32_t save) {
+    extern spin_lock_t* mlua_platform_shared_spinlock;
+    spin_unlock(mlua_platform_shared_spinlock, save);
+}
+
 // Return the current microsecond ticks, as given by a monotonic clock.
 static inline uint64_t mlua_ticks64(void) {
     return time_us_64();
@@ -76,6 +107,17 @@ static inline bool mlua_ticks_reached(lua_Unsigned ticks) {
 #endif
 }
 
+// Return the number of CPU cycles executed by the current core since its
+// interpreter was set up. The count is derived from the SysTick timer of the
+// core, extended by its wrap interrupt.
+uint64_t mlua_cycles64(void);
+
+// Return the low-order 32 bits of mlua_cycles64().
+static inline uint32_t mlua_cycles(void) { return mlua_cycles64(); }
+
+// Return the frequency of the cycle counter, in Hz.
+uint32_t mlua_cycles_freq(void);
+
 // Wait for an event, up to the given deadline. Returns true iff the deadline
 // was reached.
 static inline bool mlua_wait(uint64_t deadline) {
@@ -93,17 +135,75 @@ char const* mlua_pico_error_str(int err);
 
 #include "pico/async_context.h"
 
-// Return the global async_context_t.
+// Return the global async_context_t. The context is initialized on first use,
+// and processes its work in the core on which it was initialized.
 async_context_t* mlua_async_context(void);
 
+// Return the core on which the global async_context_t processes its work, or -1
+// if it hasn't been initialized.
+int mlua_async_context_core(void);
+
+// De-initialize the global async_context_t, so that it can be re-initialized
+// on another core. Must be called on the core on which the context runs, after
+// all its users have been de-initialized.
+void mlua_async_context_deinit(void);
+
+// When non-zero, the global async_context_t is a polled context whose work is
+// processed by mlua_async_context_service(), typically from an event handler
+// thread, instead of a low-priority IRQ.
+#ifndef MLUA_ASYNC_CONTEXT_POLL
+#define MLUA_ASYNC_CONTEXT_POLL 0
+#endif
+
+#if MLUA_ASYNC_CONTEXT_POLL
+
+// Statistics about the servicing of the global async_context_t. Times are in
+// microseconds.
+typedef struct MLuaAsyncContextStats {
+    uint64_t latency_total;  // Sum of the servicing latencies
+    uint32_t latency_max;    // Longest time from notification to servicing
+    uint32_t services;       // Calls to mlua_async_context_service()
+    uint32_t rounds;         // Passes over the pending work
+    uint32_t service_max;    // Longest time spent in a single service call
+    uint32_t overruns;       // Service calls that exhausted their budget
+} MLuaAsyncContextStats;
+
+// Set the function that is called when the global async_context_t needs to be
+// serviced, or NULL to stop notifications. The function can be called from
+// any core, and from interrupt context.
+void mlua_async_context_set_notify(void (*notify)(void));
+
+// Process the work of the global async_context_t for at most "budget"
+// microseconds. Returns true iff work remains pending after the budget has
+// elapsed. Otherwise, the notification function is called when timed work
+// becomes due.
+bool mlua_async_context_service(uint32_t budget);
+
+// Get the servicing statistics of the global async_context_t, and optionally
+// reset them.
+void mlua_async_context_stats(MLuaAsyncContextStats* stats, bool reset);
+
+#endif  // MLUA_ASYNC_CONTEXT_POLL
+
 // Return a description of the flash memory of the platform, or NULL if the
 // platform doesn't have flash memory.
 MLuaFlash const* mlua_platform_flash(void);
 
+// Update a checksum state with a block of memory using the DMA sniffer.
+// Returns false if the checksum must be computed in software, e.g. because the
+// block is too short, or the sniffer or all DMA channels are in use.
+bool mlua_platform_checksum(MLuaChecksum algo, void const* ptr, size_t len,
+                            uint32_t* state);
+
 #else  // !PICO_ON_DEVICE
 
 static inline MLuaFlash const* mlua_platform_flash(void) { return NULL; }
 
+static inline bool mlua_platform_checksum(MLuaChecksum algo, void const* ptr,
+                                          size_t len, uint32_t* state) {
+    return false;
+}
+
 #endif  // !PICO_ON_DEVICE
 
 #ifdef __cplusplus
@@ -10,8 +10,10 @@
 #include "lwip/ip_addr.h"
 #include "pico/lwip_nosys.h"
 
+#include "mlua/int64.h"
 #include "mlua/lwip.h"
 #include "mlua/module.h"
+#include "mlua/thread.h"
 #include "mlua/util.h"
 
 int mlua_lwip_push_err(lua_State* ls, err_t err) {
@@ -48,6 +50,8 @@ static char const* mlua_lwip_err_str(err_t err) {
     }
 }
 
+MLuaLwipDnsCacheStats mlua_lwip_dns_cache_stats;
+
 char const mlua_IPAddr_name[] = "lwip.IPAddr";
 
 ip_addr_t* mlua_new_IPAddr(lua_State* ls) {
@@ -139,13 +143,27 @@ static int mod_init(lua_State* ls) {
 }
 
 static int mod_deinit(lua_State* ls) {
+    bool release = mlua_to_cbool(ls, 1);
     async_context_t* ctx = mlua_async_context();
     mlua_lwip_lock();
     lwip_nosys_deinit(ctx);
     mlua_lwip_unlock();
+    if (release) {
+        if ((int)get_core_num() != mlua_async_context_core()) {
+            return luaL_error(ls, "lwip: context runs on core %d",
+                              mlua_async_context_core());
+        }
+        mlua_async_context_deinit();
+    }
     return 0;
 }
 
+static int mod_core(lua_State* ls) {
+    int core = mlua_async_context_core();
+    if (core < 0) return 0;
+    return lua_pushinteger(ls, core), 1;
+}
+
 static int mod_err_str(lua_State* ls) {
     char const* msg = mlua_lwip_err_str(luaL_checkinteger(ls, 1));
     return lua_pushstring(ls, msg), 1;
@@ -168,6 +186,114 @@ static int mod_ipaddr_aton(lua_State* ls) {
     return 1;
 }
 
+// Return the readiness interface of the object at index arg, or NULL if the
+// object cannot be polled.
+static MLuaLwipPollVt const* to_poll_vt(lua_State* ls, int arg) {
+    if (luaL_getmetafield(ls, arg, "__poll") == LUA_TNIL) return NULL;
+    MLuaLwipPollVt const* vt = lua_touserdata(ls, -1);
+    lua_pop(ls, 1);
+    return vt;
+}
+
+// Return the conditions to poll for the object at index i of the table at
+// index 1. The conditions are at index 2, either as an integer applying to all
+// objects, or as a table indexed like the objects.
+static unsigned int poll_cond(lua_State* ls, lua_Integer i) {
+    if (lua_type(ls, 2) != LUA_TTABLE) return lua_tointeger(ls, 2);
+    lua_rawgeti(ls, 2, i);
+    unsigned int cond = lua_tointeger(ls, -1);
+    lua_pop(ls, 1);
+    return cond;
+}
+
+// Watch or unwatch the events of the objects to poll.
+static void poll_watch(lua_State* ls, bool watch) {
+    lua_Integer len = lua_rawlen(ls, 1);
+    for (lua_Integer i = 1; i <= len; ++i) {
+        lua_rawgeti(ls, 1, i);
+        int arg = lua_absindex(ls, -1);
+        MLuaLwipPollVt const* vt = to_poll_vt(ls, arg);
+        unsigned int cond = poll_cond(ls, i);
+        for (unsigned int c = MLUA_LWIP_POLL_RECV; c <= MLUA_LWIP_POLL_SEND;
+                c <<= 1) {
+            if ((cond & c) == 0) continue;
+            MLuaEvent* ev = vt->event(ls, arg, c);
+            if (ev == NULL || !mlua_event_enabled(ev)) continue;
+            if (watch) {
+                mlua_event_watch(ls, ev);
+            } else {
+                mlua_event_unwatch(ls, ev);
+            }
+        }
+        lua_pop(ls, 1);
+    }
+}
+
+// Push the list of ready objects and the list of their fulfilled conditions.
+// Stack: (objs, cond, deadline).
+static int poll_loop(lua_State* ls, bool timeout) {
+    lua_Integer len = lua_rawlen(ls, 1);
+    lua_Integer cnt = 0;
+    for (lua_Integer i = 1; i <= len; ++i) {
+        lua_rawgeti(ls, 1, i);
+        unsigned int ready = to_poll_vt(ls, -1)->ready(
+            ls, lua_absindex(ls, -1), poll_cond(ls, i));
+        if (ready == 0) {
+            lua_pop(ls, 1);
+            continue;
+        }
+        if (cnt == 0) {
+            lua_createtable(ls, 1, 0);
+            lua_createtable(ls, 1, 0);
+            lua_rotate(ls, 4, -1);
+        }
+        ++cnt;
+        lua_rawseti(ls, 4, cnt);
+        lua_pushinteger(ls, ready);
+        lua_rawseti(ls, 5, cnt);
+    }
+    if (cnt > 0) return 2;
+    if (!timeout) return -1;
+    return mlua_lwip_push_err(ls, ERR_TIMEOUT);
+}
+
+static int mod_poll_1(lua_State* ls, int status, lua_KContext ctx);
+
+static int mod_poll(lua_State* ls) {
+    luaL_checktype(ls, 1, LUA_TTABLE);
+    lua_settop(ls, 3);  // Ensure deadline is set
+    if (lua_type(ls, 2) != LUA_TTABLE) {
+        lua_pushinteger(ls, luaL_optinteger(ls, 2, MLUA_LWIP_POLL_RECV));
+        lua_replace(ls, 2);
+    }
+    lua_Integer len = lua_rawlen(ls, 1);
+    for (lua_Integer i = 1; i <= len; ++i) {
+        lua_rawgeti(ls, 1, i);
+        if (to_poll_vt(ls, -1) == NULL) {
+            return luaL_error(ls, "objs[%d]: cannot be polled", (int)i);
+        }
+        lua_pop(ls, 1);
+    }
+    int res = poll_loop(ls, false);
+    if (res >= 0) return res;
+    if (!lua_isnil(ls, 3)) {
+        luaL_argexpected(ls, mlua_is_time(ls, 3), 3, "integer or Int64");
+    }
+    poll_watch(ls, true);
+    return mlua_thread_suspend(ls, &mod_poll_1, 0, lua_isnil(ls, 3) ? 0 : 3);
+}
+
+static int mod_poll_1(lua_State* ls, int status, lua_KContext ctx) {
+    bool timeout = !lua_isnil(ls, 3) && mlua_time_reached(ls, 3);
+    int res = poll_loop(ls, timeout);
+    if (res < 0) {
+        return mlua_thread_suspend(ls, &mod_poll_1, 0,
+                                   lua_isnil(ls, 3) ? 0 : 3);
+    }
+    poll_watch(ls, false);
+    return res;
+}
+
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(VERSION, integer, LWIP_VERSION),
     MLUA_SYM_V(VERSION_STRING, string, LWIP_VERSION_STRING),
@@ -196,16 +322,23 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(IPADDR_TYPE_V4, integer, IPADDR_TYPE_V4),
     MLUA_SYM_V(IPADDR_TYPE_V6, integer, IPADDR_TYPE_V6),
     MLUA_SYM_V(IPADDR_TYPE_ANY, integer, IPADDR_TYPE_ANY),
+    MLUA_SYM_V(POLL_RECV, integer, MLUA_LWIP_POLL_RECV),
+    MLUA_SYM_V(POLL_SEND, integer, MLUA_LWIP_POLL_SEND),
     MLUA_SYM_P(IP_ANY_TYPE, mod_),
 
     MLUA_SYM_F(init, mod_),
     MLUA_SYM_F(deinit, mod_),
+    MLUA_SYM_F(core, mod_),
     MLUA_SYM_F(err_str, mod_),
     MLUA_SYM_F(assert, mod_),
     MLUA_SYM_F(ipaddr_aton, mod_),
+    MLUA_SYM_F(poll, mod_),
 };
 
 MLUA_OPEN_MODULE(lwip) {
+    mlua_thread_require(ls);
+    mlua_require(ls, "mlua.int64", false);
+
     // Create the module.
     mlua_new_module(ls, 0, module_syms);
 
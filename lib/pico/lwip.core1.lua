@@ -0,0 +1,74 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local lwip = require 'lwip'
+local async_context = require 'pico.async_context'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local multicore = require 'pico.multicore'
+
+local module_name = ...
+
+-- The interval at which start() checks if the stack is running.
+local poll_interval = time.msec
+
+-- Start the network stack in core 1, and wait until it is running. If "cyw43"
+-- is true, the CYW43 driver is initialized in core 1 as well. Returns true on
+-- success, or fail if the stack wasn't running by the deadline.
+function start(cyw43, deadline)
+    if lwip.core() ~= nil then error("network stack already running", 2) end
+    if deadline == nil then deadline = time.deadline(5 * time.sec) end
+    multicore.launch_core1(module_name,
+                           cyw43 and 'cyw43_worker' or 'worker')
+    while lwip.core() == nil do
+        if time.compare(time.ticks64(), deadline) >= 0 then
+            multicore.reset_core1()
+            return nil
+        end
+        time.sleep_for(poll_interval)
+    end
+    return true
+end
+
+-- Stop the network stack running in core 1.
+function stop()
+    if lwip.core() ~= 1 then return end
+    multicore.reset_core1()
+end
+
+-- De-initialize the network stack, and release the async context so that it
+-- can be re-initialized in another core.
+local function deinit(cyw43)
+    if cyw43 then cyw43.deinit() end
+    lwip.deinit(true)
+end
+
+-- Run the network stack in the current core until shutdown. The work of the
+-- async context is processed in IRQ handlers, or by a servicing thread if the
+-- context is polled, so the interpreter just waits.
+local function run(cyw43)
+    local service = async_context.POLL and async_context.service()
+    multicore.set_shutdown_handler(function()
+        if service then service:kill() end
+        deinit(cyw43)
+        thread.shutdown()
+    end)
+    thread.suspend()
+end
+
+-- The main function of the interpreter in core 1, without the CYW43 driver.
+function worker()
+    if not lwip.init() then return deinit() end
+    return run()
+end
+
+-- The main function of the interpreter in core 1, with the CYW43 driver. The
+-- pico.cyw43 module must be linked into the binary.
+function cyw43_worker()
+    local cyw43 = require 'pico.cyw43'
+    if not cyw43.init() then return deinit() end
+    if not lwip.init() then return deinit(cyw43) end
+    return run(cyw43)
+end
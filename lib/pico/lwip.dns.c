@@ -2,14 +2,19 @@
 // SPDX-License-Identifier: MIT
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
+#include "lwip/def.h"
 #include "lwip/dns.h"
 #include "pico/platform.h"
 
 #include "lua.h"
 #include "lauxlib.h"
 #include "mlua/lwip.h"
+#include "mlua/int64.h"
 #include "mlua/module.h"
+#include "mlua/platform.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
 
@@ -21,6 +26,27 @@
 #endif
 #endif
 
+// The number of entries in the DNS result cache. Setting this to 0 disables
+// the cache.
+#ifndef MLUA_DNS_CACHE_SIZE
+#define MLUA_DNS_CACHE_SIZE 4
+#endif
+
+// The maximum length of the hostnames that can be cached.
+#ifndef MLUA_DNS_CACHE_NAME_LEN
+#define MLUA_DNS_CACHE_NAME_LEN 63
+#endif
+
+// The default time-to-live of successful lookups in the cache, in seconds.
+#ifndef MLUA_DNS_CACHE_TTL
+#define MLUA_DNS_CACHE_TTL 300
+#endif
+
+// The default time-to-live of failed lookups in the cache, in seconds.
+#ifndef MLUA_DNS_CACHE_NEG_TTL
+#define MLUA_DNS_CACHE_NEG_TTL 30
+#endif
+
 static int mod_getserver(lua_State* ls) {
     u8_t index = luaL_checkinteger(ls, 1);
     mlua_lwip_lock();
@@ -46,10 +72,94 @@ typedef enum ReqStatus {
     STATUS_NOT_FOUND,
 } ReqStatus;
 
+typedef struct CacheEntry {
+    uint64_t expires;
+    ip_addr_t addr;
+    u8_t addrtype;
+    bool found;
+    char name[MLUA_DNS_CACHE_NAME_LEN + 1];  // Empty for unused entries
+} CacheEntry;
+
+#if MLUA_DNS_CACHE_SIZE > 0
+static CacheEntry cache[MLUA_DNS_CACHE_SIZE];
+#endif
+static uint64_t cache_ttl = MLUA_DNS_CACHE_TTL * 1000000ull;
+static uint64_t cache_neg_ttl = MLUA_DNS_CACHE_NEG_TTL * 1000000ull;
+
+// Find the live cache entry for the given lookup. Must be called with the lwIP
+// lock held.
+static CacheEntry* cache_find(char const* name, u8_t addrtype) {
+#if MLUA_DNS_CACHE_SIZE > 0
+    for (CacheEntry* e = cache; e != cache + MLUA_SIZE(cache); ++e) {
+        if (e->name[0] == '\0' || e->addrtype != addrtype
+                || lwip_stricmp(e->name, name) != 0) {
+            continue;
+        }
+        if (!mlua_ticks64_reached(e->expires)) return e;
+        e->name[0] = '\0';
+        break;
+    }
+#endif
+    return NULL;
+}
+
+// Store the result of a lookup in the cache, replacing the entry that expires
+// first if the cache is full. Must be called with the lwIP lock held.
+static void cache_put(char const* name, u8_t addrtype, ip_addr_t const* addr) {
+#if MLUA_DNS_CACHE_SIZE > 0
+    uint64_t ttl = addr != NULL ? cache_ttl : cache_neg_ttl;
+    size_t len = strlen(name);
+    if (ttl == 0 || len > MLUA_DNS_CACHE_NAME_LEN) return;
+    CacheEntry* entry = cache_find(name, addrtype);
+    if (entry == NULL) {
+        entry = cache;
+        for (CacheEntry* e = cache; e != cache + MLUA_SIZE(cache); ++e) {
+            if (e->name[0] == '\0') { entry = e; break; }
+            if (e->expires < entry->expires) entry = e;
+        }
+        if (entry->name[0] != '\0' && !mlua_ticks64_reached(entry->expires)) {
+            ++mlua_lwip_dns_cache_stats.evictions;
+        }
+        memcpy(entry->name, name, len + 1);
+        entry->addrtype = addrtype;
+    }
+    entry->expires = mlua_ticks64() + ttl;
+    entry->found = addr != NULL;
+    if (addr != NULL) entry->addr = *addr;
+#endif
+}
+
+static int mod_cache_flush(lua_State* ls) {
+#if MLUA_DNS_CACHE_SIZE > 0
+    mlua_lwip_lock();
+    for (CacheEntry* e = cache; e != cache + MLUA_SIZE(cache); ++e) {
+        e->name[0] = '\0';
+    }
+    mlua_lwip_unlock();
+#endif
+    return 0;
+}
+
+static int mod_cache_ttl(lua_State* ls) {
+    bool set_ttl = !lua_isnoneornil(ls, 1);
+    bool set_neg_ttl = !lua_isnoneornil(ls, 2);
+    uint64_t new_ttl = set_ttl ? mlua_check_int64(ls, 1) : 0;
+    uint64_t new_neg_ttl = set_neg_ttl ? mlua_check_int64(ls, 2) : 0;
+    mlua_lwip_lock();
+    uint64_t ttl = cache_ttl, neg_ttl = cache_neg_ttl;
+    if (set_ttl) cache_ttl = new_ttl;
+    if (set_neg_ttl) cache_neg_ttl = new_neg_ttl;
+    mlua_lwip_unlock();
+    mlua_push_int64(ls, ttl);
+    mlua_push_int64(ls, neg_ttl);
+    return 2;
+}
+
 typedef struct GHBNState {
     MLuaEvent event;
     ip_addr_t addr;
     uint8_t status;
+    u8_t addrtype;
 } GHBNState;
 
 static GHBNState ghbn_state[MLUA_MAX_DNS_REQUESTS];
@@ -57,6 +167,7 @@ static GHBNState ghbn_state[MLUA_MAX_DNS_REQUESTS];
 static void handle_dns_found(char const* name, ip_addr_t const* addr,
                              void* arg) {
     GHBNState* state = arg;
+    cache_put(name, state->addrtype, addr);
     if (mlua_event_disable_abandoned(&state->event)) return;
     if (addr != NULL) {
         state->addr = *addr;
@@ -103,6 +214,21 @@ static int mod_gethostbyname(lua_State* ls) {
     u8_t addrtype = luaL_optinteger(ls, 2, LWIP_DNS_ADDRTYPE_DEFAULT);
     lua_settop(ls, 3);  // Ensure deadline is set
 
+    // Serve the lookup from the cache if possible.
+    mlua_lwip_lock();
+    CacheEntry* entry = cache_find(hostname, addrtype);
+    if (entry != NULL) {
+        ip_addr_t addr = entry->addr;
+        bool found = entry->found;
+        ++*(found ? &mlua_lwip_dns_cache_stats.hits
+                  : &mlua_lwip_dns_cache_stats.neg_hits);
+        mlua_lwip_unlock();
+        if (found) return push_addr(ls, &addr);
+        return lua_pushboolean(ls, false), 1;
+    }
+    ++mlua_lwip_dns_cache_stats.misses;
+    mlua_lwip_unlock();
+
     // Find an available slot.
     GHBNState* state = ghbn_state;
     for (; state != ghbn_state + MLUA_SIZE(ghbn_state); ++state) {
@@ -115,6 +241,7 @@ static int mod_gethostbyname(lua_State* ls) {
     lua_pushcclosure(ls, &gethostbyname_done, 1);
     lua_toclose(ls, -1);
     state->status = STATUS_WAITING;
+    state->addrtype = addrtype;
     lua_pushlightuserdata(ls, state);
 
     // Initiate the lookup and wait for the response.
@@ -140,14 +267,18 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(ADDRTYPE_IPV4_IPV6, integer, LWIP_DNS_ADDRTYPE_IPV4_IPV6),
     MLUA_SYM_V(ADDRTYPE_IPV6_IPV4, integer, LWIP_DNS_ADDRTYPE_IPV6_IPV4),
     MLUA_SYM_V(MAX_SERVERS, integer, DNS_MAX_SERVERS),
+    MLUA_SYM_V(CACHE_SIZE, integer, MLUA_DNS_CACHE_SIZE),
 
     MLUA_SYM_F(getserver, mod_),
     MLUA_SYM_F(setserver, mod_),
     MLUA_SYM_F(gethostbyname, mod_),
+    MLUA_SYM_F(cache_flush, mod_),
+    MLUA_SYM_F(cache_ttl, mod_),
 };
 
 MLUA_OPEN_MODULE(lwip.dns) {
     mlua_thread_require(ls);
+    mlua_require(ls, "mlua.int64", false);
     mlua_require(ls, "lwip", false);
 
     // Create the module.
@@ -5,6 +5,7 @@ _ENV = module(...)
 
 local lwip = require 'lwip'
 local dns = require 'lwip.dns'
+local stats = require 'lwip.stats'
 local time = require 'mlua.time'
 local table = require 'table'
 
@@ -37,3 +38,29 @@ function test_gethostbyname(t)
         ::continue::
     end
 end
+
+function test_gethostbyname_cache(t)
+    if dns.CACHE_SIZE == 0 then t:skip("DNS cache disabled") end
+    dns.cache_flush()
+    t:cleanup(dns.cache_flush)
+    local dl = time.deadline(5 * time.sec)
+    for _, test in ipairs{
+        {'dns.google', dns.ADDRTYPE_IPV4},
+        {'this.is.invalid', dns.ADDRTYPE_IPV4},
+    } do
+        local host, typ = table.unpack(test)
+        local want, err = dns.gethostbyname(host, typ, dl)
+        t:assert(err == nil, "DNS request failed: %s",
+                 function() return lwip.err_str(err) end)
+        local before = stats.dns_cache()
+        t:expect(t.expr(dns).gethostbyname(host, typ, 0)):eq(want)
+        local after = stats.dns_cache()
+        t:expect(after.hits + after.neg_hits):label("hits")
+            :eq(before.hits + before.neg_hits + 1)
+        t:expect(after.misses):label("misses"):eq(before.misses)
+    end
+    dns.cache_flush()
+    t:expect(t.mexpr(dns).gethostbyname('this.is.invalid', dns.ADDRTYPE_IPV4,
+                                        0))
+        :eq{nil, lwip.ERR_TIMEOUT}
+end
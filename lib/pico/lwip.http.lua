@@ -0,0 +1,485 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local lwip = require 'lwip'
+local tcp = require 'lwip.tcp'
+local fs = require 'mlua.fs'
+local mem = require 'mlua.mem'
+local oo = require 'mlua.oo'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local math = require 'math'
+local string = require 'string'
+local table = require 'table'
+
+-- The maximum size of the request line and headers of a request. This is also
+-- the size of the receive buffer of each connection.
+HEADER_SIZE = 1024
+
+-- The size of the blocks in which files are streamed.
+BLOCK_SIZE = 1024
+
+-- The maximum size of an unread request body that is discarded to keep the
+-- connection alive. Connections with larger unread bodies are closed.
+DRAIN_SIZE = 4096
+
+-- The default timeouts.
+IDLE_TIMEOUT = 10 * time.sec
+IO_TIMEOUT = 5 * time.sec
+
+-- The reason phrases of status codes.
+reasons = {
+    [200] = "OK",
+    [201] = "Created",
+    [204] = "No Content",
+    [301] = "Moved Permanently",
+    [302] = "Found",
+    [304] = "Not Modified",
+    [400] = "Bad Request",
+    [403] = "Forbidden",
+    [404] = "Not Found",
+    [405] = "Method Not Allowed",
+    [408] = "Request Timeout",
+    [413] = "Content Too Large",
+    [431] = "Request Header Fields Too Large",
+    [500] = "Internal Server Error",
+    [501] = "Not Implemented",
+    [503] = "Service Unavailable",
+}
+
+-- The content types of files, indexed by extension.
+content_types = {
+    css = 'text/css',
+    gif = 'image/gif',
+    htm = 'text/html; charset=utf-8',
+    html = 'text/html; charset=utf-8',
+    ico = 'image/x-icon',
+    jpeg = 'image/jpeg',
+    jpg = 'image/jpeg',
+    js = 'text/javascript',
+    json = 'application/json',
+    png = 'image/png',
+    svg = 'image/svg+xml',
+    txt = 'text/plain; charset=utf-8',
+    wasm = 'application/wasm',
+}
+
+-- Return the content type of the file at the given path.
+function content_type(path)
+    local ext = path:match('%.([^./]+)$')
+    return ext and content_types[ext:lower()] or 'application/octet-stream'
+end
+
+-- Decode the percent-encoded characters of a string.
+function unquote(s)
+    return (s:gsub('%%(%x%x)', function(h)
+        return string.char(tonumber(h, 16))
+    end))
+end
+
+-- A request received on a connection.
+Request = oo.class('Request')
+
+function Request:__init(conn, method, target, version, headers)
+    self._conn = conn
+    self.method, self.target, self.version = method, target, version
+    self.headers = headers
+    local path, query = target:match('^([^?]*)%??(.*)$')
+    self.path, self.query = unquote(path), query
+    self._body = tonumber(headers['content-length']) or 0
+end
+
+-- Return true iff the client accepts the given content coding.
+function Request:accepts(coding)
+    local ae = self.headers['accept-encoding']
+    if not ae then return false end
+    for c in ae:gmatch('([^,;%s]+)[^,]*') do
+        if c:lower() == coding then return true end
+    end
+    return false
+end
+
+-- Read up to "len" bytes of the request body. Returns an empty string at the
+-- end of the body.
+function Request:read(len)
+    len = math.min(len, self._body)
+    if len <= 0 then return '' end
+    local data = self._conn:read(len)
+    self._body = self._body - #data
+    return data
+end
+
+-- Discard the unread part of the request body. Returns false if the body is
+-- too large to be discarded.
+function Request:_drain()
+    if self._body > DRAIN_SIZE then return false end
+    while self._body > 0 do
+        if #self:read(self._body) == 0 then return false end
+    end
+    return true
+end
+
+-- The response to a request.
+Response = oo.class('Response')
+
+function Response:__init(conn, req)
+    self._conn, self._req = conn, req
+    self.status, self.headers = 200, {}
+    self._close = req.version == '1.0'
+    local c = req.headers['connection']
+    if c then
+        c = c:lower()
+        if c:find('close', 1, true) then
+            self._close = true
+        elseif c:find('keep-alive', 1, true) then
+            self._close = false
+        end
+    end
+end
+
+-- Set the status code of the response.
+function Response:set_status(status) self.status = status end
+
+-- Set a response header.
+function Response:set_header(name, value) self.headers[name] = value end
+
+-- Return true iff the response header has been sent.
+function Response:head_sent() return self._head ~= nil end
+
+-- Format the response header, with the given Content-Length. The body is
+-- chunked if the length is missing.
+function Response:_format_head(len)
+    if self._head then error("response header already sent", 3) end
+    local parts = {('HTTP/1.1 %d %s\r\n'):format(
+        self.status, reasons[self.status] or '')}
+    for name, value in pairs(self.headers) do
+        parts[#parts + 1] = ('%s: %s\r\n'):format(name, value)
+    end
+    if len then
+        parts[#parts + 1] = ('Content-Length: %d\r\n'):format(len)
+        self._head = 'length'
+    elseif self._req.version == '1.0' then
+        self._close, self._head = true, 'raw'
+    else
+        parts[#parts + 1] = 'Transfer-Encoding: chunked\r\n'
+        self._head = 'chunked'
+    end
+    if self._close then
+        parts[#parts + 1] = 'Connection: close\r\n'
+    elseif self._req.version == '1.0' then
+        parts[#parts + 1] = 'Connection: keep-alive\r\n'
+    end
+    parts[#parts + 1] = '\r\n'
+    return parts
+end
+
+-- Return true iff the response has no body.
+function Response:_no_body()
+    local s = self.status
+    return self._req.method == 'HEAD' or s == 204 or s == 304
+           or (s >= 100 and s < 200)
+end
+
+-- Send a complete response with the given body.
+function Response:send(body)
+    body = body or ''
+    local parts = self:_format_head(#body)
+    if not self:_no_body() then parts[#parts + 1] = body end
+    self._done = true
+    return self._conn:sendv(parts)
+end
+
+-- Send a complete error response with a short text body.
+function Response:error(status, msg)
+    self.status = status
+    self.headers = {['Content-Type'] = 'text/plain; charset=utf-8'}
+    return self:send(msg or ('%d %s\n'):format(status, reasons[status] or ''))
+end
+
+-- Send a chunk of the response body. The response header is sent first if it
+-- hasn't been sent yet, and the body uses the chunked transfer encoding.
+function Response:write(data)
+    if #data == 0 then return end
+    local conn = self._conn
+    if not self._head then
+        conn:sendv(self:_format_head(), {more = true})
+    end
+    if self:_no_body() then return end
+    if self._head == 'chunked' then
+        return conn:sendv({('%x\r\n'):format(#data), data, '\r\n'})
+    end
+    return conn:sendv({data})
+end
+
+-- Complete the response.
+function Response:finish()
+    if self._done then return end
+    self._done = true
+    local conn = self._conn
+    if not self._head then return conn:sendv(self:_format_head(0)) end
+    if self:_no_body() then return conn:flush() end
+    if self._head == 'chunked' then return conn:sendv({'0\r\n\r\n'}) end
+end
+
+-- Send the content of a file as the response body. If the client accepts gzip
+-- encoding and a file with the same path and a .gz suffix exists, the latter
+-- is sent instead. The file is streamed in blocks of BLOCK_SIZE bytes.
+function Response:send_file(dfs, path, ctype)
+    local f, enc
+    if self._req:accepts('gzip') then
+        f = dfs:open(path .. '.gz', fs.O_RDONLY)
+        if f then enc = 'gzip' end
+    end
+    if not f then f = dfs:open(path, fs.O_RDONLY) end
+    if not f then return self:error(404) end
+    local file<close> = f
+    local size = assert(file:size())
+    self.headers['Content-Type'] = ctype or content_type(path)
+    if enc then
+        self.headers['Content-Encoding'] = enc
+        self.headers['Vary'] = 'Accept-Encoding'
+    end
+    local conn, no_body = self._conn, self:_no_body()
+    self._done = true
+    conn:sendv(self:_format_head(size), {more = size > 0 and not no_body})
+    if no_body then return end
+    while size > 0 do
+        local data = assert(file:read(math.min(BLOCK_SIZE, size)))
+        if #data == 0 then
+            -- The file was truncated. Close the connection, as the response
+            -- is incomplete.
+            self._close = true
+            return
+        end
+        size = size - #data
+        conn:sendv({data}, {more = size > 0})
+    end
+end
+
+-- A connection to a client. Its receive buffer holds the partially received
+-- request header, and possibly the data following it.
+local Conn = oo.class('Conn')
+
+function Conn:__init(server, sock)
+    self._server, self.sock = server, sock
+    self._buf, self._len, self._scan = mem.alloc(HEADER_SIZE), 0, 0
+    self:touch()
+end
+
+-- Reset the idle deadline of the connection.
+function Conn:touch()
+    self.expires = time.deadline(self._server.idle_timeout)
+end
+
+function Conn:deadline() return time.deadline(self._server.timeout) end
+
+-- Read up to "len" bytes, first from the receive buffer, then from the socket.
+function Conn:read(len)
+    local blen = self._len
+    if blen == 0 then
+        return lwip.assert(self.sock:recv(len, self:deadline()))
+    end
+    local buf = self._buf
+    len = math.min(len, blen)
+    local data = mem.read(buf, 0, len)
+    self:_consume(len)
+    return data
+end
+
+-- Remove "len" bytes from the start of the receive buffer.
+function Conn:_consume(len)
+    local buf, rest = self._buf, self._len - len
+    if rest > 0 then mem.write(buf, mem.read(buf, len, rest), 0) end
+    self._len, self._scan = rest, 0
+end
+
+function Conn:sendv(parts, opts)
+    return lwip.assert(self.sock:sendv(parts, opts, self:deadline()))
+end
+
+function Conn:flush() return lwip.assert(self.sock:flush()) end
+
+-- Receive data into the receive buffer, waiting until the idle deadline.
+-- Returns false at the end of the stream.
+function Conn:fill()
+    local len = self._len
+    local cnt = lwip.assert(self.sock:recv_into(
+        self._buf, len, HEADER_SIZE - len, self.expires))
+    self._len = len + cnt
+    return cnt > 0
+end
+
+-- Parse a request header from the receive buffer. Returns the request, nil if
+-- the header is incomplete, or false and a status code if the request is
+-- invalid.
+function Conn:parse()
+    local buf, len = self._buf, self._len
+    local pos = mem.find(buf, '\r\n\r\n', self._scan, len - self._scan)
+    if not pos then
+        if len >= HEADER_SIZE then return false, 431 end
+        self._scan = math.max(0, len - 3)
+        return
+    end
+    local head = mem.read(buf, 0, pos + 2)
+    self:_consume(pos + 4)
+    local method, target, version, i = head:match(
+        '^(%u+) (%S+) HTTP/(1%.[01])\r\n()')
+    if not method then return false, 400 end
+    local headers = {}
+    for name, value in head:gmatch('([^:\r\n]+):[ \t]*([^\r\n]-)[ \t]*\r\n', i)
+    do
+        name = name:lower()
+        local prev = headers[name]
+        headers[name] = prev and prev .. ', ' .. value or value
+    end
+    if headers['transfer-encoding'] then return false, 501 end
+    return Request(self, method, target, version, headers)
+end
+
+-- An HTTP/1.1 server. Each connection is served by its own thread, so that a
+-- slow client doesn't delay the others.
+Server = oo.class('Server')
+
+function Server:__init(opts)
+    opts = opts or {}
+    self.timeout = opts.timeout or IO_TIMEOUT
+    self.idle_timeout = opts.idle_timeout or IDLE_TIMEOUT
+    self.max_conns = opts.max_conns or 8
+    self._routes = {}
+end
+
+-- Register a handler for requests. If "prefix" ends with a slash, the handler
+-- is called for all paths starting with "prefix". Otherwise, it is only called
+-- for exact path matches. The longest matching prefix wins. The handler is
+-- called as handler(req, resp).
+function Server:handle(prefix, handler)
+    local routes = self._routes
+    routes[#routes + 1] = {prefix, handler}
+    table.sort(routes, function(a, b) return #a[1] > #b[1] end)
+end
+
+-- Serve files from the directory "root" of the filesystem "dfs", for paths
+-- starting with "prefix". Requests for directories serve their index.html.
+function Server:static(prefix, dfs, root)
+    return self:handle(prefix, function(req, resp)
+        if req.method ~= 'GET' and req.method ~= 'HEAD' then
+            return resp:error(405)
+        end
+        local rel = req.path:sub(#prefix + 1)
+        if rel:find('..', 1, true) then return resp:error(404) end
+        if rel == '' or rel:sub(-1) == '/' then rel = rel .. 'index.html' end
+        return resp:send_file(dfs, root .. '/' .. rel)
+    end)
+end
+
+-- Return the handler for the given path, or nil if none matches.
+function Server:_route(path)
+    for _, r in ipairs(self._routes) do
+        local prefix = r[1]
+        if path == prefix
+                or (prefix:sub(-1) == '/'
+                    and path:sub(1, #prefix) == prefix) then
+            return r[2]
+        end
+    end
+end
+
+-- Start listening for connections on the given address and port.
+function Server:listen(addr, port, backlog)
+    local sock, err = tcp.new()
+    if not sock then return sock, err end
+    local ok
+    ok, err = sock:bind(addr, port)
+    if ok then ok, err = sock:listen(backlog) end
+    if not ok then
+        sock:close()
+        return ok, err
+    end
+    self._sock = sock
+    return true
+end
+
+-- Stop the server and close all connections.
+function Server:close()
+    local sock = self._sock
+    if not sock then return end
+    self._sock = nil
+    sock:close()
+end
+
+-- Serve a request. Returns true iff the connection should be kept alive.
+function Server:_serve_request(conn, req)
+    local resp = Response(conn, req)
+    local handler = self:_route(req.path)
+    local ok, err = pcall(function()
+        if not handler then return resp:error(404) end
+        handler(req, resp)
+        return resp:finish()
+    end)
+    if not ok then
+        if resp:head_sent() then return false end
+        resp._close = true
+        pcall(resp.error, resp, 500)
+        return false
+    end
+    return not resp._close and req:_drain()
+end
+
+-- Serve the requests of a connection until it is closed or times out.
+function Server:_serve_conn(conn)
+    while true do
+        local ok, res = pcall(self._serve_available, self, conn)
+        if not (ok and res) then return end
+    end
+end
+
+function Server:_serve_available(conn)
+    local eof = not conn:fill()
+    while true do
+        local req, status = conn:parse()
+        if req == nil then return not eof end
+        if req == false then
+            local resp = Response(conn, {version = '1.1', headers = {},
+                                         method = 'GET'})
+            resp._close = true
+            pcall(resp.error, resp, status)
+            return false
+        end
+        if not self:_serve_request(conn, req) then return false end
+        conn:touch()
+    end
+end
+
+-- Serve connections until the server is closed. Each connection is served by
+-- a separate thread, and uses a receive buffer of HEADER_SIZE bytes.
+function Server:serve()
+    local sock = self._sock
+    if not sock then error("server not listening", 2) end
+    local conns, cnt = {}, 0
+    local done<close> = function()
+        for th in pairs(conns) do th:kill() end
+    end
+    while self._sock do
+        local ok, cs = pcall(sock.accept, sock, time.deadline(time.sec))
+        if not ok then
+            if not self._sock then break end
+            error(cs, 0)
+        end
+        if cs and cnt >= self.max_conns then
+            cs:close()
+        elseif cs then
+            cnt = cnt + 1
+            local th
+            th = thread.start(function()
+                local conn_sock<close> = cs
+                local done<close> = function()
+                    conns[th], cnt = nil, cnt - 1
+                end
+                self:_serve_conn(Conn(self, cs))
+            end)
+            conns[th] = true
+        end
+    end
+end
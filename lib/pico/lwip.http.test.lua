@@ -0,0 +1,145 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local lwip = require 'lwip'
+local http = require 'lwip.http'
+local ip4 = require 'lwip.ip4'
+local tcp = require 'lwip.tcp'
+local block_mem = require 'mlua.block.mem'
+local fs = require 'mlua.fs'
+local lfs = require 'mlua.fs.lfs'
+local mem = require 'mlua.mem'
+local testing_lwip = require 'mlua.testing.lwip'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local string = require 'string'
+local table = require 'table'
+
+local function write_file(dfs, path, data)
+    local f<close> = assert(dfs:open(path, fs.O_WRONLY | fs.O_CREAT))
+    assert(f:write(data))
+    assert(f:close())
+end
+
+local function checksum(data)
+    local sum = 0
+    for i = 1, #data do sum = sum + data:byte(i) end
+    return sum
+end
+
+function test_content_type(t)
+    t:expect(t.expr(http).content_type('/a/index.html'))
+        :eq('text/html; charset=utf-8')
+    t:expect(t.expr(http).content_type('/a/app.JS')):eq('text/javascript')
+    t:expect(t.expr(http).content_type('/a.b/file'))
+        :eq('application/octet-stream')
+end
+
+function test_unquote(t)
+    t:expect(t.expr(http).unquote('/a%20b%2Fc')):eq('/a b/c')
+    t:expect(t.expr(http).unquote('/a%2')):eq('/a%2')
+end
+
+-- Send a request over the loopback interface, and return the full response.
+local function request(port, req, dl)
+    local conn<close> = lwip.assert(tcp.new())
+    lwip.assert(conn:connect(ip4.LOOPBACK, port, dl))
+    lwip.assert(conn:send(req, dl))
+    local parts = {}
+    while true do
+        local data = lwip.assert(conn:recv(1024, dl))
+        if #data == 0 then break end
+        parts[#parts + 1] = data
+    end
+    return table.concat(parts)
+end
+
+function test_loopback(t)
+    local srv = http.Server()
+    srv:handle('/hello', function(req, resp)
+        resp:set_header('Content-Type', 'text/plain')
+        resp:send('Hello')
+    end)
+    srv:handle('/chunked', function(req, resp)
+        resp:write('abc')
+        resp:write('defg')
+    end)
+    local port = 1235
+    lwip.assert(srv:listen(ip4.LOOPBACK, port))
+    local server<close> = thread.start(function() srv:serve() end)
+    t:cleanup(function() srv:close() end)
+    local dl = time.deadline(5 * time.sec)
+
+    -- An idle connection must not delay the requests of other clients.
+    local idle<close> = lwip.assert(tcp.new())
+    lwip.assert(idle:connect(ip4.LOOPBACK, port, dl))
+    lwip.assert(idle:send('GET /hello HTTP/1.1\r\n', dl))
+
+    local resp = request(port, 'GET /hello HTTP/1.1\r\n'
+                               .. 'Connection: close\r\n\r\n', dl)
+    t:expect(resp:match('^HTTP/1%.1 (%d+)')):label("status"):eq('200')
+    t:expect(resp:match('\r\nContent%-Length: (%d+)\r\n'))
+        :label("Content-Length"):eq('5')
+    t:expect(resp:match('\r\n\r\n(.*)$')):label("body"):eq('Hello')
+    resp = request(port, 'GET /chunked HTTP/1.1\r\n'
+                         .. 'Connection: close\r\n\r\n', dl)
+    t:expect(resp:match('\r\n\r\n(.*)$')):label("body")
+        :eq('3\r\nabc\r\n4\r\ndefg\r\n0\r\n\r\n')
+    resp = request(port, 'GET /missing HTTP/1.1\r\n'
+                         .. 'Connection: close\r\n\r\n', dl)
+    t:expect(resp:match('^HTTP/1%.1 (%d+)')):label("status"):eq('404')
+end
+
+function test_serve(t)
+    local dev = block_mem.new(mem.alloc(32 << 10, 256, 256))
+    local dfs = lfs.new(dev)
+    t:assert(dfs:format(dev:size()))
+    t:assert(dfs:mount())
+    t:cleanup(function() assert(dfs:unmount()) end)
+    local big = string.rep('0123456789', 3 * http.BLOCK_SIZE // 10 + 7)
+    assert(dfs:mkdir('/www'))
+    write_file(dfs, '/www/index.html', '<p>Hello</p>')
+    write_file(dfs, '/www/big.txt', big)
+    write_file(dfs, '/www/app.js', 'plain')
+    write_file(dfs, '/www/app.js.gz', 'gzipped')
+
+    local srv = http.Server()
+    srv:static('/', dfs, '/www')
+    srv:handle('/chunked', function(req, resp)
+        resp:set_header('Content-Type', 'text/plain')
+        resp:write('abc')
+        resp:write('defg')
+    end)
+    srv:handle('/echo/', function(req, resp)
+        resp:send(('%s %s?%s'):format(req.method, req.path, req.query))
+    end)
+    local port = 1234
+    lwip.assert(srv:listen(nil, port))
+    local server<close> = thread.start(function() srv:serve() end)
+    t:cleanup(function() srv:close() end)
+
+    local ctrl = testing_lwip.Control(t)
+    local dl = time.deadline(5 * time.sec)
+    ctrl:send(dl, 'http %s / /big.txt /app.js /chunked /echo/a%%20b?x=1 '
+                  .. '/../x /missing\n', port)
+    for _, want in ipairs{
+        {200, '-', '<p>Hello</p>'},
+        {200, '-', big},
+        {200, 'gzip', 'gzipped'},
+        {200, '-', 'abcdefg'},
+        {200, '-', 'GET /echo/a b?x=1'},
+        {404, '-', '404 Not Found\n'},
+        {404, '-', '404 Not Found\n'},
+    } do
+        local status, enc, body = table.unpack(want)
+        local line = ctrl:recv(dl)
+        local gstatus, genc, glen, gsum =
+            line:match('^RESP (%d+) (%S+) (%d+) (%d+)\n$')
+        t:expect(tonumber(gstatus)):label("status"):eq(status)
+        t:expect(genc):label("encoding"):eq(enc)
+        t:expect(tonumber(glen)):label("length"):eq(#body)
+        t:expect(tonumber(gsum)):label("checksum"):eq(checksum(body))
+    end
+end
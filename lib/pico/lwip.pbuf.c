@@ -1,14 +1,18 @@
 // Copyright 2024 Remy Blank <remy@c-space.org>
 // SPDX-License-Identifier: MIT
 
+#include <stdbool.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "lwip/pbuf.h"
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/int64.h"
 #include "mlua/lwip.h"
 #include "mlua/module.h"
+#include "mlua/thread.h"
 #include "mlua/util.h"
 
 char const mlua_PBUF_name[] = "lwip.PBUF";
@@ -109,6 +113,168 @@ MLUA_SYMBOLS_NOHASH(PBUF_syms_nh) = {
     MLUA_SYM_F_NH(__buffer, PBUF_),
 };
 
+static char const Pool_name[] = "lwip.PBUFPool";
+
+// A slot of a pool, holding a custom pbuf whose payload memory is reused.
+typedef struct PoolSlot {
+    struct pbuf_custom pc;
+    struct PoolSlot* next;
+    struct PoolData* pool;
+    u8_t* mem;
+} PoolSlot;
+
+// The data of a pool. It is allocated outside of the Lua heap, because the
+// pbufs handed out by the pool can outlive it, e.g. in an lwIP send queue. The
+// pool is protected by the lwIP lock.
+typedef struct PoolData {
+    MLuaEvent event;
+    PoolSlot* free;
+    pbuf_layer layer;
+    u16_t size;
+    u16_t mem_size;
+    u16_t count;
+    u16_t used;
+    bool closed;
+    PoolSlot slots[];
+} PoolData;
+
+typedef struct Pool {
+    PoolData* data;
+} Pool;
+
+// Return a pbuf to its pool. This is called with the lwIP lock held, when the
+// reference count of the pbuf drops to zero.
+static void pool_free_pbuf(struct pbuf* p) {
+    PoolSlot* slot = (PoolSlot*)p;
+    PoolData* pd = slot->pool;
+    slot->next = pd->free;
+    pd->free = slot;
+    --pd->used;
+    if (!pd->closed) {
+        mlua_event_set(&pd->event);
+    } else if (pd->used == 0) {
+        mlua_event_disable_abandoned(&pd->event);
+        free(pd);
+    }
+}
+
+static inline Pool* check_Pool(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Pool_name);
+}
+
+static PoolData* check_open_Pool(lua_State* ls, int arg) {
+    PoolData* pd = check_Pool(ls, arg)->data;
+    luaL_argcheck(ls, pd != NULL, arg, "closed pool");
+    return pd;
+}
+
+// Stack: (pool, len, deadline, pbuf).
+static int acquire_loop(lua_State* ls, bool timeout) {
+    PoolData* pd = check_open_Pool(ls, 1);
+    u16_t len = lua_tointeger(ls, 2);
+    mlua_lwip_lock();
+    PoolSlot* slot = pd->free;
+    if (slot != NULL) {
+        pd->free = slot->next;
+        ++pd->used;
+        *(struct pbuf**)lua_touserdata(ls, 4) = pbuf_alloced_custom(
+            pd->layer, len, PBUF_RAM, &slot->pc, slot->mem, pd->mem_size);
+    }
+    mlua_lwip_unlock();
+    if (slot != NULL) return 1;
+    if (timeout) return mlua_lwip_push_err(ls, ERR_TIMEOUT);
+    return -1;
+}
+
+static int Pool_acquire(lua_State* ls) {
+    PoolData* pd = check_open_Pool(ls, 1);
+    lua_Integer len = luaL_optinteger(ls, 2, pd->size);
+    luaL_argcheck(ls, 0 <= len && len <= pd->size, 2, "out of bounds");
+    lua_settop(ls, 3);  // Ensure deadline is set
+    lua_pushinteger(ls, len);
+    lua_replace(ls, 2);
+    mlua_new_PBUF(ls);
+    return mlua_event_wait(ls, &pd->event, 0, &acquire_loop, 3);
+}
+
+static int Pool_available(lua_State* ls) {
+    PoolData* pd = check_Pool(ls, 1)->data;
+    if (pd == NULL) return lua_pushinteger(ls, 0), 1;
+    mlua_lwip_lock();
+    lua_Integer avail = pd->count - pd->used;
+    mlua_lwip_unlock();
+    return lua_pushinteger(ls, avail), 1;
+}
+
+static int Pool_close(lua_State* ls) {
+    Pool* pool = check_Pool(ls, 1);
+    PoolData* pd = pool->data;
+    if (pd == NULL) return 0;
+    pool->data = NULL;
+    mlua_lwip_lock();
+    bool used = pd->used > 0;
+    pd->closed = true;
+    if (used) mlua_event_abandon(ls, &pd->event);
+    mlua_lwip_unlock();
+    if (!used) {
+        mlua_event_disable(ls, &pd->event);
+        free(pd);
+    }
+    return 0;
+}
+
+MLUA_SYMBOLS(Pool_syms) = {
+    MLUA_SYM_F(acquire, Pool_),
+    MLUA_SYM_F(available, Pool_),
+    MLUA_SYM_F(close, Pool_),
+};
+
+#define Pool___close Pool_close
+#define Pool___gc Pool_close
+
+MLUA_SYMBOLS_NOHASH(Pool_syms_nh) = {
+    MLUA_SYM_F_NH(__close, Pool_),
+    MLUA_SYM_F_NH(__gc, Pool_),
+};
+
+static int mod_pool(lua_State* ls) {
+    lua_Integer size = luaL_checkinteger(ls, 1);
+    lua_Integer count = luaL_checkinteger(ls, 2);
+    pbuf_layer layer = luaL_optinteger(ls, 3, PBUF_TRANSPORT);
+    luaL_argcheck(ls, 0 <= size && size <= 0xffff, 1, "out of bounds");
+    size_t mem_size = LWIP_MEM_ALIGN_SIZE(layer) + LWIP_MEM_ALIGN_SIZE(size);
+    luaL_argcheck(ls, mem_size <= 0xffff, 1, "out of bounds");
+    luaL_argcheck(ls, 0 < count && count <= 0xffff, 2, "out of bounds");
+    Pool* pool = lua_newuserdatauv(ls, sizeof(Pool), 0);
+    pool->data = NULL;
+    luaL_getmetatable(ls, Pool_name);
+    lua_setmetatable(ls, -2);
+    size_t slots_size = LWIP_MEM_ALIGN_SIZE(
+        sizeof(PoolData) + count * sizeof(PoolSlot));
+    PoolData* pd = malloc(slots_size + count * mem_size);
+    if (pd == NULL) return mlua_lwip_push_err(ls, ERR_MEM);
+    mlua_event_init(&pd->event);
+    pd->free = NULL;
+    pd->layer = layer;
+    pd->size = size;
+    pd->mem_size = mem_size;
+    pd->count = count;
+    pd->used = 0;
+    pd->closed = false;
+    u8_t* mem = (u8_t*)pd + slots_size;
+    for (lua_Integer i = count - 1; i >= 0; --i) {
+        PoolSlot* slot = &pd->slots[i];
+        slot->pc.custom_free_function = &pool_free_pbuf;
+        slot->pool = pd;
+        slot->mem = mem + i * mem_size;
+        slot->next = pd->free;
+        pd->free = slot;
+    }
+    pool->data = pd;
+    mlua_event_enable(ls, &pd->event);
+    return 1;
+}
+
 static int mod_alloc(lua_State* ls) {
     pbuf_layer layer = luaL_checkinteger(ls, 1);
     u16_t size = luaL_checkinteger(ls, 2);
@@ -133,9 +299,12 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(POOL, integer, PBUF_POOL),
 
     MLUA_SYM_F(alloc, mod_),
+    MLUA_SYM_F(pool, mod_),
 };
 
 MLUA_OPEN_MODULE(lwip.pbuf) {
+    mlua_thread_require(ls);
+    mlua_require(ls, "mlua.int64", false);
     mlua_require(ls, "lwip", false);
 
     // Create the module.
@@ -144,5 +313,9 @@ MLUA_OPEN_MODULE(lwip.pbuf) {
     // Create the PBUF class.
     mlua_new_class(ls, mlua_PBUF_name, PBUF_syms, PBUF_syms_nh);
     lua_pop(ls, 1);
+
+    // Create the PBUFPool class.
+    mlua_new_class(ls, Pool_name, Pool_syms, Pool_syms_nh);
+    lua_pop(ls, 1);
     return 1;
 }
@@ -3,8 +3,11 @@
 
 _ENV = module(...)
 
+local lwip = require 'lwip'
 local pbuf = require 'lwip.pbuf'
 local mem = require 'mlua.mem'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
 
 function test_PBUF(t)
     local p<close> = pbuf.alloc(pbuf.TRANSPORT, 10)
@@ -14,3 +17,38 @@ function test_PBUF(t)
     mem.write(p, 'abc', 5)
     t:expect(t.expr(mem).read(p)):eq('_____abc__')
 end
+
+function test_pool(t)
+    local pool<close> = pbuf.pool(16, 2)
+    t:expect(t.expr(pool):available()):eq(2)
+    local p1 = pool:acquire()
+    t:expect(#p1):label("#p1"):eq(16)
+    mem.write(p1, 'abc')
+    t:expect(t.expr(mem).read(p1, 0, 3)):eq('abc')
+    local p2 = pool:acquire(4)
+    t:expect(#p2):label("#p2"):eq(4)
+    t:expect(t.expr(pool):available()):eq(0)
+    local p, err = pool:acquire(nil, time.ticks())
+    t:expect(p):label("p"):eq(nil)
+    t:expect(err):label("err"):eq(lwip.ERR_TIMEOUT)
+    t:expect(t.expr(pool).acquire(pool, 17)):raises("out of bounds")
+
+    -- Releasing a pbuf wakes up a waiting thread.
+    local got
+    local waiter<close> = thread.start(function() got = pool:acquire() end)
+    thread.yield()
+    t:expect(got):label("got"):eq(nil)
+    p1:free()
+    waiter:join()
+    t:expect(#got):label("#got"):eq(16)
+    t:expect(t.expr(pool):available()):eq(0)
+    got:free()
+    p2:free()
+    t:expect(t.expr(pool):available()):eq(2)
+
+    -- A pbuf can outlive its pool.
+    local p3 = pool:acquire()
+    pool:close()
+    t:expect(t.expr(pool):available()):eq(0)
+    p3:free()
+end
@@ -3,11 +3,20 @@
 
 #include <stdbool.h>
 
+#include "lwip/memp.h"
 #include "lwip/stats.h"
 
 #include "mlua/lwip.h"
 #include "mlua/module.h"
 
+#if LWIP_PROFILE == LWIP_PROFILE_LOW_MEMORY
+#define PROFILE_NAME "low_memory"
+#elif LWIP_PROFILE == LWIP_PROFILE_BALANCED
+#define PROFILE_NAME "balanced"
+#elif LWIP_PROFILE == LWIP_PROFILE_HIGH_THROUGHPUT
+#define PROFILE_NAME "high_throughput"
+#endif
+
 #define SET_FIELD(subsys, name) \
     lua_pushinteger(ls, lwip_stats.subsys name); \
     lua_setfield(ls, -2, #name)
@@ -164,6 +173,66 @@ int mod_memp_reset(lua_State* ls) {
     return 0;
 }
 
+int mod_dns_cache(lua_State* ls) {
+    lua_createtable(ls, 0, 4);
+    mlua_lwip_lock();
+    MLuaLwipDnsCacheStats st = mlua_lwip_dns_cache_stats;
+    mlua_lwip_unlock();
+    lua_pushinteger(ls, st.hits);
+    lua_setfield(ls, -2, "hits");
+    lua_pushinteger(ls, st.neg_hits);
+    lua_setfield(ls, -2, "neg_hits");
+    lua_pushinteger(ls, st.misses);
+    lua_setfield(ls, -2, "misses");
+    lua_pushinteger(ls, st.evictions);
+    lua_setfield(ls, -2, "evictions");
+    return 1;
+}
+
+int mod_dns_cache_reset(lua_State* ls) {
+    mlua_lwip_lock();
+    mlua_lwip_dns_cache_stats = (MLuaLwipDnsCacheStats){0};
+    mlua_lwip_unlock();
+    return 0;
+}
+
+#if MEM_STATS || MEMP_STATS
+#if MEMP_STATS
+// The names of the memory pools, in the order of memp_t.
+static char const* const memp_names[] = {
+#define LWIP_MEMPOOL(name, num, size, desc) #name,
+#include "lwip/priv/memp_std.h"
+};
+#endif
+
+static void set_high_water(lua_State* ls, char const* name,
+                           struct stats_mem const* st) {
+    lua_createtable(ls, 0, 3);
+    lua_pushinteger(ls, st->max);
+    lua_setfield(ls, -2, "max");
+    lua_pushinteger(ls, st->avail);
+    lua_setfield(ls, -2, "avail");
+    lua_pushinteger(ls, st->err);
+    lua_setfield(ls, -2, "err");
+    lua_setfield(ls, -2, name);
+}
+
+int mod_high_water(lua_State* ls) {
+    lua_createtable(ls, 0, MEMP_MAX + 1);
+    mlua_lwip_lock();
+#if MEM_STATS
+    set_high_water(ls, "HEAP", &lwip_stats.mem);
+#endif
+#if MEMP_STATS
+    for (int i = 0; i < MEMP_MAX; ++i) {
+        set_high_water(ls, memp_names[i], lwip_stats.memp[i]);
+    }
+#endif
+    mlua_lwip_unlock();
+    return 1;
+}
+#endif
+
 #if IP6_STATS
 MOD_PROTO_STATS(ip6)
 #endif
@@ -244,6 +313,7 @@ int mod_mib2(lua_State* ls) {
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(COUNTER_MAX, integer, (STAT_COUNTER)-1),
     MLUA_SYM_V(MEMP_COUNT, integer, MEMP_MAX),
+    MLUA_SYM_V(PROFILE, string, PROFILE_NAME),
     MLUA_SYM_P(SUBSYSTEMS, mod_),
 
 #if LINK_STATS
@@ -298,6 +368,13 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(memp, boolean, false),
 #endif
     MLUA_SYM_F(memp_reset, mod_),
+#if MEM_STATS || MEMP_STATS
+    MLUA_SYM_F(high_water, mod_),
+#else
+    MLUA_SYM_V(high_water, boolean, false),
+#endif
+    MLUA_SYM_F(dns_cache, mod_),
+    MLUA_SYM_F(dns_cache_reset, mod_),
 #if IP6_STATS
     MLUA_SYM_F(ip6, mod_),
 #else
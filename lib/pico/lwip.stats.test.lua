@@ -38,6 +38,29 @@ function test_mem_stats(t)
     end
 end
 
+function test_dns_cache_stats(t)
+    t:expect(t.expr(stats).dns_cache()):has('hits'):has('neg_hits')
+        :has('misses'):has('evictions')
+end
+
+function test_high_water(t)
+    t:expect(t.expr(stats).PROFILE)
+        :eq_one_of{'low_memory', 'balanced', 'high_throughput'}
+    local fn = stats.high_water
+    if fn == false then return end
+    local hw = fn()
+    if stats.mem ~= false then
+        t:expect(hw):label("high_water"):has('HEAP')
+        t:expect(hw.HEAP):label("HEAP"):has('max'):has('avail'):has('err')
+    end
+    if stats.memp ~= false then
+        t:expect(hw):label("high_water"):has('PBUF_POOL')
+        local pool = hw.PBUF_POOL
+        t:expect(pool.max <= pool.avail, "PBUF_POOL: max %s > avail %s",
+                 pool.max, pool.avail)
+    end
+end
+
 function test_mib2_stats(t)
     t:expect(t.expr(stats).SUBSYSTEMS):has('mib2')
     local fn = stats.mib2
@@ -0,0 +1,53 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local lwip = require 'lwip'
+local ip4 = require 'lwip.ip4'
+local tcp = require 'lwip.tcp'
+local mem = require 'mlua.mem'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local cyw43 = require 'pico.cyw43'
+
+local module_name = ...
+local size = 1 << 10
+
+function set_up(t)
+    t:once(module_name .. '|cyw43', function()
+        t:assert(cyw43.init(), "Failed to initialize CYW43")
+    end)
+    t:once(module_name .. '|lwip', function()
+        t:assert(lwip.init(), "Failed to initialize lwIP")
+    end)
+end
+
+-- Open a connection over the loopback interface. The server is bound to an
+-- ephemeral port, as the connections of previous rounds may still be in
+-- TIME_WAIT.
+local function connect(dl)
+    local srv<close> = lwip.assert(tcp.new())
+    lwip.assert(srv:bind(ip4.LOOPBACK, 0))
+    lwip.assert(srv:listen(1))
+    local client = lwip.assert(tcp.new())
+    lwip.assert(client:connect(ip4.LOOPBACK, srv:local_port(), dl))
+    return client, lwip.assert(srv:accept(dl))
+end
+
+-- Measure the throughput of a TCP connection over the loopback interface.
+function bench_loopback(b)
+    local dl = time.deadline(10 * time.sec)
+    local client<close>, server<close> = connect(dl)
+    local data = ('0123456789abcdef'):rep(size // 16)
+    local total = b.n * size
+    local receiver<close> = thread.start(function()
+        local buf, got = mem.alloc(size), 0
+        while got < total do
+            got = got + lwip.assert(server:recv_into(buf, 0, size, dl))
+        end
+    end)
+    b:bytes(size)
+    b:reset()
+    for i = 1, b.n do lwip.assert(client:send(data)) end
+end
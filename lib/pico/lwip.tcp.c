@@ -1,6 +1,7 @@
 // Copyright 2024 Remy Blank <remy@c-space.org>
 // SPDX-License-Identifier: MIT
 
+#include <limits.h>
 #include <stdbool.h>
 #include <string.h>
 
@@ -18,6 +19,24 @@
 
 static char const TCP_name[] = "lwip.TCP";
 
+// Per-connection statistics. The fields updated by lwIP callbacks are
+// protected by the lwIP lock.
+typedef struct TCPStats {
+    uint64_t bytes_in;  // The number of bytes received
+    uint32_t segs_in;  // The number of pbuf chains received
+    uint32_t rexmits;  // The number of retransmissions observed
+    uint32_t recv_queued;  // The number of bytes in the receive queue
+    uint32_t recv_queued_max;  // The high-water mark of recv_queued
+    uint64_t recv_time;  // When data arrived into an empty receive queue
+    uint64_t recv_latency;  // Total time from data arrival to read
+    uint64_t recv_latency_max;  // Maximum time from data arrival to read
+    uint32_t recv_delays;  // The number of samples in recv_latency
+    uint32_t send_waits;  // The number of times send() waited for sndbuf
+    uint64_t send_wait_start;  // When send() started waiting for sndbuf
+    uint64_t send_blocked;  // Total time send() waited for sndbuf
+    u8_t nrtx;  // The last observed value of pcb->nrtx
+} TCPStats;
+
 typedef struct TCP {
     struct tcp_pcb* pcb;
     MLuaEvent recv_event;
@@ -37,6 +56,11 @@ typedef struct TCP {
         };
     };
     u16_t recv_off;
+    u32_t queued;  // The number of bytes written to the send queue
+    u32_t acked;  // The number of bytes acknowledged by the remote end
+    TCPStats stats;
+    lua_Integer pin_head;  // The first pinned value
+    lua_Integer pin_tail;  // The end of the pinned values
     err_t err;
     bool listening: 1;
     bool connected: 1;
@@ -52,6 +76,17 @@ static void handle_err(void* arg, err_t err) {
     mlua_event_set(&tcp->send_event);
 }
 
+// Account for the retransmissions of the oldest unacknowledged segment since
+// the last call. lwIP doesn't count retransmissions per PCB, so this samples
+// pcb->nrtx, which is reset when the segment is acknowledged. Must be called
+// with the lwIP lock held.
+static void sample_rexmits(TCP* tcp) {
+    if (tcp->pcb == NULL || tcp->listening) return;
+    u8_t nrtx = tcp->pcb->nrtx;
+    if (nrtx > tcp->stats.nrtx) tcp->stats.rexmits += nrtx - tcp->stats.nrtx;
+    tcp->stats.nrtx = nrtx;
+}
+
 static err_t handle_recv(void*, struct tcp_pcb*, struct pbuf*, err_t);
 static err_t handle_sent(void*, struct tcp_pcb*, u16_t);
 static err_t handle_poll(void*, struct tcp_pcb*);
@@ -65,7 +100,7 @@ static void set_handlers(struct tcp_pcb* pcb, void* arg) {
 }
 
 static TCP* new_TCP(lua_State* ls) {
-    TCP* tcp = lua_newuserdatauv(ls, sizeof(TCP), 0);
+    TCP* tcp = lua_newuserdatauv(ls, sizeof(TCP), 1);
     memset(tcp, 0, sizeof(*tcp));
     luaL_getmetatable(ls, TCP_name);
     lua_setmetatable(ls, -2);
@@ -94,6 +129,48 @@ static TCP* check_conn_TCP(lua_State* ls, int arg) {
     return tcp;
 }
 
+// Pin the value at index arg, which is referenced by the send queue without
+// copying, until "end" bytes have been acknowledged. The pinned values are
+// stored as (value, end) pairs in the first user value of the TCP at index 1.
+static void pin_value(lua_State* ls, TCP* tcp, int arg, u32_t end) {
+    if (lua_getiuservalue(ls, 1, 1) == LUA_TNIL) {
+        lua_pop(ls, 1);
+        lua_createtable(ls, 2, 0);
+        lua_pushvalue(ls, -1);
+        lua_setiuservalue(ls, 1, 1);
+    }
+    lua_pushvalue(ls, arg);
+    lua_rawseti(ls, -2, 2 * tcp->pin_tail + 1);
+    lua_pushinteger(ls, end);
+    lua_rawseti(ls, -2, 2 * tcp->pin_tail + 2);
+    ++tcp->pin_tail;
+    lua_pop(ls, 1);
+}
+
+// Release the pinned values that are not referenced by the send queue anymore.
+// The TCP must be at index 1.
+static void release_pins(lua_State* ls, TCP* tcp) {
+    if (tcp->pin_head == tcp->pin_tail) return;
+    mlua_lwip_lock();
+    u32_t acked = tcp->acked;
+    bool freed = tcp->pcb == NULL;  // The send queue has been freed
+    mlua_lwip_unlock();
+    lua_getiuservalue(ls, 1, 1);
+    for (; tcp->pin_head < tcp->pin_tail; ++tcp->pin_head) {
+        lua_Integer i = 2 * tcp->pin_head;
+        lua_rawgeti(ls, -1, i + 2);
+        u32_t end = lua_tointeger(ls, -1);
+        lua_pop(ls, 1);
+        if (!freed && (int32_t)(acked - end) < 0) break;
+        lua_pushnil(ls);
+        lua_rawseti(ls, -2, i + 1);
+        lua_pushnil(ls);
+        lua_rawseti(ls, -2, i + 2);
+    }
+    lua_pop(ls, 1);
+    if (tcp->pin_head == tcp->pin_tail) tcp->pin_head = tcp->pin_tail = 0;
+}
+
 #define lock_and_check_error(ls, tcp) do { \
     mlua_lwip_lock(); \
     err_t err = (tcp)->err; \
@@ -105,12 +182,19 @@ static TCP* check_conn_TCP(lua_State* ls, int arg) {
 
 static int TCP_close(lua_State* ls) {
     TCP* tcp = check_TCP(ls, 1);
+    release_pins(ls, tcp);
     mlua_lwip_lock();
     err_t err = tcp->err;
     if (err == ERR_OK) {
         tcp_arg(tcp->pcb, NULL);
-        // Closing never fails <https://savannah.nongnu.org/bugs/?60757>.
-        err = tcp_close(tcp->pcb);
+        if (tcp->pin_head != tcp->pin_tail) {
+            // The send queue references pinned values, which will become
+            // unreachable. Abort the connection to free the queue.
+            tcp_abort(tcp->pcb);
+        } else {
+            // Closing never fails <https://savannah.nongnu.org/bugs/?60757>.
+            err = tcp_close(tcp->pcb);
+        }
         tcp->err = ERR_CLSD;
         tcp->pcb = NULL;
     }
@@ -125,8 +209,10 @@ static int TCP_close(lua_State* ls) {
             p = pbuf_free_header(p, p->len);
         }
         tcp->recv_head = tcp->recv_tail = NULL;
+        tcp->stats.recv_queued = 0;
     }
     mlua_lwip_unlock();
+    release_pins(ls, tcp);
     mlua_event_disable(ls, &tcp->recv_event);
     mlua_event_disable(ls, &tcp->send_event);
     return mlua_lwip_push_result(ls, err);
@@ -242,6 +328,7 @@ static err_t handle_connected(void* arg, struct tcp_pcb* pcb, err_t err) {
     }
     tcp->connected = true;
     mlua_event_set(&tcp->recv_event);
+    mlua_event_set(&tcp->send_event);
     return ERR_OK;
 }
 
@@ -285,6 +372,8 @@ static int TCP_connect(lua_State* ls) {
 static err_t handle_sent(void* arg, struct tcp_pcb* pcb, u16_t len) {
     if (arg == NULL || arg == TCP_name) return tcp_abort(pcb), ERR_ABRT;
     TCP* tcp = arg;
+    tcp->acked += len;
+    tcp->stats.nrtx = 0;  // The retransmitted segment has been acknowledged
     mlua_event_set(&tcp->send_event);
     return ERR_OK;
 }
@@ -297,31 +386,50 @@ static err_t handle_poll(void* arg, struct tcp_pcb* pcb) {
         return ERR_OK;
     }
     TCP* tcp = arg;
+    sample_rexmits(tcp);
     mlua_event_set(&tcp->send_event);
     return ERR_OK;
 }
 
+// Account for the time spent waiting for room in the send buffer, if any.
+static void send_unblocked(TCP* tcp) {
+    uint64_t start = tcp->stats.send_wait_start;
+    if (start == 0) return;
+    tcp->stats.send_blocked += mlua_ticks64() - start;
+    tcp->stats.send_wait_start = 0;
+}
+
+// Send flags.
+#define SEND_MORE (1u << 0)
+#define SEND_NOCOPY (1u << 1)
+#define SEND_FLUSH (1u << 2)
+
+// Stack: (tcp, data, ..., deadline, flags, index, offset).
 static int send_loop(lua_State* ls, bool timeout) {
     TCP* tcp = to_TCP(ls, 1);
+    uint32_t flags = lua_tointeger(ls, -3);
     int index = lua_tointeger(ls, -2);
     lua_Unsigned offset = lua_tointeger(ls, -1);
-    int last = lua_gettop(ls) - 3;
+    int last = lua_gettop(ls) - 4;
+    u8_t wflags = (flags & SEND_NOCOPY) ? 0 : TCP_WRITE_FLAG_COPY;
     while (index <= last) {
         MLuaBuffer buf;
         if (!mlua_get_ro_buffer(ls, index, &buf) || buf.vt != NULL) {
             return luaL_typeerror(ls, index, "string or raw buffer");
         }
+        bool more = index < last || (flags & SEND_MORE);
         while (offset < buf.size) {
             lock_and_check_error(ls, tcp);
             u16_t sz = tcp_sndbuf(tcp->pcb);
-            if (sz > buf.size) sz = buf.size;
+            if (sz > buf.size - offset) sz = buf.size - offset;
+            if (sz > 0) send_unblocked(tcp);
             if (sz > 0) {
                 err_t err = tcp_write(
                     tcp->pcb, buf.ptr + offset, sz,
-                    TCP_WRITE_FLAG_COPY
-                    | (index < last ? TCP_WRITE_FLAG_MORE : 0));
+                    wflags | (more ? TCP_WRITE_FLAG_MORE : 0));
                 if (err == ERR_OK) {  // Data written, update pointers
                     offset += sz;
+                    tcp->queued += sz;
                 } else if (err == ERR_MEM) {  // No room
                     sz = 0;
                 } else {  // Write failed, abort
@@ -329,8 +437,27 @@ static int send_loop(lua_State* ls, bool timeout) {
                     return mlua_lwip_push_err(ls, err);
                 }
             }
+            u32_t queued = tcp->queued;
             mlua_lwip_unlock();
+            if (sz > 0 && (flags & SEND_NOCOPY)) {
+                pin_value(ls, tcp, index, queued);
+            }
             if (sz == 0) {  // Nothing written, wait for event
+                if (tcp->stats.send_wait_start == 0) {
+                    tcp->stats.send_wait_start = mlua_ticks64();
+                    ++tcp->stats.send_waits;
+                }
+                if (flags & SEND_NOCOPY) {
+                    // Push what has been written, to get acknowledgements.
+                    lock_and_check_error(ls, tcp);
+                    tcp_output(tcp->pcb);
+                    mlua_lwip_unlock();
+                    release_pins(ls, tcp);
+                }
+                if (timeout) {
+                    send_unblocked(tcp);
+                    return mlua_lwip_push_err(ls, ERR_TIMEOUT);
+                }
                 lua_pop(ls, 2);
                 lua_pushinteger(ls, index);
                 lua_pushinteger(ls, offset);
@@ -340,21 +467,62 @@ static int send_loop(lua_State* ls, bool timeout) {
         ++index;
         offset = 0;
     }
-    // TODO: Make the call to tcp_output() optional?
+    // Data written without copying remains pinned until it is acknowledged.
     lock_and_check_error(ls, tcp);
-    err_t err = tcp_output(tcp->pcb);
+    err_t err = (flags & SEND_FLUSH) ? tcp_output(tcp->pcb) : ERR_OK;
     mlua_lwip_unlock();
-    return mlua_lwip_push_result(ls, err);
+    if (err != ERR_OK) return mlua_lwip_push_err(ls, err);
+    return lua_pushboolean(ls, true), 1;
 }
 
 static int TCP_send(lua_State* ls) {
     TCP* tcp = check_conn_TCP(ls, 1);
-    // TODO: Support WRITE_FLAG_MORE
-    // TODO: Support !WRITE_FLAG_COPY by waiting for "sent"
     if (!mlua_is_time(ls, -1)) lua_pushnil(ls);  // deadline
+    uint32_t flags = SEND_FLUSH;
+    if (lua_gettop(ls) > 2 && lua_isnil(ls, -2)) {
+        lua_remove(ls, -2);  // Absent opts
+    } else if (lua_gettop(ls) > 2 && lua_istable(ls, -2)) {
+        int opts = lua_absindex(ls, -2);
+        lua_getfield(ls, opts, "more");
+        lua_getfield(ls, opts, "nocopy");
+        lua_getfield(ls, opts, "flush");
+        bool more = mlua_to_cbool(ls, -3);
+        bool nocopy = mlua_to_cbool(ls, -2);
+        // Data written without copying must be pushed to be acknowledged.
+        bool flush = nocopy
+                     || (lua_isnil(ls, -1) ? !more : mlua_to_cbool(ls, -1));
+        lua_pop(ls, 3);
+        lua_remove(ls, opts);
+        flags = (more ? SEND_MORE : 0) | (nocopy ? SEND_NOCOPY : 0)
+                | (flush ? SEND_FLUSH : 0);
+    }
+    release_pins(ls, tcp);
+    tcp->stats.send_wait_start = 0;  // Discard waits of failed sends
+    lua_pushinteger(ls, flags);
     lua_pushinteger(ls, 2);  // index
     lua_pushinteger(ls, 0);  // offset
-    return mlua_event_wait(ls, &tcp->send_event, 0, &send_loop, -3);
+    return mlua_event_wait(ls, &tcp->send_event, 0, &send_loop, -4);
+}
+
+static int TCP_sendv(lua_State* ls) {
+    check_conn_TCP(ls, 1);
+    luaL_checktype(ls, 2, LUA_TTABLE);
+    lua_Unsigned n = lua_rawlen(ls, 2);
+    luaL_argcheck(ls, n <= INT_MAX - lua_gettop(ls), 2, "too many values");
+    luaL_checkstack(ls, n, "too many values");
+    for (lua_Unsigned i = 1; i <= n; ++i) lua_rawgeti(ls, 2, i);
+    lua_rotate(ls, 3, n);
+    lua_remove(ls, 2);
+    return TCP_send(ls);
+}
+
+static int TCP_flush(lua_State* ls) {
+    TCP* tcp = check_conn_TCP(ls, 1);
+    release_pins(ls, tcp);
+    lock_and_check_error(ls, tcp);
+    err_t err = tcp_output(tcp->pcb);
+    mlua_lwip_unlock();
+    return mlua_lwip_push_result(ls, err);
 }
 
 static err_t handle_recv(void* arg, struct tcp_pcb* pcb, struct pbuf* p,
@@ -373,6 +541,15 @@ static err_t handle_recv(void* arg, struct tcp_pcb* pcb, struct pbuf* p,
             pbuf_free(p);
             return ERR_OK;
         }
+        TCPStats* st = &tcp->stats;
+        st->bytes_in += p->tot_len;
+        ++st->segs_in;
+        if (st->recv_queued == 0) st->recv_time = mlua_ticks64();
+        st->recv_queued += p->tot_len;
+        if (st->recv_queued > st->recv_queued_max) {
+            st->recv_queued_max = st->recv_queued;
+        }
+        sample_rexmits(tcp);
         struct pbuf* t = tcp->recv_tail;
         if (t != NULL) t->next = p; else tcp->recv_head = p;
         while (p->next != NULL) p = p->next;
@@ -388,40 +565,72 @@ static err_t handle_recv(void* arg, struct tcp_pcb* pcb, struct pbuf* p,
     return ERR_OK;
 }
 
+// Account for sz bytes having been read from the receive queue. Must be called
+// with the lwIP lock held.
+static void recv_account(TCP* tcp, u32_t sz) {
+    TCPStats* st = &tcp->stats;
+    st->recv_queued -= sz;
+    if (st->recv_time == 0) return;
+    uint64_t latency = mlua_ticks64() - st->recv_time;
+    st->recv_latency += latency;
+    if (latency > st->recv_latency_max) st->recv_latency_max = latency;
+    ++st->recv_delays;
+    st->recv_time = 0;  // Sample again once the queue has been drained
+}
+
+// Remove sz bytes from the head of the receive queue, and acknowledge them.
+// sz must not exceed the remaining length of the head pbuf. Must be called with
+// the lwIP lock held.
+static void recv_consume(TCP* tcp, u16_t sz) {
+    recv_account(tcp, sz);
+    struct pbuf* h = tcp->recv_head;
+    if (tcp->recv_off + sz == h->len) {
+        h = pbuf_free_header(h, h->len);
+        tcp->recv_head = h;
+        if (h == NULL) tcp->recv_tail = NULL;
+        tcp->recv_off = 0;
+        mlua_event_set(&tcp->send_event);
+    } else {
+        tcp->recv_off += sz;
+    }
+    if (tcp->pcb != NULL) tcp_recved(tcp->pcb, sz);
+}
+
+// Release the lwIP lock, and push the result of a receive loop that didn't
+// receive any data. Returns 0 at the end of the stream, without pushing
+// anything.
+static int recv_none(lua_State* ls, TCP* tcp, bool timeout) {
+    err_t err = tcp->err;
+    bool rx_closed = tcp->rx_closed;
+    mlua_lwip_unlock();
+    if (rx_closed) return 0;
+    if (err != ERR_OK) return mlua_lwip_push_err(ls, err);
+    if (timeout) return mlua_lwip_push_err(ls, ERR_TIMEOUT);
+    return -1;
+}
+
 static int recv_loop(lua_State* ls, bool timeout) {
     TCP* tcp = to_TCP(ls, 1);
     lua_Integer len = lua_tointeger(ls, 2);
     luaL_Buffer buf = {.n = 0};
     mlua_lwip_lock();  // Report error after data
-    struct pbuf* h = tcp->recv_head;
-    u16_t off = tcp->recv_off;
-    while (h != NULL && len > 0) {
+    while (tcp->recv_head != NULL && len > 0) {
         if (luaL_bufflen(&buf) == 0) luaL_buffinit(ls, &buf);
-        u16_t sz = h->len - off;
+        struct pbuf* h = tcp->recv_head;
+        u16_t sz = h->len - tcp->recv_off;
         if (len < sz) sz = len;
-        pbuf_copy_partial(h, luaL_prepbuffsize(&buf, sz), sz, off);
+        pbuf_copy_partial(h, luaL_prepbuffsize(&buf, sz), sz, tcp->recv_off);
         luaL_addsize(&buf, sz);
         len -= sz;
-        if (off + sz == h->len) {
-            h = pbuf_free_header(h, h->len);
-            off = 0;
-            mlua_event_set(&tcp->send_event);
-        } else {
-            off += sz;
-        }
-        if (tcp->pcb != NULL) tcp_recved(tcp->pcb, sz);
+        recv_consume(tcp, sz);
     }
-    tcp->recv_head = h;
-    if (h == NULL) tcp->recv_tail = NULL;
-    tcp->recv_off = off;
-    err_t err = tcp->err;
-    bool rx_closed = tcp->rx_closed;
-    mlua_lwip_unlock();
-    if (luaL_bufflen(&buf) > 0) return luaL_pushresult(&buf), 1;
-    if (rx_closed) return lua_pushliteral(ls, ""), 1;
-    if (err != ERR_OK) return mlua_lwip_push_err(ls, err);
-    if (timeout) return mlua_lwip_push_err(ls, ERR_TIMEOUT);
-    return -1;
+    if (luaL_bufflen(&buf) > 0) {
+        mlua_lwip_unlock();
+        return luaL_pushresult(&buf), 1;
+    }
+    int res = recv_none(ls, tcp, timeout);
+    if (res == 0) return lua_pushliteral(ls, ""), 1;
+    return res;
 }
 
 static int TCP_recv(lua_State* ls) {
@@ -432,6 +641,88 @@ static int TCP_recv(lua_State* ls) {
     return mlua_event_wait(ls, &tcp->recv_event, 0, &recv_loop, 3);
 }
 
+// Stack: (tcp, buf, off, len, deadline).
+static int recv_into_loop(lua_State* ls, bool timeout) {
+    TCP* tcp = to_TCP(ls, 1);
+    MLuaBuffer buf;
+    mlua_get_buffer(ls, 2, &buf);
+    lua_Unsigned off = lua_tointeger(ls, 3);
+    lua_Unsigned len = lua_tointeger(ls, 4);
+    lua_Unsigned pos = off;
+    mlua_lwip_lock();  // Report error after data
+    while (tcp->recv_head != NULL && len > 0) {
+        struct pbuf* h = tcp->recv_head;
+        u16_t sz = h->len - tcp->recv_off;
+        if (len < sz) sz = len;
+        mlua_buffer_write(&buf, pos, sz, (u8_t*)h->payload + tcp->recv_off);
+        pos += sz;
+        len -= sz;
+        recv_consume(tcp, sz);
+    }
+    if (pos > off) {
+        mlua_lwip_unlock();
+        return lua_pushinteger(ls, pos - off), 1;
+    }
+    int res = recv_none(ls, tcp, timeout);
+    if (res == 0) return lua_pushinteger(ls, 0), 1;
+    return res;
+}
+
+static int TCP_recv_into(lua_State* ls) {
+    TCP* tcp = check_conn_TCP(ls, 1);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 2, &buf), 2, "buffer");
+    lua_Unsigned off = luaL_optinteger(ls, 3, 0);
+    luaL_argcheck(ls, off <= buf.size, 3, "out of bounds");
+    lua_Unsigned len = luaL_opt(ls, luaL_checkinteger, 4, buf.size - off);
+    luaL_argcheck(ls, len <= buf.size - off, 4, "out of bounds");
+    if (len == 0) return lua_pushinteger(ls, 0), 1;
+    lua_settop(ls, 5);  // Ensure deadline is set
+    lua_pushinteger(ls, off);
+    lua_replace(ls, 3);
+    lua_pushinteger(ls, len);
+    lua_replace(ls, 4);
+    return mlua_event_wait(ls, &tcp->recv_event, 0, &recv_into_loop, 5);
+}
+
+// Stack: (tcp, deadline, pbuf).
+static int recv_pbuf_loop(lua_State* ls, bool timeout) {
+    TCP* tcp = to_TCP(ls, 1);
+    mlua_lwip_lock();  // Report error after data
+    struct pbuf* h = tcp->recv_head;
+    if (h == NULL) {
+        int res = recv_none(ls, tcp, timeout);
+        if (res == 0) return lua_pushboolean(ls, false), 1;
+        return res;
+    }
+
+    // Detach the first chain from the receive queue. Chains are appended to the
+    // queue without updating tot_len, so the last pbuf of a chain is the first
+    // one whose tot_len is equal to its len.
+    if (tcp->recv_off > 0) {
+        h = pbuf_free_header(h, tcp->recv_off);
+        tcp->recv_off = 0;
+    }
+    recv_account(tcp, h->tot_len);
+    struct pbuf* t = h;
+    while (t->tot_len != t->len) t = t->next;
+    tcp->recv_head = t->next;
+    if (t->next == NULL) tcp->recv_tail = NULL;
+    t->next = NULL;
+    if (tcp->pcb != NULL) tcp_recved(tcp->pcb, h->tot_len);
+    mlua_event_set(&tcp->send_event);
+    mlua_lwip_unlock();
+    *(struct pbuf**)lua_touserdata(ls, 3) = h;
+    return 1;
+}
+
+static int TCP_recv_pbuf(lua_State* ls) {
+    TCP* tcp = check_conn_TCP(ls, 1);
+    lua_settop(ls, 2);  // Ensure deadline is set
+    mlua_new_PBUF(ls);
+    return mlua_event_wait(ls, &tcp->recv_event, 0, &recv_pbuf_loop, 2);
+}
+
 static int TCP_prio(lua_State* ls) {
     TCP* tcp = check_TCP(ls, 1);
     lua_Integer value = luaL_optinteger(ls, 2, -1);
@@ -510,6 +801,70 @@ static int TCP_ttl(lua_State* ls) {
     return lua_pushinteger(ls, old), 1;
 }
 
+#define SET_STAT(name) \
+    mlua_push_minint(ls, st.name); \
+    lua_setfield(ls, -2, #name)
+
+static int TCP_stats(lua_State* ls) {
+    TCP* tcp = check_conn_TCP(ls, 1);
+    lua_createtable(ls, 0, 19);
+    mlua_lwip_lock();
+    sample_rexmits(tcp);
+    TCPStats st = tcp->stats;
+    u32_t queued = tcp->queued, acked = tcp->acked;
+    struct tcp_pcb* pcb = tcp->pcb;
+    bool has_pcb = pcb != NULL;
+    tcpwnd_size_t snd_buf = 0, cwnd = 0, rcv_wnd = 0;
+    u16_t snd_queuelen = 0, mss = 0;
+    if (has_pcb) {
+        snd_buf = tcp_sndbuf(pcb);
+        snd_queuelen = tcp_sndqueuelen(pcb);
+        cwnd = pcb->cwnd;
+        rcv_wnd = pcb->rcv_wnd;
+        mss = tcp_mss(pcb);
+    }
+    mlua_lwip_unlock();
+    if (st.send_wait_start != 0) {
+        st.send_blocked += mlua_ticks64() - st.send_wait_start;
+    }
+    SET_STAT(bytes_in);
+    SET_STAT(segs_in);
+    SET_STAT(rexmits);
+    SET_STAT(recv_queued);
+    SET_STAT(recv_queued_max);
+    SET_STAT(recv_latency);
+    SET_STAT(recv_latency_max);
+    SET_STAT(recv_delays);
+    SET_STAT(send_waits);
+    SET_STAT(send_blocked);
+    lua_pushinteger(ls, queued);
+    lua_setfield(ls, -2, "bytes_out");
+    lua_pushinteger(ls, acked);
+    lua_setfield(ls, -2, "bytes_acked");
+    if (has_pcb) {
+        lua_pushinteger(ls, snd_buf);
+        lua_setfield(ls, -2, "snd_buf");
+        lua_pushinteger(ls, snd_queuelen);
+        lua_setfield(ls, -2, "snd_queuelen");
+        lua_pushinteger(ls, cwnd);
+        lua_setfield(ls, -2, "cwnd");
+        lua_pushinteger(ls, rcv_wnd);
+        lua_setfield(ls, -2, "rcv_wnd");
+        lua_pushinteger(ls, mss);
+        lua_setfield(ls, -2, "mss");
+    }
+    return 1;
+}
+
+static int TCP_is_idle(lua_State* ls) {
+    TCP* tcp = check_conn_TCP(ls, 1);
+    mlua_lwip_lock();
+    bool idle = tcp->err == ERR_OK && tcp->pcb != NULL && tcp->connected
+                && !tcp->rx_closed && tcp->recv_head == NULL;
+    mlua_lwip_unlock();
+    return lua_pushboolean(ls, idle), 1;
+}
+
 #define TCP_write TCP_send
 #define TCP_read TCP_recv
 
@@ -523,8 +878,12 @@ MLUA_SYMBOLS(TCP_syms) = {
     MLUA_SYM_F(connect, TCP_),
     MLUA_SYM_F(send, TCP_),
     MLUA_SYM_F(write, TCP_),
+    MLUA_SYM_F(sendv, TCP_),
+    MLUA_SYM_F(flush, TCP_),
     MLUA_SYM_F(recv, TCP_),
     MLUA_SYM_F(read, TCP_),
+    MLUA_SYM_F(recv_into, TCP_),
+    MLUA_SYM_F(recv_pbuf, TCP_),
     MLUA_SYM_F(prio, TCP_),
     MLUA_SYM_F(local_ip, TCP_),
     MLUA_SYM_F(remote_ip, TCP_),
@@ -533,6 +892,38 @@ MLUA_SYMBOLS(TCP_syms) = {
     MLUA_SYM_F(options, TCP_),
     MLUA_SYM_F(tos, TCP_),
     MLUA_SYM_F(ttl, TCP_),
+    MLUA_SYM_F(stats, TCP_),
+    MLUA_SYM_F(is_idle, TCP_),
+};
+
+static unsigned int poll_ready(lua_State* ls, int arg, unsigned int cond) {
+    TCP* tcp = to_TCP(ls, arg);
+    unsigned int ready = 0;
+    mlua_lwip_lock();
+    if (tcp->pcb == NULL) {
+        ready = cond;  // The error is reported by the next operation
+    } else if (tcp->listening) {
+        if (tcp->accept_head != NULL) ready |= MLUA_LWIP_POLL_RECV;
+    } else {
+        if (tcp->recv_head != NULL || tcp->rx_closed) {
+            ready |= MLUA_LWIP_POLL_RECV;
+        }
+        if (tcp->connected && tcp_sndbuf(tcp->pcb) > 0) {
+            ready |= MLUA_LWIP_POLL_SEND;
+        }
+    }
+    mlua_lwip_unlock();
+    return ready & cond;
+}
+
+static MLuaEvent* poll_event(lua_State* ls, int arg, unsigned int cond) {
+    TCP* tcp = to_TCP(ls, arg);
+    return cond == MLUA_LWIP_POLL_SEND ? &tcp->send_event : &tcp->recv_event;
+}
+
+static MLuaLwipPollVt const TCP_poll_vt = {
+    .ready = &poll_ready,
+    .event = &poll_event,
 };
 
 #define TCP___close TCP_close
@@ -541,6 +932,7 @@ MLUA_SYMBOLS(TCP_syms) = {
 MLUA_SYMBOLS_NOHASH(TCP_syms_nh) = {
     MLUA_SYM_F_NH(__close, TCP_),
     MLUA_SYM_F_NH(__gc, TCP_),
+    MLUA_SYM_V_NH(__poll, lightuserdata, (void*)&TCP_poll_vt),
 };
 
 static int mod_new(lua_State* ls) {
@@ -0,0 +1,140 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local lwip = require 'lwip'
+local dns = require 'lwip.dns'
+local tcp = require 'lwip.tcp'
+local oo = require 'mlua.oo'
+local thread = require 'mlua.thread'
+local table = require 'table'
+
+-- The default maximum number of connections of a pool.
+MAX = 4
+
+-- Open a new connection to the pool's host and port.
+local function connect(self, deadline)
+    local addr, err = self._addr
+    if not addr then
+        addr, err = dns.gethostbyname(self.host, self._atype, deadline)
+        if not addr then
+            if addr == false then return nil, lwip.ERR_ARG end
+            return addr, err
+        end
+    end
+    local conn
+    conn, err = tcp.new(self._type)
+    if not conn then return conn, err end
+    local ok
+    ok, err = conn:connect(addr, self.port, deadline)
+    if not ok then
+        conn:close()
+        return ok, err
+    end
+    return conn
+end
+
+-- A pool of outbound TCP connections to a single host and port, which keeps
+-- idle connections open for reuse.
+Pool = oo.class('Pool')
+
+function Pool:__init(opts)
+    self.host, self.port = opts.host, opts.port
+    self.max = opts.max or MAX
+    if type(self.host) ~= 'string' then self._addr = self.host end
+    self._type, self._atype = opts.type, opts.addrtype
+    self._connect = opts.connect or connect
+    self._idle, self._active = {}, 0
+    self._cond = thread.Condition()
+end
+
+-- Return the number of connections that are checked out, and the number of
+-- idle connections.
+function Pool:counts() return self._active, #self._idle end
+
+-- Check out a connection. Idle connections are reused if they are still
+-- healthy, i.e. the remote end hasn't closed them and they have no pending
+-- data. Otherwise, a new connection is opened. Blocks while "max" connections
+-- are checked out.
+function Pool:get(deadline)
+    while true do
+        if self._closed then return nil, lwip.ERR_CLSD end
+        local idle = self._idle
+        while #idle > 0 do
+            local conn = table.remove(idle)
+            if conn:is_idle() then
+                self._active = self._active + 1
+                return conn
+            end
+            conn:close()
+        end
+        if self._active < self.max then break end
+        if not self._cond:wait(deadline) then return nil, lwip.ERR_TIMEOUT end
+    end
+    self._active = self._active + 1
+    local conn, err = self:_connect(deadline)
+    if not conn then self:_release() end
+    return conn, err
+end
+
+function Pool:_release()
+    self._active = self._active - 1
+    self._cond:notify()
+end
+
+-- Return a connection to the pool. The connection is kept for reuse if it is
+-- still healthy and the pool is open, and closed otherwise.
+function Pool:put(conn)
+    self:_release()
+    if not self._closed and conn:is_idle()
+            and self._active + #self._idle < self.max then
+        table.insert(self._idle, conn)
+    else
+        conn:close()
+    end
+end
+
+-- Close a connection that was checked out, instead of returning it to the
+-- pool. This should be used after errors that leave the connection in an
+-- unknown state.
+function Pool:discard(conn)
+    self:_release()
+    conn:close()
+end
+
+-- Check out a connection, call "fn(conn, ...)" with it, and return the
+-- connection to the pool. The connection is discarded if "fn" raises an error.
+-- Returns the results of "fn", or (fail, err) if no connection could be
+-- checked out.
+function Pool:with(deadline, fn, ...)
+    local conn, err = self:get(deadline)
+    if not conn then return conn, err end
+    local ok = false
+    local done<close> = function()
+        if ok then self:put(conn) else self:discard(conn) end
+    end
+    return (function(...) ok = true return ... end)(fn(conn, ...))
+end
+
+-- Close all idle connections, and prevent further check-outs. Connections that
+-- are checked out are closed when they are returned.
+function Pool:close()
+    self._closed = true
+    local idle = self._idle
+    self._idle = {}
+    for _, conn in ipairs(idle) do conn:close() end
+    self._cond:notify_all()
+end
+
+Pool.__close = Pool.close
+
+-- Create a connection pool. "opts" is a table with the following fields:
+--  - host: The remote host, as a hostname or IPAddr.
+--  - port: The remote port.
+--  - max: The maximum number of connections (checked out and idle).
+--  - type: The IP address type of new sockets, as for lwip.tcp.new().
+--  - addrtype: The address type for resolving hostnames.
+--  - connect: A function "connect(pool, deadline) -> conn | (fail, err)" that
+--    opens new connections (optional).
+function new(opts) return Pool(opts) end
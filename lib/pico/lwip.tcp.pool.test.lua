@@ -0,0 +1,94 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local lwip = require 'lwip'
+local pool = require 'lwip.tcp.pool'
+local oo = require 'mlua.oo'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+
+-- A fake connection, whose health can be controlled by the test.
+local Conn = oo.class('Conn')
+
+function Conn:__init(id) self.id, self.idle = id, true end
+function Conn:is_idle() return self.idle and not self.closed end
+function Conn:close() self.closed = true return true end
+
+local function new_pool(t, max)
+    local conns = {}
+    local p = pool.new{host = 'example.com', port = 80, max = max,
+        connect = function(self, deadline)
+            local conn = Conn(#conns + 1)
+            conns[#conns + 1] = conn
+            return conn
+        end}
+    t:cleanup(function() p:close() end)
+    return p, conns
+end
+
+function test_reuse(t)
+    local p, conns = new_pool(t, 2)
+    local c1 = p:get()
+    t:expect(c1):label("c1"):eq(conns[1])
+    t:expect(t.mexpr(p):counts()):eq{1, 0}
+    p:put(c1)
+    t:expect(t.mexpr(p):counts()):eq{0, 1}
+    t:expect(c1.closed):label("closed"):eq(nil)
+    t:expect(t.expr(p):get()):eq(c1)
+    t:expect(#conns):label("#conns"):eq(1)
+    p:put(c1)
+
+    -- Unhealthy connections are closed on check-in and check-out.
+    c1.idle = false
+    t:expect(t.expr(p):get()):eq(conns[2])
+    t:expect(c1.closed):label("c1.closed"):eq(true)
+    conns[2].idle = false
+    p:put(conns[2])
+    t:expect(conns[2].closed):label("c2.closed"):eq(true)
+    t:expect(t.mexpr(p):counts()):eq{0, 0}
+
+    -- Discarded connections are closed.
+    local c3 = p:get()
+    p:discard(c3)
+    t:expect(c3.closed):label("c3.closed"):eq(true)
+    t:expect(t.mexpr(p):counts()):eq{0, 0}
+end
+
+function test_max(t)
+    local p, conns = new_pool(t, 2)
+    local c1, c2 = p:get(), p:get()
+    t:expect(t.mexpr(p):get(time.deadline(10 * time.msec)))
+        :eq{nil, lwip.ERR_TIMEOUT}
+    local got
+    local waiter<close> = thread.start(function() got = p:get() end)
+    thread.yield()
+    t:expect(got):label("got"):eq(nil)
+    p:put(c2)
+    waiter:join()
+    t:expect(got):label("got"):eq(c2)
+    t:expect(#conns):label("#conns"):eq(2)
+end
+
+function test_with(t)
+    local p = new_pool(t, 1)
+    t:expect(t.mexpr(p):with(nil, function(conn, a, b)
+        return conn.id, a + b
+    end, 1, 2)):eq{1, 3}
+    t:expect(t.mexpr(p):counts()):eq{0, 1}
+    t:expect(t.expr(p):with(nil, function(conn) error("boom", 0) end))
+        :raises("boom")
+    t:expect(t.mexpr(p):counts()):eq{0, 0}
+end
+
+function test_close(t)
+    local p = new_pool(t, 2)
+    local c1, c2 = p:get(), p:get()
+    p:put(c1)
+    p:close()
+    t:expect(c1.closed):label("c1.closed"):eq(true)
+    t:expect(t.mexpr(p):get()):eq{nil, lwip.ERR_CLSD}
+    p:put(c2)
+    t:expect(c2.closed):label("c2.closed"):eq(true)
+end
@@ -4,6 +4,7 @@
 _ENV = module(...)
 
 local lwip = require 'lwip'
+local math = require 'math'
 local tcp = require 'lwip.tcp'
 local mem = require 'mlua.mem'
 local testing_lwip = require 'mlua.testing.lwip'
@@ -46,21 +47,133 @@ local function start_logger(t, ctrl, dl, size, count)
     return logger, logged
 end
 
-local function echo(t, conn, dl, size, count)
+-- Factories for functions reading up to "len" bytes from a connection.
+local readers = {
+    recv = function()
+        return function(conn, len, dl) return conn:recv(len, dl) end
+    end,
+    recv_into = function()
+        return function(conn, len, dl)
+            local buf = mem.alloc(len)
+            local n, err = conn:recv_into(buf, 0, len, dl)
+            if not n then return n, err end
+            return mem.read(buf, 0, n)
+        end
+    end,
+    recv_pbuf = function()
+        local pb, off
+        return function(conn, len, dl)
+            if not pb then
+                local err
+                pb, err = conn:recv_pbuf(dl)
+                if pb == false then pb = nil return '' end
+                if not pb then return pb, err end
+                off = 0
+            end
+            local n = math.min(len, #pb - off)
+            local data = mem.read(pb, off, n)
+            off = off + n
+            if off == #pb then pb:free() pb = nil end
+            return data
+        end
+    end,
+}
+
+-- Functions writing a size header and the data to a connection.
+local writers = {
+    send = function(conn, dsize, data, dl)
+        return conn:send(dsize, data, dl)
+    end,
+    send_more = function(conn, dsize, data, dl)
+        lwip.assert(conn:send(dsize, {more = true}, dl))
+        return conn:send(data, dl)
+    end,
+    send_flush = function(conn, dsize, data, dl)
+        lwip.assert(conn:send(dsize, data, {flush = false}, dl))
+        return conn:flush()
+    end,
+    send_nocopy = function(conn, dsize, data, dl)
+        return conn:send(dsize, data, {nocopy = true}, dl)
+    end,
+    sendv = function(conn, dsize, data, dl)
+        return conn:sendv({dsize, data}, dl)
+    end,
+    sendv_nil = function(conn, dsize, data, dl)
+        return conn:sendv({dsize, data}, nil, dl)
+    end,
+}
+
+local function echo(t, conn, dl, size, count, mode)
     local conn<close> = conn
-    local received = testing_lwip.Set()
+    local recv = (readers[mode] or readers.recv)()
+    local send = writers[mode] or writers.send
+    local received, nbytes = testing_lwip.Set(), 0
     while true do
-        local dsize = lwip.assert(conn:recv(2, dl))
+        local dsize = lwip.assert(recv(conn, 2, dl))
         if #dsize < 2 then break end
         local rsize = dsize:byte(1) | (dsize:byte(2) << 8)
-        local data = lwip.assert(conn:recv(rsize, dl))
+        local data = lwip.assert(recv(conn, rsize, dl))
         if #data < rsize then break end
         local pid, ok = testing_lwip.verify_data(data, 0, #data)
         t:expect(rsize):label("rsize"):eq(size)
         t:expect(ok):label("data ok"):eq(true)
-        lwip.assert(conn:send(dsize, data, dl))
+        lwip.assert(send(conn, dsize, data, dl))
+        nbytes = nbytes + 2 + rsize
         if received:add(pid) == count then break end
     end
+    if mode == 'send_nocopy' then
+        -- Closing before the data is acknowledged would abort the connection.
+        while conn:stats().bytes_acked < nbytes do
+            t:assert(time.compare(time.ticks(), dl) < 0,
+                     "timeout waiting for acknowledgements")
+            time.sleep_for(time.msec)
+        end
+    end
+    local stats = conn:stats()
+    t:expect(stats.bytes_out):label("bytes_out"):eq(nbytes)
+    t:expect(stats.bytes_in >= nbytes, "bytes_in: got %s, want >= %s",
+             stats.bytes_in, nbytes)
+    t:expect(stats.segs_in > 0, "segs_in: got %s, want > 0", stats.segs_in)
+    t:expect(stats.recv_queued_max >= stats.recv_queued,
+             "recv_queued_max: got %s, want >= %s", stats.recv_queued_max,
+             stats.recv_queued)
+end
+
+-- Serve "conns" connections accepted on a listener from a single thread, by
+-- polling the listener and the connections for readiness.
+local function poll_server(t, sock, dl, conns, size, count)
+    local objs, pending, received, done = {sock}, {}, {}, 0
+    while done < conns do
+        local ready = lwip.assert(lwip.poll(objs, lwip.POLL_RECV, dl))
+        for _, s in ipairs(ready) do
+            if s == sock then
+                local conn = lwip.assert(sock:accept(dl))
+                objs[#objs + 1] = conn
+                pending[conn], received[conn] = '', testing_lwip.Set()
+                goto continue
+            end
+            local data = pending[s] .. lwip.assert(s:recv(4096, dl))
+            while #data >= 2 do
+                local rsize = data:byte(1) | (data:byte(2) << 8)
+                if #data < 2 + rsize then break end
+                local pid, ok = testing_lwip.verify_data(data, 2, rsize)
+                t:expect(rsize):label("rsize"):eq(size)
+                t:expect(ok):label("data ok"):eq(true)
+                lwip.assert(s:send(data:sub(1, 2 + rsize), dl))
+                data = data:sub(3 + rsize)
+                if received[s]:add(pid) == count then
+                    s:close()
+                    for i, o in ipairs(objs) do
+                        if o == s then table.remove(objs, i) break end
+                    end
+                    done = done + 1
+                    break
+                end
+            end
+            pending[s] = data
+            ::continue::
+        end
+    end
 end
 
 function test_listen(t)
@@ -73,6 +186,15 @@ function test_listen(t)
         {"multi-port", nil, {1234, 5678}, 1, 64, 10, 10 * time.msec},
         {"IPv4", testing_lwip.IPV4, {1234}, 1, 64, 10, 10 * time.msec},
         {"IPv6", testing_lwip.IPV6, {1234}, 1, 64, 10, 10 * time.msec},
+        {"recv_into", nil, {1234}, 1, 1200, 10, 10 * time.msec, 'recv_into'},
+        {"recv_pbuf", nil, {1234}, 1, 1200, 10, 10 * time.msec, 'recv_pbuf'},
+        {"send_more", nil, {1234}, 1, 64, 10, 10 * time.msec, 'send_more'},
+        {"send_flush", nil, {1234}, 1, 64, 10, 10 * time.msec, 'send_flush'},
+        {"send_nocopy", nil, {1234}, 1, 1200, 10, 10 * time.msec,
+         'send_nocopy'},
+        {"sendv", nil, {1234}, 1, 64, 10, 10 * time.msec, 'sendv'},
+        {"sendv_nil", nil, {1234}, 1, 64, 10, 10 * time.msec, 'sendv_nil'},
+        {"poll", nil, {1234}, 3, 64, 10, 10 * time.msec, 'poll'},
     } do
         local desc, atype, ports = table.unpack(test, 1, 3)
         t:run(desc, function(t)
@@ -87,7 +209,8 @@ function test_listen(t)
     end
 end
 
-function run_listen_test(t, atype, lport, conns, size, count, interval)
+function run_listen_test(t, atype, lport, conns, size, count, interval,
+                         mode)
     local ctrl = testing_lwip.Control(t, atype)
     local sock<close> = lwip.assert(tcp.new())
     lwip.assert(sock:bind(nil, lport))
@@ -100,11 +223,14 @@ function run_listen_test(t, atype, lport, conns, size, count, interval)
 
     local workers<close> = thread.Group()
     local accepter<close> = thread.start(log_error(function()
+        if mode == 'poll' then
+            return poll_server(t, sock, dl, conns, size, count)
+        end
         while true do
             local conn = lwip.assert(sock:accept(dl))
             t:expect(t.expr(conn):remote_ip()):eq(ctrl.addr)
             workers:start(log_error(function()
-                return echo(t, conn, dl, size, count)
+                return echo(t, conn, dl, size, count, mode)
             end))
         end
     end))
@@ -21,6 +21,10 @@ function test_assert(t)
     t:expect(t.expr(lwip).assert(false, "boom")):raises("boom")
 end
 
+function test_core(t)
+    t:expect(t.expr(lwip).core()):eq_one_of{0, 1}
+end
+
 function test_IPAddr(t)
     t:expect(t.expr(lwip).IP_ANY_TYPE:type()):eq(lwip.IPADDR_TYPE_ANY)
 end
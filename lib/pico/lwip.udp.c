@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: MIT
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "lwip/netif.h"
 #include "lwip/udp.h"
@@ -22,7 +23,8 @@ typedef struct Packet {
 typedef struct UDP {
     struct udp_pcb* pcb;
     MLuaEvent recv_event;
-    uint8_t head, len, cap, dropped;
+    uint8_t head, len, cap;
+    u32_t dropped;
     Packet recv_packets[0];
 } UDP;
 
@@ -124,25 +126,115 @@ static int UDP_send(lua_State* ls) {
     return mlua_lwip_push_result(ls, err);
 }
 
+// The destination arguments of sendto() and sendtov().
+typedef struct Dest {
+    ip_addr_t const* addr;
+    u16_t port;
+    struct netif* netif;
+    ip_addr_t const* src;
+} Dest;
+
+static void check_dest(lua_State* ls, int arg, Dest* dest) {
+    dest->addr = mlua_check_IPAddr(ls, arg);
+    dest->port = luaL_checkinteger(ls, arg + 1);
+    dest->netif = luaL_opt(ls, mlua_check_NETIF, arg + 2, NULL);
+    dest->src = luaL_opt(ls, mlua_check_IPAddr, arg + 3, NULL);
+    luaL_argcheck(ls, dest->netif != NULL || dest->src == NULL, arg + 2,
+                  "required if src is specified");
+}
+
+static err_t send_to_dest(UDP* udp, struct pbuf* pb, Dest const* dest) {
+    mlua_lwip_lock();
+    err_t err;
+    if (dest->netif == NULL) {
+        err = udp_sendto(udp->pcb, pb, dest->addr, dest->port);
+    } else if (dest->src == NULL) {
+        err = udp_sendto_if(udp->pcb, pb, dest->addr, dest->port,
+                            dest->netif);
+    } else {
+        err = udp_sendto_if_src(udp->pcb, pb, dest->addr, dest->port,
+                                dest->netif, dest->src);
+    }
+    mlua_lwip_unlock();
+    return err;
+}
+
 static int UDP_sendto(lua_State* ls) {
     UDP* udp = check_UDP(ls, 1);
     if (udp->pcb == NULL) return mlua_lwip_push_err(ls, ERR_CLSD);
     struct pbuf* pb = mlua_check_PBUF(ls, 2);
-    ip_addr_t* addr = mlua_check_IPAddr(ls, 3);
-    u16_t port = luaL_checkinteger(ls, 4);
-    struct netif* netif = luaL_opt(ls, mlua_check_NETIF, 5, NULL);
-    ip_addr_t* src = luaL_opt(ls, mlua_check_IPAddr, 6, NULL);
-    luaL_argcheck(ls, netif != NULL || src == NULL, 5,
-                  "required if src is specified");
+    Dest dest;
+    check_dest(ls, 3, &dest);
+    return mlua_lwip_push_result(ls, send_to_dest(udp, pb, &dest));
+}
+
+// Build a pbuf chain from the strings and buffers in the table at index arg.
+// Strings and raw buffers are referenced by PBUF_REF pbufs, and other buffers
+// are copied. The table must be kept alive until the chain is freed. Returns
+// NULL if memory allocation fails.
+static struct pbuf* new_chain(lua_State* ls, int arg) {
+    luaL_checktype(ls, arg, LUA_TTABLE);
+    lua_Unsigned n = lua_rawlen(ls, arg);
+    lua_Unsigned total = 0;
+    for (lua_Unsigned i = 1; i <= n; ++i) {
+        lua_rawgeti(ls, arg, i);
+        MLuaBuffer buf;
+        if (!mlua_get_ro_buffer(ls, -1, &buf) || buf.size == SIZE_MAX) {
+            luaL_error(ls, "bad element %d (string or buffer expected)",
+                       (int)i);
+        }
+        lua_pop(ls, 1);
+        total += buf.size;
+        luaL_argcheck(ls, total <= 0xffff, arg, "too large");
+    }
     mlua_lwip_lock();
-    err_t err;
-    if (netif == NULL) {
-        err = udp_sendto(udp->pcb, pb, addr, port);
-    } else if (src == NULL) {
-        err = udp_sendto_if(udp->pcb, pb, addr, port, netif);
-    } else {
-        err = udp_sendto_if_src(udp->pcb, pb, addr, port, netif, src);
+    struct pbuf* head = pbuf_alloc(PBUF_TRANSPORT, 0, PBUF_RAM);
+    mlua_lwip_unlock();
+    if (head == NULL) return NULL;
+    for (lua_Unsigned i = 1; i <= n; ++i) {
+        lua_rawgeti(ls, arg, i);
+        MLuaBuffer buf;
+        mlua_get_ro_buffer(ls, -1, &buf);
+        lua_pop(ls, 1);
+        if (buf.size == 0) continue;
+        mlua_lwip_lock();
+        struct pbuf* p = pbuf_alloc(PBUF_RAW, buf.size,
+                                    buf.vt == NULL ? PBUF_REF : PBUF_RAM);
+        if (p == NULL) {
+            pbuf_free(head);
+            mlua_lwip_unlock();
+            return NULL;
+        }
+        if (buf.vt == NULL) p->payload = buf.ptr;
+        pbuf_cat(head, p);
+        mlua_lwip_unlock();
+        if (buf.vt != NULL) mlua_buffer_read(&buf, 0, buf.size, p->payload);
     }
+    return head;
+}
+
+static int UDP_sendv(lua_State* ls) {
+    UDP* udp = check_UDP(ls, 1);
+    if (udp->pcb == NULL) return mlua_lwip_push_err(ls, ERR_CLSD);
+    struct pbuf* pb = new_chain(ls, 2);
+    if (pb == NULL) return mlua_lwip_push_err(ls, ERR_MEM);
+    mlua_lwip_lock();
+    err_t err = udp_send(udp->pcb, pb);
+    pbuf_free(pb);
+    mlua_lwip_unlock();
+    return mlua_lwip_push_result(ls, err);
+}
+
+static int UDP_sendtov(lua_State* ls) {
+    UDP* udp = check_UDP(ls, 1);
+    if (udp->pcb == NULL) return mlua_lwip_push_err(ls, ERR_CLSD);
+    Dest dest;
+    check_dest(ls, 3, &dest);
+    struct pbuf* pb = new_chain(ls, 2);
+    if (pb == NULL) return mlua_lwip_push_err(ls, ERR_MEM);
+    err_t err = send_to_dest(udp, pb, &dest);
+    mlua_lwip_lock();
+    pbuf_free(pb);
     mlua_lwip_unlock();
     return mlua_lwip_push_result(ls, err);
 }
@@ -185,6 +277,130 @@ static int UDP_recvfrom(lua_State* ls) {
     return mlua_event_wait(ls, &udp->recv_event, 0, &recv_loop, 2);
 }
 
+// Return true iff the UDP at index arg has a receive queue.
+static inline bool has_queue(lua_State* ls, int arg) {
+    return lua_rawlen(ls, arg) != sizeof(struct udp_pcb*);
+}
+
+// Remove the packet at the head of the receive queue.
+static void pop_packet(UDP* udp) {
+    mlua_lwip_lock();
+    if (++udp->head == udp->cap) udp->head = 0;
+    --udp->len;
+    mlua_lwip_unlock();
+}
+
+// Stack: (udp, max, deadline).
+static int recv_many_loop(lua_State* ls, bool timeout) {
+    UDP* udp = to_UDP(ls, 1);
+    mlua_lwip_lock();
+    lua_Integer len = udp->len;
+    mlua_lwip_unlock();
+    if (len == 0) {
+        if (!timeout) return -1;
+        return mlua_lwip_push_err(ls, ERR_TIMEOUT);
+    }
+    lua_Integer max = lua_tointeger(ls, 2);
+    if (len > max) len = max;
+    lua_createtable(ls, len, 0);
+    lua_createtable(ls, len, 0);
+    lua_createtable(ls, len, 0);
+    for (lua_Integer i = 1; i <= len; ++i) {
+        struct pbuf** pb = mlua_new_PBUF(ls);
+        Packet* pkt = &udp->recv_packets[udp->head];
+        *pb = pkt->p;
+        ip_addr_t addr = pkt->addr;
+        u16_t port = pkt->port;
+        pop_packet(udp);
+        lua_rawseti(ls, -4, i);
+        *mlua_new_IPAddr(ls) = addr;
+        lua_rawseti(ls, -3, i);
+        lua_pushinteger(ls, port);
+        lua_rawseti(ls, -2, i);
+    }
+    return 3;
+}
+
+static int UDP_recv_many(lua_State* ls) {
+    UDP* udp = check_UDP(ls, 1);
+    if (udp->pcb == NULL) return mlua_lwip_push_err(ls, ERR_CLSD);
+    luaL_argcheck(ls, has_queue(ls, 1), 1, "no receive queue");
+    lua_Integer max = luaL_optinteger(ls, 2, udp->cap);
+    luaL_argcheck(ls, max > 0, 2, "must be positive");
+    lua_settop(ls, 3);  // Ensure deadline is set
+    lua_pushinteger(ls, max);
+    lua_replace(ls, 2);
+    return mlua_event_wait(ls, &udp->recv_event, 0, &recv_many_loop, 3);
+}
+
+// Stack: (udp, bufs, lens, deadline).
+static int recv_many_into_loop(lua_State* ls, bool timeout) {
+    UDP* udp = to_UDP(ls, 1);
+    mlua_lwip_lock();
+    lua_Integer len = udp->len;
+    mlua_lwip_unlock();
+    if (len == 0) {
+        if (!timeout) return -1;
+        return mlua_lwip_push_err(ls, ERR_TIMEOUT);
+    }
+    lua_Integer max = lua_rawlen(ls, 2);
+    if (len > max) len = max;
+    for (lua_Integer i = 1; i <= len; ++i) {
+        lua_rawgeti(ls, 2, i);
+        MLuaBuffer buf;
+        if (!mlua_get_buffer(ls, -1, &buf)) {
+            return luaL_error(ls, "bad buffer %d (buffer expected)", (int)i);
+        }
+        lua_pop(ls, 1);
+        struct pbuf* p = udp->recv_packets[udp->head].p;
+        lua_Unsigned off = 0;
+        for (struct pbuf* q = p; q != NULL && off < buf.size; q = q->next) {
+            lua_Unsigned n = q->len;
+            if (n > buf.size - off) n = buf.size - off;
+            mlua_buffer_write(&buf, off, n, q->payload);
+            off += n;
+        }
+        pop_packet(udp);
+        mlua_lwip_lock();
+        pbuf_free(p);
+        mlua_lwip_unlock();
+        lua_pushinteger(ls, off);
+        lua_rawseti(ls, 3, i);
+    }
+    return lua_pushinteger(ls, len), 1;
+}
+
+static int UDP_recv_many_into(lua_State* ls) {
+    UDP* udp = check_UDP(ls, 1);
+    if (udp->pcb == NULL) return mlua_lwip_push_err(ls, ERR_CLSD);
+    luaL_argcheck(ls, has_queue(ls, 1), 1, "no receive queue");
+    luaL_checktype(ls, 2, LUA_TTABLE);
+    luaL_checktype(ls, 3, LUA_TTABLE);
+    lua_settop(ls, 4);  // Ensure deadline is set
+    if (lua_rawlen(ls, 2) == 0) return lua_pushinteger(ls, 0), 1;
+    return mlua_event_wait(ls, &udp->recv_event, 0, &recv_many_into_loop, 4);
+}
+
+static int UDP_queued(lua_State* ls) {
+    UDP* udp = check_UDP(ls, 1);
+    if (!has_queue(ls, 1)) return lua_pushinteger(ls, 0), 1;
+    mlua_lwip_lock();
+    lua_Integer len = udp->len;
+    mlua_lwip_unlock();
+    return lua_pushinteger(ls, len), 1;
+}
+
+static int UDP_dropped(lua_State* ls) {
+    UDP* udp = check_UDP(ls, 1);
+    bool reset = mlua_to_cbool(ls, 2);
+    if (!has_queue(ls, 1)) return lua_pushinteger(ls, 0), 1;
+    mlua_lwip_lock();
+    u32_t dropped = udp->dropped;
+    if (reset) udp->dropped = 0;
+    mlua_lwip_unlock();
+    return lua_pushinteger(ls, dropped), 1;
+}
+
 static int UDP_local_ip(lua_State* ls) {
     struct udp_pcb* pcb = check_UDP(ls, 1)->pcb;
     if (pcb == NULL) return mlua_lwip_push_err(ls, ERR_CLSD);
@@ -265,8 +481,14 @@ MLUA_SYMBOLS(UDP_syms) = {
     MLUA_SYM_F(disconnect, UDP_),
     MLUA_SYM_F(send, UDP_),
     MLUA_SYM_F(sendto, UDP_),
+    MLUA_SYM_F(sendv, UDP_),
+    MLUA_SYM_F(sendtov, UDP_),
     MLUA_SYM_F(recv, UDP_),
     MLUA_SYM_F(recvfrom, UDP_),
+    MLUA_SYM_F(recv_many, UDP_),
+    MLUA_SYM_F(recv_many_into, UDP_),
+    MLUA_SYM_F(queued, UDP_),
+    MLUA_SYM_F(dropped, UDP_),
     MLUA_SYM_F(local_ip, UDP_),
     MLUA_SYM_F(remote_ip, UDP_),
     MLUA_SYM_F(local_port, UDP_),
@@ -276,12 +498,35 @@ MLUA_SYMBOLS(UDP_syms) = {
     MLUA_SYM_F(ttl, UDP_),
 };
 
+static unsigned int poll_ready(lua_State* ls, int arg, unsigned int cond) {
+    UDP* udp = to_UDP(ls, arg);
+    if (udp->pcb == NULL) return cond;  // Operations fail with ERR_CLSD
+    unsigned int ready = MLUA_LWIP_POLL_SEND;
+    if (has_queue(ls, arg)) {
+        mlua_lwip_lock();
+        if (udp->len > 0) ready |= MLUA_LWIP_POLL_RECV;
+        mlua_lwip_unlock();
+    }
+    return ready & cond;
+}
+
+static MLuaEvent* poll_event(lua_State* ls, int arg, unsigned int cond) {
+    if (cond != MLUA_LWIP_POLL_RECV || !has_queue(ls, arg)) return NULL;
+    return &to_UDP(ls, arg)->recv_event;
+}
+
+static MLuaLwipPollVt const UDP_poll_vt = {
+    .ready = &poll_ready,
+    .event = &poll_event,
+};
+
 #define UDP___close UDP_close
 #define UDP___gc UDP_close
 
 MLUA_SYMBOLS_NOHASH(UDP_syms_nh) = {
     MLUA_SYM_F_NH(__close, UDP_),
     MLUA_SYM_F_NH(__gc, UDP_),
+    MLUA_SYM_V_NH(__poll, lightuserdata, (void*)&UDP_poll_vt),
 };
 
 static int mod_new(lua_State* ls) {
@@ -4,6 +4,7 @@
 _ENV = module(...)
 
 local lwip = require 'lwip'
+local mem = require 'mlua.mem'
 local pbuf = require 'lwip.pbuf'
 local udp = require 'lwip.udp'
 local testing_lwip = require 'mlua.testing.lwip'
@@ -28,9 +29,32 @@ function test_accessors(t)
     t:expect(t.expr(sock):ttl()):eq(127)
 end
 
+function test_poll(t)
+    local s1<close> = lwip.assert(udp.new(nil, 2))
+    local s2<close> = lwip.assert(udp.new(nil, 0))
+    local ready, conds = lwip.poll({s1, s2}, lwip.POLL_SEND)
+    t:expect(#ready):label("#ready"):eq(2)
+    t:expect(ready[1]):label("ready[1]"):eq(s1)
+    t:expect(ready[2]):label("ready[2]"):eq(s2)
+    t:expect(conds[1]):label("conds[1]"):eq(lwip.POLL_SEND)
+    t:expect(conds[2]):label("conds[2]"):eq(lwip.POLL_SEND)
+    ready, conds = lwip.poll({s1, s2}, {lwip.POLL_RECV, lwip.POLL_SEND})
+    t:expect(#ready):label("#ready"):eq(1)
+    t:expect(ready[1]):label("ready[1]"):eq(s2)
+    t:expect(t.mexpr(lwip).poll({s1}, nil, time.deadline(time.msec)))
+        :eq{nil, lwip.ERR_TIMEOUT}
+    t:expect(t.expr(lwip).poll({s1, 1})):raises("cannot be polled")
+    s1:close()
+    ready, conds = lwip.poll({s1}, lwip.POLL_RECV)
+    t:expect(ready[1]):label("ready[1]"):eq(s1)
+    t:expect(conds[1]):label("conds[1]"):eq(lwip.POLL_RECV)
+end
+
 function test_send(t)
     for _, test in ipairs{
         {"send", 'send', nil, {1234}, 64, 10, 10 * time.msec},
+        {"sendv", 'sendv', nil, {1234}, 64, 10, 10 * time.msec},
+        {"sendtov", 'sendtov', nil, {1234}, 1200, 10, 10 * time.msec},
         {"small", 'sendto', nil, {1234}, 64, 10, 10 * time.msec},
         {"large", 'sendto', nil, {1234}, 1200, 10, 50 * time.msec},
         {"many", 'sendto', nil, {1234}, 64, 100, 5 * time.msec},
@@ -78,14 +102,26 @@ function run_send_test(t, fname, atype, lport, size, count, interval)
         end
     end))
 
-    local send, to = sock[fname], fname == 'sendto'
+    local send = sock[fname]
+    local to = fname == 'sendto' or fname == 'sendtov'
+    local vec = fname == 'sendv' or fname == 'sendtov'
     local sender<close> = thread.start(log_error(function()
         for pid = 0, count - 1 do
             local p<close> = lwip.assert(pbuf.alloc(pbuf.TRANSPORT, size))
             testing_lwip.generate_data(pid, size, p, 0)
+            local tail<close> = vec and lwip.assert(
+                pbuf.alloc(pbuf.TRANSPORT, size - 24)) or nil
+            local data = p
+            if vec then
+                -- Split the data into a string, a raw buffer and a PBUF.
+                local raw = mem.alloc(16)
+                mem.write(raw, mem.read(p, 8, 16))
+                mem.write(tail, mem.read(p, 24))
+                data = {mem.read(p, 0, 8), raw, tail}
+            end
             local addr = to and ctrl.addr or nil
             local port = to and ctrl.port or nil
-            local ok, err = send(sock, p, addr, port)
+            local ok, err = send(sock, data, addr, port)
             t:expect(ok):label("send() ok"):eq(true)
             t:expect(err):label("send() err"):eq(nil)
             time.sleep_for(interval)
@@ -99,6 +135,9 @@ end
 function test_recv(t)
     for _, test in ipairs{
         {"recv", 'recv', nil, {1234}, 64, 10, 10 * time.msec},
+        {"recv_many", 'recv_many', nil, {1234}, 64, 100, 1 * time.usec},
+        {"recv_many_into", 'recv_many_into', nil, {1234}, 64, 100,
+         1 * time.usec},
         {"small", 'recvfrom', nil, {1234}, 64, 10, 10 * time.msec},
         {"large", 'recvfrom', nil, {1234}, 1200, 10, 10 * time.msec},
         {"many", 'recvfrom', nil, {1234}, 64, 100, 5 * time.msec},
@@ -127,6 +166,10 @@ function run_recv_test(t, fname, atype, lport, size, count, interval)
     lwip.assert(sock:connect(ctrl.addr, ctrl.port))
 
     local dl = time.deadline(count * interval + 1000 * time.msec)
+    if fname == 'recv_many' or fname == 'recv_many_into' then
+        return run_recv_many_test(t, ctrl, sock, fname, dl, lport, size, count,
+                                  interval)
+    end
     local recv, from = sock[fname], fname == 'recvfrom'
     local received = testing_lwip.Set()
     local receiver<close> = thread.start(log_error(function()
@@ -146,3 +189,44 @@ function run_recv_test(t, fname, atype, lport, size, count, interval)
     receiver:join()
     t:expect(#received):label("received"):eq(count)
 end
+
+function run_recv_many_test(t, ctrl, sock, fname, dl, lport, size, count,
+                            interval)
+    local bufs, lens = {}, {}
+    for i = 1, 4 do bufs[i] = mem.alloc(size) end
+    local received = testing_lwip.Set()
+    local receiver<close> = thread.start(log_error(function()
+        while true do
+            if fname == 'recv_many' then
+                local ps, addrs, ports = sock:recv_many(nil, dl)
+                if not ps then break end
+                t:expect(#addrs):label("#addrs"):eq(#ps)
+                t:expect(#ports):label("#ports"):eq(#ps)
+                for i, p in ipairs(ps) do
+                    t:expect(addrs[i]):label("addr"):eq(ctrl.addr)
+                    t:expect(ports[i]):label("port"):eq(ctrl.port)
+                    local pid, ok = testing_lwip.verify_data(p, 0, #p)
+                    p:free()
+                    t:expect(ok):label("data ok"):eq(true)
+                    if received:add(pid) == count then return end
+                end
+            else
+                local n = sock:recv_many_into(bufs, lens, dl)
+                if not n then break end
+                for i = 1, n do
+                    t:expect(lens[i]):label("lens[%s]", i):eq(size)
+                    local pid, ok = testing_lwip.verify_data(bufs[i], 0,
+                                                             lens[i])
+                    t:expect(ok):label("data ok"):eq(true)
+                    if received:add(pid) == count then return end
+                end
+            end
+        end
+    end))
+
+    ctrl:send(dl, 'udp %s %s %s %s\n', lport, size, count, interval)
+
+    receiver:join()
+    t:expect(#received):label("received"):eq(count)
+    t:expect(t.expr(sock):dropped()):eq(0)
+end
@@ -6,18 +6,76 @@
 #include <string.h>
 
 #include "hardware/flash.h"
+#include "hardware/structs/psm.h"
+#include "hardware/structs/watchdog.h"
 #include "hardware/sync.h"
+#include "pico/error.h"
+#include "pico/flash.h"
+#include "pico/multicore.h"
+#include "pico/platform.h"
 
 #include "lua.h"
 #include "lauxlib.h"
+#include "mlua/bits.h"
 #include "mlua/errors.h"
 #include "mlua/module.h"
 #include "mlua/util.h"
 
-// TODO: Use pico_flash instead of hardware_flash to handle lockout
+// The maximum size of a single flash program operation. Larger writes are
+// split into chunks of this size, and interrupts are re-enabled between them.
+#ifndef MLUA_BLOCK_FLASH_PROGRAM_CHUNK
+#define MLUA_BLOCK_FLASH_PROGRAM_CHUNK FLASH_SECTOR_SIZE
+#endif
+
+// The timeout for locking out the other core, in milliseconds.
+#ifndef MLUA_BLOCK_FLASH_LOCKOUT_TIMEOUT_MS
+#define MLUA_BLOCK_FLASH_LOCKOUT_TIMEOUT_MS 100
+#endif
 
 extern char const __flash_binary_start[];
 
+typedef struct FlashOp {
+    uint32_t offset;
+    uint8_t const* src;
+    size_t size;
+} FlashOp;
+
+static void do_program(void* param) {
+    FlashOp const* op = param;
+    flash_range_program(op->offset, op->src, op->size);
+}
+
+static void do_erase(void* param) {
+    FlashOp const* op = param;
+    flash_range_erase(op->offset, op->size);
+}
+
+__attribute__((weak)) bool mlua_block_flash_core_running(uint core) {
+    return core == 0;
+}
+
+// Execute a flash operation. If the other core has been set up as a lockout
+// victim, it is paused through pico_flash while the operation executes. If it
+// isn't running, disabling interrupts on the calling core is sufficient.
+// Otherwise, it may be executing from flash, so the operation fails.
+static int safe_execute(void (*fn)(void*), FlashOp* op) {
+    uint other = get_core_num() ^ 1;
+    if (multicore_lockout_victim_is_initialized(other)) {
+        int rc = flash_safe_execute(fn, op,
+                                    MLUA_BLOCK_FLASH_LOCKOUT_TIMEOUT_MS);
+        return rc == PICO_OK ? MLUA_EOK : MLUA_EIO;
+    }
+    if (mlua_block_flash_core_running(other)) return MLUA_EBUSY;
+    uint32_t save = save_and_disable_interrupts();
+    fn(op);
+    restore_interrupts(save);
+    return MLUA_EOK;
+}
+
+static inline uint32_t flash_offset(MLuaBlockFlash* f, uint64_t off) {
+    return (f->start + off) - (void const*)__flash_binary_start;
+}
+
 static int flash_dev_read(MLuaBlockDev* dev, uint64_t off, void* dst,
                           size_t size) {
     MLuaBlockFlash* f = (MLuaBlockFlash*)dev;
@@ -30,20 +88,32 @@ static int flash_dev_write(MLuaBlockDev* dev, uint64_t off, void const* src,
                            size_t size) {
     MLuaBlockFlash* f = (MLuaBlockFlash*)dev;
     if (off + size > f->dev.size) return MLUA_EINVAL;
-    uint32_t save = save_and_disable_interrupts();
-    flash_range_program((f->start + off) - (void const*)__flash_binary_start,
-                        src, size);
-    restore_interrupts(save);
+    FlashOp op = {.offset = flash_offset(f, off), .src = src};
+    while (size > 0) {
+        op.size = size < MLUA_BLOCK_FLASH_PROGRAM_CHUNK ? size
+                  : MLUA_BLOCK_FLASH_PROGRAM_CHUNK;
+        int err = safe_execute(&do_program, &op);
+        if (err < 0) return err;
+        op.offset += op.size;
+        op.src += op.size;
+        size -= op.size;
+    }
     return MLUA_EOK;
 }
 
 static int flash_dev_erase(MLuaBlockDev* dev, uint64_t off, size_t size) {
     MLuaBlockFlash* f = (MLuaBlockFlash*)dev;
-    if (off + size > f->dev.size) return MLUA_EINVAL;
-    uint32_t save = save_and_disable_interrupts();
-    flash_range_erase((f->start + off) - (void const*)__flash_binary_start,
-                      size);
-    restore_interrupts(save);
+    if (off + size > f->dev.size || size % FLASH_SECTOR_SIZE != 0) {
+        return MLUA_EINVAL;
+    }
+    // Erase one sector at a time, to limit the time during which interrupts are
+    // disabled.
+    FlashOp op = {.offset = flash_offset(f, off), .size = FLASH_SECTOR_SIZE};
+    for (; size > 0; size -= FLASH_SECTOR_SIZE) {
+        int err = safe_execute(&do_erase, &op);
+        if (err < 0) return err;
+        op.offset += FLASH_SECTOR_SIZE;
+    }
     return MLUA_EOK;
 }
 
@@ -79,8 +149,59 @@ static int mod_new(lua_State* ls) {
     return 1;
 }
 
+// Copy "size" bytes from "src" to the start of flash, then reset the chip. The
+// running binary is overwritten, so this function must not call into flash,
+// and it is called with interrupts disabled and the other core reset.
+static void __no_inline_not_in_flash_func(install_image)(uint8_t const* src,
+                                                         uint32_t size) {
+    uint32_t page[FLASH_PAGE_SIZE / sizeof(uint32_t)];
+    for (uint32_t off = 0; off < size; off += FLASH_SECTOR_SIZE) {
+        flash_range_erase(off, FLASH_SECTOR_SIZE);
+        for (uint32_t p = off; p < off + FLASH_SECTOR_SIZE;
+                p += FLASH_PAGE_SIZE) {
+            // Copy through a volatile pointer, so that the loop isn't replaced
+            // with a call to memcpy(), which may be located in flash.
+            uint32_t const volatile* s = (uint32_t const volatile*)(src + p);
+            for (uint i = 0; i < count_of(page); ++i) page[i] = s[i];
+            flash_range_program(p, (uint8_t const*)page, FLASH_PAGE_SIZE);
+        }
+    }
+
+    // Trigger a reset through the watchdog, like watchdog_reboot().
+    watchdog_hw->scratch[4] = 0;
+    psm_hw->wdsel = PSM_WDSEL_BITS
+                    & ~(PSM_WDSEL_ROSC_BITS | PSM_WDSEL_XOSC_BITS);
+    hw_set_bits(&watchdog_hw->ctrl, WATCHDOG_CTRL_TRIGGER_BITS);
+    for (;;) tight_loop_contents();
+}
+
+static int mod_install(lua_State* ls) {
+    MLuaBlockFlash* f = (MLuaBlockFlash*)mlua_block_check(ls, 1);
+    luaL_argexpected(ls, f->dev.read == &flash_dev_read, 1,
+                     "flash block device");
+    lua_Integer size = luaL_checkinteger(ls, 2);
+    luaL_argcheck(ls, size > 0 && (lua_Unsigned)size <= f->dev.size, 2,
+                  "invalid size");
+    uint32_t len = (size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
+    luaL_argcheck(ls, flash_offset(f, 0) >= len, 1,
+                  "overlaps the installed image");
+    if (!lua_isnoneornil(ls, 3)) {
+        uint32_t crc = ~mlua_bits_checksum(MLUA_CHECKSUM_CRC32, f->start, size,
+                                           0xffffffffu);
+        if (crc != (uint32_t)luaL_checkinteger(ls, 3)) {
+            return mlua_err_push(ls, MLUA_ECORRUPT);
+        }
+    }
+    if (get_core_num() != 0) return luaL_error(ls, "must run in core 0");
+    multicore_reset_core1();
+    save_and_disable_interrupts();
+    install_image(f->start, len);
+    return 0;
+}
+
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(new, mod_),
+    MLUA_SYM_F(install, mod_),
 };
 
 MLUA_OPEN_MODULE(mlua.block.flash) {
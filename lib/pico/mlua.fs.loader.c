@@ -8,12 +8,14 @@
 #include "pico/binary_info.h"
 #include "pico/platform.h"
 
+#include "lfs_util.h"
 #include "lua.h"
 #include "lauxlib.h"
 #include "mlua/errors.h"
 #include "mlua/block.flash.h"
 #include "mlua/fs.h"
 #include "mlua/fs.lfs.h"
+#include "mlua/int64.h"
 #include "mlua/module.h"
 #include "mlua/util.h"
 
@@ -29,6 +31,18 @@
 #ifndef MLUA_FS_LOADER_FLAT
 #define MLUA_FS_LOADER_FLAT 1
 #endif
+#ifndef MLUA_FS_LOADER_CHUNK_SIZE
+#define MLUA_FS_LOADER_CHUNK_SIZE (4 * FLASH_PAGE_SIZE)
+#endif
+#ifndef MLUA_FS_LOADER_BYTECODE
+#define MLUA_FS_LOADER_BYTECODE 1
+#endif
+#ifndef MLUA_FS_LOADER_BYTECODE_WRITE
+#define MLUA_FS_LOADER_BYTECODE_WRITE 0
+#endif
+#ifndef MLUA_FS_LOADER_BYTECODE_STRIP
+#define MLUA_FS_LOADER_BYTECODE_STRIP 0
+#endif
 
 static_assert(((MLUA_FS_LOADER_OFFSET) & (FLASH_SECTOR_SIZE - 1)) == 0,
               "MLUA_FS_LOADER_OFFSET must be a multiple of FLASH_SECTOR_SIZE");
@@ -38,6 +52,9 @@ static_assert(
     (MLUA_FS_LOADER_OFFSET) >= 0
     && ((MLUA_FS_LOADER_OFFSET) + (MLUA_FS_LOADER_SIZE) <= PICO_FLASH_SIZE_BYTES),
     "Filesystem is outside of flash boundaries");
+static_assert(
+    ((MLUA_FS_LOADER_CHUNK_SIZE) % FLASH_PAGE_SIZE) == 0,
+    "MLUA_FS_LOADER_CHUNK_SIZE must be a multiple of FLASH_PAGE_SIZE");
 
 bi_decl(bi_block_device(
     MLUA_BI_TAG, "lfs:loader",
@@ -60,17 +77,38 @@ static __attribute__((constructor)) void init(void) {
     mlua_fs_lfs_mount(fs);
 }
 
+// The buffers into which module files are read, one per core. Loading doesn't
+// yield, so a single buffer per core is sufficient. The size is a multiple of
+// the filesystem cache size, so that littlefs can read full blocks directly
+// into the buffer.
+static char load_buffers[NUM_CORES][MLUA_FS_LOADER_CHUNK_SIZE];
+
 typedef struct Loader {
-    void* buffer;
+    char* buffer;
     int file;
+    bool direct;
     lua_Integer err;
 } Loader;
 
+static void init_loader(lua_State* ls, Loader* l, int file) {
+    l->buffer = load_buffers[get_core_num()];
+    l->file = file;
+    l->direct = mlua_fs_lfs_is_file(ls, file);
+    l->err = MLUA_EOK;
+}
+
 static char const* load_block(lua_State* ls, void* buf, size_t* size) {
     Loader* l = buf;
+    if (l->direct) {  // Read directly from the littlefs file
+        lua_Integer res = mlua_fs_lfs_read(ls, l->file, l->buffer,
+                                           MLUA_FS_LOADER_CHUNK_SIZE);
+        if (res < 0) return l->err = res, NULL;
+        *size = res;
+        return l->buffer;
+    }
     lua_getfield(ls, l->file, "read");
     lua_pushvalue(ls, l->file);
-    lua_pushinteger(ls, sizeof(luaL_Buffer));
+    lua_pushinteger(ls, MLUA_FS_LOADER_CHUNK_SIZE);
     if (lua_pcall(ls, 2, 3, 0) != LUA_OK) {
         l->err = MLUA_EIO;
         return lua_pop(ls, 1), NULL;
@@ -84,6 +122,152 @@ static char const* load_block(lua_State* ls, void* buf, size_t* size) {
     return l->buffer;
 }
 
+#if MLUA_FS_LOADER_BYTECODE
+
+// Push a method of the object at index obj, followed by the object.
+static void push_method(lua_State* ls, int obj, char const* name) {
+    lua_getfield(ls, obj, name);
+    lua_pushvalue(ls, obj);
+}
+
+// The header of a bytecode file. It identifies the source from which the
+// bytecode was compiled by its size and CRC-32.
+#define BC_MAGIC "MLBC"
+#define BC_HEADER_SIZE 12
+
+static void encode_header(char* hdr, uint32_t const key[2]) {
+    memcpy(hdr, BC_MAGIC, 4);
+    for (int i = 0; i < 4; ++i) {
+        hdr[4 + i] = key[0] >> (8 * i);
+        hdr[8 + i] = key[1] >> (8 * i);
+    }
+}
+
+// Compute the key of the source file, by reading it completely, then rewind
+// it. Returns false on error.
+static bool source_key(lua_State* ls, Loader* l, uint32_t key[2]) {
+    uint32_t size = 0, crc = 0xffffffff;
+    for (;;) {
+        size_t len;
+        char const* data = load_block(ls, l, &len);
+        if (data == NULL) return false;
+        if (len == 0) break;
+        crc = lfs_crc(crc, data, len);
+        size += len;
+    }
+    push_method(ls, l->file, "rewind");
+    if (lua_pcall(ls, 1, 1, 0) != LUA_OK || !lua_toboolean(ls, -1)) {
+        l->err = MLUA_EIO;
+        return lua_pop(ls, 1), false;
+    }
+    lua_pop(ls, 1);
+    key[0] = size;
+    key[1] = crc ^ 0xffffffff;
+    return true;
+}
+
+// Open the bytecode file corresponding to the source path at index path, and
+// push it. Returns false if the file couldn't be opened.
+static bool open_bytecode(lua_State* ls, int fs_index, int path, int flags) {
+    push_method(ls, fs_index, "open");
+    lua_pushfstring(ls, "%sc", lua_tostring(ls, path));
+    lua_pushinteger(ls, flags);
+    if (lua_pcall(ls, 3, 1, 0) != LUA_OK || !lua_toboolean(ls, -1)) {
+        return lua_pop(ls, 1), false;
+    }
+    return true;
+}
+
+// Return true iff the bytecode file corresponding to the source path at index
+// path exists.
+static bool bytecode_exists(lua_State* ls, int fs_index, int path) {
+    push_method(ls, fs_index, "stat");
+    lua_pushfstring(ls, "%sc", lua_tostring(ls, path));
+    bool ok = lua_pcall(ls, 2, 1, 0) == LUA_OK && lua_toboolean(ls, -1);
+    lua_pop(ls, 1);
+    return ok;
+}
+
+// Load the bytecode file for the source whose key is given. On success, leave
+// the loaded function at the top of the stack, above the open bytecode file,
+// which is closed when the searcher returns. Returns false, with the stack
+// unchanged, if the bytecode file doesn't exist, doesn't match the source or
+// cannot be loaded.
+static bool load_bytecode(lua_State* ls, int fs_index, int path, int chunkname,
+                          uint32_t const key[2]) {
+    int top = lua_gettop(ls);
+    if (!open_bytecode(ls, fs_index, path, MLUA_FS_O_RDONLY)) return false;
+    lua_toclose(ls, top + 1);
+    push_method(ls, top + 1, "read");
+    lua_pushinteger(ls, BC_HEADER_SIZE);
+    if (lua_pcall(ls, 2, 1, 0) != LUA_OK) return lua_settop(ls, top), false;
+    char hdr[BC_HEADER_SIZE];
+    encode_header(hdr, key);
+    size_t len;
+    char const* got = lua_tolstring(ls, -1, &len);
+    if (got == NULL || len != BC_HEADER_SIZE
+            || memcmp(got, hdr, BC_HEADER_SIZE) != 0) {
+        return lua_settop(ls, top), false;
+    }
+    lua_pop(ls, 1);
+    Loader l;
+    init_loader(ls, &l, top + 1);
+    if (lua_load(ls, &load_block, &l, lua_tostring(ls, chunkname), "b")
+            != LUA_OK || l.err != MLUA_EOK) {
+        return lua_settop(ls, top), false;
+    }
+    return true;
+}
+
+#if MLUA_FS_LOADER_BYTECODE_WRITE
+
+typedef struct Writer {
+    int file;
+} Writer;
+
+static int dump_block(lua_State* ls, void const* p, size_t size, void* ud) {
+    Writer* w = ud;
+    push_method(ls, w->file, "write");
+    lua_pushlstring(ls, p, size);
+    bool ok = lua_pcall(ls, 2, 1, 0) == LUA_OK && lua_toboolean(ls, -1);
+    lua_pop(ls, 1);
+    return ok ? 0 : 1;
+}
+
+// Write the bytecode of the function at the top of the stack to the bytecode
+// file for the source whose key is given. Errors are ignored, and incomplete
+// files are removed.
+static void store_bytecode(lua_State* ls, int fs_index, int path,
+                           uint32_t const key[2]) {
+    int top = lua_gettop(ls);
+    if (!open_bytecode(ls, fs_index, path,
+                       MLUA_FS_O_WRONLY | MLUA_FS_O_CREAT | MLUA_FS_O_TRUNC)) {
+        return;
+    }
+    int file = top + 1;
+    Writer w = {.file = file};
+    char hdr[BC_HEADER_SIZE];
+    encode_header(hdr, key);
+    bool ok = dump_block(ls, hdr, BC_HEADER_SIZE, &w) == 0;
+    if (ok) {
+        lua_pushvalue(ls, top);
+        ok = lua_dump(ls, &dump_block, &w, MLUA_FS_LOADER_BYTECODE_STRIP) == 0;
+        lua_pop(ls, 1);
+    }
+    push_method(ls, file, "close");
+    ok = lua_pcall(ls, 1, 1, 0) == LUA_OK && lua_toboolean(ls, -1) && ok;
+    lua_pop(ls, 1);
+    if (!ok) {
+        push_method(ls, fs_index, "remove");
+        lua_pushfstring(ls, "%sc", lua_tostring(ls, path));
+        lua_pcall(ls, 2, 0, 0);
+    }
+    lua_settop(ls, top);
+}
+
+#endif  // MLUA_FS_LOADER_BYTECODE_WRITE
+#endif  // MLUA_FS_LOADER_BYTECODE
+
 static int mod_search(lua_State* ls) {
     size_t len;
     char const* mod = luaL_checklstring(ls, 1, &len);
@@ -145,9 +329,30 @@ static int mod_search(lua_State* ls) {
         path = sep + 1;
     }
 
-    // Load the module from the file. Re-use buf as a data buffer.
-    Loader l = {.buffer = &buf, .file = fs_index + 1, .err = MLUA_EOK};
+    // Load the module from the file.
+    Loader l;
+    init_loader(ls, &l, fs_index + 1);
     lua_pushfstring(ls, "@%s", lua_tostring(ls, fs_index + 2));
+#if MLUA_FS_LOADER_BYTECODE
+    // Try loading pre-compiled bytecode. The source is only read to compute
+    // its key if there is a bytecode file, or if one will be written.
+    uint32_t key[2];
+    bool keyed = false;
+    if (MLUA_FS_LOADER_BYTECODE_WRITE
+            || bytecode_exists(ls, fs_index, fs_index + 2)) {
+        keyed = source_key(ls, &l, key);
+        if (l.err != MLUA_EOK) {
+            return lua_pushfstring(ls, "%s: %s",
+                                   lua_tostring(ls, fs_index + 2),
+                                   mlua_err_msg(l.err)), 1;
+        }
+        if (keyed && load_bytecode(ls, fs_index, fs_index + 2, fs_index + 3,
+                                   key)) {
+            lua_pushvalue(ls, fs_index + 2);
+            return 2;
+        }
+    }
+#endif
     if (lua_load(ls, &load_block, &l, lua_tostring(ls, -1), NULL) != LUA_OK) {
         return 1;
     } else if (l.err != MLUA_EOK) {
@@ -155,16 +360,94 @@ static int mod_search(lua_State* ls) {
         return lua_pushfstring(ls, "%s: %s", lua_tostring(ls, fs_index + 2),
                                mlua_err_msg(l.err)), 1;
     }
+#if MLUA_FS_LOADER_BYTECODE && MLUA_FS_LOADER_BYTECODE_WRITE
+    if (keyed) store_bytecode(ls, fs_index, fs_index + 2, key);
+#endif
     lua_pushvalue(ls, fs_index + 2);
     return 2;
 }
 
+static char const Mapping_name[] = "mlua.fs.loader.Mapping";
+
+// A read-only view of the content of a file, mapped from flash through XIP.
+typedef struct Mapping {
+    void const* ptr;
+    size_t size;
+} Mapping;
+
+static inline Mapping* check_Mapping(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Mapping_name);
+}
+
+static int Mapping_ptr(lua_State* ls) {
+    return lua_pushlightuserdata(ls, (void*)check_Mapping(ls, 1)->ptr), 1;
+}
+
+static int Mapping___len(lua_State* ls) {
+    return lua_pushinteger(ls, check_Mapping(ls, 1)->size), 1;
+}
+
+static int Mapping___buffer(lua_State* ls) {
+    Mapping* m = check_Mapping(ls, 1);
+    lua_pushlightuserdata(ls, (void*)m->ptr);
+    lua_pushinteger(ls, m->size);
+    return 2;
+}
+
+MLUA_SYMBOLS(Mapping_syms) = {
+    MLUA_SYM_F(ptr, Mapping_),
+};
+
+MLUA_SYMBOLS_NOHASH(Mapping_syms_nh) = {
+    MLUA_SYM_F_NH(__len, Mapping_),
+    MLUA_SYM_F_NH(__buffer, Mapping_),
+};
+
+static int mod_map(lua_State* ls) {
+    luaL_checkstring(ls, 1);
+    if (fs == NULL) return mlua_err_push(ls, MLUA_ENOTCONN);
+    lua_settop(ls, 1);
+
+    // Open the file.
+    mlua_fs_lfs_push(ls, fs);
+    lua_getfield(ls, 2, "open");
+    lua_pushvalue(ls, 2);
+    lua_pushvalue(ls, 1);
+    lua_pushinteger(ls, MLUA_FS_O_RDONLY);
+    lua_call(ls, 3, 3);
+    if (!lua_toboolean(ls, -3)) return 3;
+    lua_pop(ls, 2);
+    lua_toclose(ls, 3);
+
+    // Get the location of its content on the block device.
+    lua_getfield(ls, 3, "extent");
+    lua_pushvalue(ls, 3);
+    lua_call(ls, 1, 3);
+    if (!lua_toboolean(ls, -3)) return 3;
+    uint64_t off = mlua_check_int64(ls, -3);
+    size_t size = lua_tointeger(ls, -2);
+
+    Mapping* m = lua_newuserdatauv(ls, sizeof(Mapping), 0);
+    m->ptr = dev.start + off;
+    m->size = size;
+    luaL_getmetatable(ls, Mapping_name);
+    lua_setmetatable(ls, -2);
+    return 1;
+}
+
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(block, boolean, false),
     MLUA_SYM_V(fs, boolean, false),
+    MLUA_SYM_F(map, mod_),
 };
 
 MLUA_OPEN_MODULE(mlua.fs.loader) {
+    mlua_require(ls, "mlua.int64", false);
+
+    // Create the Mapping class.
+    mlua_new_class(ls, Mapping_name, Mapping_syms, Mapping_syms_nh);
+    lua_pop(ls, 1);
+
     // Create the module.
     mlua_new_module(ls, 0, module_syms);
     int mod_index = lua_gettop(ls);
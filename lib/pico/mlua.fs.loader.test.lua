@@ -3,8 +3,11 @@
 
 _ENV = module(...)
 
+local bits = require 'mlua.bits'
+local errors = require 'mlua.errors'
 local fs = require 'mlua.fs'
 local loader = require 'mlua.fs.loader'
+local mem = require 'mlua.mem'
 local package = require 'package'
 local multicore = require 'pico.multicore'
 local fifo = require 'pico.multicore.fifo'
@@ -66,6 +69,49 @@ function test_loading(t)
         :raises("\t/invalid%.lua:1: syntax error")
 end
 
+function test_bytecode(t)
+    local path = package.path
+    local name = prefix .. '.bc'
+    t:cleanup(function()
+        package.loaded[name] = nil
+        package.path = path
+    end)
+    package.path = '/lua/?.lua'
+
+    local src = '_ENV = module(...)\nvalue = "source"\n'
+    local bc = string.dump(load('_ENV = module(...)\nvalue = "bytecode"\n'))
+    local lua_path = ('/lua/%s.lua'):format(name)
+    write_file(loader.fs, lua_path, src)
+    write_file(loader.fs, lua_path .. 'c',
+               string.pack('<c4I4I4', 'MLBC', #src, bits.crc32(src)) .. bc)
+    local m, p = require(name)
+    t:expect(t.expr(m).value):eq('bytecode')
+    t:expect(p):label("path"):eq(lua_path)
+
+    -- Bytecode that doesn't match the source is ignored.
+    package.loaded[name] = nil
+    write_file(loader.fs, lua_path, src .. '\n')
+    t:expect(t.expr(require(name)).value):eq('source')
+end
+
+function test_map(t)
+    local data = ('0123456789'):rep(300)
+    write_file(loader.fs, '/data.bin', data)
+    local m = loader.map('/data.bin')
+    t:expect(#m):label("#m"):eq(#data)
+    t:expect(t.expr(mem).read(m)):eq(data)
+    t:expect(t.expr(mem).find(m, '9012')):eq(9)
+
+    write_file(loader.fs, '/small.bin', 'abc')
+    t:expect(t.mexpr(loader).map('/small.bin'))
+        :eq{nil, errors.message(errors.ENODATA), errors.ENODATA}
+    write_file(loader.fs, '/big.bin', data:rep(2))
+    t:expect(t.mexpr(loader).map('/big.bin'))
+        :eq{nil, errors.message(errors.EFBIG), errors.EFBIG}
+    t:expect(t.mexpr(loader).map('/missing'))
+        :eq{nil, errors.message(errors.ENOENT), errors.ENOENT}
+end
+
 function test_loading_multicore(t)
     write_file(loader.fs, ('/lua/%s.c.lua'):format(prefix), [[
         _ENV = module(...)
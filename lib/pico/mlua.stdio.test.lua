@@ -7,7 +7,10 @@ local io = require 'mlua.io'
 local list = require 'mlua.list'
 local repr = require 'mlua.repr'
 local stdio = require 'mlua.stdio'
+local time = require 'mlua.time'
 local testing_stdio = require 'mlua.testing.stdio'
+local pico_stdio = require 'pico.stdio'
+local string = require 'string'
 
 function test_streams_BNB(t)
     for _, test in ipairs{
@@ -32,6 +35,54 @@ function test_streams_BNB(t)
     end
 end
 
+-- Return the characters that have been written to the loopback so far.
+local function drain()
+    local got = ''
+    while true do
+        local c = pico_stdio.getchar_timeout_us(1000)
+        if c < 0 then return got end
+        got = got .. string.char(c)
+    end
+end
+
+function test_buffered_BNB(t)
+    local got = {}
+    local function log(...)
+        for _, v in ipairs{...} do got[#got + 1] = v end
+    end
+    t:expect(pcall(function()  -- No output in this block
+        local done<close> = testing_stdio.enable_loopback(t, false)
+        local s = stdio.stderr
+        local reset<close> = function() s:setvbuf('no') end
+        s:setvbuf('full', 8)
+        log(s:write('abc'), s:write('def'), drain())
+        log(s:write('gh'), drain())
+        s:flush()
+        log(drain(), s:write('0123456789'), drain())
+        s:setvbuf('line')
+        log(s:write('ab'), drain(), s:write('c\nd'), drain())
+        s:setvbuf('no')
+        log(drain())
+    end))
+    t:expect(got):label("got"):eq{3, 3, '', 2, '', 'abcdefgh', 10,
+                                  '0123456789', 2, '', 3, 'abc\nd', ''}
+end
+
+function test_buffered_idle(t)
+    local got = {}
+    t:expect(pcall(function()  -- No output in this block
+        local done<close> = testing_stdio.enable_loopback(t, false)
+        local s = stdio.stderr
+        local reset<close> = function() s:setvbuf('no') end
+        s:setvbuf('full', 64, 2000)
+        s:write('xyz')
+        got[1] = drain()
+        time.sleep_for(5000)
+        got[2] = drain()
+    end))
+    t:expect(got):label("got"):eq{'', 'xyz'}
+end
+
 function test_print(t)
     local r = t:patch(_G, 'stdout', io.Recorder())
 
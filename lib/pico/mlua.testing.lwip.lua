@@ -67,6 +67,7 @@ function Control:__init(t, atype)
     self.sock = lwip.assert(tcp.new())
     t:cleanup(function() self.sock:close() end)
     lwip.assert(self.sock:connect(self.addr, config.SERVER_PORT, dl))
+    self.reader = io.BufferedReader(self.sock)
     local line = self:recv(dl)
     local port = line:match('^PORT ([0-9]+)\n$')
     t:assert(port, "Unexpected PORT line: @{+WHITE}%s@{NORM}", t:repr(line))
@@ -78,7 +79,7 @@ function Control:send(dl, fmt, ...)
 end
 
 function Control:recv(dl)
-    return lwip.assert(io.read_line(self.sock, dl))
+    return lwip.assert(self.reader:read_line(dl))
 end
 
 if not testing.overrides[...] then
@@ -0,0 +1,115 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "pico/platform.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/int64.h"
+#include "mlua/module.h"
+#include "mlua/platform.h"
+#include "mlua/thread.h"
+#include "mlua/util.h"
+
+// The default time budget per dispatch of the servicing thread, in
+// microseconds.
+#ifndef MLUA_ASYNC_CONTEXT_BUDGET
+#define MLUA_ASYNC_CONTEXT_BUDGET 2000
+#endif
+
+#if MLUA_ASYNC_CONTEXT_POLL
+
+static MLuaEvent service_event;
+static uint32_t service_budget;
+
+static void __time_critical_func(notify_service)(void) {
+    mlua_event_set(&service_event);
+}
+
+static int handle_service_event(lua_State* ls) {
+    // If work remains after the budget has elapsed, set the event again, so
+    // that other threads get to run before servicing continues.
+    if (mlua_async_context_service(service_budget)) {
+        mlua_event_set(&service_event);
+    }
+    return 0;
+}
+
+static int service_done(lua_State* ls) {
+    mlua_async_context_set_notify(NULL);
+    mlua_event_disable(ls, &service_event);
+    return 0;
+}
+
+static int mod_service(lua_State* ls) {
+    lua_Unsigned priority = luaL_optinteger(ls, 1, 0);
+    luaL_argcheck(ls, priority < MLUA_EVENT_PRIORITIES, 1, "invalid priority");
+    lua_Integer budget = luaL_optinteger(ls, 2, MLUA_ASYNC_CONTEXT_BUDGET);
+    luaL_argcheck(ls, budget > 0 && budget <= UINT32_MAX / 2, 2,
+                  "invalid budget");
+    mlua_async_context();
+    if ((int)get_core_num() != mlua_async_context_core()) {
+        return luaL_error(ls, "async context: runs on core %d",
+                          mlua_async_context_core());
+    }
+    if (!mlua_event_enable_priority(ls, &service_event, priority)) {
+        return luaL_error(ls, "async context: already serviced");
+    }
+    service_budget = budget;
+    mlua_async_context_set_notify(&notify_service);
+    mlua_event_set(&service_event);  // Process the work that is already pending
+
+    // Start the event handler thread.
+    lua_pushcfunction(ls, &handle_service_event);
+    lua_pushcfunction(ls, &service_done);
+    return mlua_event_handle(ls, &service_event, &mlua_cont_return, 1);
+}
+
+#define SET_STAT(name) \
+    mlua_push_minint(ls, st.name); \
+    lua_setfield(ls, -2, #name)
+
+static int mod_stats(lua_State* ls) {
+    bool reset = mlua_to_cbool(ls, 1);
+    MLuaAsyncContextStats st;
+    mlua_async_context_stats(&st, reset);
+    lua_createtable(ls, 0, 6);
+    SET_STAT(services);
+    SET_STAT(rounds);
+    SET_STAT(overruns);
+    SET_STAT(latency_total);
+    SET_STAT(latency_max);
+    SET_STAT(service_max);
+    return 1;
+}
+
+#endif  // MLUA_ASYNC_CONTEXT_POLL
+
+static int mod_core(lua_State* ls) {
+    int core = mlua_async_context_core();
+    if (core < 0) return 0;
+    return lua_pushinteger(ls, core), 1;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_V(POLL, boolean, MLUA_ASYNC_CONTEXT_POLL),
+
+    MLUA_SYM_F(core, mod_),
+#if MLUA_ASYNC_CONTEXT_POLL
+    MLUA_SYM_F(service, mod_),
+    MLUA_SYM_F(stats, mod_),
+#else
+    MLUA_SYM_V(service, boolean, false),
+    MLUA_SYM_V(stats, boolean, false),
+#endif
+};
+
+MLUA_OPEN_MODULE(pico.async_context) {
+    mlua_thread_require(ls);
+
+    mlua_new_module(ls, 0, module_syms);
+    return 1;
+}
@@ -0,0 +1,31 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local async_context = require 'pico.async_context'
+local thread = require 'mlua.thread'
+
+function test_service(t)
+    if not async_context.POLL then
+        t:expect(async_context.service):label("service"):eq(false)
+        t:expect(async_context.stats):label("stats"):eq(false)
+        return
+    end
+    local th<close> = async_context.service()
+    t:expect(async_context.core()):label("core"):neq(nil)
+    thread.yield()
+    local st = async_context.stats(true)
+    t:expect(st.services):label("services"):gte(1)
+    t:expect(st.rounds):label("rounds"):gte(st.services)
+    t:expect(st.overruns):label("overruns"):eq(0)
+    t:expect(t.expr(async_context).service())
+        :raises("async context: already serviced")
+
+    -- Servicing can be restarted after killing the thread.
+    th:kill()
+    local th2<close> = async_context.service()
+    thread.yield()
+    st = async_context.stats()
+    t:expect(st.services):label("services"):gte(1)
+end
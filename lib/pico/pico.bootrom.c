@@ -39,7 +39,7 @@ int mod_data_lookup(lua_State* ls) {
     return rom_lookup(ls, &rom_data_lookup);
 }
 
-MLUA_FUNC_V2(mod_,, reset_usb_boot, luaL_checkinteger, luaL_checkinteger)
+MLUA_FUNC_V2(mod_,, reset_usb_boot, mlua_arg_integer, mlua_arg_integer)
 
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(START, lightuserdata, (void*)(uintptr_t)0x00000000),
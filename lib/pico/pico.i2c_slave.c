@@ -5,6 +5,8 @@
 #include <stdint.h>
 
 #include "hardware/i2c.h"
+#include "hardware/irq.h"
+#include "hardware/sync.h"
 
 #include "mlua/hardware.i2c.h"
 #include "mlua/module.h"
@@ -74,8 +76,182 @@ static int mod_run(lua_State* ls) {
                              &mlua_cont_return, 1);
 }
 
+// The number of completed accesses that can be queued for notification.
+#ifndef MLUA_I2C_SLAVE_ACCESSES
+#define MLUA_I2C_SLAVE_ACCESSES 8
+#endif
+
+// A register access, i.e. a contiguous sequence of reads or writes.
+typedef struct Access {
+    uint16_t start;
+    uint16_t count;
+    bool write;
+} Access;
+
+// The state of a register-file slave. The register map is served entirely
+// from the IRQ handler: the first byte written after the address phase sets
+// the register address, subsequent bytes are written to the registers, and
+// reads return the registers. The address auto-increments and wraps around at
+// the end of the register map. Completed accesses are queued, and the event
+// handler notifies Lua once per access.
+typedef struct RegSlave {
+    uint8_t* regs;
+    uint16_t size;
+    uint16_t addr;
+    Access cur;
+    uint8_t head, tail;
+    uint32_t dropped;
+    Access done[MLUA_I2C_SLAVE_ACCESSES];
+} RegSlave;
+
+static RegSlave reg_slaves[NUM_I2CS];
+
+static void __time_critical_func(end_access)(RegSlave* s) {
+    if (s->cur.count == 0) return;
+    uint8_t next = (s->head + 1) % MLUA_I2C_SLAVE_ACCESSES;
+    if (next != s->tail) {
+        s->done[s->head] = s->cur;
+        s->head = next;
+    } else {
+        ++s->dropped;
+    }
+    s->cur.count = 0;
+}
+
+static void __time_critical_func(start_access)(RegSlave* s, bool write) {
+    if (s->cur.count != 0 && s->cur.write == write) return;
+    end_access(s);
+    s->cur.start = s->addr;
+    s->cur.write = write;
+}
+
+static void __time_critical_func(handle_reg_slave_irq)(void) {
+    uint num = __get_current_exception() - VTABLE_FIRST_IRQ - I2C0_IRQ;
+    i2c_hw_t* hw = i2c_get_hw(i2c_get_instance(num));
+    RegSlave* s = &reg_slaves[num];
+    uint8_t head = s->head;
+
+    // Handle writes.
+    while ((hw->raw_intr_stat & I2C_IC_RAW_INTR_STAT_RX_FULL_BITS) != 0) {
+        uint32_t dc = hw->data_cmd;
+        if ((dc & I2C_IC_DATA_CMD_FIRST_DATA_BYTE_BITS) != 0) {
+            end_access(s);
+            s->addr = (dc & 0xff) % s->size;
+            continue;
+        }
+        start_access(s, true);
+        s->regs[s->addr] = dc & 0xff;
+        s->addr = (s->addr + 1) % s->size;
+        ++s->cur.count;
+    }
+
+    // Handle read requests.
+    uint32_t stat = hw->intr_stat;
+    if ((stat & I2C_IC_INTR_STAT_R_RD_REQ_BITS) != 0) {
+        start_access(s, false);
+        hw->data_cmd = s->regs[s->addr];
+        hw->clr_rd_req;
+        s->addr = (s->addr + 1) % s->size;
+        ++s->cur.count;
+    }
+    if ((stat & I2C_IC_INTR_STAT_R_TX_ABRT_BITS) != 0) hw->clr_tx_abrt;
+
+    // Complete the access at the end of the transaction.
+    if ((stat & I2C_IC_INTR_STAT_R_STOP_DET_BITS) != 0) {
+        hw->clr_stop_det;
+        end_access(s);
+    }
+    if (s->head != head) mlua_event_set(&mlua_i2c_state[num].event);
+}
+
+static int handle_reg_slave_event_1(lua_State* ls, int status,
+                                    lua_KContext ctx);
+
+static int handle_reg_slave_event(lua_State* ls) {
+    return handle_reg_slave_event_1(ls, LUA_OK, 0);
+}
+
+static int handle_reg_slave_event_1(lua_State* ls, int status,
+                                    lua_KContext ctx) {
+    RegSlave* s = &reg_slaves[i2c_hw_index(
+        mlua_to_I2C(ls, lua_upvalueindex(1)))];
+    for (;;) {
+        uint32_t save = save_and_disable_interrupts();
+        bool empty = s->tail == s->head;
+        Access a = s->done[s->tail];
+        if (!empty) s->tail = (s->tail + 1) % MLUA_I2C_SLAVE_ACCESSES;
+        restore_interrupts(save);
+        if (empty) return 0;
+        lua_pushvalue(ls, lua_upvalueindex(2));  // on_access
+        lua_pushvalue(ls, lua_upvalueindex(1));  // inst
+        lua_pushboolean(ls, a.write);
+        lua_pushinteger(ls, a.start);
+        lua_pushinteger(ls, a.count);
+        lua_callk(ls, 4, 0, 0, &handle_reg_slave_event_1);
+    }
+}
+
+static int reg_slave_handler_done(lua_State* ls) {
+    i2c_inst_t* inst = mlua_to_I2C(ls, lua_upvalueindex(1));
+    uint num = i2c_hw_index(inst);
+    i2c_get_hw(inst)->intr_mask = 0;
+    i2c_set_slave_mode(inst, false, 0);
+    lua_pushboolean(ls, false);
+    mlua_event_enable_irq(ls, &mlua_i2c_state[num].event, I2C0_IRQ + num,
+                          &handle_reg_slave_irq, -1, -1);
+    reg_slaves[num].regs = NULL;
+    return 0;
+}
+
+static int mod_serve(lua_State* ls) {
+    i2c_inst_t* inst = mlua_check_I2C(ls, 1);
+    uint num = i2c_hw_index(inst);
+    uint16_t address = luaL_checkinteger(ls, 2);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 3, &buf) && buf.vt == NULL
+                         && buf.size != SIZE_MAX, 3, "raw buffer");
+    luaL_argcheck(ls, buf.size > 0 && buf.size <= 256, 3,
+                  "invalid register map size");
+
+    // Set up the slave state, then enable the IRQ.
+    RegSlave* s = &reg_slaves[num];
+    *s = (RegSlave){.regs = buf.ptr, .size = buf.size};
+    i2c_hw_t* hw = i2c_get_hw(inst);
+    hw->intr_mask = 0;
+    if (!mlua_event_enable_irq(ls, &mlua_i2c_state[num].event, I2C0_IRQ + num,
+                               &handle_reg_slave_irq, 5, -1)) {
+        return luaL_error(ls, "I2C%d: IRQ already enabled", num);
+    }
+    i2c_set_slave_mode(inst, true, address);
+    hw->intr_mask = I2C_IC_INTR_MASK_M_RX_FULL_BITS
+                    | I2C_IC_INTR_MASK_M_RD_REQ_BITS
+                    | I2C_IC_INTR_MASK_M_TX_ABRT_BITS
+                    | I2C_IC_INTR_MASK_M_STOP_DET_BITS;
+
+    // Start the event handler thread. The register map is kept alive by the
+    // handler closure.
+    lua_pushvalue(ls, 1);  // inst
+    lua_pushvalue(ls, 4);  // on_access
+    lua_pushvalue(ls, 3);  // regs
+    lua_pushcclosure(ls, &handle_reg_slave_event, 3);
+    lua_pushvalue(ls, 1);  // inst
+    lua_pushcclosure(ls, &reg_slave_handler_done, 1);
+    return mlua_event_handle(ls, &mlua_i2c_state[num].event,
+                             &mlua_cont_return, 1);
+}
+
+static int mod_dropped(lua_State* ls) {
+    uint num = i2c_hw_index(mlua_check_I2C(ls, 1));
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t dropped = reg_slaves[num].dropped;
+    restore_interrupts(save);
+    return lua_pushinteger(ls, dropped), 1;
+}
+
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(run, mod_),
+    MLUA_SYM_F(serve, mod_),
+    MLUA_SYM_F(dropped, mod_),
 };
 
 MLUA_OPEN_MODULE(pico.i2c_slave) {
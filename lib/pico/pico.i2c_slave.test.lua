@@ -4,6 +4,10 @@
 _ENV = module(...)
 
 local config = require 'mlua.config'
+local array = require 'mlua.array'
+local list = require 'mlua.list'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
 local testing_i2c = require 'mlua.testing.i2c'
 local i2c_slave = require 'pico.i2c_slave'
 
@@ -28,3 +32,39 @@ function test_slave(t)
         :eq('hijklmnopqrstuvwxyz012345')
     t:expect(t.expr(master):read_blocking(slave_addr, 7, false)):eq('abcdefg')
 end
+
+function test_serve(t)
+    local slave_addr = 0x17
+    local master, slave = testing_i2c.set_up(
+        t, 1000000, config.I2C_MASTER_SDA, config.I2C_MASTER_SCL,
+        config.I2C_SLAVE_SDA, config.I2C_SLAVE_SCL)
+    master:enable_irq()
+    t:cleanup(function() master:enable_irq(false) end)
+    local regs = array('B', 16)
+    for i = 1, 16 do regs:set(i, 0x40 + i) end
+    local accesses = list()
+    local th = i2c_slave.serve(slave, slave_addr, regs,
+                               function(inst, write, start, count)
+        accesses:append(('%s %d %d'):format(write, start, count))
+    end)
+    t:cleanup(function() th:kill() end)
+    t:expect(t.expr(slave):enable_irq()):raises("IRQ already enabled")
+
+    -- Write registers, wrapping around at the end of the register map.
+    t:expect(t.expr(master):write_blocking(slave_addr, '\x0e\x01\x02\x03',
+                                           false)):eq(4)
+    t:expect(t.expr(master):write_blocking(slave_addr, '\x03', true)):eq(1)
+    t:expect(t.expr(master):read_blocking(slave_addr, 4, false))
+        :eq('DEFG')
+    t:expect(t.expr(master):write_blocking(slave_addr, '\x0e', true)):eq(1)
+    t:expect(t.expr(master):read_blocking(slave_addr, 3, false))
+        :eq('\x01\x02\x03')
+    t:expect(t.mexpr(regs):get(15, 2)):eq{1, 2}
+    t:expect(t.expr(regs):get(1)):eq(3)
+
+    -- Wait for the notifications.
+    local deadline = time.deadline(100000)
+    while #accesses < 3 and time.ticks() < deadline do thread.yield() end
+    t:expect(accesses):eq(list{'true 14 3', 'false 3 4', 'false 14 3'})
+    t:expect(t.expr(i2c_slave).dropped(slave)):eq(0)
+end
@@ -6,6 +6,7 @@
 #include <string.h>
 
 #include "hardware/structs/sio.h"
+#include "pico/flash.h"
 #include "pico/multicore.h"
 #include "pico/platform.h"
 
@@ -16,6 +17,14 @@
 #include "mlua/thread.h"
 #include "mlua/util.h"
 
+// When set to 1, interpreters in core 1 are set up as lockout victims for
+// pico_flash, so that the other core can write to flash while they run. This
+// claims the SIO IRQ of core 1, so pico.multicore.fifo.enable_irq() cannot be
+// used in core 1.
+#ifndef MLUA_MULTICORE_FLASH_SAFE
+#define MLUA_MULTICORE_FLASH_SAFE 0
+#endif
+
 // TODO: Allow passing arguments to and returning results from main() on core 1
 
 typedef struct CoreState {
@@ -27,6 +36,13 @@ typedef struct CoreState {
 
 static CoreState core_state[NUM_CORES - 1];
 
+// Override the weak definition in mlua.block.flash, so that flash writes fail
+// while core 1 runs an interpreter that isn't a lockout victim.
+bool mlua_block_flash_core_running(uint core) {
+    if (core == 0) return true;
+    return mlua_event_enabled(&core_state[core - 1].shutdown_event);
+}
+
 static int find_main(lua_State* ls) {
     lua_getglobal(ls, "require");
     lua_pushvalue(ls, lua_upvalueindex(1));
@@ -39,7 +55,13 @@ static int find_main(lua_State* ls) {
 static void launch_core(void) {
     CoreState* st = &core_state[get_core_num() - 1];
     lua_State* ls = st->ls;
+#if MLUA_MULTICORE_FLASH_SAFE
+    flash_safe_execute_core_init();
+#endif
     mlua_run_main(ls, 0, 0, 0);
+#if MLUA_MULTICORE_FLASH_SAFE
+    flash_safe_execute_core_deinit();
+#endif
     // TODO: The event should be disabled after closing the lua_State,
     //       otherwise the core could be reset before the state can be closed.
     mlua_event_disable(ls, &st->shutdown_event);
@@ -55,10 +77,15 @@ static int mod_launch_core1(lua_State* ls) {
     size_t mlen, flen;
     char const* module = luaL_checklstring(ls, 1, &mlen);
     char const* fn = luaL_optlstring(ls, 2, "main", &flen);
+    lua_Integer heap_size = luaL_optinteger(ls, 3, MLUA_HEAP_SIZE);
+    luaL_argcheck(ls, heap_size >= 0, 3, "invalid heap size");
+    MLuaGCProfile gc = mlua_gc_default_profile;
+    if (!lua_isnoneornil(ls, 4)) mlua_check_gc_profile(ls, 4, &gc);
 
     // Create a new interpreter.
-    lua_State* ls1 = mlua_new_interpreter();
+    lua_State* ls1 = mlua_new_interpreter_heap(heap_size);
     if (ls1 == NULL) return luaL_error(ls, "interpreter creation failed");
+    mlua_set_gc_profile(ls1, &gc);
 
     // Set up the shutdown request event.
     CoreState* st = &core_state[core - 1];
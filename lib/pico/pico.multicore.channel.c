@@ -0,0 +1,304 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "pico/platform.h"
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/int64.h"
+#include "mlua/module.h"
+#include "mlua/platform.h"
+#include "mlua/thread.h"
+#include "mlua/util.h"
+
+// The size of the message ring in each direction, in bytes. Must be a power of
+// two.
+#ifndef MLUA_MULTICORE_CHANNEL_SIZE
+#define MLUA_MULTICORE_CHANNEL_SIZE 4096
+#endif
+
+static_assert((MLUA_MULTICORE_CHANNEL_SIZE
+               & (MLUA_MULTICORE_CHANNEL_SIZE - 1)) == 0,
+              "MLUA_MULTICORE_CHANNEL_SIZE must be a power of two");
+
+// The size of the message header.
+#define HEADER_SIZE 2
+
+// The header flag marking a buffer handoff message.
+#define HEADER_BUFFER 0x8000u
+
+// The maximum size of a single message.
+#define MAX_SIZE (MLUA_MULTICORE_CHANNEL_SIZE - HEADER_SIZE < HEADER_BUFFER \
+                  ? MLUA_MULTICORE_CHANNEL_SIZE - HEADER_SIZE \
+                  : HEADER_BUFFER - 1)
+
+// A single-producer, single-consumer ring of messages from one core to the
+// other. Each message is stored as a 16-bit little-endian header followed by
+// the message data, and can wrap around the end of the ring. The header holds
+// the length of the data, and the HEADER_BUFFER flag for buffer handoffs, whose
+// data is a BufferHandoff. "head" and "tail" are free-running byte counters,
+// respectively written only by the receiver and the sender. The sender sets
+// recv_event after appending a message, and the receiver sets send_event after
+// removing one.
+typedef struct Ring {
+    uint8_t data[MLUA_MULTICORE_CHANNEL_SIZE];
+    uint32_t volatile head;
+    uint32_t volatile tail;
+    MLuaEvent recv_event;
+    MLuaEvent send_event;
+} Ring;
+
+// A buffer whose memory is allocated outside of the Lua heap, with an allocator
+// that can be used from both cores. The memory can be handed off to the other
+// core without copying; the sending buffer then loses access to it.
+typedef struct Buffer {
+    void* ptr;
+    size_t size;
+} Buffer;
+
+// The data of a buffer handoff message.
+typedef struct BufferHandoff {
+    void* ptr;
+    size_t size;
+} BufferHandoff;
+
+static char const Buffer_name[] = "pico.multicore.channel.Buffer";
+
+// The rings, indexed by sending core.
+static Ring rings[NUM_CORES];
+
+static inline Ring* send_ring(void) { return &rings[get_core_num()]; }
+static inline Ring* recv_ring(void) { return &rings[get_core_num() ^ 1]; }
+
+static void copy_in(Ring* r, uint32_t pos, void const* src, uint32_t len) {
+    uint32_t off = pos & (MLUA_MULTICORE_CHANNEL_SIZE - 1);
+    uint32_t n = MLUA_MULTICORE_CHANNEL_SIZE - off;
+    if (n > len) n = len;
+    memcpy(&r->data[off], src, n);
+    memcpy(&r->data[0], (uint8_t const*)src + n, len - n);
+}
+
+static void copy_out(Ring* r, uint32_t pos, void* dst, uint32_t len) {
+    uint32_t off = pos & (MLUA_MULTICORE_CHANNEL_SIZE - 1);
+    uint32_t n = MLUA_MULTICORE_CHANNEL_SIZE - off;
+    if (n > len) n = len;
+    memcpy(dst, &r->data[off], n);
+    memcpy((uint8_t*)dst + n, &r->data[0], len - n);
+}
+
+// Append a message to the send ring. Returns false if there isn't enough space.
+static bool try_send(void const* src, uint32_t len, uint32_t flags) {
+    Ring* r = send_ring();
+    uint32_t tail = r->tail;
+    uint32_t used = tail - r->head;
+    if (MLUA_MULTICORE_CHANNEL_SIZE - used < HEADER_SIZE + len) return false;
+    __dmb();  // Don't overwrite data before it has been read
+    uint32_t h = len | flags;
+    uint8_t hdr[HEADER_SIZE] = {h & 0xff, h >> 8};
+    copy_in(r, tail, hdr, HEADER_SIZE);
+    copy_in(r, tail + HEADER_SIZE, src, len);
+    __dmb();  // Publish the data before the tail
+    r->tail = tail + HEADER_SIZE + len;
+    mlua_event_set(&r->recv_event);
+    __sev();  // In case the other end is doing blocking reads
+    return true;
+}
+
+// Push the next message from the receive ring. Returns false if the ring is
+// empty.
+static bool try_recv(lua_State* ls) {
+    Ring* r = recv_ring();
+    uint32_t head = r->head;
+    if (r->tail == head) return false;
+    __dmb();  // Read the data after the tail
+    uint8_t hdr[HEADER_SIZE];
+    copy_out(r, head, hdr, HEADER_SIZE);
+    uint32_t h = hdr[0] | (hdr[1] << 8);
+    uint32_t len = h & ~HEADER_BUFFER;
+    if (h & HEADER_BUFFER) {
+        // Wrap the handed-off memory in a new buffer.
+        BufferHandoff ho;
+        copy_out(r, head + HEADER_SIZE, &ho, sizeof(ho));
+        Buffer* buf = lua_newuserdatauv(ls, sizeof(Buffer), 0);
+        buf->ptr = ho.ptr;
+        buf->size = ho.size;
+        luaL_getmetatable(ls, Buffer_name);
+        lua_setmetatable(ls, -2);
+    } else {
+        luaL_Buffer buf;
+        copy_out(r, head + HEADER_SIZE, luaL_buffinitsize(ls, &buf, len), len);
+        luaL_pushresultsize(&buf, len);
+    }
+    __dmb();  // Finish reading the data before releasing the space
+    r->head = head + HEADER_SIZE + len;
+    mlua_event_set(&r->send_event);
+    __sev();  // In case the other end is doing blocking writes
+    return true;
+}
+
+// Send the message at index 1, which must be a string or a Buffer.
+static bool send_message(lua_State* ls) {
+    Buffer* buf = luaL_testudata(ls, 1, Buffer_name);
+    if (buf == NULL) {
+        size_t len;
+        char const* data = lua_tolstring(ls, 1, &len);
+        return try_send(data, len, 0);
+    }
+    BufferHandoff ho = {.ptr = buf->ptr, .size = buf->size};
+    if (!try_send(&ho, sizeof(ho), HEADER_BUFFER)) return false;
+    buf->ptr = NULL;
+    buf->size = 0;
+    return true;
+}
+
+static int send_loop(lua_State* ls, bool timeout) {
+    if (send_message(ls)) return lua_pushboolean(ls, true), 1;
+    if (timeout) return lua_pushboolean(ls, false), 1;
+    return -1;
+}
+
+static int mod_send(lua_State* ls) {
+    Buffer* buf = luaL_testudata(ls, 1, Buffer_name);
+    if (buf != NULL) {
+        luaL_argcheck(ls, buf->ptr != NULL, 1, "buffer has been handed off");
+    } else {
+        size_t len;
+        luaL_checklstring(ls, 1, &len);
+        luaL_argcheck(ls, len <= MAX_SIZE, 1, "message too large");
+    }
+    lua_settop(ls, 2);  // Ensure deadline is set
+    bool has_deadline = !lua_isnil(ls, 2);
+    uint64_t deadline = has_deadline ? mlua_check_time(ls, 2) : MLUA_TICKS_MAX;
+    MLuaEvent* event = &send_ring()->send_event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        return mlua_event_wait(ls, event, 0, &send_loop, has_deadline ? 2 : 0);
+    }
+    while (!send_message(ls)) {
+        if (mlua_wait(deadline)) return lua_pushboolean(ls, false), 1;
+    }
+    return lua_pushboolean(ls, true), 1;
+}
+
+static int recv_loop(lua_State* ls, bool timeout) {
+    if (try_recv(ls)) return 1;
+    if (timeout) return 0;
+    return -1;
+}
+
+static int mod_recv(lua_State* ls) {
+    lua_settop(ls, 1);  // Ensure deadline is set
+    bool has_deadline = !lua_isnil(ls, 1);
+    uint64_t deadline = has_deadline ? mlua_check_time(ls, 1) : MLUA_TICKS_MAX;
+    MLuaEvent* event = &recv_ring()->recv_event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        return mlua_event_wait(ls, event, 0, &recv_loop, has_deadline ? 1 : 0);
+    }
+    while (!try_recv(ls)) {
+        if (mlua_wait(deadline)) return 0;
+    }
+    return 1;
+}
+
+static Buffer* check_Buffer(lua_State* ls, int arg) {
+    return luaL_checkudata(ls, arg, Buffer_name);
+}
+
+static int Buffer___new(lua_State* ls) {
+    lua_Integer size = luaL_checkinteger(ls, 2);
+    luaL_argcheck(ls, size >= 0, 2, "invalid size");
+    Buffer* buf = lua_newuserdatauv(ls, sizeof(Buffer), 0);
+    buf->ptr = NULL;
+    buf->size = 0;
+    luaL_getmetatable(ls, Buffer_name);
+    lua_setmetatable(ls, -2);
+    buf->ptr = malloc(size > 0 ? size : 1);
+    if (buf->ptr == NULL) return luaL_error(ls, "out of memory");
+    buf->size = size;
+    return 1;
+}
+
+static int Buffer___gc(lua_State* ls) {
+    Buffer* buf = check_Buffer(ls, 1);
+    free(buf->ptr);
+    buf->ptr = NULL;
+    buf->size = 0;
+    return 0;
+}
+
+static int Buffer_ptr(lua_State* ls) {
+    Buffer* buf = check_Buffer(ls, 1);
+    if (buf->ptr == NULL) return 0;
+    return lua_pushlightuserdata(ls, buf->ptr), 1;
+}
+
+static int Buffer___len(lua_State* ls) {
+    return lua_pushinteger(ls, check_Buffer(ls, 1)->size), 1;
+}
+
+static int Buffer___buffer(lua_State* ls) {
+    Buffer* buf = check_Buffer(ls, 1);
+    if (buf->ptr == NULL) return 0;
+    lua_pushlightuserdata(ls, buf->ptr);
+    lua_pushinteger(ls, buf->size);
+    return 2;
+}
+
+MLUA_SYMBOLS(Buffer_syms) = {
+    MLUA_SYM_F(ptr, Buffer_),
+};
+
+#define Buffer___close Buffer___gc
+
+MLUA_SYMBOLS_NOHASH(Buffer_syms_nh) = {
+    MLUA_SYM_F_NH(__new, Buffer_),
+    MLUA_SYM_F_NH(__gc, Buffer_),
+    MLUA_SYM_F_NH(__close, Buffer_),
+    MLUA_SYM_F_NH(__len, Buffer_),
+    MLUA_SYM_F_NH(__buffer, Buffer_),
+};
+
+static int mod_enable_events(lua_State* ls) {
+    if (lua_type(ls, 1) == LUA_TBOOLEAN && !lua_toboolean(ls, 1)) {
+        mlua_event_disable(ls, &recv_ring()->recv_event);
+        mlua_event_disable(ls, &send_ring()->send_event);
+        return 0;
+    }
+    if (!mlua_event_enable(ls, &recv_ring()->recv_event)) {
+        return luaL_error(ls, "channel: events already enabled");
+    }
+    mlua_event_enable(ls, &send_ring()->send_event);
+    return 0;
+}
+
+static int mod_events_enabled(lua_State* ls) {
+    return lua_pushboolean(ls, mlua_event_enabled(&recv_ring()->recv_event)), 1;
+}
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_V(SIZE, integer, MLUA_MULTICORE_CHANNEL_SIZE),
+    MLUA_SYM_V(MAX_SIZE, integer, MAX_SIZE),
+    MLUA_SYM_F(send, mod_),
+    MLUA_SYM_F(recv, mod_),
+    MLUA_SYM_F_THREAD(enable_events, mod_),
+    MLUA_SYM_F_THREAD(events_enabled, mod_),
+};
+
+MLUA_OPEN_MODULE(pico.multicore.channel) {
+    mlua_thread_require(ls);
+    mlua_require(ls, "mlua.int64", false);
+
+    mlua_new_module(ls, 0, module_syms);
+
+    // Create the Buffer class.
+    mlua_new_class(ls, Buffer_name, Buffer_syms, Buffer_syms_nh);
+    mlua_set_metaclass(ls);
+    lua_setfield(ls, -2, "Buffer");
+    return 1;
+}
@@ -0,0 +1,68 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local multicore = require 'pico.multicore'
+local channel = require 'pico.multicore.channel'
+local mem = require 'mlua.mem'
+local string = require 'string'
+
+local module_name = ...
+
+function set_up(t)
+    multicore.reset_core1()
+    while channel.recv(time.ticks()) do end
+end
+
+local function enable_events(t)
+    if thread.blocking() then return end
+    channel.enable_events()
+    t:cleanup(function() channel.enable_events(false) end)
+end
+
+function test_send_recv_BNB(t)
+    enable_events(t)
+    multicore.launch_core1(module_name, 'core1_echo')
+    t:cleanup(multicore.reset_core1)
+    for _, size in ipairs{0, 1, 10, 100, 1000, channel.MAX_SIZE} do
+        local msg = string.rep('x', size - 1) .. (size > 0 and 'y' or '')
+        t:expect(t.expr(channel).send(msg)):eq(true)
+        t:expect(t.expr(channel).recv()):eq(msg)
+    end
+    t:expect(t.expr(channel).send(string.rep('x', channel.MAX_SIZE + 1)))
+        :raises("message too large")
+end
+
+function test_buffer_handoff_BNB(t)
+    enable_events(t)
+    multicore.launch_core1(module_name, 'core1_echo')
+    t:cleanup(multicore.reset_core1)
+    local buf = channel.Buffer(64)
+    mem.write(buf, 'some payload')
+    local ptr = buf:ptr()
+    t:expect(t.expr(channel).send(buf)):eq(true)
+    t:expect(t.expr(buf):ptr()):eq(nil)
+    t:expect(#buf):label("#buf"):eq(0)
+    t:expect(t.expr(channel).send(buf)):raises("buffer has been handed off")
+    local got = channel.recv()
+    t:expect(t.expr(got):ptr()):eq(ptr)
+    t:expect(#got):label("#got"):eq(64)
+    t:expect(t.expr(mem).read(got, 0, 12)):eq('some payload')
+end
+
+function test_recv_timeout_BNB(t)
+    enable_events(t)
+    t:expect(t.expr(channel).recv(time.ticks() + time.msec)):eq(nil)
+end
+
+function core1_echo()
+    multicore.set_shutdown_handler()
+    channel.enable_events()
+    local done<close> = function() channel.enable_events(false) end
+    while true do
+        channel.send(channel.recv())
+    end
+end
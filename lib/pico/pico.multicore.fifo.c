@@ -2,6 +2,7 @@
 // SPDX-License-Identifier: MIT
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include "hardware/structs/sio.h"
@@ -38,6 +39,21 @@ static void __time_critical_func(handle_sio_irq)(void) {
     }
 }
 
+static char const Readable_name[] = "pico.multicore.fifo.Readable";
+
+static int Readable___select(lua_State* ls) {
+    uint core = get_core_num();
+    bool valid = multicore_fifo_rvalid();
+    if (!valid) irq_set_enabled(SIO_IRQ_PROC0 + core, true);
+    lua_pushboolean(ls, valid);
+    lua_pushlightuserdata(ls, &fifo_state[core].event);
+    return 2;
+}
+
+MLUA_SYMBOLS_NOHASH(Readable_syms_nh) = {
+    MLUA_SYM_F_NH(__select, Readable_),
+};
+
 static int mod_enable_irq(lua_State* ls) {
     uint core = get_core_num();
     if (!mlua_event_enable_irq(ls, &fifo_state[core].event,
@@ -140,6 +156,143 @@ static int mod_pop_timeout_us(lua_State* ls) {
     return 1;
 }
 
+// Check the (offset, count) arguments at index arg, in elements, for the buffer
+// at index arg - 1, and convert them to a byte offset and length.
+static void check_elt_range(lua_State* ls, int arg, MLuaBuffer const* buf,
+                            uint size, size_t* off, size_t* len) {
+    luaL_argcheck(ls, size == 1 || size == 2 || size == 4, arg - 1,
+                  "invalid element size");
+    lua_Unsigned cnt = buf->size == SIZE_MAX ? SIZE_MAX : buf->size / size;
+    lua_Unsigned o = luaL_optinteger(ls, arg, 0);
+    luaL_argcheck(ls, o <= cnt, arg, "out of bounds");
+    lua_Unsigned c = luaL_opt(ls, luaL_checkinteger, arg + 1, cnt - o);
+    luaL_argcheck(ls, c <= cnt - o && c <= SIZE_MAX / size, arg + 1,
+                  "out of bounds");
+    *off = o * size;
+    *len = c * size;
+}
+
+static uint32_t read_elt(MLuaBuffer const* buf, size_t pos, uint size) {
+    uint8_t p[4];
+    mlua_buffer_read(buf, pos, size, p);
+    switch (size) {
+    case 1: return p[0];
+    case 2: return p[0] | (p[1] << 8);
+    default: return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+    }
+}
+
+static void write_elt(MLuaBuffer const* buf, size_t pos, uint size,
+                      uint32_t v) {
+    uint8_t p[4] = {v, v >> 8, v >> 16, v >> 24};
+    mlua_buffer_write(buf, pos, size, p);
+}
+
+static int mod_push_many_1(lua_State* ls, int status, lua_KContext ctx);
+
+static int mod_push_many(lua_State* ls) {
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_ro_buffer(ls, 1, &buf), 1,
+                     "string or buffer");
+    uint size = mlua_buffer_elt_size(ls, 1, 4);
+    size_t off, len;
+    check_elt_range(ls, 2, &buf, size, &off, &len);
+    if (!mlua_thread_blocking(ls)) {
+        lua_settop(ls, 1);
+        lua_pushinteger(ls, off);  // pos
+        lua_pushinteger(ls, off + len);  // end
+        lua_pushinteger(ls, size);
+        lua_pushinteger(ls, len);
+        return mod_push_many_1(ls, LUA_OK, 0);
+    }
+    for (size_t pos = off; pos < off + len; pos += size) {
+        multicore_fifo_push_blocking(read_elt(&buf, pos, size));
+    }
+    return lua_pushinteger(ls, len / size), 1;
+}
+
+#if LIB_MLUA_MOD_MLUA_THREAD
+
+// Stack: (buf, pos, end, size, len).
+static int mod_push_many_1(lua_State* ls, int status, lua_KContext ctx) {
+    MLuaBuffer buf;
+    mlua_get_ro_buffer(ls, 1, &buf);
+    size_t start = lua_tointeger(ls, 2);
+    size_t end = lua_tointeger(ls, 3);
+    uint size = lua_tointeger(ls, 4);
+    size_t pos = start;
+    while (pos < end && multicore_fifo_wready()) {
+        sio_hw->fifo_wr = read_elt(&buf, pos, size);
+        pos += size;
+    }
+    if (pos != start) __sev();  // In case the other end is doing blocking reads
+    if (pos >= end) return lua_pushinteger(ls, lua_tointeger(ls, 5) / size), 1;
+
+    // Busy loop, as there is no interrupt for RDY.
+    lua_pushinteger(ls, pos);
+    lua_replace(ls, 2);
+    return mlua_thread_yield(ls, 0, &mod_push_many_1, 0);
+}
+
+#endif  // LIB_MLUA_MOD_MLUA_THREAD
+
+// Stack: (buf, off, count, deadline, pos, end, size, start).
+static int pop_many_loop(lua_State* ls, bool timeout) {
+    MLuaBuffer buf;
+    mlua_get_buffer(ls, 1, &buf);
+    size_t pos = lua_tointeger(ls, 5);
+    size_t end = lua_tointeger(ls, 6);
+    uint size = lua_tointeger(ls, 7);
+    while (pos < end && multicore_fifo_rvalid()) {
+        write_elt(&buf, pos, size, sio_hw->fifo_rd);
+        pos += size;
+    }
+    if (pos < end && !timeout) {
+        lua_pushinteger(ls, pos);
+        lua_replace(ls, 5);
+        irq_set_enabled(SIO_IRQ_PROC0 + get_core_num(), true);
+        return -1;
+    }
+    return lua_pushinteger(ls, (pos - lua_tointeger(ls, 8)) / size), 1;
+}
+
+static int mod_pop_many(lua_State* ls) {
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_buffer(ls, 1, &buf), 1, "buffer");
+    uint size = mlua_buffer_elt_size(ls, 1, 4);
+    size_t off, len;
+    check_elt_range(ls, 2, &buf, size, &off, &len);
+    bool has_timeout = !lua_isnoneornil(ls, 4);
+    uint64_t timeout = has_timeout ? mlua_check_int64(ls, 4) : 0;
+    MLuaEvent* event = &fifo_state[get_core_num()].event;
+    if (mlua_event_can_wait(ls, event, 0)) {
+        lua_settop(ls, 3);
+        if (has_timeout) {
+            mlua_push_deadline(ls, timeout);
+        } else {
+            lua_pushnil(ls);
+        }
+        lua_pushinteger(ls, off);  // pos
+        lua_pushinteger(ls, off + len);  // end
+        lua_pushinteger(ls, size);
+        lua_pushinteger(ls, off);  // start
+        return mlua_event_wait(ls, event, 0, &pop_many_loop,
+                               has_timeout ? 4 : 0);
+    }
+
+    absolute_time_t deadline = has_timeout ? make_timeout_time_us(timeout)
+                                           : at_the_end_of_time;
+    for (size_t pos = off; pos < off + len; pos += size) {
+        while (!multicore_fifo_rvalid()) {
+            if (best_effort_wfe_or_timeout(deadline)) {
+                return lua_pushinteger(ls, (pos - off) / size), 1;
+            }
+        }
+        write_elt(&buf, pos, size, sio_hw->fifo_rd);
+    }
+    return lua_pushinteger(ls, len / size), 1;
+}
+
 static int mod_clear_irq(lua_State* ls) {
 #if LIB_MLUA_MOD_MLUA_THREAD
     FifoState* st = &fifo_state[get_core_num()];
@@ -182,6 +335,8 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(push_timeout_us, mod_),
     MLUA_SYM_F(pop_blocking, mod_),
     MLUA_SYM_F(pop_timeout_us, mod_),
+    MLUA_SYM_F(push_many, mod_),
+    MLUA_SYM_F(pop_many, mod_),
     MLUA_SYM_F(drain, mod_),
     MLUA_SYM_F(clear_irq, mod_),
     MLUA_SYM_F(get_status, mod_),
@@ -193,5 +348,13 @@ MLUA_OPEN_MODULE(pico.multicore.fifo) {
     mlua_require(ls, "mlua.int64", false);
 
     mlua_new_module(ls, 0, module_syms);
+
+#if LIB_MLUA_MOD_MLUA_THREAD
+    // Create the selectable source for the read side of the FIFO.
+    lua_newuserdatauv(ls, 0, 0);
+    mlua_new_class_nohash(ls, Readable_name, mlua_nosyms, Readable_syms_nh);
+    lua_setmetatable(ls, -2);
+    lua_setfield(ls, -2, "readable");
+#endif
     return 1;
 }
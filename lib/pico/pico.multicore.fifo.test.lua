@@ -3,6 +3,7 @@
 
 _ENV = module(...)
 
+local array = require 'mlua.array'
 local thread = require 'mlua.thread'
 local multicore = require 'pico.multicore'
 local fifo = require 'pico.multicore.fifo'
@@ -65,6 +66,29 @@ function test_push_pop_BNB(t)
     end
 end
 
+function test_push_pop_many_BNB(t)
+    multicore.launch_core1(module_name, 'core1_echo')
+    t:cleanup(multicore.reset_core1)
+    if not thread.blocking() then
+        fifo.enable_irq()
+        t:cleanup(function() fifo.enable_irq(false) end)
+    end
+    local src, dst = array('I', 32), array('I', 32)
+    for i = 1, #src do src:set(i, 0x01010101 * i) end
+    for off = 0, #src - 1, 8 do
+        t:expect(t.expr(fifo).push_many(src, off, 8)):eq(8)
+        t:expect(t.expr(fifo).pop_many(dst, off, 8)):eq(8)
+    end
+    t:expect(dst):label("dst"):eq(src)
+    t:expect(t.expr(fifo).push_many('\x01\x02\x03\x04\x05\x06\x07\x08'))
+        :eq(2)
+    local dst8 = array('B', 4)
+    t:expect(t.expr(fifo).pop_many(dst8, 1, 3, 1000)):eq(2)
+    t:expect(dst8):label("dst8"):eq(array('B', 4):set(2, 0x01, 0x05))
+    t:expect(t.expr(fifo).push_many(src, 33)):raises("out of bounds")
+    t:expect(t.expr(fifo).pop_many(dst, 30, 3)):raises("out of bounds")
+end
+
 function core1_echo()
     multicore.set_shutdown_handler()
     fifo.enable_irq()
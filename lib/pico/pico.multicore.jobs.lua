@@ -0,0 +1,181 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local math = require 'math'
+local oo = require 'mlua.oo'
+local thread = require 'mlua.thread'
+local multicore = require 'pico.multicore'
+local channel = require 'pico.multicore.channel'
+local string = require 'string'
+local table = require 'table'
+
+local module_name = ...
+
+-- The encoders for values of each type. Only values that can be copied
+-- between interpreters are supported.
+local encoders = {
+    ['nil'] = function(v) return '-' end,
+    boolean = function(v) return v and 't' or 'f' end,
+    number = function(v)
+        if math.type(v) == 'integer' then return string.pack('<c1j', 'i', v) end
+        return string.pack('<c1n', 'n', v)
+    end,
+    string = function(v) return string.pack('<c1s2', 's', v) end,
+}
+
+-- The decoders for the encoded values, indexed by tag.
+local decoders = {
+    ['-'] = function(data, pos) return nil, pos end,
+    t = function(data, pos) return true, pos end,
+    f = function(data, pos) return false, pos end,
+    i = function(data, pos) return string.unpack('<j', data, pos) end,
+    n = function(data, pos) return string.unpack('<n', data, pos) end,
+    s = function(data, pos) return string.unpack('<s2', data, pos) end,
+}
+
+-- Encode the values in the table "vs" at indexes i to vs.n.
+local function encode(vs, i)
+    local parts = {string.pack('<I2', vs.n - i + 1)}
+    for j = i, vs.n do
+        local v = vs[j]
+        local enc = encoders[type(v)]
+        if not enc then
+            error(("unsupported value type: %s"):format(type(v)), 3)
+        end
+        parts[#parts + 1] = enc(v)
+    end
+    return table.concat(parts)
+end
+
+-- Decode the values encoded at position "pos" in "data" into a table.
+local function decode(data, pos)
+    local n
+    n, pos = string.unpack('<I2', data, pos)
+    local vs = {n = n}
+    for i = 1, n do
+        local tag = data:sub(pos, pos)
+        vs[i], pos = decoders[tag](data, pos + 1)
+    end
+    return vs
+end
+
+local dispatcher, own_events, pending, next_id = nil, false, {}, 0
+
+-- A handle to a job submitted to core 1.
+local Job = oo.class('Job')
+
+function Job:__init(id)
+    self.id, self._results = id, thread.Channel(1)
+end
+
+-- Return true iff the job has completed.
+function Job:is_done() return self._res ~= nil or #self._results > 0 end
+
+-- Wait for the job to complete, and return true and its results if it
+-- succeeded, or false and an error message if it raised an error. Returns
+-- nothing if the deadline elapses first.
+function Job:wait(deadline)
+    local res = self._res
+    if not res then
+        res = self._results:recv(deadline)
+        if not res then return end
+        self._res = res
+    end
+    return table.unpack(res, 1, res.n)
+end
+
+-- Complete the job with the given results.
+local function complete(id, res)
+    local job = pending[id]
+    if not job then return end
+    pending[id] = nil
+    job._results:try_send(res)
+end
+
+-- Receive results from core 1 and complete the corresponding jobs.
+local function dispatch()
+    while true do
+        local msg = channel.recv()
+        local id, ok, pos = string.unpack('<I4B', msg)
+        local vs = decode(msg, pos)
+        local res = {n = vs.n + 1, ok ~= 0}
+        for i = 1, vs.n do res[i + 1] = vs[i] end
+        complete(id, res)
+    end
+end
+
+-- Start the worker interpreter in core 1, and the thread dispatching job
+-- results in core 0. Channel events that are already enabled are left as they
+-- are, and aren't disabled by stop().
+function start()
+    if dispatcher then error("worker already running", 2) end
+    own_events = not channel.events_enabled()
+    if own_events then channel.enable_events() end
+    multicore.launch_core1(module_name, 'worker')
+    dispatcher = thread.start(dispatch, 'jobs.dispatch')
+end
+
+-- Stop the worker in core 1 and fail all pending jobs.
+function stop()
+    if not dispatcher then return end
+    multicore.reset_core1()
+    dispatcher:kill()
+    dispatcher = nil
+    if own_events then channel.enable_events(false) end
+    own_events = false
+    while channel.recv(0) do end
+    for id in pairs(pending) do
+        complete(id, {n = 2, false, "worker stopped"})
+    end
+end
+
+-- Submit a job calling require(module)[fn](...) in core 1, and return a Job
+-- handle for its results.
+function submit(module, fn, ...)
+    if not dispatcher then error("worker not running", 2) end
+    local msg = string.pack('<I4s2s2', next_id, module, fn)
+                .. encode(table.pack(...), 1)
+    if #msg > channel.MAX_SIZE then error("job too large", 2) end
+    local job = Job(next_id)
+    pending[next_id] = job
+    next_id = (next_id + 1) & 0xffffffff
+    channel.send(msg)
+    return job
+end
+
+-- Run a job in the worker.
+local function run(module, fn, ...)
+    local f = require(module)[fn]
+    if not f then error(("%s.%s: no such function"):format(module, fn), 0) end
+    return f(...)
+end
+
+-- Encode the result message of a job.
+local function result_msg(id, res)
+    local ok, msg = pcall(encode, res, 2)
+    if ok then msg = string.pack('<I4B', id, res[1] and 1 or 0) .. msg end
+    if not ok or #msg > channel.MAX_SIZE then
+        msg = string.pack('<I4B', id, 0)
+              .. encode({n = 1, ok and "result too large" or msg}, 1)
+    end
+    return msg
+end
+
+-- The main function of the worker interpreter in core 1. Jobs are executed
+-- one at a time, in the order in which they were submitted.
+function worker()
+    multicore.set_shutdown_handler()
+    channel.enable_events()
+    local done<close> = function() channel.enable_events(false) end
+    while true do
+        local msg = channel.recv()
+        local id, module, fn, pos = string.unpack('<I4s2s2', msg)
+        local args = decode(msg, pos)
+        local res = table.pack(
+            pcall(run, module, fn, table.unpack(args, 1, args.n)))
+        if not res[1] then res[2] = tostring(res[2]) end
+        channel.send(result_msg(id, res))
+    end
+end
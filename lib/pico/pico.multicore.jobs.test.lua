@@ -0,0 +1,91 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local math = require 'math'
+local thread = require 'mlua.thread'
+local time = require 'mlua.time'
+local channel = require 'pico.multicore.channel'
+local jobs = require 'pico.multicore.jobs'
+local table = require 'table'
+
+local module_name = ...
+
+function set_up(t)
+    jobs.start()
+    t:cleanup(jobs.stop)
+end
+
+function test_submit_BNB(t)
+    local job = jobs.submit(module_name, 'add', 1, 2)
+    t:expect(t.expr(jobs).submit(module_name, 'add', {}))
+        :raises("unsupported value type: table")
+    local ok, res = job:wait()
+    t:expect(ok):label("ok"):eq(true)
+    t:expect(res):label("res"):eq(3)
+    t:expect(t.expr(job):is_done()):eq(true)
+    t:expect(t.expr(job):wait()):eq(true)
+end
+
+function test_values_BNB(t)
+    local want = {n = 7, nil, true, false, math.mininteger, 1.5, 'abc', nil}
+    local got = table.pack(jobs.submit(module_name, 'echo',
+                                       table.unpack(want, 1, want.n)):wait())
+    t:expect(got.n):label("n"):eq(want.n + 1)
+    t:expect(got[1]):label("ok"):eq(true)
+    for i = 1, want.n do
+        t:expect(got[i + 1]):label("got[%s]", i):eq(want[i])
+    end
+end
+
+function test_errors_BNB(t)
+    t:expect(t.expr(jobs.submit(module_name, 'fail', "boom")):wait())
+        :eq(false)
+    local _, err = jobs.submit(module_name, 'fail', "boom"):wait()
+    t:expect(err):label("err"):eq("boom")
+    _, err = jobs.submit(module_name, 'missing'):wait()
+    t:expect(err):label("err"):eq(module_name .. ".missing: no such function")
+end
+
+function test_concurrent_BNB(t)
+    local ths<close> = thread.Group()
+    local results = {}
+    for i = 1, 5 do
+        ths:start(function()
+            local _, res = jobs.submit(module_name, 'add', i, 10):wait()
+            results[i] = res
+        end)
+    end
+    ths:join()
+    for i = 1, 5 do
+        t:expect(results[i]):label("results[%s]", i):eq(i + 10)
+    end
+end
+
+function test_wait_timeout_BNB(t)
+    local job = jobs.submit(module_name, 'sleep', 100 * time.msec)
+    t:expect(t.expr(job):wait(time.ticks() + time.msec)):eq(nil)
+    t:expect(t.expr(job):is_done()):eq(false)
+    t:expect(t.expr(job):wait()):eq(true)
+end
+
+function test_events_enabled_BNB(t)
+    -- Restart the worker with channel events already enabled.
+    jobs.stop()
+    t:expect(t.expr(channel).events_enabled()):eq(false)
+    channel.enable_events()
+    t:cleanup(function() channel.enable_events(false) end)
+    jobs.start()
+    t:expect(t.expr(jobs.submit(module_name, 'add', 1, 2)):wait())
+        :eq(true)
+
+    -- Stopping the worker leaves the events enabled.
+    jobs.stop()
+    t:expect(t.expr(channel).events_enabled()):eq(true)
+end
+
+function add(a, b) return a + b end
+function echo(...) return ... end
+function fail(msg) error(msg, 0) end
+function sleep(duration) time.sleep_for(duration) end
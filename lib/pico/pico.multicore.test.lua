@@ -17,12 +17,21 @@ function test_core1(t)
         {{module_name, 'core1_suspend'}, nil},
         {{module_name, 'core1_suspend'}, 2 * time.msec},
         {{module_name, 'core1_busy'}, 2 * time.msec},
+        {{module_name, 'core1_suspend', 32 * 1024}, 2 * time.msec},
+        {{module_name, 'core1_busy', 32 * 1024}, 2 * time.msec},
+        {{module_name, 'core1_suspend', nil, {mode = 'generational'}},
+         2 * time.msec},
     } do
         local args, sleep = table.unpack(test)
-        multicore.launch_core1(table.unpack(args))
+        multicore.launch_core1(table.unpack(args, 1, 4))
         if sleep then time.sleep_for(sleep) end
         multicore.reset_core1()
     end
+    t:expect(t.expr(multicore).launch_core1(module_name, 'core1_exit', -1))
+        :raises("invalid heap size")
+    t:expect(t.expr(multicore).launch_core1(module_name, 'core1_exit', nil,
+                                            {pause = -1}))
+        :raises("invalid GC pause")
 end
 
 function core1_exit()
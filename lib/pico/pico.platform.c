@@ -9,7 +9,7 @@
 
 MLUA_FUNC_R0(mod_,, rp2040_chip_version, lua_pushinteger)
 MLUA_FUNC_R0(mod_,, rp2040_rom_version, lua_pushinteger)
-MLUA_FUNC_V1(mod_,, busy_wait_at_least_cycles, luaL_checkinteger)
+MLUA_FUNC_V1(mod_,, busy_wait_at_least_cycles, mlua_arg_integer)
 MLUA_FUNC_R0(mod_,, get_core_num, lua_pushinteger)
 
 MLUA_SYMBOLS(module_syms) = {
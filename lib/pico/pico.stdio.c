@@ -1,17 +1,21 @@
 // Copyright 2023 Remy Blank <remy@c-space.org>
 // SPDX-License-Identifier: MIT
 
+#include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <unistd.h>
 
 #include "pico.h"
 #include "pico/stdio.h"
+#include "pico/stdio/driver.h"
 #include "pico/time.h"
 
 #include "lauxlib.h"
 #include "mlua/int64.h"
 #include "mlua/module.h"
+#include "mlua/platform.h"
 #include "mlua/thread.h"
 #include "mlua/util.h"
 
@@ -19,6 +23,136 @@
 __attribute__((weak)) int _link(char const* old, char const* new) { return -1; }
 __attribute__((weak)) int _unlink(char const* file) { return -1; }
 
+// The size of the receive ring for bulk reads, in bytes. Must be a power of
+// two.
+#ifndef MLUA_STDIO_BULK_READ_SIZE
+#define MLUA_STDIO_BULK_READ_SIZE 4096
+#endif
+
+static_assert((MLUA_STDIO_BULK_READ_SIZE & (MLUA_STDIO_BULK_READ_SIZE - 1))
+              == 0, "MLUA_STDIO_BULK_READ_SIZE must be a power of two");
+
+// The state of bulk reads. When enabled, the input of the driver is drained
+// into the ring from the "characters available" callback. "head" and "tail"
+// are free-running byte counters. All fields are protected by the event lock.
+typedef struct BulkRead {
+    stdio_driver_t* driver;  // NULL if bulk reads are disabled
+    uint32_t head;
+    uint32_t tail;
+    uint32_t epoch;          // Incremented when bulk reads are (re)configured
+    bool draining;           // True while the driver is being drained
+    bool redrain;            // True if more input arrived while draining
+    bool stalled;            // True if the ring was full when draining
+    uint32_t stalls;         // Number of times the ring became full
+    uint64_t bytes;          // Total number of bytes received
+    uint64_t start;          // The time when bulk reads were enabled
+    uint8_t data[MLUA_STDIO_BULK_READ_SIZE];
+} BulkRead;
+
+static BulkRead bulk;
+
+// Drain the input of the bulk read driver into the ring, until the driver has
+// no more data or the ring is full. The driver is called outside of the event
+// lock, as it may block or take its own locks. It reads directly into the free
+// part of the ring, which isn't visible to readers until "tail" is advanced.
+// Only one caller drains at a time; concurrent calls make it drain again.
+static void __time_critical_func(bulk_drain)(void) {
+    mlua_event_lock();
+    if (bulk.draining) {
+        bulk.redrain = true;
+        mlua_event_unlock();
+        return;
+    }
+    stdio_driver_t* driver = bulk.driver;
+    if (driver == NULL || driver->in_chars == NULL) {
+        mlua_event_unlock();
+        return;
+    }
+    uint32_t epoch = bulk.epoch;
+    bulk.draining = true;
+    for (;;) {
+        bulk.redrain = false;
+        uint32_t tail = bulk.tail;
+        uint32_t space = MLUA_STDIO_BULK_READ_SIZE - (tail - bulk.head);
+        if (space == 0) {
+            if (!bulk.stalled) ++bulk.stalls;
+            bulk.stalled = true;
+            break;
+        }
+        uint32_t off = tail & (MLUA_STDIO_BULK_READ_SIZE - 1);
+        uint32_t n = MLUA_STDIO_BULK_READ_SIZE - off;
+        if (n > space) n = space;
+        mlua_event_unlock();
+        int cnt = driver->in_chars((char*)&bulk.data[off], n);
+        mlua_event_lock();
+        if (bulk.epoch != epoch) {
+            // Bulk reads were reconfigured while draining; drop the input.
+            epoch = bulk.epoch;
+            driver = bulk.driver;
+            if (driver == NULL || driver->in_chars == NULL) break;
+            continue;
+        }
+        if (cnt <= 0) {
+            if (bulk.redrain) continue;
+            bulk.stalled = false;
+            break;
+        }
+        bulk.tail = tail + cnt;
+        bulk.bytes += cnt;
+    }
+    bulk.draining = false;
+    mlua_event_unlock();
+}
+
+static inline bool bulk_enabled(void) { return bulk.driver != NULL; }
+
+// Return true iff the bulk read ring has data.
+static bool bulk_available(void) {
+    mlua_event_lock();
+    bool res = bulk.tail != bulk.head;
+    mlua_event_unlock();
+    return res;
+}
+
+// Move up to len bytes from the bulk read ring to a buffer at the given
+// offset, and return the number of bytes moved. Resumes draining the driver if
+// the ring was full.
+static uint32_t bulk_take(MLuaBuffer const* buf, size_t off, size_t len) {
+    mlua_event_lock();
+    uint32_t head = bulk.head;
+    uint32_t avail = bulk.tail - head;
+    mlua_event_unlock();
+    if (len > avail) len = avail;
+    if (len == 0) return 0;
+    uint32_t pos = head & (MLUA_STDIO_BULK_READ_SIZE - 1);
+    uint32_t n = MLUA_STDIO_BULK_READ_SIZE - pos;
+    if (n > len) n = len;
+    mlua_buffer_write(buf, off, n, &bulk.data[pos]);
+    if (len > n) mlua_buffer_write(buf, off + n, len - n, &bulk.data[0]);
+    mlua_event_lock();
+    bulk.head = head + len;
+    bool stalled = bulk.stalled;
+    mlua_event_unlock();
+    if (stalled) bulk_drain();
+    return len;
+}
+
+// Return the next character from the bulk read ring, or PICO_ERROR_TIMEOUT if
+// the ring is empty.
+static int bulk_getchar(void) {
+    uint8_t c;
+    MLuaBuffer buf = {.ptr = &c};
+    return bulk_take(&buf, 0, 1) > 0 ? c : PICO_ERROR_TIMEOUT;
+}
+
+// Push a string with up to len bytes from the bulk read ring.
+static int bulk_read(lua_State* ls, size_t len) {
+    luaL_Buffer lbuf;
+    MLuaBuffer buf = {.ptr = luaL_buffinitsize(ls, &lbuf, len)};
+    luaL_pushresultsize(&lbuf, bulk_take(&buf, 0, len));
+    return 1;
+}
+
 #if LIB_MLUA_MOD_MLUA_THREAD
 
 typedef struct StdioState {
@@ -29,6 +163,7 @@ typedef struct StdioState {
 static StdioState stdio_state;
 
 static void __time_critical_func(handle_chars_available)(void* ud) {
+    bulk_drain();
     mlua_event_lock();
     stdio_state.pending = true;
     mlua_event_set_nolock(&stdio_state.event);
@@ -51,8 +186,18 @@ static void enable_chars_available(lua_State* ls) {
     stdio_set_chars_available_callback(&handle_chars_available, NULL);
 }
 
+static void disable_bulk_read(void) {
+    mlua_event_lock();
+    bulk.driver = NULL;
+    bulk.head = bulk.tail = 0;
+    ++bulk.epoch;
+    bulk.stalled = false;
+    mlua_event_unlock();
+}
+
 static int mod_enable_chars_available(lua_State* ls) {
     if (lua_type(ls, 1) == LUA_TBOOLEAN && !lua_toboolean(ls, 1)) {
+        disable_bulk_read();
         stdio_set_chars_available_callback(NULL, NULL);
         mlua_event_disable(ls, &stdio_state.event);
         return 0;
@@ -61,6 +206,45 @@ static int mod_enable_chars_available(lua_State* ls) {
     return 0;
 }
 
+static int mod_enable_bulk_read(lua_State* ls) {
+    if (lua_isnoneornil(ls, 1)
+            || (lua_type(ls, 1) == LUA_TBOOLEAN && !lua_toboolean(ls, 1))) {
+        disable_bulk_read();
+        return 0;
+    }
+    stdio_driver_t* driver = mlua_check_userdata(ls, 1);
+    enable_chars_available(ls);
+    uint64_t now = mlua_ticks64();
+    mlua_event_lock();
+    bulk.driver = driver;
+    bulk.head = bulk.tail = 0;
+    ++bulk.epoch;
+    bulk.stalled = false;
+    bulk.stalls = 0;
+    bulk.bytes = 0;
+    bulk.start = now;
+    mlua_event_unlock();
+    bulk_drain();
+    return 0;
+}
+
+static int mod_bulk_read_stats(lua_State* ls) {
+    uint64_t now = mlua_ticks64();
+    mlua_event_lock();
+    bool enabled = bulk.driver != NULL;
+    uint64_t bytes = bulk.bytes;
+    uint64_t start = bulk.start;
+    uint32_t stalls = bulk.stalls;
+    uint32_t buffered = bulk.tail - bulk.head;
+    mlua_event_unlock();
+    if (!enabled) return 0;
+    mlua_push_minint(ls, bytes);
+    mlua_push_minint(ls, now - start);
+    lua_pushinteger(ls, stalls);
+    lua_pushinteger(ls, buffered);
+    return 4;
+}
+
 static int handle_chars_available_event(lua_State* ls) {
     mlua_event_lock();
     bool pending = stdio_state.pending;
@@ -111,15 +295,32 @@ static bool chars_available_reset() { return true; }
 #endif  // !LIB_MLUA_MOD_MLUA_THREAD
 
 static int getchar_loop(lua_State* ls, bool timeout) {
+    if (bulk_enabled()) {
+        int c = bulk_getchar();
+        if (c >= 0 || timeout) return lua_pushinteger(ls, c), 1;
+        return -1;
+    }
     if (chars_available_reset()) return lua_pushinteger(ls, getchar()), 1;
     if (!timeout) return -1;
     return lua_pushinteger(ls, PICO_ERROR_TIMEOUT), 1;
 }
 
+// Get a character from the bulk read ring, blocking without yielding until the
+// deadline.
+static int bulk_getchar_until(uint64_t deadline) {
+    for (;;) {
+        int c = bulk_getchar();
+        if (c >= 0 || mlua_wait(deadline)) return c;
+    }
+}
+
 static int mod_getchar(lua_State* ls) {
     if (mlua_event_can_wait(ls, &stdio_state.event, 0)) {
         return mlua_event_wait(ls, &stdio_state.event, 0, &getchar_loop, 0);
     }
+    if (bulk_enabled()) {
+        return lua_pushinteger(ls, bulk_getchar_until(MLUA_TICKS_MAX)), 1;
+    }
     lua_pushinteger(ls, getchar());
     return 1;
 }
@@ -131,6 +332,10 @@ static int mod_getchar_timeout_us(lua_State* ls) {
         mlua_push_deadline(ls, timeout);
         return mlua_event_wait(ls, &stdio_state.event, 0, &getchar_loop, 1);
     }
+    if (bulk_enabled()) {
+        uint64_t deadline = mlua_ticks64() + timeout;
+        return lua_pushinteger(ls, bulk_getchar_until(deadline)), 1;
+    }
     lua_pushinteger(ls, getchar_timeout_us(timeout));
     return 1;
 }
@@ -145,6 +350,10 @@ static int do_read(lua_State* ls, int fd, lua_Integer len) {
 }
 
 static int read_loop(lua_State* ls, bool timeout) {
+    if (bulk_enabled()) {
+        if (!bulk_available()) return -1;
+        return bulk_read(ls, lua_tointeger(ls, -1));
+    }
     if (!chars_available_reset()) return -1;
     return do_read(ls, lua_tointeger(ls, -2), lua_tointeger(ls, -1));
 }
@@ -157,6 +366,10 @@ int mlua_stdio_read(lua_State* ls, int fd, int arg) {
         lua_pushinteger(ls, len);
         return mlua_event_wait(ls, &stdio_state.event, 0, &read_loop, 0);
     }
+    if (bulk_enabled()) {
+        while (!bulk_available()) mlua_wait(MLUA_TICKS_MAX);
+        return bulk_read(ls, len);
+    }
     return do_read(ls, fd, len);
 }
 
@@ -164,6 +377,48 @@ static int mod_read(lua_State* ls) {
     return mlua_stdio_read(ls, STDIN_FILENO, 1);
 }
 
+// Use the helper from mlua.stdio.
+int mlua_stdio_read_buffer(lua_State* ls, int fd, MLuaBuffer const* buf,
+                           size_t off, size_t len);
+
+static int read_into_loop(lua_State* ls, bool timeout) {
+    if (!(bulk_enabled() ? bulk_available() : chars_available_reset())) {
+        return -1;
+    }
+    MLuaBuffer buf;
+    mlua_get_buffer(ls, lua_gettop(ls) - 3, &buf);
+    if (bulk_enabled()) {
+        uint32_t cnt = bulk_take(&buf, lua_tointeger(ls, -2),
+                                 lua_tointeger(ls, -1));
+        return lua_pushinteger(ls, cnt), 1;
+    }
+    return mlua_stdio_read_buffer(ls, lua_tointeger(ls, -3), &buf,
+                                  lua_tointeger(ls, -2),
+                                  lua_tointeger(ls, -1));
+}
+
+int mlua_stdio_read_into(lua_State* ls, int fd, int arg) {
+    MLuaBuffer buf;
+    size_t off, len;
+    mlua_check_buffer_range(ls, arg, &buf, &off, &len);
+    if (mlua_event_can_wait(ls, &stdio_state.event, 0)) {
+        lua_pushvalue(ls, arg);
+        lua_pushinteger(ls, fd);
+        lua_pushinteger(ls, off);
+        lua_pushinteger(ls, len);
+        return mlua_event_wait(ls, &stdio_state.event, 0, &read_into_loop, 0);
+    }
+    if (bulk_enabled()) {
+        while (!bulk_available()) mlua_wait(MLUA_TICKS_MAX);
+        return lua_pushinteger(ls, bulk_take(&buf, off, len)), 1;
+    }
+    return mlua_stdio_read_buffer(ls, fd, &buf, off, len);
+}
+
+static int mod_read_into(lua_State* ls) {
+    return mlua_stdio_read_into(ls, STDIN_FILENO, 1);
+}
+
 // Use the default implementation from mlua.stdio.
 int mlua_stdio_write(lua_State* ls, int fd, int arg);
 
@@ -174,12 +429,12 @@ static int mod_write(lua_State* ls) {
 MLUA_FUNC_R0(mod_, stdio_, init_all, lua_pushboolean)
 MLUA_FUNC_V0(mod_, stdio_, flush)
 MLUA_FUNC_V2(mod_, stdio_, set_driver_enabled, mlua_check_userdata,
-             mlua_to_cbool)
+             mlua_arg_cbool)
 MLUA_FUNC_V1(mod_, stdio_, filter_driver, mlua_check_userdata_or_nil)
 MLUA_FUNC_V2(mod_, stdio_, set_translate_crlf, mlua_check_userdata,
-             mlua_to_cbool)
-MLUA_FUNC_R1(mod_,, putchar, lua_pushinteger, luaL_checkinteger)
-MLUA_FUNC_R1(mod_,, putchar_raw, lua_pushinteger, luaL_checkinteger)
+             mlua_arg_cbool)
+MLUA_FUNC_R1(mod_,, putchar, lua_pushinteger, mlua_arg_integer)
+MLUA_FUNC_R1(mod_,, putchar_raw, lua_pushinteger, mlua_arg_integer)
 MLUA_FUNC_R1(mod_,, puts, lua_pushinteger, luaL_checkstring)
 MLUA_FUNC_R1(mod_,, puts_raw, lua_pushinteger, luaL_checkstring)
 
@@ -201,8 +456,11 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(puts_raw, mod_),
     MLUA_SYM_F_THREAD(set_chars_available_callback, mod_),
     MLUA_SYM_F(read, mod_),
+    MLUA_SYM_F(read_into, mod_),
     MLUA_SYM_F(write, mod_),
     MLUA_SYM_F_THREAD(enable_chars_available, mod_),
+    MLUA_SYM_F_THREAD(enable_bulk_read, mod_),
+    MLUA_SYM_F_THREAD(bulk_read_stats, mod_),
 };
 
 void mlua_stdio_require(lua_State* ls) {
@@ -8,6 +8,7 @@ local repr = require 'mlua.repr'
 local testing_stdio = require 'mlua.testing.stdio'
 local thread = require 'mlua.thread'
 local stdio = require 'pico.stdio'
+local stdio_uart = require 'pico.stdio.uart'
 local string = require 'string'
 
 -- We don't test the pico.stdio.usb module, because it sometimes causes the
@@ -70,6 +71,26 @@ function test_write_read_BNB(t)
     end
 end
 
+function test_bulk_read_BNB(t)
+    local want, got, stats = ('0123456789abcdef'):rep(8), ''
+    t:expect(pcall(function()  -- No output in this block
+        local done<close> = testing_stdio.enable_loopback(t, false)
+        stdio.enable_bulk_read(stdio_uart.driver)
+        local bulk<close> = function()
+            stdio.enable_bulk_read(false)
+            if thread.blocking() then stdio.enable_chars_available(false) end
+        end
+        stdio.write(want)
+        while #got < #want do got = got .. stdio.read(#want - #got) end
+        stats = {stdio.bulk_read_stats()}
+    end))
+    t:expect(got):label("got"):eq(want)
+    t:expect(stats[1]):label("bytes"):eq(#want)
+    t:expect(stats[2] > 0, "invalid duration: %s", stats[2])
+    t:expect(stats[4]):label("buffered"):eq(0)
+    t:expect(t.expr(stdio).bulk_read_stats()):eq(nil)
+end
+
 function test_set_chars_available_callback(t)
     local got, want = '', 'abcdefghijklmnopqrstuvwxyz'
     t:expect(pcall(function()  -- No output in this block
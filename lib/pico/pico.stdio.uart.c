@@ -11,8 +11,8 @@
 MLUA_FUNC_V0(mod_, stdio_uart_, init)
 MLUA_FUNC_V0(mod_init_stdout, stdout_uart_init,)
 MLUA_FUNC_V0(mod_init_stdin, stdin_uart_init,)
-MLUA_FUNC_V4(mod_, stdio_uart_, init_full, mlua_check_UART, luaL_checkinteger,
-             luaL_checkinteger, luaL_checkinteger)
+MLUA_FUNC_V4(mod_, stdio_uart_, init_full, mlua_check_UART, mlua_arg_integer,
+             mlua_arg_integer, mlua_arg_integer)
 
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(driver, lightuserdata, &stdio_uart),
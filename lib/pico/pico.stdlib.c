@@ -20,10 +20,10 @@ static int mod_check_sys_clock_khz(lua_State* ls) {
 
 MLUA_FUNC_V0(mod_,, setup_default_uart)
 MLUA_FUNC_V0(mod_,, set_sys_clock_48mhz)
-MLUA_FUNC_V3(mod_,, set_sys_clock_pll, luaL_checkinteger, luaL_checkinteger,
-             luaL_checkinteger)
-MLUA_FUNC_R2(mod_,, set_sys_clock_khz, lua_pushboolean, luaL_checkinteger,
-             mlua_to_cbool)
+MLUA_FUNC_V3(mod_,, set_sys_clock_pll, mlua_arg_integer, mlua_arg_integer,
+             mlua_arg_integer)
+MLUA_FUNC_R2(mod_,, set_sys_clock_khz, lua_pushboolean, mlua_arg_integer,
+             mlua_arg_cbool)
 
 MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_V(DEFAULT_LED_PIN_INVERTED, boolean, PICO_DEFAULT_LED_PIN_INVERTED),
@@ -2,6 +2,8 @@
 // SPDX-License-Identifier: MIT
 
 #include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "hardware/timer.h"
 #include "pico/time.h"
@@ -45,30 +47,21 @@ static int mod_make_timeout_time_ms(lua_State* ls) {
     return 1;
 }
 
-static int mod_sleep_until_1(lua_State* ls, int status, lua_KContext ctx);
-
 static int mod_sleep_until(lua_State* ls) {
     absolute_time_t t = check_time(ls, 1);
     if (!mlua_thread_blocking(ls)) {
-        if (time_reached(t)) return 0;
-        return mlua_thread_suspend(ls, &mod_sleep_until_1, 0, 1);
+        return mlua_thread_sleep_until(ls, to_us_since_boot(t));
     }
     sleep_until(t);
     return 0;
 }
 
-static int mod_sleep_until_1(lua_State* ls, int status, lua_KContext ctx) {
-    if (time_reached(from_us_since_boot(mlua_to_time(ls, 1)))) return 0;
-    return mlua_thread_suspend(ls, &mod_sleep_until_1, 0, 1);
-}
-
 static int mod_sleep_us(lua_State* ls) {
     uint64_t delay = mlua_check_int64(ls, 1);
     if (delay == 0) return 0;
     if (!mlua_thread_blocking(ls)) {
-        lua_settop(ls, 0);
-        mlua_push_deadline(ls, delay);
-        return mlua_thread_suspend(ls, &mod_sleep_until_1, 0, 1);
+        return mlua_thread_sleep_until(
+            ls, to_us_since_boot(make_timeout_time_us(delay)));
     }
     sleep_us(delay);
     return 0;
@@ -78,133 +71,267 @@ static int mod_sleep_ms(lua_State* ls) {
     lua_Unsigned delay = luaL_checkinteger(ls, 1);
     if (delay == 0) return 0;
     if (!mlua_thread_blocking(ls)) {
-        lua_settop(ls, 0);
-#if MLUA_IS64INT
-        lua_pushinteger(ls, mlua_timeout_time(mlua_ticks(), delay * 1000));
-#else
-        if (delay <= LUA_MAXINTEGER / 1000) {
-            lua_pushinteger(ls, mlua_ticks() + delay * 1000);
-        } else {
-            mlua_push_int64(ls, to_us_since_boot(make_timeout_time_ms(delay)));
-        }
-#endif
-        return mlua_thread_suspend(ls, &mod_sleep_until_1, 0, 1);
+        return mlua_thread_sleep_until(
+            ls, to_us_since_boot(make_timeout_time_ms(delay)));
     }
     sleep_ms(delay);
     return 0;
 }
 
-static int alarm_thread_1(lua_State* ls, int status, lua_KContext ctx);
-static int alarm_thread_2(lua_State* ls, int status, lua_KContext ctx);
+// A scheduled alarm or repeating timer. "delay" is zero for alarms, and holds
+// the interval for repeating timers (negative if relative to the scheduled
+// time).
+typedef struct Alarm {
+    uint64_t time;
+    int64_t delay;
+    uint32_t id;
+} Alarm;
+
+// The alarms of an interpreter, as a binary min-heap ordered by time. The
+// callbacks are stored in uservalue 1, keyed by alarm ID, the dispatcher thread
+// in uservalue 2, and the userdata holding the heap in uservalue 3. "running"
+// is the ID of the alarm whose callback is currently being called, or zero if
+// no callback is running or if the alarm was cancelled from its callback.
+typedef struct Alarms {
+    Alarm* heap;
+    uint32_t len;
+    uint32_t cap;
+    uint32_t next_id;
+    uint32_t running;
+    Alarm current;
+} Alarms;
+
+static char const alarms_key[] = "pico.time.alarms";
+
+static inline bool alarm_before(Alarm const* a, Alarm const* b) {
+    if (a->time != b->time) return a->time < b->time;
+    return (int32_t)(a->id - b->id) < 0;
+}
 
-static int alarm_thread(lua_State* ls) {
-    lua_pushcfunction(ls, &mod_sleep_until);
-    lua_pushvalue(ls, lua_upvalueindex(1));  // time
-    return mlua_callk(ls, 1, 0, alarm_thread_1, 0);
+static void sift_up(Alarm* heap, uint32_t i) {
+    Alarm al = heap[i];
+    while (i > 0) {
+        uint32_t parent = (i - 1) / 2;
+        if (!alarm_before(&al, &heap[parent])) break;
+        heap[i] = heap[parent];
+        i = parent;
+    }
+    heap[i] = al;
 }
 
-static int alarm_thread_1(lua_State* ls, int status, lua_KContext ctx) {
-    lua_pushvalue(ls, lua_upvalueindex(2));  // callback
-    lua_pushthread(ls);
-    return mlua_callk(ls, 1, 1, alarm_thread_2, ctx);
+static void sift_down(Alarm* heap, uint32_t len, uint32_t i) {
+    Alarm al = heap[i];
+    for (;;) {
+        uint32_t child = 2 * i + 1;
+        if (child >= len) break;
+        if (child + 1 < len && alarm_before(&heap[child + 1], &heap[child])) {
+            ++child;
+        }
+        if (!alarm_before(&heap[child], &al)) break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = al;
 }
 
-static int alarm_thread_2(lua_State* ls, int status, lua_KContext ctx) {
-    int64_t delay = mlua_check_int64(ls, lua_upvalueindex(3));  // delay
-    if (delay == 0) {  // Alarm
-        if (lua_isnil(ls, -1)) return 0;
-        delay = mlua_check_int64(ls, -1);
-        lua_pop(ls, 1);
-    } else if (lua_isboolean(ls, -1)) {  // Repeating timer
-        if (!lua_toboolean(ls, -1)) return 0;
-        lua_pop(ls, 1);
-    } else if (!lua_isnil(ls, -1)) {  // Repeating timer, delay update
-        delay = mlua_check_int64(ls, -1);
-        lua_replace(ls, lua_upvalueindex(3));
+// Add an alarm to the heap of the alarms at the given index, growing the heap
+// if necessary.
+static void push_alarm(lua_State* ls, int arg, Alarms* alarms,
+                       Alarm const* al) {
+    if (alarms->len == alarms->cap) {
+        arg = lua_absindex(ls, arg);
+        uint32_t cap = alarms->cap > 0 ? 2 * alarms->cap : 8;
+        Alarm* heap = lua_newuserdatauv(ls, cap * sizeof(Alarm), 0);
+        if (alarms->len > 0) {
+            memcpy(heap, alarms->heap, alarms->len * sizeof(Alarm));
+        }
+        lua_setiuservalue(ls, arg, 3);
+        alarms->heap = heap;
+        alarms->cap = cap;
     }
-    if (delay == 0) return 0;
-    absolute_time_t now = get_absolute_time();
-    absolute_time_t next = delay < 0 ?
-        delayed_by_us(from_us_since_boot(mlua_to_time(ls, lua_upvalueindex(1))),
-                      (uint64_t)-delay)
-        : delayed_by_us(now, (uint64_t)delay);
-    int64_t dt = absolute_time_diff_us(now, next);
-    if (LUA_MININTEGER <= dt && dt <= LUA_MAXINTEGER) {
-        lua_pushinteger(ls, (lua_Unsigned)to_us_since_boot(next));
+    alarms->heap[alarms->len] = *al;
+    sift_up(alarms->heap, alarms->len++);
+}
+
+static void remove_alarm(Alarms* alarms, uint32_t i) {
+    Alarm* heap = alarms->heap;
+    if (i == --alarms->len) return;
+    heap[i] = heap[alarms->len];
+    if (i > 0 && alarm_before(&heap[i], &heap[(i - 1) / 2])) {
+        sift_up(heap, i);
     } else {
-        mlua_push_int64(ls, to_us_since_boot(next));
+        sift_down(heap, alarms->len, i);
     }
-    lua_replace(ls, lua_upvalueindex(1));
-    return alarm_thread(ls);
 }
 
-typedef enum Delta {
-    D_UNKNOWN,
-    D_INTEGER,
-    D_INT64,
-} Delta;
-
-static int schedule_alarm(lua_State* ls, absolute_time_t time,
-                          bool fire_if_past, int64_t delay, Delta delta) {
-    if (!fire_if_past && time_reached(time)) return 0;
+// Remove the callback of the given alarm.
+static void drop_callback(lua_State* ls, int arg, uint32_t id) {
+    lua_getiuservalue(ls, arg, 1);
+    lua_pushnil(ls);
+    lua_rawseti(ls, -2, id);
+    lua_pop(ls, 1);
+}
 
-    // Start the alarm thread.
-    if (delta == D_INTEGER
-        || (delta == D_UNKNOWN
-            && absolute_time_diff_us(get_absolute_time(), time)
-               <= LUA_MAXINTEGER)) {
-        lua_pushinteger(ls, (lua_Unsigned)to_us_since_boot(time));  // time
+// Handle the result of the callback of the current alarm, at the top of the
+// stack, and re-schedule the alarm if requested.
+static void finish_alarm(lua_State* ls, Alarms* alarms, int status) {
+    Alarm al = alarms->current;
+    bool cancelled = alarms->running == 0;
+    alarms->running = 0;
+    int64_t delay = al.delay;
+    if (status == LUA_OK || status == LUA_YIELD) {
+        int ok = true;
+        if (al.delay == 0) {  // Alarm
+            if (!lua_isnil(ls, -1)) delay = mlua_to_int64x(ls, -1, &ok);
+        } else if (lua_isboolean(ls, -1)) {  // Repeating timer
+            if (!lua_toboolean(ls, -1)) delay = 0;
+        } else if (!lua_isnil(ls, -1)) {  // Repeating timer, delay update
+            delay = al.delay = mlua_to_int64x(ls, -1, &ok);
+        }
+        if (!ok) delay = 0;
     } else {
-        mlua_push_int64(ls, to_us_since_boot(time));  // time
+        delay = 0;
+    }
+    lua_settop(ls, 0);
+    if (cancelled) return;
+    if (delay == 0) {
+        drop_callback(ls, lua_upvalueindex(1), al.id);
+        return;
     }
-    lua_pushvalue(ls, 2);  // callback
-    mlua_push_minint(ls, delay);  // delay
-    lua_pushcclosure(ls, &alarm_thread, 3);
+    al.time = delay < 0 ? al.time + (uint64_t)-delay
+              : to_us_since_boot(get_absolute_time()) + (uint64_t)delay;
+    push_alarm(ls, lua_upvalueindex(1), alarms, &al);
+}
+
+static int dispatch_alarms_1(lua_State* ls, int status, lua_KContext ctx);
+
+static int dispatch_alarms(lua_State* ls) {
+    return dispatch_alarms_1(ls, LUA_OK, 0);
+}
+
+// The main loop of the dispatcher thread. The context is non-zero when
+// returning from a callback that yielded.
+static int dispatch_alarms_1(lua_State* ls, int status, lua_KContext ctx) {
+    Alarms* alarms = lua_touserdata(ls, lua_upvalueindex(1));
+    if (ctx != 0) finish_alarm(ls, alarms, status);
+    for (;;) {
+        lua_settop(ls, 0);
+        if (alarms->len == 0) {
+            return mlua_thread_suspend(ls, &dispatch_alarms_1, 0, 0);
+        }
+        uint64_t time = alarms->heap[0].time;
+        if (!mlua_ticks64_reached(time)) {
+            return mlua_thread_suspend_until(ls, &dispatch_alarms_1, 0, time);
+        }
+        alarms->current = alarms->heap[0];
+        alarms->running = alarms->current.id;
+        remove_alarm(alarms, 0);
+        lua_getiuservalue(ls, lua_upvalueindex(1), 1);
+        lua_rawgeti(ls, -1, alarms->current.id);
+        lua_pushinteger(ls, alarms->current.id);
+        status = lua_pcallk(ls, 1, 1, 0, 1, &dispatch_alarms_1);
+        finish_alarm(ls, alarms, status);
+    }
+}
+
+// Push the alarms of the interpreter, creating them and starting the
+// dispatcher thread on first use.
+static Alarms* push_alarms(lua_State* ls) {
+    if (lua_getfield(ls, LUA_REGISTRYINDEX, alarms_key) != LUA_TNIL) {
+        return lua_touserdata(ls, -1);
+    }
+    lua_pop(ls, 1);
+    Alarms* alarms = lua_newuserdatauv(ls, sizeof(Alarms), 3);
+    *alarms = (Alarms){.next_id = 1};
+    lua_newtable(ls);
+    lua_setiuservalue(ls, -2, 1);
+    lua_pushvalue(ls, -1);
+    lua_pushcclosure(ls, &dispatch_alarms, 1);
     mlua_thread_start(ls);
-    return 1;
+    lua_setiuservalue(ls, -2, 2);
+    lua_pushvalue(ls, -1);
+    lua_setfield(ls, LUA_REGISTRYINDEX, alarms_key);
+    return alarms;
+}
+
+static int schedule_alarm(lua_State* ls, absolute_time_t time,
+                          bool fire_if_past, int64_t delay) {
+    if (!fire_if_past && time_reached(time)) return 0;
+    luaL_checktype(ls, 2, LUA_TFUNCTION);
+    Alarms* alarms = push_alarms(ls);
+    uint32_t id = alarms->next_id++;
+    if (alarms->next_id == 0) alarms->next_id = 1;
+    Alarm al = {.time = to_us_since_boot(time), .delay = delay, .id = id};
+    push_alarm(ls, -1, alarms, &al);
+    lua_getiuservalue(ls, -1, 1);
+    lua_pushvalue(ls, 2);
+    lua_rawseti(ls, -2, id);
+    lua_pop(ls, 1);
+
+    // Wake up the dispatcher if the alarm is the next one to fire, unless it is
+    // running a callback.
+    if (alarms->heap[0].id == id && alarms->running == 0) {
+        mlua_thread_meta(ls, "resume");
+        lua_getiuservalue(ls, -2, 2);
+        lua_call(ls, 1, 0);
+    }
+    return lua_pushinteger(ls, id), 1;
 }
 
 static int mod_add_alarm_at(lua_State* ls) {
     absolute_time_t time = check_time(ls, 1);
     bool fire_if_past = mlua_to_cbool(ls, 3);
-    return schedule_alarm(ls, time, fire_if_past, 0, D_UNKNOWN);
+    return schedule_alarm(ls, time, fire_if_past, 0);
 }
 
 static int mod_add_alarm_in_us(lua_State* ls) {
     uint64_t delay = mlua_check_int64(ls, 1);
     bool fire_if_past = mlua_to_cbool(ls, 3);
-    return schedule_alarm(ls, make_timeout_time_us(delay), fire_if_past, 0,
-                          delay <= LUA_MAXINTEGER ? D_INTEGER : D_INT64);
+    return schedule_alarm(ls, make_timeout_time_us(delay), fire_if_past, 0);
 }
 
 static int mod_add_alarm_in_ms(lua_State* ls) {
     uint32_t delay = luaL_checkinteger(ls, 1);
     bool fire_if_past = mlua_to_cbool(ls, 3);
-    return schedule_alarm(ls, make_timeout_time_ms(delay), fire_if_past, 0,
-                          delay <= LUA_MAXINTEGER / 1000 ? D_INTEGER : D_INT64);
+    return schedule_alarm(ls, make_timeout_time_ms(delay), fire_if_past, 0);
 }
 
 static int mod_cancel_alarm(lua_State* ls) {
-    mlua_check_thread(ls, 1);
-    lua_settop(ls, 1);
-    mlua_thread_kill(ls);
-    return 1;
+    uint32_t id = luaL_checkinteger(ls, 1);
+    if (lua_getfield(ls, LUA_REGISTRYINDEX, alarms_key) == LUA_TNIL) {
+        return lua_pushboolean(ls, false), 1;
+    }
+    Alarms* alarms = lua_touserdata(ls, -1);
+    lua_getiuservalue(ls, -1, 1);
+    if (lua_rawgeti(ls, -1, id) == LUA_TNIL) {
+        return lua_pushboolean(ls, false), 1;
+    }
+    drop_callback(ls, -3, id);
+    if (alarms->running == id) {
+        alarms->running = 0;
+    } else {
+        for (uint32_t i = 0; i < alarms->len; ++i) {
+            if (alarms->heap[i].id == id) {
+                remove_alarm(alarms, i);
+                break;
+            }
+        }
+    }
+    return lua_pushboolean(ls, true), 1;
 }
 
 static int mod_add_repeating_timer_us(lua_State* ls) {
     int64_t delay = mlua_check_int64(ls, 1);
     if (delay == 0) delay = 1;
     int64_t delta = delay >= 0 ? delay : -delay;
-    return schedule_alarm(ls, make_timeout_time_us(delta), true, delay,
-                          delta <= LUA_MAXINTEGER ? D_INTEGER : D_INT64);
+    return schedule_alarm(ls, make_timeout_time_us(delta), true, delay);
 }
 
 static int mod_add_repeating_timer_ms(lua_State* ls) {
     int64_t delay = (int64_t)luaL_checkinteger(ls, 1) * 1000;
     if (delay == 0) delay = 1;
     int64_t delta = delay >= 0 ? delay : -delay;
-    return schedule_alarm(ls, make_timeout_time_us(delta), true, delay,
-                          delta <= LUA_MAXINTEGER / 1000 ? D_INTEGER : D_INT64);
+    return schedule_alarm(ls, make_timeout_time_us(delta), true, delay);
 }
 
 MLUA_FUNC_R0(mod_,, get_absolute_time, push_absolute_time)
@@ -212,7 +339,7 @@ MLUA_FUNC_R1(mod_,, to_ms_since_boot, lua_pushinteger, check_time)
 MLUA_FUNC_R2(mod_,, delayed_by_us, push_absolute_time, check_time,
              mlua_check_int64)
 MLUA_FUNC_R2(mod_,, delayed_by_ms, push_absolute_time, check_time,
-             luaL_checkinteger)
+             mlua_arg_integer)
 MLUA_FUNC_R2(mod_,, absolute_time_diff_us, mlua_push_minint, check_time,
              check_time)
 MLUA_FUNC_R2(mod_,, absolute_time_min, push_absolute_time, check_time,
@@ -243,7 +370,7 @@ MLUA_SYMBOLS(module_syms) = {
     MLUA_SYM_F(sleep_ms, mod_),
     MLUA_SYM_F(best_effort_wfe_or_timeout, mod_),
 
-    // alarm_pool_*: not useful in Lua, as thread-based alarms are unlimited
+    // alarm_pool_*: not useful in Lua, as dispatched alarms are unlimited
     MLUA_SYM_F_THREAD(add_alarm_at, mod_),
     MLUA_SYM_F_THREAD(add_alarm_in_us, mod_),
     MLUA_SYM_F_THREAD(add_alarm_in_ms, mod_),
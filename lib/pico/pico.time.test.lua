@@ -90,6 +90,8 @@ function test_best_effort_wfe_or_timeout(t)
 end
 
 function test_add_alarm(t)
+    local parent = thread.running()
+
     -- Test absolute alarms.
     for_each_time(t, function(get_time)
         local start = get_time()
@@ -103,9 +105,10 @@ function test_add_alarm(t)
             alarm = time.add_alarm_at(arg, function(a)
                 t2 = get_time()
                 t:expect(a):label("alarm"):eq(alarm)
+                parent:resume()
             end, fip)
             if alarm then
-                alarm:join()
+                thread.suspend()
                 if want == 0 then want = t1 end
                 t:expect(t2):label("add_alarm_at(%s): end time", arg)
                     :gte(want):lt(want + 800)
@@ -124,9 +127,10 @@ function test_add_alarm(t)
         alarm = time[fn](arg, function(a)
             t2 = time.get_absolute_time_int()
             t:expect(a):label("alarm"):eq(alarm)
+            parent:resume()
         end, fip)
         if alarm then
-            alarm:join()
+            thread.suspend()
             want = t1 + want
             t:expect(t2):label("%s(%s): end time", fn, arg)
                 :gte(want):lt(want + 800)
@@ -135,16 +139,32 @@ function test_add_alarm(t)
     end
 end
 
+function test_alarm_order(t)
+    local parent = thread.running()
+    local got, ids = {}, {}
+    for i, delay in ipairs{3000, 1000, 2000, 1000} do
+        ids[i] = time.add_alarm_in_us(delay, function(a)
+            got[#got + 1] = a
+            if #got == 4 then parent:resume() end
+        end)
+    end
+    thread.suspend()
+    t:expect(got):label("order"):eq{ids[2], ids[4], ids[3], ids[1]}
+end
+
 function test_alarm_repeat(t)
+    local parent = thread.running()
     for_each_time(t, function(get_time)
         local res, got = {-2000, 2000, 0}, list()
         local start = get_time()
-        local alarm = time.add_alarm_at(start + 1000, function()
+        time.add_alarm_at(start + 1000, function()
             got:append(get_time())
             time.sleep_us(1000)
-            return res[#got]
+            local r = res[#got]
+            if r == 0 then parent:resume() end
+            return r
         end)
-        alarm:join()
+        thread.suspend()
 
         local want = {1000, 3000, 6000}
         t:expect(t.expr(got):len()):eq(#want)
@@ -158,39 +178,55 @@ end
 function test_cancel_alarm(t)
     local parent = thread.running()
 
-    -- Cancel before the alarm thread starts.
+    -- Cancel before the dispatcher runs.
     local triggered = false
     local alarm = time.add_alarm_in_ms(10000, function() triggered = true end)
     t:expect(t.expr(time).cancel_alarm(alarm)):eq(true)
+    t:expect(t.expr(time).cancel_alarm(alarm)):eq(false)
     t:expect(triggered):label("triggered"):eq(false)
 
-    -- Cancel before the sleep elapses.
+    -- Cancel before the alarm fires.
     local triggered = false
     local alarm = time.add_alarm_in_ms(10000, function() triggered = true end)
     thread.yield()
     t:expect(t.expr(time).cancel_alarm(alarm)):eq(true)
     t:expect(triggered):label("triggered"):eq(false)
 
-    -- Cancel while the callback runs.
-    local triggered = false
-    local alarm = time.add_alarm_in_us(800, function()
+    -- Cancel while the callback runs. The callback completes, but the alarm
+    -- isn't re-scheduled.
+    local count = 0
+    local alarm = time.add_repeating_timer_us(800, function()
+        count = count + 1
         parent:resume()
         thread.yield()
-        triggered = true
     end)
     thread.suspend()
     t:expect(t.expr(time).cancel_alarm(alarm)):eq(true)
-    t:expect(triggered):label("triggered"):eq(false)
+    time.sleep_us(3000)
+    t:expect(count):label("count"):eq(1)
 
     -- Cancel after the callback terminates.
     local triggered = false
-    local alarm = time.add_alarm_in_us(100, function() triggered = true end)
-    alarm:join()
+    local alarm = time.add_alarm_in_us(100, function()
+        triggered = true
+        parent:resume()
+    end)
+    thread.suspend()
     t:expect(t.expr(time).cancel_alarm(alarm)):eq(false)
     t:expect(triggered):label("triggered"):eq(true)
+
+    -- An error in the callback cancels the alarm.
+    local alarm = time.add_repeating_timer_us(100, function()
+        parent:resume()
+        error("boom")
+    end)
+    thread.suspend()
+    thread.yield()
+    t:expect(t.expr(time).cancel_alarm(alarm)):eq(false)
 end
 
 function test_add_repeating_timer(t)
+    local parent = thread.running()
     for_each_time(t, function(get_time)
         for _, test in ipairs{
             {'add_repeating_timer_us', 1000},
@@ -199,12 +235,14 @@ function test_add_repeating_timer(t)
             local fn, fact = table.unpack(test)
             local res, got = list.pack(nil, -3000, true, 1000, false), list()
             local start = get_time()
-            local alarm = time[fn](-2 * fact, function()
+            time[fn](-2 * fact, function()
                 got:append(get_time())
                 time.sleep_us(1000)
-                return res[#got]
+                local r = res[#got]
+                if r == false then parent:resume() end
+                return r
             end)
-            alarm:join()
+            thread.suspend()
 
             local want = {2000, 4000, 7000, 10000, 12000}
             t:expect(t.expr(got):len()):eq(#want)
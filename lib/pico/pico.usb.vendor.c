@@ -0,0 +1,380 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "hardware/sync.h"
+#include "pico/platform.h"
+#include "pico/stdio_usb.h"
+#include "pico/time.h"
+#include "pico/unique_id.h"
+#include "tusb.h"
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+#include "pico/stdio_usb/reset_interface.h"
+#endif
+
+#include "lua.h"
+#include "lauxlib.h"
+#include "mlua/module.h"
+#include "mlua/thread.h"
+#include "mlua/util.h"
+
+// The USB vendor and product IDs. They default to the values used by the SDK
+// for USB stdio, so that tools locating the device by ID keep working.
+#ifndef MLUA_USB_VENDOR_VID
+#define MLUA_USB_VENDOR_VID 0x2e8a
+#endif
+#ifndef MLUA_USB_VENDOR_PID
+#define MLUA_USB_VENDOR_PID 0x000a
+#endif
+
+// The product string of the device.
+#ifndef MLUA_USB_VENDOR_PRODUCT
+#define MLUA_USB_VENDOR_PRODUCT "MicroLua"
+#endif
+
+// The size of the chunks used to copy data from and to non-raw buffers.
+#define CHUNK_SIZE 64
+
+// The vendor interface index, as seen by TinyUSB.
+#define ITF 0
+
+// Device descriptors. USB servicing (tud_task()) is performed by the
+// background task of pico_stdio_usb, which uses the first CDC interface.
+
+enum {
+    ITF_NUM_CDC,
+    ITF_NUM_CDC_DATA,
+    ITF_NUM_VENDOR,
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+    ITF_NUM_RESET,
+#endif
+    ITF_NUM_TOTAL,
+};
+
+enum {
+    STR_LANGID,
+    STR_MANUFACTURER,
+    STR_PRODUCT,
+    STR_SERIAL,
+    STR_CDC,
+    STR_VENDOR,
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+    STR_RESET,
+#endif
+    STR_COUNT,
+};
+
+#define EP_CDC_NOTIF 0x81
+#define EP_CDC_OUT 0x02
+#define EP_CDC_IN 0x82
+#define EP_VENDOR_OUT 0x03
+#define EP_VENDOR_IN 0x83
+
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+#define RESET_DESC_LEN TUD_RPI_RESET_DESC_LEN
+#else
+#define RESET_DESC_LEN 0
+#endif
+
+#define CONFIG_LEN (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN \
+                    + TUD_VENDOR_DESC_LEN + RESET_DESC_LEN)
+
+static tusb_desc_device_t const device_desc = {
+    .bLength = sizeof(tusb_desc_device_t),
+    .bDescriptorType = TUSB_DESC_DEVICE,
+    .bcdUSB = 0x0200,
+    .bDeviceClass = TUSB_CLASS_MISC,
+    .bDeviceSubClass = MISC_SUBCLASS_COMMON,
+    .bDeviceProtocol = MISC_PROTOCOL_IAD,
+    .bMaxPacketSize0 = CFG_TUD_ENDPOINT0_SIZE,
+    .idVendor = MLUA_USB_VENDOR_VID,
+    .idProduct = MLUA_USB_VENDOR_PID,
+    .bcdDevice = 0x0100,
+    .iManufacturer = STR_MANUFACTURER,
+    .iProduct = STR_PRODUCT,
+    .iSerialNumber = STR_SERIAL,
+    .bNumConfigurations = 1,
+};
+
+static uint8_t const config_desc[CONFIG_LEN] = {
+    TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL, STR_LANGID, CONFIG_LEN, 0, 250),
+    TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, STR_CDC, EP_CDC_NOTIF, 8, EP_CDC_OUT,
+                       EP_CDC_IN, 64),
+    TUD_VENDOR_DESCRIPTOR(ITF_NUM_VENDOR, STR_VENDOR, EP_VENDOR_OUT,
+                          EP_VENDOR_IN, 64),
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+    TUD_RPI_RESET_DESCRIPTOR(ITF_NUM_RESET, STR_RESET),
+#endif
+};
+
+static char const* const strings[STR_COUNT] = {
+    [STR_MANUFACTURER] = "Raspberry Pi",
+    [STR_PRODUCT] = MLUA_USB_VENDOR_PRODUCT,
+    [STR_CDC] = "Board CDC",
+    [STR_VENDOR] = "Vendor",
+#if PICO_STDIO_USB_ENABLE_RESET_VIA_VENDOR_INTERFACE
+    [STR_RESET] = "Reset",
+#endif
+};
+
+uint8_t const* tud_descriptor_device_cb(void) {
+    return (uint8_t const*)&device_desc;
+}
+
+uint8_t const* tud_descriptor_configuration_cb(uint8_t index) {
+    return config_desc;
+}
+
+uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid) {
+    static uint16_t desc[32];
+    static char serial[2 * PICO_UNIQUE_BOARD_ID_SIZE_BYTES + 1];
+    uint8_t len;
+    if (index == STR_LANGID) {
+        desc[1] = 0x0409;  // English
+        len = 1;
+    } else if (index < STR_COUNT) {
+        char const* s = strings[index];
+        if (index == STR_SERIAL) {
+            if (serial[0] == '\0') {
+                pico_get_unique_board_id_string(serial, sizeof(serial));
+            }
+            s = serial;
+        }
+        for (len = 0; len < MLUA_SIZE(desc) - 1 && s[len] != '\0'; ++len) {
+            desc[1 + len] = s[len];
+        }
+    } else {
+        return NULL;
+    }
+    desc[0] = (uint16_t)((TUSB_DESC_STRING << 8) | (2 * len + 2));
+    return desc;
+}
+
+// The events set by the vendor class callbacks, which are called from the
+// USB servicing task.
+static MLuaEvent rx_event;
+static MLuaEvent tx_event;
+
+#if TUSB_VERSION_MAJOR == 0 && TUSB_VERSION_MINOR < 16
+void tud_vendor_rx_cb(uint8_t itf) {
+#else
+void tud_vendor_rx_cb(uint8_t itf, uint8_t const* buffer, uint16_t bufsize) {
+#endif
+    mlua_event_set(&rx_event);
+}
+
+void tud_vendor_tx_cb(uint8_t itf, uint32_t sent_bytes) {
+    mlua_event_set(&tx_event);
+}
+
+// The servicing task runs in a low-priority IRQ on the core that initialized
+// USB stdio. Calls into TinyUSB are performed with interrupts disabled on that
+// same core, so that they don't race with the task.
+
+static void check_core(lua_State* ls) {
+    uint core = alarm_pool_core_num(alarm_pool_get_default());
+    if (get_core_num() != core) {
+        luaL_error(ls, "USB vendor: runs on core %d", core);
+    }
+}
+
+static uint32_t vendor_available(void) {
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t res = tud_vendor_n_available(ITF);
+    restore_interrupts(save);
+    return res;
+}
+
+static uint32_t vendor_read(void* dst, uint32_t len) {
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t res = tud_vendor_n_read(ITF, dst, len);
+    restore_interrupts(save);
+    return res;
+}
+
+static uint32_t vendor_write(void const* src, uint32_t len) {
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t res = tud_vendor_n_write(ITF, src, len);
+    tud_vendor_n_write_flush(ITF);
+    restore_interrupts(save);
+    return res;
+}
+
+static int mod_mounted(lua_State* ls) {
+    return lua_pushboolean(ls, tud_vendor_n_mounted(ITF)), 1;
+}
+
+static int mod_available(lua_State* ls) {
+    return lua_pushinteger(ls, vendor_available()), 1;
+}
+
+static int mod_write_available(lua_State* ls) {
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t res = tud_vendor_n_write_available(ITF);
+    restore_interrupts(save);
+    return lua_pushinteger(ls, res), 1;
+}
+
+// Write as much data as the FIFO accepts, starting at the given offset.
+// Returns the new offset.
+static size_t write_some(MLuaBuffer const* buf, size_t offset) {
+    if (buf->vt == NULL) {
+        return offset + vendor_write((uint8_t const*)buf->ptr + offset,
+                                     buf->size - offset);
+    }
+    while (offset < buf->size) {
+        uint8_t chunk[CHUNK_SIZE];
+        size_t cnt = buf->size - offset;
+        if (cnt > sizeof(chunk)) cnt = sizeof(chunk);
+        mlua_buffer_read(buf, offset, cnt, chunk);
+        size_t n = vendor_write(chunk, cnt);
+        // Data that doesn't fit in the FIFO is read again on the next call.
+        offset += n;
+        if (n < cnt) break;
+    }
+    return offset;
+}
+
+static int write_loop(lua_State* ls, bool timeout) {
+    MLuaBuffer buf;
+    mlua_get_ro_buffer(ls, 1, &buf);
+    size_t offset = write_some(&buf, lua_tointeger(ls, 2));
+    if (offset < buf.size) {
+        lua_pushinteger(ls, offset);
+        lua_replace(ls, 2);
+        return -1;
+    }
+    return lua_pushinteger(ls, buf.size), 1;
+}
+
+static int mod_write(lua_State* ls) {
+    check_core(ls);
+    MLuaBuffer buf;
+    luaL_argexpected(ls, mlua_get_ro_buffer(ls, 1, &buf), 1,
+                     "string or buffer");
+    luaL_argcheck(ls, buf.size != SIZE_MAX, 1, "infinite buffer");
+    lua_settop(ls, 1);
+    lua_pushinteger(ls, 0);  // offset
+    if (mlua_event_can_wait(ls, &tx_event, 0)) {
+        return mlua_event_wait(ls, &tx_event, 0, &write_loop, 0);
+    }
+    size_t offset = 0;
+    while ((offset = write_some(&buf, offset)) < buf.size) {
+        tight_loop_contents();
+    }
+    return lua_pushinteger(ls, buf.size), 1;
+}
+
+static int mod_flush(lua_State* ls) {
+    uint32_t save = save_and_disable_interrupts();
+    tud_vendor_n_write_flush(ITF);
+    restore_interrupts(save);
+    return 0;
+}
+
+// Read the available data into the given buffer range. Returns the number of
+// bytes read.
+static size_t read_some(MLuaBuffer const* buf, size_t off, size_t len) {
+    if (buf->vt == NULL) return vendor_read((uint8_t*)buf->ptr + off, len);
+    size_t offset = 0;
+    while (offset < len) {
+        uint8_t chunk[CHUNK_SIZE];
+        size_t cnt = len - offset;
+        if (cnt > sizeof(chunk)) cnt = sizeof(chunk);
+        cnt = vendor_read(chunk, cnt);
+        if (cnt == 0) break;
+        mlua_buffer_write(buf, off + offset, cnt, chunk);
+        offset += cnt;
+    }
+    return offset;
+}
+
+static int read_into_loop(lua_State* ls, bool timeout) {
+    MLuaBuffer buf;
+    mlua_get_buffer(ls, 1, &buf);
+    size_t cnt = read_some(&buf, lua_tointeger(ls, 2), lua_tointeger(ls, 3));
+    if (cnt == 0) return -1;
+    return lua_pushinteger(ls, cnt), 1;
+}
+
+static int mod_read_into(lua_State* ls) {
+    check_core(ls);
+    MLuaBuffer buf;
+    size_t off, len;
+    mlua_check_buffer_range(ls, 1, &buf, &off, &len);
+    if (len == 0) return lua_pushinteger(ls, 0), 1;
+    if (mlua_event_can_wait(ls, &rx_event, 0)) {
+        lua_settop(ls, 1);
+        lua_pushinteger(ls, off);
+        lua_pushinteger(ls, len);
+        return mlua_event_wait(ls, &rx_event, 0, &read_into_loop, 0);
+    }
+    size_t cnt;
+    while ((cnt = read_some(&buf, off, len)) == 0) tight_loop_contents();
+    return lua_pushinteger(ls, cnt), 1;
+}
+
+#if LIB_MLUA_MOD_MLUA_THREAD
+
+static int mod_enable_events(lua_State* ls) {
+    if (!lua_isnone(ls, 1) && !mlua_to_cbool(ls, 1)) {
+        mlua_event_disable(ls, &rx_event);
+        mlua_event_disable(ls, &tx_event);
+        return 0;
+    }
+    if (!mlua_event_enable(ls, &rx_event)) {
+        return luaL_error(ls, "USB vendor: events already enabled");
+    }
+    mlua_event_enable(ls, &tx_event);
+    return 0;
+}
+
+static char const Readable_name[] = "pico.usb.vendor.Readable";
+
+static int Readable___select(lua_State* ls) {
+    lua_pushboolean(ls, vendor_available() != 0);
+    lua_pushlightuserdata(ls, &rx_event);
+    return 2;
+}
+
+MLUA_SYMBOLS_NOHASH(Readable_syms_nh) = {
+    MLUA_SYM_F_NH(__select, Readable_),
+};
+
+#endif  // LIB_MLUA_MOD_MLUA_THREAD
+
+MLUA_SYMBOLS(module_syms) = {
+    MLUA_SYM_V(RX_BUFSIZE, integer, CFG_TUD_VENDOR_RX_BUFSIZE),
+    MLUA_SYM_V(TX_BUFSIZE, integer, CFG_TUD_VENDOR_TX_BUFSIZE),
+
+    MLUA_SYM_F(mounted, mod_),
+    MLUA_SYM_F(available, mod_),
+    MLUA_SYM_F(write_available, mod_),
+    MLUA_SYM_F(write, mod_),
+    MLUA_SYM_F(flush, mod_),
+    MLUA_SYM_F(read_into, mod_),
+    MLUA_SYM_F_THREAD(enable_events, mod_),
+};
+
+// Initialize TinyUSB before USB stdio, which only starts the servicing task
+// when the application links TinyUSB itself.
+static __attribute__((constructor(200))) void init(void) {
+    tusb_init();
+}
+
+MLUA_OPEN_MODULE(pico.usb.vendor) {
+    mlua_thread_require(ls);
+
+    mlua_new_module(ls, 0, module_syms);
+#if LIB_MLUA_MOD_MLUA_THREAD
+    // Create the selectable source for the Rx side of the interface.
+    lua_newuserdatauv(ls, 0, 0);
+    mlua_new_class_nohash(ls, Readable_name, mlua_nosyms, Readable_syms_nh);
+    lua_setmetatable(ls, -2);
+    lua_setfield(ls, -2, "readable");
+#endif
+    return 1;
+}
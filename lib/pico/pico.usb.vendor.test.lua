@@ -0,0 +1,21 @@
+-- Copyright 2024 Remy Blank <remy@c-space.org>
+-- SPDX-License-Identifier: MIT
+
+_ENV = module(...)
+
+local array = require 'mlua.array'
+local vendor = require 'pico.usb.vendor'
+
+function test_state(t)
+    t:expect(t.expr(vendor).RX_BUFSIZE):gt(0)
+    t:expect(t.expr(vendor).TX_BUFSIZE):gt(0)
+    t:expect(type(vendor.mounted())):label("type(mounted())"):eq('boolean')
+    t:expect(t.expr(vendor).available()):gte(0)
+    t:expect(t.expr(vendor).write_available()):gte(0)
+end
+
+function test_args(t)
+    t:expect(t.expr(vendor).write(1)):raises("string or buffer expected")
+    t:expect(t.expr(vendor).write('')):eq(0)
+    t:expect(t.expr(vendor).read_into(array('B', 4), 0, 0)):eq(0)
+end
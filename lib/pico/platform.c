@@ -4,10 +4,29 @@
 #include "mlua/platform.h"
 
 #if PICO_ON_DEVICE
+#include "hardware/clocks.h"
+#include "hardware/dma.h"
 #include "hardware/exception.h"
 #include "hardware/flash.h"
+#include "hardware/structs/scb.h"
+#include "hardware/structs/systick.h"
+#include "hardware/sync.h"
+#if MLUA_ASYNC_CONTEXT_POLL
+#include "pico/async_context_base.h"
+#include "pico/async_context_poll.h"
+#include "pico/mutex.h"
+#else
 #include "pico/async_context_threadsafe_background.h"
 #endif
+#include "pico/platform.h"
+#include "pico/time.h"
+#endif
+
+spin_lock_t* mlua_platform_shared_spinlock;
+
+static __attribute__((constructor)) void init(void) {
+    mlua_platform_shared_spinlock = spin_lock_init(PICO_SPINLOCK_ID_OS2);
+}
 
 bi_decl(bi_program_feature_group_with_flags(
     MLUA_BI_TAG, MLUA_BI_FROZEN_MODULE, "frozen modules",
@@ -51,7 +70,59 @@ static __attribute__((naked)) void hardfault_handler(void) {
 
 void isr_hardfault(void);
 
-#endif  // PICO_ON_DEVICE
+// The SysTick timer counts down from its 24-bit reload value at the CPU clock,
+// and each core has its own. The wrap interrupt extends it to 64 bits.
+#define SYSTICK_MAX M0PLUS_SYST_RVR_BITS
+
+static uint32_t volatile systick_wraps[NUM_CORES];
+
+static void __time_critical_func(systick_handler)(void) {
+    ++systick_wraps[get_core_num()];
+}
+
+void isr_systick(void);
+
+static void setup_cycles(void) {
+    // Set the SysTick exception handler if none was set before, and start the
+    // timer of the current core, unless something else uses it.
+    exception_handler_t handler =
+        exception_get_vtable_handler(SYSTICK_EXCEPTION);
+    if (handler == &isr_systick) {
+        exception_set_exclusive_handler(SYSTICK_EXCEPTION, &systick_handler);
+    } else if (handler != &systick_handler) {
+        return;
+    }
+    if ((systick_hw->csr & M0PLUS_SYST_CSR_ENABLE_BITS) != 0) return;
+    systick_hw->rvr = SYSTICK_MAX;
+    systick_hw->cvr = 0;
+    systick_hw->csr = M0PLUS_SYST_CSR_CLKSOURCE_BITS
+                      | M0PLUS_SYST_CSR_TICKINT_BITS
+                      | M0PLUS_SYST_CSR_ENABLE_BITS;
+}
+
+uint64_t __time_critical_func(mlua_cycles64)(void) {
+    uint32_t save = save_and_disable_interrupts();
+    uint32_t wraps = systick_wraps[get_core_num()];
+    uint32_t cvr = systick_hw->cvr;
+    // If the timer has wrapped but the interrupt hasn't been handled yet,
+    // account for the wrap, and re-read the counter, as the wrap may have
+    // happened after the first read.
+    if ((scb_hw->icsr & M0PLUS_ICSR_PENDSTSET_BITS) != 0) {
+        ++wraps;
+        cvr = systick_hw->cvr;
+    }
+    restore_interrupts(save);
+    return ((uint64_t)wraps << 24) | (SYSTICK_MAX - cvr);
+}
+
+uint32_t mlua_cycles_freq(void) { return clock_get_hz(clk_sys); }
+
+#else  // !PICO_ON_DEVICE
+
+uint64_t mlua_cycles64(void) { return time_us_64(); }
+uint32_t mlua_cycles_freq(void) { return 1000000; }
+
+#endif  // !PICO_ON_DEVICE
 
 void mlua_platform_setup_interpreter(lua_State* ls) {
 #if PICO_ON_DEVICE
@@ -62,10 +133,8 @@ void mlua_platform_setup_interpreter(lua_State* ls) {
         exception_set_exclusive_handler(HARDFAULT_EXCEPTION,
                                         &hardfault_handler);
     }
+    setup_cycles();
 #endif
-
-    // Tune the GC for an embedded system.
-    lua_gc(ls, LUA_GCINC, 120, 100, 12);
 }
 
 char const* mlua_pico_error_str(int err) {
@@ -86,21 +155,208 @@ char const* mlua_pico_error_str(int err) {
 
 #if PICO_ON_DEVICE
 
+#if MLUA_ASYNC_CONTEXT_POLL
+
+// The polled context uses a copy of the type of async_context_poll_t, with
+// hooks that notify the servicing code when work becomes pending. The polled
+// context isn't thread-safe, so the hooks also add a lock, which allows using
+// the context from both cores.
+static async_context_poll_t context;
+static async_context_type_t const* poll_type;
+static async_context_type_t context_type;
+static recursive_mutex_t context_lock;
+static int volatile context_core = -1;
+static void (*volatile context_notify)(void);
+static alarm_id_t context_alarm;
+static bool context_servicing;
+static bool volatile context_pending;
+static uint32_t volatile context_notified;
+static MLuaAsyncContextStats context_stats;
+
+static void __time_critical_func(notify_context)(void) {
+    if (!context_pending) {
+        context_notified = time_us_32();
+        context_pending = true;
+    }
+    void (*notify)(void) = context_notify;
+    if (notify != NULL) notify();
+}
+
+static void __time_critical_func(context_set_work_pending)(
+        async_context_t* self, async_when_pending_worker_t* worker) {
+    poll_type->set_work_pending(self, worker);
+    notify_context();
+}
+
+static void context_acquire_lock(async_context_t* self) {
+    recursive_mutex_enter_blocking(&context_lock);
+}
+
+static void context_release_lock(async_context_t* self) {
+    bool outermost = context_lock.enter_count == 1;
+    recursive_mutex_exit(&context_lock);
+    // Like async_context_threadsafe_background, process work after the
+    // outermost lock is released, as lwIP doesn't notify when it adds timers.
+    if (outermost && !context_servicing) notify_context();
+}
+
+static void context_lock_check(async_context_t* self) {
+    hard_assert(context_lock.owner == lock_get_caller_owner_id());
+}
+
+static uint32_t context_execute_sync(async_context_t* self,
+                                     uint32_t (*func)(void* param),
+                                     void* param) {
+    context_acquire_lock(self);
+    uint32_t res = func(param);
+    context_release_lock(self);
+    return res;
+}
+
+static int64_t handle_context_alarm(alarm_id_t id, void* data) {
+    notify_context();
+    return 0;
+}
+
+async_context_t* mlua_async_context(void) {
+    if (luai_unlikely(context.core.type == NULL)) {
+        if (!async_context_poll_init_with_defaults(&context)) {
+            panic("async context initialization failed");
+            return NULL;
+        }
+        recursive_mutex_init(&context_lock);
+        poll_type = context.core.type;
+        context_type = *poll_type;
+        context_type.acquire_lock_blocking = &context_acquire_lock;
+        context_type.release_lock = &context_release_lock;
+        context_type.lock_check = &context_lock_check;
+        context_type.execute_sync = &context_execute_sync;
+        context_type.set_work_pending = &context_set_work_pending;
+        context.core.type = &context_type;
+        __dmb();
+        context_core = get_core_num();
+    }
+    return &context.core;
+}
+
+void mlua_async_context_set_notify(void (*notify)(void)) {
+    context_notify = notify;
+}
+
+bool mlua_async_context_service(uint32_t budget) {
+    async_context_t* ctx = mlua_async_context();
+    uint32_t start = time_us_32();
+    recursive_mutex_enter_blocking(&context_lock);
+    context_servicing = true;
+    ++context_stats.services;
+    if (context_pending) {
+        uint32_t latency = start - context_notified;
+        context_stats.latency_total += latency;
+        if (latency > context_stats.latency_max) {
+            context_stats.latency_max = latency;
+        }
+    }
+    bool more;
+    absolute_time_t next;
+    do {
+        context_pending = false;
+        ++context_stats.rounds;
+        next = async_context_base_execute_once(ctx);
+        more = context_pending
+               || absolute_time_diff_us(get_absolute_time(), next) <= 0;
+    } while (more && time_us_32() - start < budget);
+    context_servicing = false;
+
+    // Wake up when the next timed work becomes due.
+    if (context_alarm > 0) cancel_alarm(context_alarm);
+    context_alarm = 0;
+    if (more) {
+        ++context_stats.overruns;
+    } else if (!is_at_the_end_of_time(next)) {
+        context_alarm = add_alarm_at(next, &handle_context_alarm, NULL, true);
+    }
+    uint32_t elapsed = time_us_32() - start;
+    if (elapsed > context_stats.service_max) {
+        context_stats.service_max = elapsed;
+    }
+    recursive_mutex_exit(&context_lock);
+    return more;
+}
+
+void mlua_async_context_stats(MLuaAsyncContextStats* stats, bool reset) {
+    mlua_async_context();
+    recursive_mutex_enter_blocking(&context_lock);
+    *stats = context_stats;
+    if (reset) context_stats = (MLuaAsyncContextStats){0};
+    recursive_mutex_exit(&context_lock);
+}
+
+int mlua_async_context_core(void) {
+    int core = context_core;
+    __dmb();
+    return core;
+}
+
+void mlua_async_context_deinit(void) {
+    if (context.core.type == NULL) return;
+    context_core = -1;
+    __dmb();
+    if (context_alarm > 0) cancel_alarm(context_alarm);
+    context_alarm = 0;
+    context.core.type = poll_type;
+    async_context_deinit(&context.core);
+    context.core.type = NULL;
+}
+
+#else  // !MLUA_ASYNC_CONTEXT_POLL
+
 static async_context_threadsafe_background_t context;
+static alarm_pool_t* context_alarm_pool;
+static int volatile context_core = -1;
 
 async_context_t* mlua_async_context(void) {
     // TODO: Don't make this lazy; initialize it from all modules that use it
     if (luai_unlikely(context.low_priority_irq_num == 0)) {
         async_context_threadsafe_background_config_t cfg =
             async_context_threadsafe_background_default_config();
+        uint core = get_core_num();
+        if (core != 0) {
+            // The default alarm pool runs on core 0, but the alarms of the
+            // context must fire on the core that processes its work.
+            context_alarm_pool = alarm_pool_create_with_unused_hardware_alarm(
+                PICO_TIME_DEFAULT_ALARM_POOL_MAX_TIMERS);
+            cfg.custom_alarm_pool = context_alarm_pool;
+        }
         if (!async_context_threadsafe_background_init(&context, &cfg)) {
             panic("async context initialization failed");
             return NULL;
         }
+        __dmb();
+        context_core = core;
     }
     return &context.core;
 }
 
+int mlua_async_context_core(void) {
+    int core = context_core;
+    __dmb();
+    return core;
+}
+
+void mlua_async_context_deinit(void) {
+    if (context.low_priority_irq_num == 0) return;
+    context_core = -1;
+    __dmb();
+    async_context_deinit(&context.core);
+    context.low_priority_irq_num = 0;
+    if (context_alarm_pool != NULL) {
+        alarm_pool_destroy(context_alarm_pool);
+        context_alarm_pool = NULL;
+    }
+}
+
+#endif  // !MLUA_ASYNC_CONTEXT_POLL
+
 extern char const __flash_binary_start[];
 
 static MLuaFlash const flash = {
@@ -112,4 +368,58 @@ static MLuaFlash const flash = {
 
 MLuaFlash const* mlua_platform_flash(void) { return &flash; }
 
+// The minimum length of a block for which checksums are computed with the DMA
+// sniffer. Shorter blocks are faster to checksum in software than to set up a
+// DMA transfer for.
+#ifndef MLUA_PLATFORM_CHECKSUM_DMA_MIN
+#define MLUA_PLATFORM_CHECKSUM_DMA_MIN 32
+#endif
+
+static uint32_t bit_reverse(uint32_t v) {
+    v = ((v >> 1) & 0x55555555u) | ((v & 0x55555555u) << 1);
+    v = ((v >> 2) & 0x33333333u) | ((v & 0x33333333u) << 2);
+    v = ((v >> 4) & 0x0f0f0f0fu) | ((v & 0x0f0f0f0fu) << 4);
+    return __builtin_bswap32(v);
+}
+
+bool mlua_platform_checksum(MLuaChecksum algo, void const* ptr, size_t len,
+                            uint32_t* state) {
+    if (len < MLUA_PLATFORM_CHECKSUM_DMA_MIN) return false;
+    uint mode;
+    uint32_t seed = *state;
+    switch (algo) {
+    case MLUA_CHECKSUM_CRC32:
+        // The sniffer computes the reflected CRC in bit-reversed order.
+        mode = DMA_SNIFF_CTRL_CALC_VALUE_CRC32R;
+        seed = bit_reverse(seed);
+        break;
+    case MLUA_CHECKSUM_CRC16: mode = DMA_SNIFF_CTRL_CALC_VALUE_CRC16; break;
+    case MLUA_CHECKSUM_SUM: mode = DMA_SNIFF_CTRL_CALC_VALUE_SUM; break;
+    default: return false;
+    }
+    if ((dma_hw->sniff_ctrl & DMA_SNIFF_CTRL_EN_BITS) != 0) return false;
+    int ch = dma_claim_unused_channel(false);
+    if (ch < 0) return false;
+
+    // Transfer the block to a fixed address, with the sniffer enabled.
+    static uint8_t sink;
+    dma_channel_config cfg = dma_channel_get_default_config(ch);
+    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
+    channel_config_set_read_increment(&cfg, true);
+    channel_config_set_write_increment(&cfg, false);
+    channel_config_set_sniff_enable(&cfg, true);
+    dma_sniffer_enable(ch, mode, false);
+    dma_sniffer_set_byte_swap_enabled(false);
+    dma_sniffer_set_output_invert_enabled(false);
+    dma_sniffer_set_output_reverse_enabled(algo == MLUA_CHECKSUM_CRC32);
+    dma_sniffer_set_data_accumulator(seed);
+    dma_channel_configure(ch, &cfg, &sink, ptr, len, true);
+    dma_channel_wait_for_finish_blocking(ch);
+    uint32_t res = dma_sniffer_get_data_accumulator();
+    dma_sniffer_disable();
+    dma_channel_unclaim(ch);
+    *state = algo == MLUA_CHECKSUM_CRC16 ? res & 0xffffu : res;
+    return true;
+}
+
 #endif  // PICO_ON_DEVICE
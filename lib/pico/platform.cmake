@@ -1,6 +1,18 @@
 # Copyright 2024 Remy Blank <remy@c-space.org>
 # SPDX-License-Identifier: MIT
 
+mlua_set(MLUA_PICO_RAM_CODE OFF CACHE BOOL
+    "Place the code of the interpreter hot paths in RAM")
+mlua_set(MLUA_PICO_RAM_SOURCES
+    "lvm.c;ldo.c;ltable.c;lstring.c;mlua.thread.c;event.c" CACHE STRING
+    "The source files whose code is placed in RAM with MLUA_PICO_RAM_CODE")
+mlua_set(MLUA_PICO_FLOAT_IMPL "pico" CACHE STRING
+    "The single-precision float implementation, one of (pico, compiler, none)")
+set_property(CACHE MLUA_PICO_FLOAT_IMPL PROPERTY STRINGS pico compiler none)
+mlua_set(MLUA_PICO_DOUBLE_IMPL "pico" CACHE STRING
+    "The double-precision float implementation, one of (pico, compiler, none)")
+set_property(CACHE MLUA_PICO_DOUBLE_IMPL PROPERTY STRINGS pico compiler none)
+
 macro(mlua_pre_project)
     set(PICO_LWIP_PATH "${MLUA_LWIP_SOURCE_DIR}")
     include("${MLUA_PATH}/lib/pico/pico_sdk_import.cmake")
@@ -14,6 +26,48 @@ macro(mlua_post_project)
     add_compile_definitions(PICO_STDIO_DEFAULT_CRLF=0)
 endmacro()
 
+# Place the code of the sources listed in MLUA_PICO_RAM_SOURCES in RAM, next to
+# the .time_critical sections, by deriving a linker script from the default one
+# of the SDK. The memory usage is reported at link time.
+function(mlua_place_sources_in_ram TARGET)
+    set(memmap "")
+    foreach(path IN ITEMS
+            "${PICO_SDK_PATH}/src/rp2_common/pico_crt0/rp2040/memmap_default.ld"
+            "${PICO_SDK_PATH}/src/rp2_common/pico_standard_link/memmap_default.ld")
+        if(EXISTS "${path}")
+            set(memmap "${path}")
+            break()
+        endif()
+    endforeach()
+    if(memmap STREQUAL "")
+        message(FATAL_ERROR "Default linker script not found in the Pico SDK")
+    endif()
+    set(files "")
+    set(rules "")
+    foreach(name IN LISTS MLUA_PICO_RAM_SOURCES)
+        string(APPEND files " */${name}.o*")
+        string(APPEND rules "\n        */${name}.o*(.text*)")
+    endforeach()
+    file(READ "${memmap}" script)
+    set(orig "${script}")
+    string(REGEX REPLACE "EXCLUDE_FILE\\(([^)]*)\\) \\.text\\*"
+        "EXCLUDE_FILE(\\1${files}) .text*" script "${script}")
+    string(REPLACE "*(.time_critical*)" "*(.time_critical*)${rules}"
+        script "${script}")
+    if(script STREQUAL orig)
+        message(FATAL_ERROR "Unsupported linker script: ${memmap}")
+    endif()
+    set(output "${CMAKE_CURRENT_BINARY_DIR}/${TARGET}.memmap.ld")
+    file(WRITE "${output}" "${script}")
+    pico_set_linker_script("${TARGET}" "${output}")
+    target_link_options("${TARGET}" PRIVATE "LINKER:--print-memory-usage")
+endfunction()
+
 function(mlua_add_executable_platform TARGET)
     pico_add_extra_outputs("${TARGET}")
+    pico_set_float_implementation("${TARGET}" "${MLUA_PICO_FLOAT_IMPL}")
+    pico_set_double_implementation("${TARGET}" "${MLUA_PICO_DOUBLE_IMPL}")
+    if(MLUA_PICO_RAM_CODE)
+        mlua_place_sources_in_ram("${TARGET}")
+    endif()
 endfunction()
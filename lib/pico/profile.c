@@ -0,0 +1,45 @@
+// Copyright 2024 Remy Blank <remy@c-space.org>
+// SPDX-License-Identifier: MIT
+
+#include "mlua/profile.h"
+
+#include "hardware/timer.h"
+#include "pico/platform.h"
+#include "pico/time.h"
+
+static int alarm = -1;
+static uint32_t period;
+static absolute_time_t next;
+static void (*handler)(void);
+
+// Set the alarm for the next period, skipping missed periods.
+static void __time_critical_func(schedule)(void) {
+    do {
+        next = delayed_by_us(next, period);
+    } while (hardware_alarm_set_target(alarm, next));
+}
+
+static void __time_critical_func(handle_alarm)(uint num) {
+    schedule();
+    handler();
+}
+
+bool mlua_profile_timer_start(uint32_t p, void (*h)(void)) {
+    int num = hardware_alarm_claim_unused(false);
+    if (num < 0) return false;
+    alarm = num;
+    period = p;
+    handler = h;
+    next = get_absolute_time();
+    hardware_alarm_set_callback(alarm, &handle_alarm);
+    schedule();
+    return true;
+}
+
+void mlua_profile_timer_stop(void) {
+    if (alarm < 0) return;
+    hardware_alarm_cancel(alarm);
+    hardware_alarm_set_callback(alarm, NULL);
+    hardware_alarm_unclaim(alarm);
+    alarm = -1;
+}
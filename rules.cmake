@@ -221,6 +221,23 @@ function(mlua_add_header_module TARGET MOD SRC)
     target_link_libraries("${TARGET}" INTERFACE mlua_core mlua_core_main)
 endfunction()
 
+function(mlua_add_const_module TARGET MOD SRC)
+    mlua_add_library("${TARGET}")
+    cmake_path(ABSOLUTE_PATH SRC)
+    set(template "${MLUA_PATH}/core/module_const.in.c")
+    set(output "${CMAKE_CURRENT_BINARY_DIR}/${MOD}.c")
+    add_custom_command(
+        COMMENT "Generating $<PATH:RELATIVE_PATH,${output},${CMAKE_BINARY_DIR}>"
+        DEPENDS mlua_tool_gen "${SRC}" "${template}"
+        OUTPUT "${output}"
+        COMMAND mlua_tool_gen
+            "constmod" "${MOD}" "${SRC}" "${template}" "${output}"
+        VERBATIM
+    )
+    mlua_add_gen_target("${TARGET}" mlua_gen_const INTERFACE "${output}")
+    target_link_libraries("${TARGET}" INTERFACE mlua_core mlua_core_main)
+endfunction()
+
 function(mlua_add_lua_modules TARGET)
     mlua_add_library("${TARGET}")
     set(compile 1)
@@ -273,6 +290,28 @@ function(mlua_add_fnl_modules TARGET)
     mlua_add_lua_modules("${TARGET}" "${srcs}")
 endfunction()
 
+function(mlua_add_pio_modules TARGET)
+    set(asm "${MLUA_PATH}/lib/pico/hardware.pio.asm.lua")
+    set(oo "${MLUA_PATH}/lib/common/mlua.oo.lua")
+    set(srcs)
+    foreach(src IN LISTS ARGN)
+        cmake_path(ABSOLUTE_PATH src)
+        cmake_path(GET src STEM LAST_ONLY mod)
+        set(output "${CMAKE_CURRENT_BINARY_DIR}/${mod}.lua")
+        add_custom_command(
+            COMMENT "Generating $<PATH:RELATIVE_PATH,${output},${CMAKE_BINARY_DIR}>"
+            DEPENDS mlua_tool_gen "${src}" "${asm}" "${oo}"
+            OUTPUT "${output}"
+            COMMAND mlua_tool_gen
+                "piomod" "${mod}" "${src}" "${asm}" "${oo}" "${output}"
+            VERBATIM
+        )
+        list(APPEND srcs "${output}")
+    endforeach()
+    mlua_add_lua_modules("${TARGET}" "${srcs}")
+    target_link_libraries("${TARGET}" INTERFACE mlua_mod_hardware.pio.asm)
+endfunction()
+
 # TARGET must be a binary target.
 function(mlua_add_config_module TARGET)
     set(template "${MLUA_PATH}/core/module_config.in.c")
@@ -7,16 +7,22 @@
 --  - cmod: Pre-process a C module source file.
 --  - configmod: Generate a C module providing symbols defined in the build
 --    system.
+--  - constmod: Generate a C module holding constant tables, from a Lua, JSON
+--    or CSV file.
 --  - headermod: Generate a C module providing the preprocessor symbols defined
 --    by a header file.
 --  - luamod: Generate a C module from a Lua source file.
+--  - piomod: Generate a Lua module holding pre-assembled PIO programs.
 
 _ENV = module(...)
 
 local io = require 'io'
+local math = require 'math'
 local os = require 'os'
+local package = require 'package'
 local string = require 'string'
 local table = require 'table'
+local utf8 = require 'utf8'
 
 -- Raise an error without location information.
 local function raise(format, ...) return error(format:format(...), 0) end
@@ -421,27 +427,374 @@ function cmd_headermod(args)
     write_file(output, preprocess_cmod(tmpl:gsub('@(%u+)@', sub)))
 end
 
--- Compile a Lua module and return the generated chunk as C array data.
-local function compile_lua(mod, src)
-    -- Compile the input file.
-    local chunk = assert(load(src, '@' .. mod))
-    local bin = string.dump(chunk)
-
-    -- Format the compiled chunk as C array data.
+-- Format a binary string as C array data.
+local function c_array_data(bin)
     local out = {}
     for i = 1, #bin do table.insert(out, ('0x%02x,'):format(bin:byte(i))) end
     return table.concat(out)
 end
 
+-- Compile a Lua module and return the generated chunk, with and without debug
+-- information.
+local function compile_lua(mod, src)
+    local chunk = assert(load(src, '@' .. mod))
+    return string.dump(chunk), string.dump(chunk, true)
+end
+
 -- Generate a C module from a Lua source file.
 function cmd_luamod(args)
     local mod, src, template, output = table.unpack(args, 1, 4)
-    local data = compile_lua(mod, read_file(src))
+    local bin, stripped = compile_lua(mod, read_file(src))
+    printf("%s: %d bytes of bytecode, %d bytes stripped\n", mod, #bin,
+           #stripped)
     local tmpl = read_file(template)
-    local sub = {MOD = mod, DATA = data, INCBIN = '0'}
+    local sub = {MOD = mod, DATA = c_array_data(bin),
+                 STRIPPED = c_array_data(stripped), INCBIN = '0'}
     write_file(output, tmpl:gsub('@(%u+)@', sub))
 end
 
+-- Parse a JSON document.
+local function parse_json(text, path)
+    local pos = 1
+    local function fail(msg)
+        local line = select(2, text:sub(1, pos):gsub('\n', '')) + 1
+        raise("%s:%s: %s", path, line, msg)
+    end
+    local function skip() pos = text:find('[^ \t\r\n]', pos) or #text + 1 end
+    local escapes = {
+        ['"'] = '"', ['\\'] = '\\', ['/'] = '/', b = '\b', f = '\f', n = '\n',
+        r = '\r', t = '\t',
+    }
+    local value
+    local function str()
+        local out = {}
+        pos = pos + 1
+        while true do
+            local s, e, c = text:find('([\\"])', pos)
+            if not s then fail("unterminated string") end
+            table.insert(out, text:sub(pos, s - 1))
+            pos = e + 1
+            if c == '"' then return table.concat(out) end
+            c = text:sub(pos, pos)
+            if c == 'u' then
+                local hex = text:match('^%x%x%x%x', pos + 1)
+                if not hex then fail("invalid escape") end
+                table.insert(out, utf8.char(tonumber(hex, 16)))
+                pos = pos + 5
+            elseif escapes[c] then
+                table.insert(out, escapes[c])
+                pos = pos + 1
+            else
+                fail("invalid escape")
+            end
+        end
+    end
+    local function seq(close, item)
+        pos = pos + 1
+        skip()
+        if text:sub(pos, pos) == close then pos = pos + 1 return end
+        while true do
+            item()
+            skip()
+            local c = text:sub(pos, pos)
+            pos = pos + 1
+            if c == close then return end
+            if c ~= ',' then fail("expected ',' or '" .. close .. "'") end
+            skip()
+        end
+    end
+    function value()
+        skip()
+        local c = text:sub(pos, pos)
+        if c == '{' then
+            local res = {}
+            seq('}', function()
+                if text:sub(pos, pos) ~= '"' then fail("expected key") end
+                local k = str()
+                skip()
+                if text:sub(pos, pos) ~= ':' then fail("expected ':'") end
+                pos = pos + 1
+                res[k] = value()
+            end)
+            return res
+        elseif c == '[' then
+            local res = {}
+            seq(']', function()
+                local v = value()
+                if v == nil then fail("null in array") end
+                table.insert(res, v)
+            end)
+            return res
+        elseif c == '"' then
+            return str()
+        end
+        for lit, v in pairs{['true'] = true, ['false'] = false} do
+            if text:sub(pos, pos + #lit - 1) == lit then
+                pos = pos + #lit
+                return v
+            end
+        end
+        if text:sub(pos, pos + 3) == 'null' then
+            pos = pos + 4
+            return nil
+        end
+        local num = text:match('^-?%d+%.?%d*[eE]?[-+]?%d*', pos)
+        if not num then fail("invalid value") end
+        pos = pos + #num
+        return math.tointeger(num) or tonumber(num)
+    end
+    local res = value()
+    skip()
+    if pos <= #text then fail("trailing data") end
+    return res
+end
+
+-- Convert a CSV cell to a value.
+local function csv_value(cell)
+    if cell == 'true' then return true end
+    if cell == 'false' then return false end
+    return math.tointeger(cell) or tonumber(cell) or cell
+end
+
+-- Parse a CSV document with a header line. Returns a table mapping column
+-- names to lists of cell values.
+local function parse_csv(text, path)
+    local rows = {}
+    for line in lines(text) do
+        line = line:gsub('\r?\n$', '')
+        if line == '' then goto continue end
+        local row, pos = {}, 1
+        while pos <= #line + 1 do
+            local cell
+            if line:sub(pos, pos) == '"' then
+                local s, e = pos + 1
+                cell = {}
+                while true do
+                    e = line:find('"', s, true)
+                    if not e then raise("%s: unterminated quote", path) end
+                    table.insert(cell, line:sub(s, e - 1))
+                    if line:sub(e + 1, e + 1) ~= '"' then break end
+                    table.insert(cell, '"')
+                    s = e + 2
+                end
+                cell, pos = table.concat(cell), e + 2
+            else
+                local e = line:find(',', pos, true) or #line + 1
+                cell, pos = csv_value(line:sub(pos, e - 1)), e + 1
+            end
+            table.insert(row, cell)
+        end
+        table.insert(rows, row)
+        ::continue::
+    end
+    local header = table.remove(rows, 1)
+    if not header then raise("%s: missing header", path) end
+    local res = {}
+    for i, name in ipairs(header) do
+        local col = {}
+        for j, row in ipairs(rows) do
+            if #row ~= #header then
+                raise("%s: row %s: expected %s cells, got %s", path, j + 1,
+                      #header, #row)
+            end
+            col[j] = row[i]
+        end
+        res[tostring(name)] = col
+    end
+    return res
+end
+
+-- Load the data of a constant module from a Lua, JSON or CSV file.
+local function load_const(path)
+    local text = read_file(path)
+    local ext = path:match('%.(%w+)$')
+    if ext == 'json' then return parse_json(text, path) end
+    if ext == 'csv' then return parse_csv(text, path) end
+    if ext ~= 'lua' then raise("%s: unsupported file type", path) end
+    local env = {math = math, string = string, table = table, utf8 = utf8,
+                 ipairs = ipairs, pairs = pairs, tonumber = tonumber,
+                 tostring = tostring}
+    return assert(load(text, '@' .. path, 't', env))()
+end
+
+-- Format a string as a C string literal.
+local function c_string(s)
+    if s:find('\0', 1, true) then raise("string contains NUL: %q", s) end
+    return '"' .. s:gsub('[%c"\\\128-\255]', function(c)
+        return ('\\%03o'):format(c:byte())
+    end) .. '"'
+end
+
+-- Format a value as a symbol value initializer.
+local function c_value(v, tables)
+    local typ = math.type(v) or type(v)
+    if typ == 'integer' then
+        local lit = v == math.mininteger and 'LUA_MININTEGER'
+                    or tostring(v)
+        return ('.push = &mlua_sym_push_integer, .integer = %s'):format(lit)
+    elseif typ == 'float' then
+        if v ~= v or v == math.huge or v == -math.huge then
+            raise("unsupported number: %s", v)
+        end
+        return ('.push = &mlua_sym_push_number, .number = %s'):format(
+            ('%a'):format(v))
+    elseif typ == 'boolean' then
+        return ('.push = &mlua_sym_push_boolean, .boolean = %s'):format(v)
+    elseif typ == 'string' then
+        return ('.push = &mlua_sym_push_string, .string = %s'):format(
+            c_string(v))
+    elseif typ == 'table' then
+        return ('.push = &mlua_sym_push_const_table, '
+                .. '.lightuserdata = (void*)&%s'):format(tables(v))
+    end
+    raise("unsupported value type: %s", typ)
+end
+
+-- The maximum number of keys in a hashed table.
+local max_keys = (1 << 15) - 1
+
+-- Format the constant tables reachable from a root table, children first.
+-- Returns the name of the root table.
+local function format_const_tables(root, out)
+    local names, active = {}, {}
+    local function tables(tab)
+        if names[tab] then return names[tab] end
+        if active[tab] then raise("constant tables must not be cyclic") end
+        active[tab] = true
+        local keys, n = {}, #tab
+        for k in pairs(tab) do
+            if type(k) == 'string' then
+                table.insert(keys, k)
+            elseif math.type(k) ~= 'integer' or k < 1 or k > n then
+                raise("unsupported key: %s", k)
+            end
+        end
+        if #keys > 0 and n > 0 then
+            raise("mixed list and dictionary keys")
+        end
+        local syms = {}
+        if #keys > 0 then
+            table.sort(keys)
+            for _, k in ipairs(keys) do
+                if k:find('\0', 1, true) then raise("key contains NUL") end
+                syms[#syms + 1] = ('    {.name = %s, .value = {%s}},\n'):format(
+                    c_string(k), c_value(tab[k], tables))
+            end
+        else
+            for i = 1, n do
+                syms[i] = ('    {.value = {%s}},\n'):format(
+                    c_value(tab[i], tables))
+            end
+        end
+        local name = ('const_%d'):format(#out + 1)
+        names[tab], active[tab] = name, nil
+        local o = {('static MLuaSym const %s_syms[] = {\n'):format(name)}
+        table.move(syms, 1, #syms, #o + 1, o)
+        table.insert(o, '};\n')
+        local hash = 'NULL'
+        if #keys > 0 then
+            if #keys > max_keys then
+                raise("too many keys: got %s, max %s", #keys, max_keys)
+            end
+            local h = find_perfect_hash(keys)
+            local data, bits = pack_hash(h)
+            check_packed_hash(h, data)
+            table.insert(o, ('static uint8_t const %s_g[] = {'):format(name))
+            for i, b in ipairs(data) do
+                if i % 12 == 1 then table.insert(o, '\n   ') end
+                table.insert(o, (' 0x%02x,'):format(b))
+            end
+            table.insert(o, ('\n};\nstatic MLuaSymHash const %s_hash = {\n'
+                             .. '    .g = %s_g, .seed1 = %s, .seed2 = %s, '
+                             .. '.nkeys = %s, .ng = %s, .bits = %s,\n};\n')
+                            :format(name, name, h.seed1, h.seed2, h.nkeys,
+                                    #h.g, bits))
+            hash = ('&%s_hash'):format(name)
+        end
+        table.insert(o, ('static MLuaConstTable const %s = {\n'
+                         .. '    .syms = %s_syms, .hash = %s, .cnt = %s,\n'
+                         .. '};\n\n'):format(name, name, hash, #syms))
+        table.insert(out, table.concat(o))
+        return name
+    end
+    if type(root) ~= 'table' then raise("constant data must be a table") end
+    return tables(root)
+end
+
+-- Generate a C module holding constant tables in flash, from a Lua, JSON or
+-- CSV file.
+function cmd_constmod(args)
+    local mod, src, template, output = table.unpack(args, 1, 4)
+    local out = {}
+    local root = format_const_tables(load_const(src), out)
+    printf("%s: %d constant tables\n", mod, #out)
+    local tmpl = read_file(template)
+    local sub = {MOD = mod, TABLES = table.concat(out), ROOT = root}
+    write_file(output, (tmpl:gsub('@(%u+)@', sub)))
+end
+
+-- Load a Lua module from its source file.
+local function load_module(mod, path)
+    assert(load(read_file(path), '@' .. path))(mod)
+    return package.loaded[mod]
+end
+
+-- Return the keys of a table, sorted.
+local function sorted_keys(tab)
+    local keys = {}
+    for k in pairs(tab) do table.insert(keys, k) end
+    table.sort(keys)
+    return keys
+end
+
+-- Format a Program as a call to hardware.pio.asm.program().
+local function format_program(prog)
+    local out = {'asm.program{'}
+    for i, instr in ipairs(prog) do
+        if i % 8 == 1 then table.insert(out, '\n   ') end
+        table.insert(out, (' 0x%04x,'):format(instr))
+    end
+    for _, k in ipairs{'origin', 'wrap_target', 'wrap', 'ss', 'so', 'sd'} do
+        local v = prog[k]
+        if v ~= nil then
+            table.insert(out, ('\n    %s = %s,'):format(k, tostring(v)))
+        end
+    end
+    table.insert(out, '\n    labels = {')
+    for _, name in ipairs(sorted_keys(prog.labels)) do
+        table.insert(out, ('%s = %d, '):format(name, prog.labels[name]))
+    end
+    table.insert(out, '},\n}')
+    return table.concat(out)
+end
+
+-- Generate a Lua module holding pre-assembled PIO programs. The source module
+-- is run on the host, with a stub hardware.pio module, and each of its public
+-- values must be a Program. The generated module re-creates the programs from
+-- their instruction words, without running the assembler.
+function cmd_piomod(args)
+    local mod, src, asm_src, oo_src, output = table.unpack(args, 1, 5)
+    package.loaded['hardware.pio'] = {}
+    load_module('mlua.oo', oo_src)
+    local asm = load_module('hardware.pio.asm', asm_src)
+    local progs = load_module(mod, src)
+    local out = {
+        ('-- Generated from %s. Do not edit.\n'):format(src:match('[^/]*$')),
+        '\n_ENV = module(...)\n\nlocal asm = require \'hardware.pio.asm\'\n',
+    }
+    local cnt = 0
+    for _, name in ipairs(sorted_keys(progs)) do
+        local prog = progs[name]
+        if not asm.is_program(prog) then
+            raise("%s: %s is not a PIO program", src, name)
+        end
+        table.insert(out, ('\n%s = %s\n'):format(name, format_program(prog)))
+        cnt = cnt + 1
+    end
+    printf("%s: %d PIO programs\n", mod, cnt)
+    write_file(output, table.concat(out))
+end
+
 -- Dispatch to the selected sub-command.
 function main()
     local cmd = arg[1]
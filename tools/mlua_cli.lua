@@ -5,6 +5,7 @@ _ENV = module(...)
 
 local io = require 'io'
 local math = require 'math'
+local bits = require 'mlua.bits'
 local block_mem = require 'mlua.block.mem'
 local cli = require 'mlua.cli'
 local fs = require 'mlua.fs'
@@ -265,6 +266,25 @@ local function fs_op_rename(efs, old, new)
     check(efs:rename(old, new))
 end
 
+-- Compile the Lua source files below path to bytecode files, for use by
+-- mlua.fs.loader. The header identifies the source by its size and CRC-32.
+local function fs_op_compile(efs, path, opts)
+    walk(efs, path, function(path, type, size)
+        if type == fs.TYPE_DIR or not path:find('%.lua$') then return end
+        printf("Compiling %s\n", path)
+        local src = ''
+        if size > 0 then
+            local f<close> = check(efs:open(path, fs.O_RDONLY))
+            src = check(f:read(size))
+        end
+        local chunk = check(load(src, '@' .. path, 't'))
+        local f<close> = check(efs:open(path .. 'c',
+                                        fs.O_WRONLY | fs.O_CREAT | fs.O_TRUNC))
+        check(f:write(string.pack('<c4I4I4', 'MLBC', #src, bits.crc32(src))))
+        check(f:write(string.dump(chunk, opts.strip)))
+    end)
+end
+
 local fs_ops = {
     list = {fs_op_list, 1},
     read = {fs_op_read, 2},
@@ -272,6 +292,7 @@ local fs_ops = {
     mkdir = {fs_op_mkdir, 1},
     remove = {fs_op_remove, 1},
     rename = {fs_op_rename, 2},
+    compile = {fs_op_compile, 1},
 }
 
 local function count_true(values)
@@ -291,6 +312,7 @@ local function cmd_fs(opts, args)
         -- Options
         format = cli.bool_opt(false),
         block_size = cli.num_opt(4096),
+        strip = cli.bool_opt(false),
         picotool = cli.str_opt('picotool'),
         -- TODO: --label, --reboot, --help
     })
@@ -343,7 +365,9 @@ local function cmd_fs(opts, args)
         if i + nargs > #args + 1 then
             raise("%s: not enough arguments", args[i])
         end
-        fn(efs, table.unpack(args, i, i + nargs - 1))
+        local fargs = {table.unpack(args, i, i + nargs - 1)}
+        fargs[nargs + 1] = opts
+        fn(efs, table.unpack(fargs, 1, nargs + 1))
         i = i + nargs
     end
 
@@ -5,6 +5,7 @@
 import argparse
 from concurrent import futures
 import contextlib
+import http.client
 import os.path
 import re
 import socket
@@ -245,6 +246,21 @@ class ControlHandler(socketserver.StreamRequestHandler):
         finally:
             conn.shutdown(socket.SHUT_RD)
 
+    def cmd_http(self, lport, rport, *paths):
+        rport = int(rport)
+        conn = http.client.HTTPConnection(self.client_address[0], rport,
+                                          timeout=1)
+        try:
+            for path in paths:
+                conn.request('GET', path, headers={'Accept-Encoding': 'gzip'})
+                resp = conn.getresponse()
+                body = resp.read()
+                enc = resp.getheader('Content-Encoding', '-')
+                self.w.write(
+                    f'RESP {resp.status} {enc} {len(body)} {sum(body)}\n')
+        finally:
+            conn.close()
+
     def cmd_udp(self, lport, rport, size, count, interval):
         rport, size = int(rport), int(size)
         count, interval = int(count), int(interval)